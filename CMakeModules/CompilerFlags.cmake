@@ -14,9 +14,62 @@ enable_if_supported(COMPILER_FLAGS_THIRD_PARTY "-Wno-shorten-64-to-32")
 enable_if_supported(COMPILER_FLAGS_THIRD_PARTY "/wd4244")
 enable_if_supported(COMPILER_FLAGS_THIRD_PARTY "/wd4267")
 
-enable_if_links(LINK_FLAGS_RELEASE "-flto")
 enable_if_links(LINK_FLAGS "-fuse-ld=gold")
 
+# Link time optimization of release builds. CMake picks the flavour: ThinLTO
+# with clang, LTCG with MSVC and full LTO with gcc. This used to be a bare
+# -flto at link time, which doesn't do anything without it at compile time.
+option(ENABLE_LTO "Link time optimization for release builds" ON)
+if(ENABLE_LTO)
+  if(CMAKE_VERSION VERSION_LESS 3.9)
+    message(STATUS "Link time optimization needs CMake 3.9")
+  else()
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT LTO_SUPPORTED OUTPUT LTO_ERROR LANGUAGES C CXX)
+    if(LTO_SUPPORTED)
+      set(CMAKE_INTERPROCEDURAL_OPTIMIZATION_RELEASE ON)
+      set(CMAKE_INTERPROCEDURAL_OPTIMIZATION_RELWITHDEBINFO ON)
+    else()
+      message(STATUS "Link time optimization is not supported: ${LTO_ERROR}")
+    endif()
+  endif()
+endif()
+
+# Profile guided optimization, see scripts/pgo-train.sh. Build with GENERATE,
+# train the binary, then reconfigure the same build directory with USE. gcc
+# finds the profiles by the path of the object files.
+set(PGO "" CACHE STRING "Profile guided optimization, GENERATE or USE")
+set(PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Where PGO profiles are written and read")
+
+if(PGO STREQUAL "GENERATE")
+  if(MSVC)
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} /GL")
+    set(LINK_FLAGS "${LINK_FLAGS} /LTCG /GENPROFILE:PGD=${PGO_PROFILE_DIR}/pmp.pgd")
+  elseif(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} -fprofile-generate=${PGO_PROFILE_DIR}")
+    set(LINK_FLAGS "${LINK_FLAGS} -fprofile-generate=${PGO_PROFILE_DIR}")
+  else()
+    # the player and the web engine count from many threads
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} -fprofile-generate=${PGO_PROFILE_DIR} -fprofile-update=atomic")
+    set(LINK_FLAGS "${LINK_FLAGS} -fprofile-generate=${PGO_PROFILE_DIR}")
+  endif()
+  message(STATUS "Building with PGO instrumentation, profiles go to ${PGO_PROFILE_DIR}")
+elseif(PGO STREQUAL "USE")
+  # Functions without a profile, like the benchmarks left out of the release
+  # build, are just optimized as usual.
+  if(MSVC)
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} /GL")
+    set(LINK_FLAGS "${LINK_FLAGS} /LTCG /USEPROFILE:PGD=${PGO_PROFILE_DIR}/pmp.pgd")
+  elseif(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} -fprofile-use=${PGO_PROFILE_DIR}/default.profdata -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date")
+  else()
+    set(COMPILER_FLAGS "${COMPILER_FLAGS} -fprofile-use=${PGO_PROFILE_DIR} -fprofile-correction -Wno-missing-profile")
+  endif()
+  message(STATUS "Building with the PGO profiles in ${PGO_PROFILE_DIR}")
+elseif(NOT PGO STREQUAL "")
+  message(FATAL_ERROR "PGO needs to be GENERATE or USE, not ${PGO}")
+endif()
+
 set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${COMPILER_FLAGS}")
 set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${COMPILER_FLAGS}")
 set(CMAKE_EXE_LINKER_FLAGS "${CMAKE_EXE_LINKER_FLAGS} ${LINK_FLAGS}")
@@ -13,6 +13,12 @@ endif()
 if(LINUX_X11POWER)
   add_definitions(-DUSE_X11POWER)
   Message(STATUS "Enabling X11/XDG screensaver management")
+  if(X11_FOUND AND X11_Xscreensaver_FOUND)
+    include_directories(${X11_Xscreensaver_INCLUDE_PATH})
+    set(X11_LIBRARIES ${X11_LIBRARIES} ${X11_X11_LIB} ${X11_Xscreensaver_LIB})
+    add_definitions(-DHAVE_XSS)
+    Message(STATUS "Using the X11 screensaver extension")
+  endif()
 else()
   add_definitions(-DLINUX_DBUS=1)
   Message(STATUS "Enabling D-Bus power management")
@@ -61,6 +61,12 @@ foreach(COMP ${components})
 	list(APPEND QT5_CFLAGS ${${mod}_EXECUTABLE_COMPILE_FLAGS})
 endforeach(COMP ${components})
 
+# only the test target links QtTest, so it's not in QT5_LIBRARIES
+if(ENABLE_TESTS)
+	set(Qt5Test_DIR ${QTCONFIGROOT}Test)
+	find_package(Qt5Test ${REQUIRED_QT_VERSION} REQUIRED)
+endif(ENABLE_TESTS)
+
 if(QT5_CFLAGS)
 	list(REMOVE_DUPLICATES QT5_CFLAGS)
   if(WIN32)
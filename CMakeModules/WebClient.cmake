@@ -2,6 +2,7 @@ include(FetchDependencies)
 
 option(WEB_CLIENT_TV_OLD "" OFF)
 option(WEB_CLIENT_DISABLE_DESKTOP "" OFF)
+option(WEB_CLIENT_PRECOMPRESS "Ship gzip and brotli variants of the web client assets" ON)
 
 # This is the line to edit when you bump the web-client.
 set(WEB_CLIENT_BUILD_ID 159-65a90631b12c68)
@@ -39,3 +40,32 @@ download_deps("web-client-tv"
               BASE_URL "https://artifacts.plex.tv/web-client-pmp/${WEB_CLIENT_BUILD_ID}"
               DIRECTORY WEB_TV_DIR
 )
+
+# Store .gz and .br files next to the text assets, the web server hands them out
+# to clients that accept them instead of compressing anything at runtime.
+function(precompress_web_client DIRECTORY)
+  find_program(GZIP_EXECUTABLE gzip)
+  find_program(BROTLI_EXECUTABLE brotli)
+
+  if(NOT GZIP_EXECUTABLE AND NOT BROTLI_EXECUTABLE)
+    message(STATUS "Neither gzip nor brotli found, not precompressing the web client")
+    return()
+  endif()
+
+  file(GLOB_RECURSE _ASSETS ${DIRECTORY}/*.js ${DIRECTORY}/*.css ${DIRECTORY}/*.html ${DIRECTORY}/*.svg ${DIRECTORY}/*.json)
+  foreach(_ASSET ${_ASSETS})
+    if(GZIP_EXECUTABLE AND ${_ASSET} IS_NEWER_THAN ${_ASSET}.gz)
+      execute_process(COMMAND ${GZIP_EXECUTABLE} -9 -n -k -f ${_ASSET})
+    endif()
+    if(BROTLI_EXECUTABLE AND ${_ASSET} IS_NEWER_THAN ${_ASSET}.br)
+      execute_process(COMMAND ${BROTLI_EXECUTABLE} -q 11 -k -f ${_ASSET})
+    endif()
+  endforeach()
+endfunction()
+
+if(WEB_CLIENT_PRECOMPRESS)
+  precompress_web_client(${WEB_TV_DIR})
+  if(NOT WEB_CLIENT_DISABLE_DESKTOP)
+    precompress_web_client(${WEB_DESKTOP_DIR})
+  endif()
+endif()
@@ -8,4 +8,5 @@ find_library(VERLIB version)
 find_library(DWMLIB dwmapi)
 find_library(AVRTLIB avrt)
 find_library(POWRPROFLIB PowrProf)
-set(OS_LIBS ${WINMM} ${IMMLIB} ${VERLIB} ${DWMLIB} ${AVRTLIB} ${POWRPROFLIB})
+find_library(IPHLPAPILIB iphlpapi)
+set(OS_LIBS ${WINMM} ${IMMLIB} ${VERLIB} ${DWMLIB} ${AVRTLIB} ${POWRPROFLIB} ${IPHLPAPILIB})
@@ -40,6 +40,15 @@ QHttpServer::listen(const QHostAddress& address, quint16 port, const qhttp::serv
     return d->itcpServer->listen(address, port);
 }
 
+bool
+QHttpServer::listenDescriptor(qintptr socketDescriptor, const qhttp::server::TServerHandler& handler) {
+    Q_D(QHttpServer);
+
+    d->initialize(ETcpSocket, this);
+    d->ihandler = handler;
+    return d->itcpServer->setSocketDescriptor(socketDescriptor);
+}
+
 bool
 QHttpServer::isListening() const {
     const Q_D(QHttpServer);
@@ -59,6 +59,15 @@ public:
         return listen(QHostAddress::Any, port);
     }
 
+    /** starts a TCP server on an already listening socket, like one passed in by
+     *  systemd socket activation.
+     * @param socketDescriptor the listening socket, the server takes it over.
+     * @param handler optional server handler (a lambda, std::function, ...)
+     * @return false if the descriptor can't be used.
+     */
+    bool        listenDescriptor(qintptr socketDescriptor,
+                                 const TServerHandler& handler = nullptr);
+
     /** returns true if server successfully listens. @sa listen() */
     bool        isListening() const;
 
@@ -13,6 +13,9 @@
 # virtual file name. If the real path is a directory, the directory is
 # scanned recursively, and all files are added, using the virtual path as
 # prefix.
+#
+# Files under UNCOMPRESSED_PREFIXES are stored as they are, so they can be read
+# in place (see AssetView) instead of being expanded into the heap every time.
 
 import sys
 import os
@@ -24,6 +27,9 @@ if len(sys.argv) < 2:
 
 result = "<RCC>\n"
 
+# read at startup or handed to mpv, or compressed already
+UNCOMPRESSED_PREFIXES = ["/settings/", "/inputmaps/", "/sounds/", "/testmedia/", "/images/", "ui/"]
+
 def add_files(virtualpath, filepath):
   global result
 
@@ -33,9 +39,13 @@ def add_files(virtualpath, filepath):
       add_files(os.path.join(virtualpath, item), os.path.join(filepath, item))
   else:
     dirname, fname = os.path.split(virtualpath)
+    # a threshold no compression can reach keeps rcc from compressing
+    attributes = ""
+    if any(virtualpath.startswith(prefix) for prefix in UNCOMPRESSED_PREFIXES):
+      attributes = ' threshold="100"'
     result += (('<qresource prefix=\"%s\">\n' +
-                ' <file alias=\"%s\">%s</file>\n' +
-                '</qresource>\n') % (dirname, fname, filepath))
+                ' <file alias=\"%s\"%s>%s</file>\n' +
+                '</qresource>\n') % (dirname, fname, attributes, filepath))
 
 for item in sys.argv[2:]:
   virtualpath, filepath = item.split("=", 1)
@@ -0,0 +1,161 @@
+#!/usr/bin/python -u
+#
+# This compiles settings_description.json into the C++ tables of
+# src/settings/SettingsDescription.h, so the description doesn't have to be
+# parsed at startup.
+#
+# Usage:
+#
+#  build-settings-description.py settings_description.json output.h
+#
+# Lines starting with // are comments, like for the JSON files read at
+# runtime. Entries the old parser skipped (values without "value" or
+# "default", possible values with less than two elements) are left out.
+
+import sys
+import json
+import io
+
+if len(sys.argv) != 3:
+  sys.exit(1)
+
+# json gives unicode strings with Python 2, str with Python 3
+try:
+  string_types = basestring
+  text = unicode
+except NameError:
+  string_types = str
+  text = str
+
+PLATFORMS = {
+  "osx": "PLATFORM_OSX",
+  "windows": "PLATFORM_WINDOWS",
+  "linux": "PLATFORM_LINUX",
+  "oe": "PLATFORM_OE",
+  "oe_rpi": "PLATFORM_OE_RPI",
+  "oe_x86": "PLATFORM_OE_X86",
+  "any": "PLATFORM_ANY",
+}
+
+def c_string(value):
+  if value is None:
+    return "nullptr"
+  out = '"'
+  for byte in bytearray(value.encode("utf-8")):
+    char = chr(byte)
+    if char in '"\\':
+      out += "\\" + char
+    elif 32 <= byte < 127:
+      out += char
+    else:
+      # three octal digits, so the next character can't be taken as part of it
+      out += "\\%03o" % byte
+  return out + '"'
+
+def c_bool(value):
+  return "true" if value else "false"
+
+def platform_list(value):
+  names = value if isinstance(value, list) else [value]
+  return [PLATFORMS.get(name, "PLATFORM_UNKNOWN") for name in names if isinstance(name, string_types)]
+
+def platform_mask(obj):
+  if not isinstance(obj, dict):
+    return "PLATFORM_ANY"
+  if "platforms" in obj:
+    platforms = platform_list(obj["platforms"])
+    return "(" + (" | ".join(platforms) if platforms else "PLATFORM_UNKNOWN") + ")"
+  if "platforms_excluded" in obj and isinstance(obj["platforms_excluded"], list):
+    platforms = platform_list(obj["platforms_excluded"])
+    if platforms:
+      return "PLATFORM_ANY_EXCEPT(" + " | ".join(platforms) + ")"
+  return "PLATFORM_ANY"
+
+def variant(value):
+  if isinstance(value, bool):
+    return "{ SD_TYPE_BOOL, %s, nullptr }" % ("1" if value else "0")
+  if isinstance(value, (int, float)):
+    return "{ SD_TYPE_NUMBER, %r, nullptr }" % float(value)
+  if isinstance(value, string_types):
+    return "{ SD_TYPE_STRING, 0, %s }" % c_string(value)
+  if value is None:
+    return "{ SD_TYPE_NULL, 0, nullptr }"
+  # arrays and objects as is, QJsonDocument turns them back into a QVariant
+  return "{ SD_TYPE_JSON, 0, %s }" % c_string(json.dumps(value, separators=(",", ":")))
+
+with io.open(sys.argv[1], encoding="utf-8") as f:
+  source = "".join(line for line in f if not line.lstrip().startswith("//"))
+
+description = json.loads(source)
+
+version = -1
+sections, values, defaults, options = [], [], [], []
+
+for section in description:
+  if not isinstance(section, dict) or "section" not in section:
+    sys.exit("%s: sections need to be objects with a section keyword" % sys.argv[1])
+
+  if section["section"] == "__meta__":
+    version = int(section.get("version", -1))
+    continue
+
+  if not isinstance(section.get("values"), list):
+    sys.stderr.write("section %s has no values array, skipping it\n" % section["section"])
+    continue
+
+  first_value = len(values)
+  for value in section["values"]:
+    if not isinstance(value, dict) or "value" not in value or "default" not in value or value["value"] is None:
+      continue
+
+    first_default = len(defaults)
+    if isinstance(value["default"], list):
+      # whichever matches the current platform first is used
+      for entry in value["default"]:
+        if isinstance(entry, dict):
+          defaults.append("{ %s, %s }" % (variant(entry.get("value")), platform_mask(entry)))
+    else:
+      defaults.append("{ %s, PLATFORM_ANY }" % variant(value["default"]))
+
+    first_option = len(options)
+    for option in value.get("possible_values", []):
+      if not isinstance(option, list) or len(option) < 2:
+        continue
+      platforms = platform_mask(option[2]) if len(option) == 3 and isinstance(option[2], dict) else "PLATFORM_ANY"
+      options.append("{ %s, %s, %s }" % (variant(option[0]), c_string(text(option[1])), platforms))
+
+    values.append("{ %s, %s, %s, %s, %d, %d, %d, %d }" % (
+      c_string(text(value["value"])), platform_mask(value), c_bool(value.get("hidden", False)),
+      c_string(value.get("input_type")), first_default, len(defaults) - first_default,
+      first_option, len(options) - first_option))
+
+  sections.append("{ %s, %s, %s, %s, %d, %d }" % (
+    c_string(section["section"]), platform_mask(section), c_bool(section.get("hidden", False)),
+    c_bool(section.get("storage", False)), first_value, len(values) - first_value))
+
+def table(kind, name, entries):
+  # zero sized arrays aren't allowed, the counts never reach the placeholder
+  rows = entries if entries else ["{}"]
+  return "static constexpr %s %s[] =\n{\n  %s\n};\n\n" % (kind, name, ",\n  ".join(rows))
+
+result = "// Generated from settings_description.json by scripts/build-settings-description.py, don't edit.\n\n"
+result += "#define SETTINGS_DESCRIPTION_VERSION %d\n\n" % version
+result += table("SettingsDescriptionDefault", "g_settingsDefaults", defaults)
+result += table("SettingsDescriptionOption", "g_settingsOptions", options)
+result += table("SettingsDescriptionValue", "g_settingsValues", values)
+result += table("SettingsDescriptionSection", "g_settingsSections", sections)
+
+# the table is plain ASCII, written as bytes so both Python versions take it
+if not isinstance(result, bytes):
+  result = result.encode("utf-8")
+
+# only touch the output if it changed, everything including it would be rebuilt otherwise
+try:
+  with io.open(sys.argv[2], "rb") as f:
+    if f.read() == result:
+      sys.exit(0)
+except IOError:
+  pass
+
+with io.open(sys.argv[2], "wb") as f:
+  f.write(result)
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Runs the benchmark workloads on a player built with -DPGO=GENERATE and
+# -DENABLE_BENCHMARKS=on, so the profiles cover what the player spends its time
+# on: startup, mpv event handling during playback and the HTTP server under
+# timeline load. Afterwards reconfigure the same build directory with
+# -DPGO=USE and build again.
+#
+# usage: pgo-train.sh <build dir> [playback list]
+#
+# The playback list is the one --benchmark-playback takes, without it playback
+# isn't trained. Run this on the hardware the build is meant for.
+
+set -e
+
+BUILD=$1
+PLAYBACK_LIST=$2
+
+if [ -z "$BUILD" ]; then
+  echo "usage: $0 <build dir> [playback list]"
+  exit 1
+fi
+
+PLAYER=$(find "$BUILD/src" -maxdepth 3 -type f -perm -u+x \( -name plexmediaplayer -o -name PlexMediaPlayer \) | head -n 1)
+PROFILE_DIR=$(sed -n 's/^PGO_PROFILE_DIR:PATH=//p' "$BUILD/CMakeCache.txt")
+
+if [ -z "$PLAYER" ] || [ -z "$PROFILE_DIR" ]; then
+  echo "$BUILD doesn't look like a build with PGO=GENERATE"
+  exit 1
+fi
+
+# profiles of an older binary would only be mixed in
+rm -rf "$PROFILE_DIR"
+mkdir -p "$PROFILE_DIR"
+
+echo "Training startup"
+for i in 1 2 3; do
+  "$PLAYER" --benchmark-startup cold > /dev/null
+  "$PLAYER" --benchmark-startup warm > /dev/null
+done
+
+if [ -n "$PLAYBACK_LIST" ]; then
+  echo "Training playback"
+  "$PLAYER" --benchmark-playback "$PLAYBACK_LIST" > /dev/null
+fi
+
+TIMELINE_LOAD="$BUILD/src/tools/timeline-load/timeline-load"
+if [ -x "$TIMELINE_LOAD" ]; then
+  echo "Training the HTTP server"
+  "$PLAYER" --benchmark-timeline 20 > /dev/null &
+  PLAYER_PID=$!
+  sleep 10
+  "$TIMELINE_LOAD" --subscribers 10 --pollers 10 --duration 60 > /dev/null
+  # the profile is written when the player exits normally, which it does on SIGTERM
+  kill -TERM $PLAYER_PID
+  wait $PLAYER_PID || true
+fi
+
+# clang writes raw profiles that have to be merged first, gcc reads its .gcda files as they are
+if ls "$PROFILE_DIR"/*.profraw > /dev/null 2>&1; then
+  LLVM_PROFDATA=${LLVM_PROFDATA:-llvm-profdata}
+  "$LLVM_PROFDATA" merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "Done, now run: cmake -DPGO=USE $BUILD && cmake --build $BUILD"
@@ -1,9 +1,46 @@
-
+// Precompiled for the main target with ENABLE_PCH, see src/CMakeLists.txt.
+// Only headers that are stable and used all over belong here, anything that
+// changes often would rebuild everything with it.
 #if defined(__cplusplus)
 #include <Qt>
 #include <QString>
+#include <QStringList>
+#include <QByteArray>
 #include <QList>
+#include <QHash>
+#include <QMap>
 #include <QVariant>
 #include <QObject>
 #include <QWidget>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QCoreApplication>
+#include <QGuiApplication>
+
+// QtNetwork
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QLocalSocket>
+#include <QUdpSocket>
+
+// QtQuick and QML
+#include <QQuickWindow>
+#include <QQuickItem>
+#include <QQmlApplicationEngine>
+#include <QQmlContext>
+
+// QtWebEngine
+#include <QtWebEngine/qtwebengineglobal.h>
+
+// bundled libraries
+#include "qhttpserver.hpp"
+#include "qhttpserverrequest.hpp"
+#include "qhttpserverresponse.hpp"
+#include "QsLog.h"
 #endif
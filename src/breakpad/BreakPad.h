@@ -3,6 +3,39 @@
 
 #include <QString>
 
+#include <stddef.h>
+#include <stdint.h>
+
+// What the crash dumps contain. The thread stacks are always there, the heap
+// profile adds memory referenced from them where the backend can do that.
+enum BreakPadDumpProfile
+{
+  BREAKPAD_DUMP_STACKS,
+  BREAKPAD_DUMP_STACKS_HEAP
+};
+
 void installBreakPadHandler(const QString& name, const QString& destPath);
+// Re-installs the handler if it's installed already.
+void setBreakPadDumpProfile(BreakPadDumpProfile profile);
+
+// Writes a dump of the running process with the stacks of all threads to destPath, without
+// crashing and whether the handler is installed or not. Returns the path of the dump, or an
+// empty string if it couldn't be written.
+QString writeBreakPadSnapshot(const QString& destPath);
+
+// Crash fingerprints are written as <dump id>.sig next to the dump, in the form
+// "<hash> <module>+<offset>". The helper uses them to skip duplicate uploads.
+#define BREAKPAD_FINGERPRINT_EXT ".sig"
+
+// FNV-1a, safe to use from the crash handlers.
+static inline uint64_t BreakPad_Hash(uint64_t hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+}
+
+#define BREAKPAD_HASH_SEED 14695981039346656037ULL
 
 #endif
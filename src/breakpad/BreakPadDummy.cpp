@@ -5,3 +5,12 @@ void installBreakPadHandler(const QString& name, const QString& destPath)
 {
   QLOG_WARN() << "No crash reporting compiled.";
 }
+
+void setBreakPadDumpProfile(BreakPadDumpProfile profile)
+{
+}
+
+QString writeBreakPadSnapshot(const QString& destPath)
+{
+  return QString();
+}
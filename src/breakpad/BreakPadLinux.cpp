@@ -1,9 +1,172 @@
 #include <client/linux/handler/exception_handler.h>
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
 #include "BreakPad.h"
 
+// Limits the dump when only the stacks are wanted; breakpad shortens the thread
+// stacks it includes to stay below it.
+#define BREAKPAD_STACKS_SIZE_LIMIT (1024 * 1024)
+
+static google_breakpad::ExceptionHandler* g_handler = nullptr;
+static std::string g_destPath;
+static BreakPadDumpProfile g_profile = BREAKPAD_DUMP_STACKS;
+
+// Filled in by the crash handler, written next to the dump once it exists.
+static char g_fingerprint[PATH_MAX + 64];
+static size_t g_fingerprintLength = 0;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Everything from here until the handler installation runs in the crashed process, so
+// no allocations and only async signal safe calls (dladdr is the exception, but it's
+// what everyone does).
+static size_t appendString(char* buffer, size_t pos, size_t size, const char* str)
+{
+  while (*str && pos + 1 < size)
+    buffer[pos++] = *str++;
+  buffer[pos] = '\0';
+  return pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static size_t appendHex(char* buffer, size_t pos, size_t size, uint64_t value)
+{
+  char digits[17];
+  int count = 0;
+  do
+  {
+    digits[count++] = "0123456789abcdef"[value & 0xf];
+    value >>= 4;
+  } while (value);
+
+  while (count > 0 && pos + 1 < size)
+    buffer[pos++] = digits[--count];
+  buffer[pos] = '\0';
+  return pos;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static uintptr_t crashAddress(const ucontext_t* context)
+{
+#if defined(__x86_64__)
+  return context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+  return context->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+  return context->uc_mcontext.pc;
+#elif defined(__arm__)
+  return context->uc_mcontext.arm_pc;
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool BreakPad_CrashHandler(const void* crash_context, size_t crash_context_size, void* context)
+{
+  auto crash = (const google_breakpad::ExceptionHandler::CrashContext*)crash_context;
+  uintptr_t address = crashAddress(&crash->context);
+  int signal = crash->siginfo.si_signo;
+
+  const char* module = "unknown";
+  uintptr_t offset = address;
+  Dl_info info;
+  if (address && dladdr((void*)address, &info) && info.dli_fname)
+  {
+    const char* slash = strrchr(info.dli_fname, '/');
+    module = slash ? slash + 1 : info.dli_fname;
+    offset = address - (uintptr_t)info.dli_fbase;
+  }
+
+  uint64_t hash = BreakPad_Hash(BREAKPAD_HASH_SEED, &signal, sizeof(signal));
+  hash = BreakPad_Hash(hash, module, strlen(module));
+  hash = BreakPad_Hash(hash, &offset, sizeof(offset));
+
+  size_t pos = appendHex(g_fingerprint, 0, sizeof(g_fingerprint), hash);
+  pos = appendString(g_fingerprint, pos, sizeof(g_fingerprint), " ");
+  pos = appendString(g_fingerprint, pos, sizeof(g_fingerprint), module);
+  pos = appendString(g_fingerprint, pos, sizeof(g_fingerprint), "+");
+  g_fingerprintLength = appendHex(g_fingerprint, pos, sizeof(g_fingerprint), offset);
+
+  // let breakpad write the dump
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool BreakPad_MinidumpCallback(const google_breakpad::MinidumpDescriptor& descriptor, void* context, bool succeeded)
+{
+  if (!succeeded || !g_fingerprintLength)
+    return succeeded;
+
+  // <dir>/<id>.dmp -> <dir>/<id>.sig
+  char path[PATH_MAX];
+  size_t pos = appendString(path, 0, sizeof(path), descriptor.path());
+  char* ext = strrchr(path, '.');
+  if (ext)
+    pos = ext - path;
+  appendString(path, pos, sizeof(path), BREAKPAD_FINGERPRINT_EXT);
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0)
+  {
+    ssize_t written = write(fd, g_fingerprint, g_fingerprintLength);
+    Q_UNUSED(written);
+    close(fd);
+  }
+
+  return succeeded;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool BreakPad_SnapshotCallback(const google_breakpad::MinidumpDescriptor& descriptor, void* context, bool succeeded)
+{
+  if (succeeded)
+    *(std::string*)context = descriptor.path();
+  return succeeded;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static void createHandler()
+{
+  google_breakpad::MinidumpDescriptor desc(g_destPath);
+  if (g_profile == BREAKPAD_DUMP_STACKS)
+    desc.set_size_limit(BREAKPAD_STACKS_SIZE_LIMIT);
+
+  g_handler = new google_breakpad::ExceptionHandler(desc, 0, BreakPad_MinidumpCallback, 0, true, -1);
+  g_handler->set_crash_handler(BreakPad_CrashHandler);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
 void installBreakPadHandler(const QString& name, const QString& destPath)
 {
-  google_breakpad::MinidumpDescriptor desc(destPath.toStdString());
-  new google_breakpad::ExceptionHandler(desc, 0, 0, 0, true, -1);
+  g_destPath = destPath.toStdString();
+  createHandler();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void setBreakPadDumpProfile(BreakPadDumpProfile profile)
+{
+  if (profile == g_profile)
+    return;
+
+  g_profile = profile;
+  if (g_handler)
+  {
+    delete g_handler;
+    createHandler();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString writeBreakPadSnapshot(const QString& destPath)
+{
+  std::string path;
+  if (!google_breakpad::ExceptionHandler::WriteMinidump(destPath.toStdString(), BreakPad_SnapshotCallback, &path))
+    return QString();
+  return QString::fromStdString(path);
 }
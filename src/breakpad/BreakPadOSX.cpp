@@ -9,9 +9,33 @@ static inline bool BreakPad_MinidumpCallback(const char *dump_dir, const char *m
   return succeeded;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool BreakPad_SnapshotCallback(const char *dump_dir, const char *minidump_id, void *context, bool succeeded)
+{
+  if (succeeded)
+    *(QString*)context = QString("%1/%2.dmp").arg(dump_dir, minidump_id);
+  return succeeded;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void installBreakPadHandler(const QString& name, const QString& destPath)
 {
   Q_UNUSED(name);
   new google_breakpad::ExceptionHandler(destPath.toStdString(), nullptr, BreakPad_MinidumpCallback, nullptr, true, nullptr);
 }
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void setBreakPadDumpProfile(BreakPadDumpProfile profile)
+{
+  // The mac handler writes the thread stacks only and has nothing to configure.
+  Q_UNUSED(profile);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString writeBreakPadSnapshot(const QString& destPath)
+{
+  QString path;
+  if (!google_breakpad::ExceptionHandler::WriteMinidump(destPath.toStdString(), BreakPad_SnapshotCallback, &path))
+    return QString();
+  return path;
+}
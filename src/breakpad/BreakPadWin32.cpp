@@ -1,7 +1,61 @@
 #include <client/windows/handler/exception_handler.h>
 
+#include <stdio.h>
+#include <wchar.h>
+
 #include "BreakPad.h"
 
+static google_breakpad::ExceptionHandler* g_handler = nullptr;
+static std::wstring g_destPath;
+static BreakPadDumpProfile g_profile = BREAKPAD_DUMP_STACKS;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Writes the module+offset fingerprint of the crash next to the dump.
+static void writeFingerprint(const wchar_t* dump_path, const wchar_t* minidump_id, EXCEPTION_POINTERS* exinfo)
+{
+  if (!exinfo || !exinfo->ExceptionRecord)
+    return;
+
+  DWORD code = exinfo->ExceptionRecord->ExceptionCode;
+  uintptr_t address = (uintptr_t)exinfo->ExceptionRecord->ExceptionAddress;
+
+  char module[MAX_PATH] = "unknown";
+  uintptr_t offset = address;
+  HMODULE handle;
+  if (GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         (LPCWSTR)address, &handle))
+  {
+    char fileName[MAX_PATH];
+    if (GetModuleFileNameA(handle, fileName, MAX_PATH))
+    {
+      const char* slash = strrchr(fileName, '\\');
+      strncpy_s(module, slash ? slash + 1 : fileName, _TRUNCATE);
+    }
+    offset = address - (uintptr_t)handle;
+  }
+
+  uint64_t hash = BreakPad_Hash(BREAKPAD_HASH_SEED, &code, sizeof(code));
+  hash = BreakPad_Hash(hash, module, strlen(module));
+  hash = BreakPad_Hash(hash, &offset, sizeof(offset));
+
+  char fingerprint[MAX_PATH + 64];
+  int length = _snprintf_s(fingerprint, _TRUNCATE, "%llx %s+%llx", (unsigned long long)hash, module,
+                           (unsigned long long)offset);
+
+  wchar_t path[MAX_PATH];
+  // BREAKPAD_FINGERPRINT_EXT
+  _snwprintf_s(path, _TRUNCATE, L"%s\\%s.sig", dump_path, minidump_id);
+
+  HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file != INVALID_HANDLE_VALUE)
+  {
+    DWORD written;
+    if (length > 0)
+      WriteFile(file, fingerprint, length, &written, NULL);
+    CloseHandle(file);
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 bool BreakPad_MinidumpCallback(const wchar_t* dump_path,
                                const wchar_t* minidump_id,
@@ -10,13 +64,65 @@ bool BreakPad_MinidumpCallback(const wchar_t* dump_path,
                                MDRawAssertionInfo* assertion,
                                bool succeeded)
 {
+  if (succeeded)
+    writeFingerprint(dump_path, minidump_id, exinfo);
   return succeeded;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool BreakPad_SnapshotCallback(const wchar_t* dump_path,
+                                      const wchar_t* minidump_id,
+                                      void* context,
+                                      EXCEPTION_POINTERS* exinfo,
+                                      MDRawAssertionInfo* assertion,
+                                      bool succeeded)
+{
+  if (succeeded)
+    *(QString*)context = QString("%1\\%2.dmp").arg(QString::fromWCharArray(dump_path), QString::fromWCharArray(minidump_id));
+  return succeeded;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static void createHandler()
+{
+  // MiniDumpNormal is the thread stacks and the module list. Indirectly referenced
+  // memory adds the heap objects that are pointed to from the stacks.
+  MINIDUMP_TYPE type = MiniDumpNormal;
+  if (g_profile == BREAKPAD_DUMP_STACKS_HEAP)
+    type = (MINIDUMP_TYPE)(MiniDumpNormal | MiniDumpWithIndirectlyReferencedMemory);
+
+  g_handler = new google_breakpad::ExceptionHandler(g_destPath.c_str(), NULL, BreakPad_MinidumpCallback, NULL,
+                                                    google_breakpad::ExceptionHandler::HANDLER_EXCEPTION |
+                                                    google_breakpad::ExceptionHandler::HANDLER_PURECALL,
+                                                    type, (const wchar_t*)NULL, NULL);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void installBreakPadHandler(const QString& name, const QString& destPath)
 {
-  new google_breakpad::ExceptionHandler(destPath.toStdWString().c_str(), NULL, BreakPad_MinidumpCallback, NULL,
-                                        google_breakpad::ExceptionHandler::HANDLER_EXCEPTION |
-                                        google_breakpad::ExceptionHandler::HANDLER_PURECALL);
+  g_destPath = destPath.toStdWString();
+  createHandler();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void setBreakPadDumpProfile(BreakPadDumpProfile profile)
+{
+  if (profile == g_profile)
+    return;
+
+  g_profile = profile;
+  if (g_handler)
+  {
+    delete g_handler;
+    createHandler();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString writeBreakPadSnapshot(const QString& destPath)
+{
+  QString path;
+  if (!google_breakpad::ExceptionHandler::WriteMinidump(destPath.toStdWString(), BreakPad_SnapshotCallback, &path))
+    return QString();
+  return path;
 }
@@ -9,11 +9,22 @@
 #include "Paths.h"
 #include "Version.h"
 
+// dumps waiting for the helper to upload them, older ones are removed
+#define CRASHDUMP_MAX_INCOMING 10
+
 static void setupCrashDumper()
 {
   QDir dir(Paths::cacheDir("crashdumps/incoming/" + Version::GetCanonicalVersionString()));
   dir.mkpath(dir.absolutePath());
 
+  // If the helper doesn't get to upload them, a crash loop would fill small disks.
+  QFileInfoList dumps = dir.entryInfoList(QStringList() << "*.dmp", QDir::Files, QDir::Time);
+  for (int i = CRASHDUMP_MAX_INCOMING; i < dumps.size(); i++)
+  {
+    QFile::remove(dumps[i].filePath());
+    QFile::remove(dumps[i].path() + "/" + dumps[i].completeBaseName() + BREAKPAD_FINGERPRINT_EXT);
+  }
+
 #ifdef NDEBUG
   installBreakPadHandler("Plex Media Player", dir.path());
 #else
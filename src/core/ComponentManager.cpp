@@ -1,5 +1,9 @@
 #include <QObject>
 #include <QtQml>
+#include <QElapsedTimer>
+#include <QMetaProperty>
+#include <QQuickWindow>
+#include <QTimer>
 #include <qqmlwebchannel.h>
 
 #include "ComponentManager.h"
@@ -13,6 +17,7 @@
 #include "system/UpdaterComponent.h"
 #include "settings/SettingsComponent.h"
 #include "remote/RemoteComponent.h"
+#include "ui/SlideshowComponent.h"
 
 #include "server/HTTPServer.h"
 
@@ -21,6 +26,8 @@
 #endif
 
 #include "QsLog.h"
+#include "utils/StartupTrace.h"
+#include "utils/Systemd.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ComponentManager::ComponentManager() : QObject(nullptr)
@@ -30,38 +37,81 @@ ComponentManager::ComponentManager() : QObject(nullptr)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void ComponentManager::registerComponent(ComponentBase* comp)
 {
-  if (m_components.contains(comp->componentName()))
+  if (m_registered.contains(comp->componentName()))
   {
     QLOG_ERROR() << "Component" << comp->componentName() << "already registered!";
     return;
   }
-  
-  if (comp->componentInitialize())
+
+  m_registered[comp->componentName()] = comp;
+  m_order.append(comp);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ComponentManager::initializeComponent(ComponentBase* comp, QStringList& chain)
+{
+  if (m_components.contains(comp))
+    return true;
+
+  QString name = comp->componentName();
+
+  if (chain.contains(name))
+  {
+    QLOG_ERROR() << "Circular component dependency:" << chain.join(" -> ") << "->" << name;
+    return false;
+  }
+
+  chain.append(name);
+
+  bool ok = true;
+  for (const QString& dependency : comp->componentDependencies())
   {
-    QLOG_INFO() << "Component:" << comp->componentName() << "inited";
-    m_components[comp->componentName()] = comp;
+    ComponentBase* other = m_registered.value(dependency);
+    if (!other)
+    {
+      QLOG_ERROR() << "Component" << name << "depends on unknown component" << dependency;
+      ok = false;
+    }
+    else if (!initializeComponent(other, chain))
+    {
+      ok = false;
+    }
+  }
 
-    // define component as property for qml
-    m_qmlProperyMap.insert(comp->componentName(), QVariant::fromValue(comp));
+  chain.removeLast();
+
+  if (!ok)
+  {
+    QLOG_ERROR() << "Failed to init component:" << name << "- a dependency is missing";
+    return false;
   }
-  else
+
+  QElapsedTimer timer;
+  timer.start();
+
+  StartupTrace::Begin(name, "component");
+  bool initialized = comp->componentInitialize();
+  StartupTrace::End(name, "component");
+
+  if (!initialized)
   {
-    QLOG_ERROR() << "Failed to init component:" << comp->componentName();
+    QLOG_ERROR() << "Failed to init component:" << name;
+    return false;
   }
+
+  QLOG_INFO() << "Component:" << name << "inited in" << timer.elapsed() << "ms";
+  m_components.insert(comp);
+
+  // define component as property for qml
+  m_qmlProperyMap.insert(name, QVariant::fromValue(comp));
+
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void ComponentManager::initialize()
 {
-  // then settings, since all other components
-  // might have some settings
-  //
   registerComponent(&SettingsComponent::Get());
-
-  // start our web server
-  auto server = new HttpServer(this);
-  server->start();
-
   registerComponent(&InputComponent::Get());
   registerComponent(&SystemComponent::Get());
   registerComponent(&DisplayComponent::Get());
@@ -69,23 +119,129 @@ void ComponentManager::initialize()
   registerComponent(&RemoteComponent::Get());
   registerComponent(&PlayerComponent::Get());
   registerComponent(&PowerComponent::Get());
+  registerComponent(&SlideshowComponent::Get());
 
 #if KONVERGO_OPENELEC
   registerComponent(&OESystemComponent::Get());
 #endif
 
-  for(ComponentBase* component : m_components.values())
+  // settings go first, since all other components might have some settings
+  QStringList chain;
+  initializeComponent(&SettingsComponent::Get(), chain);
+
+  // Start our web server. It listens right away, so controllers that find us early are
+  // queued by the kernel instead of refused; routes of components that aren't up yet
+  // answer 503 until they are.
+  auto server = new HttpServer(this);
+  server->start();
+
+  // the rest in registration order, unless their dependencies say otherwise
+  for (ComponentBase* component : m_order)
+  {
+    if (component->componentDeferred())
+    {
+      m_deferred.append(component);
+
+      // the web client picks up its objects once, so these are exported before they're ready
+      m_qmlProperyMap.insert(component->componentName(), QVariant::fromValue(component));
+    }
+    else
+    {
+      initializeComponent(component, chain);
+    }
+  }
+
+  // deferred components that were pulled in as a dependency are done already
+  for (ComponentBase* component : m_order)
+  {
+    if (!m_components.contains(component))
+      continue;
+
+    m_deferred.removeAll(component);
     component->componentPostInitialize();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ComponentManager::initializeDeferred(QQuickWindow* window)
+{
+  if (m_firstFrame)
+    return;
+
+  // frameSwapped comes from the render thread, the components are inited on ours
+  m_firstFrame = connect(window, &QQuickWindow::frameSwapped,
+                         this, [this]() { initializeDeferredComponents(false); }, Qt::QueuedConnection);
+
+  // A window that never renders (no usable GL, hidden on a headless box) must not keep
+  // the remote, the updater and READY=1 from happening at all.
+  QTimer::singleShot(COMPONENT_DEFERRED_TIMEOUT_MSEC, this, [this]() { initializeDeferredComponents(true); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ComponentManager::initializeDeferredComponents(bool timedOut)
+{
+  // more frames might have been queued before we got here, or the timeout came first
+  if (!disconnect(m_firstFrame))
+    return;
+
+  if (timedOut)
+    QLOG_WARN() << "No frame after" << COMPONENT_DEFERRED_TIMEOUT_MSEC << "ms, initializing the deferred components anyway";
+
+  // the first frame is up, which is what we consider the end of the startup
+  StartupTrace::End("startup");
+  StartupTrace::Begin("deferred components");
+
+  QList<ComponentBase*> deferred = m_deferred;
+  m_deferred.clear();
+
+  QStringList chain;
+  for (ComponentBase* component : deferred)
+    initializeComponent(component, chain);
+
+  for (ComponentBase* component : deferred)
+  {
+    if (m_components.contains(component))
+      component->componentPostInitialize();
+  }
+
+  StartupTrace::End("deferred components");
+  StartupTrace::Finish();
+
+  // Units ordered after us (Type=notify) start now, we're on screen and take input.
+  Systemd::Notify("READY=1");
+
+  emit deferredInitialized();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ComponentManager::isInitialized(const QString& name) const
+{
+  return m_components.contains(m_registered.value(name));
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void ComponentManager::setWebChannel(QWebChannel* webChannel)
 {
-  for(ComponentBase* comp : m_components.values())
+  for(ComponentBase* comp : m_order)
   {
+    if (!m_components.contains(comp) && !m_deferred.contains(comp))
+      continue;
+
     if (comp->componentExport())
     {
       QLOG_DEBUG() << "Adding component:" << comp->componentName() << "to webchannel";
+
+      // Signals only reach the web client if it connected to them, but the channel
+      // sends updates for every property that has a NOTIFY signal, wanted or not.
+      const QMetaObject* meta = comp->metaObject();
+      for (int i = QObject::staticMetaObject.propertyCount(); i < meta->propertyCount(); i++)
+      {
+        QMetaProperty property = meta->property(i);
+        if (property.hasNotifySignal())
+          QLOG_WARN() << "Property" << property.name() << "of component" << comp->componentName()
+                      << "has a NOTIFY signal, the web channel will push all its changes";
+      }
+
       webChannel->registerObject(comp->componentName(), comp);
     }
   }
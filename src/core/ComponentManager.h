@@ -2,13 +2,21 @@
 #define __COMPONENT_MANAGER_H__
 
 #include <QObject>
-#include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QStringList>
 #include <QQmlContext>
 #include <QQmlPropertyMap>
 #include <QWebChannel>
 
 #include "utils/Utils.h"
 
+class QQuickWindow;
+
+// deferred components are initialized after this long even if no frame was rendered
+#define COMPONENT_DEFERRED_TIMEOUT_MSEC 10000
+
 class ComponentBase : public QObject
 {
 public:
@@ -20,6 +28,13 @@ public:
 
   // executed after ALL components are initialized
   virtual void componentPostInitialize() { }
+
+  // names of the components that have to be initialized before this one
+  virtual QStringList componentDependencies() { return QStringList(); }
+
+  // if true, the component is initialized only after the main window showed its first
+  // frame. It is still exported right away, so it must cope with calls before that.
+  virtual bool componentDeferred() { return false; }
 };
 
 class ComponentManager : public QObject
@@ -29,14 +44,39 @@ class ComponentManager : public QObject
 
 public:
   void initialize();
+  // Initialize the deferred components once window has rendered its first frame, or
+  // after COMPONENT_DEFERRED_TIMEOUT_MSEC if it doesn't.
+  void initializeDeferred(QQuickWindow* window);
   inline QQmlPropertyMap &getQmlPropertyMap() { return m_qmlProperyMap; }
+  // Exported components should only have CONSTANT properties, see the check in here.
+  // The channel's transport belongs to QtWebEngine, and the other end is the
+  // qwebchannel.js of the web client, so the wire format can't be changed from
+  // here. Keep the traffic down at the source instead: high rate signals
+  // (positionUpdate, playbackSnapshot, hostInput, valuesUpdated) are coalesced
+  // where they're emitted.
   void setWebChannel(QWebChannel* webChannel);
 
+  // true once the component of that name finished componentInitialize()
+  bool isInitialized(const QString& name) const;
+
+Q_SIGNALS:
+  // All components are up, the deferred ones included.
+  void deferredInitialized();
+
 private:
   ComponentManager();
   void registerComponent(ComponentBase* comp);
+  bool initializeComponent(ComponentBase* comp, QStringList& chain);
+  void initializeDeferredComponents(bool timedOut);
 
-  QMap<QString, ComponentBase*> m_components;
+  // all registered components, initialized or not, in registration order
+  QList<ComponentBase*> m_order;
+  // by name, only for resolving componentDependencies()
+  QHash<QString, ComponentBase*> m_registered;
+  // the successfully initialized ones
+  QSet<ComponentBase*> m_components;
+  QList<ComponentBase*> m_deferred;
+  QMetaObject::Connection m_firstFrame;
   QQmlPropertyMap m_qmlProperyMap;
 };
 
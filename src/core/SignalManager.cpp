@@ -5,6 +5,8 @@
 #include "QsLog.h"
 #include "SignalManager.h"
 #include "settings/SettingsComponent.h"
+#include "utils/ProcessSampler.h"
+#include "system/SystemComponent.h"
 
 int SignalManager::g_sigtermFd[2];
 
@@ -46,6 +48,9 @@ int SignalManager::setupHandlers()
   if (sigaction(SIGUSR1, &term, nullptr) < 0)
     return -3;
 
+  if (sigaction(SIGUSR2, &term, nullptr) < 0)
+    return -4;
+
   return 0;
 }
 
@@ -68,6 +73,12 @@ void SignalManager::handleSignal()
   {
     QLOG_DEBUG() << "Received SIGUSR1, reloading config file";
     SettingsComponent::Get().load();
+    ProcessSampler::Get().dumpToLog();
+  }
+  else if (signalNumber == SIGUSR2)
+  {
+    QLOG_DEBUG() << "Received SIGUSR2, dumping diagnostics";
+    SystemComponent::Get().dumpDiagnostics();
   }
   else
   {
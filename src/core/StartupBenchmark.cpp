@@ -0,0 +1,95 @@
+#include "StartupBenchmark.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+
+#include <stdio.h>
+
+#include "ComponentManager.h"
+#include "Paths.h"
+#include "Version.h"
+#include "ui/KonvergoWindow.h"
+#include "utils/StartupTrace.h"
+
+static bool g_cold = false;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// What a cold run may wipe: QStandardPaths' test mode puts everything below a "qttest"
+// directory. Paths returns the working directory (or nothing) if it couldn't create one,
+// and that must never be removed.
+static bool isTestModePath(const QString& path)
+{
+  if (path.isEmpty())
+    return false;
+
+  QString absolute = QDir(path).absolutePath();
+  if (absolute == QDir::currentPath() || absolute == QDir::homePath() || QDir(absolute).isRoot())
+    return false;
+
+  return QDir::fromNativeSeparators(absolute).split('/').filter("qttest").size() > 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool StartupBenchmark::Prepare(const QString& mode)
+{
+  if (mode != "cold" && mode != "warm")
+  {
+    fprintf(stderr, "--benchmark-startup takes cold or warm, not %s\n", qPrintable(mode));
+    return false;
+  }
+
+  // keeps the user's own settings, caches and web storage out of it
+  QStandardPaths::setTestModeEnabled(true);
+  // anything resolved before still points at the user's directories
+  Paths::invalidateCache();
+
+  g_cold = (mode == "cold");
+  if (g_cold)
+  {
+    // The web engine keeps its storage and cache in the application specific locations.
+    QStringList dirs = {
+      Paths::dataDir(),
+      Paths::cacheDir(),
+      QStandardPaths::writableLocation(QStandardPaths::DataLocation),
+      QStandardPaths::writableLocation(QStandardPaths::CacheLocation),
+    };
+
+    for (const QString& dir : dirs)
+    {
+      if (!isTestModePath(dir))
+      {
+        fprintf(stderr, "Not wiping %s, it isn't a test mode location\n", qPrintable(dir));
+        return false;
+      }
+    }
+
+    for (const QString& dir : dirs)
+    {
+      QDir(dir).removeRecursively();
+      QDir().mkpath(dir);
+    }
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void StartupBenchmark::Start()
+{
+  KonvergoWindow::setWebUrlOverride("qrc:/misc/startup-benchmark.html");
+
+  // StartupTrace is finished right before this is emitted
+  QObject::connect(&ComponentManager::Get(), &ComponentManager::deferredInitialized, []()
+  {
+    QJsonObject result = StartupTrace::Summary();
+    result.insert("mode", g_cold ? "cold" : "warm");
+    result.insert("version", Version::GetVersionString());
+
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+    QCoreApplication::exit(EXIT_SUCCESS);
+  });
+}
@@ -0,0 +1,21 @@
+#ifndef STARTUPBENCHMARK_H
+#define STARTUPBENCHMARK_H
+
+#include <QString>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The player side of the startup benchmark, --benchmark-startup <cold|warm> in
+// ENABLE_BENCHMARKS builds. The player runs on a profile of its own (Qt's test mode
+// paths), which cold wipes first, loads a stub page instead of the web client, and
+// prints the StartupTrace phases as JSON once the first frame is up and the deferred
+// components are done, then quits. The startup-bench tool runs it repeatedly.
+namespace StartupBenchmark
+{
+  // before anything touches the settings, logs or caches
+  bool Prepare(const QString& mode);
+
+  // after the components are initialized, before the web view is loaded
+  void Start();
+}
+
+#endif // STARTUPBENCHMARK_H
@@ -5,8 +5,14 @@
 #include "settings/SettingsComponent.h"
 #include <QGuiApplication>
 #include <QWindow>
+#include <QRunnable>
 #include <math.h>
 
+// how often the display is checked for the new mode after an asynchronous switch, and how many
+// checks in a row have to report it
+#define DISPLAY_SWITCH_POLL_MSEC 100
+#define DISPLAY_SWITCH_STABLE_POLLS 3
+
 #ifdef Q_OS_MAC
 #include "osx/DisplayManagerOSX.h"
 #elif defined(TARGET_RPI)
@@ -21,17 +27,39 @@
 #include "input/InputComponent.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-DisplayComponent::DisplayComponent(QObject* parent) : ComponentBase(parent), m_initTimer(this)
+DisplayComponent::DisplayComponent(QObject* parent)
+  : ComponentBase(parent), m_initTimer(this), m_switchTimer(this)
 {
   m_displayManager = nullptr;
   m_lastVideoMode = -1;
   m_lastDisplay = -1;
   m_applicationWindow = nullptr;
+
+  m_switchDisplay = -1;
+  m_switchMode = -1;
+  m_switchStablePolls = 0;
+  m_lastRefreshRate = 0;
+  m_managerBusy = false;
+  m_revalidating = false;
+  m_switchRestore = false;
+  m_pendingFrameRate = 0;
+  m_pendingHDRFormat = DM_HDR_NONE;
+  m_switchHDRFormat = DM_HDR_NONE;
+  m_hdrFormat = DM_HDR_NONE;
+  m_hdrDisplay = -1;
+  m_windowDisplay = -1;
+  m_windowRefreshRate = 0;
+
+  m_managerPool.setMaxThreadCount(1);
+  m_switchTimer.setInterval(DISPLAY_SWITCH_POLL_MSEC);
+  connect(&m_switchTimer, &QTimer::timeout, this, &DisplayComponent::checkVideoModeStable);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 DisplayComponent::~DisplayComponent()
 {
+  // the display manager is one of our children, don't pull it away from a running switch
+  m_managerPool.waitForDone();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,9 +67,34 @@ bool DisplayComponent::initializeDisplayManager()
 {
   m_initTimer.setSingleShot(false);
 
+  if (m_managerBusy)
+  {
+    // the worker owns the display manager right now, finishVideoModeSwitch() and
+    // onVideoModesRevalidated() come back here
+    return false;
+  }
+
   bool res = false;
   if (m_displayManager)
-    res = m_displayManager->initialize();
+  {
+    QString key = m_displayManager->monitorKey();
+    if (!key.isEmpty() && key == m_displayManager->modesKey())
+    {
+      // same monitors, same modes; only the current mode may have changed, and that is
+      // always queried from the platform
+      res = true;
+    }
+    else if (!key.isEmpty() && m_displayManager->loadModeCache(key))
+    {
+      QLOG_INFO() << "Using cached display modes, re-validating them in the background.";
+      res = true;
+      revalidateVideoModes();
+    }
+    else
+    {
+      res = m_displayManager->initialize();
+    }
+  }
 
   emit refreshRateChanged();
 
@@ -51,17 +104,25 @@ bool DisplayComponent::initializeDisplayManager()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayComponent::componentInitialize()
 {
-#if 0
-  m_displayManager = new DisplayManagerDummy(this);
-#elif defined(Q_OS_MAC)
-  m_displayManager = new DisplayManagerOSX(this);
+  // displays and modes from a file instead of the real ones, see DisplayManagerDummy.h
+  QString simulation = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "debug.display_simulator").toString();
+  if (!simulation.isEmpty())
+  {
+    QLOG_INFO() << "Using the simulated displays from" << simulation;
+    m_displayManager = new DisplayManagerDummy(this, simulation);
+  }
+  else
+  {
+#if defined(Q_OS_MAC)
+    m_displayManager = new DisplayManagerOSX(this);
 #elif defined(TARGET_RPI)
-  m_displayManager = new DisplayManagerRPI(this);
+    m_displayManager = new DisplayManagerRPI(this);
 #elif defined(USE_X11XRANDR)
-  m_displayManager = new DisplayManagerX11(this);
+    m_displayManager = new DisplayManagerX11(this);
 #elif defined(Q_OS_WIN)
-  m_displayManager = new DisplayManagerWin(this);
+    m_displayManager = new DisplayManagerWin(this);
 #endif
+  }
 
   if (initializeDisplayManager())
   {
@@ -101,18 +162,18 @@ void DisplayComponent::monitorChange()
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
-bool DisplayComponent::switchToBestVideoMode(float frameRate)
+int DisplayComponent::findBestVideoMode(float frameRate, int hdrFormat, int& display)
 {
   initializeDisplayManager();
 
   if (!m_displayManager)
-    return false;
+    return -1;
 
   int currentDisplay = getApplicationDisplay();
   if (currentDisplay < 0)
   {
     QLOG_INFO() << "Not switching rate - current display not found.";
-    return false;
+    return -1;
   }
 
   int currentMode = m_displayManager->getCurrentDisplayMode(currentDisplay);
@@ -124,37 +185,316 @@ bool DisplayComponent::switchToBestVideoMode(float frameRate)
 
   QLOG_DEBUG() << "Current display:" << currentDisplay << "mode:" << currentMode;
 
-  DMMatchMediaInfo matchInfo(frameRate, false);
+  display = currentDisplay;
+
+  DMMatchMediaInfo matchInfo(frameRate, false, hdrFormat);
   int bestmode = m_displayManager->findBestMatch(currentDisplay, matchInfo);
-  if (bestmode >= 0)
+  if (bestmode < 0)
   {
-    if (bestmode != currentMode)
-    {
-      QLOG_DEBUG()
-      << "Best video matching mode is "
-      << m_displayManager->m_displays[currentDisplay]->m_videoModes[bestmode]->getPrettyName()
-      << "on display" << currentDisplay;
+    QLOG_DEBUG() << "No video mode found as better match.";
+    return -1;
+  }
 
-      if (!m_displayManager->setDisplayMode(currentDisplay, bestmode))
-      {
-        QLOG_INFO() << "Mode switching failed.";
-        return false;
-      }
-      return true;
-    }
+  if (bestmode == currentMode)
+  {
     QLOG_INFO() << "No better video mode than the currently active one found.";
+    return -1;
+  }
+
+  QLOG_DEBUG()
+  << "Best video matching mode is "
+  << m_displayManager->m_displays[currentDisplay]->m_videoModes[bestmode]->getPrettyName()
+  << "on display" << currentDisplay;
+
+  return bestmode;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+QString DisplayComponent::bestVideoModeName(float frameRate, int hdrFormat)
+{
+  initializeDisplayManager();
+
+  // the worker owns the display manager while it switches
+  if (!m_displayManager || frameRate < 1 || isSwitchingVideoMode())
+    return QString();
+
+  int display = getApplicationDisplay(true);
+  if (display < 0)
+    return QString();
+
+  DMMatchMediaInfo matchInfo(frameRate, false, hdrFormat);
+  int bestmode = m_displayManager->findBestMatch(display, matchInfo);
+  if (bestmode < 0 || bestmode == m_displayManager->getCurrentDisplayMode(display))
+    return QString();
+
+  return m_displayManager->m_displays[display]->m_videoModes[bestmode]->getPrettyName();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+int DisplayComponent::supportedHDRFormat(int display, int mode, int hdrFormat)
+{
+  if (hdrFormat == DM_HDR_NONE || hdrFormat == m_hdrFormat)
+    return DM_HDR_NONE;
+
+  if (mode < 0)
+    mode = m_displayManager->getCurrentDisplayMode(display);
+  if (!m_displayManager->isValidDisplayMode(display, mode))
+    return DM_HDR_NONE;
+
+  if (!(m_displayManager->m_displays[display]->m_videoModes[mode]->m_hdrFormats & hdrFormat))
+  {
+    QLOG_INFO() << "Display can't be switched to HDR format" << hdrFormat << "in this mode.";
+    return DM_HDR_NONE;
+  }
+
+  return hdrFormat;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayComponent::switchToBestVideoMode(float frameRate, int hdrFormat)
+{
+  if (m_managerBusy)
+  {
+    QLOG_INFO() << "Not switching rate - another mode switch is in progress.";
+    return false;
+  }
+
+  int display = -1;
+  int bestmode = findBestVideoMode(frameRate, hdrFormat, display);
+  if (display < 0)
+    return false;
+
+  hdrFormat = supportedHDRFormat(display, bestmode, hdrFormat);
+  if (bestmode < 0 && hdrFormat == DM_HDR_NONE)
+    return false;
+
+  if (bestmode >= 0 && !m_displayManager->setDisplayMode(display, bestmode))
+  {
+    QLOG_INFO() << "Mode switching failed.";
+    return false;
+  }
+
+  if (hdrFormat != DM_HDR_NONE)
+  {
+    if (m_displayManager->setHDRMode(display, hdrFormat))
+    {
+      m_hdrFormat = hdrFormat;
+      m_hdrDisplay = display;
+    }
+    else
+    {
+      QLOG_INFO() << "Switching to HDR failed.";
+    }
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+class DisplayModeSwitcher : public QRunnable
+{
+public:
+  DisplayModeSwitcher(DisplayComponent* component, DisplayManager* manager, int display, int mode, int hdrFormat)
+    : m_component(component), m_manager(manager), m_display(display), m_mode(mode), m_hdrFormat(hdrFormat) {}
+
+  void run() override
+  {
+    // XRandR, ChangeDisplaySettingsEx and CoreGraphics can all block for a while until the
+    // display has resynced, so this is kept away from the GUI thread.
+    bool success = true;
+    if (m_manager->getCurrentDisplayMode(m_display) != m_mode)
+      success = m_manager->setDisplayMode(m_display, m_mode);
+
+    // HDR is switched in the new mode, the display would drop it again otherwise
+    bool hdrSuccess = false;
+    if (success && m_hdrFormat != DM_HDR_NONE)
+      hdrSuccess = m_manager->setHDRMode(m_display, m_hdrFormat);
+
+    QMetaObject::invokeMethod(m_component, "onVideoModeSet", Qt::QueuedConnection,
+                              Q_ARG(bool, success), Q_ARG(bool, hdrSuccess));
+  }
+
+private:
+  DisplayComponent* m_component;
+  DisplayManager* m_manager;
+  int m_display;
+  int m_mode;
+  int m_hdrFormat;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+class DisplayModeValidator : public QRunnable
+{
+public:
+  DisplayModeValidator(DisplayComponent* component, DisplayManager* manager)
+    : m_component(component), m_manager(manager) {}
+
+  void run() override
+  {
+    // full enumeration, this also updates the cache if anything changed
+    bool success = m_manager->initialize();
+    QMetaObject::invokeMethod(m_component, "onVideoModesRevalidated", Qt::QueuedConnection, Q_ARG(bool, success));
+  }
+
+private:
+  DisplayComponent* m_component;
+  DisplayManager* m_manager;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::revalidateVideoModes()
+{
+  m_managerBusy = true;
+  m_revalidating = true;
+  m_managerPool.start(new DisplayModeValidator(this, m_displayManager));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::onVideoModesRevalidated(bool success)
+{
+  m_managerBusy = false;
+  m_revalidating = false;
+
+  if (!success)
+    QLOG_WARN() << "Re-validating the cached display modes failed.";
+
+  // the modes might have changed under us
+  emit refreshRateChanged();
+
+  if (m_pendingFrameRate > 0)
+  {
+    float frameRate = m_pendingFrameRate;
+    m_pendingFrameRate = 0;
+    if (!switchToBestVideoModeAsync(frameRate, m_pendingHDRFormat))
+      emit videoModeSwitched(false);
+  }
+  else if (m_switchRestore)
+  {
+    m_switchRestore = false;
+    restorePreviousVideoMode();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayComponent::switchToBestVideoModeAsync(float frameRate, int hdrFormat)
+{
+  if (isSwitchingVideoMode())
+  {
+    QLOG_INFO() << "Not switching rate - another mode switch is in progress.";
+    return false;
   }
+
+  if (m_revalidating)
+  {
+    // findBestVideoMode() needs the display manager, so decide once it's back
+    QLOG_INFO() << "Switching rate once the display modes are re-validated.";
+    m_pendingFrameRate = frameRate;
+    m_pendingHDRFormat = hdrFormat;
+    return true;
+  }
+
+  int display = -1;
+  int bestmode = findBestVideoMode(frameRate, hdrFormat, display);
+  if (display < 0)
+    return false;
+
+  hdrFormat = supportedHDRFormat(display, bestmode, hdrFormat);
+  if (bestmode < 0)
+  {
+    if (hdrFormat == DM_HDR_NONE)
+      return false;
+
+    // the current mode is fine, only HDR has to be switched on
+    bestmode = m_displayManager->getCurrentDisplayMode(display);
+  }
+
+  m_switchDisplay = display;
+  m_switchMode = bestmode;
+  m_switchHDRFormat = hdrFormat;
+  m_lastRefreshRate = m_displayManager->m_displays[display]->m_videoModes[bestmode]->m_refreshRate;
+  m_switchStablePolls = 0;
+  m_managerBusy = true;
+  m_switchElapsed.start();
+
+  m_managerPool.start(new DisplayModeSwitcher(this, m_displayManager, display, bestmode, hdrFormat));
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::onVideoModeSet(bool success, bool hdrSuccess)
+{
+  m_managerBusy = false;
+
+  QLOG_DEBUG() << "Mode switch returned after" << m_switchElapsed.elapsed() << "msec";
+
+  if (hdrSuccess)
+  {
+    m_hdrFormat = m_switchHDRFormat;
+    m_hdrDisplay = m_switchDisplay;
+  }
+  else if (m_switchHDRFormat != DM_HDR_NONE)
+  {
+    QLOG_INFO() << "Switching to HDR failed.";
+  }
+  m_switchHDRFormat = DM_HDR_NONE;
+
+  if (!success)
+  {
+    QLOG_INFO() << "Mode switching failed.";
+    finishVideoModeSwitch(false);
+    return;
+  }
+
+  m_switchTimer.start();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::checkVideoModeStable()
+{
+  // The platform call returning doesn't mean the display has resynced, so wait until the new mode
+  // has been reported back a couple of times in a row. refreshrate.delay is the upper bound.
+  if (m_displayManager->getCurrentDisplayMode(m_switchDisplay) == m_switchMode)
+    m_switchStablePolls++;
   else
+    m_switchStablePolls = 0;
+
+  if (m_switchStablePolls >= DISPLAY_SWITCH_STABLE_POLLS)
   {
-    QLOG_DEBUG() << "No video mode found as better match.";
+    QLOG_INFO() << "Display mode stable after" << m_switchElapsed.elapsed() << "msec";
+    finishVideoModeSwitch(true);
   }
+  else if (m_switchElapsed.elapsed() >= SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.delay").toInt() * 1000)
+  {
+    QLOG_INFO() << "Display didn't report a stable mode in time, continuing anyway.";
+    finishVideoModeSwitch(true);
+  }
+}
 
-  return false;
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::finishVideoModeSwitch(bool success)
+{
+  m_switchTimer.stop();
+  m_switchDisplay = -1;
+  m_switchMode = -1;
+
+  // pick up the new mode, and anything that was deferred while the switch was running
+  m_initTimer.setSingleShot(false);
+  initializeDisplayManager();
+
+  if (m_switchRestore)
+  {
+    m_switchRestore = false;
+    restorePreviousVideoMode();
+  }
+
+  emit videoModeSwitched(success);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayComponent::switchToBestOverallVideoMode(int display)
 {
+  if (m_managerBusy)
+    return false;
+
   initializeDisplayManager();
 
   if (!m_displayManager || !m_displayManager->isValidDisplay(display))
@@ -194,28 +534,72 @@ double DisplayComponent::currentRefreshRate()
   if (!m_displayManager)
     return 0;
 
+  if (m_managerBusy)
+    return m_lastRefreshRate;
+
   int currentDisplay = getApplicationDisplay();
   if (currentDisplay < 0)
     return 0;
   int mode = m_displayManager->getCurrentDisplayMode(currentDisplay);
   if (mode < 0)
     return 0;
-  return m_displayManager->m_displays[currentDisplay]->m_videoModes[mode]->m_refreshRate;
+  m_lastRefreshRate = m_displayManager->m_displays[currentDisplay]->m_videoModes[mode]->m_refreshRate;
+  return m_lastRefreshRate;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayComponent::applicationScreenChanged()
+{
+  // the switch reports the new rate itself once it's done
+  if (!m_displayManager || m_managerBusy || isSwitchingVideoMode())
+    return;
+
+  int display = getApplicationDisplay(true);
+  if (display < 0)
+    return;
+
+  float rate = (float)currentRefreshRate();
+  if (display == m_windowDisplay && rate == m_windowRefreshRate)
+    return;
+
+  m_windowDisplay = display;
+  m_windowRefreshRate = rate;
+
+  QLOG_INFO() << "Window is on" << displayName(display) << "at" << rate << "Hz";
+  emit refreshRateChanged();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayComponent::restorePreviousVideoMode()
 {
+  if (isSwitchingVideoMode() || m_managerBusy)
+  {
+    QLOG_DEBUG() << "Restoring video mode once the display manager is idle.";
+    m_switchRestore = true;
+    return true;
+  }
+
   initializeDisplayManager();
 
   if (!m_displayManager)
     return false;
 
-  if (!m_displayManager->isValidDisplayMode(m_lastDisplay, m_lastVideoMode))
-    return false;
-
   bool ret = true;
 
+  // back to SDR first, the previous mode might not support HDR at all
+  if (m_hdrFormat != DM_HDR_NONE)
+  {
+    QLOG_DEBUG() << "Restoring SDR on display" << m_hdrDisplay;
+
+    ret = m_displayManager->setHDRMode(m_hdrDisplay, DM_HDR_NONE);
+    m_hdrFormat = DM_HDR_NONE;
+    m_hdrDisplay = -1;
+    emit refreshRateChanged();
+  }
+
+  if (!m_displayManager->isValidDisplayMode(m_lastDisplay, m_lastVideoMode))
+    return ret;
+
   if (m_displayManager->getCurrentDisplayMode(m_lastDisplay) != m_lastVideoMode)
   {
     QLOG_DEBUG()
@@ -223,7 +607,7 @@ bool DisplayComponent::restorePreviousVideoMode()
     << m_displayManager->m_displays[m_lastDisplay]->m_videoModes[m_lastVideoMode]->getPrettyName()
     << "on display" << m_lastDisplay;
 
-    ret =  m_displayManager->setDisplayMode(m_lastDisplay, m_lastVideoMode);
+    ret = m_displayManager->setDisplayMode(m_lastDisplay, m_lastVideoMode) && ret;
   }
 
   m_lastVideoMode = -1;
@@ -239,7 +623,7 @@ int DisplayComponent::getApplicationDisplay(bool silent)
   QWindow* activeWindow = m_applicationWindow;
 
   int display = -1;
-  if (activeWindow && m_displayManager)
+  if (activeWindow && m_displayManager && !m_managerBusy)
   {
     if (!silent)
     {
@@ -291,6 +675,14 @@ QString DisplayComponent::debugInformation()
   {
     stream << "  (no DisplayManager initialized)" << endl;
   }
+  else if (m_revalidating)
+  {
+    stream << "  (re-validating cached display modes)" << endl;
+  }
+  else if (m_managerBusy)
+  {
+    stream << "  Switching to mode: " << modePretty(m_switchDisplay, m_switchMode) << endl;
+  }
   else
   {
     int display = getApplicationDisplay(true);
@@ -304,6 +696,10 @@ QString DisplayComponent::debugInformation()
       stream << "  Switch back on screen: " << displayName(m_lastDisplay) << endl;
       stream << "  Switch back to mode: " << modePretty(m_lastDisplay, m_lastVideoMode) << endl;
     }
+
+    auto simulator = qobject_cast<DisplayManagerDummy*>(m_displayManager);
+    if (simulator)
+      stream << "  Simulated switches: " << simulator->switches().size() << endl;
   }
 
   stream << endl;
@@ -331,6 +727,12 @@ void DisplayComponent::switchCommand(QString command)
     return;
   }
 
+  if (isSwitchingVideoMode() || m_managerBusy)
+  {
+    QLOG_ERROR() << "The display manager is busy";
+    return;
+  }
+
   if (!initializeDisplayManager())
   {
     QLOG_ERROR() << "Could not reinitialize display manager";
@@ -444,8 +846,8 @@ void DisplayComponent::switchCommand(QString command)
 /////////////////////////////////////////////////////////////////////////////////////////
 void DisplayComponent::componentPostInitialize()
 {
-  InputComponent::Get().registerHostCommand("switch", this, "switchCommand");
+  InputComponent::Get().registerHostCommand("switch", this, &DisplayComponent::switchCommand);
 
   if (m_displayManager)
-    InputComponent::Get().registerHostCommand("recreateRpiUI", m_displayManager, "resetRendering");
+    InputComponent::Get().registerHostCommand("recreateRpiUI", m_displayManager, &DisplayManager::resetRendering);
 }
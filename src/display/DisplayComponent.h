@@ -5,6 +5,8 @@
 #include "ComponentManager.h"
 #include <QScreen>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QThreadPool>
 
 class DisplayComponent : public ComponentBase
 {
@@ -17,6 +19,7 @@ public:
   const char* componentName() override { return "display"; }
   bool componentExport() override { return true; }
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings" }; }
   void componentPostInitialize() override;
 
   inline DisplayManager* getDisplayManager() { return m_displayManager; }
@@ -27,7 +30,25 @@ public:
   // Switch to the best video mode for the given video framerate. Return true only if the actual
   // mode was switched. If a good match was found, but the current video mode didn't have to be
   // changed, return false. Return false on failure too.
-  bool switchToBestVideoMode(float frameRate);
+  // With an hdrFormat (DM_HDR_*) modes supporting it are preferred, and the display is switched
+  // into it if the chosen mode does; that alone counts as a switch too.
+  bool switchToBestVideoMode(float frameRate, int hdrFormat = DM_HDR_NONE);
+
+  // Same as switchToBestVideoMode(), but does the platform mode switch on a worker thread and
+  // returns right away. Returns true if a switch was started, in which case videoModeSwitched()
+  // is emitted once the display reports the new mode as stable (or the switch failed).
+  bool switchToBestVideoModeAsync(float frameRate, int hdrFormat = DM_HDR_NONE);
+
+  // The mode switchToBestVideoMode() would switch to, without switching. Empty if it would
+  // stay in the current one. The match is cached, so the actual switch doesn't score the
+  // modes again.
+  QString bestVideoModeName(float frameRate, int hdrFormat = DM_HDR_NONE);
+
+  // The DM_HDR_* format the display was switched into, until restorePreviousVideoMode().
+  int currentHDRFormat() const { return m_hdrFormat; }
+
+  // True while an asynchronous mode switch is running or settling.
+  bool isSwitchingVideoMode() const { return m_switchDisplay >= 0 || m_pendingFrameRate > 0; }
 
   // Switch to best overall video mode. This will also switch the resolution.
   bool switchToBestOverallVideoMode(int display);
@@ -43,12 +64,22 @@ public:
 
   double currentRefreshRate();
 
+  // Called by the window when it moved to another screen. Emits refreshRateChanged() if the
+  // display it's on now is a different one, so display-fps follows the display that shows
+  // the video.
+  void applicationScreenChanged();
+
   QString debugInformation();
 
 private:
   explicit DisplayComponent(QObject *parent = nullptr);
   QString displayName(int display);
   QString modePretty(int display, int mode);
+  // display is set even if the current mode is the best one
+  int findBestVideoMode(float frameRate, int hdrFormat, int& display);
+  // hdrFormat if the current or switched to mode on display supports it
+  int supportedHDRFormat(int display, int mode, int hdrFormat);
+  void revalidateVideoModes();
 
   DisplayManager  *m_displayManager;
   int m_lastVideoMode;
@@ -56,6 +87,35 @@ private:
   QTimer m_initTimer;
   QWindow* m_applicationWindow;
 
+  // The worker runs asynchronous mode switches and the re-validation of cached modes;
+  // m_displayManager must not be touched from the GUI thread while m_managerBusy is set.
+  QThreadPool m_managerPool;
+  QTimer m_switchTimer;
+  QElapsedTimer m_switchElapsed;
+  int m_switchDisplay;
+  int m_switchMode;
+  int m_switchStablePolls;
+  float m_lastRefreshRate;
+  bool m_managerBusy;
+  bool m_revalidating;
+  bool m_switchRestore;
+  // switch requested while the modes were re-validated
+  float m_pendingFrameRate;
+  int m_pendingHDRFormat;
+  // HDR format of the running switch, and the one the display is in
+  int m_switchHDRFormat;
+  int m_hdrFormat;
+  int m_hdrDisplay;
+  // where applicationScreenChanged() saw the window last
+  int m_windowDisplay;
+  float m_windowRefreshRate;
+
+private Q_SLOTS:
+  void onVideoModeSet(bool success, bool hdrSuccess);
+  void checkVideoModeStable();
+  void finishVideoModeSwitch(bool success);
+  void onVideoModesRevalidated(bool success);
+
 public Q_SLOTS:
   void  monitorChange();
   bool  initializeDisplayManager();
@@ -64,6 +124,10 @@ public Q_SLOTS:
 Q_SIGNALS:
   void refreshRateChanged();
 
+  // Emitted when a switch started with switchToBestVideoModeAsync() is done. If success is set
+  // the new mode is active and stable.
+  void videoModeSwitched(bool success);
+
 };
 
 #endif // DISPLAYCOMPONENT_H
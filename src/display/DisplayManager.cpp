@@ -10,15 +10,148 @@
 #include "DisplayManager.h"
 #include "math.h"
 #include "settings/SettingsComponent.h"
+#include "settings/SettingsKey.h"
+#include "utils/Utils.h"
+#include "Paths.h"
+
+#include <algorithm>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+// bump this when the meaning of the cached fields changes
+#define MODE_CACHE_VERSION 2
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DisplayManager::DisplayManager(QObject* parent) : QObject(parent), m_modesFromCache(false) {}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-DisplayManager::DisplayManager(QObject* parent) : QObject(parent) {}
+static QString modeCachePath(const QString& key)
+{
+  return Paths::cacheDir("displaymodes-" + key + ".json");
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManager::initialize()
+{
+  // the platform code just enumerated everything from scratch, remember it for next time
+  m_modesKey = monitorKey();
+  m_modesFromCache = false;
+  if (!m_modesKey.isEmpty())
+    saveModeCache(m_modesKey);
+
+  updateModes();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayManager::loadModeCache(const QString& key)
+{
+  QFile file(modeCachePath(key));
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+  if (json["version"].toInt() != MODE_CACHE_VERSION)
+    return false;
+
+  DMDisplayMap displays;
+  for (const QJsonValue& displayValue : json["displays"].toArray())
+  {
+    QJsonObject displayObj = displayValue.toObject();
+
+    DMDisplayPtr display = DMDisplayPtr(new DMDisplay);
+    display->m_id = displayObj["id"].toInt();
+    display->m_name = displayObj["name"].toString();
+    display->m_privId = displayObj["privId"].toInt();
+
+    for (const QJsonValue& modeValue : displayObj["modes"].toArray())
+    {
+      QJsonObject modeObj = modeValue.toObject();
+
+      DMVideoModePtr mode = DMVideoModePtr(new DMVideoMode);
+      mode->m_id = modeObj["id"].toInt();
+      mode->m_width = modeObj["width"].toInt();
+      mode->m_height = modeObj["height"].toInt();
+      mode->m_bitsPerPixel = modeObj["bitsPerPixel"].toInt();
+      mode->m_refreshRate = (float)modeObj["refreshRate"].toDouble();
+      mode->m_interlaced = modeObj["interlaced"].toBool();
+      mode->m_hdrFormats = modeObj["hdrFormats"].toInt();
+      mode->m_privId = modeObj["privId"].toInt();
+      display->m_videoModes[mode->m_id] = mode;
+    }
+
+    // isValidDisplayMode() relies on the mode ids being 0..n-1
+    if (display->m_videoModes.isEmpty() || display->m_videoModes.lastKey() != display->m_videoModes.size() - 1)
+      return false;
+
+    displays[display->m_id] = display;
+  }
+
+  if (displays.isEmpty())
+    return false;
+
+  m_displays = displays;
+  m_modesKey = key;
+  m_modesFromCache = true;
+
+  updateModes();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayManager::saveModeCache(const QString& key)
+{
+  QJsonArray displays;
+  for (const DMDisplayPtr& display : m_displays)
+  {
+    QJsonArray modes;
+    for (const DMVideoModePtr& mode : display->m_videoModes)
+    {
+      QJsonObject modeObj;
+      modeObj["id"] = mode->m_id;
+      modeObj["width"] = mode->m_width;
+      modeObj["height"] = mode->m_height;
+      modeObj["bitsPerPixel"] = mode->m_bitsPerPixel;
+      modeObj["refreshRate"] = mode->m_refreshRate;
+      modeObj["interlaced"] = mode->m_interlaced;
+      modeObj["hdrFormats"] = mode->m_hdrFormats;
+      modeObj["privId"] = mode->m_privId;
+      modes.append(modeObj);
+    }
+
+    QJsonObject displayObj;
+    displayObj["id"] = display->m_id;
+    displayObj["name"] = display->m_name;
+    displayObj["privId"] = display->m_privId;
+    displayObj["modes"] = modes;
+    displays.append(displayObj);
+  }
+
+  QJsonObject json;
+  json["version"] = MODE_CACHE_VERSION;
+  json["displays"] = displays;
+  QByteArray data = QJsonDocument(json).toJson(QJsonDocument::Compact);
+
+  // usually the same as last time, don't rewrite it on every monitor change
+  QString path = modeCachePath(key);
+  QFile file(path);
+  if (file.open(QIODevice::ReadOnly) && file.readAll() == data)
+    return;
+  file.close();
+
+  if (!Utils::safelyWriteFile(path, data))
+    QLOG_WARN() << "Could not write display mode cache" << path;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayManager::updateModes()
 {
   QLOG_INFO() << QString("DisplayManager found %1 Display(s).").arg(m_displays.size());
 
+  updateCandidates();
+
   // list video modes
   for(int displayid : m_displays.keys())
   {
@@ -45,8 +178,6 @@ bool DisplayManager::initialize()
   }
   else
     QLOG_ERROR() << "DisplayManager : unable to retrieve main display";
-
-  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -75,124 +206,144 @@ bool DisplayManager::isValidDisplayMode(int display, int mode)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// refresh: video FPS
-// multiple: display FPS
-bool DisplayManager::isRateMultipleOf(float refresh, float multiple, bool exact)
+double DisplayManager::FrameErrorsPerHour(double refreshRate, double frameRate, int* cadence)
 {
-  long roundedRefresh = lrint(refresh);
-  long roundedMultiple = lrint(multiple);
-
-  if (roundedRefresh == 0)
-      return false;
+  if (refreshRate <= 0 || frameRate <= 0)
+    return HUGE_VAL;
 
-  long factor = roundedMultiple / roundedRefresh;
-  float newRate = factor * refresh;
-  if (newRate < 1)
-    return false;
-
-  float tolerance = exact ? 0.01 * factor : 1;
+  // Each frame is shown for n refreshes, whatever is left over (or missing)
+  // has to be made up by repeating (or dropping) frames. For 3:2 pulldown
+  // that's a lot of them, for 23.976fps at 24Hz it's one every 42 seconds.
+  int n = std::max(1, (int)lrint(refreshRate / frameRate));
+  if (cadence)
+    *cadence = n;
 
-  return fabs(newRate - multiple) < tolerance;
+  return fabs(refreshRate - n * frameRate) * 3600;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int DisplayManager::findBestMatch(int display, DMMatchMediaInfo& matchInfo)
+void DisplayManager::updateCandidates()
 {
-  bool avoid_25_30 = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.avoid_25hz_30hz").toBool();
+  QMap<int, DMModeCandidates> candidates;
 
-  // Grab current videomode information
-  DMVideoModePtr currentVideoMode = getCurrentVideoMode(display);
-  if (!currentVideoMode)
-    return -1;
-
-  // now we try to find the exact match in current resolution
-  // then fill a list
-  DMVideoModeWeightMap weights;
+  for (const DMDisplayPtr& display : m_displays)
+  {
+    DMModeCandidates& list = candidates[display->m_id];
+    list.reserve(display->m_videoModes.size());
 
-  DMVideoModeMap::const_iterator modeit = m_displays[display]->m_videoModes.constBegin();
+    for (const DMVideoModePtr& mode : display->m_videoModes)
+    {
+      // the intention is also to match 30/1.001
+      bool lowRate = (fabs(mode->m_refreshRate - 30.0) < 0.5) || (fabs(mode->m_refreshRate - 25.0) < 0.5);
+      list.append({ mode->m_id, mode->m_width, mode->m_height, mode->m_bitsPerPixel, mode->m_refreshRate, mode->m_interlaced, mode->m_hdrFormats, lowRate });
+    }
+  }
 
-  while (modeit != m_displays[display]->m_videoModes.constEnd())
+  // the platform code enumerates the modes again quite often, usually to the same result
+  if (candidates != m_candidates)
   {
-    DMVideoModePtr candidate = modeit.value();
+    m_candidates = candidates;
+    m_matches.clear();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int DisplayManager::scoreCandidates(int display, const DMVideoModePtr& currentVideoMode, const DMMatchMediaInfo& matchInfo, bool avoidLowRates)
+{
+  const DMModeCandidates& candidates = m_candidates[display];
+
+  const DMModeCandidate* chosen = nullptr;
+  float maxWeight = 0;
+  int skipped = 0;
 
+  for (const DMModeCandidate& candidate : candidates)
+  {
     // avoid switching to 30 fps (prefer a multiple - 60Hz is ideal)
-    // the intention is also to match 30/1.001
-    if ((fabs(candidate->m_refreshRate - 30.0) < 0.5) ||
-        (fabs(candidate->m_refreshRate - 25.0) < 0.5))
+    if (candidate.m_lowRate && avoidLowRates)
     {
-      if (avoid_25_30)
-      {
-        QLOG_INFO() << "DisplayManager RefreshMatch : skipping rate " << candidate->m_refreshRate << "as requested";
-        modeit++;
-        continue;
-      }
+      skipped++;
+      continue;
     }
 
-    weights[candidate->m_id] = DMVideoModeWeightPtr(new DMVideoModeWeight);
-    weights[candidate->m_id]->m_mode = candidate;
-    weights[candidate->m_id]->m_weight = 0;
+    float weight = 0;
 
     // Weight Resolution match
-    if ((candidate->m_width == currentVideoMode->m_width) &&
-        (candidate->m_height == currentVideoMode->m_height) &&
-        (candidate->m_bitsPerPixel == currentVideoMode->m_bitsPerPixel))
+    if ((candidate.m_width == currentVideoMode->m_width) &&
+        (candidate.m_height == currentVideoMode->m_height) &&
+        (candidate.m_bitsPerPixel == currentVideoMode->m_bitsPerPixel))
     {
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_RES;
+      weight += MATCH_WEIGHT_RES;
     }
 
-    // weight refresh rate
-    // exact Match
-    if (fabs(candidate->m_refreshRate - matchInfo.m_refreshRate) <= 0.01)
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_REFRESH_RATE_EXACT;
+    // weight refresh rate by how smooth the video would play
+    int cadence = 1;
+    double errors = FrameErrorsPerHour(candidate.m_refreshRate, matchInfo.m_refreshRate, &cadence);
+    float smoothness = MATCH_FRAME_ERRORS_HALF_WEIGHT / (MATCH_FRAME_ERRORS_HALF_WEIGHT + errors);
+    weight += smoothness * (MATCH_WEIGHT_REFRESH_RATE + MATCH_WEIGHT_CADENCE / (float)cadence);
 
-    // exact multiple refresh rate
-    if (isRateMultipleOf(matchInfo.m_refreshRate, candidate->m_refreshRate, true))
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_REFRESH_RATE_MULTIPLE;
+    // weight interlacing
+    if (candidate.m_interlaced == matchInfo.m_interlaced)
+      weight += MATCH_WEIGHT_INTERLACE;
+
+    // weight HDR support
+    if (candidate.m_hdrFormats & matchInfo.m_hdrFormat)
+      weight += MATCH_WEIGHT_HDR;
+
+    if (candidate.m_id == currentVideoMode->m_id)
+      weight += MATCH_WEIGHT_CURRENT;
 
-    // close refresh match (less than 1 hz diff to match all 23.xxx modes to 24p)
-    if (fabs(candidate->m_refreshRate - matchInfo.m_refreshRate) <= 0.5)
+    // now grab the mode with the highest weight
+    if (weight > maxWeight)
     {
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_REFRESH_RATE_CLOSE;
+      chosen = &candidate;
+      maxWeight = weight;
     }
+  }
 
-    // approx multiple refresh rate
-    if (isRateMultipleOf(matchInfo.m_refreshRate, candidate->m_refreshRate, false))
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_REFRESH_RATE_MULTIPLE_CLOSE;
+  if (skipped)
+    QLOG_INFO() << "DisplayManager RefreshMatch : skipped" << skipped << "25/30Hz modes as requested";
 
-    // weight interlacing
-    if (candidate->m_interlaced == matchInfo.m_interlaced)
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_INTERLACE;
+  if (chosen && maxWeight > MATCH_WEIGHT_RES)
+  {
+    QLOG_DEBUG() << "DisplayManager RefreshMatch : best mode" << chosen->m_id << "has weight" << maxWeight;
+    return chosen->m_id;
+  }
 
-    if (candidate->m_id == currentVideoMode->m_id)
-      weights[candidate->m_id]->m_weight += MATCH_WEIGHT_CURRENT;
+  return -1;
+}
 
-    modeit++;
-  }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int DisplayManager::findBestMatch(int display, DMMatchMediaInfo& matchInfo)
+{
+  static SettingsKey<bool> avoid25Hz30Hz(SETTINGS_SECTION_VIDEO, "refreshrate.avoid_25hz_30hz");
+  bool avoid_25_30 = avoid25Hz30Hz.value();
 
-  // now grab the mode with the highest weight
-  DMVideoModeWeightPtr chosen;
-  float maxWeight = 0;
+  // Grab current videomode information
+  DMVideoModePtr currentVideoMode = getCurrentVideoMode(display);
+  if (!currentVideoMode)
+    return -1;
 
-  DMVideoModeWeightMap::const_iterator weightit = weights.constBegin();
-  while (weightit != weights.constEnd())
-  {
-    QLOG_DEBUG() << "Mode " << weightit.value()->m_mode->m_id << "("
-                 << weightit.value()->m_mode->getPrettyName() << ") has weight "
-                 << weightit.value()->m_weight;
-    if (weightit.value()->m_weight > maxWeight)
-    {
-      chosen = weightit.value();
-      maxWeight = chosen->m_weight;
-    }
+  // modes added without going through initialize()
+  if (m_candidates.value(display).size() != m_displays[display]->m_videoModes.size())
+    updateCandidates();
 
-    weightit++;
+  DMMatchKey key = { display, currentVideoMode->m_id, (int)lrint(matchInfo.m_refreshRate * 1000), matchInfo.m_interlaced, matchInfo.m_hdrFormat, avoid_25_30 };
+
+  auto it = m_matches.constFind(key);
+  int mode = (it != m_matches.constEnd()) ? it.value() : -1;
+  if (it == m_matches.constEnd())
+  {
+    mode = scoreCandidates(display, currentVideoMode, matchInfo, avoid_25_30);
+    m_matches.insert(key, mode);
   }
 
-  if ((chosen) && (chosen->m_weight > MATCH_WEIGHT_RES))
+  if (mode >= 0)
   {
     QLOG_INFO() << "DisplayManager RefreshMatch : found a suitable mode : "
-                << chosen->m_mode->getPrettyName();
-    return chosen->m_mode->m_id;
+                << m_displays[display]->m_videoModes[mode]->getPrettyName() << "with"
+                << FrameErrorsPerHour(m_displays[display]->m_videoModes[mode]->m_refreshRate, matchInfo.m_refreshRate)
+                << "dropped/repeated frames per hour";
+    return mode;
   }
 
   QLOG_INFO() << "DisplayManager RefreshMatch : found no suitable videomode";
@@ -10,10 +10,17 @@
 #define _DISPLAYMANAGER_H_
 
 #include <QMap>
+#include <QHash>
+#include <QVector>
 #include <QPoint>
 #include <QString>
 #include <QSharedPointer>
 
+// HDR transfer functions, as a set in DMVideoMode::m_hdrFormats
+#define DM_HDR_NONE 0
+#define DM_HDR_HDR10 (1 << 0)
+#define DM_HDR_HLG (1 << 1)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Video Modes
 class DMVideoMode
@@ -25,6 +32,8 @@ public:
   int m_bitsPerPixel;
   float m_refreshRate;
   bool m_interlaced;
+  // what the display can be switched to with setHDRMode() while in this mode
+  int m_hdrFormats = DM_HDR_NONE;
 
   int m_privId;
 
@@ -34,6 +43,10 @@ public:
 
     name = QString("%1 x%2%3").arg(m_width, 5).arg(m_height, 5).arg((m_interlaced ? "i" : " "));
     name += QString("x %1bpp @%2Hz").arg(m_bitsPerPixel, 2).arg(m_refreshRate);
+    if (m_hdrFormats & DM_HDR_HDR10)
+      name += " HDR10";
+    if (m_hdrFormats & DM_HDR_HLG)
+      name += " HLG";
     return name;
   }
 };
@@ -62,37 +75,82 @@ typedef QMap<int, DMDisplayPtr> DMDisplayMap;
 class DMMatchMediaInfo
 {
 public:
-  DMMatchMediaInfo() : m_refreshRate(0), m_interlaced(false) {};
-  DMMatchMediaInfo(float refreshRate, bool interlaced)
-    : m_refreshRate(refreshRate), m_interlaced(interlaced) {};
+  DMMatchMediaInfo() : m_refreshRate(0), m_interlaced(false), m_hdrFormat(DM_HDR_NONE) {};
+  DMMatchMediaInfo(float refreshRate, bool interlaced, int hdrFormat = DM_HDR_NONE)
+    : m_refreshRate(refreshRate), m_interlaced(interlaced), m_hdrFormat(hdrFormat) {};
 
   float m_refreshRate;
   bool m_interlaced;
+  // one of the DM_HDR_* values
+  int m_hdrFormat;
 };
 
 // Matching weights
 #define MATCH_WEIGHT_RES 1000
 
-#define MATCH_WEIGHT_REFRESH_RATE_EXACT               200
-#define MATCH_WEIGHT_REFRESH_RATE_MULTIPLE            75
-#define MATCH_WEIGHT_REFRESH_RATE_CLOSE               50
-#define MATCH_WEIGHT_REFRESH_RATE_MULTIPLE_CLOSE      25
+// for a mode without dropped or repeated frames, less the more of them there are per hour
+#define MATCH_WEIGHT_REFRESH_RATE 200
+// frame errors per hour at which a mode gets half of MATCH_WEIGHT_REFRESH_RATE
+#define MATCH_FRAME_ERRORS_HALF_WEIGHT 60
+// among equally good modes, the one showing each frame for the fewest refreshes
+#define MATCH_WEIGHT_CADENCE 20
 
 #define MATCH_WEIGHT_INTERLACE 10
 
+// a mode that can show HDR content without tone mapping, less than a smoother refresh rate
+#define MATCH_WEIGHT_HDR 50
+
 #define MATCH_WEIGHT_CURRENT 5
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// VideoMode Weight
-class DMVideoModeWeight
+// The parts of a video mode findBestMatch() looks at, kept in a flat array per display
+struct DMModeCandidate
 {
-public:
-  float m_weight;
-  DMVideoModePtr m_mode;
+  int m_id;
+  int m_width;
+  int m_height;
+  int m_bitsPerPixel;
+  float m_refreshRate;
+  bool m_interlaced;
+  int m_hdrFormats;
+  // 25/30Hz, skipped with refreshrate.avoid_25hz_30hz
+  bool m_lowRate;
+
+  bool operator==(const DMModeCandidate& o) const
+  {
+    return m_id == o.m_id && m_width == o.m_width && m_height == o.m_height &&
+           m_bitsPerPixel == o.m_bitsPerPixel && m_refreshRate == o.m_refreshRate &&
+           m_interlaced == o.m_interlaced && m_hdrFormats == o.m_hdrFormats;
+  }
+};
+
+typedef QVector<DMModeCandidate> DMModeCandidates;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Everything the result of findBestMatch() depends on
+struct DMMatchKey
+{
+  int m_display;
+  int m_currentMode;
+  int m_milliHz;
+  bool m_interlaced;
+  int m_hdrFormat;
+  bool m_avoidLowRates;
+
+  bool operator==(const DMMatchKey& o) const
+  {
+    return m_display == o.m_display && m_currentMode == o.m_currentMode && m_milliHz == o.m_milliHz &&
+           m_interlaced == o.m_interlaced && m_hdrFormat == o.m_hdrFormat &&
+           m_avoidLowRates == o.m_avoidLowRates;
+  }
 };
 
-typedef QSharedPointer<DMVideoModeWeight> DMVideoModeWeightPtr;
-typedef QMap<int, DMVideoModeWeightPtr> DMVideoModeWeightMap;
+inline uint qHash(const DMMatchKey& key, uint seed = 0)
+{
+  return qHash(key.m_display, seed) ^ qHash(key.m_currentMode) ^ qHash(key.m_milliHz) ^
+         (key.m_interlaced ? 0x10000000 : 0) ^ (key.m_avoidLowRates ? 0x20000000 : 0) ^
+         ((uint)key.m_hdrFormat << 24);
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // DisplayManager
@@ -115,8 +173,33 @@ public:
   // extra functions that can be implemented
   virtual void resetRendering() {}
 
+  // Switch the output of display into one of the DM_HDR_* formats the current mode has in
+  // m_hdrFormats, or back to SDR with DM_HDR_NONE. The content's metadata is passed through
+  // by the video output, this only changes what the display expects.
+  virtual bool setHDRMode(int display, int format) { return false; }
+
+  // A cheap fingerprint of the connected monitors (EDID or whatever else the platform
+  // provides without probing the outputs), covering everything the enumerated modes and
+  // their m_privId values depend on. Besides that, it has to set up the platform state
+  // that the functions above need, so they work on modes loaded by loadModeCache(). An
+  // empty key disables the mode cache.
+  virtual QString monitorKey() { return QString(); }
+
+  // Fill m_displays with the modes that were enumerated for this monitor key before.
+  bool loadModeCache(const QString& key);
+
+  // Key the current modes were enumerated or loaded for, empty if unknown.
+  const QString& modesKey() const { return m_modesKey; }
+  bool modesFromCache() const { return m_modesFromCache; }
+
   // other classes functions
   int findBestMatch(int display, DMMatchMediaInfo& matchInfo);
+
+  // How many frames per hour have to be dropped or repeated (beyond the regular
+  // cadence) to show video of frameRate at refreshRate, syncing to audio. If
+  // cadence is given, it's set to the number of refreshes each frame is shown for.
+  static double FrameErrorsPerHour(double refreshRate, double frameRate, int* cadence = nullptr);
+
   DMVideoModePtr getCurrentVideoMode(int display);
 
   int findBestMode(int display);
@@ -126,7 +209,18 @@ public:
   int getDisplayFromPoint(const QPoint& pt);
 
 private:
-  bool isRateMultipleOf(float refresh, float multiple, bool exact = true);
+  // Common part of initialize() and loadModeCache() once m_displays is filled.
+  void updateModes();
+  void saveModeCache(const QString& key);
+  // Rebuild the candidate tables from m_displays. Memoized matches are only
+  // dropped if the modes actually changed.
+  void updateCandidates();
+  int scoreCandidates(int display, const DMVideoModePtr& currentVideoMode, const DMMatchMediaInfo& matchInfo, bool avoidLowRates);
+
+  QMap<int, DMModeCandidates> m_candidates;
+  QHash<DMMatchKey, int> m_matches;
+  QString m_modesKey;
+  bool m_modesFromCache;
 };
 
 typedef QSharedPointer<DisplayManager> DisplayManagerPtr;
@@ -1,6 +1,13 @@
 #include "QsLog.h"
 #include "DisplayManagerDummy.h"
 
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRect>
+#include <QThread>
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void DisplayManagerDummy::addMode(float rate)
 {
@@ -17,10 +24,100 @@ void DisplayManagerDummy::addMode(float rate)
   m_displays[0]->m_videoModes[mode->m_id] = mode;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayManagerDummy::loadSimulation()
+{
+  QFile file(m_simulationPath);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    QLOG_WARN() << "Can't open display simulation" << m_simulationPath;
+    return false;
+  }
+
+  QJsonParseError error;
+  QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+  if (error.error != QJsonParseError::NoError)
+  {
+    QLOG_WARN() << "Can't parse display simulation" << m_simulationPath << ":" << error.errorString();
+    return false;
+  }
+
+  QPoint nextPosition;
+  for (const QJsonValue& displayValue : doc.object()["displays"].toArray())
+  {
+    QJsonObject displayObj = displayValue.toObject();
+
+    DMDisplayPtr display = DMDisplayPtr(new DMDisplay());
+    display->m_id = m_displays.size();
+    display->m_name = displayObj["name"].toString(QString("Simulated display %1").arg(display->m_id));
+    display->m_privId = display->m_id;
+
+    for (const QJsonValue& modeValue : displayObj["modes"].toArray())
+    {
+      QJsonObject modeObj = modeValue.toObject();
+
+      DMVideoModePtr mode = DMVideoModePtr(new DMVideoMode());
+      mode->m_id = display->m_videoModes.size();
+      mode->m_width = modeObj["width"].toInt();
+      mode->m_height = modeObj["height"].toInt();
+      mode->m_bitsPerPixel = modeObj["bitsPerPixel"].toInt(24);
+      mode->m_refreshRate = (float)modeObj["refreshRate"].toDouble();
+      mode->m_interlaced = modeObj["interlaced"].toBool();
+      mode->m_hdrFormats = modeObj["hdrFormats"].toInt();
+      mode->m_privId = mode->m_id;
+
+      if (mode->m_width <= 0 || mode->m_height <= 0 || mode->m_refreshRate <= 0)
+      {
+        QLOG_WARN() << "Skipping simulated mode" << mode->m_id << "of" << display->m_name;
+        continue;
+      }
+      display->m_videoModes[mode->m_id] = mode;
+    }
+
+    if (display->m_videoModes.isEmpty())
+    {
+      QLOG_WARN() << "Simulated display" << display->m_name << "has no modes";
+      continue;
+    }
+
+    SimulatedDisplay simulated;
+    simulated.currentMode = displayObj["current"].toInt();
+    if (!display->m_videoModes.contains(simulated.currentMode))
+      simulated.currentMode = 0;
+    simulated.previousMode = simulated.currentMode;
+    simulated.switchLatency = displayObj["switchLatencyMsec"].toInt();
+    simulated.settle = displayObj["settleMsec"].toInt();
+
+    // side by side, unless they say where they are
+    DMVideoModePtr current = display->m_videoModes[simulated.currentMode];
+    simulated.position = QPoint(displayObj["x"].toInt(nextPosition.x()), displayObj["y"].toInt(nextPosition.y()));
+    nextPosition = simulated.position + QPoint(current->m_width, 0);
+
+    m_displays[display->m_id] = display;
+    m_simulated[display->m_id] = simulated;
+
+    QLOG_INFO() << "Simulated display" << display->m_id << display->m_name << "with"
+                << display->m_videoModes.size() << "modes, switching takes" << simulated.switchLatency
+                << "+" << simulated.settle << "msec";
+  }
+
+  return !m_displays.isEmpty();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerDummy::initialize()
 {
+  QMutexLocker lock(&m_lock);
+
   m_displays.clear();
+  m_simulated.clear();
+  m_clock.start();
+
+  if (!m_simulationPath.isEmpty() && loadSimulation())
+  {
+    lock.unlock();
+    return DisplayManager::initialize();
+  }
 
   DMDisplayPtr display = DMDisplayPtr(new DMDisplay());
   display->m_id = m_displays.size();
@@ -29,6 +126,7 @@ bool DisplayManagerDummy::initialize()
 
   addMode(60);
 
+  lock.unlock();
   return DisplayManager::initialize();
 }
 
@@ -43,7 +141,27 @@ bool DisplayManagerDummy::setDisplayMode(int display, int mode)
 
   QLOG_INFO() << "Switching to" << videomode->m_width << "x" << videomode->m_height << "@" << videomode->m_refreshRate;
 
-  m_currentMode = videomode->m_id;
+  int latency = 0;
+  {
+    QMutexLocker lock(&m_lock);
+    m_switches.append(QVariantMap {
+      { "display", display }, { "mode", mode }, { "name", videomode->getPrettyName() },
+      { "msec", m_clock.isValid() ? m_clock.elapsed() : 0 }
+    });
+    latency = m_simulated.value(display).switchLatency;
+  }
+
+  // this runs on the worker thread of DisplayComponent, like the real ones
+  if (latency > 0)
+    QThread::msleep(latency);
+
+  QMutexLocker lock(&m_lock);
+  SimulatedDisplay& simulated = m_simulated[display];
+  // a switch while the last one is still settling starts from what the display shows
+  if (!simulated.switched.isValid() || simulated.switched.elapsed() >= simulated.settle)
+    simulated.previousMode = simulated.currentMode;
+  simulated.currentMode = videomode->m_id;
+  simulated.switched.start();
 
   return true;
 }
@@ -54,22 +172,62 @@ int DisplayManagerDummy::getCurrentDisplayMode(int display)
   if (!isValidDisplay(display))
     return -1;
 
-  return m_currentMode;
+  QMutexLocker lock(&m_lock);
+
+  // modes that weren't set up by initialize() are all mode 0, with nothing to simulate
+  auto it = m_simulated.constFind(display);
+  if (it == m_simulated.constEnd())
+    return 0;
+
+  if (it->switched.isValid() && it->switched.elapsed() < it->settle)
+    return it->previousMode;
+  return it->currentMode;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int DisplayManagerDummy::getMainDisplay()
 {
-  return 0;
+  return m_displays.isEmpty() ? -1 : m_displays.firstKey();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int DisplayManagerDummy::getDisplayFromPoint(int x, int y)
 {
-  if (m_displays.size())
+  for (const DMDisplayPtr& display : m_displays)
   {
-    if (x >= 0 && y >= 0 && x < 1280 && y < 720)
-      return 0;
+    DMVideoModePtr mode = getCurrentVideoMode(display->m_id);
+    if (!mode)
+      continue;
+
+    QMutexLocker lock(&m_lock);
+    QRect rect(m_simulated.value(display->m_id).position, QSize(mode->m_width, mode->m_height));
+    if (rect.contains(x, y))
+      return display->m_id;
   }
   return -1;
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayManagerDummy::setHDRMode(int display, int format)
+{
+  if (!isValidDisplay(display))
+    return false;
+
+  // the mode that was just switched to, even if the display is still settling
+  QMutexLocker lock(&m_lock);
+  DMVideoModePtr mode = m_displays[display]->m_videoModes.value(m_simulated.value(display).currentMode);
+  if (!mode || (format != DM_HDR_NONE && !(mode->m_hdrFormats & format)))
+    return false;
+
+  m_switches.append(QVariantMap {
+    { "display", display }, { "hdrFormat", format }, { "msec", m_clock.isValid() ? m_clock.elapsed() : 0 }
+  });
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantList DisplayManagerDummy::switches()
+{
+  QMutexLocker lock(&m_lock);
+  return m_switches;
+}
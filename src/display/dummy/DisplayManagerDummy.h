@@ -1,25 +1,69 @@
 #ifndef DISPLAYMANAGERDUMMY_H_
 #define DISPLAYMANAGERDUMMY_H_
 
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QPoint>
+#include <QVariant>
+
 #include "display/DisplayManager.h"
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A display manager without a display. By default it has one 720p60 display, with a
+// simulation file (video.debug.display_simulator) it has the displays and modes from
+// that instead, so mode matching and switching can be tried against EDID sets from
+// the field:
+//
+//  { "displays": [ { "name": "TV", "x": 0, "y": 0, "current": 0,
+//                    "switchLatencyMsec": 2000, "settleMsec": 500,
+//                    "modes": [ { "width": 1920, "height": 1080, "refreshRate": 23.976,
+//                                 "interlaced": false, "bitsPerPixel": 24, "hdrFormats": 1 } ] } ] }
+//
+// Mode ids are given by the order in "modes", the format is otherwise the same as the mode
+// cache, so those files work as they are. setDisplayMode() blocks for switchLatencyMsec,
+// like XRandR does, and getCurrentDisplayMode() reports the old mode for settleMsec after
+// that, like displays that switch asynchronously. The requested switches are kept and can
+// be read with switches().
+//
 class DisplayManagerDummy : public DisplayManager
 {
   Q_OBJECT
 private:
 
   void addMode(float rate);
+  bool loadSimulation();
+
+  struct SimulatedDisplay
+  {
+    QPoint position;
+    int switchLatency = 0;
+    int settle = 0;
+    int currentMode = 0;
+    int previousMode = 0;
+    QElapsedTimer switched;
+  };
 
-  int m_currentMode;
+  QString m_simulationPath;
+  // the worker thread of DisplayComponent switches, everything below is shared with it
+  QMutex m_lock;
+  QMap<int, SimulatedDisplay> m_simulated;
+  QVariantList m_switches;
+  QElapsedTimer m_clock;
 
 public:
-  explicit DisplayManagerDummy(QObject* parent) : DisplayManager(parent), m_currentMode(0) {};
+  explicit DisplayManagerDummy(QObject* parent, const QString& simulationPath = QString())
+    : DisplayManager(parent), m_simulationPath(simulationPath) {};
 
   bool initialize() override;
   bool setDisplayMode(int display, int mode) override;
   int getCurrentDisplayMode(int display) override;
   int getMainDisplay() override;
   int getDisplayFromPoint(int x, int y) override;
+  bool setHDRMode(int display, int format) override;
+
+  // {display, mode, hdrFormat, msec} for each switch that was asked for, msec counted
+  // from initialize()
+  QVariantList switches();
 };
 
 #endif /* DISPLAYMANAGERX11_H_ */
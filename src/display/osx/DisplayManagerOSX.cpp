@@ -10,6 +10,8 @@
 #include "utils/osx/OSXUtils.h"
 #include "DisplayManagerOSX.h"
 
+#include <QCryptographicHash>
+
 #include "QsLog.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -40,6 +42,7 @@ bool DisplayManagerOSX::initialize()
     DMDisplayPtr display = DMDisplayPtr(new DMDisplay);
     display->m_id = displayid;
     display->m_name = QString("Display %1").arg(displayid);
+    display->m_privId = (int)m_osxDisplays[displayid];
     m_displays[display->m_id] = display;
 
     m_osxDisplayModes[displayid] = CGDisplayCopyAllDisplayModes(m_osxDisplays[displayid], nullptr);
@@ -64,6 +67,7 @@ bool DisplayManagerOSX::initialize()
       mode->m_height = (int)CGDisplayModeGetHeight(displayMode);
       mode->m_width = (int)CGDisplayModeGetWidth(displayMode);
       mode->m_refreshRate = (float)CGDisplayModeGetRefreshRate(displayMode);
+      mode->m_privId = (int)CGDisplayModeGetIODisplayModeID(displayMode);
 
       CFStringRef pixEnc = CGDisplayModeCopyPixelEncoding(displayMode);
 
@@ -111,12 +115,24 @@ bool DisplayManagerOSX::setDisplayMode(int display, int mode)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int DisplayManagerOSX::getCurrentDisplayMode(int display)
 {
-  if (!isValidDisplay(display) || !m_osxDisplayModes[display])
+  if (!isValidDisplay(display))
     return -1;
   
   CGDisplayModeRef currentMode = CGDisplayCopyDisplayMode(m_osxDisplays[display]);
   uint32_t currentIOKitID = CGDisplayModeGetIODisplayModeID(currentMode);
 
+  if (!m_osxDisplayModes[display])
+  {
+    // modes loaded from the cache, m_privId is the IOKit mode ID
+    CFRelease(currentMode);
+    for (const DMVideoModePtr& mode : m_displays[display]->m_videoModes)
+    {
+      if ((uint32_t)mode->m_privId == currentIOKitID)
+        return mode->m_id;
+    }
+    return -1;
+  }
+
   for (int mode = 0; mode < CFArrayGetCount(m_osxDisplayModes[display]); mode++)
   {
     CGDisplayModeRef checkMode = (CGDisplayModeRef)CFArrayGetValueAtIndex(m_osxDisplayModes[display], mode);
@@ -147,6 +163,41 @@ int DisplayManagerOSX::getMainDisplay()
   return -1;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString DisplayManagerOSX::monitorKey()
+{
+  CGDirectDisplayID displays[MAX_DISPLAYS];
+  uint32_t numDisplays = 0;
+
+  if (CGGetActiveDisplayList(MAX_DISPLAYS, displays, &numDisplays) || !numDisplays)
+    return QString();
+
+  // the mode arrays belong to the old display list
+  if (numDisplays != m_osxnumDisplays || memcmp(displays, m_osxDisplays, numDisplays * sizeof(CGDirectDisplayID)))
+  {
+    for (int i = 0; i < m_osxDisplayModes.size(); i++)
+    {
+      if (m_osxDisplayModes[i])
+        CFRelease(m_osxDisplayModes[i]);
+    }
+    m_osxDisplayModes.clear();
+
+    memcpy(m_osxDisplays, displays, numDisplays * sizeof(CGDirectDisplayID));
+    m_osxnumDisplays = numDisplays;
+  }
+
+  // vendor, model and serial number come from the EDID
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  for (uint32_t i = 0; i < numDisplays; i++)
+  {
+    uint32_t ids[] = { displays[i], CGDisplayVendorNumber(displays[i]),
+                       CGDisplayModelNumber(displays[i]), CGDisplaySerialNumber(displays[i]) };
+    hash.addData((const char*)ids, sizeof(ids));
+  }
+
+  return hash.result().toHex();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 DisplayManagerOSX::~DisplayManagerOSX()
 {
@@ -29,7 +29,7 @@ private:
   OSXDisplayModeMap m_osxDisplayModes;
 
 public:
-  explicit DisplayManagerOSX(QObject* parent) : DisplayManager(parent) {};
+  explicit DisplayManagerOSX(QObject* parent) : DisplayManager(parent), m_osxnumDisplays(0) {};
   ~DisplayManagerOSX() override;
 
   bool initialize() override;
@@ -37,6 +37,7 @@ public:
   int getCurrentDisplayMode(int display) override;
   int getMainDisplay() override;
   int getDisplayFromPoint(int x, int y) override;
+  QString monitorKey() override;
 };
 
 #endif /* _DISPLAYMANAGEROSX_H_ */
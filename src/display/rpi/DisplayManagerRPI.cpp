@@ -7,6 +7,10 @@
 #include "QsLog.h"
 #include "DisplayManagerRPI.h"
 #include "display/DisplayComponent.h"
+#include "HelperStatus.h"
+
+// how long recreating the renderer may block the main thread
+#define RPI_RESET_RENDERING_BUSY_MSEC (10 * 1000)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void DisplayManagerRPI::tv_callback(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2)
@@ -175,6 +179,9 @@ void DisplayManagerRPI::resetRendering()
   {
     QLOG_INFO() << "Recreating Qt UI renderer";
 
+    // this blocks the main thread for a while, the helper shouldn't think we hang
+    HelperStatus::Get().setMainBusy(RPI_RESET_RENDERING_BUSY_MSEC);
+
     // destroy the window to reset  OpenGL context
     window->setPersistentOpenGLContext(false);
     window->setPersistentSceneGraph(false);
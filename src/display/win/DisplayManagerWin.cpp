@@ -7,7 +7,9 @@
 //
 
 #include <QRect>
+#include <QCryptographicHash>
 #include <math.h>
+#include <vector>
 
 #include "QsLog.h"
 #include "DisplayManagerWin.h"
@@ -41,6 +43,96 @@ static bool modeEquals(const DMVideoMode& m1, const DMVideoMode& m2)
          m1.m_interlaced == m2.m_interlaced;
 }
 
+#ifdef NTDDI_WIN10_RS2
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The DisplayConfig path of the monitor on a GDI adapter, the advanced color (HDR) state is
+// only available through that API.
+static bool findDisplayPath(const QString& adapter, DISPLAYCONFIG_PATH_INFO& found)
+{
+  UINT32 pathCount = 0, modeCount = 0;
+  if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &pathCount, &modeCount) != ERROR_SUCCESS)
+    return false;
+
+  std::vector<DISPLAYCONFIG_PATH_INFO> paths(pathCount);
+  std::vector<DISPLAYCONFIG_MODE_INFO> modes(modeCount);
+  if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &pathCount, paths.data(), &modeCount, modes.data(), NULL) != ERROR_SUCCESS)
+    return false;
+
+  for (UINT32 i = 0; i < pathCount; i++)
+  {
+    DISPLAYCONFIG_SOURCE_DEVICE_NAME source = {};
+    source.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+    source.header.size = sizeof(source);
+    source.header.adapterId = paths[i].sourceInfo.adapterId;
+    source.header.id = paths[i].sourceInfo.id;
+
+    if (DisplayConfigGetDeviceInfo(&source.header) == ERROR_SUCCESS &&
+        QString::fromWCharArray(source.viewGdiDeviceName) == adapter)
+    {
+      found = paths[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int DisplayManagerWin::getHDRFormats(int display)
+{
+#ifdef NTDDI_WIN10_RS2
+  DISPLAYCONFIG_PATH_INFO path;
+  if (!findDisplayPath(m_displayAdapters[display], path))
+    return DM_HDR_NONE;
+
+  DISPLAYCONFIG_GET_ADVANCED_COLOR_INFO info = {};
+  info.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_ADVANCED_COLOR_INFO;
+  info.header.size = sizeof(info);
+  info.header.adapterId = path.targetInfo.adapterId;
+  info.header.id = path.targetInfo.id;
+
+  // Windows only does HDR10, for every mode of the monitor
+  if (DisplayConfigGetDeviceInfo(&info.header) == ERROR_SUCCESS && info.advancedColorSupported)
+    return DM_HDR_HDR10;
+#endif
+
+  return DM_HDR_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DisplayManagerWin::setHDRMode(int display, int format)
+{
+#ifdef NTDDI_WIN10_RS2
+  if (!isValidDisplay(display))
+    return false;
+
+  DISPLAYCONFIG_PATH_INFO path;
+  if (!findDisplayPath(m_displayAdapters[display], path))
+    return false;
+
+  DISPLAYCONFIG_SET_ADVANCED_COLOR_STATE state = {};
+  state.header.type = DISPLAYCONFIG_DEVICE_INFO_SET_ADVANCED_COLOR_STATE;
+  state.header.size = sizeof(state);
+  state.header.adapterId = path.targetInfo.adapterId;
+  state.header.id = path.targetInfo.id;
+  state.enableAdvancedColor = (format & DM_HDR_HDR10) ? 1 : 0;
+
+  QLOG_DEBUG() << "Switching HDR" << (state.enableAdvancedColor ? "on" : "off") << "on display" << display;
+
+  LONG rc = DisplayConfigSetDeviceInfo(&state.header);
+  if (rc != ERROR_SUCCESS)
+  {
+    QLOG_ERROR() << "Failed to change HDR state, error" << rc;
+    return false;
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerWin::initialize()
 {
@@ -61,8 +153,10 @@ bool DisplayManagerWin::initialize()
       DMDisplayPtr display = DMDisplayPtr(new DMDisplay);
       display->m_id = displayId;
       display->m_name = QString::fromWCharArray(displayInfo.DeviceString);
+      display->m_privId = displayId;
       m_displays[display->m_id] = DMDisplayPtr(display);
       m_displayAdapters[display->m_id] = QString::fromWCharArray(displayInfo.DeviceName);
+      int hdrFormats = getHDRFormats(displayId);
 
       while (getModeInfo(displayId, modeId, modeInfo))
       {
@@ -70,6 +164,8 @@ bool DisplayManagerWin::initialize()
         DMVideoModePtr videoMode = DMVideoModePtr(new DMVideoMode);
         *videoMode = convertDevMode(modeInfo);
         videoMode->m_id = modeId;
+        videoMode->m_privId = modeId;
+        videoMode->m_hdrFormats = hdrFormats;
         display->m_videoModes[videoMode->m_id] = videoMode;
 
         modeId++;
@@ -88,6 +184,46 @@ bool DisplayManagerWin::initialize()
     return DisplayManager::initialize();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString DisplayManagerWin::monitorKey()
+{
+  DISPLAY_DEVICEW displayInfo;
+  int displayId = 0;
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  // This only walks the adapters and the monitors attached to them. Enumerating all settings
+  // of every adapter is the slow part, and that's what the cache is for.
+  m_displayAdapters.clear();
+
+  while (getDisplayInfo(displayId, displayInfo))
+  {
+    if (displayInfo.StateFlags & (DISPLAY_DEVICE_ACTIVE | DISPLAY_DEVICE_ATTACHED))
+    {
+      QString adapter = QString::fromWCharArray(displayInfo.DeviceName);
+      m_displayAdapters[displayId] = adapter;
+
+      hash.addData((const char*)&displayId, sizeof(displayId));
+      hash.addData(adapter.toUtf8());
+      hash.addData(QString::fromWCharArray(displayInfo.DeviceString).toUtf8());
+
+      // the monitor's device ID is derived from its EDID
+      DISPLAY_DEVICEW monitorInfo;
+      ZeroMemory(&monitorInfo, sizeof(monitorInfo));
+      monitorInfo.cb = sizeof(monitorInfo);
+      if (EnumDisplayDevicesW(displayInfo.DeviceName, 0, &monitorInfo, 0))
+        hash.addData(QString::fromWCharArray(monitorInfo.DeviceID).toUtf8());
+    }
+
+    displayId++;
+  }
+
+  if (m_displayAdapters.isEmpty())
+    return QString();
+
+  return hash.result().toHex();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerWin::setDisplayMode(int display, int mode)
 {
@@ -12,6 +12,7 @@ class DisplayManagerWin : public DisplayManager
 private:
   bool getDisplayInfo(int display, DISPLAY_DEVICEW& info);
   bool getModeInfo(int display, int mode, DEVMODEW& info);
+  int getHDRFormats(int display);
 
   QMap<int, QString> m_displayAdapters;
 
@@ -24,6 +25,8 @@ public:
   virtual int getCurrentDisplayMode(int display);
   virtual int getMainDisplay();
   virtual int getDisplayFromPoint(int x, int y);
+  virtual bool setHDRMode(int display, int format);
+  virtual QString monitorKey();
 };
 
 #endif // DISPLAYMANAGERWIN_H
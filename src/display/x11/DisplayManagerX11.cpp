@@ -1,5 +1,7 @@
 #include "DisplayManagerX11.h"
 
+#include <QCryptographicHash>
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerX11::initialize()
 {
@@ -78,6 +80,62 @@ bool DisplayManagerX11::initialize()
     return DisplayManager::initialize();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString DisplayManagerX11::monitorKey()
+{
+  if (!xdisplay)
+    xdisplay = XOpenDisplay(NULL);
+  if (!xdisplay)
+    return QString();
+
+  // Unlike XRRGetScreenResources() this doesn't make the server probe the outputs, which is
+  // exactly the slow part we want to skip.
+  XRRScreenResources* current = XRRGetScreenResourcesCurrent(xdisplay, RootWindow(xdisplay, DefaultScreen(xdisplay)));
+  if (!current)
+    return QString();
+
+  if (resources)
+    XRRFreeScreenResources(resources);
+  resources = current;
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  Atom edidAtom = XInternAtom(xdisplay, RR_PROPERTY_RANDR_EDID, False);
+
+  for (int o = 0; o < resources->noutput; o++)
+  {
+    RROutput output = resources->outputs[o];
+    XRROutputInfo *out = XRRGetOutputInfo(xdisplay, resources, output);
+    if (!out)
+      continue;
+
+    // same outputs initialize() picks up
+    if (out->crtc)
+    {
+      hash.addData((const char*)&o, sizeof(o));
+      hash.addData(out->name, out->nameLen);
+      hash.addData((const char*)out->modes, out->nmode * sizeof(RRMode));
+
+      unsigned char* edid = NULL;
+      int format;
+      unsigned long items, bytesAfter;
+      Atom type;
+      if (XRRGetOutputProperty(xdisplay, output, edidAtom, 0, 128, False, False, AnyPropertyType,
+                               &type, &format, &items, &bytesAfter, &edid) == Success && edid)
+        hash.addData((const char*)edid, (int)items);
+      if (edid)
+        XFree(edid);
+    }
+
+    XRRFreeOutputInfo(out);
+  }
+
+  // m_privId of the modes is an index into this list
+  for (int n = 0; n < resources->nmode; n++)
+    hash.addData((const char*)&resources->modes[n].id, sizeof(RRMode));
+
+  return hash.result().toHex();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool DisplayManagerX11::setDisplayMode(int display, int mode)
 {
@@ -35,6 +35,7 @@ public:
   virtual int getCurrentDisplayMode(int display);
   virtual int getMainDisplay();
   virtual int getDisplayFromPoint(int x, int y);
+  virtual QString monitorKey();
 };
 
 #endif /* DISPLAYMANAGERX11_H_ */
@@ -0,0 +1,235 @@
+#include "DeviceHotplugMonitor.h"
+
+#include "QsLog.h"
+
+#if defined(Q_OS_MAC)
+#include <IOKit/usb/IOUSBLib.h>
+#include <dispatch/dispatch.h>
+#elif defined(Q_OS_WIN)
+#include <dbt.h>
+#elif defined(Q_OS_LINUX)
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+#if defined(Q_OS_MAC)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::DeviceHotplugMonitor(QObject* parent) : QObject(parent), m_port(nullptr),
+  m_addedIterator(0), m_removedIterator(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::~DeviceHotplugMonitor()
+{
+  if (m_addedIterator)
+    IOObjectRelease(m_addedIterator);
+  if (m_removedIterator)
+    IOObjectRelease(m_removedIterator);
+  if (m_port)
+    IONotificationPortDestroy(m_port);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DeviceHotplugMonitor::onIOKitNotification(void* refcon, io_iterator_t iterator)
+{
+  // The iterator has to be drained, or there won't be any further notifications.
+  io_object_t object;
+  while ((object = IOIteratorNext(iterator)))
+    IOObjectRelease(object);
+
+  // Runs on a dispatch queue, the connections take care of getting to the right thread.
+  emit static_cast<DeviceHotplugMonitor*>(refcon)->devicesChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DeviceHotplugMonitor::start()
+{
+  m_port = IONotificationPortCreate(kIOMasterPortDefault);
+  if (!m_port)
+    return false;
+
+  // No run loop on our thread, so the notifications go through a dispatch queue.
+  IONotificationPortSetDispatchQueue(m_port, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+
+  // IOServiceAddMatchingNotification consumes one reference each.
+  if (IOServiceAddMatchingNotification(m_port, kIOFirstMatchNotification, IOServiceMatching(kIOUSBDeviceClassName),
+                                       onIOKitNotification, this, &m_addedIterator) != KERN_SUCCESS ||
+      IOServiceAddMatchingNotification(m_port, kIOTerminatedNotification, IOServiceMatching(kIOUSBDeviceClassName),
+                                       onIOKitNotification, this, &m_removedIterator) != KERN_SUCCESS)
+  {
+    QLOG_WARN() << "Failed to register for USB device notifications";
+    return false;
+  }
+
+  // Arm the notifications, the devices already there are of no interest.
+  io_object_t object;
+  while ((object = IOIteratorNext(m_addedIterator)))
+    IOObjectRelease(object);
+  while ((object = IOIteratorNext(m_removedIterator)))
+    IOObjectRelease(object);
+
+  return true;
+}
+
+#elif defined(Q_OS_WIN)
+
+#define HOTPLUG_WINDOW_CLASS L"PlexMediaPlayerHotplug"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::DeviceHotplugMonitor(QObject* parent) : QObject(parent), m_window(nullptr),
+  m_notification(nullptr)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::~DeviceHotplugMonitor()
+{
+  if (m_notification)
+    UnregisterDeviceNotification(m_notification);
+  if (m_window)
+    DestroyWindow(m_window);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+LRESULT CALLBACK DeviceHotplugMonitor::windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+  if (message == WM_DEVICECHANGE &&
+      (wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE || wParam == DBT_DEVNODES_CHANGED))
+  {
+    auto monitor = (DeviceHotplugMonitor*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    if (monitor)
+      emit monitor->devicesChanged();
+    return TRUE;
+  }
+
+  return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DeviceHotplugMonitor::start()
+{
+  WNDCLASSW windowClass = {};
+  windowClass.lpfnWndProc = windowProc;
+  windowClass.hInstance = GetModuleHandle(nullptr);
+  windowClass.lpszClassName = HOTPLUG_WINDOW_CLASS;
+  RegisterClassW(&windowClass);
+
+  // A hidden top level window, message-only windows don't get the broadcasts. The
+  // event dispatcher of the thread that created it delivers its messages.
+  m_window = CreateWindowW(HOTPLUG_WINDOW_CLASS, L"", WS_OVERLAPPED, 0, 0, 0, 0, nullptr, nullptr,
+                           windowClass.hInstance, nullptr);
+  if (!m_window)
+  {
+    QLOG_WARN() << "Failed to create the window for device notifications";
+    return false;
+  }
+  SetWindowLongPtr(m_window, GWLP_USERDATA, (LONG_PTR)this);
+
+  // Serial ports are broadcast anyway, this adds the USB device interfaces.
+  DEV_BROADCAST_DEVICEINTERFACE_W filter = {};
+  filter.dbcc_size = sizeof(filter);
+  filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+  m_notification = RegisterDeviceNotificationW(m_window, &filter,
+                                               DEVICE_NOTIFY_WINDOW_HANDLE | DEVICE_NOTIFY_ALL_INTERFACE_CLASSES);
+
+  return true;
+}
+
+#elif defined(Q_OS_LINUX)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::DeviceHotplugMonitor(QObject* parent) : QObject(parent), m_socket(-1),
+  m_notifier(nullptr)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::~DeviceHotplugMonitor()
+{
+  delete m_notifier;
+  if (m_socket >= 0)
+    close(m_socket);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DeviceHotplugMonitor::start()
+{
+  // The same kernel uevents udev listens to, without needing libudev.
+  m_socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (m_socket < 0)
+  {
+    QLOG_WARN() << "Failed to open uevent socket:" << strerror(errno);
+    return false;
+  }
+
+  struct sockaddr_nl address = {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = 1; // kernel events
+  if (bind(m_socket, (struct sockaddr*)&address, sizeof(address)) < 0)
+  {
+    QLOG_WARN() << "Failed to bind uevent socket:" << strerror(errno);
+    close(m_socket);
+    m_socket = -1;
+    return false;
+  }
+
+  m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+  connect(m_notifier, &QSocketNotifier::activated, this, &DeviceHotplugMonitor::readEvents);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DeviceHotplugMonitor::readEvents()
+{
+  bool changed = false;
+  char buffer[4096];
+  ssize_t size;
+
+  // "ACTION@DEVPATH\0KEY=VALUE\0...", only adding and removing ttys and USB devices matters.
+  while ((size = recv(m_socket, buffer, sizeof(buffer) - 1, 0)) > 0)
+  {
+    buffer[size] = '\0';
+    bool action = !strncmp(buffer, "add@", 4) || !strncmp(buffer, "remove@", 7);
+    if (!action)
+      continue;
+
+    for (char* field = buffer; field < buffer + size; field += strlen(field) + 1)
+    {
+      if (!strcmp(field, "SUBSYSTEM=tty") || !strcmp(field, "SUBSYSTEM=usb"))
+      {
+        changed = true;
+        break;
+      }
+    }
+  }
+
+  if (changed)
+    emit devicesChanged();
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::DeviceHotplugMonitor(QObject* parent) : QObject(parent)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DeviceHotplugMonitor::~DeviceHotplugMonitor()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DeviceHotplugMonitor::start()
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DEVICEHOTPLUGMONITOR_H
+#define DEVICEHOTPLUGMONITOR_H
+
+#include <QObject>
+
+#if defined(Q_OS_MAC)
+#include <IOKit/IOKitLib.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_LINUX)
+class QSocketNotifier;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tells when USB or serial devices come and go: kernel uevents on Linux, IOKit
+// notifications on macOS and WM_DEVICECHANGE on Windows. Lives on the thread of
+// whoever creates it; on Windows that thread needs an event loop.
+//
+class DeviceHotplugMonitor : public QObject
+{
+  Q_OBJECT
+public:
+  explicit DeviceHotplugMonitor(QObject* parent = nullptr);
+  ~DeviceHotplugMonitor() override;
+
+  // Returns false if hotplug events aren't available here, callers should poll then.
+  bool start();
+
+Q_SIGNALS:
+  // Something was plugged in or removed. Events come in bursts, so receivers
+  // should wait a moment before looking.
+  void devicesChanged();
+
+private:
+#if defined(Q_OS_MAC)
+  static void onIOKitNotification(void* refcon, io_iterator_t iterator);
+
+  IONotificationPortRef m_port;
+  io_iterator_t m_addedIterator;
+  io_iterator_t m_removedIterator;
+#elif defined(Q_OS_WIN)
+  static LRESULT CALLBACK windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+
+  HWND m_window;
+  HDEVNOTIFY m_notification;
+#elif defined(Q_OS_LINUX)
+  void readEvents();
+
+  int m_socket;
+  QSocketNotifier* m_notifier;
+#endif
+};
+
+#endif // DEVICEHOTPLUGMONITOR_H
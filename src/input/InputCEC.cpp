@@ -1,6 +1,7 @@
 
 #include "QsLog.h"
 #include "InputCEC.h"
+#include "DeviceHotplugMonitor.h"
 #include "settings/SettingsComponent.h"
 #include "power/PowerComponent.h"
 
@@ -84,7 +85,10 @@ bool InputCECWorker::init()
   m_configuration.Clear();
   m_callbacks.Clear();
 
-  m_verboseLogging = SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "verbose_logging").toBool();
+  // this is the CEC thread
+  SettingsSnapshotPtr settings = SettingsComponent::Get().snapshot();
+
+  m_verboseLogging = settings->value(SETTINGS_SECTION_CEC, "verbose_logging").toBool();
 
   m_configuration.clientVersion = LIBCEC_VERSION_CURRENT;
   qstrcpy(m_configuration.strDeviceName, "Plex");
@@ -98,8 +102,8 @@ bool InputCECWorker::init()
   m_configuration.bAutodetectAddress =  CEC_DEFAULT_SETTING_AUTODETECT_ADDRESS;
   m_configuration.iPhysicalAddress = CEC_PHYSICAL_ADDRESS_TV;
   m_configuration.baseDevice = CECDEVICE_AUDIOSYSTEM;
-  m_configuration.bActivateSource = (uint8_t)SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "activatesource").toBool();
-  m_configuration.iHDMIPort = (quint8)SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "hdmiport").toInt();
+  m_configuration.bActivateSource = (uint8_t)settings->value(SETTINGS_SECTION_CEC, "activatesource").toBool();
+  m_configuration.iHDMIPort = (quint8)settings->value(SETTINGS_SECTION_CEC, "hdmiport").toInt();
 
   // open libcec
   m_adapter = (ICECAdapter*)CECInitialise(&m_configuration);
@@ -118,11 +122,26 @@ bool InputCECWorker::init()
   // check for attached adapters
   checkAdapter();
 
-  // Start a timer to keep track of attached/removed adapters
+  // Keep track of attached/removed adapters. Looking for them goes through the
+  // USB bus, so only do it when something changed, and poll only if we can't tell.
   m_timer = new QTimer(nullptr);
-  m_timer->setInterval(10 * 1000);
   connect(m_timer, &QTimer::timeout, this, &InputCECWorker::checkAdapter);
-  m_timer->start();
+
+  m_hotplug = new DeviceHotplugMonitor(this);
+  if (m_hotplug->start())
+  {
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(CEC_HOTPLUG_SETTLE_MSEC);
+    connect(m_hotplug, &DeviceHotplugMonitor::devicesChanged,
+            m_timer, static_cast<void (QTimer::*)()>(&QTimer::start));
+  }
+  else
+  {
+    QLOG_INFO() << "No device hotplug events, polling for CEC adapters.";
+    m_timer->setInterval(CEC_ADAPTER_POLL_MSEC);
+    m_timer->setTimerType(Qt::VeryCoarseTimer);
+    m_timer->start();
+  }
 
   return true;
 }
@@ -130,12 +149,16 @@ bool InputCECWorker::init()
 //////////////////////////////////////////////////////////////////////////////////////////////////
 void InputCECWorker::closeCec()
 {
-  if (m_timer->isActive())
+  if (m_timer)
   {
     m_timer->stop();
     delete m_timer;
+    m_timer = nullptr;
   }
 
+  delete m_hotplug;
+  m_hotplug = nullptr;
+
   if (m_adapter)
   {
     QLOG_DEBUG() << "Closing libCEC.";
@@ -195,7 +218,7 @@ void InputCECWorker::checkAdapter()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void InputCECWorker::sendReceivedInput(const QString &source, const QString &keycode, InputBase::InputkeyState keyState)
 {
-  emit receivedInput(source, keycode, keyState);
+  emit receivedInput(source, keycode, keyState, m_commandTimestamp);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -267,20 +290,68 @@ QString InputCECWorker::getCommandParamsList(const cec_command *command)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
 {
-  QString cmdString, keyCode;
-  bool useUpDown = SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "usekeyupdown").toBool();
   auto cec = static_cast<InputCECWorker*>(cbParam);
   Q_ASSERT(cec);
 
-  if (cec->m_verboseLogging)
+  quint32 head = cec->m_queueHead.load(std::memory_order_relaxed);
+  quint32 tail = cec->m_queueTail.load(std::memory_order_acquire);
+
+  if (head - tail >= CEC_COMMAND_QUEUE_SIZE)
   {
-    QLOG_DEBUG() << "CecCommand received " << QString::number(command->opcode, 16).toUpper() << "," << cec->getCommandParamsList(command);
+    // the worker is hopelessly behind, don't make libcec wait for it
+    cec->m_droppedCommands++;
+    return;
+  }
+
+  QueuedCommand& entry = cec->m_commandQueue[head % CEC_COMMAND_QUEUE_SIZE];
+  entry.command = *command;
+  entry.timestamp = InputBase::timestamp();
+  cec->m_queueHead.store(head + 1, std::memory_order_release);
+
+  // coalesce wakeups: if one is pending already, the worker will pick this
+  // command up together with the others
+  if (!cec->m_wakeupPending.exchange(true))
+    QMetaObject::invokeMethod(cec, "processCommands", Qt::QueuedConnection);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputCECWorker::processCommands()
+{
+  // anything queued from now on needs another wakeup
+  m_wakeupPending = false;
+
+  quint32 dropped = m_droppedCommands.exchange(0);
+  if (dropped)
+    QLOG_WARN() << "CEC command queue overflow, dropped" << dropped << "commands";
+
+  quint32 tail = m_queueTail.load(std::memory_order_relaxed);
+  while (tail != m_queueHead.load(std::memory_order_acquire))
+  {
+    // copy the entry out before releasing the slot to the callback thread
+    QueuedCommand entry = m_commandQueue[tail % CEC_COMMAND_QUEUE_SIZE];
+    m_queueTail.store(++tail, std::memory_order_release);
+
+    m_commandTimestamp = entry.timestamp;
+    handleCommand(&entry.command);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputCECWorker::handleCommand(const cec_command* command)
+{
+  QString cmdString, keyCode;
+  SettingsSnapshotPtr settings = SettingsComponent::Get().snapshot();
+  bool useUpDown = settings->value(SETTINGS_SECTION_CEC, "usekeyupdown").toBool();
+
+  if (m_verboseLogging)
+  {
+    QLOG_DEBUG() << "CecCommand received " << QString::number(command->opcode, 16).toUpper() << "," << getCommandParamsList(command);
   }
 
   switch(command->opcode)
   {
     case CEC_OPCODE_PLAY:
-      cec->sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_PLAY, InputBase::KeyPressed);
+      sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_PLAY, InputBase::KeyPressed);
       break;
 
     case CEC_OPCODE_DECK_CONTROL:
@@ -308,7 +379,7 @@ void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
         {
           // We don't have up & down events for those special keys
           // so we just fake them
-          cec->sendReceivedInput(CEC_INPUT_NAME, keyCode, InputBase::KeyPressed);
+          sendReceivedInput(CEC_INPUT_NAME, keyCode, InputBase::KeyPressed);
         }
       }
       break;
@@ -322,9 +393,9 @@ void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
                   (command->opcode == CEC_OPCODE_USER_CONTROL_PRESSED);
 
 
-      if (cec->m_verboseLogging)
+      if (m_verboseLogging)
       {
-        QLOG_DEBUG() << "CecCommand button (Down= " << down << ")" << cec->getCommandParamsList(command);
+        QLOG_DEBUG() << "CecCommand button (Down= " << down << ")" << getCommandParamsList(command);
       }
 
       if (command->parameters.size && down)
@@ -334,9 +405,9 @@ void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
           // samsung Return key
           case CEC_USER_CONTROL_CODE_AN_RETURN:
             if (useUpDown)
-              cec->sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_BACK, down ? InputBase::KeyDown : InputBase::KeyUp);
+              sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_BACK, down ? InputBase::KeyDown : InputBase::KeyUp);
             else if (down)
-              cec->sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_BACK, InputBase::KeyPressed);
+              sendReceivedInput(CEC_INPUT_NAME, INPUT_KEY_BACK, InputBase::KeyPressed);
 
             return;
             break;
@@ -346,14 +417,14 @@ void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
         }
       }
 
-      cmdString = cec->getCommandString((cec_user_control_code)command->parameters[0]);
+      cmdString = getCommandString((cec_user_control_code)command->parameters[0]);
 
       if (!cmdString.isEmpty())
       {
         if (useUpDown)
-          cec->sendReceivedInput(CEC_INPUT_NAME, cmdString, down ? InputBase::KeyDown : InputBase::KeyUp);
+          sendReceivedInput(CEC_INPUT_NAME, cmdString, down ? InputBase::KeyDown : InputBase::KeyUp);
         else if (down)
-          cec->sendReceivedInput(CEC_INPUT_NAME, cmdString, InputBase::KeyPressed);
+          sendReceivedInput(CEC_INPUT_NAME, cmdString, InputBase::KeyPressed);
       }
     }
       break;
@@ -364,18 +435,18 @@ void InputCECWorker::CecCommand(void *cbParam, const cec_command *command)
 
     case CEC_OPCODE_STANDBY:
       QLOG_DEBUG() << "CecCommand : Got a standby Request";
-      if ((SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "suspendonstandby").toBool()) && PowerComponent::Get().canSuspend())
+      if ((settings->value(SETTINGS_SECTION_CEC, "suspendonstandby").toBool()) && PowerComponent::Get().canSuspend())
       {
         PowerComponent::Get().Suspend();
       }
-      else if ((SettingsComponent::Get().value(SETTINGS_SECTION_CEC, "poweroffonstandby").toBool()) && PowerComponent::Get().canPowerOff())
+      else if ((settings->value(SETTINGS_SECTION_CEC, "poweroffonstandby").toBool()) && PowerComponent::Get().canPowerOff())
       {
         PowerComponent::Get().PowerOff();
       }
       break;
 
     default:
-      QLOG_DEBUG() << "Unhandled CEC command " << command->opcode << ", " << cec->getCommandParamsList(command);
+      QLOG_DEBUG() << "Unhandled CEC command " << command->opcode << ", " << getCommandParamsList(command);
       break;
   }
 
@@ -417,7 +488,12 @@ void InputCECWorker::CecAlert(void *cbParam, const libcec_alert type, const libc
     QLOG_DEBUG() << "libCEC : Reopenning adapter";
     auto cec = static_cast<InputCECWorker*>(cbParam);
     if (cec)
+    {
       cec->closeAdapter();
+      // No hotplug event will come for a busy or lost port, so look again soon.
+      if (cec->m_timer)
+        QMetaObject::invokeMethod(cec->m_timer, "start", Qt::QueuedConnection);
+    }
   }
 
   return;
@@ -3,6 +3,9 @@
 
 #include <QMutex>
 #include <QTimer>
+
+#include <atomic>
+
 #include "input/InputComponent.h"
 #include <libcec/cec.h>
 
@@ -12,7 +15,17 @@ using namespace CEC;
 
 #define CEC_INPUT_NAME "CEC"
 
+// number of commands that can be pending between the libcec callback and the
+// worker thread, must be a power of two
+#define CEC_COMMAND_QUEUE_SIZE 64
+
+// wait for a burst of hotplug events to settle before looking for adapters
+#define CEC_HOTPLUG_SETTLE_MSEC 1000
+// how often to look for adapters if there are no hotplug events
+#define CEC_ADAPTER_POLL_MSEC (10 * 1000)
+
 class InputCECWorker;
+class DeviceHotplugMonitor;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class InputCEC : public InputBase
@@ -35,16 +48,18 @@ class InputCECWorker : public QObject
 {
 Q_OBJECT
 public:
-  explicit InputCECWorker(QObject* parent = nullptr) : QObject(parent), m_adapter(nullptr), m_adapterPort("")
+  explicit InputCECWorker(QObject* parent = nullptr) : QObject(parent), m_adapter(nullptr), m_adapterPort(""),
+    m_timer(nullptr), m_hotplug(nullptr), m_queueHead(0), m_queueTail(0), m_droppedCommands(0), m_wakeupPending(false), m_commandTimestamp(0)
   {
   }
 
   Q_SLOT bool init();
-  Q_SIGNAL void receivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState);
+  Q_SIGNAL void receivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp);
   Q_SLOT void closeCec();
 
 public slots:
   void checkAdapter();
+  void processCommands();
 
 private:
   bool openAdapter();
@@ -52,6 +67,7 @@ private:
 
   QString getCommandString(cec_user_control_code code);
   void sendReceivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState);
+  void handleCommand(const cec_command* command);
   QString getCommandParamsList(const cec_command *command);
 
   // libcec callbacks
@@ -63,8 +79,27 @@ private:
   ICECCallbacks m_callbacks;
   ICECAdapter* m_adapter;
   QString m_adapterPort;
+  // checkAdapter() after hotplug events, or periodically without them
   QTimer* m_timer;
+  DeviceHotplugMonitor* m_hotplug;
   bool m_verboseLogging;
+
+  // Single producer (libcec callback thread), single consumer (worker thread)
+  // ring buffer. The callback only copies the command and returns, so that
+  // libcec is never blocked by us.
+  struct QueuedCommand
+  {
+    cec_command command;
+    qint64 timestamp;
+  };
+  QueuedCommand m_commandQueue[CEC_COMMAND_QUEUE_SIZE];
+  std::atomic<quint32> m_queueHead;   // written by the callback thread
+  std::atomic<quint32> m_queueTail;   // written by the worker thread
+  std::atomic<quint32> m_droppedCommands;
+  std::atomic<bool> m_wakeupPending;
+
+  // timestamp of the command being handled, see sendReceivedInput()
+  qint64 m_commandTimestamp;
 };
 
 #endif // INPUTCEC_H
@@ -3,9 +3,12 @@
 #include "settings/SettingsComponent.h"
 #include "system/SystemComponent.h"
 #include "power/PowerComponent.h"
+#include "utils/Trace.h"
+#include "utils/AllocationTracker.h"
 #include "InputKeyboard.h"
 #include "InputSocket.h"
 #include "InputRoku.h"
+#include "InputUdp.h"
 
 #ifdef Q_OS_MAC
 #include "apple/InputAppleRemote.h"
@@ -24,6 +27,8 @@
 #include "InputCEC.h"
 #endif
 
+#include <cmath>
+
 #define LONG_HOLD_MSEC 500
 #define INITAL_AUTOREPEAT_MSEC 650
 
@@ -36,10 +41,33 @@
 //
 #define AUTOREPEAT_MSEC 60
 
+// Window in which repeated actions are merged if the web client asked for it.
+// About one frame, so that the UI sees at most one navigation event per frame.
+#define COALESCE_INPUT_MSEC 16
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-InputComponent::InputComponent(QObject* parent) : ComponentBase(parent)
+InputComponent::InputComponent(QObject* parent) : ComponentBase(parent),
+  m_autoRepeatCount(0), m_inputAcknowledging(false), m_awaitingAcknowledge(false),
+  m_coalesceInput(false), m_coalescedCount(0),
+  m_analogScrolling(false), m_scrollX(0), m_scrollY(0), m_scrollPending(false)
 {
   m_mappings = new InputMapping(this);
+
+  // for auto-repeating inputs
+  //
+  m_autoRepeatTimer = new QTimer(this);
+  m_autoRepeatTimer->setSingleShot(true);
+  connect(m_autoRepeatTimer, &QTimer::timeout, this, &InputComponent::autoRepeat);
+
+  m_coalesceTimer = new QTimer(this);
+  m_coalesceTimer->setSingleShot(true);
+  m_coalesceTimer->setInterval(COALESCE_INPUT_MSEC);
+  connect(m_coalesceTimer, &QTimer::timeout, this, &InputComponent::flushCoalescedActions);
+
+  m_scrollTimer = new QTimer(this);
+  m_scrollTimer->setSingleShot(true);
+  m_scrollTimer->setInterval(COALESCE_INPUT_MSEC);
+  connect(m_scrollTimer, &QTimer::timeout, this, &InputComponent::flushScroll);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -58,20 +86,7 @@ bool InputComponent::addInput(InputBase* base)
   // needs to be remaped in remapInput and then finally send it out to JS land.
   //
   connect(base, &InputBase::receivedInput, this, &InputComponent::remapInput);
-
-  // for auto-repeating inputs
-  //
-  m_autoRepeatTimer = new QTimer(this);
-  connect(m_autoRepeatTimer, &QTimer::timeout, [=]()
-  {
-    if (!m_autoRepeatActions.isEmpty())
-    {
-      QLOG_DEBUG() << "Emit input action (autorepeat):" << m_autoRepeatActions;
-      emit hostInput(m_autoRepeatActions);
-    }
-
-    m_autoRepeatTimer->setInterval(AUTOREPEAT_MSEC);
-  });
+  connect(base, &InputBase::receivedScroll, this, &InputComponent::remapScroll);
 
   return true;
 }
@@ -83,8 +98,10 @@ bool InputComponent::componentInitialize()
   m_mappings->loadMappings();
 
   addInput(&InputKeyboard::Get());
+  connect(&InputKeyboard::Get(), &InputKeyboard::receivedKey, this, &InputComponent::remapKey);
   addInput(new InputSocket(this));
   addInput(new InputRoku(this));
+  addInput(new InputUdp(this));
 
 #ifdef Q_OS_MAC
   addInput(new InputAppleRemote(this));
@@ -108,57 +125,100 @@ bool InputComponent::componentInitialize()
 /////////////////////////////////////////////////////////////////////////////////////////
 void InputComponent::handleAction(const QString& action)
 {
-  if (action.startsWith("host:"))
+  if (!action.startsWith("host:"))
+    return;
+
+  auto it = m_hostActions.constFind(action);
+  if (it == m_hostActions.constEnd())
   {
-    QStringList argList = action.mid(5).split(" ");
-    QString hostCommand = argList.value(0);
-    QString hostArguments;
+    HostAction hostAction;
+    int space = action.indexOf(' ', 5);
+    hostAction.m_name = action.mid(5, space < 0 ? -1 : space - 5);
+    if (space >= 0)
+      hostAction.m_arguments = action.mid(space + 1);
+    hostAction.m_command = hostCommandId(hostAction.m_name);
+    if (hostAction.m_command >= 0)
+      hostAction.m_value = parseArguments(m_hostCommands.at(hostAction.m_command).m_arguments,
+                                          hostAction.m_arguments);
+
+    if (m_hostActions.size() >= INPUT_HOST_ACTION_CACHE_SIZE)
+      m_hostActions.clear();
+    it = m_hostActions.insert(action, hostAction);
+  }
 
-    if (argList.size() > 1)
-    {
-      argList.pop_front();
-      hostArguments = argList.join(" ");
-    }
+  const HostAction& hostAction = it.value();
 
-    QLOG_DEBUG() << "Got host command:" << hostCommand << "arguments:" << hostArguments;
-    if (m_hostCommands.contains(hostCommand))
-    {
-      ReceiverSlot* recvSlot = m_hostCommands.value(hostCommand);
-      if (recvSlot)
-      {
-        if (recvSlot->m_function)
-        {
-          QLOG_DEBUG() << "Invoking anonymous function";
-          recvSlot->m_function();
-        }
-        else
-        {
-          QLOG_DEBUG() << "Invoking slot" << qPrintable(recvSlot->m_slot.data());
-          QGenericArgument arg0 = QGenericArgument();
+  QLOG_DEBUG() << "Got host command:" << hostAction.m_name << "arguments:" << hostAction.m_arguments;
+  if (hostAction.m_command < 0)
+  {
+    QLOG_WARN() << "No such host command:" << hostAction.m_name;
+    return;
+  }
+
+  if (!hostAction.m_value.isValid())
+  {
+    QLOG_WARN() << "Invalid arguments for host command" << hostAction.m_name << ":" << hostAction.m_arguments;
+    return;
+  }
 
-          if (recvSlot->m_hasArguments)
-            arg0 = Q_ARG(const QString&, hostArguments);
+  const ReceiverSlot& recvSlot = m_hostCommands.at(hostAction.m_command);
+  QLOG_DEBUG() << "Invoking" << qPrintable(recvSlot.m_target);
+  recvSlot.m_function(hostAction.m_value);
+}
 
-          if (!QMetaObject::invokeMethod(recvSlot->m_receiver, recvSlot->m_slot.data(),
-                                         Qt::AutoConnection, arg0))
-          {
-            QLOG_ERROR() << "Invoking slot" << qPrintable(recvSlot->m_slot.data()) << "failed!";
-          }
-        }
-      }
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariant InputComponent::parseArguments(HostCommandArguments type, const QString& arguments)
+{
+  bool ok = true;
+  switch (type)
+  {
+    case HostArgumentsNone:
+      // ignored, like they always were
+      return true;
+    case HostArgumentsString:
+      return arguments;
+    case HostArgumentsInt:
+    {
+      int value = arguments.trimmed().toInt(&ok);
+      return ok ? QVariant(value) : QVariant();
     }
-    else
+    case HostArgumentsNumber:
     {
-      QLOG_WARN() << "No such host command:" << hostCommand;
+      double value = arguments.trimmed().toDouble(&ok);
+      return ok ? QVariant(value) : QVariant();
     }
   }
+  return QVariant();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void InputComponent::remapInput(const QString &source, const QString &keycode, InputBase::InputkeyState keyState)
+void InputComponent::remapInput(const QString &source, const QString &keycode, InputBase::InputkeyState keyState, qint64 timestamp)
 {
+  ALLOCATION_TAG(Input);
+  TRACE_SCOPE("input", "remapInput");
   QLOG_DEBUG() << "Input received: source:" << source << "keycode:" << keycode << ":" << keyState;
 
+  if (beginInput(keyState, timestamp))
+    mappedInput(source, m_mappings->mapToAction(source, keycode), keyState);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::remapKey(int combination, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp)
+{
+  ALLOCATION_TAG(Input);
+  TRACE_SCOPE("input", "remapKey");
+  QLOG_DEBUG() << "Input received: source: Keyboard keycode:" << keycode << ":" << keyState;
+
+  // a single lookup from the key event to the actions, that's all keyboards do while navigating
+  if (beginInput(keyState, timestamp))
+    mappedInput("Keyboard", m_mappings->keyboardActions(combination, keycode), keyState);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool InputComponent::beginInput(InputBase::InputkeyState keyState, qint64 timestamp)
+{
+  m_latency.received(timestamp);
+
   emit receivedInput();
 
   if (keyState == InputBase::KeyUp)
@@ -178,17 +238,22 @@ void InputComponent::remapInput(const QString &source, const QString &keycode, I
       m_currentLongPressAction.clear();
 
       QLOG_DEBUG() << "Emit input action (" + type + "):" << action;
-      emit hostInput(QStringList{action});
+      sendHostInput(QStringList{action}, false);
     }
 
-    return;
+    return false;
   }
 
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::mappedInput(const QString& source, const QVariantList& actions, InputBase::InputkeyState keyState)
+{
   QStringList queuedActions;
   m_autoRepeatActions.clear();
 
-  auto actions = m_mappings->mapToAction(source, keycode);
-  for (auto action : actions)
+  for (const QVariant& action : actions)
   {
     if (action.type() == QVariant::String)
     {
@@ -220,23 +285,176 @@ void InputComponent::remapInput(const QString &source, const QString &keycode, I
   }
 
   if (!m_autoRepeatActions.isEmpty() && keyState != InputBase::KeyPressed)
-    m_autoRepeatTimer->start(INITAL_AUTOREPEAT_MSEC);
+  {
+    AutoRepeatCurve defaults = { INITAL_AUTOREPEAT_MSEC, AUTOREPEAT_MSEC, AUTOREPEAT_MSEC, 1.0 };
+    m_autoRepeatCurve = m_mappings->autoRepeatCurve(source, m_autoRepeatActions.first(), defaults);
+    m_autoRepeatCount = 0;
+    m_autoRepeatTimer->start(m_autoRepeatCurve.delay);
+  }
 
   if (!queuedActions.isEmpty())
   {
     if (SystemComponent::Get().isWebClientConnected())
     {
       QLOG_DEBUG() << "Emit input action:" << queuedActions;
-      emit hostInput(queuedActions);
+      // only plain actions repeat, so only those are safe to merge
+      sendHostInput(queuedActions, queuedActions == m_autoRepeatActions);
     }
     else
     {
       QLOG_DEBUG() << "Web Client has not connected, handling input in host instead.";
+      m_latency.delivered();
       executeActions(queuedActions);
     }
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::autoRepeat()
+{
+  if (m_autoRepeatActions.isEmpty())
+    return;
+
+  if (m_inputAcknowledging && m_awaitingAcknowledge)
+  {
+    QLOG_DEBUG() << "Dropping autorepeat, web client is still busy with the last action";
+  }
+  else
+  {
+    QLOG_DEBUG() << "Emit input action (autorepeat):" << m_autoRepeatActions;
+    sendHostInput(m_autoRepeatActions, true);
+  }
+
+  m_autoRepeatCount++;
+
+  double interval = m_autoRepeatCurve.interval * std::pow(m_autoRepeatCurve.acceleration, m_autoRepeatCount);
+  m_autoRepeatTimer->start(qMax(m_autoRepeatCurve.minInterval, (int)interval));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::acknowledgeInput()
+{
+  m_inputAcknowledging = true;
+  m_awaitingAcknowledge = false;
+  m_latency.acknowledged();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::sendHostInput(const QStringList& actions, bool mergeable)
+{
+  m_awaitingAcknowledge = true;
+  m_latency.delivered();
+
+  if (!m_coalesceInput)
+  {
+    emit hostInput(actions);
+    return;
+  }
+
+  if (mergeable && m_coalescedCount > 0 && m_coalescedActions == actions)
+  {
+    m_coalescedCount++;
+    return;
+  }
+
+  // keep order: whatever was merged so far goes out before the new actions
+  flushCoalescedActions();
+
+  if (mergeable && m_coalesceTimer->isActive())
+  {
+    // still inside the window of the last event, hold on to it for a bit
+    m_coalescedActions = actions;
+    m_coalescedCount = 1;
+    return;
+  }
+
+  // nothing was sent recently, deliver right away and open a new window
+  emit hostInput(actions);
+  m_coalesceTimer->start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::flushCoalescedActions()
+{
+  if (m_coalescedCount == 0)
+    return;
+
+  if (m_coalescedCount == 1)
+    emit hostInput(m_coalescedActions);
+  else
+    emit hostInputRepeated(m_coalescedActions, m_coalescedCount);
+
+  m_coalescedActions.clear();
+  m_coalescedCount = 0;
+  m_coalesceTimer->start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::setInputCoalescing(bool enable)
+{
+  QLOG_INFO() << "Input coalescing" << (enable ? "enabled" : "disabled");
+
+  if (!enable)
+    flushCoalescedActions();
+
+  m_coalesceInput = enable;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::setAnalogScrolling(bool enable)
+{
+  QLOG_INFO() << "Analog scrolling" << (enable ? "enabled" : "disabled");
+
+  m_analogScrolling = enable;
+  for (auto input : m_inputs)
+    input->setAnalogScrolling(enable);
+
+  if (!enable && (m_scrollX != 0 || m_scrollY != 0))
+  {
+    // don't leave web scrolling forever
+    m_scrollTimer->stop();
+    m_scrollPending = false;
+    m_scrollX = m_scrollY = 0;
+    emit hostScroll(0, 0);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::remapScroll(const QString& source, double x, double y, qint64 timestamp)
+{
+  Q_UNUSED(source);
+  Q_UNUSED(timestamp);
+
+  if (!m_analogScrolling)
+    return;
+
+  emit receivedInput();
+
+  // only the newest velocity matters, web gets it at most once per frame
+  m_scrollX = x;
+  m_scrollY = y;
+
+  if (m_scrollTimer->isActive())
+  {
+    m_scrollPending = true;
+    return;
+  }
+
+  emit hostScroll(m_scrollX, m_scrollY);
+  m_scrollTimer->start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputComponent::flushScroll()
+{
+  if (!m_scrollPending)
+    return;
+
+  m_scrollPending = false;
+  emit hostScroll(m_scrollX, m_scrollY);
+  m_scrollTimer->start();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void InputComponent::executeActions(const QStringList& actions)
 {
@@ -245,42 +463,98 @@ void InputComponent::executeActions(const QStringList& actions)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputComponent::registerHostCommand(const QString& command, QObject* receiver, const char* slot)
+int InputComponent::addHostCommand(const QString& command, const ReceiverSlot& recvSlot)
 {
-  auto  recvSlot = new ReceiverSlot;
-  recvSlot->m_receiver = receiver;
-  recvSlot->m_slot = QMetaObject::normalizedSignature(slot);
-  recvSlot->m_hasArguments = false;
+  int id = m_hostCommandIds.value(command, -1);
+  if (id >= 0)
+  {
+    m_hostCommands[id] = recvSlot;
+    return id;
+  }
 
-  QLOG_DEBUG() << "Adding host command:" << qPrintable(command) << "mapped to"
-               << qPrintable(QString(receiver->metaObject()->className()) + "::" + recvSlot->m_slot);
+  id = m_hostCommands.size();
+  m_hostCommands.append(recvSlot);
+  m_hostCommandIds.insert(command, id);
 
-  m_hostCommands.insert(command, recvSlot);
+  // parsed before this existed
+  m_hostActions.clear();
+  return id;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+int InputComponent::registerHostCommand(const QString& command, QObject* receiver, const char* slot)
+{
+  QByteArray name = QMetaObject::normalizedSignature(slot);
+
+  ReceiverSlot recvSlot;
+  recvSlot.m_arguments = HostArgumentsNone;
+  recvSlot.m_target = QString(receiver->metaObject()->className()) + "::" + name;
 
-  auto slotWithArgs = QString("%1(QString)").arg(QString::fromLatin1(recvSlot->m_slot)).toLatin1();
-  auto slotWithoutArgs = QString("%1()").arg(QString::fromLatin1(recvSlot->m_slot)).toLatin1();
-  if (recvSlot->m_receiver->metaObject()->indexOfMethod(slotWithArgs.data()) != -1)
+  QLOG_DEBUG() << "Adding host command:" << qPrintable(command) << "mapped to" << qPrintable(recvSlot.m_target);
+
+  // which signature the slot has is only looked up here, the function calls it through the
+  // resolved QMetaMethod with the argument already parsed
+  static const struct { const char* m_signature; HostCommandArguments m_arguments; } signatures[] =
   {
-    QLOG_DEBUG() << "Host command maps to method with an argument.";
-    recvSlot->m_hasArguments = true;
-  }
-  else if (recvSlot->m_receiver->metaObject()->indexOfMethod(slotWithoutArgs.data()) != -1)
+    { "(QString)", HostArgumentsString },
+    { "(int)", HostArgumentsInt },
+    { "(double)", HostArgumentsNumber },
+    { "()", HostArgumentsNone }
+  };
+
+  const QMetaObject* meta = receiver->metaObject();
+  QMetaMethod method;
+  for (const auto& signature : signatures)
   {
-    QLOG_DEBUG() << "Host command maps to method without arguments.";
+    int index = meta->indexOfMethod((name + signature.m_signature).constData());
+    if (index != -1)
+    {
+      method = meta->method(index);
+      recvSlot.m_arguments = signature.m_arguments;
+      break;
+    }
   }
-  else
-  {
+
+  if (!method.isValid())
     QLOG_ERROR() << "Slot for host command missing, or has incorrect signature!";
-  }
+
+  QString target = recvSlot.m_target;
+  HostCommandArguments arguments = recvSlot.m_arguments;
+  recvSlot.m_function = [=](const QVariant& value)
+  {
+    bool invoked = false;
+    switch (arguments)
+    {
+      case HostArgumentsNone:
+        invoked = method.invoke(receiver, Qt::AutoConnection);
+        break;
+      case HostArgumentsString:
+        invoked = method.invoke(receiver, Qt::AutoConnection, Q_ARG(QString, value.toString()));
+        break;
+      case HostArgumentsInt:
+        invoked = method.invoke(receiver, Qt::AutoConnection, Q_ARG(int, value.toInt()));
+        break;
+      case HostArgumentsNumber:
+        invoked = method.invoke(receiver, Qt::AutoConnection, Q_ARG(double, value.toDouble()));
+        break;
+    }
+
+    if (!invoked)
+      QLOG_ERROR() << "Invoking slot" << qPrintable(target) << "failed!";
+  };
+
+  return addHostCommand(command, recvSlot);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputComponent::registerHostCommand(const QString& command, std::function<void(void)> function)
+int InputComponent::registerHostCommand(const QString& command, std::function<void(void)> function)
 {
-  auto recvSlot = new ReceiverSlot;
-  recvSlot->m_function = function;
+  ReceiverSlot recvSlot;
+  recvSlot.m_function = [=](const QVariant&) { function(); };
+  recvSlot.m_arguments = HostArgumentsNone;
+  recvSlot.m_target = "anonymous function";
   QLOG_DEBUG() << "Adding host command:" << qPrintable(command) << "mapped to anonymous function";
-  m_hostCommands.insert(command, recvSlot);
+  return addHostCommand(command, recvSlot);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -3,13 +3,18 @@
 
 #include "ComponentManager.h"
 #include "InputMapping.h"
+#include "InputLatency.h"
 
 #include <QThread>
 #include <QVariantMap>
+#include <QMetaMethod>
+#include <QVector>
 #include <QTimer>
 #include <QTime>
 
+#include <chrono>
 #include <functional>
+#include <type_traits>
 
 class InputBase : public QObject
 {
@@ -19,6 +24,10 @@ public:
   virtual bool initInput() = 0;
   virtual const char* inputName() = 0;
 
+  // Backends with analog sticks emit receivedScroll() for them while this is
+  // enabled, instead of turning them into key events.
+  virtual void setAnalogScrolling(bool enable) { Q_UNUSED(enable); }
+
   enum InputkeyState
   {
     KeyDown,
@@ -27,8 +36,19 @@ public:
   };
   Q_ENUM(InputkeyState)
 
+  // Monotonic time in usec. Backends pass this as the timestamp of
+  // receivedInput() as close to the hardware as possible, so latency can be
+  // traced through the whole input path.
+  static qint64 timestamp()
+  {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+  }
+
 signals:
-  void receivedInput(const QString& source, const QString& keycode, InputkeyState keystate);
+  void receivedInput(const QString& source, const QString& keycode, InputkeyState keystate, qint64 timestamp = 0);
+  // x and y are the scroll velocity, between -1 and 1. 0 for both means the stick was released.
+  void receivedScroll(const QString& source, double x, double y, qint64 timestamp);
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -80,12 +100,46 @@ signals:
 #define INPUT_KEY_DOWN_LONG    "KEY_DOWN_LONG"
 
 
+// parsed host actions that are kept, the web client can send any arguments
+#define INPUT_HOST_ACTION_CACHE_SIZE 256
+
+// What a host command takes as its argument. The arguments of an action are parsed into
+// this once, when the action is first seen.
+enum HostCommandArguments
+{
+  HostArgumentsNone,
+  HostArgumentsString,
+  HostArgumentsInt,
+  HostArgumentsNumber
+};
+
+template <typename Arg> struct HostCommandArgument;
+
+template <> struct HostCommandArgument<QString>
+{
+  static const HostCommandArguments type = HostArgumentsString;
+  static QString value(const QVariant& value) { return value.toString(); }
+};
+
+template <> struct HostCommandArgument<int>
+{
+  static const HostCommandArguments type = HostArgumentsInt;
+  static int value(const QVariant& value) { return value.toInt(); }
+};
+
+template <> struct HostCommandArgument<double>
+{
+  static const HostCommandArguments type = HostArgumentsNumber;
+  static double value(const QVariant& value) { return value.toDouble(); }
+};
+
 struct ReceiverSlot
 {
-  std::function<void(void)> m_function;
-  QObject* m_receiver;
-  QByteArray m_slot;
-  bool m_hasArguments;
+  // called with the parsed argument, its type is m_arguments
+  std::function<void(const QVariant&)> m_function;
+  HostCommandArguments m_arguments;
+  // for the log
+  QString m_target;
 };
 
 class InputComponent : public ComponentBase
@@ -97,9 +151,39 @@ public:
   const char* componentName() override { return "input"; }
   bool componentExport() override { return true; }
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings" }; }
 
-  void registerHostCommand(const QString& command, QObject* receiver, const char* slot);
-  void registerHostCommand(const QString& command, std::function<void(void)> function);
+  // The commands are interned, registering one returns its id.
+  int registerHostCommand(const QString& command, QObject* receiver, const char* slot);
+  int registerHostCommand(const QString& command, std::function<void(void)> function);
+
+  // Member functions are called directly, on the main thread, handleAction() runs there. The
+  // argument can be a QString, an int or a double, the return value is ignored.
+  template <typename C, typename T, typename R>
+  int registerHostCommand(const QString& command, C* receiver, R (T::*member)())
+  {
+    ReceiverSlot recvSlot;
+    recvSlot.m_function = [=](const QVariant&) { (static_cast<T*>(receiver)->*member)(); };
+    recvSlot.m_arguments = HostArgumentsNone;
+    recvSlot.m_target = QString(receiver->metaObject()->className()) + " member function";
+    return addHostCommand(command, recvSlot);
+  }
+
+  template <typename C, typename T, typename R, typename Arg>
+  int registerHostCommand(const QString& command, C* receiver, R (T::*member)(Arg))
+  {
+    typedef HostCommandArgument<typename std::decay<Arg>::type> Argument;
+    ReceiverSlot recvSlot;
+    recvSlot.m_function = [=](const QVariant& value)
+    {
+      (static_cast<T*>(receiver)->*member)(Argument::value(value));
+    };
+    recvSlot.m_arguments = Argument::type;
+    recvSlot.m_target = QString(receiver->metaObject()->className()) + " member function";
+    return addHostCommand(command, recvSlot);
+  }
+  // -1 if there's no such command
+  int hostCommandId(const QString& command) const { return m_hostCommandIds.value(command, -1); }
 
   // Called by web to actually execute pending actions. This is done in reaction
   // to hostInput(). The actions parameter contains a list of actions which
@@ -107,6 +191,22 @@ public:
   Q_INVOKABLE void executeActions(const QStringList& actions);
   void cancelAutoRepeat();
 
+  // Called by web to opt into coalesced input. If enabled, repeats of the same
+  // actions that arrive within one frame interval are merged and delivered
+  // through hostInputRepeated() instead of one hostInput() per repeat.
+  Q_INVOKABLE void setInputCoalescing(bool enable);
+
+  // Called by web to get analog sticks as hostScroll() instead of key events.
+  Q_INVOKABLE void setAnalogScrolling(bool enable);
+
+  // Called by web after it finished handling hostInput(). Once a client
+  // started doing this, auto repeats are dropped while an earlier action is
+  // still unacknowledged, so slow clients don't build up a backlog.
+  Q_INVOKABLE void acknowledgeInput();
+
+  // Latency percentiles of the last input events, for the debug overlay.
+  QString latencyInformation() const { return m_latency.summary(); }
+
 signals:
   // Always emitted when any input arrives
   void receivedInput();
@@ -115,23 +215,80 @@ signals:
   // in the keymap, such as "host:fullscreen".
   void hostInput(const QStringList& actions);
 
+  // Only emitted if input coalescing was enabled. Same as hostInput(), but the
+  // actions should be executed repeatCount times.
+  void hostInputRepeated(const QStringList& actions, int repeatCount);
+
+  // Only emitted if analog scrolling was enabled, at most once per frame while
+  // a stick is pushed. x and y are the velocity between -1 and 1, both are 0
+  // once the stick is released.
+  void hostScroll(double x, double y);
+
 private Q_SLOTS:
-  void remapInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState);
+  void remapInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp);
+  void remapKey(int combination, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp);
+  void flushCoalescedActions();
+  void remapScroll(const QString& source, double x, double y, qint64 timestamp);
+  void flushScroll();
+  void autoRepeat();
 
 private:
+  // drives remapInput() directly, see tests/InputTest.h
+  friend class InputTest;
+
   explicit InputComponent(QObject *parent = nullptr);
   bool addInput(InputBase* base);
+  // What remapInput() and remapKey() share. beginInput() returns false if there is
+  // nothing to map, like for key ups.
+  bool beginInput(InputBase::InputkeyState keyState, qint64 timestamp);
+  void mappedInput(const QString& source, const QVariantList& actions, InputBase::InputkeyState keyState);
   void handleAction(const QString& action);
+  int addHostCommand(const QString& command, const ReceiverSlot& recvSlot);
+  // Send actions to the web client. If mergeable is true the actions may be
+  // merged with identical ones that directly precede them.
+  void sendHostInput(const QStringList& actions, bool mergeable);
+
+  // by the id of the command
+  QVector<ReceiverSlot> m_hostCommands;
+  QHash<QString, int> m_hostCommandIds;
 
-  QHash<QString, ReceiverSlot*> m_hostCommands;
+  // "host:<command> <arguments>" actions, split up once. The same few come in over and over.
+  struct HostAction
+  {
+    int m_command;
+    QString m_name;
+    QString m_arguments;
+    // m_arguments parsed for the command, invalid if they don't fit
+    QVariant m_value;
+  };
+  static QVariant parseArguments(HostCommandArguments type, const QString& arguments);
+  QHash<QString, HostAction> m_hostActions;
   QList<InputBase*> m_inputs;
   InputMapping* m_mappings;
 
   QTimer* m_autoRepeatTimer;
   QStringList m_autoRepeatActions;
+  AutoRepeatCurve m_autoRepeatCurve;
+  int m_autoRepeatCount;
+
+  bool m_inputAcknowledging;
+  bool m_awaitingAcknowledge;
 
   QVariantMap m_currentLongPressAction;
   QTime m_longHoldTimer;
+
+  bool m_coalesceInput;
+  QTimer* m_coalesceTimer;
+  QStringList m_coalescedActions;
+  int m_coalescedCount;
+
+  bool m_analogScrolling;
+  QTimer* m_scrollTimer;
+  double m_scrollX;
+  double m_scrollY;
+  bool m_scrollPending;
+
+  InputLatency m_latency;
 };
 
 #endif // INPUTADAPTER_H
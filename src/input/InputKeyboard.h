@@ -18,11 +18,21 @@ public:
   bool initInput() override { return true; }
   const char* inputName() override { return "Keyboard"; }
 
-  void keyPress(const QString& keys, InputkeyState keyState)
+  void keyPress(const QString& keys, InputkeyState keyState, qint64 timestamp = 0)
   {
-    emit receivedInput("Keyboard", keys, keyState);
+    emit receivedInput("Keyboard", keys, keyState, timestamp);
   }
 
+  // The same for keys that are told apart by combination (Qt::Key | modifiers) alone,
+  // InputComponent looks their actions up by that instead of matching the name.
+  void keyPress(int combination, const QString& keys, InputkeyState keyState, qint64 timestamp)
+  {
+    emit receivedKey(combination, keys, keyState, timestamp);
+  }
+
+Q_SIGNALS:
+  void receivedKey(int combination, const QString& keys, InputkeyState keyState, qint64 timestamp);
+
 private:
   explicit InputKeyboard(QObject* parent = nullptr) : InputBase(parent) {}
 };
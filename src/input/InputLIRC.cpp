@@ -2,6 +2,11 @@
 #include <QGuiApplication>
 #include "QsLog.h"
 #include "InputLIRC.h"
+#include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 #define DEFAULT_LIRC_ADDRESS "/run/lirc/lircd"
 
@@ -9,7 +14,8 @@
 InputLIRC::InputLIRC(QObject* parent) : InputBase(parent)
 {
   socket = new QLocalSocket(this);
-  socketNotifier = NULL;
+  repeatInterval = 3;
+  verboseLogging = false;
 
   connect(socket, SIGNAL(error(QLocalSocket::LocalSocketError)), this,
           SLOT(socketerror(QLocalSocket::LocalSocketError)));
@@ -27,9 +33,29 @@ InputLIRC::~InputLIRC()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool InputLIRC::initInput()
 {
+  updateSettings();
+  connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_LIRC), &SettingsSection::valuesUpdated,
+          this, &InputLIRC::updateSettings);
+
   return connectToLIRC();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputLIRC::updateSettings()
+{
+  repeatInterval = qMax(1, SettingsComponent::Get().value(SETTINGS_SECTION_LIRC, "repeat_interval").toInt());
+  verboseLogging = SettingsComponent::Get().value(SETTINGS_SECTION_LIRC, "verbose_logging").toBool();
+
+  remoteRepeatIntervals.clear();
+  QString overrides = SettingsComponent::Get().value(SETTINGS_SECTION_LIRC, "remote_repeat_intervals").toString();
+  for (const QString& entry : overrides.split(',', QString::SkipEmptyParts))
+  {
+    int separator = entry.indexOf('=');
+    if (separator > 0)
+      remoteRepeatIntervals[entry.left(separator).trimmed().toUtf8()] = qMax(1, entry.mid(separator + 1).toInt());
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool InputLIRC::connectToLIRC()
 {
@@ -38,8 +64,9 @@ bool InputLIRC::connectToLIRC()
   socket->connectToServer(DEFAULT_LIRC_ADDRESS, QIODevice::ReadWrite);
   if (isConnected())
   {
-    socketNotifier = new QSocketNotifier(socket->socketDescriptor(), QSocketNotifier::Read, this);
-    connect(socketNotifier, SIGNAL(activated(int)), this, SLOT(read(int)));
+    // readyRead instead of a notifier on the descriptor, so the lines are already
+    // in QLocalSocket's buffer when we look for them.
+    connect(socket, &QLocalSocket::readyRead, this, &InputLIRC::read, Qt::UniqueConnection);
     return true;
   }
   else
@@ -83,35 +110,67 @@ void InputLIRC::socketerror(QLocalSocket::LocalSocketError socketError)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void InputLIRC::read(int handle)
+void InputLIRC::read()
 {
-  QString input;
+  qint64 timestamp = InputBase::timestamp();
+  char line[LIRC_MAX_LINE];
 
-  while ((input = socket->readLine()) != "")
+  while (socket->canReadLine())
   {
-    QStringList cmdList = input.split(' ', QString::KeepEmptyParts);
-    if (cmdList.size() == 4)
+    qint64 length = socket->readLine(line, sizeof(line));
+    if (length <= 0)
+      break;
+
+    if (line[length - 1] != '\n')
     {
-      // grab the input data
-      QString code = cmdList.at(0);
-      QString repeat = cmdList.at(1);
-      QString command = cmdList.at(2);
-      QString remote = cmdList.at(3);
-
-      int repeatCount = repeat.toInt();
-
-      QLOG_INFO() << "LIRC Got Key : " << command << ", repeat count:" << repeatCount
-                  << ", from remote " << remote;
-
-      // we dont want to have all the IR Bursts when we press a key
-      // it makes GUI unusable
-      if ((repeatCount % 3) == 0)
-      {
-        bool up = command.endsWith("_LIRCUP");
-        emit receivedInput("LIRC", command, up ? InputBase::KeyUp : InputBase::KeyDown);
-      }
+      // too long for anything lircd sends, skip the rest of it
+      while (length == sizeof(line) - 1 && line[length - 1] != '\n')
+        length = socket->readLine(line, sizeof(line));
+      QLOG_ERROR() << "Dropping overlong LIRC input";
+      continue;
     }
-    else
-      QLOG_ERROR() << "Unknown LIRC input: " << input;
+
+    line[length - 1] = '\0';
+    handleLine(line, length - 1, timestamp);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// "<code> <repeat count, hex> <button> <remote>", split in place.
+void InputLIRC::handleLine(char* line, qint64 length, qint64 timestamp)
+{
+  char* fields[4];
+  int count = 0;
+  char* pos = line;
+  while (count < 4 && pos < line + length)
+  {
+    fields[count++] = pos;
+    char* space = strchr(pos, ' ');
+    if (!space)
+      break;
+    *space = '\0';
+    pos = space + 1;
+  }
+
+  if (count != 4 || pos > line + length || strchr(fields[3], ' '))
+  {
+    QLOG_ERROR() << "Unknown LIRC input: " << line;
+    return;
+  }
+
+  int repeatCount = (int)strtol(fields[1], nullptr, 16);
+  int interval = remoteRepeatIntervals.value(QByteArray::fromRawData(fields[3], (int)strlen(fields[3])), repeatInterval);
+
+  if (verboseLogging)
+    QLOG_DEBUG() << "LIRC Got Key : " << fields[2] << ", repeat count:" << repeatCount
+                 << ", from remote " << fields[3];
+
+  // we dont want to have all the IR Bursts when we press a key
+  // it makes GUI unusable
+  if ((repeatCount % interval) == 0)
+  {
+    QString command = QString::fromLatin1(fields[2]);
+    bool up = command.endsWith("_LIRCUP");
+    emit receivedInput("LIRC", command, up ? InputBase::KeyUp : InputBase::KeyDown, timestamp);
   }
 }
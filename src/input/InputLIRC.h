@@ -2,19 +2,27 @@
 #define INPUTLIRC_H
 
 #include <QLocalSocket>
-#include <QSocketNotifier>
+#include <QHash>
 #include "input/InputComponent.h"
 
+// longest line from lircd we look at, longer ones are dropped
+#define LIRC_MAX_LINE 256
+
 class InputLIRC : public InputBase
 {
   Q_OBJECT
 private:
   QLocalSocket* socket;
-  QSocketNotifier* socketNotifier;
 
   bool connectToLIRC();
   void disconnectFromLIRC();
   bool isConnected();
+  void handleLine(char* line, qint64 length, qint64 timestamp);
+
+  // settings, see updateSettings()
+  int repeatInterval;
+  QHash<QByteArray, int> remoteRepeatIntervals;
+  bool verboseLogging;
 
 public:
   InputLIRC(QObject* parent);
@@ -27,7 +35,8 @@ private Q_SLOTS:
   void connected();
   void disconnected();
   void socketerror(QLocalSocket::LocalSocketError socketError);
-  void read(int handle);
+  void read();
+  void updateSettings();
 };
 
 #endif // INPUTLIRC_H
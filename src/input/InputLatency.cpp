@@ -0,0 +1,114 @@
+#include "InputLatency.h"
+#include "InputComponent.h"
+#include "QsLog.h"
+
+#include <QTextStream>
+
+#include <algorithm>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+InputLatency::InputLatency()
+  : m_writeIndex(0), m_receivedAt(0), m_queueUsec(0), m_deliveredAt(0), m_deliveredIndex(-1)
+{
+  memset(m_samples, 0, sizeof(m_samples));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputLatency::received(qint64 sourceTimestamp)
+{
+  m_receivedAt = InputBase::timestamp();
+  m_queueUsec = sourceTimestamp ? qMax(0LL, m_receivedAt - sourceTimestamp) : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputLatency::delivered()
+{
+  // only count actions that were caused by an input event, not auto repeats
+  if (!m_receivedAt)
+    return;
+
+  m_deliveredAt = InputBase::timestamp();
+
+  Sample& sample = m_samples[m_writeIndex % SampleCount];
+  sample.queueUsec = m_queueUsec;
+  sample.mappingUsec = m_deliveredAt - m_receivedAt;
+  sample.webUsec = -1;
+  m_deliveredIndex = m_writeIndex % SampleCount;
+  m_writeIndex++;
+  m_receivedAt = 0;
+
+  if (m_writeIndex % SampleCount == 0)
+  {
+    QString stats = summary();
+    stats.replace("\n", " ");
+    QLOG_INFO() << qPrintable(stats);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputLatency::acknowledged()
+{
+  if (m_deliveredIndex < 0)
+    return;
+
+  m_samples[m_deliveredIndex].webUsec = InputBase::timestamp() - m_deliveredAt;
+  m_deliveredIndex = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int InputLatency::snapshot(Sample* samples) const
+{
+  int count = (int)qMin(m_writeIndex, (quint32)SampleCount);
+  for (int i = 0; i < count; i++)
+    samples[i] = m_samples[(m_writeIndex - count + i) % SampleCount];
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void appendPercentiles(QTextStream& out, const char* name, qint64* values, int count)
+{
+  out << "  " << name << ": ";
+  if (!count)
+  {
+    out << "n/a" << endl;
+    return;
+  }
+
+  std::sort(values, values + count);
+  auto percentile = [&](int p) { return values[qMin(count - 1, count * p / 100)] / 1000.0; };
+
+  out << "p50 " << percentile(50) << "ms, p90 " << percentile(90) << "ms, p99 " << percentile(99)
+      << "ms, max " << values[count - 1] / 1000.0 << "ms" << endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString InputLatency::summary() const
+{
+  Sample samples[SampleCount];
+  int count = snapshot(samples);
+
+  QString str;
+  QTextStream out(&str);
+  out << "Input latency (last " << count << " events)" << endl;
+
+  qint64 values[SampleCount];
+  for (int i = 0; i < count; i++)
+    values[i] = samples[i].queueUsec;
+  appendPercentiles(out, "Device to host", values, count);
+
+  for (int i = 0; i < count; i++)
+    values[i] = samples[i].mappingUsec;
+  appendPercentiles(out, "Mapping", values, count);
+
+  int acknowledged = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (samples[i].webUsec >= 0)
+      values[acknowledged++] = samples[i].webUsec;
+  }
+  appendPercentiles(out, "Web client", values, acknowledged);
+
+  out << endl << flush;
+  return str;
+}
@@ -0,0 +1,45 @@
+#ifndef INPUTLATENCY_H
+#define INPUTLATENCY_H
+
+#include <QString>
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Latency statistics for the path of an input event from the device to the
+// web client. All methods must be called from the main thread.
+class InputLatency
+{
+public:
+  struct Sample
+  {
+    qint64 queueUsec;     // timestamp at the source -> InputComponent::remapInput()
+    qint64 mappingUsec;   // remapInput() -> hostInput() emitted
+    qint64 webUsec;       // hostInput() -> acknowledged by the web client, -1 if never
+  };
+
+  InputLatency();
+
+  // sourceTimestamp is InputBase::timestamp() as taken by the input backend,
+  // or 0 if the backend didn't provide one.
+  void received(qint64 sourceTimestamp);
+  void delivered();
+  void acknowledged();
+
+  // Returns a text block with latency percentiles for the debug overlay.
+  QString summary() const;
+
+private:
+  enum { SampleCount = 256 };
+
+  int snapshot(Sample* samples) const;
+
+  Sample m_samples[SampleCount];
+  quint32 m_writeIndex;
+
+  qint64 m_receivedAt;
+  qint64 m_queueUsec;
+  qint64 m_deliveredAt;
+  int m_deliveredIndex;
+};
+
+#endif // INPUTLATENCY_H
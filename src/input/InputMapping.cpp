@@ -11,6 +11,9 @@
 #include "Paths.h"
 #include "utils/Utils.h"
 
+// max. number of cached keycodes per input source
+#define ACTION_CACHE_SIZE 256
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 InputMapping::InputMapping(QObject *parent) : QObject(parent), m_sourceMatcher(false)
 {
@@ -22,27 +25,70 @@ InputMapping::InputMapping(QObject *parent) : QObject(parent), m_sourceMatcher(f
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void InputMapping::dirChange()
 {
-  QLOG_INFO() << "Change to user input path, reloading mappings.";
-  loadMappings();
+  QSet<QString> changed = scanUserMappings();
+  if (changed.isEmpty())
+    return;
+
+  QLOG_INFO() << "Change to user input path, reloading mappings:" << changed.toList();
+
+  // which mappings the cached sources matched before the change
+  QHash<QString, QVariantList> cachedSources;
+  for (auto it = m_actionCache.constBegin(); it != m_actionCache.constEnd(); ++it)
+    cachedSources.insert(it.key(), m_sourceMatcher.match(it.key()));
+
+  for (const QString& name : changed)
+    applyMapping(name);
+  rebuildSourceMatcher();
+
+  // Only drop the actions of sources that map through one of the changed
+  // mappings, before or after. Everything else is still valid.
+  for (auto it = cachedSources.constBegin(); it != cachedSources.constEnd(); ++it)
+  {
+    QVariantList now = m_sourceMatcher.match(it.key());
+    bool affected = now != it.value();
+    for (const QVariant& name : now + it.value())
+      affected = affected || changed.contains(name.toString());
+
+    if (affected)
+      m_actionCache.remove(it.key());
+  }
+
+  if (!m_actionCache.contains("Keyboard"))
+    m_keyboardActions.clear();
+
+  emit mappingChanged();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool InputMapping::loadMappings()
 {
+  qDeleteAll(m_inputMatcher);
   m_inputMatcher.clear();
-  m_sourceMatcher.clear();
+  m_actionCache.clear();
+  m_keyboardActions.clear();
+  m_autoRepeat.clear();
+  m_bundledMappings.clear();
+  m_userMappings.clear();
 
   // don't watch the path while we potentially copy files to the directory
   if (m_watcher->directories().size() > 0)
     m_watcher->removePath(Paths::dataDir("inputmaps"));
+  if (m_watcher->files().size() > 0)
+    m_watcher->removePaths(m_watcher->files());
 
   // first we load the bundled mappings
-  loadMappingDirectory(":/inputmaps", true);
+  loadBundledMappings();
 
   // now we load the user ones, if there are any
   // they will now overload the built-in ones.
   //
-  loadMappingDirectory(Paths::dataDir("inputmaps"), false);
+  QSet<QString> names = scanUserMappings();
+  for (const QString& name : m_bundledMappings.keys())
+    names.insert(name);
+
+  for (const QString& name : names)
+    applyMapping(name);
+  rebuildSourceMatcher();
 
   // we want to watch this dir for new files and changed files
   m_watcher->addPath(Paths::dataDir("inputmaps"));
@@ -51,6 +97,75 @@ bool InputMapping::loadMappings()
   return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const InputMapping::MappingDefinition* InputMapping::effectiveMapping(const QString& name) const
+{
+  // if more than one user file has the name, the last path wins, like it would
+  // in a directory listing
+  const MappingDefinition* found = nullptr;
+  QString foundPath;
+  for (auto it = m_userMappings.constBegin(); it != m_userMappings.constEnd(); ++it)
+  {
+    if (it.value().name == name && (!found || it.key() > foundPath))
+    {
+      found = &it.value();
+      foundPath = it.key();
+    }
+  }
+
+  if (found)
+    return found;
+
+  auto bundled = m_bundledMappings.constFind(name);
+  return bundled != m_bundledMappings.constEnd() ? &bundled.value() : nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputMapping::applyMapping(const QString& name)
+{
+  const MappingDefinition* definition = effectiveMapping(name);
+
+  // The new matcher is swapped in as a whole. The matchers of the other
+  // mappings, and what they cached, are left alone.
+  CachedRegexMatcher* inputMatcher = nullptr;
+  if (definition)
+  {
+    inputMatcher = new CachedRegexMatcher(true, this);
+    for (const QString& pattern : definition->mapping.keys())
+      inputMatcher->addMatcher("^" + pattern + "$", definition->mapping.value(pattern));
+  }
+
+  delete m_inputMatcher.take(name);
+  m_autoRepeat.remove(name);
+
+  if (!inputMatcher)
+    return;
+
+  m_inputMatcher.insert(name, inputMatcher);
+  if (!definition->autoRepeat.isEmpty())
+    m_autoRepeat.insert(name, definition->autoRepeat);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputMapping::rebuildSourceMatcher()
+{
+  // only a handful of patterns, cheaper to rebuild than to patch
+  m_sourceMatcher.clear();
+
+  QStringList names = m_inputMatcher.keys();
+  names.sort();
+
+  for (const QString& name : names)
+  {
+    const MappingDefinition* definition = effectiveMapping(name);
+    if (!definition || !m_sourceMatcher.addMatcher(definition->idMatcher, name))
+    {
+      delete m_inputMatcher.take(name);
+      m_autoRepeat.remove(name);
+    }
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 QVariantList InputMapping::mapToAction(const QString& source, const QString& keycode)
 {
@@ -58,15 +173,78 @@ QVariantList InputMapping::mapToAction(const QString& source, const QString& key
   if (source == "direct")
     return { QVariant(keycode) };
 
+  QHash<QString, QVariantList>& sourceCache = m_actionCache[source];
+  auto cached = sourceCache.constFind(keycode);
+  if (cached != sourceCache.constEnd())
+    return cached.value();
+
   QVariantList strActions;
 
   // first we need to match the source
   for (auto src : m_sourceMatcher.match(source))
     strActions << m_inputMatcher.value(src.toString())->match(keycode);
 
+  // keep this from growing forever if a device sends lots of distinct keycodes
+  if (sourceCache.size() >= ACTION_CACHE_SIZE)
+    sourceCache.clear();
+  sourceCache.insert(keycode, strActions);
+
   return strActions;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const QVariantList& InputMapping::keyboardActions(int combination, const QString& keyName)
+{
+  auto cached = m_keyboardActions.constFind(combination);
+  if (cached != m_keyboardActions.constEnd())
+    return cached.value();
+
+  if (m_keyboardActions.size() >= ACTION_CACHE_SIZE)
+    m_keyboardActions.clear();
+  return *m_keyboardActions.insert(combination, mapToAction("Keyboard", keyName));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void applyAutoRepeatCurve(const QVariantMap& map, AutoRepeatCurve& curve)
+{
+  curve.delay = map.value("delay", curve.delay).toInt();
+  curve.interval = map.value("interval", curve.interval).toInt();
+  curve.minInterval = map.value("minInterval", curve.minInterval).toInt();
+  curve.acceleration = map.value("acceleration", curve.acceleration).toDouble();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AutoRepeatCurve InputMapping::autoRepeatCurve(const QString& source, const QString& action,
+                                              const AutoRepeatCurve& defaults)
+{
+  AutoRepeatCurve curve = defaults;
+
+  if (m_autoRepeat.isEmpty())
+    return curve;
+
+  for (auto src : m_sourceMatcher.match(source))
+  {
+    auto it = m_autoRepeat.constFind(src.toString());
+    if (it == m_autoRepeat.constEnd())
+      continue;
+
+    applyAutoRepeatCurve(it.value(), curve);
+
+    QVariantMap actions = it.value().value("actions").toMap();
+    if (actions.contains(action))
+      applyAutoRepeatCurve(actions.value(action).toMap(), curve);
+
+    break;
+  }
+
+  // don't let a broken mapping file spin the event loop
+  curve.interval = qMax(curve.interval, 1);
+  curve.minInterval = qBound(1, curve.minInterval, curve.interval);
+  curve.acceleration = qBound(0.1, curve.acceleration, 1.0);
+
+  return curve;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool InputMapping::loadMappingFile(const QString& path, QPair<QString, QVariantMap> &mappingPair)
 {
@@ -108,49 +286,109 @@ bool InputMapping::loadMappingFile(const QString& path, QPair<QString, QVariantM
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool InputMapping::loadMappingDirectory(const QString& path, bool copy)
+bool InputMapping::loadMappingDefinition(const QFileInfo& finfo, MappingDefinition& definition)
 {
+  QPair<QString, QVariantMap> mapping;
+  if (!loadMappingFile(finfo.absoluteFilePath(), mapping))
+    return false;
+
+  definition.name = mapping.first;
+  definition.idMatcher = mapping.second.value("idmatcher").toString();
+  definition.mapping = mapping.second.value("mapping").toMap();
+  definition.autoRepeat = mapping.second.value("autorepeat").toMap();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputMapping::loadBundledMappings()
+{
+  QString path(":/inputmaps");
   QLOG_INFO() << "Loading inputmaps from:" << path;
+
+  QDir userdir(Paths::dataDir());
+  userdir.mkpath("inputmaps/examples/");
+
   QDirIterator it(path);
   while (it.hasNext())
   {
     QFileInfo finfo = QFileInfo(it.next());
-    if (finfo.isFile() && finfo.isReadable() && finfo.fileName().endsWith(".json"))
+    if (!finfo.isFile() || !finfo.isReadable() || !finfo.fileName().endsWith(".json"))
+      continue;
+
+    // make a copy of the original file to the example directory
+    QString examplePath(userdir.filePath("inputmaps/examples/" + finfo.fileName()));
+
+    // make sure we really overwrite the file. copy will not do this.
+    if (QFile(examplePath).exists())
+      QFile::remove(examplePath);
+
+    QFile::copy(finfo.absoluteFilePath(), examplePath);
+    QFile(examplePath).setPermissions(QFileDevice::ReadOwner | QFileDevice::ReadGroup | QFileDevice::WriteOwner |
+                                        QFileDevice::WriteGroup | QFileDevice::ReadOther);
+
+    MappingDefinition definition;
+    if (loadMappingDefinition(finfo, definition))
+      m_bundledMappings.insert(definition.name, definition);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QSet<QString> InputMapping::scanUserMappings()
+{
+  QString path = Paths::dataDir("inputmaps");
+  QSet<QString> changed;
+  QSet<QString> seen;
+
+  QDirIterator it(path);
+  while (it.hasNext())
+  {
+    QFileInfo finfo = QFileInfo(it.next());
+    if (!finfo.isFile() || !finfo.isReadable() || !finfo.fileName().endsWith(".json"))
+      continue;
+
+    QString filePath = finfo.absoluteFilePath();
+    seen.insert(filePath);
+
+    auto existing = m_userMappings.find(filePath);
+    if (existing != m_userMappings.end() &&
+        existing->modified == finfo.lastModified() && existing->size == finfo.size())
+      continue;
+
+    QLOG_INFO() << "Loading inputmap:" << filePath;
+
+    // editors writing in place only show up as a change of the file
+    if (!m_watcher->files().contains(filePath))
+      m_watcher->addPath(filePath);
+
+    // a file that doesn't parse any more doesn't define its old mapping either
+    if (existing != m_userMappings.end() && !existing->name.isEmpty())
+      changed.insert(existing->name);
+
+    MappingDefinition definition;
+    if (!loadMappingDefinition(finfo, definition))
+      definition.name.clear();
+    definition.modified = finfo.lastModified();
+    definition.size = finfo.size();
+
+    if (!definition.name.isEmpty())
+      changed.insert(definition.name);
+    m_userMappings.insert(filePath, definition);
+  }
+
+  for (auto mit = m_userMappings.begin(); mit != m_userMappings.end();)
+  {
+    if (seen.contains(mit.key()))
     {
-      // make a copy of the original file to the example directory
-      if (copy)
-      {
-        QDir userdir(Paths::dataDir());
-        userdir.mkpath("inputmaps/examples/");
-        QString examplePath(userdir.filePath("inputmaps/examples/" + finfo.fileName()));
-
-        // make sure we really overwrite the file. copy will not do this.
-        if (QFile(examplePath).exists())
-          QFile::remove(examplePath);
-
-        QFile::copy(finfo.absoluteFilePath(), examplePath);
-        QFile(examplePath).setPermissions(QFileDevice::ReadOwner | QFileDevice::ReadGroup | QFileDevice::WriteOwner |
-                                            QFileDevice::WriteGroup | QFileDevice::ReadOther);
-      }
-
-
-      QPair<QString, QVariantMap> mapping;
-      if (loadMappingFile(finfo.absoluteFilePath(), mapping))
-      {
-        // add the source regexp to the matcher
-        if (m_sourceMatcher.addMatcher(mapping.second.value("idmatcher").toString(), mapping.first))
-        {
-          // get the input map and add it to a new CachedMatcher
-          QVariantMap inputMap = mapping.second.value("mapping").toMap();
-          auto inputMatcher = new CachedRegexMatcher(true, this);
-          for(const QString& pattern : inputMap.keys())
-            inputMatcher->addMatcher("^" + pattern + "$", inputMap.value(pattern));
-
-          m_inputMatcher.insert(mapping.first, inputMatcher);
-        }
-      }
+      ++mit;
+      continue;
     }
+
+    QLOG_INFO() << "Inputmap was removed:" << mit.key();
+    m_watcher->removePath(mit.key());
+    if (!mit->name.isEmpty())
+      changed.insert(mit->name);
+    mit = m_userMappings.erase(mit);
   }
 
-  return true;
+  return changed;
 }
@@ -2,13 +2,26 @@
 #define INPUTMAPPING_H
 
 #include <QMap>
+#include <QDateTime>
 #include <QObject>
 #include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QSet>
 #include <QRegExp>
 #include <QVariantMap>
 #include <QMutex>
 #include <utils/CachedRegexMatcher.h>
 
+// Timing of synthetic key repeats, all values in milliseconds. Each repeat
+// the interval is multiplied by acceleration, but never below minInterval.
+struct AutoRepeatCurve
+{
+  int delay;
+  int interval;
+  int minInterval;
+  double acceleration;
+};
+
 class InputMapping : public QObject
 {
   Q_OBJECT
@@ -17,6 +30,15 @@ public:
   explicit InputMapping(QObject *parent = nullptr);
   bool loadMappings();
   QVariantList mapToAction(const QString& source, const QString& keycode);
+  // The actions of a key from InputKeyboard, combination being the Qt::Key with the
+  // modifiers. Each is only matched by name the first time.
+  const QVariantList& keyboardActions(int combination, const QString& keyName);
+
+  // Return the auto repeat curve for an action coming from source. Mapping
+  // files can override it with an optional "autorepeat" element, which can
+  // in turn hold per-action overrides in "actions". Anything not set there
+  // is taken from defaults.
+  AutoRepeatCurve autoRepeatCurve(const QString& source, const QString& action, const AutoRepeatCurve& defaults);
 
 private Q_SLOTS:
   void dirChange();
@@ -25,13 +47,49 @@ signals:
   void mappingChanged();
 
 private:
+  // A parsed mapping file
+  struct MappingDefinition
+  {
+    QString name;
+    QString idMatcher;
+    QVariantMap mapping;
+    QVariantMap autoRepeat;
+    // to tell if the file changed, only used for user files
+    QDateTime modified;
+    qint64 size = 0;
+  };
+
   bool loadMappingFile(const QString &path, QPair<QString, QVariantMap> &mappingPair);
-  bool loadMappingDirectory(const QString& path, bool copy);
+  bool loadMappingDefinition(const QFileInfo& finfo, MappingDefinition& definition);
+  void loadBundledMappings();
+  // Parse the user files that are new or changed since the last scan and
+  // forget about removed ones. Returns the names of the mappings they define.
+  QSet<QString> scanUserMappings();
+  // the definition of name that is in effect, the user ones win
+  const MappingDefinition* effectiveMapping(const QString& name) const;
+  // (re)build the matcher of one mapping
+  void applyMapping(const QString& name);
+  void rebuildSourceMatcher();
 
   QFileSystemWatcher* m_watcher;
 
+  // mapping name -> definition
+  QHash<QString, MappingDefinition> m_bundledMappings;
+  // path -> definition, files that failed to parse have no name
+  QHash<QString, MappingDefinition> m_userMappings;
+
   QHash<QString, CachedRegexMatcher*> m_inputMatcher;
   CachedRegexMatcher m_sourceMatcher;
+
+  // mapping name -> "autorepeat" element of the mapping file
+  QHash<QString, QVariantMap> m_autoRepeat;
+
+  // source -> keycode -> actions. Repeated input from the same device is
+  // resolved with two hash lookups instead of going through the matchers.
+  QHash<QString, QHash<QString, QVariantList>> m_actionCache;
+  // Qt::Key | modifiers -> actions, for the most common input there is. Filled through
+  // mapToAction(), so it's stale whenever the "Keyboard" entry of m_actionCache is.
+  QHash<int, QVariantList> m_keyboardActions;
 };
 
 #endif // INPUTMAPPING_H
@@ -4,6 +4,7 @@
 
 #include "InputRoku.h"
 #include "QsLog.h"
+#include "utils/NetworkState.h"
 
 #include "qhttpserverresponse.hpp"
 #include "qhttpserverrequest.hpp"
@@ -16,10 +17,78 @@
 using namespace qhttp::server;
 
 #define ROKU_SERIAL_NUMBER "12345678900"
+#define ROKU_SSDP_MULTICAST_ADDRESS "239.255.255.250"
+// the XML bodies only change with the computer name, locale and time zone
+#define ROKU_BODY_CACHE_MSEC (60 * 1000)
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Remote apps send bursts of small requests, so the connection is kept open whenever
+// the client allows it. qhttp closes it unless the response says keep-alive, and a
+// kept connection needs the content length.
+static void sendResponse(QHttpRequest* request, QHttpResponse* response, qhttp::TStatusCode status,
+                         const QByteArray& body = QByteArray())
+{
+  const QByteArray connection = request->headers().value("connection");
+  if (connection == "keep-alive" || (request->httpVersion() == "1.1" && connection != "close"))
+    response->addHeader("connection", "keep-alive");
+
+  if (!body.isEmpty())
+    response->addHeader("content-type", "text/xml; charset=utf-8");
+  response->addHeader("content-length", QByteArray::number(body.size()));
+  response->setStatusCode(status);
+  response->end(body);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+const QByteArray& InputRokuWorker::cachedBody(CachedBody& cache, QByteArray (InputRokuWorker::*build)())
+{
+  if (cache.data.isEmpty() || !cache.age.isValid() || cache.age.hasExpired(ROKU_BODY_CACHE_MSEC))
+  {
+    cache.data = (this->*build)();
+    cache.age.start();
+  }
+  return cache.data;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+InputRoku::InputRoku(QObject* parent) : InputBase(parent)
+{
+  m_thread = new QThread(this);
+  m_thread->setObjectName("InputRoku");
+
+  m_worker = new InputRokuWorker(nullptr);
+  m_worker->moveToThread(m_thread);
+
+  m_thread->start();
+  connect(m_worker, &InputRokuWorker::receivedInput, this, &InputRoku::receivedInput);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+InputRoku::~InputRoku()
+{
+  // the sockets belong to the worker thread, they have to go there
+  QMetaObject::invokeMethod(m_worker, "close", Qt::BlockingQueuedConnection);
+
+  m_thread->exit(0);
+  m_thread->wait();
+
+  delete m_worker;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
 bool InputRoku::initInput()
 {
+  bool retVal;
+  QMetaObject::invokeMethod(m_worker, "init", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, retVal),
+                            Q_ARG(QString, Utils::ClientUUID()));
+
+  return retVal;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool InputRokuWorker::init(const QString& clientUUID)
+{
+  m_clientUUID = clientUUID;
   m_server = new QHttpServer(this);
 
   if (!m_server->listen(QHostAddress::Any, 8060))
@@ -28,7 +97,7 @@ bool InputRoku::initInput()
     return false;
   }
 
-  connect(m_server, &QHttpServer::newRequest, this, &InputRoku::handleRequest);
+  connect(m_server, &QHttpServer::newRequest, this, &InputRokuWorker::handleRequest);
 
   m_ssdpSocket = new QUdpSocket(this);
   if (!m_ssdpSocket->bind(QHostAddress::AnyIPv4, 1900, QUdpSocket::ReuseAddressHint | QUdpSocket::ShareAddress))
@@ -37,16 +106,41 @@ bool InputRoku::initInput()
     return false;
   }
 
-  QHostAddress multicast("239.255.255.250");
-  m_ssdpSocket->joinMulticastGroup(multicast);
+  m_ssdpSocket->joinMulticastGroup(QHostAddress(ROKU_SSDP_MULTICAST_ADDRESS));
 
-  connect(m_ssdpSocket, &QUdpSocket::readyRead, this, &InputRoku::ssdpRead);
+  connect(m_ssdpSocket, &QUdpSocket::readyRead, this, &InputRokuWorker::ssdpRead);
+  // emitted from the main thread, so this is queued to ours
+  connect(&NetworkState::Get(), &NetworkState::addressesChanged, this, &InputRokuWorker::networkChanged);
 
   return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::ssdpRead()
+void InputRokuWorker::close()
+{
+  delete m_server;
+  m_server = nullptr;
+  delete m_ssdpSocket;
+  m_ssdpSocket = nullptr;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputRokuWorker::networkChanged()
+{
+  if (!m_ssdpSocket)
+    return;
+
+  // the packets carry our address, and the group membership is per interface
+  m_ssdpPackets.clear();
+
+  QHostAddress multicast(ROKU_SSDP_MULTICAST_ADDRESS);
+  m_ssdpSocket->leaveMulticastGroup(multicast);
+  if (!m_ssdpSocket->joinMulticastGroup(multicast))
+    QLOG_WARN() << "Failed to rejoin the SSDP multicast group:" << m_ssdpSocket->errorString();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputRokuWorker::ssdpRead()
 {
   while (m_ssdpSocket->hasPendingDatagrams())
   {
@@ -63,16 +157,23 @@ void InputRoku::ssdpRead()
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::parseSSDPData(const QByteArray& data, const QHostAddress& sender, quint16 port)
+void InputRokuWorker::parseSSDPData(const QByteArray& data, const QHostAddress& sender, quint16 port)
 {
-  if (data.contains("M-SEARCH * HTTP/1.1"))
+  if (data.contains("M-SEARCH * HTTP/1.1") && m_ssdpThrottle.allow(sender, port, data))
     m_ssdpSocket->writeDatagram(getSSDPPacket(sender), sender, port);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-QByteArray InputRoku::getSSDPPacket(const QHostAddress& sender)
+const QByteArray& InputRokuWorker::getSSDPPacket(const QHostAddress& sender)
 {
-  QByteArray packetData;
+  auto it = m_ssdpPackets.find(sender);
+  if (it != m_ssdpPackets.end())
+    return it.value();
+
+  if (m_ssdpPackets.size() >= DISCOVERY_MAX_SENDERS)
+    m_ssdpPackets.clear();
+
+  QByteArray& packetData = m_ssdpPackets[sender];
 
   // Header
   packetData.append("HTTP/1.1 200 OK\r\n");
@@ -81,8 +182,10 @@ QByteArray InputRoku::getSSDPPacket(const QHostAddress& sender)
   packetData.append("Ext: \r\n");
   packetData.append("Server: Roku UPnP/1.0 MiniUPnPd/1.4\r\n");
 
+  // where the sender can reach us, the address on its subnet if we have one
+  QHostAddress local = NetworkState::Get().localAddressFor(sender);
   packetData.append("Location: http://");
-  packetData.append(sender.toString());
+  packetData.append((local.isNull() ? sender : local).toString());
   packetData.append(":8060/\r\n");
 
   packetData.append("USN: uuid:roku:ecp:");
@@ -92,11 +195,16 @@ QByteArray InputRoku::getSSDPPacket(const QHostAddress& sender)
   return packetData;
 }
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::handleRequest(QHttpRequest* request, QHttpResponse* response)
+void InputRokuWorker::handleRequest(QHttpRequest* request, QHttpResponse* response)
 {
-  QString path = request->url().path();
+  const QString path = request->url().path();
 
-  if (path == "/")
+  if (path.startsWith("/keypress/") || path.startsWith("/keydown/") || path.startsWith("/keyup/"))
+  {
+    // by far the most common request, so it's checked first
+    handleKeyPress(path, request, response);
+  }
+  else if (path == "/")
   {
     handleRootInfo(request, response);
   }
@@ -108,28 +216,28 @@ void InputRoku::handleRequest(QHttpRequest* request, QHttpResponse* response)
   {
     handleQueryDeviceInfo(request, response);
   }
-  else if (path.startsWith("/keypress/") || path.startsWith("/keydown/") || path.startsWith("/keyup/"))
-  {
-    handleKeyPress(request, response);
-  }
   else
   {
     QLOG_WARN() << "Could not handle roku input:" << path;
-    response->setStatusCode(qhttp::ESTATUS_NOT_FOUND);
-    response->end();
+    sendResponse(request, response, qhttp::ESTATUS_NOT_FOUND);
   }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::handleQueryApps(QHttpRequest* request, QHttpResponse* response)
+void InputRokuWorker::handleQueryApps(QHttpRequest* request, QHttpResponse* response)
 {
   if (request->method() != qhttp::EHTTP_GET)
   {
-    response->setStatusCode(qhttp::ESTATUS_METHOD_NOT_ALLOWED);
-    response->end();
+    sendResponse(request, response, qhttp::ESTATUS_METHOD_NOT_ALLOWED);
     return;
   }
 
+  sendResponse(request, response, qhttp::ESTATUS_OK, cachedBody(m_appsBody, &InputRokuWorker::buildAppsBody));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QByteArray InputRokuWorker::buildAppsBody()
+{
   QByteArray data;
   QXmlStreamWriter writer(&data);
   writer.setAutoFormatting(true);
@@ -142,22 +250,25 @@ void InputRoku::handleQueryApps(QHttpRequest* request, QHttpResponse* response)
   writer.writeEndElement(); // apps
   writer.writeEndDocument();
 
-  response->setStatusCode(qhttp::ESTATUS_OK);
-  response->write(data);
-  response->end();
+  return data;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::handleQueryDeviceInfo(QHttpRequest* request, QHttpResponse* response)
+void InputRokuWorker::handleQueryDeviceInfo(QHttpRequest* request, QHttpResponse* response)
 {
+  sendResponse(request, response, qhttp::ESTATUS_OK, cachedBody(m_deviceInfoBody, &InputRokuWorker::buildDeviceInfoBody));
+}
 
+/////////////////////////////////////////////////////////////////////////////////////////
+QByteArray InputRokuWorker::buildDeviceInfoBody()
+{
   QByteArray data;
   QXmlStreamWriter writer(&data);
   writer.setAutoFormatting(true);
 
   writer.writeStartDocument();
   writer.writeStartElement("device-info");
-  writer.writeTextElement("udn", Utils::ClientUUID());
+  writer.writeTextElement("udn", m_clientUUID);
   writer.writeTextElement("serial-number", ROKU_SERIAL_NUMBER);
   writer.writeTextElement("device-id", ROKU_SERIAL_NUMBER);
   writer.writeTextElement("vendor-name", "Roku");
@@ -184,39 +295,42 @@ void InputRoku::handleQueryDeviceInfo(QHttpRequest* request, QHttpResponse* resp
   writer.writeEndElement(); // device-info
   writer.writeEndDocument();
 
-  response->setStatusCode(qhttp::ESTATUS_OK);
-  response->write(data);
-  response->end();
+  return data;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::handleKeyPress(QHttpRequest* request, QHttpResponse* response)
+void InputRokuWorker::handleKeyPress(const QString& path, QHttpRequest* request, QHttpResponse* response)
 {
-  QString path = request->url().path();
-  QStringList pathsplit = path.split("/");
-  if (pathsplit.count() != 3)
+  qint64 timestamp = InputBase::timestamp();
+
+  // /<action>/<key>
+  int separator = path.indexOf('/', 1);
+  if (separator < 0 || separator == path.size() - 1 || path.indexOf('/', separator + 1) >= 0)
   {
-    response->setStatusCode(qhttp::ESTATUS_BAD_REQUEST);
-    response->end();
+    sendResponse(request, response, qhttp::ESTATUS_BAD_REQUEST);
     return;
   }
 
-  auto url = request->url().toString();
-  if (url.startsWith("/keydown/"))
-    emit receivedInput("roku", pathsplit.value(2), KeyDown);
-  else if (url.startsWith("/keyup/"))
-    emit receivedInput("roku", pathsplit.value(2), KeyUp);
-  else if (url.startsWith("/keypress/"))
-    emit receivedInput("roku", pathsplit.value(2), KeyPressed);
+  QStringRef action = path.midRef(1, separator - 1);
+  QString key = path.mid(separator + 1);
+  if (action == QLatin1String("keydown"))
+    emit receivedInput("roku", key, InputBase::KeyDown, timestamp);
+  else if (action == QLatin1String("keyup"))
+    emit receivedInput("roku", key, InputBase::KeyUp, timestamp);
+  else
+    emit receivedInput("roku", key, InputBase::KeyPressed, timestamp);
 
+  sendResponse(request, response, qhttp::ESTATUS_OK);
+}
 
-  response->setStatusCode(qhttp::ESTATUS_OK);
-  response->end();
-  return;
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputRokuWorker::handleRootInfo(QHttpRequest* request, QHttpResponse* response)
+{
+  sendResponse(request, response, qhttp::ESTATUS_OK, cachedBody(m_rootBody, &InputRokuWorker::buildRootBody));
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void InputRoku::handleRootInfo(QHttpRequest* request, QHttpResponse* response)
+QByteArray InputRokuWorker::buildRootBody()
 {
   QByteArray data;
   QXmlStreamWriter writer(&data);
@@ -240,7 +354,7 @@ void InputRoku::handleRootInfo(QHttpRequest* request, QHttpResponse* response)
   writer.writeTextElement("modelNumber", "4200X");
   writer.writeTextElement("modelURL", "http://www.roku.com");
   writer.writeTextElement("serialNumber", ROKU_SERIAL_NUMBER);
-  writer.writeTextElement("UDN", "uuid:" + Utils::ClientUUID());
+  writer.writeTextElement("UDN", "uuid:" + m_clientUUID);
 
   writer.writeStartElement("serviceList");
   writer.writeStartElement("service");
@@ -255,7 +369,5 @@ void InputRoku::handleRootInfo(QHttpRequest* request, QHttpResponse* response)
   writer.writeEndElement(); // root
   writer.writeEndDocument();
 
-  response->setStatusCode(qhttp::ESTATUS_OK);
-  response->write(data);
-  response->end();
+  return data;
 }
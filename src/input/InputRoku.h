@@ -8,28 +8,79 @@
 #include "input/InputComponent.h"
 #include "qhttpserver.hpp"
 #include <QUdpSocket>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QThread>
 
+#include "utils/DiscoveryThrottle.h"
+
+class InputRokuWorker;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Roku's External Control Protocol, which a lot of remote apps speak. The HTTP server and
+// the SSDP socket live on a thread of their own (InputRokuWorker), so requests are parsed
+// and answered while the GUI thread is busy, and only the key presses are queued to it.
+//
 class InputRoku : public InputBase
 {
   Q_OBJECT
 
 public:
-  explicit InputRoku(QObject* parent = nullptr) : InputBase(parent) { }
+  explicit InputRoku(QObject* parent = nullptr);
+  ~InputRoku() override;
+
   bool initInput() override;
   const char* inputName() override { return "roku"; };
 
+private:
+  QThread* m_thread;
+  InputRokuWorker* m_worker;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+class InputRokuWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit InputRokuWorker(QObject* parent = nullptr) : QObject(parent), m_server(nullptr), m_ssdpSocket(nullptr) { }
+
+  // the client UUID is read from the settings, which only the main thread should do
+  Q_SLOT bool init(const QString& clientUUID);
+  Q_SLOT void close();
+  Q_SIGNAL void receivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp);
+
 private:
   void handleRequest(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
   void handleQueryApps(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
-  void handleKeyPress(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
+  void handleKeyPress(const QString& path, qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
   void handleQueryDeviceInfo(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
 
+  struct CachedBody
+  {
+    QByteArray data;
+    QElapsedTimer age;
+  };
+  const QByteArray& cachedBody(CachedBody& cache, QByteArray (InputRokuWorker::*build)());
+  QByteArray buildAppsBody();
+  QByteArray buildDeviceInfoBody();
+  QByteArray buildRootBody();
+
+  QString m_clientUUID;
+  CachedBody m_appsBody;
+  CachedBody m_deviceInfoBody;
+  CachedBody m_rootBody;
+
   qhttp::server::QHttpServer* m_server;
   QUdpSocket* m_ssdpSocket;
+  DiscoveryThrottle m_ssdpThrottle;
+  // the reply only depends on the sender address, so it's built once per sender
+  QHash<QHostAddress, QByteArray> m_ssdpPackets;
 
   void ssdpRead();
+  void networkChanged();
   void parseSSDPData(const QByteArray& data, const QHostAddress& sender, quint16 port);
-  QByteArray getSSDPPacket(const QHostAddress& sender);
+  const QByteArray& getSSDPPacket(const QHostAddress& sender);
   void handleRootInfo(qhttp::server::QHttpRequest* request, qhttp::server::QHttpResponse* response);
 };
 
@@ -10,9 +10,27 @@
 #include "InputSDL.h"
 #include "QsLog.h"
 
+#include <algorithm>
 #include <climits>
+#include <cmath>
 #include <cstdlib>
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+InputSDLWorker::InputSDLWorker(QObject* parent) : QObject(parent),
+  m_unknownJoystick("unknown joystick"),
+  m_hatCentered("KEY_HAT_CENTERED"),
+  m_hatUp("KEY_HAT_UP"),
+  m_hatDown("KEY_HAT_DOWN"),
+  m_hatRight("KEY_HAT_RIGHT"),
+  m_hatLeft("KEY_HAT_LEFT"),
+  m_hatOther("KEY_HAT_"),
+  m_analogScrolling(false),
+  m_scrolling(false),
+  m_nextScrollSample(0),
+  m_scrollValue{0, 0}
+{
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool InputSDLWorker::initialize()
 {
@@ -52,139 +70,270 @@ void InputSDLWorker::close()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QString InputSDLWorker::nameForId(SDL_JoystickID id)
+const QString& InputSDLWorker::nameForId(SDL_JoystickID id) const
 {
-  if (m_joysticks.contains(id))
-    return SDL_JoystickName(m_joysticks[id]);
+  auto it = m_joystickNames.constFind(id);
+  if (it != m_joystickNames.constEnd())
+    return it.value();
 
-  return "unknown joystick";
+  return m_unknownJoystick;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void InputSDLWorker::run()
+const QString& InputSDLWorker::buttonKeycode(quint8 button)
 {
-  QElapsedTimer polltimer;
+  // only grows the first time a button with a higher index is seen
+  while (m_buttonKeycodes.size() <= button)
+    m_buttonKeycodes.append(QString("KEY_BUTTON_%1").arg(m_buttonKeycodes.size()));
 
-  while (true)
+  return m_buttonKeycodes.at(button);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const QString& InputSDLWorker::axisKeycode(quint8 axis, bool up)
+{
+  // two entries per axis: even index is UP, odd index is DOWN
+  while (m_axisKeycodes.size() <= axis * 2 + 1)
   {
-    SDL_Event event;
+    int index = m_axisKeycodes.size() / 2;
+    m_axisKeycodes.append(QString("KEY_AXIS_%1_UP").arg(index));
+    m_axisKeycodes.append(QString("KEY_AXIS_%1_DOWN").arg(index));
+  }
+
+  return m_axisKeycodes.at(axis * 2 + (up ? 0 : 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+InputSDLWorker::SDLAxisZone InputSDLWorker::axisZone(qint16 value)
+{
+  int absValue = std::abs(value);
+
+  if (absValue > SDL_AXIS_PRESS_THRESHOLD)
+    return value < 0 ? AxisUp : AxisDown;
+  else if (absValue < SDL_AXIS_DEADZONE)
+    return AxisCenter;
+
+  // between the deadzone and the press threshold nothing changes
+  return AxisHysteresis;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double InputSDLWorker::scrollVelocity(qint16 value)
+{
+  int absValue = std::abs(value);
+  if (absValue < SDL_AXIS_DEADZONE)
+    return 0;
+
+  double position = std::min(1.0, double(absValue - SDL_AXIS_DEADZONE) / (SHRT_MAX - SDL_AXIS_DEADZONE));
+  double velocity = std::pow(position, SDL_SCROLL_CURVE_EXPONENT);
+
+  return value < 0 ? -velocity : velocity;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool InputSDLWorker::handleScrollAxis(const SDL_JoyAxisEvent& event)
+{
+  if (!m_analogScrolling || (event.axis != SDL_SCROLL_AXIS_X && event.axis != SDL_SCROLL_AXIS_Y))
+    return false;
+
+  // let go of a key that was held when scrolling was switched on
+  if (m_axisState.contains(event.axis))
+  {
+    emit receivedInput(nameForId(event.which), axisKeycode(event.axis, m_axisState.value(event.axis)), InputBase::KeyUp, InputBase::timestamp());
+    m_axisState.remove(event.axis);
+    m_axisZone.remove(event.axis);
+  }
+
+  m_scrollValue[event.axis == SDL_SCROLL_AXIS_X ? 0 : 1] = event.value;
+  m_scrollSource = nameForId(event.which);
+
+  if (!m_scrolling && scrollVelocity(event.value) != 0)
+  {
+    // the first sample goes out right away, the rest at a fixed rate from run()
+    m_scrolling = true;
+    m_nextScrollSample = SDL_GetTicks();
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputSDLWorker::sampleScroll()
+{
+  if (!m_scrolling || !SDL_TICKS_PASSED(SDL_GetTicks(), m_nextScrollSample))
+    return;
+
+  double x = 0, y = 0;
+  if (m_analogScrolling)
+  {
+    x = scrollVelocity(m_scrollValue[0]);
+    y = scrollVelocity(m_scrollValue[1]);
+  }
+
+  emit receivedScroll(m_scrollSource, x, y, InputBase::timestamp());
+
+  // the zero sample above tells the receiver to stop
+  if (x == 0 && y == 0)
+    m_scrolling = false;
+
+  m_nextScrollSample = SDL_GetTicks() + SDL_SCROLL_SAMPLE_MSEC;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool InputSDLWorker::handleEvent(const SDL_Event& event)
+{
+  // SDL stamps events in msec of its own clock, translate that to ours so the
+  // time the event spent in the SDL queue is accounted for.
+  qint64 eventTime = InputBase::timestamp() - qint64(SDL_GetTicks() - event.common.timestamp) * 1000;
+
+  switch (event.type)
+  {
+    case SDL_QUIT:
+      SDL_Quit();
+      return false;
+
+    case SDL_JOYBUTTONDOWN:
+    {
+      emit receivedInput(nameForId(event.jbutton.which), buttonKeycode(event.jbutton.button), InputBase::KeyDown, eventTime);
+      break;
+    }
 
-    // startpoint for polling loop
-    polltimer.restart();
+    case SDL_JOYBUTTONUP:
+    {
+      emit receivedInput(nameForId(event.jbutton.which), buttonKeycode(event.jbutton.button), InputBase::KeyUp, eventTime);
+      break;
+    }
+
+    case SDL_JOYDEVICEADDED:
+    {
+      QLOG_INFO() << "SDL detected device was added.";
+      refreshJoystickList();
+      break;
+    }
+
+    case SDL_JOYDEVICEREMOVED:
+    {
+      QLOG_INFO() << "SDL detected device was removed.";
+      refreshJoystickList();
+      break;
+    }
 
-    while (SDL_PollEvent(&event))
+    case SDL_JOYHATMOTION:
     {
-      switch (event.type)
+
+      QString hatName;
+      bool pressed = true;
+
+      switch (event.jhat.value)
       {
-        case SDL_QUIT:
-          SDL_Quit();
-          return;
+        case SDL_HAT_CENTERED:
+          if (!m_lastHat.isEmpty())
+            hatName = m_lastHat;
+          else
+            hatName = m_hatCentered;
+          pressed = false;
           break;
-
-        case SDL_JOYBUTTONDOWN:
-        {
-          emit receivedInput(nameForId(event.jbutton.which), QString("KEY_BUTTON_%1").arg(event.jbutton.button), InputBase::KeyDown);
+        case SDL_HAT_UP:
+          hatName = m_hatUp;
           break;
-        }
-
-        case SDL_JOYBUTTONUP:
-        {
-          emit receivedInput(nameForId(event.jbutton.which), QString("KEY_BUTTON_%1").arg(event.jbutton.button), InputBase::KeyUp);
+        case SDL_HAT_DOWN:
+          hatName = m_hatDown;
           break;
-        }
-
-        case SDL_JOYDEVICEADDED:
-        {
-          QLOG_INFO() << "SDL detected device was added.";
-          refreshJoystickList();
+        case SDL_HAT_RIGHT:
+          hatName = m_hatRight;
           break;
-        }
-
-        case SDL_JOYDEVICEREMOVED:
-        {
-          QLOG_INFO() << "SDL detected device was removed.";
-          refreshJoystickList();
+        case SDL_HAT_LEFT:
+          hatName = m_hatLeft;
           break;
-        }
+        default:
+          hatName = m_hatOther;
+          break;
+      }
 
-        case SDL_JOYHATMOTION:
-        {
+      m_lastHat = hatName;
 
-          QString hatName("KEY_HAT_");
-          bool pressed = true;
-
-          switch (event.jhat.value)
-          {
-            case SDL_HAT_CENTERED:
-              if (!m_lastHat.isEmpty())
-                hatName = m_lastHat;
-              else
-                hatName += "CENTERED";
-              pressed = false;
-              break;
-            case SDL_HAT_UP:
-              hatName += "UP";
-              break;
-            case SDL_HAT_DOWN:
-              hatName += "DOWN";
-              break;
-            case SDL_HAT_RIGHT:
-              hatName += "RIGHT";
-              break;
-            case SDL_HAT_LEFT:
-              hatName += "LEFT";
-              break;
-            default:
-              break;
-          }
-
-          m_lastHat = hatName;
-
-          emit receivedInput(nameForId(event.jhat.which), hatName, pressed ? InputBase::KeyDown : InputBase::KeyUp);
+      emit receivedInput(nameForId(event.jhat.which), hatName, pressed ? InputBase::KeyDown : InputBase::KeyUp, eventTime);
 
-          break;
-        }
+      break;
+    }
 
-        case SDL_JOYAXISMOTION:
+    case SDL_JOYAXISMOTION:
+    {
+      auto axis = event.jaxis.axis;
+
+      if (handleScrollAxis(event.jaxis))
+        break;
+
+      // Analog sticks report every tiny movement. Only the zone the stick is in
+      // matters for the digital conversion, so drop everything else right here.
+      SDLAxisZone zone = axisZone(event.jaxis.value);
+      if (m_axisZone.value(axis, AxisCenter) == zone)
+        break;
+      m_axisZone[axis] = zone;
+
+      // handle the Digital conversion of the analog axis
+      if (zone == AxisUp || zone == AxisDown)
+      {
+        bool up = zone == AxisUp;
+        if (!m_axisState.contains(axis))
         {
-          auto axis = event.jaxis.axis;
-          auto value = event.jaxis.value;
-
-          QLOG_DEBUG() << "JoyAxisMotion:" << axis << value;
-
-          // handle the Digital conversion of the analog axis
-          if (std::abs(value) > 32768 / 2)
-          {
-            bool up = value < 0;
-            if (!m_axisState.contains(axis))
-            {
-              emit receivedInput(nameForId(event.jaxis.which), QString("KEY_AXIS_%1_%2").arg(axis).arg(up ? "UP" : "DOWN"), InputBase::KeyDown);
-              m_axisState.insert(axis, up);
-            }
-            else if (m_axisState.value(axis) != up)
-            {
-              emit receivedInput(nameForId(event.jaxis.which), QString("KEY_AXIS_%1_%2").arg(axis).arg(m_axisState.value(axis) ? "UP" : "DOWN"), InputBase::KeyUp);
-              m_axisState.remove(axis);
-            }
-          }
-          else if (std::abs(value) < 10000 && m_axisState.contains(axis)) // back to the center.
-          {
-            emit receivedInput(nameForId(event.jaxis.which), QString("KEY_AXIS_%1_%2").arg(axis).arg(m_axisState.value(axis) ? "UP" : "DOWN"), InputBase::KeyUp);
-            m_axisState.remove(axis);
-          }
-          break;
+          emit receivedInput(nameForId(event.jaxis.which), axisKeycode(axis, up), InputBase::KeyDown, eventTime);
+          m_axisState.insert(axis, up);
         }
-        default:
+        else if (m_axisState.value(axis) != up)
         {
-          QLOG_WARN() << "Unhandled SDL event:" << event.type;
-          break;
+          // flipped over without passing the center: let go of one direction, press the other
+          emit receivedInput(nameForId(event.jaxis.which), axisKeycode(axis, m_axisState.value(axis)), InputBase::KeyUp, eventTime);
+          emit receivedInput(nameForId(event.jaxis.which), axisKeycode(axis, up), InputBase::KeyDown, eventTime);
+          m_axisState.insert(axis, up);
         }
       }
+      else if (zone == AxisCenter && m_axisState.contains(axis)) // back to the center.
+      {
+        emit receivedInput(nameForId(event.jaxis.which), axisKeycode(axis, m_axisState.value(axis)), InputBase::KeyUp, eventTime);
+        m_axisState.remove(axis);
+      }
+      break;
+    }
+    default:
+    {
+      QLOG_WARN() << "Unhandled SDL event:" << event.type;
+      break;
     }
+  }
 
-    // make the poll time fixed to SDL_POLL_TIME
-    if (polltimer.elapsed() < SDL_POLL_TIME)
-      QThread::msleep(SDL_POLL_TIME - polltimer.elapsed());
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputSDLWorker::run()
+{
+  SDL_Event event;
+
+  while (true)
+  {
+    // Sleep until SDL has something for us. The timeout is only a safety net,
+    // close() wakes us up by pushing SDL_QUIT. While a stick is scrolling we
+    // wake up for the next sample instead, since a held stick sends nothing.
+    int timeout = SDL_WAIT_TIMEOUT;
+    if (m_scrolling)
+      timeout = std::max(1, int(m_nextScrollSample - SDL_GetTicks()));
+
+    if (!SDL_WaitEventTimeout(&event, timeout))
+    {
+      sampleScroll();
+      continue;
+    }
+
+    // handle everything that queued up while we were busy before going back to sleep
+    do
+    {
+      if (!handleEvent(event))
+        return;
+    }
+    while (SDL_PollEvent(&event));
+
+    sampleScroll();
   }
 }
 
@@ -201,6 +350,7 @@ void InputSDLWorker::refreshJoystickList()
   }
 
   m_joysticks.clear();
+  m_joystickNames.clear();
 
   // list all the joysticks and open them
   int numJoysticks = SDL_NumJoysticks();
@@ -217,9 +367,14 @@ void InputSDLWorker::refreshJoystickList()
                   << SDL_JoystickNumButtons(joystick) << " buttons and " << SDL_JoystickNumAxes(joystick)
                   << "axes";
       m_joysticks[instanceid] = joystick;
+      m_joystickNames[instanceid] = QString::fromUtf8(SDL_JoystickName(joystick));
       m_axisState.clear();
+      m_axisZone.clear();
     }
   }
+
+  // a stick that was unplugged while pushed doesn't scroll on
+  m_scrollValue[0] = m_scrollValue[1] = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -231,6 +386,7 @@ InputSDL::InputSDL(QObject* parent) : InputBase(parent)
 
   connect(this, &InputSDL::run, m_sdlworker, &InputSDLWorker::run);
   connect(m_sdlworker, &InputSDLWorker::receivedInput, this, &InputBase::receivedInput);
+  connect(m_sdlworker, &InputSDLWorker::receivedScroll, this, &InputBase::receivedScroll);
   m_thread->start();
 }
 
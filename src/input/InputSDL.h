@@ -12,8 +12,11 @@
 #include <QThread>
 #include <QElapsedTimer>
 #include <QByteArray>
+#include <QVector>
 #include <SDL.h>
 
+#include <atomic>
+
 #include "input/InputComponent.h"
 
 typedef QMap<int, SDL_Joystick*> SDLJoystickMap;
@@ -22,17 +25,31 @@ typedef SDLJoystickMap::const_iterator SDLJoystickMapIterator;
 typedef QMap<int, QElapsedTimer*> SDLTimeStampMap;
 typedef QMap<int, QElapsedTimer*>::const_iterator SDLTimeStampMapIterator;
 
-#define SDL_POLL_TIME 50
+// how long the SDL thread sleeps at most when there are no events
+#define SDL_WAIT_TIMEOUT 1000
+// an axis counts as pressed beyond the threshold and released inside the deadzone
+#define SDL_AXIS_PRESS_THRESHOLD (32768 / 2)
+#define SDL_AXIS_DEADZONE 10000
 #define SDL_BUTTON_REPEAT_DELAY 500
 #define SDL_BUTTON_REPEAT_RATE 100
 
+// with analog scrolling, the left stick is sampled this often while it is pushed
+#define SDL_SCROLL_SAMPLE_MSEC 16
+#define SDL_SCROLL_AXIS_X 0
+#define SDL_SCROLL_AXIS_Y 1
+// velocity is the stick position to this power, for finer control of slow scrolling
+#define SDL_SCROLL_CURVE_EXPONENT 2.0
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class InputSDLWorker : public QObject
 {
   Q_OBJECT
 
 public:
-  explicit InputSDLWorker(QObject* parent) : QObject(parent) {}
+  explicit InputSDLWorker(QObject* parent);
+
+  // safe to call from any thread
+  void setAnalogScrolling(bool enable) { m_analogScrolling = enable; }
 
 public slots:
   void run();
@@ -40,17 +57,61 @@ public slots:
   void close();
 
 signals:
-  void receivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState);
+  void receivedInput(const QString& source, const QString& keycode, InputBase::InputkeyState keyState, qint64 timestamp);
+  void receivedScroll(const QString& source, double x, double y, qint64 timestamp);
 
 private:
+  enum SDLAxisZone
+  {
+    AxisCenter,
+    AxisHysteresis,
+    AxisUp,
+    AxisDown
+  };
+
+  static SDLAxisZone axisZone(qint16 value);
+  // deadzone and curve applied, between -1 and 1
+  static double scrollVelocity(qint16 value);
+
+  // returns true if the motion was taken by analog scrolling
+  bool handleScrollAxis(const SDL_JoyAxisEvent& event);
+  void sampleScroll();
+
+  // returns false when the worker should exit
+  bool handleEvent(const SDL_Event& event);
   void refreshJoystickList();
-  QString nameForId(SDL_JoystickID id);
+  const QString& nameForId(SDL_JoystickID id) const;
+
+  // Keycode strings are built once and then shared, so that emitting an
+  // event from the SDL thread doesn't have to allocate anything.
+  const QString& buttonKeycode(quint8 button);
+  const QString& axisKeycode(quint8 axis, bool up);
 
   SDLJoystickMap m_joysticks;
+  QHash<SDL_JoystickID, QString> m_joystickNames;
+  QString m_unknownJoystick;
+
+  QVector<QString> m_buttonKeycodes;
+  QVector<QString> m_axisKeycodes;
+  QString m_hatCentered;
+  QString m_hatUp;
+  QString m_hatDown;
+  QString m_hatRight;
+  QString m_hatLeft;
+  QString m_hatOther;
 
   // map axis to up = true or down = false
   QHash<quint8, bool> m_axisState;
+  // last zone seen per axis, used to drop motion events that change nothing
+  QHash<quint8, SDLAxisZone> m_axisZone;
   QString m_lastHat;
+
+  std::atomic<bool> m_analogScrolling;
+  // the stick is out of the deadzone and sampled
+  bool m_scrolling;
+  Uint32 m_nextScrollSample;
+  qint16 m_scrollValue[2];
+  QString m_scrollSource;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -63,6 +124,7 @@ public:
   
   const char* inputName() override { return "SDL"; }
   bool initInput() override;
+  void setAnalogScrolling(bool enable) override { m_sdlworker->setAnalogScrolling(enable); }
   
   void close();
 private:
@@ -0,0 +1,126 @@
+#include "InputUdp.h"
+#include "QsLog.h"
+#include "settings/SettingsComponent.h"
+
+#include <QtEndian>
+
+#define UDP_INPUT_MAGIC "PMPI"
+#define UDP_INPUT_VERSION 1
+// magic, version, state, sequence and the two lengths
+#define UDP_INPUT_MIN_SIZE 12
+// a sender that was quiet for this long may start over with its sequence numbers
+#define UDP_INPUT_SENDER_EXPIRY_MSEC (30 * 1000)
+// forget about quiet senders when we track more than this
+#define UDP_INPUT_MAX_SENDERS 64
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool InputUdp::initInput()
+{
+  int port = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "udpInputPort").toInt();
+  if (port <= 0)
+  {
+    QLOG_DEBUG() << "UDP input is disabled";
+    return false;
+  }
+
+  m_socket = new QUdpSocket(this);
+  if (!m_socket->bind(QHostAddress::Any, (quint16)port))
+  {
+    QLOG_WARN() << "Failed to bind UDP input to port" << port << ":" << m_socket->errorString();
+    return false;
+  }
+
+  connect(m_socket, &QUdpSocket::readyRead, this, &InputUdp::readDatagrams);
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputUdp::readDatagrams()
+{
+  while (m_socket->hasPendingDatagrams())
+  {
+    qint64 timestamp = InputBase::timestamp();
+
+    QByteArray datagram;
+    datagram.resize((int)m_socket->pendingDatagramSize());
+
+    QHostAddress sender;
+    if (m_socket->readDatagram(datagram.data(), datagram.size(), &sender) < 0)
+      continue;
+
+    parseDatagram(datagram, sender, timestamp);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void InputUdp::parseDatagram(const QByteArray& data, const QHostAddress& sender, qint64 timestamp)
+{
+  auto bytes = (const uchar*)data.constData();
+
+  if (data.size() < UDP_INPUT_MIN_SIZE || !data.startsWith(UDP_INPUT_MAGIC) || bytes[4] != UDP_INPUT_VERSION)
+  {
+    QLOG_DEBUG() << "Ignoring unknown UDP input packet from" << sender.toString();
+    return;
+  }
+
+  uchar state = bytes[5];
+  quint32 sequence = qFromBigEndian<quint32>(bytes + 6);
+
+  int sourceSize = bytes[10];
+  if (data.size() < 12 + sourceSize)
+    return;
+
+  int keySize = bytes[11 + sourceSize];
+  if (data.size() < 12 + sourceSize + keySize || keySize == 0 || state > KeyPressed)
+  {
+    QLOG_DEBUG() << "Ignoring malformed UDP input packet from" << sender.toString();
+    return;
+  }
+
+  QString source = QString::fromUtf8(data.constData() + 11, sourceSize);
+  QString keycode = QString::fromUtf8(data.constData() + 12 + sourceSize, keySize);
+
+  if (source.isEmpty())
+    source = "udp";
+
+  if (!isNewEvent(sender, source, sequence))
+    return;
+
+  emit receivedInput(source, keycode, (InputkeyState)state, timestamp);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool InputUdp::isNewEvent(const QHostAddress& sender, const QString& source, quint32 sequence)
+{
+  qint64 now = m_clock.elapsed();
+  auto key = qMakePair(sender, source);
+
+  auto it = m_senders.find(key);
+  if (it != m_senders.end() && now - it->lastSeen < UDP_INPUT_SENDER_EXPIRY_MSEC)
+  {
+    // the difference keeps working when the sequence wraps around
+    if ((qint32)(sequence - it->sequence) <= 0)
+      return false;
+
+    it->sequence = sequence;
+    it->lastSeen = now;
+    return true;
+  }
+
+  if (it == m_senders.end() && m_senders.size() >= UDP_INPUT_MAX_SENDERS)
+  {
+    for (auto sit = m_senders.begin(); sit != m_senders.end();)
+    {
+      if (now - sit->lastSeen >= UDP_INPUT_SENDER_EXPIRY_MSEC)
+        sit = m_senders.erase(sit);
+      else
+        ++sit;
+    }
+
+    if (m_senders.size() >= UDP_INPUT_MAX_SENDERS)
+      m_senders.clear();
+  }
+
+  m_senders[key] = { sequence, now };
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef KONVERGO_INPUTUDP_H
+#define KONVERGO_INPUTUDP_H
+
+#include "InputComponent.h"
+
+#include <QUdpSocket>
+#include <QHash>
+#include <QPair>
+#include <QElapsedTimer>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Key events from the LAN, for hardware remotes and home automation bridges
+// that can't afford a HTTP request per key. Every datagram carries a single
+// event, all numbers are big endian:
+//
+//   4 bytes  "PMPI"
+//   1 byte   version, 1
+//   1 byte   state, 0 = down, 1 = up, 2 = pressed
+//   4 bytes  sequence number
+//   1 byte   length of the source, followed by the source in UTF-8
+//   1 byte   length of the keycode, followed by the keycode in UTF-8
+//
+// The sequence number is counted up by the sender for each event of one
+// source, so events can be sent more than once to make up for lost datagrams.
+// Anything that is not newer than the last event we saw is dropped.
+//
+class InputUdp : public InputBase
+{
+  Q_OBJECT
+public:
+  explicit InputUdp(QObject* parent = nullptr) : InputBase(parent), m_socket(nullptr) { m_clock.start(); }
+
+  bool initInput() override;
+  const char* inputName() override { return "udp"; };
+
+private Q_SLOTS:
+  void readDatagrams();
+
+private:
+  void parseDatagram(const QByteArray& data, const QHostAddress& sender, qint64 timestamp);
+  bool isNewEvent(const QHostAddress& sender, const QString& source, quint32 sequence);
+
+  struct Sender
+  {
+    quint32 sequence;
+    qint64 lastSeen;
+  };
+
+  QUdpSocket* m_socket;
+  QHash<QPair<QHostAddress, QString>, Sender> m_senders;
+  QElapsedTimer m_clock;
+};
+
+#endif //KONVERGO_INPUTUDP_H
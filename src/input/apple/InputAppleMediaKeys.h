@@ -12,10 +12,13 @@ class InputAppleMediaKeys : public InputBase
 {
   Q_OBJECT
 public:
-  explicit InputAppleMediaKeys(QObject* parent = nullptr) : InputBase(parent) { }
+  explicit InputAppleMediaKeys(QObject* parent = nullptr) : InputBase(parent), m_sourceName(QStringLiteral("AppleMediaKeys")) { }
   bool initInput() override;
   const char* inputName() override { return "AppleMediaKeys"; }
 
+  // the source of every event, created once instead of per key
+  const QString& sourceName() const { return m_sourceName; }
+
 private:
   void* m_delegate;
   void handleStateChanged(PlayerComponent::State newState, PlayerComponent::State oldState);
@@ -31,6 +34,7 @@ private:
 
   bool m_pendingUpdate;
   quint64 m_currentTime;
+  QString m_sourceName;
 };
 
 #endif //KONVERGO_INPUTAPPLEMEDIAKEYS_H
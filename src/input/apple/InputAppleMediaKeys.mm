@@ -58,27 +58,28 @@
 
 -(MPRemoteCommandHandlerStatus)gotCommand:(MPRemoteCommandEvent *)event
 {
+  qint64 timestamp = InputBase::timestamp();
   QString keyPressed;
   MPRemoteCommand* command = [event command];
 
 #define CMD(name) [MPRemoteCommandCenter sharedCommandCenter].name ## Command
   if (command == CMD(play)) {
-    keyPressed = INPUT_KEY_PLAY;
+    keyPressed = QStringLiteral(INPUT_KEY_PLAY);
   } else if (command == CMD(pause)) {
-    keyPressed = INPUT_KEY_PAUSE;
+    keyPressed = QStringLiteral(INPUT_KEY_PAUSE);
   } else if (command == CMD(togglePlayPause)) {
-    keyPressed = INPUT_KEY_PLAY_PAUSE;
+    keyPressed = QStringLiteral(INPUT_KEY_PLAY_PAUSE);
   } else if (command == CMD(stop)) {
-    keyPressed = INPUT_KEY_STOP;
+    keyPressed = QStringLiteral(INPUT_KEY_STOP);
   } else if (command == CMD(nextTrack)) {
-    keyPressed = INPUT_KEY_NEXT;
+    keyPressed = QStringLiteral(INPUT_KEY_NEXT);
   } else if (command == CMD(previousTrack)) {
-    keyPressed = INPUT_KEY_PREV;
+    keyPressed = QStringLiteral(INPUT_KEY_PREV);
   } else {
     return MPRemoteCommandHandlerStatusCommandFailed;
   }
 
-  emit input->receivedInput("AppleMediaKeys", keyPressed, InputBase::KeyPressed);
+  emit input->receivedInput(input->sourceName(), keyPressed, InputBase::KeyPressed, timestamp);
   return MPRemoteCommandHandlerStatusSuccess;
 }
 
@@ -90,6 +91,7 @@
 
 -(void)mediaKeyTap:(SPMediaKeyTap *)keyTap receivedMediaKeyEvent:(NSEvent *)event
 {
+  qint64 timestamp = InputBase::timestamp();
   int keyCode = (([event data1] & 0xFFFF0000) >> 16);
   int keyFlags = ([event data1] & 0x0000FFFF);
   BOOL keyIsPressed = (((keyFlags & 0xFF00) >> 8)) == 0xA;
@@ -98,26 +100,26 @@
 
   switch (keyCode) {
     case NX_KEYTYPE_PLAY:
-      keyPressed = INPUT_KEY_PLAY_PAUSE;
+      keyPressed = QStringLiteral(INPUT_KEY_PLAY_PAUSE);
       break;
     case NX_KEYTYPE_FAST:
-      keyPressed = "KEY_FAST";
+      keyPressed = QStringLiteral("KEY_FAST");
       break;
     case NX_KEYTYPE_REWIND:
-      keyPressed = "KEY_REWIND";
+      keyPressed = QStringLiteral("KEY_REWIND");
       break;
     case NX_KEYTYPE_NEXT:
-      keyPressed = INPUT_KEY_NEXT;
+      keyPressed = QStringLiteral(INPUT_KEY_NEXT);
       break;
     case NX_KEYTYPE_PREVIOUS:
-      keyPressed = INPUT_KEY_PREV;
+      keyPressed = QStringLiteral(INPUT_KEY_PREV);
       break;
     default:
-      break;
-      // More cases defined in hidsystem/ev_keymap.h
+      // More cases defined in hidsystem/ev_keymap.h, nothing is mapped to them
+      return;
   }
 
-  emit input->receivedInput("AppleMediaKeys", keyPressed, keyIsPressed ? InputBase::KeyDown : InputBase::KeyUp);
+  emit input->receivedInput(input->sourceName(), keyPressed, keyIsPressed ? InputBase::KeyDown : InputBase::KeyUp, timestamp);
 }
 
 @end
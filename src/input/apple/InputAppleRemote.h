@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QString>
+#include <QHash>
 #include "input/InputComponent.h"
 
 
@@ -16,7 +17,8 @@ typedef void delegate;
 class InputAppleRemote : public InputBase
 {
 public:
-  explicit InputAppleRemote(QObject* parent = nullptr) : InputBase(parent), m_remoteID(0) { }
+  explicit InputAppleRemote(QObject* parent = nullptr) : InputBase(parent), m_remoteID(0),
+    m_sourceName(QStringLiteral("AppleRemote")) { }
   const char* inputName() override { return "AppleRemote"; }
   bool initInput() override;
   
@@ -31,6 +33,12 @@ private:
   delegate* m_delegate;
   QStringList m_remotes;
   quint32 m_remoteID;
+
+  // The event names, by the PHT remote ID (0 for normal remotes) and the button code. There
+  // are only a few buttons, so the names are made once instead of on every press.
+  QString eventName(quint32 remoteID, quint8 code);
+  QHash<quint32, QString> m_eventNames;
+  QString m_sourceName;
 };
 
 #endif
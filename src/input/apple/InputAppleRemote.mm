@@ -1,4 +1,5 @@
 #include "settings/SettingsComponent.h"
+#include "settings/SettingsKey.h"
 #include "InputAppleRemote.h"
 #include "QsLog.h"
 
@@ -49,14 +50,26 @@ void InputAppleRemote::remoteButtonEvent(quint8 code, bool pressed, const QStrin
   // Since it's unknown if this will cause problems with any remotes I have added a setting:
   // appleremote.emulatepht to turn this off if needed, but for now we'll keep it defaulted to on
   //
-  QString eventName;
-  if (SettingsComponent::Get().value(SETTINGS_SECTION_APPLEREMOTE, "emulatepht").toBool() &&
-      (m_remoteID >= 150 && m_remoteID <= 160))
-    eventName = QString("%1-%2").arg(m_remoteID).arg(code);
-  else
-    eventName = QString::number(code);
+  qint64 timestamp = InputBase::timestamp();
 
-  emit receivedInput("AppleRemote", eventName, pressed ? KeyDown : KeyUp);
+  static SettingsKey<bool> emulatePHT(SETTINGS_SECTION_APPLEREMOTE, "emulatepht");
+  quint32 remoteID = (emulatePHT.value() && m_remoteID >= 150 && m_remoteID <= 160) ? m_remoteID : 0;
+
+  emit receivedInput(m_sourceName, eventName(remoteID, code), pressed ? KeyDown : KeyUp, timestamp);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString InputAppleRemote::eventName(quint32 remoteID, quint8 code)
+{
+  quint32 key = (remoteID << 8) | code;
+
+  auto it = m_eventNames.constFind(key);
+  if (it != m_eventNames.constEnd())
+    return it.value();
+
+  QString name = remoteID ? QString("%1-%2").arg(remoteID).arg(code) : QString::number(code);
+  m_eventNames.insert(key, name);
+  return name;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -26,9 +26,19 @@
 #include "ui/KonvergoWindow.h"
 #include "Globals.h"
 #include "ui/ErrorMessage.h"
+#include "ui/ArtworkImageProvider.h"
+#include "ui/SlideshowComponent.h"
+#include "ui/WebClientPrewarm.h"
 #include "UniqueApplication.h"
 #include "utils/HelperLauncher.h"
 #include "utils/Log.h"
+#include "utils/ProcessSampler.h"
+#include "utils/MemoryPressure.h"
+#include "utils/NetworkState.h"
+#include "utils/StartupTrace.h"
+#include "utils/Trace.h"
+#include "utils/StallWatchdog.h"
+#include "input/InputComponent.h"
 
 #ifdef Q_OS_MAC
 #include "PFMoveApplication.h"
@@ -38,6 +48,13 @@
 #include "SignalManager.h"
 #endif
 
+#ifdef ENABLE_BENCHMARKS
+#include "core/StartupBenchmark.h"
+#include "player/PlaybackBenchmark.h"
+#include "remote/TimelineBenchmark.h"
+#include "settings/SettingsBenchmark.h"
+#endif
+
 /////////////////////////////////////////////////////////////////////////////////////////
 static void preinitQt()
 {
@@ -83,6 +100,15 @@ void ShowLicenseInfo()
   printf("%.*s\n", contents.size(), contents.data());
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// What every way out of main() has to do last, returns ret.
+static int uninitAll(int ret)
+{
+  Codecs::Uninit();
+  Log::Uninit();
+  return ret;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 QStringList g_qtFlags = {
   "--disable-gpu",
@@ -94,6 +120,9 @@ int main(int argc, char *argv[])
 {
   try
   {
+    // ended once the first frame is on screen, see ComponentManager
+    StartupTrace::Begin("startup");
+
     QCommandLineParser parser;
     parser.setApplicationDescription("Plex Media Player");
     parser.addHelpOption();
@@ -106,7 +135,8 @@ int main(int argc, char *argv[])
                        {"windowed",                "Start in windowed mode"},
                        {"fullscreen",              "Start in fullscreen"},
                        {"no-updates",              "Disable auto-updating"},
-                       {"terminal",                "Log to terminal"}});
+                       {"terminal",                "Log to terminal"},
+                       {"trace",                   "Record trace events until exit, see also the trace host command"}});
 
     auto scaleOption = QCommandLineOption("scale-factor", "Set to a integer or default auto which controls" \
                                                           "the scale (DPI) of the desktop interface.");
@@ -114,6 +144,13 @@ int main(int argc, char *argv[])
     scaleOption.setDefaultValue("auto");
     parser.addOption(scaleOption);
 
+#ifdef ENABLE_BENCHMARKS
+    parser.addOption({"benchmark-settings", "Benchmark the settings reads, writes and saves on a separate profile, then quit"});
+    parser.addOption({"benchmark-timeline", "Send synthetic timelines to remote subscribers", "rate"});
+    parser.addOption({"benchmark-playback", "Play the media listed in a file without the web client and print JSON stats", "list"});
+    parser.addOption({"benchmark-startup", "Start on a separate profile with a stub web client, print the startup phases as JSON and quit", "cold|warm"});
+#endif
+
     char **newArgv = appendCommandLineArguments(argc, argv, g_qtFlags);
     int newArgc = argc + g_qtFlags.size();
 
@@ -151,13 +188,23 @@ int main(int argc, char *argv[])
       return EXIT_SUCCESS;
     }
 
+#ifdef ENABLE_BENCHMARKS
+    if (parser.isSet("benchmark-startup") && !StartupBenchmark::Prepare(parser.value("benchmark-startup")))
+      return EXIT_FAILURE;
+
+    if (parser.isSet("benchmark-settings"))
+      SettingsBenchmark::prepare();
+#endif
+
     auto scale = parser.value("scale-factor");
     if (scale.isEmpty() || scale == "auto")
       QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     else if (scale != "none")
       qputenv("QT_SCALE_FACTOR", scale.toUtf8());
 
+    StartupTrace::Begin("QApplication");
     QApplication app(newArgc, newArgv);
+    StartupTrace::End("QApplication");
 #if defined(Q_OS_WIN) || defined(Q_OS_LINUX)
     // Setting window icon on OSX will break user ability to change it
     app.setWindowIcon(QIcon(":/images/icon.png"));
@@ -184,33 +231,72 @@ int main(int argc, char *argv[])
     if (parser.isSet("terminal"))
       Log::EnableTerminalOutput();
 
+    if (parser.isSet("trace"))
+      Trace::Start();
+
     // Quit app and apply update if we find one.
-    if (!parser.isSet("no-updates") && UpdateManager::CheckForUpdates())
+    StartupTrace::Begin("UpdateManager::CheckForUpdates");
+    bool haveUpdate = !parser.isSet("no-updates") && UpdateManager::CheckForUpdates();
+    StartupTrace::End("UpdateManager::CheckForUpdates");
+    if (haveUpdate)
     {
       app.quit();
       return 0;
     }
 
+    StartupTrace::Begin("detectOpenGLLate");
     detectOpenGLLate();
+    StartupTrace::End("detectOpenGLLate");
+
+    // Get the web engine and the web client going while the rest initializes. The remote
+    // inspector variable below is only read once the first web view is created.
+    StartupTrace::Begin("QtWebEngine::initialize");
+    QtWebEngine::initialize();
+    StartupTrace::End("QtWebEngine::initialize");
 
+    WebClientPrewarm::Start();
+
+    StartupTrace::Begin("Codecs::preinitCodecs");
     Codecs::preinitCodecs();
+    StartupTrace::End("Codecs::preinitCodecs");
+
+    // the remote and discovery components read the addresses while they start
+    NetworkState::Get().start();
 
     // Initialize all the components. This needs to be done
     // early since most everything else relies on it
     //
+    StartupTrace::Begin("ComponentManager::initialize");
     ComponentManager::Get().initialize();
+    StartupTrace::End("ComponentManager::initialize");
+
+#ifdef ENABLE_BENCHMARKS
+    // these run on the initialized components and exit
+    int (*benchmark)() = nullptr;
+    if (parser.isSet("benchmark-settings"))
+      benchmark = &SettingsBenchmark::run;
+
+    if (benchmark)
+    {
+      int ret = benchmark();
+      delete uniqueApp;
+      return uninitAll(ret);
+    }
+#endif
 
     if (parser.isSet("no-updates"))
       UpdaterComponent::Get().disable();
 
+    // The crash handler is installed before the settings are loaded.
+    if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "crashDumpProfile").toString() == "stacks-heap")
+      setBreakPadDumpProfile(BREAKPAD_DUMP_STACKS_HEAP);
+
     SettingsComponent::Get().setCommandLineValues(parser.optionNames());
 
     // enable remote inspection if we have the correct setting for it.
     if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "remoteInspector").toBool())
       qputenv("QTWEBENGINE_REMOTE_DEBUGGING", "0.0.0.0:9992");
 
-    QtWebEngine::initialize();
-
     // start our helper
 #if ENABLE_HELPER
     HelperLauncher::Get().connectToHelper();
@@ -219,6 +305,14 @@ int main(int argc, char *argv[])
     QQmlApplicationEngine *engine = Globals::Engine();
 
     KonvergoWindow::RegisterClass();
+
+    ArtworkCache::Get().setBudget(SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "artworkCacheSize").toInt());
+    QObject::connect(&MemoryPressure::Get(), &MemoryPressure::levelChanged, [](MemoryPressure::Level level)
+    {
+      ArtworkCache::Get().setMemoryShare(MemoryPressure::share(level));
+    });
+    engine->addImageProvider("artwork", new ArtworkImageProvider);
+    engine->addImageProvider("slideshow", new ArtworkImageProvider(&SlideshowComponent::Get().photos()));
     Globals::SetContextProperty("components", &ComponentManager::Get().getQmlPropertyMap());
 
     // the only way to detect if QML parsing fails is to hook to this signal and then see
@@ -237,22 +331,55 @@ int main(int argc, char *argv[])
       QObject* webChannel = qvariant_cast<QObject*>(window->property("webChannel"));
       Q_ASSERT(webChannel);
       ComponentManager::Get().setWebChannel(qobject_cast<QWebChannel*>(webChannel));
+      ComponentManager::Get().initializeDeferred(window);
 
       QObject::connect(uniqueApp, &UniqueApplication::otherApplicationStarted, window, &KonvergoWindow::otherAppFocus);
     });
+#ifdef ENABLE_BENCHMARKS
+    if (parser.isSet("benchmark-timeline"))
+    {
+      // the remote component is one of the deferred ones
+      auto benchmark = new TimelineBenchmark(parser.value("benchmark-timeline").toInt(), &app);
+      QObject::connect(&ComponentManager::Get(), &ComponentManager::deferredInitialized,
+                       benchmark, &TimelineBenchmark::start);
+    }
+
+    if (parser.isSet("benchmark-playback"))
+    {
+      // mpv still renders into the window, only web is left out
+      KonvergoWindow::setWebUrlOverride("about:blank");
+      auto benchmark = new PlaybackBenchmark(parser.value("benchmark-playback"), &app);
+      QObject::connect(&ComponentManager::Get(), &ComponentManager::deferredInitialized,
+                       benchmark, &PlaybackBenchmark::start);
+    }
+
+    if (parser.isSet("benchmark-startup"))
+      StartupBenchmark::Start();
+#endif
+
+    StartupTrace::Begin("engine->load");
     engine->load(QUrl(QStringLiteral("qrc:/ui/webview.qml")));
+    StartupTrace::End("engine->load");
 
     Log::UpdateLogLevel();
 
+    ProcessSampler::Get().start();
+    MemoryPressure::Get().start();
+
+    InputComponent::Get().registerHostCommand("trace", &Trace::Toggle);
+
+    StallWatchdog::Get().start();
+
     // run our application
     int ret = app.exec();
 
+    StallWatchdog::Get().stop();
+    Trace::Stop();
+
     delete uniqueApp;
     Globals::EngineDestroy();
 
-    Codecs::Uninit();
-    Log::Uninit();
-    return ret;
+    return uninitAll(ret);
   }
   catch (FatalException& e)
   {
@@ -264,8 +391,6 @@ int main(int argc, char *argv[])
 
     errApp.exec();
 
-    Codecs::Uninit();
-    Log::Uninit();
-    return 1;
+    return uninitAll(1);
   }
 }
@@ -0,0 +1,117 @@
+#include "AudioCapabilities.h"
+
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QSet>
+
+#include "QsLog.h"
+
+// where ALSA lists the sound cards, as card<n>/id and card<n>/eld#<codec>.<pin>
+#define ALSA_PROC_DIR "/proc/asound"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Short audio descriptor coding types (CEA-861), for the formats we can pass through.
+static QString codecFromCodingType(int type)
+{
+  switch (type)
+  {
+    case 0x2: return "ac3";
+    case 0x7: return "dts";
+    case 0xa: return "eac3";
+    case 0xb: return "dts-hd";
+    case 0xc: return "truehd";
+    default: return QString();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool AudioCapabilities::ParseELD(const QString& eld, QStringList& codecs)
+{
+  bool present = false, valid = false;
+  codecs.clear();
+
+  // lines like "sad1_coding_type	[0x2] AC-3"
+  QRegularExpression codingType("^sad\\d+_coding_type\\s+\\[0x([0-9a-fA-F]+)\\]");
+
+  for (const QString& line : eld.split('\n'))
+  {
+    QStringList fields = line.simplified().split(' ');
+    if (fields.size() < 2)
+      continue;
+
+    if (fields[0] == "monitor_present")
+      present = fields[1] == "1";
+    else if (fields[0] == "eld_valid")
+      valid = fields[1] == "1";
+
+    QRegularExpressionMatch match = codingType.match(line);
+    if (match.hasMatch())
+    {
+      QString codec = codecFromCodingType(match.captured(1).toInt(nullptr, 16));
+      if (!codec.isEmpty() && !codecs.contains(codec))
+        codecs << codec;
+    }
+  }
+
+  if (!present || !valid)
+  {
+    codecs.clear();
+    return false;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList AudioCapabilities::ProbePassthrough(const QString& device)
+{
+#ifdef Q_OS_LINUX
+  QString card;
+  QRegularExpressionMatch match = QRegularExpression("CARD=([^,:]+)").match(device);
+  if (match.hasMatch())
+    card = match.captured(1);
+
+  QDir proc(ALSA_PROC_DIR);
+  bool found = false;
+  QSet<QString> codecs;
+
+  for (const QString& cardDir : proc.entryList(QStringList("card*"), QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    QDir dir(proc.absoluteFilePath(cardDir));
+
+    if (!card.isEmpty())
+    {
+      QFile id(dir.absoluteFilePath("id"));
+      if (!id.open(QIODevice::ReadOnly) || QString::fromUtf8(id.readAll()).trimmed() != card)
+        continue;
+    }
+
+    for (const QString& eldName : dir.entryList(QStringList("eld#*"), QDir::Files))
+    {
+      QFile eldFile(dir.absoluteFilePath(eldName));
+      if (!eldFile.open(QIODevice::ReadOnly))
+        continue;
+
+      QStringList sinkCodecs;
+      if (!ParseELD(QString::fromUtf8(eldFile.readAll()), sinkCodecs))
+        continue;
+
+      codecs = found ? codecs.intersect(sinkCodecs.toSet()) : sinkCodecs.toSet();
+      found = true;
+    }
+  }
+
+  QStringList result = codecs.toList();
+  // keep the order stable, so the audio configuration doesn't look changed
+  result.sort();
+
+  if (found)
+    QLOG_DEBUG() << "HDMI sink of" << device << "decodes:" << (result.isEmpty() ? "only PCM" : result.join(","));
+
+  return result;
+#else
+  Q_UNUSED(device);
+  return QStringList();
+#endif
+}
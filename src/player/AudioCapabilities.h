@@ -0,0 +1,27 @@
+#ifndef AUDIOCAPABILITIES_H
+#define AUDIOCAPABILITIES_H
+
+#include <QStringList>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Finds out which formats the HDMI sink (TV or receiver) can decode, from the
+// ELD its driver has read from the EDID. The formats are named like in
+// PlayerComponent::AudioCodecsAll().
+//
+// Only ALSA makes the ELD available to us (in /proc/asound), on other platforms
+// nothing is detected and the passthrough settings are all there is.
+class AudioCapabilities
+{
+public:
+  // The formats the sinks behind an mpv audio device (e.g. "alsa/hdmi:CARD=PCH,DEV=0")
+  // can decode. Devices that don't name an ALSA card check all cards, and if
+  // several sinks are connected, only the formats all of them support count.
+  // Empty if there's no ELD.
+  static QStringList ProbePassthrough(const QString& device);
+
+  // Parses an ELD the way ALSA presents it in /proc/asound/card*/eld#*. Returns
+  // false if no monitor is present or the ELD isn't valid.
+  static bool ParseELD(const QString& eld, QStringList& codecs);
+};
+
+#endif // AUDIOCAPABILITIES_H
@@ -0,0 +1,121 @@
+#include "AudioSyncProfile.h"
+
+#include <QDateTime>
+
+#include <math.h>
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::load(const QVariantMap& state)
+{
+  m_profiles = state;
+  m_changed = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool AudioSyncProfile::takeChanged()
+{
+  bool changed = m_changed;
+  m_changed = false;
+  return changed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString AudioSyncProfile::outputKey(const QString& device, bool passthrough, double refreshRate)
+{
+  // 23.976 and 24 are the same mode to a receiver, and so are 59.94 and 60
+  return device + "|" + (passthrough ? "passthrough" : "pcm") + "|" + QString::number(qRound(refreshRate));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::setOutput(const QString& key)
+{
+  m_output = key;
+  m_samples = 0;
+  m_avsyncSum = 0;
+  m_avsyncChange = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 AudioSyncProfile::delay(bool* known) const
+{
+  QVariantMap profile = m_profiles.value(m_output).toMap();
+  if (known)
+    *known = profile.contains("delayMs");
+  return profile.value("delayMs").toLongLong();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::learn(qint64 milliseconds)
+{
+  if (m_output.isEmpty())
+    return;
+
+  QVariantMap profile = m_profiles.value(m_output).toMap();
+  if (profile.contains("delayMs") && profile["delayMs"].toLongLong() == milliseconds)
+    return;
+
+  QLOG_INFO() << "Audio delay for" << m_output << "is now" << milliseconds << "ms";
+  profile["delayMs"] = milliseconds;
+  profile["lastUsed"] = QDateTime::currentMSecsSinceEpoch();
+  m_profiles[m_output] = profile;
+  m_changed = true;
+  prune();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::addAvsync(double seconds)
+{
+  if (fabs(seconds) > AUDIO_SYNC_MAX_SAMPLE_SECS)
+    return;
+  m_samples++;
+  m_avsyncSum += seconds;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::finish()
+{
+  if (m_output.isEmpty() || !m_samples)
+    return;
+
+  QVariantMap profile = m_profiles.value(m_output).toMap();
+  double avsyncMs = m_avsyncSum / m_samples * 1000;
+  double changeMs = m_avsyncChange * 1000;
+  int files = profile.value("files").toInt();
+  if (files > 0)
+  {
+    avsyncMs = profile.value("avsyncMs").toDouble() * (1 - AUDIO_SYNC_AVERAGE_WEIGHT) + avsyncMs * AUDIO_SYNC_AVERAGE_WEIGHT;
+    changeMs = profile.value("avsyncChangeMs").toDouble() * (1 - AUDIO_SYNC_AVERAGE_WEIGHT) + changeMs * AUDIO_SYNC_AVERAGE_WEIGHT;
+  }
+
+  profile["avsyncMs"] = avsyncMs;
+  profile["avsyncChangeMs"] = changeMs;
+  profile["files"] = files + 1;
+  profile["lastUsed"] = QDateTime::currentMSecsSinceEpoch();
+  m_profiles[m_output] = profile;
+  m_changed = true;
+  prune();
+
+  QLOG_DEBUG() << "A/V sync on" << m_output << ": avsync" << m_avsyncSum / m_samples * 1000 << "ms over"
+               << m_samples << "samples, corrected by" << m_avsyncChange * 1000 << "ms";
+
+  m_samples = 0;
+  m_avsyncSum = 0;
+  m_avsyncChange = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AudioSyncProfile::prune()
+{
+  while (m_profiles.size() > AUDIO_SYNC_MAX_PROFILES)
+  {
+    auto oldest = m_profiles.begin();
+    for (auto it = m_profiles.begin(); it != m_profiles.end(); ++it)
+    {
+      if (it.value().toMap().value("lastUsed").toLongLong() < oldest.value().toMap().value("lastUsed").toLongLong())
+        oldest = it;
+    }
+    m_profiles.erase(oldest);
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef AUDIOSYNCPROFILE_H
+#define AUDIOSYNCPROFILE_H
+
+#include <QVariantMap>
+#include <QString>
+#include <QtGlobal>
+
+// outputs remembered, the one used longest ago is dropped first
+#define AUDIO_SYNC_MAX_PROFILES 32
+// avsync samples further off than this are a seek or a stream switch settling, not lipsync
+#define AUDIO_SYNC_MAX_SAMPLE_SECS 0.5
+// weight of the last file in the avsync average of an output
+#define AUDIO_SYNC_AVERAGE_WEIGHT 0.25
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Lipsync delay per audio output: the audio device, whether it gets passthrough or PCM, and
+// the display refresh rate. Receivers and TVs add different latencies for each, so a delay
+// the user dialed in once only fits the output it was set for.
+//
+// mpv can't measure that latency, it happens after the audio left the device, so the delays
+// are the user's own corrections: the last one made while playing on an output is used
+// at the start of later files on it. What mpv does see, avsync and total-avsync-change, is
+// averaged per output as well, so a device that reports its buffering wrong shows up in
+// the logs and in state() instead of being blamed on the receiver.
+//
+class AudioSyncProfile
+{
+public:
+  AudioSyncProfile() : m_samples(0), m_avsyncSum(0), m_avsyncChange(0), m_changed(false) {}
+
+  // The "state" setting it is kept in, see state().
+  void load(const QVariantMap& state);
+  QVariantMap state() const { return m_profiles; }
+  // true once since something worth saving changed
+  bool takeChanged();
+
+  static QString outputKey(const QString& device, bool passthrough, double refreshRate);
+
+  // Starts measuring a file on the output, clears the last measurements.
+  void setOutput(const QString& key);
+  const QString& output() const { return m_output; }
+
+  // ms the user's last correction for the output was, *known is false without one
+  qint64 delay(bool* known = nullptr) const;
+  void learn(qint64 milliseconds);
+
+  void addAvsync(double seconds);
+  void setAvsyncChange(double seconds) { m_avsyncChange = seconds; }
+  // Folds the measurements of the file into the output's averages.
+  void finish();
+
+private:
+  void prune();
+
+  QString m_output;
+  QVariantMap m_profiles;
+  qint64 m_samples;
+  double m_avsyncSum;
+  double m_avsyncChange;
+  bool m_changed;
+};
+
+#endif // AUDIOSYNCPROFILE_H
@@ -0,0 +1,115 @@
+#include "CachePolicy.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_MAC)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#else
+#include <unistd.h>
+#endif
+
+// Share of the physical memory all buffers together may use, and the limits
+// of that budget in MB. The budget is split evenly between the stream cache
+// and the demuxer queue.
+#define CACHE_MEMORY_FRACTION 8
+#define CACHE_BUDGET_MIN_MB 100
+#define CACHE_BUDGET_MAX_MB 1024
+// A demuxer queue that is too short makes badly interleaved files fail.
+#define CACHE_DEMUXER_MIN_MB 50
+// Seconds of media to read ahead normally, and if the measured throughput is
+// barely above the bitrate (this is what lets a fast network get ahead of a
+// stall).
+#define CACHE_READAHEAD_SECS 20
+#define CACHE_READAHEAD_SLOW_SECS 60
+#define CACHE_SLOW_THROUGHPUT_FACTOR 1.5
+// Covers a whole track for music, limited by the budget like everything else.
+#define CACHE_READAHEAD_AUDIO_SECS (15 * 60)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool CachePolicy::Sizes::operator==(const Sizes& other) const
+{
+  return cacheKB == other.cacheKB && backbufferKB == other.backbufferKB &&
+         demuxerMaxBytes == other.demuxerMaxBytes && readaheadSecs == other.readaheadSecs;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CachePolicy::CachePolicy(qint64 userCacheMB)
+  : m_memory(physicalMemory()), m_userCacheMB(userCacheMB), m_bitrateKbps(0), m_throughput(0),
+    m_audioOnly(false), m_memoryShare(1)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 CachePolicy::physicalMemory()
+{
+#if defined(Q_OS_WIN)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status))
+    return (qint64)status.ullTotalPhys;
+  return 0;
+#elif defined(Q_OS_MAC)
+  int64_t memory = 0;
+  size_t size = sizeof(memory);
+  if (sysctlbyname("hw.memsize", &memory, &size, nullptr, 0) == 0)
+    return memory;
+  return 0;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGE_SIZE);
+  if (pages <= 0 || pageSize <= 0)
+    return 0;
+  return (qint64)pages * pageSize;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 CachePolicy::bitrateFromMediaInfo(const QVariantMap& serverMediaInfo)
+{
+  qint64 bitrate = serverMediaInfo["bitrate"].toLongLong();
+  if (bitrate > 0)
+    return bitrate;
+
+  // Not every item has the overall bitrate, add up the streams instead.
+  for (auto partInfo : serverMediaInfo["Part"].toList())
+  {
+    for (auto streamInfo : partInfo.toMap()["Stream"].toList())
+      bitrate += streamInfo.toMap()["bitrate"].toLongLong();
+  }
+  return bitrate;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CachePolicy::Sizes CachePolicy::sizes() const
+{
+  qint64 budget = (m_memory / CACHE_MEMORY_FRACTION) / (1024 * 1024);
+  budget = qBound((qint64)CACHE_BUDGET_MIN_MB, budget, (qint64)CACHE_BUDGET_MAX_MB) * 1024 * 1024;
+  budget = (qint64)(budget * m_memoryShare);
+
+  double readahead = CACHE_READAHEAD_SECS;
+  double bytesPerSecond = m_bitrateKbps * 1000.0 / 8;
+  if (bytesPerSecond > 0 && m_throughput > 0 &&
+      m_throughput < bytesPerSecond * CACHE_SLOW_THROUGHPUT_FACTOR)
+    readahead = CACHE_READAHEAD_SLOW_SECS;
+  if (m_audioOnly)
+    readahead = CACHE_READAHEAD_AUDIO_SECS;
+
+  // Without a bitrate, fall back to what the user picked (and the minimum).
+  qint64 wanted = (qint64)(bytesPerSecond * readahead);
+  qint64 half = budget / 2;
+
+  Sizes sizes;
+  // The user's size is kept as it is, unless the system is short on memory.
+  qint64 user = m_userCacheMB * 1024 * 1024;
+  if (m_memoryShare < 1)
+    user = qMin(user, half);
+  sizes.cacheKB = qMax(qMin(wanted, half), user) / 1024;
+  // A quarter of the cache again is kept behind the play position.
+  sizes.backbufferKB = sizes.cacheKB / 4;
+  // a short queue fails on some files, being OOM killed fails on all of them
+  qint64 demuxerMin = m_memoryShare < 1 ? 0 : (qint64)CACHE_DEMUXER_MIN_MB * 1024 * 1024;
+  sizes.demuxerMaxBytes = qMin(qMax(wanted, demuxerMin), half);
+  sizes.readaheadSecs = readahead;
+  return sizes;
+}
@@ -0,0 +1,56 @@
+#ifndef CACHEPOLICY_H
+#define CACHEPOLICY_H
+
+#include <QVariantMap>
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Chooses how much mpv may buffer. Low memory devices used to get fixed small
+// values (which high bitrate remuxes outrun), everything else mpv's defaults
+// (which leave most of a desktop's RAM unused).
+class CachePolicy
+{
+public:
+  struct Sizes
+  {
+    qint64 cacheKB;           // "cache", the stream cache
+    qint64 backbufferKB;      // "cache-backbuffer", kept for seeking back
+    qint64 demuxerMaxBytes;   // "demuxer-max-bytes", the packet queue
+    double readaheadSecs;     // "demuxer-readahead-secs"
+
+    bool operator==(const Sizes& other) const;
+    bool operator!=(const Sizes& other) const { return !(*this == other); }
+  };
+
+  // userCacheMB is the video.cache setting, which is the minimum even above the
+  // budget, unless the system is short on memory (see setMemoryShare()).
+  explicit CachePolicy(qint64 userCacheMB = 0);
+
+  void setUserCacheSize(qint64 megabytes) { m_userCacheMB = megabytes; }
+  // Bitrate the server reported for the item, 0 if unknown.
+  void setBitrate(qint64 kbps) { m_bitrateKbps = kbps; }
+  // Measured network throughput, 0 if not known yet.
+  void setThroughput(double bytesPerSecond) { m_throughput = bytesPerSecond; }
+  // Music tracks are read ahead as a whole, so the next one in the queue gets opened
+  // (prefetch-playlist) while this one is still playing.
+  void setAudioOnly(bool audioOnly) { m_audioOnly = audioOnly; }
+  // Share of the usual budget that may be used while the system is short on memory, 1 normally.
+  // Below 1 the demuxer queue minimum doesn't apply either.
+  void setMemoryShare(double share) { m_memoryShare = share; }
+
+  Sizes sizes() const;
+
+  static qint64 bitrateFromMediaInfo(const QVariantMap& serverMediaInfo);
+  // Total physical memory, 0 if it can't be determined.
+  static qint64 physicalMemory();
+
+private:
+  qint64 m_memory;
+  qint64 m_userCacheMB;
+  qint64 m_bitrateKbps;
+  double m_throughput;
+  bool m_audioOnly;
+  double m_memoryShare;
+};
+
+#endif // CACHEPOLICY_H
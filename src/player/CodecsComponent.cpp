@@ -7,6 +7,7 @@
 #include <QDomNode>
 #include <QCoreApplication>
 #include <QProcess>
+#include <QTimer>
 #include <QUuid>
 #include <QUrl>
 #include <QUrlQuery>
@@ -16,6 +17,21 @@
 #include <QSysInfo>
 #include <QCryptographicHash>
 #include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <string.h>
+
+#include <mpv/client.h>
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 101)
+#include <mpv/stream_cb.h>
+#define HAVE_MPV_STREAM_CB 1
+#endif
 
 #ifdef HAVE_MINIZIP
 #include <minizip/unzip.h>
@@ -24,14 +40,27 @@
 
 #include "system/SystemComponent.h"
 #include "settings/SettingsComponent.h"
+#include "utils/AssetView.h"
 #include "utils/Utils.h"
+#include "utils/NetworkService.h"
 #include "shared/Paths.h"
 #include "PlayerComponent.h"
+#include "ZipStreamExtractor.h"
+#include "DownloadProgress.h"
+#include "UtilityMpv.h"
 
 #include "QsLog.h"
 
 #define countof(x) (sizeof(x) / sizeof((x)[0]))
 
+// How many codecs are fetched at the same time.
+#define MAX_PARALLEL_DOWNLOADS 3
+
+// The codec directories are looked through this long after startup.
+#define CODEC_MAINTENANCE_DELAY_MSEC (30 * 1000)
+// A codec list from the last start is checked against mpv this long after startup.
+#define CODEC_LIST_REBUILD_DELAY_MSEC (5 * 1000)
+
 // For QVariant. Mysteriously makes Qt happy.
 Q_DECLARE_METATYPE(CodecDriver);
 
@@ -83,15 +112,38 @@ static QSet<QString> g_systemAudioDecoderWhitelist = {
 static QSet<QString> g_systemAudioEncoderWhitelist = {
 };
 
-static QSize g_mediaFoundationH264MaxResolution;
+// Largest resolution each probed decoder handled, see probeCodecs(). Keyed by
+// decoder name, or "hwdec:" + format for FFmpeg decoders with hardware decoding.
+// QSize() means all probes failed. Written by the background probe.
+static QHash<QString, QSize> g_probedMaxResolutions;
+static QMutex g_probedMaxResolutionsLock;
 
 static QString g_codecVersion;
+static QString g_ffmpegVersion;
 static QList<CodecDriver> g_cachedCodecList;
+// Indexes into g_cachedCodecList, rebuilt by updateCachedCodecList().
+static QHash<QPair<int, QString>, QList<int>> g_cachedCodecsByFormat;
+static QHash<QString, int> g_cachedCodecsByName;
+static int g_cachedCodecListGeneration;
 
 static QString g_deviceID;
 
+// bump when the meaning of something in the codec state changes
+#define CODEC_STATE_VERSION 1
+static QMutex g_codecStateLock;
+static QVariantMap g_codecState;
+
 static QString g_eaeWatchFolder;
 static QProcess* g_eaeProcess;
+// stops EAE when no playback needed it for a while
+static QTimer* g_eaeIdleTimer;
+// terminate() was sent and the process hasn't exited yet
+static bool g_eaeStopping;
+// EAE was asked for while it was stopping, it's started once the old process is gone
+static bool g_eaeRestartPending;
+
+// downloads in flight, by downloadName(), and the fetcher doing each one
+static QHash<QString, CodecsFetcher*> g_codecDownloads;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static QString getBuildType()
@@ -123,18 +175,37 @@ static QString getEAEBuildType()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QString Codecs::plexNameToFF(QString plex)
+// Codecs Plex and FFmpeg call differently. Comparing a QString to a char literal converts the
+// literal to a QString first, QLatin1String compares in place.
+struct CodecName
 {
-  if (plex == "dca")
-    return "dts";
+  QLatin1String plex;
+  QLatin1String ff;
+};
+
+static const CodecName g_codecNames[] = {
+  { QLatin1String("dca"), QLatin1String("dts") },
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString Codecs::plexNameToFF(const QString& plex)
+{
+  for (const CodecName& name : g_codecNames)
+  {
+    if (plex == name.plex)
+      return name.ff;
+  }
   return plex;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QString Codecs::plexNameFromFF(QString ffname)
+QString Codecs::plexNameFromFF(const QString& ffname)
 {
-  if (ffname == "dts")
-    return "dca";
+  for (const CodecName& name : g_codecNames)
+  {
+    if (ffname == name.ff)
+      return name.plex;
+  }
   return ffname;
 }
 
@@ -174,20 +245,134 @@ static bool eaeIsPresent()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static int indexOfCodecInList(const QList<CodecDriver>& list, const CodecDriver& codec)
+// What codec startup needs from earlier launches, in one file, so it doesn't have to look
+// through the codec directories every time: the device ID, the codec files that were found
+// in them (and the ones we installed since) and the probe results. The directories are still
+// scanned, but in the background once the app is up (see CodecMaintenanceJob), and what
+// that finds is used on the next start.
+static QString codecStatePath()
 {
-  for (int n = 0; n < list.size(); n++)
+  return QDir(codecsRootPath()).absoluteFilePath(".codec-state");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void loadCodecState()
+{
+  QVariantMap state;
+  QFile file(codecStatePath());
+  if (file.open(QFile::ReadOnly))
+    state = QJsonDocument::fromJson(file.readAll()).object().toVariantMap();
+
+  if (state["version"].toInt() != CODEC_STATE_VERSION)
   {
-    if (Codecs::sameCodec(list[n], codec))
-      return n;
+    state.clear();
+    state["version"] = CODEC_STATE_VERSION;
   }
+  // what got installed with which hash, written by earlier builds but never needed
+  state.remove("installed");
+
+  QMutexLocker lock(&g_codecStateLock);
+  g_codecState = state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QVariant codecState(const QString& key)
+{
+  QMutexLocker lock(&g_codecStateLock);
+  return g_codecState.value(key);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Can be called from any thread, the file is written right away.
+static void setCodecState(const QString& key, const QVariant& value)
+{
+  QMutexLocker lock(&g_codecStateLock);
+  g_codecState[key] = value;
+  Utils::safelyWriteFile(codecStatePath(), QJsonDocument(QJsonObject::fromVariantMap(g_codecState)).toJson());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int indexOfCachedCodec(const CodecDriver& codec)
+{
+  int index = g_cachedCodecsByName.value(codec.getMangledName(), -1);
+  if (index >= 0 && Codecs::sameCodec(g_cachedCodecList[index], codec))
+    return index;
   return -1;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void addCachedCodec(const CodecDriver& codec)
+{
+  int index = g_cachedCodecList.size();
+  g_cachedCodecList.append(codec);
+  g_cachedCodecsByFormat[qMakePair((int)codec.type, codec.format)].append(index);
+  g_cachedCodecsByName.insert(codec.getMangledName(), index);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The decoder and encoder lists only change with the mpv and FFmpeg builds, or when codecs
+// are installed, and updateCachedCodecList() saves the list again then.
+static QString codecListVersion()
+{
+  QString mpvVersion = mpv::qt::get_property(PlayerComponent::Get().getMpvHandle(), "mpv-version").toString();
+  QByteArray build = (mpvVersion + "|" + g_ffmpegVersion + "|" + g_codecVersion).toUtf8();
+  return QString::fromLatin1(QCryptographicHash::hash(build, QCryptographicHash::Sha1).toHex());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void saveCachedCodecList()
+{
+  QVariantList codecs;
+  for (const CodecDriver& codec : g_cachedCodecList)
+  {
+    codecs.append(QVariantMap {
+      { "type", (int)codec.type }, { "format", codec.format }, { "driver", codec.driver },
+      { "present", codec.present }, { "external", codec.external }
+    });
+  }
+
+  QVariantMap list;
+  list["version"] = codecListVersion();
+  list["codecs"] = codecs;
+  setCodecState("codecList", list);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns false if there is no list saved for this build, the cached list is left alone then.
+static bool loadCachedCodecList()
+{
+  QVariantMap list = codecState("codecList").toMap();
+  if (list["version"].toString() != codecListVersion() || list["codecs"].toList().isEmpty())
+    return false;
+
+  g_cachedCodecList.clear();
+  g_cachedCodecsByFormat.clear();
+  g_cachedCodecsByName.clear();
+
+  for (const QVariant& entry : list["codecs"].toList())
+  {
+    QVariantMap map = entry.toMap();
+    CodecDriver codec = {};
+    codec.type = map["type"].toInt() == (int)CodecType::Encoder ? CodecType::Encoder : CodecType::Decoder;
+    codec.format = map["format"].toString();
+    codec.driver = map["driver"].toString();
+    codec.present = map["present"].toBool();
+    codec.external = map["external"].toBool();
+    addCachedCodec(codec);
+  }
+
+  g_cachedCodecListGeneration++;
+  return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Codecs::updateCachedCodecList()
 {
+  QList<CodecDriver> oldList = g_cachedCodecList;
+
   g_cachedCodecList.clear();
+  g_cachedCodecsByFormat.clear();
+  g_cachedCodecsByName.clear();
 
   for (CodecType type : {CodecType::Decoder, CodecType::Encoder})
   {
@@ -202,7 +387,7 @@ void Codecs::updateCachedCodecList()
       codec.driver = list[i].name;
       codec.external = list[i].external;
       if (!codec.isSystemCodec())
-        g_cachedCodecList.append(codec);
+        addCachedCodec(codec);
     }
   }
 
@@ -210,17 +395,52 @@ void Codecs::updateCachedCodecList()
   // on the CodecManifest.h list (system codecs, or when compiled  without
   // codec loading).
 
-  QList<CodecDriver> installed = PlayerComponent::Get().installedCodecDrivers();
+  QList<CodecDriver> installed = PlayerComponent::Get().mpvCodecDrivers();
 
-  // Surely O(n^2) won't be causing trouble, right?
   for (const CodecDriver& installedCodec : installed)
   {
-    int index = indexOfCodecInList(g_cachedCodecList, installedCodec);
+    int index = indexOfCachedCodec(installedCodec);
     if (index >= 0)
       g_cachedCodecList[index].present = true;
     else
-      g_cachedCodecList.append(installedCodec);
+      addCachedCodec(installedCodec);
+  }
+
+  // This runs for every file that is played, but the result rarely changes.
+  bool changed = oldList.size() != g_cachedCodecList.size();
+  for (int i = 0; !changed && i < oldList.size(); i++)
+  {
+    const CodecDriver& a = oldList[i];
+    const CodecDriver& b = g_cachedCodecList[i];
+    changed = !sameCodec(a, b) || a.present != b.present || a.external != b.external;
   }
+  if (changed)
+  {
+    g_cachedCodecListGeneration++;
+    saveCachedCodecList();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QSize Codecs::probedMaxResolution(const QString& decoder, bool* probed)
+{
+  QMutexLocker lock(&g_probedMaxResolutionsLock);
+  auto it = g_probedMaxResolutions.find(decoder);
+  if (probed)
+    *probed = it != g_probedMaxResolutions.end();
+  return it != g_probedMaxResolutions.end() ? *it : QSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QSize Codecs::hardwareDecodeMaxResolution(const QString& format, bool* probed)
+{
+  return probedMaxResolution("hwdec:" + format, probed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Codecs::cachedCodecListGeneration()
+{
+  return g_cachedCodecListGeneration;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -229,10 +449,26 @@ const QList<CodecDriver>& Codecs::getCachedCodecList()
   return g_cachedCodecList;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const CodecDriver* Codecs::findCachedCodec(const CodecDriver& codec)
+{
+  int index = indexOfCachedCodec(codec);
+  return index >= 0 ? &g_cachedCodecList[index] : nullptr;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QList<CodecDriver> Codecs::findCodecsByFormat(const QList<CodecDriver>& list, CodecType type, const QString& format)
 {
   QList<CodecDriver> result;
+
+  // The cached list is indexed, so don't scan it.
+  if (&list == &g_cachedCodecList)
+  {
+    for (int index : g_cachedCodecsByFormat.value(qMakePair((int)type, format)))
+      result.append(g_cachedCodecList[index]);
+    return result;
+  }
+
   for (const CodecDriver& codec : list)
   {
     if (codec.type == type && codec.format == format)
@@ -302,9 +538,13 @@ bool CodecDriver::isWhitelistedSystemAudioCodec() const
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool CodecDriver::isWhitelistedSystemVideoCodec() const
 {
-  if (type == CodecType::Decoder)
-    return g_systemVideoDecoderWhitelist.contains(driver);
-  return false;
+  if (type != CodecType::Decoder || !g_systemVideoDecoderWhitelist.contains(driver))
+    return false;
+
+  // A decoder that couldn't decode any of the test clips is no use.
+  bool probed = false;
+  QSize maxResolution = Codecs::probedMaxResolution(driver, &probed);
+  return !probed || !maxResolution.isEmpty();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -361,9 +601,13 @@ static QString findOldDeviceID()
 // Returns "" on error.
 static QString loadDeviceID()
 {
+  QString id = codecState("deviceID").toString();
+  if (id.size() >= 32 && id.size() <= 512)
+    return id;
+
   QString deviceIDFilename = QDir(codecsRootPath()).absoluteFilePath(".device-id");
 
-  QString id = loadDeviceID(deviceIDFilename);
+  id = loadDeviceID(deviceIDFilename);
   if (id.isEmpty())
   {
     id = findOldDeviceID();
@@ -384,6 +628,10 @@ static QString loadDeviceID()
     id = loadDeviceID(deviceIDFilename);
   }
 
+  // The .device-id file is still written for older versions and other Plex products.
+  if (!id.isEmpty())
+    setCodecState("deviceID", id);
+
   return id;
 }
 
@@ -411,6 +659,7 @@ void Codecs::preinitCodecs()
 {
   // Extract the CI codecs version we set with --extra-version when compiling FFmpeg.
   QString ffmpegVersion = getFFmpegVersion();
+  g_ffmpegVersion = ffmpegVersion;
   int sep = ffmpegVersion.indexOf(',');
   if (sep >= 0)
     g_codecVersion = ffmpegVersion.mid(sep + 1);
@@ -432,42 +681,127 @@ void Codecs::preinitCodecs()
 
   setEnv("EAE_ROOT", g_eaeWatchFolder);
 
+  loadCodecState();
   g_deviceID = loadDeviceID();
 }
 
-#if 0
+// Give up on a probe if mpv hasn't finished decoding the test clip after this.
+#define PROBE_TIMEOUT_MSEC 10000
+
+#ifdef HAVE_MPV_STREAM_CB
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// "qrc://" stream protocol for mpv, which reads directly from the memory of an
+// embedded QResource. The test clips are stored uncompressed for this.
+struct ResourceStream
+{
+  AssetView asset;
+  int64_t pos;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static bool probeDecoder(QString decoder, QString resourceName)
+static int64_t resourceStreamRead(void* cookie, char* buf, uint64_t nbytes)
+{
+  auto stream = (ResourceStream *)cookie;
+  int64_t left = stream->asset.size() - stream->pos;
+  int64_t count = qMin((int64_t)nbytes, left);
+  memcpy(buf, stream->asset.data() + stream->pos, count);
+  stream->pos += count;
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int64_t resourceStreamSeek(void* cookie, int64_t offset)
+{
+  auto stream = (ResourceStream *)cookie;
+  if (offset < 0 || offset > stream->asset.size())
+    return MPV_ERROR_GENERIC;
+  stream->pos = offset;
+  return offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int64_t resourceStreamSize(void* cookie)
+{
+  return ((ResourceStream *)cookie)->asset.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void resourceStreamClose(void* cookie)
+{
+  delete (ResourceStream *)cookie;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int resourceStreamOpen(void* userdata, char* uri, mpv_stream_cb_info* info)
+{
+  Q_UNUSED(userdata);
+
+  // "qrc://testmedia/x" -> ":/testmedia/x"
+  AssetView asset = AssetView::open(":/" + QString::fromUtf8(uri).mid(strlen("qrc://")));
+  if (!asset.isValid())
+    return MPV_ERROR_LOADING_FAILED;
+
+  auto stream = new ResourceStream;
+  stream->asset = asset;
+  stream->pos = 0;
+
+  info->cookie = stream;
+  info->read_fn = resourceStreamRead;
+  info->seek_fn = resourceStreamSeek;
+  info->size_fn = resourceStreamSize;
+  info->close_fn = resourceStreamClose;
+  return 0;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// If hwdec is set, decoding must also have used hardware decoding to succeed.
+static bool probeDecoder(UtilityMpv::Session& session, QString decoder, QString hwdec, QString resourceName)
 {
   QResource resource(resourceName);
 
   QLOG_DEBUG() << "Testing decoding of" << resource.fileName();
 
-  if (!resource.isValid())
-    return false;
-
-  auto mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
-  if (!mpv || mpv_initialize(mpv) < 0)
+  mpv_handle* mpv = session.handle();
+  if (!resource.isValid() || !mpv)
     return false;
 
-  // Disable any output.
-  mpv::qt::set_property(mpv, "vo", "null");
-
   // Force the decoder. The ",-" means that if the first entry fails, the next codec in the global
   // codec list will not be tried, and decoding fails.
-  mpv::qt::set_property(mpv, "vd", "lavc:" + decoder + ",-");
+  session.setProperty("vd", "lavc:" + decoder + ",-");
+
+  // Copy back, since there's nothing that could display the frames.
+  if (!hwdec.isEmpty())
+    session.setProperty("hwdec", hwdec);
 
   // Attempt decoding, and return success.
-  auto data = QByteArray::fromRawData((const char *)resource.data(), resource.size());
-  if (resource.isCompressed())
-    data = qUncompress(data);
-  auto hex = data.toHex();
+#ifdef HAVE_MPV_STREAM_CB
+  // Let mpv read the resource in place instead of passing it through the URL. An instance
+  // that ran a probe before has it already, then this fails and that's fine.
+  mpv_stream_cb_add_ro(mpv, "qrc", nullptr, resourceStreamOpen);
+  mpv::qt::command(mpv, QVariantList{"loadfile", "qrc://" + resourceName.mid(2)});
+#else
+  auto hex = AssetView::open(resourceName).bytes().toHex();
   mpv::qt::command(mpv, QVariantList{"loadfile", "hex://" + QString::fromLatin1(hex)});
+#endif
   bool result = false;
+  QString hwdecUsed;
+  QElapsedTimer timer;
+  timer.start();
   while (1) {
-    mpv_event *event = mpv_wait_event(mpv, 0);
+    qint64 remaining = PROBE_TIMEOUT_MSEC - timer.elapsed();
+    if (remaining <= 0)
+    {
+      QLOG_WARN() << "Probing" << decoder << "timed out";
+      break;
+    }
+    // Block until something happens instead of spinning on the event queue.
+    mpv_event *event = mpv_wait_event(mpv, remaining / 1000.0);
     if (event->event_id == MPV_EVENT_SHUTDOWN)
       break;
+    // The decoder is set up once the first frame is out.
+    if (event->event_id == MPV_EVENT_VIDEO_RECONFIG && !hwdec.isEmpty())
+      hwdecUsed = mpv::qt::get_property(mpv, "hwdec-current").toString();
     if (event->event_id == MPV_EVENT_END_FILE)
     {
       mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
@@ -476,31 +810,181 @@ static bool probeDecoder(QString decoder, QString resourceName)
     }
   }
 
+  if (!hwdec.isEmpty() && (hwdecUsed.isEmpty() || hwdecUsed == "no"))
+    result = false;
+
   QLOG_DEBUG() << "Result:" << result;
 
   return result;
 }
-#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static void probeCodecs()
+struct DecoderProbe
+{
+  QString decoder;
+  QString hwdec;
+  QString resourceName;
+  QSize resolution;
+  bool result;
+
+  QString cacheKey() const { return decoder + "|" + hwdec + "|" + resourceName; }
+  // key into g_probedMaxResolutions
+  QString ceilingKey() const { return hwdec.isEmpty() ? decoder : "hwdec:" + decoder; }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Probe results are kept across launches: every probe needs a full mpv instance
+// and decodes a clip. They're only valid for the same FFmpeg build and set of
+// codecs, so the cache is thrown away as soon as either changes.
+static QString probeCacheVersion()
+{
+  return g_ffmpegVersion + "|" + g_codecVersion;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QVariantMap loadProbeCache()
+{
+  QVariantMap cache = codecState("probes").toMap();
+  if (cache["version"].toString() != probeCacheVersion())
+    return QVariantMap();
+
+  return cache["results"].toMap();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void saveProbeCache(const QVariantMap& results)
 {
-#if 0
-  if (useSystemVideoDecoders())
+  QVariantMap cache;
+  cache["version"] = probeCacheVersion();
+  cache["results"] = results;
+  setCodecState("probes", cache);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Run all probes that aren't cached yet on the utility mpv instances, and fill in the
+// result fields.
+static void probeDecoders(QList<DecoderProbe>& probes)
+{
+  QVariantMap cache = loadProbeCache();
+  QList<UtilityMpv::Job> jobs;
+
+  for (DecoderProbe& probe : probes)
   {
-    if (probeDecoder("h264_mf", ":/testmedia/high_4096x2304.h264"))
-      g_mediaFoundationH264MaxResolution = QSize(4096, 2304);
-    else if (probeDecoder("h264_mf", ":/testmedia/high_4096x2160.h264"))
-      g_mediaFoundationH264MaxResolution = QSize(4096, 2160);
-    else if (probeDecoder("h264_mf", ":/testmedia/high_4096x1080.h264"))
-      g_mediaFoundationH264MaxResolution = QSize(4096, 1080);
-    else
-      g_systemVideoDecoderWhitelist.remove("h264_mf");
+    QVariant cached = cache.value(probe.cacheKey());
+    if (cached.isValid())
+    {
+      probe.result = cached.toBool();
+      QLOG_DEBUG() << "Cached probe result for" << probe.decoder << probe.resourceName << ":" << probe.result;
+      continue;
+    }
 
-    QLOG_DEBUG() << "h264_mf max. resolution:" << g_mediaFoundationH264MaxResolution;
+    DecoderProbe* pending = &probe;
+    jobs << [pending](UtilityMpv::Session& session)
+    {
+      pending->result = probeDecoder(session, pending->decoder, pending->hwdec, pending->resourceName);
+    };
   }
+
+  if (jobs.isEmpty())
+    return;
+
+  UtilityMpv::Get().run(jobs);
+
+  for (const DecoderProbe& probe : probes)
+    cache[probe.cacheKey()] = probe.result;
+  saveProbeCache(cache);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The test clips, from the largest resolution down for each decoder. Clips that
+// are not in resources/testmedia are skipped, so the matrix can be extended by
+// adding them (see the README there). The FFmpeg decoders are probed with
+// hardware decoding, which is what the ceiling matters for: the h264 rows limit
+// h264_mf, the hevc and vp9 ones the capabilities (see SystemComponent). A format
+// gets rows once something reads its limit.
+struct ProbeClip
+{
+  const char* decoder;
+  const char* resourceName;
+  int width, height;
+};
+
+static const ProbeClip g_probeMatrix[] =
+{
+  { "h264", ":/testmedia/high_4096x2304.h264", 4096, 2304 },
+  { "h264", ":/testmedia/high_4096x2160.h264", 4096, 2160 },
+  { "h264", ":/testmedia/high_1920x1080.h264", 1920, 1080 },
+  { "hevc", ":/testmedia/main10_3840x2160.hevc", 3840, 2160 },
+  { "hevc", ":/testmedia/main10_1920x1080.hevc", 1920, 1080 },
+  { "vp9", ":/testmedia/profile2_3840x2160.ivf", 3840, 2160 },
+  { "vp9", ":/testmedia/profile2_1920x1080.ivf", 1920, 1080 },
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class CapabilityProbeJob : public QRunnable
+{
+public:
+  explicit CapabilityProbeJob(const QList<DecoderProbe>& probes) : m_probes(probes) { }
+
+  void run() override
+  {
+    probeDecoders(m_probes);
+
+    QHash<QString, QSize> maxResolutions;
+    for (const DecoderProbe& probe : m_probes)
+    {
+      QSize& max = maxResolutions[probe.ceilingKey()];
+      if (probe.result && probe.resolution.width() * probe.resolution.height() > max.width() * max.height())
+        max = probe.resolution;
+    }
+
+    for (auto it = maxResolutions.begin(); it != maxResolutions.end(); ++it)
+      QLOG_INFO() << "Decoder" << it.key() << "max. resolution:" << it.value();
+
+    {
+      QMutexLocker lock(&g_probedMaxResolutionsLock);
+      g_probedMaxResolutions = maxResolutions;
+    }
+
+    // The capabilities advertise the hardware limits.
+    QMetaObject::invokeMethod(&SystemComponent::Get(), "codecsProbed", Qt::QueuedConnection);
+  }
+
+private:
+  QList<DecoderProbe> m_probes;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void probeCodecs()
+{
+  QList<DecoderProbe> probes;
+  for (const ProbeClip& clip : g_probeMatrix)
+  {
+    if (!QResource(clip.resourceName).isValid())
+      continue;
+
+    QSize resolution(clip.width, clip.height);
+#ifndef TARGET_RPI
+    // The Pi's decoders are separate (mmal), and it can't afford extra instances.
+    probes.append({ clip.decoder, "auto-copy", clip.resourceName, resolution, false });
 #endif
 
+    // Also find the limits of the OS decoders for this format.
+    if (useSystemVideoDecoders())
+    {
+      for (const CodecDriver& codec : Codecs::findCodecsByFormat(g_cachedCodecList, CodecType::Decoder, clip.decoder))
+      {
+        if (codec.present && codec.isSystemCodec() && codec.getSystemCodecType() == "mf")
+          probes.append({ codec.driver, "", clip.resourceName, resolution, false });
+      }
+    }
+  }
+
+  // Each probe decodes a clip in its own mpv instance, which would hold up startup.
+  // Results are cached, so this is only slow the first time for an FFmpeg build.
+  if (!probes.isEmpty())
+    QThreadPool::globalInstance()->start(new CapabilityProbeJob(probes));
+
 #ifdef Q_OS_MAC
   // Unsupported, but avoid picking up broken Perian decoders.
   if (QSysInfo::MacintoshVersion <= QSysInfo::MV_10_10)
@@ -512,7 +996,9 @@ static void probeCodecs()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static void updateCodecs()
+// Looks for codecs we or other Plex products installed for any codec version, so the same
+// ones can be installed for ours. The EasyAudioEncoder prefix is used by PMS as well.
+static void scanCodecDirectories(QStringList& codecFiles, bool& eaeFound)
 {
   QStringList candidates = {
     codecsRootPath(),
@@ -526,8 +1012,8 @@ static void updateCodecs()
     Paths::dataDir() + "/codecs/",
   };
 
-  QSet<QString> codecFiles;
-  bool needEAE = false;
+  QSet<QString> files;
+  eaeFound = false;
 
   for (auto dir : candidates)
   {
@@ -542,14 +1028,36 @@ static void updateCodecs()
         continue;
 
       for (auto codecdirEntry : entryDir.entryList(QDir::Files))
-        codecFiles.insert(codecdirEntry);
+        files.insert(codecdirEntry);
 
-      // NOTE: PMS also uses this prefix
-      if (entry.startsWith("EasyAudioEncoder-") && !eaeIsPresent())
-        needEAE = true;
+      if (entry.startsWith("EasyAudioEncoder-"))
+        eaeFound = true;
     }
   }
 
+  codecFiles = files.toList();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void updateCodecs()
+{
+  QStringList codecFiles;
+  bool eaeFound;
+
+  // Only the first start has to scan, after that the maintenance job keeps this current.
+  if (codecState("codecFiles").isValid())
+  {
+    codecFiles = codecState("codecFiles").toStringList();
+    eaeFound = codecState("eaeFound").toBool();
+  }
+  else
+  {
+    scanCodecDirectories(codecFiles, eaeFound);
+    setCodecState("codecFiles", codecFiles);
+    setCodecState("eaeFound", eaeFound);
+  }
+
+  bool needEAE = eaeFound && !eaeIsPresent();
   QList<CodecDriver> install;
 
   for (CodecDriver& codec : g_cachedCodecList)
@@ -617,6 +1125,27 @@ static void deleteOldCodecs()
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The directory walks that used to hold up startup: refreshes the codec files in the codec
+// state and deletes codecs for other versions.
+class CodecMaintenanceJob : public QRunnable
+{
+public:
+  void run() override
+  {
+    QStringList codecFiles;
+    bool eaeFound;
+    scanCodecDirectories(codecFiles, eaeFound);
+    setCodecState("codecFiles", codecFiles);
+    setCodecState("eaeFound", eaeFound);
+
+    deleteOldCodecs();
+
+    // the probe results moved into the codec state
+    QFile::remove(QDir(codecsRootPath()).absoluteFilePath(".probe-cache"));
+  }
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Codecs::initCodecs()
 {
@@ -626,11 +1155,33 @@ void Codecs::initCodecs()
   if (g_eaeWatchFolder.isEmpty())
     throw FatalException("Could not create EAE working directory.");
 
-  Codecs::updateCachedCodecList();
+  // Asking mpv for its decoders and filtering them takes a while, with the list from the
+  // last start that is done once the UI is up. Until then the saved list is used.
+  bool cached = loadCachedCodecList();
+  if (!cached)
+    Codecs::updateCachedCodecList();
 
   updateCodecs();
-  deleteOldCodecs();
   probeCodecs();
+
+  if (cached)
+  {
+    QTimer::singleShot(CODEC_LIST_REBUILD_DELAY_MSEC, []()
+    {
+      int generation = g_cachedCodecListGeneration;
+      Codecs::updateCachedCodecList();
+      if (generation != g_cachedCodecListGeneration)
+      {
+        QLOG_INFO() << "The codec list changed since the last start";
+        updateCodecs();
+      }
+    });
+  }
+
+  QTimer::singleShot(CODEC_MAINTENANCE_DELAY_MSEC, []()
+  {
+    QThreadPool::globalInstance()->start(new CodecMaintenanceJob());
+  });
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -660,17 +1211,83 @@ bool CodecsFetcher::codecNeedsDownload(const CodecDriver& codec)
   return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+CodecsFetcher::~CodecsFetcher()
+{
+  // whoever waits for these must not wait forever
+  foreach (const QString& name, g_codecDownloads.keys(this))
+    releaseDownload(name);
+
+#ifdef HAVE_MINIZIP
+  delete m_eaeExtractor;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool CodecsFetcher::claimDownload(const QString& name, bool wait)
+{
+  CodecsFetcher* owner = g_codecDownloads.value(name);
+  if (owner == this)
+    return false;
+
+  if (owner)
+  {
+    // Two downloads of the same file would write the same .part file.
+    if (wait)
+    {
+      QLOG_INFO() << name << "is already being downloaded, waiting for it.";
+      m_waitingFor.insert(name);
+      connect(owner, &CodecsFetcher::downloadReleased, this, &CodecsFetcher::otherDownloadDone, Qt::UniqueConnection);
+    }
+    return false;
+  }
+
+  g_codecDownloads[name] = this;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::releaseDownload(const QString& name)
+{
+  if (g_codecDownloads.value(name) != this)
+    return;
+
+  g_codecDownloads.remove(name);
+  emit downloadReleased(name);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::setPaused(bool paused)
+{
+  if (paused == m_paused)
+    return;
+
+  m_paused = paused;
+  if (!m_paused)
+    startNext();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CodecsFetcher::otherDownloadDone(const QString& name)
+{
+  if (!m_waitingFor.remove(name))
+    return;
+
+  startNext();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void CodecsFetcher::installCodecs(const QList<CodecDriver>& codecs)
 {
   foreach (CodecDriver codec, codecs)
   {
-    if (codecNeedsDownload(codec))
+    // background downloads are claimed once they start, see startNext()
+    if (codecNeedsDownload(codec) && (background || claimDownload(codec.getMangledName())))
       m_Codecs.enqueue(codec);
     if (codec.getSystemCodecType() == "eae")
     {
       m_eaeNeeded = true;
-      if (!eaeIsPresent())
+      if (!eaeIsPresent() && !m_fetchEAE && (background || claimDownload("eae")))
         m_fetchEAE = true;
     }
   }
@@ -705,36 +1322,59 @@ static QUrl buildCodecQuery(QString version, QString name, QString build)
   return url;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Identifies a download job; context is what's passed as Downloader userData.
+static QString downloadName(const QVariant& context)
+{
+  if (context == QVariant("eae"))
+    return "eae";
+  return context.value<CodecDriver>().getMangledName();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void CodecsFetcher::startNext()
 {
-  if (m_fetchEAE)
+  int maxDownloads = background ? 1 : MAX_PARALLEL_DOWNLOADS;
+  while (m_activeDownloads < maxDownloads && !m_paused)
   {
-    m_fetchEAE = false;
+    if (m_fetchEAE)
+    {
+      m_fetchEAE = false;
+      if (background && (eaeIsPresent() || !claimDownload("eae", false)))
+        continue;
+
+      QUrl url = buildCodecQuery(STRINGIFY(EAE_VERSION), "easyaudioencoder", getEAEBuildType());
 
-    QUrl url = buildCodecQuery(STRINGIFY(EAE_VERSION), "easyaudioencoder", getEAEBuildType());
+      Downloader *downloader = new Downloader(QVariant("eae"), url, getPlexHeaders(), this);
+      connect(downloader, &Downloader::done, this, &CodecsFetcher::codecInfoDownloadDone);
+      m_activeDownloads++;
+      continue;
+    }
+
+    if (m_Codecs.isEmpty())
+      break;
+
+    CodecDriver codec = m_Codecs.dequeue();
+    // it might have been installed by another fetcher since it was queued
+    const CodecDriver* current = Codecs::findCachedCodec(codec);
+    if (background && ((current && current->present) || !claimDownload(codec.getMangledName(), false)))
+      continue;
 
-    Downloader *downloader = new Downloader(QVariant("eae"), url, getPlexHeaders(), this);
+    QUrl url = buildCodecQuery(g_codecVersion, codec.getMangledName(), getBuildType());
+
+    Downloader *downloader = new Downloader(QVariant::fromValue(codec), url, getPlexHeaders(), this);
     connect(downloader, &Downloader::done, this, &CodecsFetcher::codecInfoDownloadDone);
-    return;
+    m_activeDownloads++;
   }
 
-  if (m_Codecs.isEmpty())
+  if (m_activeDownloads == 0 && m_waitingFor.isEmpty() && m_Codecs.isEmpty() && !m_fetchEAE)
   {
     // Do final initializations.
     if (m_eaeNeeded && startCodecs)
-      startEAE();
+      Codecs::startEAE();
 
     emit done(this);
-    return;
   }
-
-  CodecDriver codec = m_Codecs.dequeue();
-
-  QUrl url = buildCodecQuery(g_codecVersion, codec.getMangledName(), getBuildType());
-
-  Downloader *downloader = new Downloader(QVariant::fromValue(codec), url, getPlexHeaders(), this);
-  connect(downloader, &Downloader::done, this, &CodecsFetcher::codecInfoDownloadDone);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -771,16 +1411,36 @@ bool CodecsFetcher::processCodecInfoReply(const QVariant& context, const QByteAr
   }
 
   QString hash = attrs.namedItem("fileSha").toAttr().value();
-  m_currentHash = QByteArray::fromHex(hash.toUtf8());
+  QByteArray expectedHash = QByteArray::fromHex(hash.toUtf8());
   // it's hardcoded to SHA-1
-  if (!m_currentHash.size()) {
+  if (!expectedHash.size()) {
     QLOG_ERROR() << "Hash value in unexpected format or missing:" << hash;
     return false;
   }
+  m_expectedHashes[downloadName(context)] = expectedHash;
 
-  Downloader *downloader = new Downloader(context, url, getPlexHeaders(), this);
+  QString destination;
+  if (context == QVariant("eae"))
+    destination = eaePrefixPath() + ".zip";
+  else
+    destination = context.value<CodecDriver>().getPath();
+
+  Downloader *downloader = new Downloader(context, url, getPlexHeaders(), this, destination);
   connect(downloader, &Downloader::done, this, &CodecsFetcher::codecDownloadDone);
 
+#ifdef HAVE_MINIZIP
+  if (context == QVariant("eae"))
+  {
+    QDir(eaePrefixPath()).removeRecursively();
+    delete m_eaeExtractor;
+    m_eaeExtractor = new ZipStreamExtractor(eaePrefixPath());
+    connect(downloader, &Downloader::dataReceived, [=](const QByteArray& chunk, qint64 offset)
+    {
+      m_eaeExtractor->feed(chunk, offset);
+    });
+  }
+#endif
+
   return true;
 }
 
@@ -790,6 +1450,8 @@ void CodecsFetcher::codecInfoDownloadDone(QVariant userData, bool success, const
   if (!success || !processCodecInfoReply(userData, data))
   {
     QLOG_ERROR() << "Codec download failed.";
+    releaseDownload(downloadName(userData));
+    m_activeDownloads--;
     startNext();
   }
 }
@@ -993,29 +1655,52 @@ static bool extractZip(QString zip, QString dest)
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByteArray& data)
+void CodecsFetcher::processCodecDownloadDone(const QVariant& context, Downloader* downloader)
 {
-  QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+  QByteArray hash = downloader->sha1();
+  QByteArray expectedHash = m_expectedHashes.take(downloadName(context));
+  QString partFile = downloader->partFilePath();
 
-  if (hash != m_currentHash)
+  if (hash != expectedHash)
   {
-    QLOG_ERROR() << "Checksum mismatch: got" << hash.toHex() << "expected" << m_currentHash.toHex();
+    QLOG_ERROR() << "Checksum mismatch: got" << hash.toHex() << "expected" << expectedHash.toHex();
+    // Don't try to resume from broken data next time.
+    QFile::remove(partFile);
+    if (context == QVariant("eae"))
+      QDir(eaePrefixPath()).removeRecursively();
     return;
   }
 
   if (context == QVariant("eae"))
   {
+    bool extracted = false;
+#ifdef HAVE_MINIZIP
+    extracted = m_eaeExtractor && m_eaeExtractor->finish();
+    delete m_eaeExtractor;
+    m_eaeExtractor = nullptr;
+#endif
+
+    if (extracted)
+    {
+      QLOG_INFO() << "EAE was extracted to" << eaePrefixPath() << "while downloading";
+      QFile::remove(partFile);
+      QLOG_INFO() << "Codec download and installation succeeded.";
+      return;
+    }
+
     QString dest = eaePrefixPath() + ".zip";
 
     QLOG_INFO() << "Storing EAE as" << dest;
 
-    if (!Utils::safelyWriteFile(dest, data))
+    QFile::remove(dest);
+    if (!QFile::rename(partFile, dest))
     {
       QLOG_ERROR() << "Writing codec file failed.";
       return;
     }
 
-    QDir dir(dest);
+    // Get rid of anything a failed streaming extraction left behind.
+    QDir dir(eaePrefixPath());
     dir.removeRecursively();
 
     if (!extractZip(dest, eaePrefixPath()))
@@ -1033,7 +1718,8 @@ void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByt
 
     QLOG_INFO() << "Storing codec as" << codec.getPath();
 
-    if (!Utils::safelyWriteFile(codec.getPath(), data))
+    QFile::remove(codec.getPath());
+    if (!QFile::rename(partFile, codec.getPath()))
     {
       QLOG_ERROR() << "Writing codec file failed.";
       return;
@@ -1041,14 +1727,16 @@ void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByt
 
     // This causes libmpv and eventually libavcodec to rescan and load new codecs.
     Codecs::updateCachedCodecList();
-    for (const CodecDriver& item : Codecs::getCachedCodecList())
+    const CodecDriver* item = Codecs::findCachedCodec(codec);
+    if (item && !item->present)
     {
-      if (Codecs::sameCodec(item, codec) && !item.present)
-      {
-        QLOG_ERROR() << "Codec could not be loaded after installing it.";
-        return;
-      }
+      QLOG_ERROR() << "Codec could not be loaded after installing it.";
+      return;
     }
+
+    QStringList codecFiles = codecState("codecFiles").toStringList();
+    if (!codecFiles.contains(codec.getFileName()))
+      setCodecState("codecFiles", codecFiles << codec.getFileName());
   }
 
   QLOG_INFO() << "Codec download and installation succeeded.";
@@ -1057,44 +1745,105 @@ void CodecsFetcher::processCodecDownloadDone(const QVariant& context, const QByt
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void CodecsFetcher::codecDownloadDone(QVariant userData, bool success, const QByteArray& data)
 {
+  Q_UNUSED(data);
+
   QLOG_INFO() << "Codec request finished.";
-  if (success)
+  Downloader* downloader = qobject_cast<Downloader*>(sender());
+  if (success && downloader)
   {
-    processCodecDownloadDone(userData, data);
+    processCodecDownloadDone(userData, downloader);
   }
   else
   {
     QLOG_ERROR() << "Codec download HTTP request failed.";
+    m_expectedHashes.remove(downloadName(userData));
+#ifdef HAVE_MINIZIP
+    if (userData == QVariant("eae"))
+    {
+      delete m_eaeExtractor;
+      m_eaeExtractor = nullptr;
+    }
+#endif
   }
+  if (downloader)
+    downloader->deleteLater();
+  releaseDownload(downloadName(userData));
+  m_activeDownloads--;
   startNext();
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void CodecsFetcher::startEAE()
+static void stopEAE()
+{
+  if (!g_eaeProcess || g_eaeProcess->state() == QProcess::NotRunning)
+    return;
+
+  QLOG_INFO() << "Stopping EAE, it wasn't used for" << EAE_IDLE_TIMEOUT_MSEC / 1000 << "seconds.";
+
+  // so the next start doesn't take this for a crash
+  g_eaeProcess->setProgram(QString());
+  g_eaeProcess->terminate();
+  g_eaeStopping = true;
+
+  QProcess* process = g_eaeProcess;
+  QTimer::singleShot(EAE_KILL_TIMEOUT_MSEC, process, [=]()
+  {
+    // after a restart this would be the new process
+    if (g_eaeStopping && process->state() != QProcess::NotRunning)
+      process->kill();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Codecs::startEAE()
 {
   if (!g_eaeProcess)
   {
     g_eaeProcess = new QProcess();
     g_eaeProcess->setProcessChannelMode(QProcess::ForwardedChannels);
-    connect(g_eaeProcess, &QProcess::stateChanged,
+    QObject::connect(g_eaeProcess, &QProcess::stateChanged,
       [](QProcess::ProcessState s)
       {
         QLOG_INFO() << "EAE process state:" << s;
       }
     );
-    connect(g_eaeProcess, &QProcess::errorOccurred,
+    QObject::connect(g_eaeProcess, &QProcess::errorOccurred,
       [](QProcess::ProcessError e)
       {
         QLOG_INFO() << "EAE process error:" << e;
       }
     );
-    connect(g_eaeProcess, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+    QObject::connect(g_eaeProcess, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
       [](int exitCode, QProcess::ExitStatus exitStatus)
       {
         QLOG_INFO() << "EAE process finished:" << exitCode << exitStatus;
+        g_eaeStopping = false;
+        if (g_eaeRestartPending)
+        {
+          g_eaeRestartPending = false;
+          startEAE();
+        }
       }
     );
+
+    g_eaeIdleTimer = new QTimer(g_eaeProcess);
+    g_eaeIdleTimer->setSingleShot(true);
+    g_eaeIdleTimer->setInterval(EAE_IDLE_TIMEOUT_MSEC);
+    QObject::connect(g_eaeIdleTimer, &QTimer::timeout, &stopEAE);
+  }
+
+  // it's needed again
+  g_eaeIdleTimer->stop();
+
+  // A second EAE on the same watch folder would fight the old one over the files, so this
+  // waits for the old one to exit (EAE_KILL_TIMEOUT_MSEC at most).
+  if (g_eaeStopping)
+  {
+    if (!g_eaeRestartPending)
+      QLOG_INFO() << "EAE is still stopping, starting it again once it exited.";
+    g_eaeRestartPending = true;
+    return;
   }
 
   if (g_eaeProcess->state() == QProcess::NotRunning)
@@ -1110,24 +1859,31 @@ void CodecsFetcher::startEAE()
     g_eaeProcess->setProgram(eaeBinaryPath());
     g_eaeProcess->setWorkingDirectory(g_eaeWatchFolder);
 
-    QDir dir(g_eaeWatchFolder);
-    dir.removeRecursively();
-    dir.mkpath(".");
-
-    static const QStringList watchfolder_names =
+    // the layout is created once, EAE finds it in place when it's started again
+    static bool watchFolderReady = false;
+    if (!watchFolderReady)
     {
-      "Convert to WAV (to 2ch or less)",
-      "Convert to WAV (to 8ch or less)",
-      "Convert to Dolby Digital (Low Quality - 384 kbps)",
-      "Convert to Dolby Digital (High Quality - 640 kbps)",
-      "Convert to Dolby Digital Plus (High Quality - 384 kbps)",
-      "Convert to Dolby Digital Plus (Max Quality - 1024 kbps)",
-    };
-    for (auto folder : watchfolder_names)
-    {
-      if (!dir.mkpath(folder))
+      QDir dir(g_eaeWatchFolder);
+      dir.removeRecursively();
+      dir.mkpath(".");
+
+      static const QStringList watchfolder_names =
       {
-        QLOG_ERROR() << "Could not create watch folder";
+        "Convert to WAV (to 2ch or less)",
+        "Convert to WAV (to 8ch or less)",
+        "Convert to Dolby Digital (Low Quality - 384 kbps)",
+        "Convert to Dolby Digital (High Quality - 640 kbps)",
+        "Convert to Dolby Digital Plus (High Quality - 384 kbps)",
+        "Convert to Dolby Digital Plus (Max Quality - 1024 kbps)",
+      };
+      watchFolderReady = true;
+      for (auto folder : watchfolder_names)
+      {
+        if (!dir.mkpath(folder))
+        {
+          QLOG_ERROR() << "Could not create watch folder";
+          watchFolderReady = false;
+        }
       }
     }
 
@@ -1136,29 +1892,145 @@ void CodecsFetcher::startEAE()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Downloader::Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent)
-  : QObject(parent), m_userData(userData), m_lastProgress(-1)
+void Codecs::prewarmEAE()
+{
+  if (!HAVE_EAE || !eaeIsPresent())
+    return;
+
+  if (!g_eaeProcess || g_eaeProcess->state() == QProcess::NotRunning || g_eaeStopping)
+    QLOG_INFO() << "Starting EAE ahead of playback.";
+  startEAE();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Codecs::releaseEAE()
+{
+  if (g_eaeProcess && g_eaeProcess->state() != QProcess::NotRunning && !g_eaeStopping)
+    g_eaeIdleTimer->start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Downloader::Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent,
+                       const QString& destination)
+  : QObject(parent), m_userData(userData), m_lastProgress(-1), m_reply(nullptr),
+    m_hash(QCryptographicHash::Sha1), m_resumeOffset(0), m_rangeChecked(false), m_writeError(false)
 {
   QLOG_INFO() << "HTTP request:" << url.toDisplayString();
   m_currentStartTime.start();
 
-  connect(&m_WebCtrl, &QNetworkAccessManager::finished, this, &Downloader::networkFinished);
-
   QNetworkRequest request(url);
   for (int n = 0; n < headers.size(); n++)
     request.setRawHeader(headers[n].first.toUtf8(), headers[n].second.toUtf8());
-  QNetworkReply *reply = m_WebCtrl.get(request);
-  if (reply)
+
+  if (destination.size())
   {
-    connect(reply, &QNetworkReply::downloadProgress, this, &Downloader::downloadProgress);
+    // ReadWrite doesn't truncate, so whatever an earlier attempt left behind is kept.
+    m_file.setFileName(destination + ".part");
+    if (m_file.open(QIODevice::ReadWrite))
+    {
+      m_resumeOffset = m_file.size();
+      if (m_resumeOffset > 0)
+      {
+        // Hash what we already have; this also moves the file position to the end.
+        m_hash.addData(&m_file);
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(m_resumeOffset) + "-");
+        QLOG_INFO() << "Resuming download at byte" << m_resumeOffset;
+      }
+    }
+    else
+    {
+      QLOG_ERROR() << "Could not open" << m_file.fileName() << "for writing.";
+      m_writeError = true;
+    }
+  }
+
+  // codec information is small and cacheable, the codecs themselves are resumed downloads
+  m_reply = NetworkService::Get().get(request, destination.size() ? NetworkService::DownloadRequest : NetworkService::MetadataRequest);
+  if (m_reply)
+  {
+    connect(m_reply, &QNetworkReply::finished, this, [this]() { networkFinished(m_reply); });
+    connect(m_reply, &QNetworkReply::downloadProgress, this, &Downloader::downloadProgress);
+    if (m_file.isOpen())
+      connect(m_reply, &QNetworkReply::readyRead, this, &Downloader::readyRead);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Downloader::~Downloader()
+{
+  DownloadProgress::Get().remove(this);
+
+  // the reply belongs to the shared network manager, it would keep running without us
+  if (m_reply)
+  {
+    disconnect(m_reply, nullptr, this, nullptr);
+    m_reply->abort();
+    m_reply->deleteLater();
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Downloader::readyRead()
+{
+  if (!m_file.isOpen() || !m_reply)
+    return;
+
+  // An error page, or the 416 for a file that is complete already, isn't part of the file.
+  int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (status != 200 && status != 206)
+  {
+    m_reply->readAll();
+    return;
+  }
+
+  if (!m_rangeChecked)
+  {
+    m_rangeChecked = true;
+    if (m_resumeOffset > 0 && status != 206)
+    {
+      // The server ignored the Range header and sends the whole file.
+      QLOG_INFO() << "Server doesn't support resuming, starting over.";
+      m_file.resize(0);
+      m_file.seek(0);
+      m_hash.reset();
+      m_resumeOffset = 0;
+    }
+    else if (m_resumeOffset > 0)
+    {
+      // Let listeners catch up on what was downloaded before.
+      m_file.seek(0);
+      while (m_file.pos() < m_resumeOffset)
+      {
+        qint64 offset = m_file.pos();
+        QByteArray chunk = m_file.read(qMin((qint64)65536, m_resumeOffset - offset));
+        if (chunk.isEmpty())
+          break;
+        emit dataReceived(chunk, offset);
+      }
+      m_file.seek(m_resumeOffset);
+    }
+  }
+
+  QByteArray data = m_reply->readAll();
+  qint64 offset = m_file.pos();
+  m_hash.addData(data);
+  if (m_file.write(data) != data.size())
+    m_writeError = true;
+  else
+    emit dataReceived(data, offset);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Downloader::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
+  // codec information isn't worth reporting
+  if (m_file.fileName().size())
+    DownloadProgress::Get().update(this, bytesReceived + m_resumeOffset, bytesTotal > 0 ? bytesTotal + m_resumeOffset : 0);
+
   if (bytesTotal > 0)
   {
+    bytesReceived += m_resumeOffset;
+    bytesTotal += m_resumeOffset;
     int progress = (int)(bytesReceived * 100 / bytesTotal);
     if (m_lastProgress < 0 || progress > m_lastProgress + 10)
     {
@@ -1174,17 +2046,51 @@ void Downloader::networkFinished(QNetworkReply* pReply)
   QLOG_INFO() << "HTTP finished after" << (m_currentStartTime.elapsed() + 500) / 1000
               << "seconds for a request of" << pReply->size() << "bytes.";
 
-  if (pReply->error() == QNetworkReply::NoError)
+  if (m_file.isOpen())
+  {
+    if (pReply->error() == QNetworkReply::NoError)
+      readyRead();
+    m_file.close();
+  }
+
+  int status = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+  // The range starts at the end of the file: the earlier attempt got all of it, but didn't
+  // get to install it. Content-Range has the size, the caller checks the hash.
+  bool complete = false;
+  if (status == 416 && m_resumeOffset > 0)
   {
-    emit done(m_userData, true, pReply->readAll());
+    QByteArray range = pReply->rawHeader("Content-Range");
+    bool ok = false;
+    qint64 total = range.mid(range.lastIndexOf('/') + 1).toLongLong(&ok);
+    complete = !ok || total == m_resumeOffset;
+    if (complete)
+      QLOG_INFO() << "Download was complete already.";
+  }
+
+  if ((pReply->error() == QNetworkReply::NoError || complete) && !m_writeError)
+  {
+    if (m_file.fileName().size())
+      emit done(m_userData, true, QByteArray());
+    else
+      emit done(m_userData, true, pReply->readAll());
   }
   else
   {
-    QLOG_ERROR() << "HTTP download error:" << pReply->errorString();
+    if (m_writeError)
+      QLOG_ERROR() << "Error writing" << m_file.fileName();
+    else
+      QLOG_ERROR() << "HTTP download error:" << pReply->errorString();
+
+    // A partial file we can't resume from is useless.
+    if (m_file.fileName().size() && (m_writeError || status == 416))
+      QFile::remove(m_file.fileName());
+
     emit done(m_userData, false, QByteArray());
   }
   pReply->deleteLater();
-  m_WebCtrl.clearAccessCache(); // make sure the TCP connection is closed
+  m_reply = nullptr;
+  DownloadProgress::Get().remove(this);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1193,7 +2099,7 @@ static CodecDriver selectBestDecoder(const StreamInfo& stream)
   QList<CodecDriver> codecs = Codecs::findCodecsByFormat(Codecs::getCachedCodecList(), CodecType::Decoder, stream.codec);
   CodecDriver best = {};
   int bestScore = -1;
-  for (auto codec : codecs)
+  for (const CodecDriver& codec : codecs)
   {
     int score = -1;
 
@@ -1204,23 +2110,24 @@ static CodecDriver selectBestDecoder(const StreamInfo& stream)
       if ((codec.isWhitelistedSystemAudioCodec() && useSystemAudioDecoders()) ||
           (codec.isWhitelistedSystemVideoCodec() && useSystemVideoDecoders()))
         score = 10;
-      if (codec.format == "h264")
+      if (codec.format == QLatin1String("h264"))
       {
         // Avoid using system video decoders for h264 profiles usually not supported.
-        if (stream.profile != "" && stream.profile != "main" && stream.profile != "baseline" && stream.profile != "high")
+        if (!stream.profile.isEmpty() && stream.profile != QLatin1String("main") &&
+            stream.profile != QLatin1String("baseline") && stream.profile != QLatin1String("high"))
           score = 1;
       }
-      if (codec.driver == "h264_mf")
+      if (!stream.videoResolution.isEmpty())
       {
-        if (!stream.videoResolution.isEmpty())
-        {
-          QSize res = stream.videoResolution;
-          if (res.width() > g_mediaFoundationH264MaxResolution.width() ||
-              res.height() > g_mediaFoundationH264MaxResolution.height())
-            score = 1;
-        }
+        // Unprobed h264_mf is assumed to be unable to handle anything.
+        bool probed = false;
+        QSize max = Codecs::probedMaxResolution(codec.driver, &probed);
+        QSize res = stream.videoResolution;
+        if ((probed || codec.driver == QLatin1String("h264_mf")) &&
+            (res.width() > max.width() || res.height() > max.height()))
+          score = 1;
       }
-      if (codec.driver == "aac_mf")
+      if (codec.driver == QLatin1String("aac_mf"))
       {
         // Arbitrary but documented and enforced 6 channel limit by MS.
         if (stream.audioChannels > 6)
@@ -1229,7 +2136,7 @@ static CodecDriver selectBestDecoder(const StreamInfo& stream)
         if (stream.audioSampleRate > 0 && (stream.audioSampleRate < 8000 || stream.audioSampleRate > 48000))
           score = 1;
       }
-      if (codec.getSystemCodecType() == "eae")
+      if (codec.getSystemCodecType() == QLatin1String("eae"))
         score = HAVE_EAE ? 2 : -1;
     }
     else
@@ -1264,7 +2171,7 @@ QList<CodecDriver> Codecs::determineRequiredCodecs(const PlaybackInfo& info)
   QLOG_INFO() << "Not using on-demand codecs.";
 #endif
 
-  for (auto stream : info.streams)
+  for (const StreamInfo& stream : info.streams)
   {
     if (!stream.isVideo && !stream.isAudio)
       continue;
@@ -1274,13 +2181,6 @@ QList<CodecDriver> Codecs::determineRequiredCodecs(const PlaybackInfo& info)
       continue;
     }
 
-    // We could do this if we'd find a nice way to enable passthrough by default:
-#if 0
-    // Can passthrough be used? If so, don't request a codec.
-    if (info.audioPassthroughCodecs.contains(stream.codec))
-      continue;
-#endif
-
     // (Would be nice to check audioChannels here to not request the encoder
     // when playing stereo - but unfortunately, the ac3 encoder is loaded first,
     // and only removed when detecting stereo input)
@@ -1329,8 +2229,10 @@ void Codecs::Uninit()
 {
   if (g_eaeProcess)
   {
+    // takes the idle timer with it
     delete g_eaeProcess;
     g_eaeProcess = nullptr;
+    g_eaeIdleTimer = nullptr;
   }
 
   if (!g_eaeWatchFolder.isEmpty())
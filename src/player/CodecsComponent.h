@@ -12,6 +12,14 @@
 #include <QVariant>
 #include <QTime>
 #include <QSet>
+#include <QHash>
+#include <QFile>
+#include <QCryptographicHash>
+
+// EAE is stopped once playback didn't need it for this long
+#define EAE_IDLE_TIMEOUT_MSEC (10 * 60 * 1000)
+// and killed if it didn't quit this long after being asked to
+#define EAE_KILL_TIMEOUT_MSEC 5000
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 enum class CodecType {
@@ -76,31 +84,54 @@ class Downloader : public QObject
   Q_OBJECT
 public:
   typedef QList<QPair<QString, QString>> HeaderList;
-  explicit Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent);
+  // If destination is set, the reply is streamed to "<destination>.part" instead
+  // of being kept in memory, and done() passes an empty data argument. An
+  // existing .part file from an earlier, interrupted attempt is resumed.
+  explicit Downloader(QVariant userData, const QUrl& url, const HeaderList& headers, QObject* parent,
+                      const QString& destination = QString());
+  ~Downloader() override;
+
+  // Only valid for downloads to a file, after done() was emitted.
+  QString partFilePath() const { return m_file.fileName(); }
+  QByteArray sha1() const { return m_hash.result(); }
+
 Q_SIGNALS:
   void done(QVariant userData, bool success, const QByteArray& data);
+  // Only for downloads to a file: emitted for every chunk written, offset is its
+  // position in the file. On resume, the existing data is replayed first.
+  void dataReceived(const QByteArray& data, qint64 offset);
 
 private Q_SLOTS:
   void networkFinished(QNetworkReply* pReply);
   void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+  void readyRead();
 
 private:
-  QNetworkAccessManager m_WebCtrl;
   QByteArray m_DownloadedData;
   QVariant m_userData;
   QTime m_currentStartTime;
   int m_lastProgress;
+  QNetworkReply* m_reply;
+  QFile m_file;
+  QCryptographicHash m_hash;
+  qint64 m_resumeOffset;
+  bool m_rangeChecked;
+  bool m_writeError;
 };
 
+class ZipStreamExtractor;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class CodecsFetcher : public QObject
 {
   Q_OBJECT
 public:
   CodecsFetcher()
-  : startCodecs(true), m_eaeNeeded(false), m_fetchEAE(false)
+  : startCodecs(true), background(false), m_eaeNeeded(false), m_fetchEAE(false), m_activeDownloads(0),
+    m_paused(false), m_eaeExtractor(nullptr)
   {
   }
+  ~CodecsFetcher() override;
 
   // Download the given list of codecs (skip download for codecs already
   // installed). Then call done(userData), regardless of success.
@@ -111,24 +142,42 @@ public:
 
   bool startCodecs;
 
+  // Set before installCodecs() for downloads nobody waits for: one at a time, none start while
+  // paused, and codecs another fetcher gets to first are left to it.
+  bool background;
+  // Downloads that already run are finished, done() waits for resuming.
+  void setPaused(bool paused);
+
 Q_SIGNALS:
   void done(CodecsFetcher* sender);
+  // A download this fetcher did is over, whether it succeeded or not.
+  void downloadReleased(const QString& name);
 
 private Q_SLOTS:
   void codecInfoDownloadDone(QVariant userData, bool success, const QByteArray& data);
   void codecDownloadDone(QVariant userData, bool success, const QByteArray& data);
+  void otherDownloadDone(const QString& name);
 
 private:
   bool codecNeedsDownload(const CodecDriver& codec);
+  // false if another fetcher is already downloading it, this one then waits for that if wait is set
+  bool claimDownload(const QString& name, bool wait = true);
+  void releaseDownload(const QString& name);
   bool processCodecInfoReply(const QVariant& context, const QByteArray& data);
-  void processCodecDownloadDone(const QVariant& context, const QByteArray& data);
+  void processCodecDownloadDone(const QVariant& context, Downloader* downloader);
   void startNext();
-  void startEAE();
 
   QQueue<CodecDriver> m_Codecs;
-  QByteArray m_currentHash;
+  // expected SHA-1 of each file being downloaded, see downloadName()
+  QHash<QString, QByteArray> m_expectedHashes;
   bool m_eaeNeeded;
   bool m_fetchEAE;
+  int m_activeDownloads;
+  bool m_paused;
+  // what other fetchers are downloading for this one, done() waits for them
+  QSet<QString> m_waitingFor;
+  // extracts the EAE archive while it's downloading (if minizip is available)
+  ZipStreamExtractor* m_eaeExtractor;
 };
 
 class Codecs
@@ -138,9 +187,10 @@ public:
 
   static void initCodecs();
 
-  static QString plexNameToFF(QString plex);
+  // Both return the name itself (without copying it) unless the two disagree on it.
+  static QString plexNameToFF(const QString& plex);
 
-  static QString plexNameFromFF(QString ffname);
+  static QString plexNameFromFF(const QString& ffname);
 
   static inline bool sameCodec(const CodecDriver& a, const CodecDriver& b)
   {
@@ -151,8 +201,31 @@ public:
 
   static void Uninit();
 
+  // EAE runs while playback needs it. It's started when codecs are loaded for an item,
+  // or ahead of that with prewarmEAE() when an item that likely needs it is queued, and
+  // stopped EAE_IDLE_TIMEOUT_MSEC after releaseEAE() unless it's started again.
+  static void startEAE();
+  static void prewarmEAE();
+  static void releaseEAE();
+
   static const QList<CodecDriver>& getCachedCodecList();
 
+  // Incremented whenever updateCachedCodecList() actually changed the list, so
+  // anything derived from it can tell whether it is stale.
+  static int cachedCodecListGeneration();
+
+  // Largest resolution the decoder (by driver name) decoded in the background
+  // capability probe. *probed is false if it wasn't (or not yet) probed.
+  static QSize probedMaxResolution(const QString& decoder, bool* probed = nullptr);
+  // The same for the FFmpeg decoder of the format with hardware decoding, the
+  // capabilities string advertises this for hevc and vp9.
+  static QSize hardwareDecodeMaxResolution(const QString& format, bool* probed = nullptr);
+
+  // Lookup in the cached codec list by type/format/driver. Returns nullptr if not found.
+  // The pointer is invalidated by updateCachedCodecList().
+  static const CodecDriver* findCachedCodec(const CodecDriver& codec);
+
+  // Passing getCachedCodecList() as list uses an index instead of a linear scan.
   static QList<CodecDriver> findCodecsByFormat(const QList<CodecDriver>& list, CodecType type, const QString& format);
   static QList<CodecDriver> determineRequiredCodecs(const PlaybackInfo& info);
 };
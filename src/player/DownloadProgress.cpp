@@ -0,0 +1,101 @@
+#include "DownloadProgress.h"
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DownloadProgress::DownloadProgress() : QObject(nullptr), m_doneReceived(0), m_doneTotal(0),
+  m_timer(this), m_sampleReceived(0), m_rate(0)
+{
+  m_timer.setInterval(DOWNLOAD_PROGRESS_INTERVAL_MSEC);
+  connect(&m_timer, &QTimer::timeout, this, &DownloadProgress::report);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DownloadProgress::update(const QObject* download, qint64 bytesReceived, qint64 bytesTotal)
+{
+  if (m_downloads.isEmpty() && !m_timer.isActive())
+  {
+    m_sampleTime.start();
+    m_sampleReceived = 0;
+    m_rate = 0;
+    m_timer.start();
+  }
+
+  auto it = m_downloads.find(download);
+  if (it == m_downloads.end())
+  {
+    // what was resumed isn't throughput
+    m_sampleReceived += bytesReceived;
+    it = m_downloads.insert(download, Download());
+  }
+
+  it->m_received = bytesReceived;
+  it->m_total = qMax(bytesTotal, (qint64)0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DownloadProgress::remove(const QObject* download)
+{
+  auto it = m_downloads.find(download);
+  if (it == m_downloads.end())
+    return;
+
+  m_doneReceived += it->m_received;
+  m_doneTotal += qMax(it->m_received, it->m_total);
+  m_downloads.erase(it);
+
+  // the next tick reports the end
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap DownloadProgress::summary() const
+{
+  qint64 received = m_doneReceived;
+  qint64 total = m_doneTotal;
+  bool totalKnown = true;
+  for (const Download& download : m_downloads)
+  {
+    received += download.m_received;
+    total += download.m_total;
+    totalKnown = totalKnown && download.m_total > 0;
+  }
+
+  int secondsLeft = -1;
+  if (totalKnown && m_rate > 0)
+    secondsLeft = (int)((total - received) / m_rate + 0.5);
+
+  QVariantMap summary;
+  summary["received"] = received;
+  summary["total"] = totalKnown ? total : 0;
+  summary["bytesPerSecond"] = (qint64)m_rate;
+  summary["secondsLeft"] = secondsLeft;
+  summary["done"] = m_downloads.isEmpty();
+  return summary;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DownloadProgress::report()
+{
+  qint64 received = m_doneReceived;
+  for (const Download& download : m_downloads)
+    received += download.m_received;
+
+  qint64 elapsed = m_sampleTime.restart();
+  if (elapsed > 0)
+  {
+    double rate = (received - m_sampleReceived) * 1000.0 / elapsed;
+    m_rate = m_rate > 0 ? m_rate * (1 - DOWNLOAD_PROGRESS_RATE_WEIGHT) + rate * DOWNLOAD_PROGRESS_RATE_WEIGHT : rate;
+  }
+  m_sampleReceived = received;
+
+  QVariantMap progressSummary = summary();
+  emit progress(progressSummary);
+
+  if (m_downloads.isEmpty())
+  {
+    QLOG_DEBUG() << "Downloads done," << m_doneReceived << "bytes";
+    m_timer.stop();
+    m_doneReceived = 0;
+    m_doneTotal = 0;
+  }
+}
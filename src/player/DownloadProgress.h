@@ -0,0 +1,66 @@
+#ifndef DOWNLOADPROGRESS_H
+#define DOWNLOADPROGRESS_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+#include "utils/Utils.h"
+
+// how often progress of the codec downloads is reported, at most
+#define DOWNLOAD_PROGRESS_INTERVAL_MSEC 250
+// weight of the newest throughput sample, the rest is what was measured before
+#define DOWNLOAD_PROGRESS_RATE_WEIGHT 0.3
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// All codec downloads that are running, as one. The downloads only record their numbers here
+// on every QNetworkReply progress callback, progress() is emitted from a timer every
+// DOWNLOAD_PROGRESS_INTERVAL_MSEC while any of them runs. A large EAE archive would
+// otherwise mean thousands of progress updates.
+//
+// A download that finishes stays counted until all of them did, so the progress doesn't go
+// back when one of several parallel downloads ends.
+//
+class DownloadProgress : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(DownloadProgress);
+
+public:
+  // bytesReceived and bytesTotal include what was resumed from an earlier attempt.
+  // bytesTotal is 0 if the server didn't say.
+  void update(const QObject* download, qint64 bytesReceived, qint64 bytesTotal);
+  void remove(const QObject* download);
+
+  // See progress().
+  QVariantMap summary() const;
+
+Q_SIGNALS:
+  // Keys: "received" and "total" in bytes (total 0 if unknown), "bytesPerSecond", "secondsLeft"
+  // (-1 if unknown) and "done", which is true for the last one, after all downloads ended.
+  void progress(const QVariantMap& summary);
+
+private:
+  DownloadProgress();
+  void report();
+
+  struct Download
+  {
+    qint64 m_received;
+    qint64 m_total;
+  };
+  QHash<const QObject*, Download> m_downloads;
+
+  // of the downloads that ended since the first one started
+  qint64 m_doneReceived;
+  qint64 m_doneTotal;
+
+  QTimer m_timer;
+  QElapsedTimer m_sampleTime;
+  qint64 m_sampleReceived;
+  double m_rate;
+};
+
+#endif // DOWNLOADPROGRESS_H
@@ -0,0 +1,182 @@
+#include "FrameTimings.h"
+
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include <math.h>
+#include <string.h>
+
+// Upper bounds (in usec) of the histogram buckets, the last bucket is open-ended.
+static const qint64 g_bucketLimits[] = { 2000, 4000, 8000, 17000, 34000, 67000 };
+#define BUCKET_COUNT (int)(sizeof(g_bucketLimits) / sizeof(g_bucketLimits[0]) + 1)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+FrameTimings::FrameTimings()
+  : m_writeIndex(0), m_updateRequestedAt(0), m_totalMissedVsyncs(0), m_displayFps(0),
+    m_renderStart(0), m_lastSwap(0), m_current()
+{
+  memset(m_samples, 0, sizeof(m_samples));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 FrameTimings::now()
+{
+  static QElapsedTimer timer;
+  static std::atomic<bool> started(false);
+  if (!started.exchange(true))
+    timer.start();
+  return timer.nsecsElapsed() / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameTimings::updateRequested()
+{
+  // Only the first request since the last render counts, since that's the one
+  // the render was late for.
+  qint64 expected = 0;
+  m_updateRequestedAt.compare_exchange_strong(expected, now());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameTimings::renderStart()
+{
+  m_renderStart = now();
+  qint64 requested = m_updateRequestedAt.exchange(0);
+  m_current.latencyUsec = requested ? m_renderStart - requested : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameTimings::renderDone()
+{
+  m_current.drawUsec = now() - m_renderStart;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameTimings::swapped()
+{
+  double displayFps = m_displayFps.load(std::memory_order_relaxed);
+  qint64 t = now();
+  m_current.swapUsec = m_lastSwap ? t - m_lastSwap : 0;
+  m_current.missedVsyncs = 0;
+  m_lastSwap = t;
+
+  if (displayFps > 1 && m_current.swapUsec > 0)
+  {
+    double vsyncs = m_current.swapUsec / (1000000.0 / displayFps);
+    m_current.missedVsyncs = qMax(0, (int)lround(vsyncs) - 1);
+    m_totalMissedVsyncs += m_current.missedVsyncs;
+  }
+
+  quint32 index = m_writeIndex.load(std::memory_order_relaxed);
+  m_samples[index % SampleCount] = m_current;
+  m_writeIndex.store(index + 1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int FrameTimings::snapshot(Sample* samples) const
+{
+  quint32 written = m_writeIndex.load(std::memory_order_acquire);
+  int count = (int)qMin(written, (quint32)SampleCount);
+  for (int i = 0; i < count; i++)
+    samples[i] = m_samples[(written - count + i) % SampleCount];
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void appendHistogram(QTextStream& out, const char* name, const qint64* values, int count)
+{
+  int buckets[BUCKET_COUNT] = {};
+  qint64 sum = 0, max = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int b = 0;
+    while (b < BUCKET_COUNT - 1 && values[i] >= g_bucketLimits[b])
+      b++;
+    buckets[b]++;
+    sum += values[i];
+    max = qMax(max, values[i]);
+  }
+
+  out << "  " << name << ": avg " << (count ? sum / count / 1000.0 : 0.0) << "ms, max " << max / 1000.0 << "ms" << endl;
+  out << "   ";
+  for (int b = 0; b < BUCKET_COUNT; b++)
+  {
+    if (b < BUCKET_COUNT - 1)
+      out << " <" << g_bucketLimits[b] / 1000 << "ms:" << buckets[b];
+    else
+      out << " >=" << g_bucketLimits[b - 1] / 1000 << "ms:" << buckets[b];
+  }
+  out << endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString FrameTimings::histograms() const
+{
+  Sample samples[SampleCount];
+  int count = snapshot(samples);
+
+  QString str;
+  QTextStream out(&str);
+  out << "Frame timings (last " << count << " frames)" << endl;
+
+  qint64 values[SampleCount];
+  for (int i = 0; i < count; i++)
+    values[i] = samples[i].drawUsec;
+  appendHistogram(out, "Draw", values, count);
+  for (int i = 0; i < count; i++)
+    values[i] = samples[i].latencyUsec;
+  appendHistogram(out, "Update latency", values, count);
+  for (int i = 0; i < count; i++)
+    values[i] = samples[i].swapUsec;
+  appendHistogram(out, "Swap interval", values, count);
+
+  int missed = 0;
+  for (int i = 0; i < count; i++)
+    missed += samples[i].missedVsyncs;
+  out << "  Missed vsyncs: " << missed << " (total " << m_totalMissedVsyncs.load() << ")" << endl;
+  out << endl << flush;
+  return str;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double FrameTimings::meanDrawMsec() const
+{
+  Sample samples[SampleCount];
+  int count = snapshot(samples);
+  if (!count)
+    return 0;
+
+  qint64 draw = 0;
+  for (int i = 0; i < count; i++)
+    draw += samples[i].drawUsec;
+  return draw / count / 1000.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString FrameTimings::summary() const
+{
+  Sample samples[SampleCount];
+  int count = snapshot(samples);
+  if (!count)
+    return QString();
+
+  qint64 draw = 0, latency = 0, swap = 0;
+  int missed = 0;
+  for (int i = 0; i < count; i++)
+  {
+    draw += samples[i].drawUsec;
+    latency += samples[i].latencyUsec;
+    swap += samples[i].swapUsec;
+    missed += samples[i].missedVsyncs;
+  }
+
+  QString str;
+  QTextStream out(&str);
+  out << "Renderer:" << endl;
+  out << "Draw: " << draw / count / 1000.0 << "ms" << endl;
+  out << "Update latency: " << latency / count / 1000.0 << "ms" << endl;
+  out << "Swap interval: " << swap / count / 1000.0 << "ms" << endl;
+  out << "Missed vsyncs: " << missed << "/" << count << endl;
+  out << flush;
+  return str;
+}
@@ -0,0 +1,64 @@
+#ifndef FRAMETIMINGS_H
+#define FRAMETIMINGS_H
+
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-frame statistics of the video renderer. The render thread records the
+// frames, mpv's update callback comes from one of mpv's threads and the refresh
+// rate from the GUI thread. Any other thread may read a summary at any time. No
+// locks are taken, so a reader can see a sample that is being overwritten, which
+// is acceptable for statistics.
+class FrameTimings
+{
+public:
+  struct Sample
+  {
+    qint64 drawUsec;      // time spent in mpv's render call
+    qint64 latencyUsec;   // mpv requesting a redraw -> render() actually running
+    qint64 swapUsec;      // interval between this and the previous swap
+    int missedVsyncs;     // number of display refreshes skipped before this swap
+  };
+
+  FrameTimings();
+
+  // From mpv's update callback, any thread.
+  void updateRequested();
+  // Render thread only.
+  void renderStart();
+  void renderDone();
+  void swapped();
+
+  // Refresh rate of the screen the window is on, missed vsyncs are counted against it.
+  // Set from the GUI thread, where QScreen lives.
+  void setDisplayFps(double fps) { m_displayFps.store(fps, std::memory_order_relaxed); }
+
+  // Returns a text block with histograms of the last samples.
+  QString histograms() const;
+  // Returns a short one-line-per-value summary for the video info overlay.
+  QString summary() const;
+  // Average time spent drawing over the last samples, in ms.
+  double meanDrawMsec() const;
+
+private:
+  enum { SampleCount = 256 };
+
+  static qint64 now();
+  int snapshot(Sample* samples) const;
+
+  Sample m_samples[SampleCount];
+  std::atomic<quint32> m_writeIndex;
+  std::atomic<qint64> m_updateRequestedAt;
+  std::atomic<quint64> m_totalMissedVsyncs;
+  std::atomic<double> m_displayFps;
+
+  // render thread state
+  qint64 m_renderStart;
+  qint64 m_lastSwap;
+  Sample m_current;
+};
+
+#endif // FRAMETIMINGS_H
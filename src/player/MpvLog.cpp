@@ -0,0 +1,197 @@
+#include "MpvLog.h"
+
+#include <QDateTime>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <string.h>
+
+#include "QsLog.h"
+#include "shared/Paths.h"
+
+static const struct { const char* name; int level; } g_levelNames[] = {
+  { "no", MPV_LOG_LEVEL_NONE },
+  { "fatal", MPV_LOG_LEVEL_FATAL },
+  { "error", MPV_LOG_LEVEL_ERROR },
+  { "warn", MPV_LOG_LEVEL_WARN },
+  { "info", MPV_LOG_LEVEL_INFO },
+  // mpv hands status messages to clients as info
+  { "status", MPV_LOG_LEVEL_INFO },
+  { "v", MPV_LOG_LEVEL_V },
+  { "debug", MPV_LOG_LEVEL_DEBUG },
+  { "trace", MPV_LOG_LEVEL_TRACE }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int levelFromName(const QString& name, int defaultLevel)
+{
+  for (const auto& level : g_levelNames)
+  {
+    if (name == level.name)
+      return level.level;
+  }
+  return defaultLevel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static const char* levelName(int level)
+{
+  for (const auto& name : g_levelNames)
+  {
+    if (name.level == level)
+      return name.name;
+  }
+  return "?";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MpvLog::MpvLog() : m_defaultLevel(MPV_LOG_DEFAULT_LEVEL), m_ringNext(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString MpvLog::setLevels(const QString& levels)
+{
+  m_moduleLevels.clear();
+  m_defaultLevel = MPV_LOG_DEFAULT_LEVEL;
+
+  for (const QString& entry : levels.split(',', QString::SkipEmptyParts))
+  {
+    QStringList parts = entry.trimmed().split('=');
+    if (parts.size() != 2)
+    {
+      QLOG_WARN() << "Ignoring mpv log level:" << entry;
+      continue;
+    }
+
+    int level = levelFromName(parts.at(1), -1);
+    if (level < 0)
+    {
+      QLOG_WARN() << "Unknown mpv log level:" << entry;
+      continue;
+    }
+
+    if (parts.at(0) == "all")
+      m_defaultLevel = level;
+    else
+      m_moduleLevels.insert(parts.at(0).toUtf8(), level);
+  }
+
+  // mpv has to send everything the ring keeps, and more where the log file wants more
+  QStringList mpvLevels;
+  mpvLevels << QString("all=") + levelName(qMax(m_defaultLevel, MPV_LOG_RING_LEVEL));
+  for (auto it = m_moduleLevels.constBegin(); it != m_moduleLevels.constEnd(); ++it)
+    mpvLevels << QString::fromUtf8(it.key()) + "=" + levelName(qMax(it.value(), MPV_LOG_RING_LEVEL));
+
+  return mpvLevels.join(',');
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MpvLog::levelFor(const char* prefix) const
+{
+  if (m_moduleLevels.isEmpty())
+    return m_defaultLevel;
+
+  return m_moduleLevels.value(QByteArray::fromRawData(prefix, (int)strlen(prefix)), m_defaultLevel);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MpvLog::message(const mpv_event_log_message* msg)
+{
+  // Strip the trailing '\n'
+  int len = (int)strlen(msg->text);
+  if (len > 0 && msg->text[len - 1] == '\n')
+    len -= 1;
+
+  if (msg->log_level <= MPV_LOG_RING_LEVEL)
+  {
+    if (m_ring.size() < MPV_LOG_RING_SIZE)
+      m_ring.resize(MPV_LOG_RING_SIZE);
+
+    Entry& entry = m_ring[m_ringNext];
+    entry.time = QDateTime::currentMSecsSinceEpoch();
+    entry.level = msg->log_level;
+    entry.line = QByteArray(msg->prefix) + ": " + QByteArray(msg->text, len);
+    m_ringNext = (m_ringNext + 1) % MPV_LOG_RING_SIZE;
+  }
+
+  if (msg->log_level > levelFor(msg->prefix))
+    return;
+
+  QsLogging::Level level;
+  if (msg->log_level >= MPV_LOG_LEVEL_V)
+    level = QsLogging::DebugLevel;
+  else if (msg->log_level >= MPV_LOG_LEVEL_INFO)
+    level = QsLogging::InfoLevel;
+  else if (msg->log_level >= MPV_LOG_LEVEL_WARN)
+    level = QsLogging::WarnLevel;
+  else
+    level = QsLogging::ErrorLevel;
+
+  // mpv is verbose, check the level before converting the message at all
+  if (QsLogging::Logger::instance().loggingLevel() > level)
+    return;
+
+  QString logline = QString::fromUtf8(msg->prefix) + ": " + QString::fromUtf8(msg->text, len);
+  QsLogging::Logger::Helper(level).stream() << qPrintable(logline);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class MpvLogWriter : public QRunnable
+{
+public:
+  MpvLogWriter(const QString& path, const QByteArray& header, const QVector<QByteArray>& lines)
+    : m_path(path), m_header(header), m_lines(lines) {}
+
+  void run() override
+  {
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+      QLOG_WARN() << "Can't write the mpv log to" << m_path;
+      return;
+    }
+
+    file.write(m_header);
+    for (const QByteArray& line : m_lines)
+      file.write(line);
+
+    if (!file.commit())
+      QLOG_WARN() << "Can't write the mpv log to" << m_path;
+  }
+
+private:
+  QString m_path;
+  QByteArray m_header;
+  QVector<QByteArray> m_lines;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MpvLog::dump(const QString& reason)
+{
+  QVector<QByteArray> lines;
+  lines.reserve(m_ring.size());
+
+  // oldest first, the slots after the newest one are only used once the ring went around
+  for (int i = 0; i < m_ring.size(); i++)
+  {
+    Entry& entry = m_ring[(m_ringNext + i) % m_ring.size()];
+    if (entry.line.isNull())
+      continue;
+
+    QByteArray time = QDateTime::fromMSecsSinceEpoch(entry.time).toString("hh:mm:ss.zzz").toLatin1();
+    lines << time + " [" + levelName(entry.level) + "] " + entry.line + "\n";
+    entry.line.clear();
+  }
+
+  if (lines.isEmpty())
+    return;
+
+  QString path = Paths::logDir("mpv-failure.log");
+  QLOG_INFO() << "Playback failed, writing the last" << lines.size() << "mpv messages to" << path;
+
+  QByteArray header = "Playback failed: " + reason.toUtf8() + "\n\n";
+  QThreadPool::globalInstance()->start(new MpvLogWriter(path, header, lines));
+}
@@ -0,0 +1,54 @@
+#ifndef MPVLOG_H
+#define MPVLOG_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <mpv/client.h>
+
+// the last this many mpv messages are kept for when playback fails
+#define MPV_LOG_RING_SIZE 4096
+// down to this level, whatever goes to the log file
+#define MPV_LOG_RING_LEVEL MPV_LOG_LEVEL_V
+// what goes to the log file if the settings don't say otherwise
+#define MPV_LOG_DEFAULT_LEVEL MPV_LOG_LEVEL_INFO
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Decides which mpv log messages go to the log file, per mpv module, and keeps the verbose
+// rest in memory. The memory is only written out when playback fails, so we have the details
+// then without writing all of them all the time. Only used from the main thread.
+//
+class MpvLog
+{
+public:
+  MpvLog();
+
+  // Takes levels in mpv's msg-level syntax ("all=info,vd=debug") and returns the msg-level
+  // mpv has to be set to, so it sends all of these plus what the ring keeps.
+  QString setLevels(const QString& levels);
+
+  void message(const mpv_event_log_message* msg);
+
+  // Writes the messages kept so far to a file in the log dir, on a worker thread.
+  void dump(const QString& reason);
+
+private:
+  struct Entry
+  {
+    qint64 time;
+    int level;
+    QByteArray line;
+  };
+
+  int levelFor(const char* prefix) const;
+
+  QHash<QByteArray, int> m_moduleLevels;
+  int m_defaultLevel;
+
+  QVector<Entry> m_ring;
+  int m_ringNext;
+};
+
+#endif // MPVLOG_H
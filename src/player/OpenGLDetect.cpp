@@ -2,6 +2,9 @@
 #include <QSurfaceFormat>
 #include <QCoreApplication>
 #include <QOpenGLContext>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include <mpv/client.h>
 
@@ -9,6 +12,64 @@
 
 #include "QtHelper.h"
 #include "OpenGLDetect.h"
+#include "Paths.h"
+#include "Version.h"
+
+#if defined(Q_OS_LINUX)
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSysInfo>
+#elif defined(Q_OS_WIN)
+#include <QSettings>
+#include <QSysInfo>
+#include <QRegExp>
+#include <windows.h>
+#endif
+
+// bump this when what is probed, or how, changes
+#define GL_DETECT_CACHE_VERSION 1
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_WIN)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The probes below are slow, so their result is kept along with a description of the GPU,
+// driver and display server it was found on. It's only probed again if that changed.
+// Deleting opengl-detect.json in the cache directory forces a new probe.
+static QString detectCachePath()
+{
+  return Paths::cacheDir("opengl-detect.json");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool loadDetectCache(const QString& identity, QString* result)
+{
+  QFile file(detectCachePath());
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+  if (json["version"].toInt() != GL_DETECT_CACHE_VERSION || json["identity"].toString() != identity)
+    return false;
+
+  *result = json["result"].toString();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void saveDetectCache(const QString& identity, const QString& result)
+{
+  QJsonObject json;
+  json["version"] = GL_DETECT_CACHE_VERSION;
+  json["identity"] = identity;
+  json["result"] = result;
+
+  QFile file(detectCachePath());
+  if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(json).toJson()) < 0)
+    QLOG_WARN() << "Failed to write" << detectCachePath();
+}
+
+#endif
 
 #if defined(Q_OS_MAC)
 
@@ -54,11 +115,58 @@ static QString probeHwdecInterop()
   return mpv::qt::get_property(mpv, "hwdec-interop").toString();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString readSysFile(const QString& path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return QString();
+  return QString::fromUtf8(file.readLine()).trimmed();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// What the probe result depends on: the GPUs and their kernel drivers, the display server,
+// and the user space drivers. The latter aren't easy to tell apart without loading them, but
+// installing or updating any library rewrites ld.so.cache, which is good enough.
+static QString systemIdentity()
+{
+  QStringList parts;
+  parts << Version::GetVersionString() << QString::number(mpv_client_api_version());
+  parts << QSysInfo::kernelVersion();
+
+  for (const char* name : { "XDG_SESSION_TYPE", "WAYLAND_DISPLAY", "DISPLAY", "LIBVA_DRIVER_NAME", "VDPAU_DRIVER" })
+    parts << QString::fromLocal8Bit(qgetenv(name));
+
+  QDir drm("/sys/class/drm");
+  for (const QString& card : drm.entryList(QStringList() << "card[0-9]" << "card[0-9][0-9]", QDir::Dirs | QDir::System))
+  {
+    QString device = drm.filePath(card + "/device/");
+    QString driver = QFileInfo(QFileInfo(device + "driver").symLinkTarget()).fileName();
+    parts << card << readSysFile(device + "vendor") << readSysFile(device + "device") << driver
+          << readSysFile("/sys/module/" + driver + "/version");
+  }
+
+  parts << readSysFile("/proc/driver/nvidia/version");
+  parts << QString::number(QFileInfo("/etc/ld.so.cache").lastModified().toMSecsSinceEpoch());
+
+  return parts.join("|");
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void detectOpenGLEarly()
 {
+  QString identity = systemIdentity();
+  QString interop;
+  if (!loadDetectCache(identity, &interop))
+  {
+    interop = probeHwdecInterop();
+    // a failed probe might work next time
+    if (!interop.isEmpty())
+      saveDetectCache(identity, interop);
+  }
+
   // The putenv call must happen before Qt initializes its platform stuff.
-  if (probeHwdecInterop() == "vaapi-egl")
+  if (interop == "vaapi-egl")
     qputenv("QT_XCB_GL_INTEGRATION", "xcb_egl");
 }
 
@@ -69,12 +177,51 @@ void detectOpenGLLate()
 
 #elif defined(Q_OS_WIN)
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The primary display adapter and its driver version, and the Windows build.
+static QString systemIdentity()
+{
+  QStringList parts;
+  parts << Version::GetVersionString() << QSysInfo::kernelVersion();
+
+  DISPLAY_DEVICEW device;
+  for (DWORD i = 0; ; i++)
+  {
+    ZeroMemory(&device, sizeof(device));
+    device.cb = sizeof(device);
+    if (!EnumDisplayDevicesW(NULL, i, &device, 0))
+      break;
+    if (!(device.StateFlags & DISPLAY_DEVICE_PRIMARY_DEVICE))
+      continue;
+
+    parts << QString::fromWCharArray(device.DeviceString) << QString::fromWCharArray(device.DeviceID);
+
+    // \Registry\Machine\System\... is HKEY_LOCAL_MACHINE\System\...
+    QString key = QString::fromWCharArray(device.DeviceKey);
+    key.replace(QRegExp("^\\\\Registry\\\\Machine", Qt::CaseInsensitive), "HKEY_LOCAL_MACHINE");
+    parts << QSettings(key, QSettings::NativeFormat).value("DriverVersion").toString();
+    break;
+  }
+
+  return parts.join("|");
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void detectOpenGLEarly()
 {
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+static QSurfaceFormat glesFormat(int version)
+{
+  QSurfaceFormat fmt = QSurfaceFormat::defaultFormat();
+  fmt.setMajorVersion(version);
+#ifdef HAVE_OPTIMALORIENTATION
+  fmt.setOption(QSurfaceFormat::UseOptimalOrientation);
+#endif
+  return fmt;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void detectOpenGLLate()
 {
@@ -84,21 +231,27 @@ void detectOpenGLLate()
   // Workaround for broken QSGDefaultDistanceFieldGlyphCache::resizeTexture in ES 3 mode
   qputenv("QML_USE_GLYPHCACHE_WORKAROUND", "1");
 
+  QString identity = systemIdentity();
+  QString cached;
+  if (loadDetectCache(identity, &cached) && cached.toInt() > 0)
+  {
+    QLOG_INFO() << "Using GLES version" << cached << "(cached)";
+    QSurfaceFormat::setDefaultFormat(glesFormat(cached.toInt()));
+    return;
+  }
+
   QList<int> versions = { 3, 2 };
   for (auto version : versions)
   {
     QLOG_INFO() << "Trying GLES version" << version;
-    QSurfaceFormat fmt = QSurfaceFormat::defaultFormat();
-    fmt.setMajorVersion(version);
-#ifdef HAVE_OPTIMALORIENTATION
-    fmt.setOption(QSurfaceFormat::UseOptimalOrientation);
-#endif
+    QSurfaceFormat fmt = glesFormat(version);
     QOpenGLContext ctx;
     ctx.setFormat(fmt);
     if (ctx.create())
     {
       QLOG_INFO() << "Using GLES version" << version;
       QSurfaceFormat::setDefaultFormat(fmt);
+      saveDetectCache(identity, QString::number(version));
       break;
     }
   }
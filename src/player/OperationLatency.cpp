@@ -0,0 +1,122 @@
+#include "OperationLatency.h"
+
+#include <QTextStream>
+
+// upper bounds of the histogram buckets, the last one takes everything above
+static const qint64 g_bucketBounds[] = { 100, 250, 500, 1000, 2500, 5000 };
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const char* OperationLatency::name(Operation operation)
+{
+  switch (operation)
+  {
+    case Seek:
+      return "seek";
+    case AudioSwitch:
+      return "audioSwitch";
+    case SubtitleSwitch:
+      return "subtitleSwitch";
+    case StreamSwitch:
+      return "streamSwitch";
+    default:
+      return "unknown";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void OperationLatency::reset()
+{
+  for (int i = 0; i < OperationCount; i++)
+  {
+    QElapsedTimer started = i == StreamSwitch ? m_operations[i].started : QElapsedTimer();
+    m_operations[i] = Timing();
+    m_operations[i].started = started;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void OperationLatency::start(Operation operation)
+{
+  Timing& timing = m_operations[operation];
+  if (!timing.started.isValid() || timing.started.elapsed() > OPERATION_LATENCY_TIMEOUT_MSEC)
+    timing.started.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void OperationLatency::finish(Operation operation)
+{
+  Timing& timing = m_operations[operation];
+  if (!timing.started.isValid())
+    return;
+
+  qint64 msec = timing.started.elapsed();
+  timing.started.invalidate();
+
+  // the event was for something else, the one that was asked for never finished
+  if (msec > OPERATION_LATENCY_TIMEOUT_MSEC)
+  {
+    timing.timeouts++;
+    return;
+  }
+
+  int bucket = 0;
+  while (bucket < BucketCount - 1 && msec > g_bucketBounds[bucket])
+    bucket++;
+
+  timing.buckets[bucket]++;
+  timing.count++;
+  timing.sumMsec += msec;
+  timing.maxMsec = qMax(timing.maxMsec, msec);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap OperationLatency::summary() const
+{
+  QVariantMap summary;
+  for (int i = 0; i < OperationCount; i++)
+  {
+    const Timing& timing = m_operations[i];
+    if (!timing.count && !timing.timeouts)
+      continue;
+
+    QVariantMap histogram;
+    for (int bucket = 0; bucket < BucketCount - 1; bucket++)
+      histogram[QString("le%1").arg(g_bucketBounds[bucket])] = timing.buckets[bucket];
+    histogram[QString("over%1").arg(g_bucketBounds[BucketCount - 2])] = timing.buckets[BucketCount - 1];
+
+    QVariantMap operation;
+    operation["count"] = timing.count;
+    operation["meanMsec"] = timing.count ? timing.sumMsec / timing.count : 0;
+    operation["maxMsec"] = timing.maxMsec;
+    operation["timeouts"] = timing.timeouts;
+    operation["histogram"] = histogram;
+    summary[name((Operation)i)] = operation;
+  }
+  return summary;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString OperationLatency::overlay() const
+{
+  QString text;
+  QTextStream out(&text);
+
+  for (int i = 0; i < OperationCount; i++)
+  {
+    const Timing& timing = m_operations[i];
+    out << name((Operation)i) << ": ";
+    if (!timing.count)
+    {
+      out << "-" << endl;
+      continue;
+    }
+
+    out << timing.count << "x, mean " << timing.sumMsec / timing.count << " max " << timing.maxMsec << " ms [";
+    for (int bucket = 0; bucket < BucketCount; bucket++)
+      out << (bucket ? " " : "") << timing.buckets[bucket];
+    out << "]" << endl;
+  }
+
+  out << flush;
+  return text;
+}
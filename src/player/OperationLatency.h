@@ -0,0 +1,63 @@
+#ifndef OPERATIONLATENCY_H
+#define OPERATIONLATENCY_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVariantMap>
+#include <QtGlobal>
+
+// an operation mpv never finishes isn't waited for longer than this
+#define OPERATION_LATENCY_TIMEOUT_MSEC 30000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// How long seeks and stream switches take, from the call that asked for them to the mpv
+// event that says they are done, as a histogram per kind of operation over one file. Only
+// one of each kind is timed at a time: asking again while one is still running keeps the
+// first start, which is how long the user waited. Only used from the main thread.
+class OperationLatency
+{
+public:
+  enum Operation
+  {
+    Seek,
+    AudioSwitch,
+    SubtitleSwitch,
+    StreamSwitch,
+    OperationCount
+  };
+
+  OperationLatency() {}
+
+  // Forget the histograms of the last file, a stream switch is still waited for.
+  void reset();
+
+  void start(Operation operation);
+  void finish(Operation operation);
+  void cancel(Operation operation) { m_operations[operation].started.invalidate(); }
+  bool pending(Operation operation) const { return m_operations[operation].started.isValid(); }
+
+  // {seek: {count, meanMsec, maxMsec, timeouts, histogram: {le100, ..., over5000}}, ...},
+  // only the operations that happened.
+  QVariantMap summary() const;
+  // A line per operation for the video info overlay.
+  QString overlay() const;
+
+private:
+  enum { BucketCount = 7 };
+
+  struct Timing
+  {
+    QElapsedTimer started;
+    int count = 0;
+    int timeouts = 0;
+    qint64 sumMsec = 0;
+    qint64 maxMsec = 0;
+    int buckets[BucketCount] = {};
+  };
+
+  static const char* name(Operation operation);
+
+  Timing m_operations[OperationCount];
+};
+
+#endif // OPERATIONLATENCY_H
@@ -0,0 +1,204 @@
+#include "PlaybackBenchmark.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include <stdio.h>
+
+#include "Globals.h"
+#include "PlayerComponent.h"
+#include "PlayerQuickItem.h"
+#include "QsLog.h"
+#include "QtHelper.h"
+#include "ui/DebugMetrics.h"
+#include "ui/KonvergoWindow.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlaybackBenchmark::PlaybackBenchmark(const QString& listPath, QObject* parent) : QObject(parent),
+  m_listPath(listPath), m_current(-1), m_firstFrameMsec(-1), m_playStartMsec(0), m_cpuStartUsec(0),
+  m_seekTarget(-1), m_seekStartMsec(0), m_seekLatencyMsec(-1), m_position(0), m_fpsSum(0), m_drawSum(0),
+  m_samples(0)
+{
+  m_timeout.setSingleShot(true);
+  m_timeout.setInterval(PLAYBACK_BENCHMARK_LOAD_TIMEOUT_MSEC);
+  connect(&m_timeout, &QTimer::timeout, this, [=]() { finishItem("no frame within the timeout"); });
+
+  m_itemTimer.setSingleShot(true);
+  connect(&m_itemTimer, &QTimer::timeout, this, [=]() { finishItem(); });
+
+  m_seekTimer.setSingleShot(true);
+  connect(&m_seekTimer, &QTimer::timeout, this, &PlaybackBenchmark::seek);
+
+  m_sampleTimer.setInterval(PLAYBACK_BENCHMARK_SAMPLE_MSEC);
+  connect(&m_sampleTimer, &QTimer::timeout, this, &PlaybackBenchmark::sample);
+
+  PlayerComponent& player = PlayerComponent::Get();
+  connect(&player, &PlayerComponent::playing, this, &PlaybackBenchmark::onPlaying);
+  connect(&player, &PlayerComponent::positionUpdate, this, &PlaybackBenchmark::onPosition);
+  connect(&player, &PlayerComponent::error, this, [=](const QString& msg) { finishItem(msg); });
+  connect(&player, &PlayerComponent::finished, this, [=]() { finishItem(); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlaybackBenchmark::loadList()
+{
+  QFile file(m_listPath);
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    return false;
+
+  QTextStream stream(&file);
+  while (!stream.atEnd())
+  {
+    QString line = stream.readLine().trimmed();
+    if (line.isEmpty() || line.startsWith('#'))
+      continue;
+
+    QStringList fields = line.split(' ', QString::SkipEmptyParts);
+    Item item;
+    item.url = fields.at(0);
+    item.durationMsec = fields.size() > 1 ? (qint64)(fields.at(1).toDouble() * 1000) : PLAYBACK_BENCHMARK_ITEM_MSEC;
+    if (item.durationMsec <= 0)
+      item.durationMsec = PLAYBACK_BENCHMARK_ITEM_MSEC;
+    m_items.append(item);
+  }
+
+  return !m_items.isEmpty();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::start()
+{
+  if (!loadList())
+  {
+    fprintf(stderr, "No media in %s\n", qPrintable(m_listPath));
+    QCoreApplication::exit(EXIT_FAILURE);
+    return;
+  }
+
+  QLOG_INFO() << "Playback benchmark with" << m_items.size() << "items from" << m_listPath;
+
+  m_current = 0;
+  startItem();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::startItem()
+{
+  if (m_current >= m_items.size())
+  {
+    printf("%s", QJsonDocument(m_results).toJson().constData());
+    fflush(stdout);
+    QCoreApplication::exit(EXIT_SUCCESS);
+    return;
+  }
+
+  const Item& item = m_items.at(m_current);
+  QLOG_INFO() << "Playback benchmark: playing" << item.url;
+
+  m_firstFrameMsec = -1;
+  m_seekTarget = -1;
+  m_seekLatencyMsec = -1;
+  m_position = 0;
+  m_fpsSum = m_drawSum = 0;
+  m_samples = 0;
+
+  m_cpuStartUsec = processCpuTimeUsec();
+  m_clock.start();
+  m_timeout.start();
+
+  PlayerComponent::Get().load(item.url, {{"autoplay", true}}, {{"type", "video"}});
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::onPlaying()
+{
+  // playing is entered again after seeks and buffering
+  if (m_current < 0 || m_current >= m_items.size() || m_firstFrameMsec >= 0)
+    return;
+
+  m_firstFrameMsec = m_clock.elapsed();
+  m_playStartMsec = m_firstFrameMsec;
+  m_timeout.stop();
+
+  qint64 duration = m_items.at(m_current).durationMsec;
+  m_itemTimer.start(duration);
+  m_seekTimer.start(duration / 2);
+  m_sampleTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::onPosition(quint64 ms)
+{
+  m_position = ms;
+
+  if (m_seekTarget >= 0 && m_seekLatencyMsec < 0 &&
+      qAbs((qint64)ms - m_seekTarget) <= PLAYBACK_BENCHMARK_SEEK_TOLERANCE_MSEC)
+    m_seekLatencyMsec = m_clock.elapsed() - m_seekStartMsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::seek()
+{
+  // forward into what likely isn't cached yet, or back to the start of short files
+  double duration = mpv::qt::get_property_variant(PlayerComponent::Get().getMpvHandle(), "duration").toDouble();
+  qint64 target = (qint64)m_position + 60000;
+  if (duration > 0 && target > duration * 1000 - 10000)
+    target = 0;
+
+  m_seekTarget = target;
+  m_seekStartMsec = m_clock.elapsed();
+  PlayerComponent::Get().seekTo(target);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::sample()
+{
+  m_fpsSum += mpv::qt::get_property_variant(PlayerComponent::Get().getMpvHandle(), "estimated-vf-fps").toDouble();
+
+  KonvergoWindow* window = Globals::MainWindow();
+  PlayerQuickItem* video = window ? window->findChild<PlayerQuickItem*>("video") : nullptr;
+  if (video)
+    m_drawSum += video->meanDrawMsec();
+
+  m_samples++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackBenchmark::finishItem(const QString& error)
+{
+  if (m_current < 0 || m_current >= m_items.size())
+    return;
+
+  m_timeout.stop();
+  m_itemTimer.stop();
+  m_seekTimer.stop();
+  m_sampleTimer.stop();
+
+  qint64 elapsed = m_clock.elapsed();
+  qint64 cpuUsec = processCpuTimeUsec() - m_cpuStartUsec;
+
+  QJsonObject result = QJsonObject::fromVariantMap(PlayerComponent::Get().currentPlaybackQuality());
+  result["url"] = m_items.at(m_current).url;
+  result["timeToFirstFrameMsec"] = m_firstFrameMsec;
+  result["playedMsec"] = m_firstFrameMsec >= 0 ? elapsed - m_playStartMsec : 0;
+  result["seekLatencyMsec"] = m_seekLatencyMsec;
+  result["decodeFps"] = m_samples ? m_fpsSum / m_samples : 0.0;
+  result["renderMsecPerFrame"] = m_samples ? m_drawSum / m_samples : 0.0;
+  result["cpuMsec"] = cpuUsec / 1000;
+  result["cpuPercent"] = elapsed > 0 ? cpuUsec / 10.0 / elapsed : 0.0;
+  if (!error.isEmpty())
+    result["error"] = error;
+  m_results.append(result);
+
+  QLOG_INFO() << "Playback benchmark:" << QJsonDocument(result).toJson(QJsonDocument::Compact).constData();
+
+  // the stop emits canceled, not finished, so this isn't entered again
+  m_current++;
+  PlayerComponent::Get().stop();
+
+  // give mpv a moment to tear down the old file
+  QTimer::singleShot(1000, this, &PlaybackBenchmark::startItem);
+}
@@ -0,0 +1,72 @@
+#ifndef PLAYBACKBENCHMARK_H
+#define PLAYBACKBENCHMARK_H
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QObject>
+#include <QTimer>
+
+// how long each item plays unless its line in the list says otherwise
+#define PLAYBACK_BENCHMARK_ITEM_MSEC 30000
+// an item that doesn't show a frame within this is given up
+#define PLAYBACK_BENCHMARK_LOAD_TIMEOUT_MSEC 30000
+// how often the decoder frame rate and render time are sampled
+#define PLAYBACK_BENCHMARK_SAMPLE_MSEC 1000
+// the seek counts as done once playback is this close to the target
+#define PLAYBACK_BENCHMARK_SEEK_TOLERANCE_MSEC 2000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Plays a list of media URLs one after the other through PlayerComponent, with no web
+// client loaded, and prints a JSON array with one object per item: time to first
+// frame, decoder frame rate, dropped frames, seek latency, and CPU and render time.
+// Started with --benchmark-playback <list> in ENABLE_BENCHMARKS builds. The list has
+// one "url [seconds]" per line, # starts a comment.
+//
+class PlaybackBenchmark : public QObject
+{
+  Q_OBJECT
+public:
+  PlaybackBenchmark(const QString& listPath, QObject* parent = nullptr);
+
+  void start();
+
+private:
+  struct Item
+  {
+    QString url;
+    qint64 durationMsec;
+  };
+
+  bool loadList();
+  void startItem();
+  void finishItem(const QString& error = QString());
+  void onPlaying();
+  void onPosition(quint64 ms);
+  void sample();
+  void seek();
+
+  QString m_listPath;
+  QList<Item> m_items;
+  int m_current;
+  QJsonArray m_results;
+
+  QTimer m_timeout;
+  QTimer m_sampleTimer;
+  QTimer m_seekTimer;
+  QTimer m_itemTimer;
+
+  // the current item
+  QElapsedTimer m_clock;
+  qint64 m_firstFrameMsec;
+  qint64 m_playStartMsec;
+  qint64 m_cpuStartUsec;
+  qint64 m_seekTarget;
+  qint64 m_seekStartMsec;
+  qint64 m_seekLatencyMsec;
+  quint64 m_position;
+  double m_fpsSum;
+  double m_drawSum;
+  int m_samples;
+};
+
+#endif // PLAYBACKBENCHMARK_H
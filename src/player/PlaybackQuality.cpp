@@ -0,0 +1,82 @@
+#include "PlaybackQuality.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlaybackQuality::PlaybackQuality()
+  : m_active(false), m_frameDrops(0), m_decoderFrameDrops(0), m_delayedFrames(0),
+    m_pausedForCache(false), m_stalls(0), m_stalledMsec(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackQuality::Stat::add(double value)
+{
+  if (!count || value < min)
+    min = value;
+  if (!count || value > max)
+    max = value;
+  sum += value;
+  count++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackQuality::start()
+{
+  m_active = true;
+  m_session.start();
+  m_frameDrops = m_decoderFrameDrops = m_delayedFrames = 0;
+  m_cacheDuration.reset();
+  m_cacheSpeed.reset();
+  m_avsync.reset();
+  m_pausedForCache = false;
+  m_stalls = 0;
+  m_stalledMsec = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackQuality::stop()
+{
+  setPausedForCache(false);
+  m_active = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackQuality::setPausedForCache(bool paused)
+{
+  if (paused == m_pausedForCache)
+    return;
+
+  m_pausedForCache = paused;
+  if (paused)
+  {
+    m_stalls++;
+    m_stall.start();
+  }
+  else if (m_stall.isValid())
+  {
+    m_stalledMsec += m_stall.elapsed();
+    m_stall.invalidate();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlaybackQuality::summary() const
+{
+  qint64 stalledMsec = m_stalledMsec;
+  if (m_pausedForCache && m_stall.isValid())
+    stalledMsec += m_stall.elapsed();
+
+  QVariantMap summary;
+  summary["sessionMsec"] = m_session.isValid() ? m_session.elapsed() : 0;
+  summary["frameDrops"] = m_frameDrops;
+  summary["decoderFrameDrops"] = m_decoderFrameDrops;
+  summary["delayedFrames"] = m_delayedFrames;
+  summary["cacheStalls"] = m_stalls;
+  summary["cacheStalledMsec"] = stalledMsec;
+  summary["cacheDurationMin"] = m_cacheDuration.min;
+  summary["cacheDurationMean"] = m_cacheDuration.mean();
+  summary["cacheSpeedMin"] = m_cacheSpeed.min;
+  summary["cacheSpeedMean"] = m_cacheSpeed.mean();
+  summary["avsyncMean"] = m_avsync.mean();
+  summary["avsyncMax"] = m_avsync.max;
+  return summary;
+}
@@ -0,0 +1,64 @@
+#ifndef PLAYBACKQUALITY_H
+#define PLAYBACKQUALITY_H
+
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Aggregates what mpv reports about playback health over one file, so the
+// result can be compared across sessions (and machines). Only used from the
+// main thread.
+class PlaybackQuality
+{
+public:
+  PlaybackQuality();
+
+  // Start a new session, discarding everything collected so far.
+  void start();
+  void stop();
+  bool active() const { return m_active; }
+
+  // mpv's counters are per file, so these simply keep the last value.
+  void setFrameDrops(qint64 count) { m_frameDrops = count; }
+  void setDecoderFrameDrops(qint64 count) { m_decoderFrameDrops = count; }
+  void setDelayedFrames(qint64 count) { m_delayedFrames = count; }
+
+  void addCacheDuration(double seconds) { m_cacheDuration.add(seconds); }
+  // only while the cache is filling, a full cache reads at the bitrate
+  void addCacheSpeed(double bytesPerSecond) { m_cacheSpeed.add(bytesPerSecond); }
+  void addAvsync(double seconds) { m_avsync.add(qAbs(seconds)); }
+  void setPausedForCache(bool paused);
+
+  double cacheSpeedMean() const { return m_cacheSpeed.mean(); }
+
+  // Flat map with numbers only, suitable for JSON and the web client.
+  QVariantMap summary() const;
+
+private:
+  struct Stat
+  {
+    int count;
+    double sum, min, max;
+
+    Stat() { reset(); }
+    void reset() { count = 0; sum = min = max = 0; }
+    void add(double value);
+    double mean() const { return count ? sum / count : 0; }
+  };
+
+  bool m_active;
+  QElapsedTimer m_session;
+  qint64 m_frameDrops;
+  qint64 m_decoderFrameDrops;
+  qint64 m_delayedFrames;
+  Stat m_cacheDuration;
+  Stat m_cacheSpeed;
+  Stat m_avsync;
+  bool m_pausedForCache;
+  int m_stalls;
+  QElapsedTimer m_stall;
+  qint64 m_stalledMsec;
+};
+
+#endif // PLAYBACKQUALITY_H
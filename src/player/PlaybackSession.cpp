@@ -0,0 +1,26 @@
+#include "PlaybackSession.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackSession::start(const QElapsedTimer& origin)
+{
+  m_active = true;
+  m_phases.clear();
+
+  if (origin.isValid())
+    m_clock = origin;
+  else
+    m_clock.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackSession::mark(const QString& phase)
+{
+  set(phase, m_clock.elapsed());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlaybackSession::set(const QString& phase, qint64 msec)
+{
+  if (m_active && !m_phases.contains(phase))
+    m_phases.insert(phase, msec);
+}
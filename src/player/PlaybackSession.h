@@ -0,0 +1,36 @@
+#ifndef PLAYBACKSESSION_H
+#define PLAYBACKSESSION_H
+
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// When the steps of starting playback of one file happened, in msecs since it was loaded.
+// Each phase keeps the first time it was reached, the on_load and on_preloaded hooks run again
+// for stream switches. Only used from the main thread.
+class PlaybackSession
+{
+public:
+  PlaybackSession() : m_active(false) {}
+
+  // The clock runs from origin (when load() was called), or from now if it isn't valid.
+  void start(const QElapsedTimer& origin = QElapsedTimer());
+  void stop() { m_active = false; }
+  bool active() const { return m_active; }
+
+  // phase was reached now, or took msec
+  void mark(const QString& phase);
+  void set(const QString& phase, qint64 msec);
+  bool reached(const QString& phase) const { return m_phases.contains(phase); }
+
+  // {phase: msec}
+  const QVariantMap& phases() const { return m_phases; }
+  qint64 elapsed() const { return m_clock.isValid() ? m_clock.elapsed() : 0; }
+
+private:
+  bool m_active;
+  QElapsedTimer m_clock;
+  QVariantMap m_phases;
+};
+
+#endif // PLAYBACKSESSION_H
@@ -4,15 +4,26 @@
 #include <QDir>
 #include <QCoreApplication>
 #include <QGuiApplication>
+#include <QJsonDocument>
+#include <QDateTime>
 #include "display/DisplayComponent.h"
 #include "settings/SettingsComponent.h"
 #include "system/SystemComponent.h"
 #include "utils/Utils.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
+#include "utils/HostResolver.h"
+#include "utils/BandwidthEstimator.h"
+#include "utils/MemoryPressure.h"
+#include "utils/AllocationTracker.h"
 #include "ComponentManager.h"
 #include "settings/SettingsSection.h"
+#include "settings/SettingsKey.h"
 
 #include "PlayerQuickItem.h"
+#include "AudioCapabilities.h"
+#include "DownloadProgress.h"
+#include "SessionMetrics.h"
 #include "input/InputComponent.h"
 
 #include "QsLog.h"
@@ -34,6 +45,21 @@
 #include <interface/vmcs_host/vcgencmd.h>
 #endif
 
+// how long audio-device-list has to be quiet before the devices are looked at
+#define AUDIO_DEVICE_LIST_SETTLE_MSEC 750
+// how often the cache sizes are reconsidered with the measured throughput
+#define CACHE_POLICY_REVIEW_MSEC 15000
+// how often the dropped and delayed frame counts are read during playback
+#define FRAME_COUNTER_SAMPLE_MSEC 2000
+// how long video has to play without the OSD before the web view stops rendering
+#define WEB_SUSPEND_DELAY_MSEC 5000
+// with more dropped/repeated frames per hour than this, display-resample is used instead
+#define DISPLAY_RESAMPLE_MIN_FRAME_ERRORS 60
+// how much display-resample may change the playback speed, like mpv's video-sync-max-video-change
+#define DISPLAY_RESAMPLE_MAX_SPEED_CHANGE 0.01
+// items prepareMedia() remembers, the web client prepares whatever gets selected
+#define PREPARED_MEDIA_CACHE_SIZE 32
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static void wakeup_cb(void *context)
 {
@@ -44,14 +70,20 @@ static void wakeup_cb(void *context)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerComponent::PlayerComponent(QObject* parent)
-  : ComponentBase(parent), m_state(State::finished), m_paused(false), m_playbackActive(false),
-  m_windowVisible(false), m_videoPlaybackActive(false), m_inPlayback(false), m_playbackCanceled(false),
+  : ComponentBase(parent), m_nextAsyncReply(1), m_state(State::finished), m_paused(false), m_playbackActive(false),
+  m_windowVisible(false), m_osdVisible(true), m_videoOnlyMode(false), m_webSuspended(false), m_videoPlaybackActive(false), m_inPlayback(false), m_playbackCanceled(false),
   m_bufferingPercentage(100), m_lastBufferingPercentage(-1),
-  m_lastPositionUpdate(0.0), m_playbackAudioDelay(0),
-  m_window(nullptr), m_mediaFrameRate(0),
-  m_restoreDisplayTimer(this), m_reloadAudioTimer(this),
-  m_streamSwitchImminent(false), m_doAc3Transcoding(false),
-  m_videoRectangle(-1, -1, -1, -1)
+  m_lastPositionUpdate(0.0), m_pendingPosition(0.0), m_lastSnapshotPaused(false),
+  m_lastSnapshotBuffering(100), m_snapshotTimer(this), m_playbackAudioDelay(0),
+  m_window(nullptr), m_mediaFrameRate(0), m_mediaHDRFormat(DM_HDR_NONE), m_mediaIsMusic(false), m_videoAspect(0),
+  m_webSuspendTimer(this), m_restoreDisplayTimer(this), m_reloadAudioTimer(this), m_audioDeviceListTimer(this),
+  m_cachePolicyTimer(this), m_cacheSizes(), m_frameCounterTimer(this),
+  m_debugOverlayActive(false), m_debugObserverId(0), m_debugDirty(true), m_debugDisplayFps(0),
+  m_scrubbing(false), m_scrubSeekInFlight(false), m_scrubTarget(-1),
+  m_streamSwitchImminent(false), m_displaySwitchPending(false), m_doAc3Transcoding(false), m_prewarmFetcher(nullptr), m_prepareFetcher(nullptr),
+  m_audioProfileApplied(false), m_displayResample(false),
+  m_queueMediaMsec(0), m_cacheSpeed(0), m_cacheDuration(0), m_mediaDuration(0), m_stallPredicted(false), m_cachePauseWait(1),
+  m_videoRectangle(-1, -1, -1, -1), m_videoRectangleBlit(false)
 {
   qmlRegisterType<PlayerQuickItem>("Konvergo", 1, 0, "MpvVideo"); // deprecated name
   qmlRegisterType<PlayerQuickItem>("Konvergo", 1, 0, "KonvergoVideo");
@@ -60,15 +92,59 @@ PlayerComponent::PlayerComponent(QObject* parent)
   connect(&m_restoreDisplayTimer, &QTimer::timeout, this, &PlayerComponent::onRestoreDisplay);
 
   connect(&DisplayComponent::Get(), &DisplayComponent::refreshRateChanged, this, &PlayerComponent::onRefreshRateChange);
+  connect(&DisplayComponent::Get(), &DisplayComponent::videoModeSwitched, this, &PlayerComponent::onVideoModeSwitched);
 
   m_reloadAudioTimer.setSingleShot(true);
   connect(&m_reloadAudioTimer, &QTimer::timeout, this, &PlayerComponent::updateAudioDevice);
+
+  // HDMI hotplug on TVs tends to come in bursts, look at the list once it settled
+  m_audioDeviceListTimer.setSingleShot(true);
+  m_audioDeviceListTimer.setInterval(AUDIO_DEVICE_LIST_SETTLE_MSEC);
+  connect(&m_audioDeviceListTimer, &QTimer::timeout, this, &PlayerComponent::updateAudioDeviceList);
+
+  connect(&m_snapshotTimer, &QTimer::timeout, this, &PlayerComponent::flushPlaybackSnapshot);
+
+  m_cachePolicyTimer.setInterval(CACHE_POLICY_REVIEW_MSEC);
+  connect(&m_cachePolicyTimer, &QTimer::timeout, this, &PlayerComponent::reviewCachePolicy);
+
+  m_frameCounterTimer.setInterval(FRAME_COUNTER_SAMPLE_MSEC);
+  m_frameCounterTimer.setTimerType(Qt::CoarseTimer);
+  connect(&m_frameCounterTimer, &QTimer::timeout, this, &PlayerComponent::sampleFrameCounters);
+
+  m_webSuspendTimer.setSingleShot(true);
+  m_webSuspendTimer.setInterval(WEB_SUSPEND_DELAY_MSEC);
+  connect(&m_webSuspendTimer, &QTimer::timeout, this, [=]() { setWebSuspended(true); });
+
+  connect(&DownloadProgress::Get(), &DownloadProgress::progress, this, &PlayerComponent::codecDownloadProgress);
+
+  m_thumbnails = new ThumbnailExtractor(this);
+  connect(m_thumbnails, &ThumbnailExtractor::ready, this, [=](qint64 positionMs, int width, const QByteArray& jpeg)
+  {
+    QString image = jpeg.isEmpty() ? QString() : "data:image/jpeg;base64," + QString::fromLatin1(jpeg.toBase64());
+    emit thumbnailReady(positionMs, width, image);
+  });
+
+  // mpv drops what's over the new limits on its own
+  connect(&MemoryPressure::Get(), &MemoryPressure::levelChanged, this, [=](MemoryPressure::Level level)
+  {
+    m_cachePolicy.setMemoryShare(MemoryPressure::share(level));
+    if (m_mpv)
+      applyCachePolicy();
+    // they are extracted again if they're asked for
+    if (level != MemoryPressure::Normal)
+      m_thumbnails->clear();
+  });
+
+  m_rebufferClock.start();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::componentPostInitialize()
 {
-  InputComponent::Get().registerHostCommand("player", this, "userCommand");
+  InputComponent::Get().registerHostCommand("player", this, &PlayerComponent::userCommand);
+
+  // remotes, CEC and the like, the window's own input is seen by eventFilter()
+  connect(&InputComponent::Get(), &InputComponent::receivedInput, this, &PlayerComponent::wakeWebView);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -86,7 +162,7 @@ bool PlayerComponent::componentInitialize()
     throw FatalException(tr("Failed to load mpv."));
 
   mpv_request_log_messages(m_mpv, "terminal-default");
-  mpv::qt::set_property(m_mpv, "msg-level", "all=v");
+  updateLogLevels();
 
   // Configuration properties defined in the mpv.conf will override our
   // hardcoded properties below.
@@ -128,6 +204,10 @@ bool PlayerComponent::componentInitialize()
   // See: https://github.com/plexinc/plex-media-player/issues/736
   mpv::qt::set_property(m_mpv, "cache-seek-min", 5000);
 
+  // Open the next playlist entry and fill its cache while the current one is
+  // ending, so queued episodes start without waiting for the network.
+  mpv::qt::set_property(m_mpv, "prefetch-playlist", true);
+
   mpv::qt::set_property(m_mpv, "tls-verify", "yes");
 
 #if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
@@ -156,14 +236,8 @@ bool PlayerComponent::componentInitialize()
     throw FatalException(tr("Failed to locate CA bundle."));
 #endif
 
-  // Apply some low-memory settings on RPI, which is relatively memory-constrained.
+  // The cache and demuxer queue sizes are chosen by applyCachePolicy().
 #ifdef TARGET_RPI
-  // The backbuffer makes seeking back faster (without having to do a HTTP-level seek)
-  mpv::qt::set_property(m_mpv, "cache-backbuffer", 10 * 1024); // KB
-  // The demuxer queue is used for the readahead, and also for dealing with badly
-  // interlaved audio/video. Setting it too low increases sensitivity to network
-  // issues, and could cause playback failure with "bad" files.
-  mpv::qt::set_property(m_mpv, "demuxer-max-bytes", 50 * 1024 * 1024); // bytes
   // Specifically for enabling mpeg4.
   mpv::qt::set_property(m_mpv, "hwdec-codecs", "all");
   // Do not use exact seeks by default. (This affects the start position in the "loadfile"
@@ -176,14 +250,112 @@ bool PlayerComponent::componentInitialize()
   if (mpv_initialize(m_mpv) < 0)
     throw FatalException(tr("Failed to initialize mpv."));
 
-  mpv_observe_property(m_mpv, 0, "pause", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "core-idle", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "cache-buffering-state", MPV_FORMAT_INT64);
-  mpv_observe_property(m_mpv, 0, "playback-time", MPV_FORMAT_DOUBLE);
-  mpv_observe_property(m_mpv, 0, "vo-configured", MPV_FORMAT_FLAG);
-  mpv_observe_property(m_mpv, 0, "duration", MPV_FORMAT_DOUBLE);
-  mpv_observe_property(m_mpv, 0, "audio-device-list", MPV_FORMAT_NODE);
-  mpv_observe_property(m_mpv, 0, "video-dec-params", MPV_FORMAT_NODE);
+  observeProperty("pause", MPV_FORMAT_FLAG, [=](mpv_event_property* prop)
+  {
+    if (prop->format == MPV_FORMAT_FLAG)
+      m_paused = !!*(int *)prop->data;
+  });
+
+  observeProperty("core-idle", MPV_FORMAT_FLAG, [=](mpv_event_property* prop)
+  {
+    if (prop->format == MPV_FORMAT_FLAG)
+      m_playbackActive = !*(int *)prop->data;
+  });
+
+  observeProperty("cache-buffering-state", MPV_FORMAT_INT64, [=](mpv_event_property* prop)
+  {
+    m_bufferingPercentage = prop->format == MPV_FORMAT_INT64 ? (int)*(int64_t *)prop->data : 100;
+  });
+
+  observeProperty("playback-time", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    if (prop->format != MPV_FORMAT_DOUBLE)
+      return;
+
+    m_pendingPosition = *(double*)prop->data;
+    if (fabs(m_pendingPosition - m_lastPositionUpdate) > 0.015)
+      queuePlaybackSnapshot();
+  });
+
+  observeProperty("vo-configured", MPV_FORMAT_FLAG, [=](mpv_event_property* prop)
+  {
+    int state = prop->format == MPV_FORMAT_FLAG ? *(int *)prop->data : 0;
+    m_windowVisible = state;
+    emit windowVisible(m_windowVisible);
+  });
+
+  observeProperty("duration", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    m_mediaDuration = prop->format == MPV_FORMAT_DOUBLE ? *(double *)prop->data : 0;
+    if (prop->format == MPV_FORMAT_DOUBLE)
+      emit updateDuration(m_mediaDuration * 1000.0);
+  });
+
+  // Playback health, aggregated per file by m_quality. The frame counters are read by
+  // sampleFrameCounters() instead, observing them is an event per late frame.
+  observeProperty("demuxer-cache-duration", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    m_cacheDuration = prop->format == MPV_FORMAT_DOUBLE ? *(double *)prop->data : 0;
+    if (m_quality.active() && prop->format == MPV_FORMAT_DOUBLE)
+      m_quality.addCacheDuration(m_cacheDuration);
+    if (m_inPlayback && prop->format == MPV_FORMAT_DOUBLE)
+      updateRebufferPrediction();
+  });
+
+  observeProperty("cache-speed", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    m_cacheSpeed = prop->format == MPV_FORMAT_DOUBLE ? *(double *)prop->data : 0;
+
+    // Once the cache is as full as it may get, mpv only reads as fast as it plays, which says
+    // nothing about the network (and would make reviewCachePolicy() think it's slow).
+    bool filling = m_bufferingPercentage < 100 || m_cacheDuration < m_cacheSizes.readaheadSecs;
+    if (m_quality.active() && filling && prop->format == MPV_FORMAT_DOUBLE)
+      m_quality.addCacheSpeed(m_cacheSpeed);
+    if (m_inPlayback && filling && !m_mediaServer.isEmpty())
+      BandwidthEstimator::Get().addRate(m_mediaServer, m_cacheSpeed);
+  });
+
+  observeProperty("avsync", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    if (m_quality.active() && prop->format == MPV_FORMAT_DOUBLE)
+      m_quality.addAvsync(*(double *)prop->data);
+    if (m_playbackActive && prop->format == MPV_FORMAT_DOUBLE)
+      m_audioSync.addAvsync(*(double *)prop->data);
+  });
+
+  observeProperty("total-avsync-change", MPV_FORMAT_DOUBLE, [=](mpv_event_property* prop)
+  {
+    if (m_inPlayback && prop->format == MPV_FORMAT_DOUBLE)
+      m_audioSync.setAvsyncChange(*(double *)prop->data);
+  });
+
+  observeProperty("paused-for-cache", MPV_FORMAT_FLAG, [=](mpv_event_property* prop)
+  {
+    if (m_quality.active())
+      m_quality.setPausedForCache(prop->format == MPV_FORMAT_FLAG && *(int *)prop->data);
+  });
+
+  // The node properties are read in place, there's no need to fetch (and convert) them again.
+  observeProperty("audio-device-list", MPV_FORMAT_NODE, [=](mpv_event_property*)
+  {
+    // restarting it merges a burst of changes into one update
+    m_audioDeviceListTimer.start();
+  });
+
+  observeProperty("video-dec-params", MPV_FORMAT_NODE, [=](mpv_event_property* prop)
+  {
+    mpv::qt::node_view params(prop->format == MPV_FORMAT_NODE ? (mpv_node *)prop->data : nullptr);
+    m_videoAspect = params["aspect"].to_double();
+
+    // Aspect might be known now (or it changed during playback), so update settings
+    // dependent on the aspect ratio.
+    updateVideoAspectSettings();
+    updateVideoRectangleGeometry();
+  });
+
+  // The debug overlay properties share one id, so they can be unobserved at once.
+  m_propertyHandlers.append([=](mpv_event_property* prop) { updateDebugValue(prop); });
+  m_debugObserverId = (uint64_t)m_propertyHandlers.size();
 
   // Setup a hook with the ID 1, which is run during the file is loaded.
   // Used to delay playback start for display framerate switching.
@@ -194,6 +366,8 @@ bool PlayerComponent::componentInitialize()
   // We use it to initialize stream selections and to probe the codecs.
   mpv::qt::command(m_mpv, QStringList() << "hook-add" << "on_preloaded" << "2" << "0");
 
+  m_audioSync.load(SettingsComponent::Get().value(SETTINGS_SECTION_STATE, "audioSyncProfiles").toMap());
+
   updateAudioDeviceList();
   setAudioConfiguration();
   updateSubtitleSettings();
@@ -208,6 +382,13 @@ bool PlayerComponent::componentInitialize()
   connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_AUDIO), &SettingsSection::valuesUpdated,
           this, &PlayerComponent::setAudioConfiguration);
 
+  connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_MAIN), &SettingsSection::valuesUpdated,
+          this, [=](const QVariantMap& values)
+  {
+    if (values.contains("mpvLogLevels"))
+      updateLogLevels();
+  });
+
   initializeCodecSupport();
   Codecs::initCodecs();
 
@@ -231,6 +412,66 @@ bool PlayerComponent::componentInitialize()
   return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::observeProperty(const char* name, mpv_format format, const PropertyHandler& handler)
+{
+  m_propertyHandlers.append(handler);
+  m_propertyIds.insert(name, (uint64_t)m_propertyHandlers.size());
+  mpv_observe_property(m_mpv, (uint64_t)m_propertyHandlers.size(), name, format);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::commandAsync(const QVariant& args, const ReplyHandler& handler)
+{
+  mpv::qt::node_builder node(args);
+  submitCommand(args.toList().value(0).toString(), node.node(), handler);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::commandAsync(mpv::qt::command_builder& command, const ReplyHandler& handler)
+{
+  mpv_node* node = command.node();
+  submitCommand(mpv::qt::node_view(node)[0].to_string(), node, handler);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::submitCommand(const QString& name, mpv_node* command, const ReplyHandler& handler)
+{
+  uint64_t id = m_nextAsyncReply++;
+  // only the command name, the arguments can contain tokens
+  m_asyncReplies.insert(id, { name, handler });
+
+  // mpv copies the command, it doesn't have to outlive this call
+  int err = mpv_command_node_async(m_mpv, id, command);
+  if (err < 0)
+    handleAsyncReply(id, err, QVariant());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::setPropertyAsync(const QString& name, const QVariant& value, const ReplyHandler& handler)
+{
+  uint64_t id = m_nextAsyncReply++;
+  m_asyncReplies.insert(id, { "set " + name, handler });
+
+  mpv::qt::node_builder node(value);
+  int err = mpv_set_property_async(m_mpv, id, name.toUtf8().data(), MPV_FORMAT_NODE, node.node());
+  if (err < 0)
+    handleAsyncReply(id, err, QVariant());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::handleAsyncReply(uint64_t id, int error, const QVariant& result)
+{
+  if (!m_asyncReplies.contains(id))
+    return;
+
+  AsyncReply reply = m_asyncReplies.take(id);
+  if (reply.handler)
+    reply.handler(error, result);
+  else if (error < 0)
+    QLOG_WARN() << "mpv:" << reply.description << "failed:" << mpv_error_string(error);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setVideoRectangle(int x, int y, int w, int h)
 {
@@ -238,10 +479,46 @@ void PlayerComponent::setVideoRectangle(int x, int y, int w, int h)
   if (rc != m_videoRectangle)
   {
     m_videoRectangle = rc;
+    updateVideoRectangleGeometry();
     emit onVideoRecangleChanged();
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateVideoRectangleGeometry()
+{
+  if (!m_mpv)
+    return;
+
+  double zoom = 0.0, panX = 0.0, panY = 0.0;
+
+  if (!m_videoRectangleBlit && m_window && m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0)
+  {
+    QSizeF window = QSizeF(m_window->size() * m_window->devicePixelRatio());
+    double aspect = m_videoAspect;
+
+    if (aspect > 0 && window.width() > 0 && window.height() > 0 &&
+        m_videoRectangle != QRect(QPoint(0, 0), window.toSize()))
+    {
+      // mpv fits the video into the whole window and then scales it by 2^zoom
+      // and moves it by pan * (scaled video size). Pick the values that make the
+      // fitted video end up letterboxed inside m_videoRectangle instead.
+      double windowWidth = qMin(window.width(), window.height() * aspect);
+      double rectWidth = qMin((double)m_videoRectangle.width(), m_videoRectangle.height() * aspect);
+      double rectHeight = rectWidth / aspect;
+      QPointF center = QRectF(m_videoRectangle).center();
+
+      zoom = log2(rectWidth / windowWidth);
+      panX = (center.x() - window.width() / 2.0) / rectWidth;
+      panY = (center.y() - window.height() / 2.0) / rectHeight;
+    }
+  }
+
+  mpv::qt::set_property(m_mpv, "video-zoom", zoom);
+  mpv::qt::set_property(m_mpv, "video-pan-x", panX);
+  mpv::qt::set_property(m_mpv, "video-pan-y", panY);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setQtQuickWindow(QQuickWindow* window)
 {
@@ -255,9 +532,13 @@ void PlayerComponent::setQtQuickWindow(QQuickWindow* window)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setWindow(QQuickWindow* window)
 {
-  QString vo = "opengl-cb";
+  QString vo = PLAYER_QUICK_VO;
 
 #ifdef TARGET_RPI
+  // The rpi vo puts the decoded video on its own DispmanX layer under the
+  // (transparent) window, and the HVS combines them during scanout. GL only
+  // renders when the web view changes, it never touches the video. See
+  // KonvergoWindow for the window side of this.
   window->setFlags(Qt::FramelessWindowHint);
   vo = "rpi";
 #endif
@@ -272,15 +553,41 @@ void PlayerComponent::setWindow(QQuickWindow* window)
 
   mpv::qt::set_property(m_mpv, "vo", vo);
 
-  if (vo == "opengl-cb")
+  if (vo == PLAYER_QUICK_VO)
     setQtQuickWindow(window);
+
+  connect(window, &QQuickWindow::widthChanged, this, &PlayerComponent::updateVideoRectangleGeometry);
+  connect(window, &QQuickWindow::heightChanged, this, &PlayerComponent::updateVideoRectangleGeometry);
+
+  window->installEventFilter(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlayerComponent::eventFilter(QObject* watched, QEvent* event)
+{
+  switch (event->type())
+  {
+    case QEvent::KeyPress:
+    case QEvent::MouseMove:
+    case QEvent::MouseButtonPress:
+    case QEvent::Wheel:
+    case QEvent::TouchBegin:
+      wakeWebView();
+      break;
+    default:
+      break;
+  }
+
+  return ComponentBase::eventFilter(watched, event);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool PlayerComponent::load(const QString& url, const QVariantMap& options, const QVariantMap &metadata, const QString& audioStream , const QString& subtitleStream)
 {
   stop();
+  m_loadClock.start();
   queueMedia(url, options, metadata, audioStream, subtitleStream);
+  m_queueMediaMsec = m_loadClock.elapsed();
   return true;
 }
 
@@ -306,58 +613,120 @@ void PlayerComponent::queueMedia(const QString& url, const QVariantMap& options,
 {
   InputComponent::Get().cancelAutoRepeat();
 
-  m_mediaFrameRate = metadata["frameRate"].toFloat(); // returns 0 on failure
-  m_serverMediaInfo = metadata["media"].toMap();
+  // Applied once mpv starts this file. Until then the current file (if any) keeps its state.
+  QueuedMedia queued;
+  queued.frameRate = metadata["frameRate"].toFloat(); // returns 0 on failure
+  queued.music = metadata["type"] == "music";
+  queued.serverMediaInfo = metadata["media"].toMap();
+  auto prepared = m_preparedMedia.constFind(url);
+  if (prepared != m_preparedMedia.constEnd())
+  {
+    queued.hdrFormat = prepared->hdrFormat;
+    queued.serverStreams = prepared->serverStreams;
+  }
+  else
+  {
+    queued.hdrFormat = serverHDRFormat(queued.serverMediaInfo);
+    queued.serverStreams = indexServerStreams(queued.serverMediaInfo);
+  }
+  // resolved now, so the on_preloaded hook only has to look them up
+  queued.audioStream = parseStreamSelection(audioStream, MediaType::Audio);
+  queued.subtitleStream = parseStreamSelection(subtitleStream, MediaType::Subtitle);
+  QUrl serverUrl(url);
+  if (serverUrl.scheme() == "http" || serverUrl.scheme() == "https")
+    queued.server = BandwidthEstimator::serverKey(serverUrl);
+  m_queuedMedia.append(queued);
+
+  // Resolve the next episode's codecs now, so there's nothing left to download
+  // when it's loaded. prepareMedia() already did.
+  if (m_inPlayback && prepared == m_preparedMedia.constEnd())
+    prefetchCodecs(queued.serverMediaInfo);
+
+  // EAE takes a moment to start, with an idle box it's not running
+  for (const StreamInfo& stream : serverStreams(queued.serverMediaInfo))
+  {
+    if (stream.isAudio && (stream.codec == "eac3" || stream.codec == "truehd"))
+    {
+      Codecs::prewarmEAE();
+      break;
+    }
+  }
 
   updateVideoSettings();
 
   QUrl qurl = url;
   QString host = qurl.host();
+  QString hostHeader;
   if (IsPlexDirectURL(host))
+  {
     qurl.setHost(ConvertPlexDirectURL(host));
+  }
+  else if (qurl.scheme() == "http")
+  {
+    // With plain http the name only matters for the Host header, so the address that
+    // connected fastest last time can be used directly. https would need the name for SNI.
+    quint16 port = qurl.port(80);
+    QHostAddress address = HostResolver::Get().fastestAddress(host, port);
+    if (!address.isNull())
+    {
+      hostHeader = qurl.port() == -1 ? host : host + ":" + QString::number(port);
+      qurl.setHost(address.protocol() == QAbstractSocket::IPv6Protocol ? "[" + address.toString() + "]" : address.toString());
+    }
+    // for the next file from this server, if the result is getting old
+    HostResolver::Get().prepare(host, port);
+  }
 
-  QVariantList command;
-  command << "loadfile" << qurl.toString(QUrl::FullyEncoded);
-  command << "append-play"; // if nothing is playing, play it now, otherwise just enqueue it
+  mpv::qt::command_builder command;
+  command.add("loadfile").add(qurl.toString(QUrl::FullyEncoded));
+  command.add("append-play"); // if nothing is playing, play it now, otherwise just enqueue it
 
-  QVariantMap extraArgs;
+  command.begin_map();
 
   quint64 startMilliseconds = options["startMilliseconds"].toLongLong();
   if (startMilliseconds != 0)
-    extraArgs.insert("start", "+" + QString::number(startMilliseconds / 1000.0));
+    command.add_option("start", "+" + QString::number(startMilliseconds / 1000.0));
 
   // we're going to select these streams later, in the preloaded hook
-  extraArgs.insert("aid", "no");
-  extraArgs.insert("sid", "no");
-
-  m_currentSubtitleStream = subtitleStream;
-  m_currentAudioStream = audioStream;
+  command.add_option("aid", "no");
+  command.add_option("sid", "no");
 
-  if (metadata["type"] == "music")
-    extraArgs.insert("vid", "no");
+  if (queued.music)
+  {
+    command.add_option("vid", "no");
+    // With "yes" the audio output stays in the format of the first track and the following
+    // ones are converted to it, so a queue of tracks with different sample rates doesn't
+    // reopen the device between them. That is what makes multi-room receivers drop out.
+    // As a loadfile option it only applies to this file, anything after it gets mpv's
+    // default ("weak") back.
+    command.add_option("gapless-audio", "yes");
+  }
 
-  extraArgs.insert("pause", options["autoplay"].toBool() ? "no" : "yes");
+  command.add_option("pause", options["autoplay"].toBool() ? "no" : "yes");
 
   QString userAgent = metadata["headers"].toMap()["User-Agent"].toString();
   if (userAgent.size())
-    extraArgs.insert("user-agent", userAgent);
+    command.add_option("user-agent", userAgent);
 
   // Make sure the list of requested codecs is reset.
-  extraArgs.insert("ad", "");
-  extraArgs.insert("vd", "");
+  command.add_option("ad", "");
+  command.add_option("vd", "");
 
   if (IsPlexDirectURL(host))
-    extraArgs.insert("stream-lavf-o", "verifyhost=" + host);
+    command.add_option("stream-lavf-o", "verifyhost=" + host);
 
-  command << extraArgs;
+  if (!hostHeader.isEmpty())
+    command.add_option("http-header-fields", "Host: " + hostHeader);
 
-  mpv::qt::command(m_mpv, command);
+  command.end_map();
+
+  commandAsync(command);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::streamSwitch()
 {
   m_streamSwitchImminent = true;
+  m_latency.start(OperationLatency::StreamSwitch);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -391,18 +760,76 @@ bool PlayerComponent::switchDisplayFrameRate()
   // still in-flight. It could switch the display back after we've switched.
   m_restoreDisplayTimer.stop();
 
+  int hdrFormat = DM_HDR_NONE;
+  if (SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.hdr_switch").toBool())
+    hdrFormat = m_mediaHDRFormat;
+
   DisplayComponent* display = &DisplayComponent::Get();
-  if (!display->switchToBestVideoMode(m_mediaFrameRate))
+  if (!display->switchToBestVideoModeAsync(m_mediaFrameRate, hdrFormat))
   {
     QLOG_DEBUG() << "Switching refresh-rate failed or unnecessary.";
     return false;
   }
 
-  // Make sure settings dependent on the display refresh rate are updated properly.
-  updateVideoSettings();
+  m_displaySwitchPending = true;
   return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateSyncMode()
+{
+  bool resample = false;
+
+  QString syncMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "sync_mode").toString();
+  if (m_mediaFrameRate >= 1 && syncMode == "audio" &&
+      SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.resample_fallback").toBool())
+  {
+    double refreshRate = DisplayComponent::Get().currentRefreshRate();
+    int cadence = 1;
+    double errors = DisplayManager::FrameErrorsPerHour(refreshRate, m_mediaFrameRate, &cadence);
+
+    // Resampling only fixes a small drift. With a cadence that doesn't fit (like
+    // 24fps at 60Hz) mpv would give up on it anyway.
+    double speedChange = fabs(refreshRate / cadence - m_mediaFrameRate) / m_mediaFrameRate;
+    resample = errors > DISPLAY_RESAMPLE_MIN_FRAME_ERRORS && speedChange <= DISPLAY_RESAMPLE_MAX_SPEED_CHANGE;
+
+    QLOG_DEBUG() << m_mediaFrameRate << "fps at" << refreshRate << "Hz drops or repeats" << errors
+                 << "frames per hour," << (resample ? "resampling to the display" : "syncing to audio");
+  }
+
+  if (resample == m_displayResample)
+    return;
+
+  m_displayResample = resample;
+  updateVideoSettings();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::waitForDisplaySwitch(std::function<void()> resume)
+{
+  if (m_displaySwitchPending)
+    m_displaySwitchWaiters.append(resume);
+  else
+    resume();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::onVideoModeSwitched(bool success)
+{
+  if (!m_displaySwitchPending)
+    return;
+
+  QLOG_INFO() << "Refresh rate switch" << (success ? "done" : "failed") << "- continuing playback";
+
+  // The display component re-initialized itself, so refreshRateChanged() has already updated
+  // the settings that depend on the refresh rate.
+  m_displaySwitchPending = false;
+  QList<std::function<void()>> waiters = m_displaySwitchWaiters;
+  m_displaySwitchWaiters.clear();
+  for (auto waiter : waiters)
+    waiter();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::onRestoreDisplay()
 {
@@ -416,6 +843,10 @@ void PlayerComponent::onRefreshRateChange()
 {
   // Make sure settings dependent on the display refresh rate are updated properly.
   updateVideoSettings();
+
+  // the receiver's latency can be different in the new mode
+  if (m_inPlayback)
+    updateAudioSyncOutput();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -460,6 +891,12 @@ void PlayerComponent::updatePlaybackState()
       break;
     case State::playing:
       QLOG_INFO() << "Entering state: playing";
+      if (m_session.active() && !m_session.reached("firstFrame"))
+      {
+        m_session.mark("firstFrame");
+        m_sessionDecoder = mpv::qt::get_property(m_mpv, "hwdec-current").toString();
+        m_sessionVideoCodec = mpv::qt::get_property(m_mpv, "video-codec").toString();
+      }
       emit playing();
       break;
     case State::buffering:
@@ -489,22 +926,128 @@ void PlayerComponent::updatePlaybackState()
     emit buffering(m_bufferingPercentage);
   m_lastBufferingPercentage = m_bufferingPercentage;
 
+  if (m_paused != m_lastSnapshotPaused || m_bufferingPercentage != m_lastSnapshotBuffering)
+    queuePlaybackSnapshot();
+
   bool is_videoPlaybackActive = m_state == State::playing && m_windowVisible;
   if (m_videoPlaybackActive != is_videoPlaybackActive)
   {
     m_videoPlaybackActive = is_videoPlaybackActive;
     emit videoPlaybackActive(m_videoPlaybackActive);
+    updateWebLayer();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::queuePlaybackSnapshot()
+{
+  // A flush is already scheduled and will pick up the new values.
+  if (m_snapshotTimer.isActive())
+    return;
+
+  flushPlaybackSnapshot();
+
+  static SettingsKey<int> positionUpdateRate(SETTINGS_SECTION_MAIN, "positionUpdateRate");
+  int rate = positionUpdateRate.value();
+  if (rate > 0)
+    m_snapshotTimer.start(1000 / rate);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::flushPlaybackSnapshot()
+{
+  bool positionChanged = fabs(m_pendingPosition - m_lastPositionUpdate) > 0.015;
+  if (!positionChanged && m_paused == m_lastSnapshotPaused &&
+      m_bufferingPercentage == m_lastSnapshotBuffering)
+  {
+    // Nothing happened during the last interval, go idle until the next change.
+    m_snapshotTimer.stop();
+    return;
+  }
+
+  quint64 ms = (quint64)(qMax(m_pendingPosition * 1000.0, 0.0));
+  if (positionChanged)
+  {
+    emit positionUpdate(ms);
+    m_lastPositionUpdate = m_pendingPosition;
   }
+
+  m_lastSnapshotPaused = m_paused;
+  m_lastSnapshotBuffering = m_bufferingPercentage;
+  emit playbackSnapshot(ms, m_paused, m_bufferingPercentage);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::handleMpvEvent(mpv_event *event)
 {
+  ALLOCATION_TAG(Player);
   switch (event->event_id)
   {
     case MPV_EVENT_START_FILE:
     {
       m_inPlayback = true;
+      m_quality.start();
+      m_frameCounterTimer.start();
+      // what's downloading is finished, the rest waits until nothing plays
+      if (m_prewarmFetcher)
+        m_prewarmFetcher->setPaused(true);
+
+      // Files mpv moves on to by itself (the playlist) weren't load()ed, they start now.
+      m_session.start(m_loadClock);
+      if (m_loadClock.isValid())
+        m_session.set("queueMedia", m_queueMediaMsec);
+      m_loadClock.invalidate();
+      m_session.mark("startFile");
+      m_sessionDecoder.clear();
+      m_sessionVideoCodec.clear();
+      m_latency.reset();
+
+      // this comes before the on_load hook, which uses these
+      if (!m_queuedMedia.isEmpty())
+      {
+        QueuedMedia queued = m_queuedMedia.takeFirst();
+        m_mediaFrameRate = queued.frameRate;
+        m_mediaHDRFormat = queued.hdrFormat;
+        m_mediaServer = queued.server;
+        m_mediaIsMusic = queued.music;
+        m_serverMediaInfo = queued.serverMediaInfo;
+        m_serverStreams = queued.serverStreams;
+        m_currentAudioStream = queued.audioStream;
+        m_currentSubtitleStream = queued.subtitleStream;
+      }
+
+      // mpv opens the stream only once the on_load hook is done, so this
+      // still applies to the file that is starting.
+      m_cachePolicy.setBitrate(CachePolicy::bitrateFromMediaInfo(m_serverMediaInfo));
+      m_cachePolicy.setThroughput(0);
+      m_cachePolicy.setAudioOnly(m_mediaIsMusic);
+      applyCachePolicy();
+      m_cachePolicyTimer.start();
+      resetRebufferPrediction();
+      break;
+    }
+    case MPV_EVENT_PLAYBACK_RESTART:
+    {
+      // seeks and the first frame of a file both end with this
+      finishOperation(OperationLatency::Seek);
+      if (!m_streamSwitchImminent)
+        finishOperation(OperationLatency::StreamSwitch);
+      break;
+    }
+    case MPV_EVENT_AUDIO_RECONFIG:
+    {
+      // the decoder and output are set up for the new track
+      finishOperation(OperationLatency::AudioSwitch);
+      // passthrough or PCM is only known now
+      if (m_inPlayback)
+        updateAudioSyncOutput();
+      break;
+    }
+    case MPV_EVENT_SEEK:
+    {
+      // the cache is dropped or jumps ahead, neither is the network
+      m_rebuffer.reset();
+      m_stallPredicted = false;
       break;
     }
     case MPV_EVENT_END_FILE:
@@ -512,6 +1055,19 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
       mpv_event_end_file *endFile = (mpv_event_end_file *)event->data;
 
       m_inPlayback = false;
+      m_cachePolicyTimer.stop();
+      // the counters are gone with the file, the last sample is what the summary gets
+      m_frameCounterTimer.stop();
+
+      // whatever still ran was for this file, a stream switch finishes with the next one
+      m_latency.cancel(OperationLatency::Seek);
+      m_latency.cancel(OperationLatency::AudioSwitch);
+      m_latency.cancel(OperationLatency::SubtitleSwitch);
+      m_thumbnails->clear();
+      m_audioSync.finish();
+      // so the next file gets the delay of its output, even if it's the same one
+      m_audioSync.setOutput(QString());
+      saveAudioSync();
       m_playbackCanceled = false;
       m_playbackError = "";
 
@@ -520,6 +1076,7 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
         case MPV_END_FILE_REASON_ERROR:
         {
           m_playbackError = mpv_error_string(endFile->error);
+          m_log.dump(m_playbackError);
           break;
         }
         case MPV_END_FILE_REASON_STOP:
@@ -529,75 +1086,61 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
         }
       }
 
+      QVariantMap summary;
+      if (m_quality.active())
+      {
+        summary = m_quality.summary();
+        m_quality.stop();
+        QLOG_INFO() << "Playback quality:"
+                    << QJsonDocument::fromVariant(summary).toJson(QJsonDocument::Compact).constData();
+        emit playbackQuality(summary);
+      }
+
+      if (m_session.active())
+      {
+        recordSession(endFile->reason, summary);
+        m_session.stop();
+      }
+
+      // a prewarm that had to wait for playback, unless something else is about to play
+      if (!m_streamSwitchImminent && m_queuedMedia.isEmpty())
+      {
+        startCodecPrewarm();
+        Codecs::releaseEAE();
+      }
+
       if (!m_streamSwitchImminent)
         m_restoreDisplayTimer.start(0);
       m_streamSwitchImminent = false;
       break;
     }
+    case MPV_EVENT_COMMAND_REPLY:
+    {
+      QVariant result;
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 102)
+      if (event->error >= 0)
+        result = mpv::qt::node_to_variant(&((mpv_event_command *)event->data)->result);
+#endif
+      handleAsyncReply(event->reply_userdata, event->error, result);
+      break;
+    }
+    case MPV_EVENT_SET_PROPERTY_REPLY:
+    {
+      handleAsyncReply(event->reply_userdata, event->error, QVariant());
+      break;
+    }
     case MPV_EVENT_PROPERTY_CHANGE:
     {
-      mpv_event_property *prop = (mpv_event_property *)event->data;
-      if (strcmp(prop->name, "pause") == 0 && prop->format == MPV_FORMAT_FLAG)
-      {
-        m_paused = !!*(int *)prop->data;
-      }
-      else if (strcmp(prop->name, "core-idle") == 0 && prop->format == MPV_FORMAT_FLAG)
-      {
-        m_playbackActive = !*(int *)prop->data;
-      }
-      else if (strcmp(prop->name, "cache-buffering-state") == 0)
-      {
-        m_bufferingPercentage = prop->format == MPV_FORMAT_INT64 ? (int)*(int64_t *)prop->data : 100;
-      }
-      else if (strcmp(prop->name, "playback-time") == 0 && prop->format == MPV_FORMAT_DOUBLE)
-      {
-        double pos = *(double*)prop->data;
-        if (fabs(pos - m_lastPositionUpdate) > 0.015)
-        {
-          quint64 ms = (quint64)(qMax(pos * 1000.0, 0.0));
-          emit positionUpdate(ms);
-          m_lastPositionUpdate = pos;
-        }
-      }
-      else if (strcmp(prop->name, "vo-configured") == 0)
-      {
-        int state = prop->format == MPV_FORMAT_FLAG ? *(int *)prop->data : 0;
-        m_windowVisible = state;
-        emit windowVisible(m_windowVisible);
-      }
-      else if (strcmp(prop->name, "duration") == 0)
-      {
-        if (prop->format == MPV_FORMAT_DOUBLE)
-          emit updateDuration(*(double *)prop->data * 1000.0);
-      }
-      else if (strcmp(prop->name, "audio-device-list") == 0)
-      {
-        updateAudioDeviceList();
-      }
-      else if (strcmp(prop->name, "video-dec-params") == 0)
-      {
-        // Aspect might be known now (or it changed during playback), so update settings
-        // dependent on the aspect ratio.
-        updateVideoAspectSettings();
-      }
+      // reply_userdata is the 1-based index into m_propertyHandlers that was
+      // assigned by observeProperty(); 0 means we did not register the property.
+      uint64_t id = event->reply_userdata;
+      if (id > 0 && id <= (uint64_t)m_propertyHandlers.size())
+        m_propertyHandlers[(int)id - 1]((mpv_event_property *)event->data);
       break;
     }
     case MPV_EVENT_LOG_MESSAGE:
     {
-      mpv_event_log_message *msg = (mpv_event_log_message *)event->data;
-      // Strip the trailing '\n'
-      size_t len = strlen(msg->text);
-      if (len > 0 && msg->text[len - 1] == '\n')
-        len -= 1;
-      QString logline = QString::fromUtf8(msg->prefix) + ": " + QString::fromUtf8(msg->text, (int)len);
-      if (msg->log_level >= MPV_LOG_LEVEL_V)
-        QLOG_DEBUG() << qPrintable(logline);
-      else if (msg->log_level >= MPV_LOG_LEVEL_INFO)
-        QLOG_INFO() << qPrintable(logline);
-      else if (msg->log_level >= MPV_LOG_LEVEL_WARN)
-        QLOG_WARN() << qPrintable(logline);
-      else
-        QLOG_ERROR() << qPrintable(logline);
+      m_log.message((mpv_event_log_message *)event->data);
       break;
     }
     case MPV_EVENT_CLIENT_MESSAGE:
@@ -616,34 +1159,49 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
           QLOG_INFO() << "checking codecs";
           startCodecsLoading([=] {
             QLOG_INFO() << "resuming loading";
+            m_session.mark("codecsLoaded");
             mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
           });
         };
-        if (switchDisplayFrameRate())
-        {
-          // Now wait for some time for mode change - this is needed because mode changing can take some
-          // time, during which the screen is black, and initializing hardware decoding could fail due
-          // to various strange OS-related reasons.
-          // (Better hope the user doesn't try to exit Konvergo during mode change.)
-          int pause = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.delay").toInt() * 1000;
-          QLOG_INFO() << "waiting" << pause << "msec after rate switch before loading";
-          QTimer::singleShot(pause, resume);
-        }
-        else
-        {
-          resume();
-        }
+        // The mode switch runs in the background while mpv opens the file and fills its cache.
+        // Only decoder initialization (after the on_preloaded hook) waits for the display to
+        // settle, since hardware decoding can fail to initialize during a mode change.
+        if (!m_mediaIsMusic && switchDisplayFrameRate())
+          QLOG_INFO() << "loading while the refresh rate is switched";
+        resume();
         break;
       }
       // Start "on_preloaded" hook.
       // Used initialize stream selections and to probe codecs.
       if (!strcmp(msg->args[1], "2"))
       {
-        reselectStream(m_currentSubtitleStream, MediaType::Subtitle);
-        reselectStream(m_currentAudioStream, MediaType::Audio);
+        m_session.mark("preloaded");
+        // the selections and the codec check share one copy of the track list
+        QVariant tracks = mpv::qt::get_property(m_mpv, "track-list");
+        bool added = addExternalStream(m_currentSubtitleStream, MediaType::Subtitle, tracks.toList());
+        added |= addExternalStream(m_currentAudioStream, MediaType::Audio, tracks.toList());
+        if (added)
+          tracks = mpv::qt::get_property(m_mpv, "track-list");
+
+        TrackIndex index = indexTracks(tracks.toList());
+        selectStream(m_currentSubtitleStream, MediaType::Subtitle, index);
+        selectStream(m_currentAudioStream, MediaType::Audio, index);
+
         startCodecsLoading([=] {
-          mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
-        });
+          // Nothing for music to wait for. The codecs were fetched when the track was queued,
+          // so the next track starts right after the previous one.
+          if (m_mediaIsMusic)
+          {
+            mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
+            return;
+          }
+          waitForDisplaySwitch([=] {
+            m_session.mark("displaySwitched");
+            // the refresh rate is final now
+            updateSyncMode();
+            mpv::qt::command(m_mpv, QStringList() << "hook-ack" << resumeId);
+          });
+        }, tracks);
         break;
       }
       break;
@@ -655,12 +1213,15 @@ void PlayerComponent::handleMpvEvent(mpv_event *event)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::handleMpvEvents()
 {
+  TRACE_SCOPE("player", "handleMpvEvents");
+
   // Process all events, until the event queue is empty.
   while (1)
   {
     mpv_event *event = mpv_wait_event(m_mpv, 0);
     if (event->event_id == MPV_EVENT_NONE)
       break;
+    TRACE_SCOPE("player", mpv_event_name(event->event_id));
     handleMpvEvent(event);
   }
   // Once we got all status updates, determine the new canonical state.
@@ -670,58 +1231,204 @@ void PlayerComponent::handleMpvEvents()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setVideoOnlyMode(bool enable)
 {
+  m_videoOnlyMode = enable;
+
   if (m_window)
   {
     QQuickItem *web = m_window->findChild<QQuickItem *>("web");
     if (web)
-      web->setVisible(!enable);
+      web->setVisible(!enable && !m_webSuspended);
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::play()
+void PlayerComponent::setOsdVisible(bool visible)
 {
-  QStringList args = (QStringList() << "set" << "pause" << "no");
-  mpv::qt::command(m_mpv, args);
+  if (m_osdVisible == visible)
+    return;
+
+  m_osdVisible = visible;
+  updateWebLayer();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::stop()
+void PlayerComponent::updateWebLayer()
 {
-  QStringList args("stop");
-  mpv::qt::command(m_mpv, args);
+  if (!m_window)
+    return;
+
+  QQuickItem *web = m_window->findChild<QQuickItem *>("web");
+  if (!web)
+    return;
+
+  // The scene graph leaves out items at opacity 0. Unlike hiding the view, this
+  // keeps its focus and input, and the OSD is back with the next frame.
+  bool skip = m_videoPlaybackActive && !m_osdVisible;
+
+  // If it stays that way, Chromium doesn't have to render it either.
+  if (!skip)
+  {
+    m_webSuspendTimer.stop();
+    setWebSuspended(false);
+  }
+  else if (!m_webSuspended && !m_webSuspendTimer.isActive())
+  {
+    m_webSuspendTimer.start();
+  }
+
+  if (skip == (web->opacity() == 0.0))
+    return;
+
+  QLOG_DEBUG() << (skip ? "Not compositing" : "Compositing") << "the web view over the video";
+  web->setOpacity(skip ? 0.0 : 1.0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::clearQueue()
+void PlayerComponent::setWebSuspended(bool suspended)
 {
-  QStringList args("playlist_clear");
-  mpv::qt::command(m_mpv, args);
+  if (m_webSuspended == suspended || !m_window)
+    return;
+
+  QQuickItem *web = m_window->findChild<QQuickItem *>("web");
+  if (!web)
+    return;
+
+  // A hidden view tells Chromium to stop producing frames, its timers are throttled too.
+  m_webSuspended = suspended;
+  if (!m_videoOnlyMode)
+    web->setVisible(!suspended);
+
+  // hiding it took the focus away
+  if (!suspended)
+    web->forceActiveFocus();
+
+  QLOG_DEBUG() << (suspended ? "Suspending" : "Resuming") << "web view rendering";
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::pause()
+void PlayerComponent::wakeWebView()
 {
-  QStringList args = (QStringList() << "set" << "pause" << "yes");
-  mpv::qt::command(m_mpv, args);
+  if (!m_webSuspended)
+    return;
+
+  // Web has to be running to react to the input, most likely by showing the OSD.
+  // If it doesn't, it's suspended again after a while.
+  setWebSuspended(false);
+  m_webSuspendTimer.start();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::seekTo(qint64 ms)
+void PlayerComponent::play()
 {
-  double timeSecs = ms / 1000.0;
-  QVariantList args = (QVariantList() << "seek" << timeSecs << "absolute+exact");
-  mpv::qt::command(m_mpv, args);
+  mpv::qt::command_builder args;
+  args.add("set").add("pause").add("no");
+  commandAsync(args);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QVariant PlayerComponent::getAudioDeviceList()
+void PlayerComponent::stop()
 {
-  return mpv::qt::get_property(m_mpv, "audio-device-list");
+  m_queuedMedia.clear();
+
+  mpv::qt::command_builder args;
+  args.add("stop");
+  commandAsync(args);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::setAudioDevice(const QString& name)
+void PlayerComponent::clearQueue()
+{
+  // the current file was taken from the queue when it started
+  m_queuedMedia.clear();
+
+  mpv::qt::command_builder args;
+  args.add("playlist_clear");
+  commandAsync(args);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::pause()
+{
+  mpv::qt::command_builder args;
+  args.add("set").add("pause").add("yes");
+  commandAsync(args);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::seekTo(qint64 ms)
+{
+  m_latency.start(OperationLatency::Seek);
+
+  double timeSecs = ms / 1000.0;
+  mpv::qt::command_builder args;
+  args.add("seek").add(timeSecs).add("absolute+exact");
+  commandAsync(args);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::beginScrub()
+{
+  m_scrubbing = true;
+  m_scrubTarget = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::scrubTo(qint64 ms)
+{
+  if (!m_scrubbing)
+    beginScrub();
+
+  m_scrubTarget = ms;
+  sendScrubSeek();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::endScrub(qint64 ms)
+{
+  m_scrubbing = false;
+  m_scrubTarget = -1;
+
+  // mpv runs commands in order, so this lands after a keyframe seek in flight.
+  seekTo(ms);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::sendScrubSeek()
+{
+  if (m_scrubSeekInFlight || m_scrubTarget < 0)
+    return;
+
+  double timeSecs = m_scrubTarget / 1000.0;
+  m_scrubTarget = -1;
+  m_scrubSeekInFlight = true;
+
+  // Keyframe seeks don't decode up to the exact position, which is most of
+  // the cost of a seek in remote high bitrate files.
+  mpv::qt::command_builder args;
+  args.add("seek").add(timeSecs).add("absolute+keyframes");
+  commandAsync(args, [=](int, const QVariant&)
+  {
+    m_scrubSeekInFlight = false;
+    if (m_scrubbing)
+      sendScrubSeek();
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariant PlayerComponent::getAudioDeviceList()
+{
+  return mpv::qt::get_property(m_mpv, "audio-device-list");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateLogLevels()
+{
+  QString levels = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "mpvLogLevels").toString();
+  mpv::qt::set_property(m_mpv, "msg-level", m_log.setLevels(levels));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::setAudioDevice(const QString& name)
 {
   mpv::qt::set_property(m_mpv, "audio-device", name);
 }
@@ -759,49 +1466,15 @@ bool PlayerComponent::muted()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-QVariantList PlayerComponent::findStreamsForURL(const QString &url)
+static const char* mpvStreamType(PlayerComponent::MediaType target)
 {
-  bool isExternal = !url.isEmpty();
-  QVariantList res;
-
-  auto tracks = mpv::qt::get_property(m_mpv, "track-list");
-  for (auto track : tracks.toList())
-  {
-    QVariantMap map = track.toMap();
-
-    if (map["external"].toBool() != isExternal)
-      continue;
-
-    if (!isExternal || map["external-filename"].toString() == url)
-      res += map;
-  }
-
-  return res;
+  return target == PlayerComponent::MediaType::Subtitle ? "sub" : "audio";
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::reselectStream(const QString &streamSelection, MediaType target)
+PlayerComponent::StreamSelection PlayerComponent::parseStreamSelection(const QString& streamSelection, MediaType target)
 {
-  QString streamIdPropertyName;
-  QString streamAddCommandName;
-  QString mpvStreamTypeName;
-
-  switch (target)
-  {
-  case MediaType::Subtitle:
-    mpvStreamTypeName = "sub";
-    streamIdPropertyName = "sid";
-    streamAddCommandName = "sub-add";
-    break;
-  case MediaType::Audio:
-    mpvStreamTypeName = "audio";
-    streamIdPropertyName = "aid";
-    streamAddCommandName = "audio-add";
-    break;
-  }
-
-  QString streamName;
-  QString streamID;
+  StreamSelection selection;
 
   if (streamSelection.startsWith("#"))
   {
@@ -809,14 +1482,13 @@ void PlayerComponent::reselectStream(const QString &streamSelection, MediaType t
     if (splitPos < 0)
     {
       // Stream from the main file
-      streamID = streamSelection.mid(1);
-      streamName = "";
+      selection.streamID = streamSelection.mid(1);
     }
     else
     {
       // Stream from an external file
-      streamID = streamSelection.mid(1, splitPos - 1);
-      streamName = streamSelection.mid(splitPos + 1);
+      selection.streamID = streamSelection.mid(1, splitPos - 1);
+      selection.url = streamSelection.mid(splitPos + 1);
     }
   }
   else if (!streamSelection.isEmpty())
@@ -824,68 +1496,115 @@ void PlayerComponent::reselectStream(const QString &streamSelection, MediaType t
     if (target == MediaType::Audio)
     {
       // For some reason, audio stream selections never start with '#'.
-      streamID = streamSelection;
-      streamName = "";
+      selection.streamID = streamSelection;
     }
     else
     {
       // Legacy web-client single external subtitle
-      streamID = "0";
-      streamName = streamSelection;
+      selection.streamID = "0";
+      selection.url = streamSelection;
     }
   }
 
-  if (!streamName.isEmpty())
+  if (selection.url.startsWith("https://"))
   {
-    if (streamName.startsWith("https://")) {
-      QUrl qurl = streamName;
-      qurl.setHost(ConvertPlexDirectURL(qurl.host()));
-      streamName = qurl.toString();
-    }
-
-    auto streams = findStreamsForURL(streamName);
-    if (streams.isEmpty())
-    {
-      QStringList args = (QStringList() << streamAddCommandName << streamName);
-      mpv::qt::command(m_mpv, args);
-    }
+    QUrl qurl = selection.url;
+    qurl.setHost(ConvertPlexDirectURL(qurl.host()));
+    selection.url = qurl.toString();
   }
 
-  QString selection = "no";
+  return selection;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString trackKey(const QString& type, const QString& url, const QString& streamID)
+{
+  return type + "|" + url + "|" + streamID;
+}
 
-  for (auto stream : findStreamsForURL(streamName))
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PlayerComponent::TrackIndex PlayerComponent::indexTracks(const QVariantList& tracks)
+{
+  TrackIndex index;
+  for (const QVariant& track : tracks)
   {
-    auto map = stream.toMap();
+    QVariantMap map = track.toMap();
+    QString url = map["external"].toBool() ? map["external-filename"].toString() : QString();
+    index.insert(trackKey(map["type"].toString(), url, map["ff-index"].toString()), map["id"].toString());
+  }
+  return index;
+}
 
-    if (map["type"].toString() != mpvStreamTypeName)
-      continue;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PlayerComponent::addExternalStream(const StreamSelection& selection, MediaType target, const QVariantList& tracks)
+{
+  if (selection.url.isEmpty())
+    return false;
 
-    if (!streamID.isEmpty() && map["ff-index"].toString() == streamID)
-    {
-      selection = map["id"].toString();
-      break;
-    }
+  for (const QVariant& track : tracks)
+  {
+    QVariantMap map = track.toMap();
+    if (map["external"].toBool() && map["external-filename"].toString() == selection.url)
+      return false;
   }
 
+  QString command = target == MediaType::Subtitle ? "sub-add" : "audio-add";
+  mpv::qt::command(m_mpv, QStringList() << command << selection.url);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::selectStream(const StreamSelection& selection, MediaType target, const TrackIndex& index)
+{
+  QString value = "no";
+  if (!selection.streamID.isEmpty())
+    value = index.value(trackKey(mpvStreamType(target), selection.url, selection.streamID), "no");
+
   // Fallback to the first stream if none could be found.
   // Useful if web-client uses wrong stream IDs when e.g. transcoding.
-  if ((target == MediaType::Audio || !streamID.isEmpty()) && selection == "no")
-    selection = "1";
+  if ((target == MediaType::Audio || !selection.streamID.isEmpty()) && value == "no")
+    value = "1";
+
+  OperationLatency::Operation operation =
+    target == MediaType::Subtitle ? OperationLatency::SubtitleSwitch : OperationLatency::AudioSwitch;
+  QString property = target == MediaType::Subtitle ? "sid" : "aid";
+  setPropertyAsync(property, value, [=](int error, const QVariant&)
+  {
+    if (error < 0)
+    {
+      QLOG_WARN() << "mpv: set" << property << "failed:" << mpv_error_string(error);
+      m_latency.cancel(operation);
+    }
+    // mpv has switched the track once it replies, subtitles don't have to wait for more
+    else if (operation == OperationLatency::SubtitleSwitch)
+    {
+      finishOperation(operation);
+    }
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::reselectStream(const StreamSelection& selection, MediaType target)
+{
+  if (addExternalStream(selection, target, mpv::qt::get_property(m_mpv, "track-list").toList()))
+    QLOG_DEBUG() << "Added external stream" << selection.url;
 
-  mpv::qt::set_property(m_mpv, streamIdPropertyName, selection);
+  selectStream(selection, target, indexTracks(mpv::qt::get_property(m_mpv, "track-list").toList()));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setSubtitleStream(const QString &subtitleStream)
 {
-  m_currentSubtitleStream = subtitleStream;
+  m_latency.start(OperationLatency::SubtitleSwitch);
+  m_currentSubtitleStream = parseStreamSelection(subtitleStream, MediaType::Subtitle);
   reselectStream(m_currentSubtitleStream, MediaType::Subtitle);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::setAudioStream(const QString &audioStream)
 {
-  m_currentAudioStream = audioStream;
+  m_latency.start(OperationLatency::AudioSwitch);
+  m_currentAudioStream = parseStreamSelection(audioStream, MediaType::Audio);
   reselectStream(m_currentAudioStream, MediaType::Audio);
 }
 
@@ -894,6 +1613,19 @@ void PlayerComponent::setAudioDelay(qint64 milliseconds)
 {
   m_playbackAudioDelay = milliseconds;
 
+  // Only what the user set while watching, anything else can't have been tuned by ear.
+  if (m_playbackActive)
+  {
+    m_audioSync.learn(milliseconds);
+    saveAudioSync();
+  }
+
+  applyAudioDelay();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::applyAudioDelay()
+{
   double displayFps = DisplayComponent::Get().currentRefreshRate();
   const char *audioDelaySetting = "audio_delay.normal";
   if (fabs(displayFps - 24) < 0.5) // cover 24Hz, 23.976Hz, and values very close
@@ -904,7 +1636,42 @@ void PlayerComponent::setAudioDelay(qint64 milliseconds)
     audioDelaySetting = "audio_delay.50hz";
 
   double fixedDelay = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, audioDelaySetting).toFloat();
-  mpv::qt::set_property(m_mpv, "audio-delay", (fixedDelay + m_playbackAudioDelay) / 1000.0);
+  setPropertyAsync("audio-delay", (fixedDelay + m_playbackAudioDelay) / 1000.0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateAudioSyncOutput()
+{
+  QString format = mpv::qt::get_property(m_mpv, "audio-out-params/format").toString();
+  // without audio there is nothing to keep in sync
+  if (format.isEmpty())
+    return;
+
+  QString key = AudioSyncProfile::outputKey(m_audioProfile.device, format.startsWith("spdif-"),
+                                            DisplayComponent::Get().currentRefreshRate());
+  if (key == m_audioSync.output())
+    return;
+
+  // what was measured so far belongs to the output that played until now
+  m_audioSync.finish();
+  m_audioSync.setOutput(key);
+  saveAudioSync();
+
+  bool known = false;
+  qint64 delay = m_audioSync.delay(&known);
+  if (known && delay != m_playbackAudioDelay)
+  {
+    QLOG_INFO() << "Using the audio delay of" << delay << "ms learned for" << key;
+    m_playbackAudioDelay = delay;
+    applyAudioDelay();
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::saveAudioSync()
+{
+  if (m_audioSync.takeChanged())
+    SettingsComponent::Get().setValue(SETTINGS_SECTION_STATE, "audioSyncProfiles", m_audioSync.state());
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -943,29 +1710,39 @@ void PlayerComponent::checkCurrentAudioDevice(const QSet<QString>& old_devs, con
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::updateAudioDeviceList()
+{
+  mpv::qt::node_property list(m_mpv, "audio-device-list");
+  updateAudioDevices(list.view());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateAudioDevices(const mpv::qt::node_view& list)
 {
   QString userDevice = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "device").toString();
   bool userDeviceFound = false;
 
-  QVariantList settingList;
-  QVariant list = getAudioDeviceList();
-  QSet<QString> devices;
-  for(const QVariant& d : list.toList())
+  QMap<QString, QString> devices;
+  for (int i = 0; i < list.size(); i++)
   {
-    Q_ASSERT(d.type() == QVariant::Map);
-    QVariantMap dmap = d.toMap();
+    mpv::qt::node_view d = list[i];
+    Q_ASSERT(d.format() == MPV_FORMAT_NODE_MAP);
 
-    QString device = dmap["name"].toString();
-    QString description = dmap["description"].toString();
+    devices.insert(d["name"].to_string(), d["description"].to_string());
+  }
 
-    devices.insert(device);
+  // Nothing the settings (and the web client) would show differently, and nothing to reload.
+  if (devices == m_audioDevices && userDevice == m_publishedAudioDevice && !m_audioDevices.isEmpty())
+    return;
 
-    if (userDevice == device)
+  QVariantList settingList;
+  for (auto it = devices.constBegin(); it != devices.constEnd(); ++it)
+  {
+    if (userDevice == it.key())
       userDeviceFound = true;
 
     QVariantMap entry;
-    entry["value"] = device;
-    entry["title"] = description;
+    entry["value"] = it.key();
+    entry["title"] = it.value();
 
     settingList << entry;
   }
@@ -980,78 +1757,91 @@ void PlayerComponent::updateAudioDeviceList()
   }
 
   SettingsComponent::Get().updatePossibleValues(SETTINGS_SECTION_AUDIO, "device", settingList);
+  m_publishedAudioDevice = userDevice;
+
+  // only the names matter here, a changed description doesn't need a reload
+  QSet<QString> oldNames = QSet<QString>::fromList(m_audioDevices.keys());
+  QSet<QString> newNames = QSet<QString>::fromList(devices.keys());
+  if (oldNames != newNames)
+    checkCurrentAudioDevice(oldNames, newNames);
 
-  checkCurrentAudioDevice(m_audioDevices, devices);
   m_audioDevices = devices;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::updateAudioDevice()
+QStringList PlayerComponent::DetectedPassthroughCodecs()
 {
-  QString device = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "device").toString();
+  SettingsSection* audioSection = SettingsComponent::Get().getSection(SETTINGS_SECTION_AUDIO);
+  QVariantMap values = audioSection->allValues();
+
+  // only HDMI sinks have an ELD
+  if (values.value("devicetype").toString() != AUDIO_DEVICE_TYPE_HDMI || !values.value("passthrough.detect").toBool())
+    return QStringList();
 
-  if (!m_audioDevices.contains(device))
+  QStringList codecs;
+  for (const QString& codec : AudioCapabilities::ProbePassthrough(values.value("device").toString()))
   {
-    QLOG_WARN() << "Not using audio device" << device << "because it's not present.";
-    device = "auto";
+    // leave out what this platform can't pass through
+    if (values.contains("passthrough." + codec))
+      codecs << codec;
   }
-
-  mpv::qt::set_property(m_mpv, "audio-device", device);
+  return codecs;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::setAudioConfiguration()
+PlayerComponent::AudioProfile PlayerComponent::compileAudioProfile()
 {
-  QString deviceType = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "devicetype").toString();
+  AudioProfile profile;
+  SettingsSection* audioSection = SettingsComponent::Get().getSection(SETTINGS_SECTION_AUDIO);
+  QString deviceType = audioSection->value("devicetype").toString();
 
-  mpv::qt::set_property(m_mpv, "audio-exclusive", SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "exclusive").toBool());
+  profile.exclusive = audioSection->value("exclusive").toBool();
 
-  updateAudioDevice();
+  profile.device = audioSection->value("device").toString();
+  if (!m_audioDevices.contains(profile.device))
+  {
+    QLOG_WARN() << "Not using audio device" << profile.device << "because it's not present.";
+    profile.device = "auto";
+  }
 
   QString resampleOpts = "";
-  bool normalize = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "normalize").toBool();
+  bool normalize = audioSection->value("normalize").toBool();
   resampleOpts += QString(":normalize=") + (normalize ? "yes" : "no");
 
   // Make downmix more similar to PHT.
   resampleOpts += ":o=[surround_mix_level=1]";
 
-  mpv::qt::set_property(m_mpv, "af-defaults", "lavrresample" + resampleOpts);
-
-  m_passthroughCodecs.clear();
+  profile.resampler = "lavrresample" + resampleOpts;
 
   // passthrough doesn't make sense with basic type
   if (deviceType != AUDIO_DEVICE_TYPE_BASIC)
   {
-    SettingsSection* audioSection = SettingsComponent::Get().getSection(SETTINGS_SECTION_AUDIO);
-
     QStringList codecs;
     if (deviceType == AUDIO_DEVICE_TYPE_SPDIF)
       codecs = AudioCodecsSPDIF();
     else if (deviceType == AUDIO_DEVICE_TYPE_HDMI)
       codecs = AudioCodecsAll();
 
+    // what the TV or receiver says it decodes is passed through even if it wasn't ticked
+    QStringList detected = DetectedPassthroughCodecs();
+
     for(const QString& key : codecs)
     {
-      if (audioSection->value("passthrough." + key).toBool())
-        m_passthroughCodecs << key;
+      if (audioSection->value("passthrough." + key).toBool() || detected.contains(key))
+        profile.passthroughCodecs << key;
     }
 
     // dts-hd includes dts, but listing dts before dts-hd may disable dts-hd.
-    if (m_passthroughCodecs.indexOf("dts-hd") != -1)
-      m_passthroughCodecs.removeAll("dts");
+    if (profile.passthroughCodecs.indexOf("dts-hd") != -1)
+      profile.passthroughCodecs.removeAll("dts");
   }
 
-  QString passthroughCodecs = m_passthroughCodecs.join(",");
-  mpv::qt::set_property(m_mpv, "audio-spdif", passthroughCodecs);
-
   // set the channel layout
-  QVariant layout = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "channels");
+  profile.channels = audioSection->value("channels").toString();
 
   // always force either stereo or transcoding
   if (deviceType == AUDIO_DEVICE_TYPE_SPDIF)
-    layout = "2.0";
-
-  mpv::qt::set_property(m_mpv, "audio-channels", layout);
+    profile.channels = "2.0";
 
   // if the user has indicated that PCM only works for stereo, and that
   // the receiver supports AC3, set this extra option that allows us to transcode
@@ -1059,58 +1849,155 @@ void PlayerComponent::setAudioConfiguration()
   // here for now. We might need to add support for DTS transcoding
   // if we see user requests for it.
   //
-  m_doAc3Transcoding = false;
-  if (deviceType == AUDIO_DEVICE_TYPE_SPDIF &&
-      SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.ac3").toBool())
-  {
-    QString filterArgs = "";
-    mpv::qt::command(m_mpv, QStringList() << "af" << "add" << ("@ac3:lavcac3enc" + filterArgs));
-    m_doAc3Transcoding = true;
-  }
-  else
+  profile.ac3Transcoding = (deviceType == AUDIO_DEVICE_TYPE_SPDIF && audioSection->value("passthrough.ac3").toBool());
+
+  return profile;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateAudioDevice()
+{
+  // always set, even if it's the same device, this is how the audio output is reopened
+  // on a device that came back
+  m_audioProfile.device = compileAudioProfile().device;
+  mpv::qt::set_property(m_mpv, "audio-device", m_audioProfile.device);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::setAudioConfiguration()
+{
+  // Most of these make mpv reinit the audio output, which is audible and makes
+  // receivers resync. So only what actually changed is pushed to mpv.
+  AudioProfile profile = compileAudioProfile();
+  bool all = !m_audioProfileApplied;
+
+  if (!all && profile == m_audioProfile)
+    return;
+
+  if (all || profile.exclusive != m_audioProfile.exclusive)
+    mpv::qt::set_property(m_mpv, "audio-exclusive", profile.exclusive);
+
+  if (all || profile.device != m_audioProfile.device)
+    mpv::qt::set_property(m_mpv, "audio-device", profile.device);
+
+  if (all || profile.resampler != m_audioProfile.resampler)
+    mpv::qt::set_property(m_mpv, "af-defaults", profile.resampler);
+
+  QString passthroughCodecs = profile.passthroughCodecs.join(",");
+  if (all || profile.passthroughCodecs != m_audioProfile.passthroughCodecs)
+    mpv::qt::set_property(m_mpv, "audio-spdif", passthroughCodecs);
+
+  if (all || profile.channels != m_audioProfile.channels)
+    mpv::qt::set_property(m_mpv, "audio-channels", profile.channels);
+
+  if (all || profile.ac3Transcoding != m_audioProfile.ac3Transcoding)
   {
-    mpv::qt::command(m_mpv, QStringList() << "af" << "del" << "@ac3");
+    if (profile.ac3Transcoding)
+    {
+      QString filterArgs = "";
+      mpv::qt::command(m_mpv, QStringList() << "af" << "add" << ("@ac3:lavcac3enc" + filterArgs));
+    }
+    else
+    {
+      mpv::qt::command(m_mpv, QStringList() << "af" << "del" << "@ac3");
+    }
   }
 
-  QVariant device = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "device");
+  m_audioProfile = profile;
+  m_audioProfileApplied = true;
+  m_passthroughCodecs = profile.passthroughCodecs;
+  m_doAc3Transcoding = profile.ac3Transcoding;
 
   // Make a informational log message.
   QString audioConfig = QString(QString("Audio Config - device: %1, ") +
                                         "channel layout: %2, " +
                                         "passthrough codecs: %3, " +
-                                        "ac3 transcoding: %4").arg(device.toString(),
-                                                                   layout.toString(),
+                                        "ac3 transcoding: %4").arg(profile.device,
+                                                                   profile.channels,
                                                                    passthroughCodecs.isEmpty() ? "none" : passthroughCodecs,
                                                                    m_doAc3Transcoding ? "yes" : "no");
   QLOG_INFO() << qPrintable(audioConfig);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::updateSubtitleSettings()
+void PlayerComponent::applyVideoOptions(const QVariantMap& options)
+{
+  QStringList changed;
+
+  for (auto it = options.constBegin(); it != options.constEnd(); ++it)
+  {
+    auto applied = m_videoOptions.constFind(it.key());
+    if (applied != m_videoOptions.constEnd() && applied.value() == it.value())
+      continue;
+
+    QString name = it.key();
+    m_videoOptions.insert(name, it.value());
+    changed << name;
+
+    setPropertyAsync(name, it.value(), [=](int error, const QVariant&)
+    {
+      if (error < 0)
+      {
+        QLOG_WARN() << "mpv: set" << name << "failed:" << mpv_error_string(error);
+        // so the next update sends it again
+        m_videoOptions.remove(name);
+      }
+    });
+  }
+
+  if (!changed.isEmpty())
+    QLOG_DEBUG() << "Changed video options:" << qPrintable(changed.join(", "));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::subtitleOptions()
 {
-  QVariant size = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "size");
-  mpv::qt::set_property(m_mpv, "sub-text-font-size", size);
+  QVariantMap options;
+
+  options["sub-text-font-size"] = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "size");
 
   QVariant colorsString = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "color");
   auto colors = colorsString.toString().split(",");
   if (colors.length() == 2)
   {
-    mpv::qt::set_property(m_mpv, "sub-text-color", colors[0]);
-    mpv::qt::set_property(m_mpv, "sub-text-border-color", colors[1]);
+    options["sub-text-color"] = colors[0];
+    options["sub-text-border-color"] = colors[1];
   }
 
   QVariant subposString = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "placement");
   auto subpos = subposString.toString().split(",");
   if (subpos.length() == 2)
   {
-    mpv::qt::set_property(m_mpv, "sub-text-align-x", subpos[0]);
-    mpv::qt::set_property(m_mpv, "sub-text-align-y", subpos[1]);
+    options["sub-text-align-x"] = subpos[0];
+    options["sub-text-align-y"] = subpos[1];
   }
+
+#ifndef TARGET_RPI
+  // libass rasterizes every event again for every frame it changes on, at the size it's
+  // drawn at. Blending into the video frame means heavy ASS styling on a 1080p video is
+  // rendered at 1080p instead of at the screen's 4K, which is what the ARM boxes can't keep up
+  // with. (vo_rpi draws subtitles itself and doesn't have the option.)
+  bool videoResolution = SettingsComponent::Get().value(SETTINGS_SECTION_SUBTITLES, "videoResolution").toBool();
+  options["blend-subtitles"] = videoResolution ? "video" : "no";
+#endif
+
+  return options;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::updateVideoAspectSettings()
+void PlayerComponent::updateSubtitleSettings()
+{
+  if (!m_mpv)
+    return;
+
+  applyVideoOptions(subtitleOptions());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::videoAspectOptions()
 {
+  QVariantMap options;
+
   QVariant mode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "aspect").toString();
   bool disableScaling = false;
   bool keepAspect = true;
@@ -1119,7 +2006,7 @@ void PlayerComponent::updateVideoAspectSettings()
   if (mode == "custom")
   {
     // in particular, do not restore anything - the intention is not to touch the user's mpv.conf settings, or whatever
-    return;
+    return options;
   }
   else if (mode == "zoom")
   {
@@ -1135,9 +2022,7 @@ void PlayerComponent::updateVideoAspectSettings()
   }
   else if (mode == "force_16_9_if_4_3")
   {
-    auto params = mpv::qt::get_property(m_mpv, "video-dec-params").toMap();
-    auto aspect = params["aspect"].toFloat();
-    if (fabs(aspect - 4.0/3.0) < 0.1)
+    if (fabs(m_videoAspect - 4.0/3.0) < 0.1)
       forceAspect = "16:9";
   }
   else if (mode == "stretch")
@@ -1149,20 +2034,31 @@ void PlayerComponent::updateVideoAspectSettings()
     disableScaling = true;
   }
 
-  mpv::qt::set_property(m_mpv, "video-unscaled", disableScaling);
-  mpv::qt::set_property(m_mpv, "video-aspect", forceAspect);
-  mpv::qt::set_property(m_mpv, "keepaspect", keepAspect);
-  mpv::qt::set_property(m_mpv, "panscan", panScan);
+  options["video-unscaled"] = disableScaling;
+  options["video-aspect"] = forceAspect;
+  options["keepaspect"] = keepAspect;
+  options["panscan"] = panScan;
+
+  return options;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::updateVideoSettings()
+void PlayerComponent::updateVideoAspectSettings()
 {
   if (!m_mpv)
     return;
 
-  QVariant syncMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "sync_mode");
-  mpv::qt::set_property(m_mpv, "video-sync", syncMode);
+  applyVideoOptions(videoAspectOptions());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::videoOptions()
+{
+  QVariantMap options;
+
+  options["video-sync"] = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "sync_mode");
+  if (m_displayResample)
+    options["video-sync"] = "display-resample";
 
   QString hardwareDecodingMode = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "hardwareDecoding").toString();
   QString hwdecMode = "no";
@@ -1178,23 +2074,54 @@ void PlayerComponent::updateVideoSettings()
   {
     hwdecMode = "auto-copy";
   }
-  mpv::qt::set_property(m_mpv, "hwdec", hwdecMode);
-  mpv::qt::set_property(m_mpv, "videotoolbox-format", hwdecVTFormat);
+  options["hwdec"] = hwdecMode;
+  options["videotoolbox-format"] = hwdecVTFormat;
 
   QVariant deinterlace = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "deinterlace");
-  mpv::qt::set_property(m_mpv, "deinterlace", deinterlace.toBool() ? "yes" : "no");
+  options["deinterlace"] = deinterlace.toBool() ? "yes" : "no";
 
 #ifndef TARGET_RPI
-  double displayFps = DisplayComponent::Get().currentRefreshRate();
-  mpv::qt::set_property(m_mpv, "display-fps", displayFps);
+  options["display-fps"] = DisplayComponent::Get().currentRefreshRate();
 #endif
 
-  setAudioDelay(m_playbackAudioDelay);
+  // With the display in HDR mode, mpv has to output PQ or HLG as is. Left to "auto" it would
+  // tone map to SDR, which at 4K is more than the shaders of a mid-range GPU keep up with.
+  QString targetTrc = "auto", targetPrim = "auto";
+  int hdrFormat = DisplayComponent::Get().currentHDRFormat();
+  if (hdrFormat != DM_HDR_NONE)
+  {
+    targetTrc = (hdrFormat == DM_HDR_HLG) ? "hlg" : "pq";
+    targetPrim = "bt.2020";
+  }
+  options["target-trc"] = targetTrc;
+  options["target-prim"] = targetPrim;
+
+  // the aspect settings are part of the same batch
+  options.unite(videoAspectOptions());
+
+  return options;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateVideoSettings()
+{
+  if (!m_mpv)
+    return;
+
+  applyVideoOptions(videoOptions());
+
+  applyAudioDelay();
 
   QVariant cache = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "cache");
-  mpv::qt::set_property(m_mpv, "cache", cache.toInt() * 1024);
+  m_cachePolicy.setUserCacheSize(cache.toInt());
+  applyCachePolicy();
 
-  updateVideoAspectSettings();
+  bool blit = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "debug.video_rectangle_blit").toBool();
+  if (blit != m_videoRectangleBlit)
+  {
+    m_videoRectangleBlit = blit;
+    updateVideoRectangleGeometry();
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -1262,6 +2189,18 @@ QList<CodecDriver> convertCodecList(QVariant list, CodecType type)
 
 /////////////////////////////////////////////////////////////////////////////////////////
 QList<CodecDriver> PlayerComponent::installedCodecDrivers()
+{
+  QList<CodecDriver> codecs;
+  for (const CodecDriver& codec : Codecs::getCachedCodecList())
+  {
+    if (codec.present)
+      codecs.append(codec);
+  }
+  return codecs;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QList<CodecDriver> PlayerComponent::mpvCodecDrivers()
 {
   QList<CodecDriver> codecs;
 
@@ -1297,7 +2236,7 @@ QStringList PlayerComponent::installedDecoderCodecs()
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-PlaybackInfo PlayerComponent::getPlaybackInfo()
+PlaybackInfo PlayerComponent::getPlaybackInfo(const QVariant& trackList)
 {
   PlaybackInfo info = {};
 
@@ -1311,7 +2250,7 @@ PlaybackInfo PlayerComponent::getPlaybackInfo()
 
   info.enableAC3Transcoding = m_doAc3Transcoding;
 
-  auto tracks = mpv::qt::get_property(m_mpv, "track-list");
+  QVariant tracks = trackList.isValid() ? trackList : mpv::qt::get_property(m_mpv, "track-list");
   for (auto track : tracks.toList())
   {
     QVariantMap map = track.toMap();
@@ -1328,19 +2267,11 @@ PlaybackInfo PlayerComponent::getPlaybackInfo()
     // Get the profile from the server, because mpv can't determine it yet.
     if (stream.isVideo)
     {
-      int index = map["ff-index"].toInt();
-      for (auto partInfo : m_serverMediaInfo["Part"].toList())
+      auto it = m_serverStreams.constFind(map["ff-index"].toInt());
+      if (it != m_serverStreams.constEnd())
       {
-        for (auto streamInfo : partInfo.toMap()["Stream"].toList())
-        {
-          auto streamInfoMap = streamInfo.toMap();
-          bool ok = false;
-          if (streamInfoMap["index"].toInt(&ok) == index && ok)
-          {
-            stream.profile = streamInfoMap["profile"].toString();
-            QLOG_DEBUG() << "h264profile:" << stream.profile;
-          }
-        }
+        stream.profile = it.value()["profile"].toString();
+        QLOG_DEBUG() << "h264profile:" << stream.profile;
       }
     }
 
@@ -1350,26 +2281,269 @@ PlaybackInfo PlayerComponent::getPlaybackInfo()
   // If we're in an early stage where we don't have streams yet, try to get the
   // info from the PMS metadata.
   if (!info.streams.size())
+    info.streams = serverStreams(m_serverMediaInfo);
+
+  return info;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QHash<int, QVariantMap> PlayerComponent::indexServerStreams(const QVariantMap& serverMediaInfo)
+{
+  QHash<int, QVariantMap> streams;
+
+  for (auto partInfo : serverMediaInfo["Part"].toList())
   {
-    for (auto partInfo : m_serverMediaInfo["Part"].toList())
+    for (auto streamInfo : partInfo.toMap()["Stream"].toList())
     {
-      for (auto streamInfo : partInfo.toMap()["Stream"].toList())
-      {
-        auto streamInfoMap = streamInfo.toMap();
+      auto streamInfoMap = streamInfo.toMap();
+      bool ok = false;
+      int index = streamInfoMap["index"].toInt(&ok);
+      if (ok)
+        streams.insert(index, streamInfoMap);
+    }
+  }
 
-        StreamInfo stream = {};
-        stream.isVideo = streamInfoMap["width"].isValid();
-        stream.isAudio = streamInfoMap["channels"].isValid();
-        stream.codec = Codecs::plexNameToFF(streamInfoMap["codec"].toString());
-        stream.audioChannels = streamInfoMap["channels"].toInt();
-        stream.videoResolution = QSize(streamInfoMap["width"].toInt(), streamInfoMap["height"].toInt());
-        stream.profile = streamInfoMap["profile"].toString();
+  return streams;
+}
 
-        info.streams.append(stream);
-      }
+/////////////////////////////////////////////////////////////////////////////////////////
+int PlayerComponent::serverHDRFormat(const QVariantMap& serverMediaInfo)
+{
+  for (auto partInfo : serverMediaInfo["Part"].toList())
+  {
+    for (auto streamInfo : partInfo.toMap()["Stream"].toList())
+    {
+      QString colorTrc = streamInfo.toMap()["colorTrc"].toString();
+      if (colorTrc == "smpte2084")
+        return DM_HDR_HDR10;
+      if (colorTrc == "arib-std-b67")
+        return DM_HDR_HLG;
+    }
+  }
+
+  return DM_HDR_NONE;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QList<StreamInfo> PlayerComponent::serverStreams(const QVariantMap& serverMediaInfo)
+{
+  QList<StreamInfo> streams;
+
+  for (auto partInfo : serverMediaInfo["Part"].toList())
+  {
+    for (auto streamInfo : partInfo.toMap()["Stream"].toList())
+    {
+      auto streamInfoMap = streamInfo.toMap();
+
+      StreamInfo stream = {};
+      stream.isVideo = streamInfoMap["width"].isValid();
+      stream.isAudio = streamInfoMap["channels"].isValid();
+      stream.codec = Codecs::plexNameToFF(streamInfoMap["codec"].toString());
+      stream.audioChannels = streamInfoMap["channels"].toInt();
+      stream.videoResolution = QSize(streamInfoMap["width"].toInt(), streamInfoMap["height"].toInt());
+      stream.profile = streamInfoMap["profile"].toString();
+
+      streams.append(stream);
     }
   }
 
+  return streams;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QStringList PlayerComponent::missingCodecs(const QVariantMap& serverMediaInfo, QList<CodecDriver>* required)
+{
+  // the tracks of what is playing now don't matter
+  PlaybackInfo info = getPlaybackInfo(QVariantList());
+  info.streams = serverStreams(serverMediaInfo);
+  if (info.streams.isEmpty())
+    return QStringList();
+
+  Codecs::updateCachedCodecList();
+  QList<CodecDriver> codecs = Codecs::determineRequiredCodecs(info);
+
+  QStringList missing;
+  for (const CodecDriver& codec : codecs)
+  {
+    if (codec.external && !codec.present)
+      missing << codec.getMangledName();
+  }
+
+  if (required)
+    *required = codecs;
+  return missing;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+CodecsFetcher* PlayerComponent::fetchMissingCodecs(const QVariantMap& serverMediaInfo, const QString& what,
+                                                   QStringList* missingOut, bool background)
+{
+  QList<CodecDriver> codecs;
+  QStringList missing = missingCodecs(serverMediaInfo, &codecs);
+  if (missingOut)
+    *missingOut = missing;
+
+  if (missing.isEmpty())
+    return nullptr;
+
+  QLOG_INFO() << "Prefetching codecs for" << what << ":" << missing.join(", ");
+
+  // startCodecsLoading() finds them installed once the item is loaded. Starting
+  // them is left to it as well, the current file might still use the old ones.
+  auto fetcher = new CodecsFetcher();
+  connect(fetcher, &CodecsFetcher::done, [=](CodecsFetcher* sender)
+  {
+    QLOG_INFO() << "Codec prefetch for" << what << "finished.";
+    sender->deleteLater();
+  });
+  fetcher->startCodecs = false;
+  fetcher->background = background;
+  fetcher->installCodecs(codecs);
+  return fetcher;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::prefetchCodecs(const QVariantMap& serverMediaInfo)
+{
+  fetchMissingCodecs(serverMediaInfo, "the next item");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::prewarmCodecs(const QVariantList& streams)
+{
+  // a later call has the newer statistics
+  m_prewarmStreams = streams;
+  startCodecPrewarm();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::startCodecPrewarm()
+{
+  // playback comes first, and what it needs is fetched by the hooks and prefetchCodecs()
+  if (m_inPlayback)
+    return;
+
+  // paused when playback started
+  if (m_prewarmFetcher)
+  {
+    m_prewarmFetcher->setPaused(false);
+    return;
+  }
+
+  if (m_prewarmStreams.isEmpty())
+    return;
+
+  QVariantMap library = {{ "Part", QVariantList{ QVariantMap{{ "Stream", m_prewarmStreams }} } }};
+  m_prewarmStreams.clear();
+
+  m_prewarmFetcher = fetchMissingCodecs(library, "the library", nullptr, true);
+  if (m_prewarmFetcher)
+  {
+    connect(m_prewarmFetcher, &CodecsFetcher::done, this, [=]()
+    {
+      m_prewarmFetcher = nullptr;
+      startCodecPrewarm();
+    });
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::requestThumbnails(const QVariantList& positions, int width)
+{
+  QString source;
+  if (m_mpv && m_inPlayback && !m_mediaIsMusic)
+    source = mpv::qt::get_property(m_mpv, "path").toString();
+
+  QUrl url(source);
+  bool local = url.isLocalFile() || url.scheme().isEmpty();
+  if (!source.isEmpty() && !local && (url.path().contains("/transcode/") || !mpv::qt::get_property(m_mpv, "seekable").toBool()))
+    source.clear();
+
+  QString userAgent = m_mpv ? mpv::qt::get_property(m_mpv, "user-agent").toString() : QString();
+  for (const QVariant& position : positions)
+  {
+    if (source.isEmpty())
+      emit thumbnailReady(position.toLongLong(), width, QString());
+    else
+      m_thumbnails->request(source, userAgent, position.toLongLong(), width);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::prepareMedia(const QString& url, const QVariantMap& metadata)
+{
+  auto it = m_preparedMedia.find(url);
+  if (it != m_preparedMedia.end() &&
+      (it->codecsFetching || it->codecListGeneration == Codecs::cachedCodecListGeneration()))
+  {
+    emit mediaPrepared(url, preparedInfo(*it));
+    return;
+  }
+
+  if (it == m_preparedMedia.end() && m_preparedMedia.size() >= PREPARED_MEDIA_CACHE_SIZE)
+    m_preparedMedia.clear();
+
+  QVariantMap serverMediaInfo = metadata["media"].toMap();
+  float frameRate = metadata["frameRate"].toFloat();
+  bool music = metadata["type"] == "music";
+
+  PreparedMedia prepared;
+  prepared.hdrFormat = serverHDRFormat(serverMediaInfo);
+  prepared.serverStreams = indexServerStreams(serverMediaInfo);
+  prepared.codecsFetching = false;
+
+  // the match is cached by the display manager, switchDisplayFrameRate() finds it there
+  if (!music && SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.auto_switch").toBool())
+  {
+    bool hdrSwitch = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "refreshrate.hdr_switch").toBool();
+    prepared.videoMode = DisplayComponent::Get().bestVideoModeName(frameRate, hdrSwitch ? prepared.hdrFormat : DM_HDR_NONE);
+  }
+
+  // While an earlier item's codecs are downloading this only says what's missing, that gets
+  // downloaded when the item is loaded (or prepared again).
+  CodecsFetcher* fetcher = nullptr;
+  if (!m_prepareFetcher)
+    fetcher = fetchMissingCodecs(serverMediaInfo, "a prepared item", &prepared.missingCodecs);
+  else
+    prepared.missingCodecs = missingCodecs(serverMediaInfo);
+  prepared.codecListGeneration = Codecs::cachedCodecListGeneration();
+
+  if (fetcher)
+  {
+    prepared.codecsFetching = true;
+    m_prepareFetcher = fetcher;
+    connect(fetcher, &CodecsFetcher::done, this, [=]()
+    {
+      m_prepareFetcher = nullptr;
+      auto done = m_preparedMedia.find(url);
+      if (done == m_preparedMedia.end())
+        return;
+
+      // what failed to download is still missing
+      done->codecsFetching = false;
+      done->missingCodecs = missingCodecs(serverMediaInfo);
+      done->codecListGeneration = Codecs::cachedCodecListGeneration();
+      emit mediaPrepared(url, preparedInfo(*done));
+    });
+  }
+
+  QUrl qurl(url);
+  if (qurl.scheme() == "http" && !IsPlexDirectURL(qurl.host()))
+    HostResolver::Get().prepare(qurl.host(), qurl.port(80));
+
+  // EAE is a process, that waits for queueMedia()
+  it = m_preparedMedia.insert(url, prepared);
+  emit mediaPrepared(url, preparedInfo(*it));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::preparedInfo(const PreparedMedia& prepared) const
+{
+  QVariantMap info;
+  info["codecsReady"] = prepared.missingCodecs.isEmpty() && !prepared.codecsFetching;
+  info["missingCodecs"] = prepared.codecsFetching ? QStringList() : prepared.missingCodecs;
+  info["videoMode"] = prepared.videoMode;
+  info["hdr"] = prepared.hdrFormat != DM_HDR_NONE;
   return info;
 }
 
@@ -1395,13 +2569,13 @@ void PlayerComponent::setPreferredCodecs(const QList<CodecDriver>& codecs)
 Q_DECLARE_METATYPE(std::function<void()>);
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void PlayerComponent::startCodecsLoading(std::function<void()> resume)
+void PlayerComponent::startCodecsLoading(std::function<void()> resume, const QVariant& tracks)
 {
   auto fetcher = new CodecsFetcher();
   fetcher->userData = QVariant::fromValue(resume);
   connect(fetcher, &CodecsFetcher::done, this, &PlayerComponent::onCodecsLoadingDone);
   Codecs::updateCachedCodecList();
-  QList<CodecDriver> codecs = Codecs::determineRequiredCodecs(getPlaybackInfo());
+  QList<CodecDriver> codecs = Codecs::determineRequiredCodecs(getPlaybackInfo(tracks));
   setPreferredCodecs(codecs);
   fetcher->installCodecs(codecs);
 }
@@ -1413,22 +2587,226 @@ void PlayerComponent::onCodecsLoadingDone(CodecsFetcher* sender)
   sender->userData.value<std::function<void()>>()();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::finishOperation(OperationLatency::Operation operation)
+{
+  if (!m_latency.pending(operation))
+    return;
+
+  m_latency.finish(operation);
+  m_debugDirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::recordSession(int endReason, const QVariantMap& quality)
+{
+  QVariantMap session;
+  session["startedAt"] = QDateTime::currentDateTimeUtc().addMSecs(-m_session.elapsed()).toString(Qt::ISODate);
+  session["durationMsec"] = m_session.elapsed();
+  session["phases"] = m_session.phases();
+  session["quality"] = quality;
+  session["server"] = m_mediaServer;
+  session["music"] = m_mediaIsMusic;
+  session["bitrateKbps"] = CachePolicy::bitrateFromMediaInfo(m_serverMediaInfo);
+  // "no" is software decoding, empty if no frame was ever shown
+  session["decoder"] = m_sessionDecoder;
+  session["videoCodec"] = m_sessionVideoCodec;
+  session["latency"] = m_latency.summary();
+
+  switch (endReason)
+  {
+    case MPV_END_FILE_REASON_EOF:
+      session["end"] = "eof";
+      break;
+    case MPV_END_FILE_REASON_STOP:
+      session["end"] = "stop";
+      break;
+    case MPV_END_FILE_REASON_ERROR:
+      session["end"] = "error";
+      session["error"] = m_playbackError;
+      break;
+    default:
+      session["end"] = "other";
+      break;
+  }
+
+  SessionMetrics::Get().record(session);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
-static QString get_mpv_osd(mpv_handle *ctx, const QString& property)
+void PlayerComponent::applyCachePolicy()
 {
-  char *s = mpv_get_property_osd_string(ctx, property.toUtf8().data());
-  if (!s)
-    return "-";
-  QString r = QString::fromUtf8(s);
-  mpv_free(s);
-  if (r.size() > 400)
-    r = r.mid(0, 400) + "...";
-  Log::CensorAuthTokens(r);
-  return r;
+  CachePolicy::Sizes sizes = m_cachePolicy.sizes();
+  if (sizes == m_cacheSizes)
+    return;
+
+  QLOG_DEBUG() << "Cache:" << sizes.cacheKB << "KB, backbuffer:" << sizes.backbufferKB
+               << "KB, demuxer:" << sizes.demuxerMaxBytes / 1024 << "KB, readahead:"
+               << sizes.readaheadSecs << "s";
+
+  m_cacheSizes = sizes;
+  setPropertyAsync("cache", sizes.cacheKB);
+  setPropertyAsync("cache-backbuffer", sizes.backbufferKB);
+  setPropertyAsync("demuxer-max-bytes", sizes.demuxerMaxBytes);
+  setPropertyAsync("demuxer-readahead-secs", sizes.readaheadSecs);
+  m_rebuffer.setReadahead(sizes.readaheadSecs);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateRebufferPrediction()
+{
+  // Close to the end the cache shrinks because there is nothing more to read.
+  bool cachedToEnd = m_mediaDuration > 0 && m_pendingPosition + m_cacheDuration >= m_mediaDuration - 1;
+  m_rebuffer.addSample(m_rebufferClock.elapsed(), m_cacheDuration, m_state == State::playing && !cachedToEnd);
+
+  double secondsLeft = m_rebuffer.secondsUntilStall();
+  if (m_rebuffer.stallPredicted() && !m_stallPredicted)
+  {
+    QLOG_INFO() << "Cache runs out in" << secondsLeft << "s, with" << m_cacheDuration << "s left";
+    m_stallPredicted = true;
+    emit stallPredicted(secondsLeft);
+  }
+  else if (secondsLeft < 0)
+  {
+    m_stallPredicted = false;
+  }
+
+  // only the next stall uses it, small changes aren't worth a property set
+  double wait = m_rebuffer.cachePauseWait();
+  if (fabs(wait - m_cachePauseWait) >= 0.5)
+  {
+    QLOG_DEBUG() << "cache-pause-wait:" << wait << "s";
+    m_cachePauseWait = wait;
+    setPropertyAsync("cache-pause-wait", wait);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::resetRebufferPrediction()
+{
+  m_rebuffer.reset();
+  m_stallPredicted = false;
+  m_mediaDuration = 0;
+
+  // the rate of the last file doesn't apply, back to mpv's default
+  if (m_cachePauseWait != 1)
+  {
+    m_cachePauseWait = 1;
+    setPropertyAsync("cache-pause-wait", 1.0);
+  }
 }
 
-#define MPV_PROPERTY(p) get_mpv_osd(m_mpv, p)
-#define MPV_PROPERTY_BOOL(p) (mpv::qt::get_property(m_mpv, p).toBool())
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::sampleFrameCounters()
+{
+  if (!m_quality.active())
+    return;
+
+  // mpv's counters are per file, so the last value is the total so far.
+  QVariant drops = mpv::qt::get_property(m_mpv, "frame-drop-count");
+  if (!mpv::qt::is_error(drops))
+    m_quality.setFrameDrops(drops.toLongLong());
+  QVariant decoderDrops = mpv::qt::get_property(m_mpv, "decoder-frame-drop-count");
+  if (!mpv::qt::is_error(decoderDrops))
+    m_quality.setDecoderFrameDrops(decoderDrops.toLongLong());
+  QVariant delayed = mpv::qt::get_property(m_mpv, "vo-delayed-frame-count");
+  if (!mpv::qt::is_error(delayed))
+    m_quality.setDelayedFrames(delayed.toLongLong());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::reviewCachePolicy()
+{
+  if (!m_quality.active())
+    return;
+
+  m_cachePolicy.setThroughput(m_quality.cacheSpeedMean());
+  applyCachePolicy();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap PlayerComponent::currentPlaybackQuality() const
+{
+  return m_quality.active() ? m_quality.summary() : QVariantMap();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Everything videoInformation() shows. These are only observed while the debug
+// overlay is visible.
+static const char* g_debugProperties[] =
+{
+  "idle-active", "path", "file-format", "seekable", "partially-seekable",
+  "video-codec", "video-params/dw", "video-params/dh", "container-fps",
+  "estimated-vf-fps", "video-aspect", "video-bitrate", "display-fps",
+  "hwdec-current", "hwdec-interop", "audio-codec", "audio-bitrate",
+  "audio-params/format", "audio-params/hr-channels", "audio-params/channels",
+  "audio-out-params/format", "audio-out-params/hr-channels", "audio-out-params/channels",
+  "current-ao", "avsync", "vo-drop-frame-count", "display-sync-active", "vsync-ratio",
+  "mistimed-frame-count", "vo-delayed-frame-count", "estimated-display-fps",
+  "vsync-jitter", "video-speed-correction", "audio-speed-correction",
+  "demuxer-cache-duration", "cache-used", "cache-buffering-state", "cache-speed",
+  "playback-time", "duration", "percent-pos", "pause", "paused-for-cache",
+  "core-idle", "seeking",
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::setDebugOverlayActive(bool active)
+{
+  if (active == m_debugOverlayActive)
+    return;
+
+  m_debugOverlayActive = active;
+
+  if (active)
+  {
+    // mpv sends the current value of each property right away, and afterwards
+    // only when it changes.
+    for (const char* name : g_debugProperties)
+      mpv_observe_property(m_mpv, m_debugObserverId, name, MPV_FORMAT_OSD_STRING);
+  }
+  else
+  {
+    mpv_unobserve_property(m_mpv, m_debugObserverId);
+    m_debugValues.clear();
+  }
+
+  m_debugText.clear();
+  m_debugDirty = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PlayerComponent::updateDebugValue(mpv_event_property* prop)
+{
+  if (!m_debugOverlayActive)
+    return;
+
+  QString value = "-";
+  if (prop->format == MPV_FORMAT_OSD_STRING && prop->data)
+  {
+    value = QString::fromUtf8(*(char **)prop->data);
+    if (value.size() > 400)
+      value = value.mid(0, 400) + "...";
+    // Only the URL can carry a token, so don't scan every number that changes.
+    if (!strcmp(prop->name, "path"))
+      Log::CensorAuthTokens(value);
+  }
+
+  QString& cached = m_debugValues[QString::fromUtf8(prop->name)];
+  if (cached != value)
+  {
+    cached = value;
+    m_debugDirty = true;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString PlayerComponent::debugValue(const QString& name) const
+{
+  return m_debugValues.value(name, "-");
+}
+
+#define MPV_PROPERTY(p) debugValue(p)
+#define MPV_PROPERTY_BOOL(p) (debugValue(p) == "yes")
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void PlayerComponent::appendAudioFormat(QTextStream& info, const QString& property) const
@@ -1453,12 +2831,20 @@ void PlayerComponent::appendAudioFormat(QTextStream& info, const QString& proper
 /////////////////////////////////////////////////////////////////////////////////////////
 QString PlayerComponent::videoInformation() const
 {
-  QString infoStr;
-  QTextStream info(&infoStr);
+  // The display refresh rate isn't an mpv property, so it's checked by hand.
+  double displayFps = DisplayComponent::Get().currentRefreshRate();
+  if (!m_debugDirty && displayFps == m_debugDisplayFps)
+    return m_debugText;
+
+  m_debugDirty = false;
+  m_debugDisplayFps = displayFps;
+  m_debugText.clear();
 
   // check if video is playing
-  if (mpv::qt::get_property(m_mpv, "idle-active").toBool())
-    return "";
+  if (!m_debugOverlayActive || MPV_PROPERTY_BOOL("idle-active"))
+    return m_debugText;
+
+  QTextStream info(&m_debugText);
 
   info << "File:" << endl;
   info << "URL: " << MPV_PROPERTY("path") << endl;
@@ -1475,7 +2861,6 @@ QString PlayerComponent::videoInformation() const
   info << "FPS (filters): " << MPV_PROPERTY("estimated-vf-fps") << endl;
   info << "Aspect: " << MPV_PROPERTY("video-aspect") << endl;
   info << "Bitrate: " << MPV_PROPERTY("video-bitrate") << endl;
-  double displayFps = DisplayComponent::Get().currentRefreshRate();
   info << "Display FPS: " << MPV_PROPERTY("display-fps")
                           << " (" << displayFps << ")" << endl;
   info << "Hardware Decoding: " << MPV_PROPERTY("hwdec-current")
@@ -1526,8 +2911,34 @@ QString PlayerComponent::videoInformation() const
                     << (MPV_PROPERTY_BOOL("core-idle") ? "waiting " : "playing ")
                     << (MPV_PROPERTY_BOOL("seeking") ? "seeking " : "")
                     << endl;
+  info << endl;
+  info << "Latency (ms, <=100/250/500/1000/2500/5000/more):" << endl;
+  info << m_latency.overlay();
 
   info << flush;
-  return infoStr;
+  return m_debugText;
 }
 
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString PlayerComponent::diagnosticsInformation() const
+{
+  QString text;
+  QTextStream info(&text);
+
+  info << "Player" << endl;
+  for (const char* name : g_debugProperties)
+  {
+    char* data = mpv_get_property_osd_string(m_mpv, name);
+    QString value = data ? QString::fromUtf8(data) : "-";
+    mpv_free(data);
+
+    if (!strcmp(name, "path"))
+      Log::CensorAuthTokens(value);
+    info << "  " << name << ": " << value << endl;
+  }
+  info << endl;
+
+  info << flush;
+  return text;
+}
@@ -5,8 +5,11 @@
 #include <QtCore/qglobal.h>
 #include <QVariant>
 #include <QSet>
+#include <QHash>
+#include <QVector>
 #include <QQuickWindow>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QTextStream>
 
 #include <functional>
@@ -14,6 +17,14 @@
 #include "ComponentManager.h"
 #include "CodecsComponent.h"
 #include "QtHelper.h"
+#include "PlaybackQuality.h"
+#include "PlaybackSession.h"
+#include "OperationLatency.h"
+#include "AudioSyncProfile.h"
+#include "ThumbnailExtractor.h"
+#include "CachePolicy.h"
+#include "RebufferPredictor.h"
+#include "MpvLog.h"
 
 #include <mpv/client.h>
 
@@ -28,6 +39,7 @@ public:
   const char* componentName() override { return "player"; }
   bool componentExport() override { return true; }
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings", "display" }; }
   void componentPostInitialize() override;
   
   explicit PlayerComponent(QObject* parent = nullptr);
@@ -51,6 +63,14 @@ public:
 
   Q_INVOKABLE virtual void seekTo(qint64 ms);
 
+  // Scrubbing through the seek bar. Between beginScrub() and endScrub() only
+  // keyframes are seeked to, and at most one seek is waiting for mpv: further
+  // scrubTo() calls replace each other until it is done. endScrub() does the
+  // precise seek to where the user let go.
+  Q_INVOKABLE void beginScrub();
+  Q_INVOKABLE void scrubTo(qint64 ms);
+  Q_INVOKABLE void endScrub(qint64 ms);
+
   // Stop playback and clear all queued items.
   Q_INVOKABLE virtual void stop();
 
@@ -85,6 +105,8 @@ public:
   Q_INVOKABLE virtual void setAudioStream(const QString& audioStream);
   Q_INVOKABLE virtual void setSubtitleStream(const QString& subtitleStream);
 
+  // Set while playing, the delay is remembered for the audio output (see AudioSyncProfile)
+  // and used again when a later file plays on it.
   Q_INVOKABLE virtual void setAudioDelay(qint64 milliseconds);
   Q_INVOKABLE virtual void setSubtitleDelay(qint64 milliseconds);
 
@@ -92,6 +114,11 @@ public:
   // only. If no video is running, render a black background only.
   Q_INVOKABLE virtual void setVideoOnlyMode(bool enable);
 
+  // Web tells us whether its OSD (or anything else) is drawn over the video. While
+  // video plays without it, the web view is left out of the scene graph, so it
+  // isn't composited over every frame.
+  Q_INVOKABLE virtual void setOsdVisible(bool visible);
+
   // Currently is meant to check for "vc1" and "mpeg2video". Will return whether
   // it can be natively decoded. Will return true for all other codecs,
   // including unknown codec names.
@@ -101,7 +128,11 @@ public:
   // Downloadable, but not yet installed codecs are excluded.
   // May include codecs that do not work, like vc1_mmal on RPIs with no license.
   // (checkCodecSupport() handles this specific case to a degree.)
+  // Read from the cached codec list, which at startup is the one saved by the last start
+  // until Codecs::initCodecs() checked it against mpv.
   Q_INVOKABLE virtual QList<CodecDriver> installedCodecDrivers();
+  // The same, asked from mpv right away.
+  QList<CodecDriver> mpvCodecDrivers();
 
   // Return list of codecs supported for decoding. This specifically returns
   // the format and not decoder implementation (e.g. "h264" not "h264_mmal").
@@ -117,16 +148,57 @@ public:
   // automatically use the whole window. (Same if the rectangle is 0-sized.)
   Q_INVOKABLE void setVideoRectangle(int x, int y, int w, int h);
 
+  // What playbackQuality() would report if the current file ended now. Empty
+  // if nothing is playing.
+  Q_INVOKABLE QVariantMap currentPlaybackQuality() const;
+
+  // Download the codecs the library is likely to need, before anything is played. streams
+  // are Plex stream maps like the ones of an item, e.g. one per codec and resolution or
+  // channel count found in the library: video streams have width and height, audio streams
+  // channels. Waits while something plays.
+  Q_INVOKABLE void prewarmCodecs(const QVariantList& streams);
+
+  // Called by web when an item is likely to be played soon, e.g. when it's selected. url and
+  // metadata are what queueMedia() would get. Downloads the codecs it needs, looks up the
+  // display mode it would switch to and resolves the server, so queueMedia() finds all of
+  // that done. mediaPrepared() reports the result.
+  Q_INVOKABLE void prepareMedia(const QString& url, const QVariantMap& metadata);
+
+  // Seek bar previews and chapter images of the current file, for servers that have no
+  // index for it. positions are in ms, the images are width pixels wide (0 for the default)
+  // and each comes with thumbnailReady(). Nothing is extracted for music and transcoded
+  // streams, which would start another transcode on the server.
+  Q_INVOKABLE void requestThumbnails(const QVariantList& positions, int width = 0);
+
+  // Last observed cache-speed (bytes/s) and demuxer-cache-duration (seconds).
+  double cacheSpeed() const { return m_cacheSpeed; }
+  double cacheDuration() const { return m_cacheDuration; }
+
   QRect videoRectangle() { return m_videoRectangle; }
 
+  // If true, a custom video rectangle is rendered into a separate FBO and then
+  // blitted to the screen. Otherwise mpv draws directly into the window
+  // framebuffer, positioned with video-zoom/video-pan and clipped by a scissor.
+  bool videoRectangleBlit() const { return m_videoRectangleBlit; }
+
   const mpv::qt::Handle getMpvHandle() const { return m_mpv; }
 
   virtual void setWindow(QQuickWindow* window);
 
+  // Start or stop observing the properties the debug overlay shows. While it's
+  // inactive videoInformation() returns an empty string.
+  void setDebugOverlayActive(bool active);
+  // Cached text, only formatted again if one of the observed values changed.
   QString videoInformation() const;
+  // All the values the overlay shows, asked from mpv right away. For diagnostics dumps,
+  // where the overlay is most likely not open.
+  QString diagnosticsInformation() const;
 
   static QStringList AudioCodecsAll() { return { "ac3", "dts", "eac3", "dts-hd", "truehd" }; };
   static QStringList AudioCodecsSPDIF() { return { "ac3", "dts" }; };
+  // What the HDMI sink says it decodes, if the settings ask to detect it. Only
+  // codecs the player can pass through on this platform are listed.
+  static QStringList DetectedPassthroughCodecs();
 
   enum class State {
     finished,
@@ -147,13 +219,24 @@ public Q_SLOTS:
   void updateAudioDeviceList();
   void updateSubtitleSettings();
   void updateVideoSettings();
+  void updateLogLevels();
+
+protected:
+  // Wakes the web view up on the window's input.
+  bool eventFilter(QObject* watched, QEvent* event) override;
 
 private Q_SLOTS:
   void handleMpvEvents();
   void onRestoreDisplay();
   void onRefreshRateChange();
+  void onVideoModeSwitched(bool success);
   void onCodecsLoadingDone(CodecsFetcher* sender);
   void updateAudioDevice();
+  void flushPlaybackSnapshot();
+  // Look at the cache sizes again, now that the throughput is known better.
+  void reviewCachePolicy();
+  // Read the dropped and delayed frame counts into m_quality.
+  void sampleFrameCounters();
 
 Q_SIGNALS:
   // The following signals correspond to the State enum above.
@@ -178,11 +261,38 @@ Q_SIGNALS:
   // when position updates
   void positionUpdate(quint64);
 
+  // Coalesced playback state, emitted at most "positionUpdateRate" times a second.
+  void playbackSnapshot(quint64 positionMs, bool paused, int bufferingPercentage);
+
+  // Summary of frame drops, cache and A/V sync health, emitted when a file ends.
+  // See PlaybackQuality::summary() for the keys.
+  void playbackQuality(const QVariantMap& summary);
+
+  // Progress of all codec downloads together, a few times per second while any runs.
+  // See DownloadProgress::progress() for the keys.
+  void codecDownloadProgress(const QVariantMap& summary);
+
+  // For prepareMedia(), again once the codecs it started downloading are installed. Keys:
+  // "codecsReady" (bool), "missingCodecs" (the ones that aren't installed, empty while they
+  // are downloading),
+  // "videoMode" (the mode the display would switch to, empty if none) and "hdr" (bool).
+  void mediaPrepared(const QString& url, const QVariantMap& info);
+
+  // The cache shrinks while playing and runs out in about secondsLeft, the network can't keep
+  // up with the stream. Emitted once, until the cache stops shrinking (or after a seek).
+  void stallPredicted(double secondsLeft);
+
+  // For requestThumbnails(), image is a JPEG data: URL or empty if there is none.
+  void thumbnailReady(qint64 positionMs, int width, const QString& image);
+
   void onVideoRecangleChanged();
 
   void onMpvEvents();
   
 private:
+  // feeds synthetic events to handleMpvEvents(), see tests/PlayerTest.h
+  friend class PlayerTest;
+
   // this is the function actually implemented in the backends. the variantmap contains
   // a few known keys:
   // * subtitleStreamIndex
@@ -194,29 +304,163 @@ private:
   void loadWithOptions(const QVariantMap& options);
   void setQtQuickWindow(QQuickWindow* window);
   void updatePlaybackState();
+  // Schedule a playback snapshot. The first one after a quiet period is sent
+  // right away, further changes are merged until the rate limit timer fires.
+  void queuePlaybackSnapshot();
   void handleMpvEvent(mpv_event *event);
-  // Potentially switch the display refresh rate, and return true if the refresh rate
-  // was actually changed.
+
+  typedef std::function<void(mpv_event_property*)> PropertyHandler;
+  // Observe an mpv property and call handler on every change. The handler is
+  // looked up by reply_userdata, so there's no need to compare property names.
+  void observeProperty(const char* name, mpv_format format, const PropertyHandler& handler);
+
+  // error is an mpv_error, result the command's return value (if any).
+  typedef std::function<void(int error, const QVariant& result)> ReplyHandler;
+  // Submit a command or property change without waiting for mpv's core to get to it,
+  // which can take long while it's stuck on the network. The handler runs from
+  // handleMpvEvent() once mpv replied, failures are logged if there is none.
+  void commandAsync(const QVariant& args, const ReplyHandler& handler = nullptr);
+  void commandAsync(mpv::qt::command_builder& command, const ReplyHandler& handler = nullptr);
+  void submitCommand(const QString& name, mpv_node* command, const ReplyHandler& handler);
+  void setPropertyAsync(const QString& name, const QVariant& value, const ReplyHandler& handler = nullptr);
+  void handleAsyncReply(uint64_t id, int error, const QVariant& result);
+  // Potentially switch the display refresh rate, and return true if a refresh rate
+  // switch was started. The switch happens asynchronously, see waitForDisplaySwitch().
   bool switchDisplayFrameRate();
+  // Call resume() once a pending refresh rate switch is done (or right away if there's none).
+  void waitForDisplaySwitch(std::function<void()> resume);
+  // Use display-resample for the file if the refresh rate doesn't fit its frame rate.
+  void updateSyncMode();
+  void updateAudioDevices(const mpv::qt::node_view& list);
   void checkCurrentAudioDevice(const QSet<QString>& old_devs, const QSet<QString>& new_devs);
   void appendAudioFormat(QTextStream& info, const QString& property) const;
+  // Set the sizes m_cachePolicy picks, if they changed.
+  void applyCachePolicy();
+  // A timed operation is done, see OperationLatency.
+  void finishOperation(OperationLatency::Operation operation);
+  // Sets audio-delay from the refresh rate setting and m_playbackAudioDelay.
+  void applyAudioDelay();
+  // Switches m_audioSync to the output that plays now, and applies its delay if it has one.
+  void updateAudioSyncOutput();
+  void saveAudioSync();
+  // Hand the ended session to SessionMetrics. endReason is an mpv_end_file_reason.
+  void recordSession(int endReason, const QVariantMap& quality);
+  // Feed m_rebuffer, emit stallPredicted() and adapt cache-pause-wait.
+  void updateRebufferPrediction();
+  void resetRebufferPrediction();
+  // Send the waiting scrub seek, unless one is still in flight.
+  void sendScrubSeek();
+  void updateDebugValue(mpv_event_property* prop);
+  QString debugValue(const QString& name) const;
   void initializeCodecSupport();
-  PlaybackInfo getPlaybackInfo();
+  // tracks is mpv's track-list, it's read from mpv if not given
+  PlaybackInfo getPlaybackInfo(const QVariant& tracks = QVariant());
   // Make the player prefer certain codecs over others.
   void setPreferredCodecs(const QList<CodecDriver>& codecs);
   // Determine the required codecs and possibly download them.
   // Call resume() when done.
-  void startCodecsLoading(std::function<void()> resume);
+  void startCodecsLoading(std::function<void()> resume, const QVariant& tracks = QVariant());
   void updateVideoAspectSettings();
-  QVariantList findStreamsForURL(const QString &url);
-  void reselectStream(const QString &streamSelection, MediaType target);
+  // The mpv options for the video, subtitle and aspect settings. Each one maps
+  // option names to values, so they can be applied in one batch.
+  QVariantMap videoOptions();
+  QVariantMap subtitleOptions();
+  // empty if the user handles the aspect in mpv.conf
+  QVariantMap videoAspectOptions();
+  // Send mpv those options that changed since the last call, without waiting for it.
+  void applyVideoOptions(const QVariantMap& options);
+  // Position the video inside m_videoRectangle (only used if not blitting).
+  void updateVideoRectangleGeometry();
+  // Skip compositing the web view if it has nothing to draw over the video, and
+  // stop it from rendering at all if that lasts.
+  void updateWebLayer();
+  void setWebSuspended(bool suspended);
+  // Input arrived, web has to handle it.
+  void wakeWebView();
+
+  // A stream selection from web, parsed: the ff-index of the stream, and the external
+  // file it is in (empty for the main file).
+  struct StreamSelection
+  {
+    QString streamID;
+    QString url;
+  };
+  // "type|external file|ff-index" -> mpv track id
+  typedef QHash<QString, QString> TrackIndex;
+
+  static StreamSelection parseStreamSelection(const QString& streamSelection, MediaType target);
+  static TrackIndex indexTracks(const QVariantList& tracks);
+  // Load the external file of a selection if it isn't in tracks yet, returns whether it did.
+  bool addExternalStream(const StreamSelection& selection, MediaType target, const QVariantList& tracks);
+  void selectStream(const StreamSelection& selection, MediaType target, const TrackIndex& index);
+  void reselectStream(const StreamSelection& selection, MediaType target);
+  // The streams the server reported for an item, used before mpv opened it.
+  static QList<StreamInfo> serverStreams(const QVariantMap& serverMediaInfo);
+  // The server's streams of an item by their index, which is mpv's ff-index.
+  static QHash<int, QVariantMap> indexServerStreams(const QVariantMap& serverMediaInfo);
+  // DM_HDR_* format of the video stream, by the server's colorTrc.
+  static int serverHDRFormat(const QVariantMap& serverMediaInfo);
+  // Download the codecs an item needs while the current one is still playing.
+  void prefetchCodecs(const QVariantMap& serverMediaInfo);
+  // Start downloading what the streams need and isn't installed, nullptr if that's nothing.
+  // The mangled names of the external codecs the streams need and aren't installed. required
+  // is set to all codecs they need.
+  QStringList missingCodecs(const QVariantMap& serverMediaInfo, QList<CodecDriver>* required = nullptr);
+  // missing is set to what missingCodecs() returned. Background fetches are for nobody in
+  // particular, see CodecsFetcher::background.
+  CodecsFetcher* fetchMissingCodecs(const QVariantMap& serverMediaInfo, const QString& what,
+                                    QStringList* missing = nullptr, bool background = false);
+  void startCodecPrewarm();
+
+  // What queueMedia() knows about an item that mpv hasn't started yet.
+  struct QueuedMedia
+  {
+    float frameRate;
+    // DM_HDR_* of the video stream
+    int hdrFormat;
+    bool music;
+    QVariantMap serverMediaInfo;
+    QHash<int, QVariantMap> serverStreams;
+    // BandwidthEstimator::serverKey() of the url, empty if it's not http
+    QString server;
+    StreamSelection audioStream;
+    StreamSelection subtitleStream;
+  };
+
+  // What prepareMedia() found out about an item, by its url.
+  struct PreparedMedia
+  {
+    int hdrFormat;
+    QHash<int, QVariantMap> serverStreams;
+    QStringList missingCodecs;
+    bool codecsFetching;
+    QString videoMode;
+    // of the codec list missingCodecs was determined with
+    int codecListGeneration;
+  };
+  QVariantMap preparedInfo(const PreparedMedia& prepared) const;
 
   mpv::qt::Handle m_mpv;
+  QVector<PropertyHandler> m_propertyHandlers;
+  // observed property name to its reply_userdata
+  QHash<QByteArray, uint64_t> m_propertyIds;
+
+  struct AsyncReply
+  {
+    QString description;
+    ReplyHandler handler;
+  };
+  // keyed by reply_userdata, which is separate from the ids of observed properties
+  QHash<uint64_t, AsyncReply> m_asyncReplies;
+  uint64_t m_nextAsyncReply;
 
   State m_state;
   bool m_paused;
   bool m_playbackActive;
   bool m_windowVisible;
+  bool m_osdVisible;
+  bool m_videoOnlyMode;
+  bool m_webSuspended;
   bool m_videoPlaybackActive;
   bool m_inPlayback;
   bool m_playbackCanceled;
@@ -224,20 +468,109 @@ private:
   int m_bufferingPercentage;
   int m_lastBufferingPercentage;
   double m_lastPositionUpdate;
+  double m_pendingPosition;
+  bool m_lastSnapshotPaused;
+  int m_lastSnapshotBuffering;
+  QTimer m_snapshotTimer;
   qint64 m_playbackAudioDelay;
+  // learned lipsync delays per audio output, part of the state settings
+  AudioSyncProfile m_audioSync;
   QQuickWindow* m_window;
   float m_mediaFrameRate;
+  int m_mediaHDRFormat;
+  QString m_mediaServer;
+  // the file that is playing came from a music queue, there's no video to wait for
+  bool m_mediaIsMusic;
+  // from the observed video-dec-params, 0 if unknown
+  double m_videoAspect;
+  QTimer m_webSuspendTimer;
   QTimer m_restoreDisplayTimer;
   QTimer m_reloadAudioTimer;
-  QSet<QString> m_audioDevices;
+  // device name (which is stable) -> description, as last published to the settings
+  QMap<QString, QString> m_audioDevices;
+  QString m_publishedAudioDevice;
+  QTimer m_audioDeviceListTimer;
+  QTimer m_cachePolicyTimer;
+  CachePolicy m_cachePolicy;
+  CachePolicy::Sizes m_cacheSizes;
+  QTimer m_frameCounterTimer;
+  bool m_debugOverlayActive;
+  uint64_t m_debugObserverId;
+  // observed property name -> OSD formatted value
+  QHash<QString, QString> m_debugValues;
+  mutable bool m_debugDirty;
+  mutable double m_debugDisplayFps;
+  mutable QString m_debugText;
+  bool m_scrubbing;
+  bool m_scrubSeekInFlight;
+  // where the next scrub seek goes, -1 if there's none waiting
+  qint64 m_scrubTarget;
   bool m_streamSwitchImminent;
+  bool m_displaySwitchPending;
+  QList<std::function<void()>> m_displaySwitchWaiters;
   QMap<QString, bool> m_codecSupport;
   bool m_doAc3Transcoding;
+  QVariantList m_prewarmStreams;
+  CodecsFetcher* m_prewarmFetcher;
+  QHash<QString, PreparedMedia> m_preparedMedia;
+  // one item's codecs at a time, they would all write the same files
+  CodecsFetcher* m_prepareFetcher;
+
+  // What setAudioConfiguration() pushed to mpv last.
+  struct AudioProfile
+  {
+    bool exclusive = false;
+    QString device;
+    QString resampler;
+    QStringList passthroughCodecs;
+    QString channels;
+    bool ac3Transcoding = false;
+
+    bool operator==(const AudioProfile& other) const
+    {
+      return exclusive == other.exclusive && device == other.device && resampler == other.resampler &&
+             passthroughCodecs == other.passthroughCodecs && channels == other.channels &&
+             ac3Transcoding == other.ac3Transcoding;
+    }
+  };
+  AudioProfile compileAudioProfile();
+  AudioProfile m_audioProfile;
+  bool m_audioProfileApplied;
+  // video-sync is display-resample for this file, since no refresh rate fits it
+  bool m_displayResample;
   QStringList m_passthroughCodecs;
   QVariantMap m_serverMediaInfo;
-  QString m_currentSubtitleStream;
-  QString m_currentAudioStream;
+  QHash<int, QVariantMap> m_serverStreams;
+  PlaybackQuality m_quality;
+  // the startup phases of the current file, for SessionMetrics
+  PlaybackSession m_session;
+  // seeks and stream switches of the current file, for SessionMetrics and the overlay
+  OperationLatency m_latency;
+  ThumbnailExtractor* m_thumbnails;
+  // since load(), until mpv starts the file
+  QElapsedTimer m_loadClock;
+  qint64 m_queueMediaMsec;
+  // what decoded the video, known once the first frame is up
+  QString m_sessionDecoder;
+  QString m_sessionVideoCodec;
+  MpvLog m_log;
+  double m_cacheSpeed;
+  double m_cacheDuration;
+  // seconds, 0 if unknown
+  double m_mediaDuration;
+  RebufferPredictor m_rebuffer;
+  QElapsedTimer m_rebufferClock;
+  bool m_stallPredicted;
+  // what cache-pause-wait was set to
+  double m_cachePauseWait;
+  // in mpv's playlist order, the front one is taken when mpv starts the next file
+  QList<QueuedMedia> m_queuedMedia;
+  StreamSelection m_currentSubtitleStream;
+  StreamSelection m_currentAudioStream;
+  // what applyVideoOptions() sent last
+  QVariantMap m_videoOptions;
   QRect m_videoRectangle;
+  bool m_videoRectangleBlit;
 };
 
 #endif // PLAYERCOMPONENT_H
@@ -9,16 +9,19 @@
 #include <QtGui/QOpenGLFramebufferObject>
 
 #include <QtQuick/QQuickWindow>
+#include <QScreen>
 #include <QOpenGLFunctions>
 
 #include "QsLog.h"
 #include "utils/Utils.h"
+#include "utils/ProcessSampler.h"
+#include "utils/Trace.h"
+#include "settings/SettingsComponent.h"
 
 
 #if defined(Q_OS_WIN32)
 #include <windows.h>
 #include <dwmapi.h>
-#include <avrt.h>
 #endif
 
 #ifdef USE_X11EXTRAS
@@ -89,11 +92,28 @@ private:
 
 }
 
+// Sizes of the intermediate video rectangle FBO are rounded up to this.
+#define FBO_SIZE_ROUNDING 256
+
+// GL_NVX_gpu_memory_info
+#define GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#define GPU_MEMORY_QUERY_MSEC 10000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QSize roundFboSize(const QSize& size)
+{
+  auto roundUp = [](int v) { return ((v + FBO_SIZE_ROUNDING - 1) / FBO_SIZE_ROUNDING) * FBO_SIZE_ROUNDING; };
+  return QSize(roundUp(size.width()), roundUp(size.height()));
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-PlayerRenderer::PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window)
-: m_mpv(mpv), m_mpvGL(nullptr), m_window(window), m_size(), m_hAvrtHandle(nullptr), m_videoRectangle(-1, -1, -1, -1), m_fbo(0)
+PlayerRenderer::PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window, FrameTimings* timings)
+: m_mpv(mpv), m_mpvGL(nullptr), m_window(window), m_size(), m_raisePriority(false), m_videoRectangle(-1, -1, -1, -1), m_videoRectangleBlit(false), m_fbo(0), m_fboHasFrame(false), m_timings(timings), m_gpuMemoryQuery(0)
 {
+#ifndef HAVE_MPV_RENDER_API
   m_mpvGL = (mpv_opengl_cb_context *)mpv_get_sub_api(m_mpv, MPV_SUB_API_OPENGL_CB);
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -104,25 +124,71 @@ bool PlayerRenderer::init()
   DwmEnableMMCSS(TRUE);
 #endif
 
+#ifdef HAVE_MPV_RENDER_API
+  // mpv's hardware decoding interops (VAAPI/DRM-PRIME over EGL, D3D11 over
+  // ANGLE, IOSurface on CGL) map decoded frames into GL textures of this
+  // context, so they never go through system memory. Beyond the context
+  // itself, some of them need the native display.
+  mpv_opengl_init_params glInitParams = { get_proc_address, nullptr };
+  mpv_render_param params[] =
+  {
+    { MPV_RENDER_PARAM_API_TYPE, (void *)MPV_RENDER_API_TYPE_OPENGL },
+    { MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &glInitParams },
+    { MPV_RENDER_PARAM_INVALID, nullptr },
+    { MPV_RENDER_PARAM_INVALID, nullptr }
+  };
+#ifdef USE_X11EXTRAS
+  if (QX11Info::isPlatformX11())
+    params[2] = { MPV_RENDER_PARAM_X11_DISPLAY, QX11Info::display() };
+#endif
+
+  if (mpv_render_context_create(&m_mpvGL, m_mpv, params) < 0)
+  {
+    m_mpvGL = nullptr;
+    return false;
+  }
+
+  mpv_render_context_set_update_callback(m_mpvGL, on_update, (void *)this);
+  return true;
+#else
   mpv_opengl_cb_set_update_callback(m_mpvGL, on_update, (void *)this);
 
   // Signals presence of MPGetNativeDisplay().
   const char *extensions = "GL_MP_MPGetNativeDisplay";
   return mpv_opengl_cb_init_gl(m_mpvGL, extensions, get_proc_address, nullptr) >= 0;
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerRenderer::~PlayerRenderer()
 {
+  // Runs on the render thread as well, which may outlive the renderer.
+  m_priority.restore();
+
   // Keep in mind that the m_mpv handle must be held until this is done.
   if (m_mpvGL)
+  {
+#ifdef HAVE_MPV_RENDER_API
+    mpv_render_context_free(m_mpvGL);
+#else
     mpv_opengl_cb_uninit_gl(m_mpvGL);
+#endif
+  }
   delete m_fbo;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::render()
 {
+  TRACE_SCOPE("render", "PlayerRenderer::render");
+  m_timings->renderStart();
+
+  // The scenegraph also renders for UI changes, which don't need a new video frame.
+  bool newFrame = true;
+#ifdef HAVE_MPV_RENDER_API
+  newFrame = mpv_render_context_update(m_mpvGL) & MPV_RENDER_UPDATE_FRAME;
+#endif
+
   QOpenGLContext *context = QOpenGLContext::currentContext();
 
   GLint fbo = 0;
@@ -138,17 +204,28 @@ void PlayerRenderer::render()
   m_window->resetOpenGLState();
 
   QRect fullWindow(0, 0, m_size.width(), m_size.height());
-  if (m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0 && m_videoRectangle != fullWindow && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit() && QOpenGLFramebufferObject::hasOpenGLFramebufferObjects())
+  bool useRectangle = m_videoRectangle.width() > 0 && m_videoRectangle.height() > 0 && m_videoRectangle != fullWindow;
+  bool scissor = false;
+  if (useRectangle && m_videoRectangleBlit && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit() && QOpenGLFramebufferObject::hasOpenGLFramebufferObjects())
   {
-    if (!m_fbo || !m_fbo->isValid() || m_fbo->size() != m_videoRectangle.size())
+    // The FBO is over-allocated and only a sub-rectangle of it is used, so that
+    // resizing the video during UI animations doesn't reallocate it every frame.
+    // It's only replaced if the video rectangle outgrows it, or if it has become
+    // way bigger than needed.
+    QSize needed = m_videoRectangle.size();
+    bool tooSmall = !m_fbo || m_fbo->width() < needed.width() || m_fbo->height() < needed.height();
+    bool tooLarge = m_fbo && m_fbo->width() > FBO_SIZE_ROUNDING && m_fbo->height() > FBO_SIZE_ROUNDING &&
+                    m_fbo->width() * m_fbo->height() > 4 * needed.width() * needed.height();
+    if (tooSmall || tooLarge || !m_fbo->isValid())
     {
       delete m_fbo;
-      m_fbo = new QOpenGLFramebufferObject(m_videoRectangle.size());
+      m_fbo = new QOpenGLFramebufferObject(roundFboSize(needed));
+      m_fboHasFrame = false;
     }
     if (m_fbo && m_fbo->isValid())
     {
       blitFbo = m_fbo;
-      fboSize = m_fbo->size();
+      fboSize = needed;
       fbo = m_fbo->handle();
       flip = false;
 
@@ -157,10 +234,57 @@ void PlayerRenderer::render()
       context->functions()->glClear(GL_COLOR_BUFFER_BIT);
     }
   }
+  else if (useRectangle)
+  {
+    // PlayerComponent already moved the video into the rectangle (video-zoom/pan),
+    // so all that is left is to keep mpv from drawing its borders over the rest
+    // of the window.
+    QRect clip = m_videoRectangle;
+    if (screenFlip)
+      clip.moveTop(m_size.height() - m_videoRectangle.y() - m_videoRectangle.height());
 
-  // The negative height signals to mpv that the video should be flipped
-  // (according to the flipped OpenGL coordinate system).
-  mpv_opengl_cb_draw(m_mpvGL, fbo, fboSize.width(), (flip ? -1 : 1) * fboSize.height());
+    context->functions()->glEnable(GL_SCISSOR_TEST);
+    context->functions()->glScissor(clip.x(), clip.y(), clip.width(), clip.height());
+    scissor = true;
+
+    if (m_fbo)
+    {
+      delete m_fbo;
+      m_fbo = nullptr;
+    }
+  }
+
+  // Only our own FBO keeps the last frame, the window's back buffer has to be drawn
+  // every time. The FBO is redrawn when the video rectangle is resized, moving it is
+  // just a different blit.
+  bool redraw = newFrame || !blitFbo || !m_fboHasFrame || fboSize != m_fboFrameSize;
+  if (redraw)
+  {
+#ifdef HAVE_MPV_RENDER_API
+    mpv_opengl_fbo mpvFbo = { (int)fbo, fboSize.width(), fboSize.height(), 0 };
+    int flipY = flip ? 1 : 0;
+    mpv_render_param params[] =
+    {
+      { MPV_RENDER_PARAM_OPENGL_FBO, &mpvFbo },
+      { MPV_RENDER_PARAM_FLIP_Y, &flipY },
+      { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    mpv_render_context_render(m_mpvGL, params);
+#else
+    // The negative height signals to mpv that the video should be flipped
+    // (according to the flipped OpenGL coordinate system).
+    mpv_opengl_cb_draw(m_mpvGL, fbo, fboSize.width(), (flip ? -1 : 1) * fboSize.height());
+#endif
+
+    m_fboHasFrame = blitFbo != nullptr;
+    m_fboFrameSize = fboSize;
+  }
+  m_timings->renderDone();
+
+  queryGpuMemory(context);
+
+  if (scissor)
+    context->functions()->glDisable(GL_SCISSOR_TEST);
 
   m_window->resetOpenGLState();
 
@@ -170,37 +294,56 @@ void PlayerRenderer::render()
     if (screenFlip)
       dstRect = QRect(dstRect.x(), m_size.height() - dstRect.y(), dstRect.width(), dstRect.top() - dstRect.bottom());
 
-    QOpenGLFramebufferObject::blitFramebuffer(0, dstRect, blitFbo, QRect(QPoint(0, 0), blitFbo->size()));
+    // mpv drew into the lower left corner of the (possibly bigger) FBO.
+    QOpenGLFramebufferObject::blitFramebuffer(0, dstRect, blitFbo, QRect(QPoint(0, 0), fboSize));
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerRenderer::queryGpuMemory(QOpenGLContext* context)
+{
+  // Only NVIDIA drivers tell us how much video memory is in use.
+  if (m_gpuMemoryQuery == 0)
+    m_gpuMemoryQuery = context->hasExtension("GL_NVX_gpu_memory_info") ? 1 : -1;
+
+  if (m_gpuMemoryQuery < 0 || (m_gpuMemoryClock.isValid() && m_gpuMemoryClock.elapsed() < GPU_MEMORY_QUERY_MSEC))
+    return;
+  m_gpuMemoryClock.start();
+
+  GLint total = 0, available = 0;
+  context->functions()->glGetIntegerv(GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+  context->functions()->glGetIntegerv(GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+  ProcessSampler::Get().setGpuMemoryKB(total - available);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::swap()
 {
+#ifdef HAVE_MPV_RENDER_API
+  mpv_render_context_report_swap(m_mpvGL);
+#else
   mpv_opengl_cb_report_flip(m_mpvGL, 0);
+#endif
+
+  m_timings->swapped();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::onVideoPlaybackActive(bool active)
 {
-#ifdef Q_OS_WIN32
-  if (active && !m_hAvrtHandle)
-  {
-    DWORD handle = 0;
-    m_hAvrtHandle = AvSetMmThreadCharacteristicsW(L"Low Latency", &handle);
-  }
-  else if (!active && m_hAvrtHandle)
-  {
-    AvRevertMmThreadCharacteristics(m_hAvrtHandle);
-    m_hAvrtHandle = 0;
-  }
-#endif
+  // This runs on the render thread (the connection is queued).
+  if (active && m_raisePriority)
+    m_priority.raise();
+  else
+    m_priority.restore();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PlayerRenderer::on_update(void *ctx)
 {
   PlayerRenderer *self = (PlayerRenderer *)ctx;
+  self->m_timings->updateRequested();
+
   // QQuickWindow::scheduleRenderJob is expected to be called from the GUI thread but
   // is thread-safe when using the QSGThreadedRenderLoop. We can detect a non-threaded render
   // loop by checking if QQuickWindow::beforeSynchronizing was called from the GUI thread
@@ -223,8 +366,14 @@ PlayerQuickItem::PlayerQuickItem(QQuickItem* parent)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PlayerQuickItem::~PlayerQuickItem()
 {
+#ifdef HAVE_MPV_RENDER_API
+  // The render context belongs to the renderer.
+  if (m_renderer && m_renderer->m_mpvGL)
+    mpv_render_context_set_update_callback(m_renderer->m_mpvGL, nullptr, nullptr);
+#else
   if (m_mpvGL)
     mpv_opengl_cb_set_update_callback(m_mpvGL, nullptr, nullptr);
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -234,7 +383,22 @@ void PlayerQuickItem::onWindowChanged(QQuickWindow* win)
   {
     connect(win, &QQuickWindow::beforeSynchronizing, this, &PlayerQuickItem::onSynchronize, Qt::DirectConnection);
     connect(win, &QQuickWindow::sceneGraphInvalidated, this, &PlayerQuickItem::onInvalidate, Qt::DirectConnection);
+    connect(win, &QWindow::screenChanged, this, &PlayerQuickItem::onScreenChanged);
   }
+  onScreenChanged(win ? win->screen() : nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerQuickItem::onScreenChanged(QScreen* screen)
+{
+  // QScreen isn't safe to use from the render thread, so the rate is handed over.
+  disconnect(m_refreshRateConnection);
+  m_frameTimings.setDisplayFps(screen ? screen->refreshRate() : 0);
+  if (screen)
+    m_refreshRateConnection = connect(screen, &QScreen::refreshRateChanged, this, [=](qreal rate)
+    {
+      m_frameTimings.setDisplayFps(rate);
+    });
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -248,7 +412,11 @@ void PlayerQuickItem::onSynchronize()
 {
   if (!m_renderer && m_mpv)
   {
-    m_renderer = new PlayerRenderer(m_mpv, window());
+    m_renderer = new PlayerRenderer(m_mpv, window(), &m_frameTimings);
+    // The GUI thread is blocked during synchronization, so reading settings is safe.
+    m_renderer->m_raisePriority = SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "render_priority").toBool();
+    m_renderer->m_priority.setCpus(ThreadPriority::ParseCpuList(
+      SettingsComponent::Get().value(SETTINGS_SECTION_VIDEO, "render_cpus").toString()));
     if (!m_renderer->init())
     {
       delete m_renderer;
@@ -282,6 +450,7 @@ void PlayerQuickItem::onSynchronize()
   {
     m_renderer->m_size = window()->size() * window()->devicePixelRatio();
     m_renderer->m_videoRectangle = PlayerComponent::Get().videoRectangle();
+    m_renderer->m_videoRectangleBlit = PlayerComponent::Get().videoRectangleBlit();
   }
 }
 
@@ -298,9 +467,11 @@ void PlayerQuickItem::initMpv(PlayerComponent* player)
 {
   m_mpv = player->getMpvHandle();
 
+#ifndef HAVE_MPV_RENDER_API
   m_mpvGL = (mpv_opengl_cb_context *)mpv_get_sub_api(m_mpv, MPV_SUB_API_OPENGL_CB);
   if (!m_mpvGL)
     throw FatalException(tr("OpenGL not enabled in libmpv."));
+#endif
 
   connect(player, &PlayerComponent::windowVisible, this, &QQuickItem::setVisible);
   window()->update();
@@ -4,17 +4,26 @@
 #include <Qt>
 #include <QtQuick/QQuickItem>
 #include <QOpenGLFramebufferObject>
+#include <QOpenGLContext>
+#include <QElapsedTimer>
+#include <QScreen>
 
 #include <mpv/client.h>
-#include <mpv/opengl_cb.h>
-
-#ifdef Q_OS_WIN32
-#include <windows.h>
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 101)
+#include <mpv/render_gl.h>
+#define HAVE_MPV_RENDER_API 1
+// The video output that renders through the render context.
+#define PLAYER_QUICK_VO "libmpv"
+typedef mpv_render_context PlayerRenderContext;
 #else
-typedef void* HANDLE;
+#include <mpv/opengl_cb.h>
+#define PLAYER_QUICK_VO "opengl-cb"
+typedef mpv_opengl_cb_context PlayerRenderContext;
 #endif
 
 #include "PlayerComponent.h"
+#include "FrameTimings.h"
+#include "ThreadPriority.h"
 #include "QtHelper.h"
 
 class PlayerRenderer : public QObject
@@ -22,11 +31,12 @@ class PlayerRenderer : public QObject
   Q_OBJECT
   friend class PlayerQuickItem;
 
-  PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window);
+  PlayerRenderer(mpv::qt::Handle mpv, QQuickWindow* window, FrameTimings* timings);
   bool init();
   ~PlayerRenderer() override;
   void render();
   void swap();
+  void queryGpuMemory(QOpenGLContext* context);
 
 public slots:
   void onVideoPlaybackActive(bool active);
@@ -34,12 +44,22 @@ public slots:
 private:
   static void on_update(void *ctx);
   mpv::qt::Handle m_mpv;
-  mpv_opengl_cb_context* m_mpvGL;
+  PlayerRenderContext* m_mpvGL;
   QQuickWindow* m_window;
   QSize m_size;
-  HANDLE m_hAvrtHandle;
+  // raised while video plays, if enabled
+  bool m_raisePriority;
+  ThreadPriority m_priority;
   QRect m_videoRectangle;
+  bool m_videoRectangleBlit;
   QOpenGLFramebufferObject* m_fbo;
+  // the part of m_fbo the last frame was drawn into, kept until there is a new one
+  bool m_fboHasFrame;
+  QSize m_fboFrameSize;
+  FrameTimings* m_timings;
+  // 0 not checked yet, 1 supported, -1 not supported
+  int m_gpuMemoryQuery;
+  QElapsedTimer m_gpuMemoryClock;
 };
 
 class PlayerQuickItem : public QQuickItem
@@ -51,22 +71,27 @@ public:
     explicit PlayerQuickItem(QQuickItem* parent = nullptr);
     ~PlayerQuickItem() override;
     void initMpv(PlayerComponent* player);
-    QString debugInfo() { return m_debugInfo; }
+    QString debugInfo() { return m_debugInfo + m_frameTimings.histograms(); }
+    QString frameTimingSummary() { return m_frameTimings.summary(); }
+    double meanDrawMsec() const { return m_frameTimings.meanDrawMsec(); }
 
 signals:
     void onFatalError(QString message);
 
 private slots:
     void onWindowChanged(QQuickWindow* win);
+    void onScreenChanged(QScreen* screen);
     void onSynchronize();
     void onInvalidate();
     void onHandleFatalError(QString message);
 
 private:
     mpv::qt::Handle m_mpv;
-    mpv_opengl_cb_context* m_mpvGL;
+    PlayerRenderContext* m_mpvGL;
     PlayerRenderer* m_renderer;
     QString m_debugInfo;
+    FrameTimings m_frameTimings;
+    QMetaObject::Connection m_refreshRateConnection;
 };
 
 #endif
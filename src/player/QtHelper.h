@@ -34,6 +34,7 @@
 #include <QHash>
 #include <QSharedPointer>
 #include <QMetaType>
+#include <QVarLengthArray>
 
 namespace mpv {
 namespace qt {
@@ -226,6 +227,270 @@ struct node_autofree {
     ~node_autofree() { mpv_free_node_contents(ptr); }
 };
 
+/**
+ * Read-only view of a mpv_node, e.g. the data of an observed MPV_FORMAT_NODE
+ * property or a command result. Nothing is copied or converted until asked
+ * for, and missing entries or type mismatches yield a null view or default
+ * values instead of errors. The view is only valid while the node is.
+ */
+class node_view
+{
+public:
+    node_view(const mpv_node *node = NULL) : node_(node) {}
+
+    bool is_null() const { return !node_ || node_->format == MPV_FORMAT_NONE; }
+    mpv_format format() const { return node_ ? node_->format : MPV_FORMAT_NONE; }
+
+    const char *c_str() const {
+        return format() == MPV_FORMAT_STRING ? node_->u.string : "";
+    }
+    QString to_string() const { return QString::fromUtf8(c_str()); }
+    bool equals(const char *s) const { return std::strcmp(c_str(), s) == 0; }
+    bool to_bool() const { return format() == MPV_FORMAT_FLAG && node_->u.flag; }
+    int64_t to_int64() const {
+        if (format() == MPV_FORMAT_INT64)
+            return node_->u.int64;
+        if (format() == MPV_FORMAT_DOUBLE)
+            return static_cast<int64_t>(node_->u.double_);
+        return 0;
+    }
+    double to_double() const {
+        if (format() == MPV_FORMAT_DOUBLE)
+            return node_->u.double_;
+        if (format() == MPV_FORMAT_INT64)
+            return static_cast<double>(node_->u.int64);
+        return 0;
+    }
+
+    // number of entries of an array or map
+    int size() const {
+        if (format() != MPV_FORMAT_NODE_ARRAY && format() != MPV_FORMAT_NODE_MAP)
+            return 0;
+        return node_->u.list->num;
+    }
+    node_view operator[](int n) const {
+        if (n < 0 || n >= size())
+            return node_view();
+        return node_view(&node_->u.list->values[n]);
+    }
+    // map lookup; maps returned by mpv are small, so a linear search is fine
+    node_view operator[](const char *key) const {
+        if (format() != MPV_FORMAT_NODE_MAP)
+            return node_view();
+        mpv_node_list *list = node_->u.list;
+        for (int n = 0; n < list->num; n++) {
+            if (std::strcmp(list->keys[n], key) == 0)
+                return node_view(&list->values[n]);
+        }
+        return node_view();
+    }
+    const char *key(int n) const {
+        if (format() != MPV_FORMAT_NODE_MAP || n < 0 || n >= size())
+            return "";
+        return node_->u.list->keys[n];
+    }
+
+    // for the few callers that really need the QVariant tree
+    QVariant to_variant() const { return node_ ? node_to_variant(node_) : QVariant(); }
+
+private:
+    const mpv_node *node_;
+};
+
+/**
+ * A property fetched as mpv_node, freed on destruction. Use view() to read it
+ * in place.
+ */
+class node_property
+{
+public:
+    node_property(mpv_handle *ctx, const char *name) {
+        error_ = mpv_get_property(ctx, name, MPV_FORMAT_NODE, &node_);
+        if (error_ < 0)
+            node_.format = MPV_FORMAT_NONE;
+    }
+    ~node_property() {
+        if (error_ >= 0)
+            mpv_free_node_contents(&node_);
+    }
+    int error() const { return error_; }
+    node_view view() const { return node_view(&node_); }
+private:
+    Q_DISABLE_COPY(node_property)
+    mpv_node node_;
+    int error_;
+};
+
+/**
+ * Builds a command as mpv_node without going through QVariant. Arguments and
+ * strings are collected in inline storage (it only goes to the heap for
+ * unusually long commands), node() lays out the nodes in one go. A single
+ * level of map argument is supported, which is all "loadfile" needs:
+ *
+ *   command_builder cmd;
+ *   cmd.add("loadfile").add(url).add("append-play");
+ *   cmd.begin_map().add_option("pause", "yes").end_map();
+ *   mpv_command_node_async(ctx, 0, cmd.node());
+ *
+ * The node (and anything it points to) is valid until the builder is
+ * modified or destroyed.
+ */
+class command_builder
+{
+public:
+    command_builder() : map_(-1), key_(-1) {}
+
+    command_builder &add(const char *s) { return add(s, (int)std::strlen(s)); }
+    command_builder &add(const QByteArray &s) { return add(s.constData(), s.size()); }
+    command_builder &add(const QString &s) { return add(s.toUtf8()); }
+    command_builder &add(bool v) {
+        entry e = make(MPV_FORMAT_FLAG);
+        e.i = v ? 1 : 0;
+        return push(e);
+    }
+    command_builder &add(int v) { return add(static_cast<qint64>(v)); }
+    command_builder &add(qint64 v) {
+        entry e = make(MPV_FORMAT_INT64);
+        e.i = v;
+        return push(e);
+    }
+    command_builder &add(double v) {
+        entry e = make(MPV_FORMAT_DOUBLE);
+        e.d = v;
+        return push(e);
+    }
+
+    command_builder &begin_map() {
+        Q_ASSERT(map_ < 0);
+        entry e = make(MPV_FORMAT_NODE_MAP);
+        push(e);
+        map_ = entries_.size() - 1;
+        return *this;
+    }
+    template <typename T>
+    command_builder &add_option(const char *key, T value) {
+        Q_ASSERT(map_ >= 0);
+        key_ = store(key, (int)std::strlen(key));
+        return add(value);
+    }
+    command_builder &end_map() {
+        map_ = -1;
+        return *this;
+    }
+
+    mpv_node *node() {
+        int lists = 1;
+        int keys = 0;
+        for (const entry &e : entries_) {
+            if (e.format == MPV_FORMAT_NODE_MAP)
+                lists++;
+            if (e.key >= 0)
+                keys++;
+        }
+
+        // size everything first, the pointers below must not move anymore
+        nodes_.resize(entries_.size() + 1);
+        lists_.resize(lists);
+        keys_.resize(keys);
+
+        // top level arguments first, so they are contiguous; map entries after them
+        int top = 0;
+        for (const entry &e : entries_) {
+            if (e.key < 0)
+                top++;
+        }
+
+        mpv_node_list *root = lists_.data();
+        root->num = top;
+        root->values = nodes_.data() + 1;
+        root->keys = NULL;
+        nodes_[0].format = MPV_FORMAT_NODE_ARRAY;
+        nodes_[0].u.list = root;
+
+        int next_top = 1, next_child = 1 + top, next_list = 1, next_key = 0;
+        mpv_node_list *map = NULL;
+        for (const entry &e : entries_) {
+            mpv_node *dst;
+            if (e.key >= 0) {
+                Q_ASSERT(map);
+                dst = nodes_.data() + next_child++;
+                keys_[next_key] = strings_.data() + e.key;
+                if (!map->num)
+                    map->keys = keys_.data() + next_key;
+                next_key++;
+                map->num++;
+            } else {
+                dst = nodes_.data() + next_top++;
+                map = NULL;
+            }
+
+            dst->format = e.format;
+            switch (e.format) {
+            case MPV_FORMAT_STRING: dst->u.string = strings_.data() + e.str; break;
+            case MPV_FORMAT_FLAG: dst->u.flag = (int)e.i; break;
+            case MPV_FORMAT_INT64: dst->u.int64 = e.i; break;
+            case MPV_FORMAT_DOUBLE: dst->u.double_ = e.d; break;
+            case MPV_FORMAT_NODE_MAP:
+                map = lists_.data() + next_list++;
+                map->num = 0;
+                map->values = nodes_.data() + next_child;
+                map->keys = NULL;
+                dst->u.list = map;
+                break;
+            default: ;
+            }
+        }
+
+        return nodes_.data();
+    }
+
+private:
+    struct entry {
+        mpv_format format;
+        int key;      // offset into strings_ for map entries, -1 for arguments
+        int str;      // offset into strings_ for MPV_FORMAT_STRING
+        int64_t i;
+        double d;
+    };
+
+    entry make(mpv_format format) {
+        entry e;
+        e.format = format;
+        e.key = key_;
+        e.str = -1;
+        e.i = 0;
+        e.d = 0;
+        key_ = -1;
+        return e;
+    }
+    command_builder &add(const char *s, int len) {
+        entry e = make(MPV_FORMAT_STRING);
+        e.str = store(s, len);
+        return push(e);
+    }
+    command_builder &push(const entry &e) {
+        // map entries need a key, and a map ends with the first plain argument
+        Q_ASSERT(map_ < 0 || e.key >= 0 || e.format == MPV_FORMAT_NODE_MAP);
+        entries_.append(e);
+        return *this;
+    }
+    int store(const char *s, int len) {
+        int offset = strings_.size();
+        strings_.append(s, len);
+        strings_.append('\0');
+        return offset;
+    }
+
+    Q_DISABLE_COPY(command_builder)
+    QVarLengthArray<entry, 16> entries_;
+    QVarLengthArray<char, 1024> strings_;
+    QVarLengthArray<mpv_node, 17> nodes_;
+    QVarLengthArray<mpv_node_list, 2> lists_;
+    QVarLengthArray<char *, 16> keys_;
+    int map_;
+    int key_;
+};
+
 #if MPV_ENABLE_DEPRECATED
 
 /**
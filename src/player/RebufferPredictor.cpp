@@ -0,0 +1,95 @@
+#include "RebufferPredictor.h"
+
+// A stall is predicted if the cache runs out within this many seconds.
+#define REBUFFER_PREDICT_SECS 15
+// Samples closer than this are too noisy, the cache grows in packets.
+#define REBUFFER_MIN_SAMPLE_MSEC 500
+// Weight of a new sample of the rate, and how many it takes to trust it.
+#define REBUFFER_RATE_WEIGHT 0.2
+#define REBUFFER_MIN_SAMPLES 5
+// A cache this close to the readahead is full, it only grows as fast as it is played.
+#define REBUFFER_FULL_FACTOR 0.9
+// cache-pause-wait is chosen so playback lasts this long before the next stall, within
+// mpv's default of 1 second and a wait that still feels like buffering, not like an error.
+#define REBUFFER_TARGET_PLAY_SECS 30
+#define REBUFFER_MIN_PAUSE_WAIT 1.0
+#define REBUFFER_MAX_PAUSE_WAIT 10.0
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+RebufferPredictor::RebufferPredictor() : m_readahead(0)
+{
+  reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void RebufferPredictor::reset()
+{
+  m_rate = 0;
+  m_rateSamples = 0;
+  m_cacheSeconds = 0;
+  m_lastMsec = 0;
+  m_lastCacheSeconds = 0;
+  m_lastValid = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void RebufferPredictor::addSample(qint64 msec, double cacheSeconds, bool playing)
+{
+  m_cacheSeconds = cacheSeconds;
+
+  bool full = m_readahead > 0 && cacheSeconds >= m_readahead * REBUFFER_FULL_FACTOR;
+  if (!playing || full)
+  {
+    // what happens while not playing says nothing about the drain, and a full cache
+    // doesn't drain
+    if (full)
+      m_rate = qMax(m_rate, 0.0);
+    m_lastValid = false;
+    return;
+  }
+
+  if (!m_lastValid)
+  {
+    m_lastMsec = msec;
+    m_lastCacheSeconds = cacheSeconds;
+    m_lastValid = true;
+    return;
+  }
+
+  qint64 elapsed = msec - m_lastMsec;
+  if (elapsed < REBUFFER_MIN_SAMPLE_MSEC)
+    return;
+
+  double rate = (cacheSeconds - m_lastCacheSeconds) * 1000.0 / elapsed;
+  m_rate = m_rateSamples ? m_rate + (rate - m_rate) * REBUFFER_RATE_WEIGHT : rate;
+  m_rateSamples++;
+
+  m_lastMsec = msec;
+  m_lastCacheSeconds = cacheSeconds;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double RebufferPredictor::secondsUntilStall() const
+{
+  if (m_rateSamples < REBUFFER_MIN_SAMPLES || m_rate >= 0)
+    return -1;
+  return m_cacheSeconds / -m_rate;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool RebufferPredictor::stallPredicted() const
+{
+  double seconds = secondsUntilStall();
+  return seconds >= 0 && seconds < REBUFFER_PREDICT_SECS;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double RebufferPredictor::cachePauseWait() const
+{
+  if (m_rateSamples < REBUFFER_MIN_SAMPLES || m_rate >= 0)
+    return REBUFFER_MIN_PAUSE_WAIT;
+
+  // playing for the target time consumes this much more than arrives meanwhile
+  double wait = REBUFFER_TARGET_PLAY_SECS * -m_rate;
+  return qBound(REBUFFER_MIN_PAUSE_WAIT, wait, REBUFFER_MAX_PAUSE_WAIT);
+}
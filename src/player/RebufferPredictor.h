@@ -0,0 +1,46 @@
+#ifndef REBUFFERPREDICTOR_H
+#define REBUFFERPREDICTOR_H
+
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Predicts stalls from how the demuxer cache (demuxer-cache-duration) develops while playing.
+// If the network is slower than the stream, the cache shrinks by the difference every second,
+// and mpv only reports buffering once it's empty. Knowing the rate it shrinks at, the web
+// client can be told ahead of that to pick a lower bitrate.
+//
+// The same rate tells how much cache-pause-wait should collect after a stall, so that
+// playback gets some way before running dry again, instead of stalling every few seconds.
+class RebufferPredictor
+{
+public:
+  RebufferPredictor();
+
+  // For a new file and after seeks, the cache changes abruptly then.
+  void reset();
+
+  // demuxer-readahead-secs, a cache this full doesn't grow any more.
+  void setReadahead(double seconds) { m_readahead = seconds; }
+
+  // msec is a monotonic time, playing is false while paused or buffering.
+  void addSample(qint64 msec, double cacheSeconds, bool playing);
+
+  // Seconds of playback until the cache runs out, -1 if it doesn't shrink.
+  double secondsUntilStall() const;
+  bool stallPredicted() const;
+
+  // What cache-pause-wait should be.
+  double cachePauseWait() const;
+
+private:
+  double m_readahead;
+  // how many seconds the cache changes per second of playback, < 0 if it shrinks
+  double m_rate;
+  int m_rateSamples;
+  double m_cacheSeconds;
+  qint64 m_lastMsec;
+  double m_lastCacheSeconds;
+  bool m_lastValid;
+};
+
+#endif // REBUFFERPREDICTOR_H
@@ -0,0 +1,106 @@
+#include "SessionMetrics.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QUrl>
+
+#include "QsLog.h"
+#include "Paths.h"
+#include "Version.h"
+#include "settings/SettingsComponent.h"
+#include "utils/NetworkService.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SessionMetrics::SessionMetrics() : QObject(nullptr), m_batchTimer(this), m_sending(false)
+{
+  m_batchTimer.setSingleShot(true);
+  m_batchTimer.setInterval(SESSION_METRICS_BATCH_MSEC);
+  connect(&m_batchTimer, &QTimer::timeout, this, &SessionMetrics::sendBatch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SessionMetrics::record(const QVariantMap& session)
+{
+  QVariantMap record = session;
+  record["version"] = Version::GetVersionString();
+
+  writeToFile(QJsonDocument::fromVariant(record).toJson(QJsonDocument::Compact) + "\n");
+
+  if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "sessionMetricsUrl").toString().isEmpty())
+    return;
+
+  m_pending << record;
+  // not while a batch is out, its records are removed from the front once it went through
+  while (!m_sending && m_pending.size() > SESSION_METRICS_MAX_PENDING)
+    m_pending.removeFirst();
+
+  if (m_pending.size() >= SESSION_METRICS_BATCH_SIZE)
+    sendBatch();
+  else if (!m_batchTimer.isActive())
+    m_batchTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SessionMetrics::writeToFile(const QByteArray& line)
+{
+  QString path = Paths::logDir("sessions.jsonl");
+
+  if (QFile(path).size() + line.size() > SESSION_METRICS_MAX_FILE_SIZE)
+  {
+    // sessions.jsonl.1 is the newest of the old ones
+    QFile::remove(QString("%1.%2").arg(path).arg(SESSION_METRICS_MAX_FILES));
+    for (int i = SESSION_METRICS_MAX_FILES - 1; i > 0; i--)
+      QFile::rename(QString("%1.%2").arg(path).arg(i), QString("%1.%2").arg(path).arg(i + 1));
+    QFile::rename(path, path + ".1");
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+  {
+    QLOG_WARN() << "Can't write playback session to" << path << ":" << file.errorString();
+    return;
+  }
+  file.write(line);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SessionMetrics::sendBatch()
+{
+  m_batchTimer.stop();
+
+  QUrl url(SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "sessionMetricsUrl").toString());
+  if (m_sending || m_pending.isEmpty() || !url.isValid())
+    return;
+
+  int count = qMin(m_pending.size(), SESSION_METRICS_BATCH_SIZE);
+
+  QVariantMap batch;
+  batch["player"] = SettingsComponent::Get().value(SETTINGS_SECTION_WEBCLIENT, "clientID");
+  batch["sessions"] = m_pending.mid(0, count);
+
+  QNetworkRequest request(url);
+  request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+
+  m_sending = true;
+  QNetworkReply* reply = NetworkService::Get().post(request, QJsonDocument::fromVariant(batch).toJson(QJsonDocument::Compact),
+                                                    NetworkService::MetadataRequest);
+  connect(reply, &QNetworkReply::finished, this, [=]()
+  {
+    reply->deleteLater();
+    m_sending = false;
+
+    // kept for the next batch otherwise
+    if (reply->error() != QNetworkReply::NoError)
+    {
+      QLOG_WARN() << "Failed to send" << count << "playback sessions:" << reply->errorString();
+      m_batchTimer.start();
+      return;
+    }
+
+    m_pending = m_pending.mid(count);
+    if (m_pending.size() >= SESSION_METRICS_BATCH_SIZE)
+      sendBatch();
+    else if (!m_pending.isEmpty())
+      m_batchTimer.start();
+  });
+}
@@ -0,0 +1,47 @@
+#ifndef SESSIONMETRICS_H
+#define SESSIONMETRICS_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
+
+#include "utils/Utils.h"
+
+// sessions.jsonl in the log directory is rotated at this size, and this many old ones kept
+#define SESSION_METRICS_MAX_FILE_SIZE (1024 * 1024)
+#define SESSION_METRICS_MAX_FILES 3
+// records are POSTed once this many are waiting, or this long after the first one came in
+#define SESSION_METRICS_BATCH_SIZE 20
+#define SESSION_METRICS_BATCH_MSEC (5 * 60 * 1000)
+// waiting records are dropped beyond this while the endpoint can't be reached
+#define SESSION_METRICS_MAX_PENDING 500
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Machine readable records of each playback session (startup phases, stalls, drops, bitrate,
+// decoder), for looking at many players at once instead of their logs. Every record is a line
+// of JSON in sessions.jsonl in the log directory. If main.sessionMetricsUrl is set, they are
+// also POSTed there as {"player": ..., "sessions": [...]} in batches, through NetworkService.
+//
+// Main thread only.
+//
+class SessionMetrics : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(SessionMetrics);
+
+public:
+  void record(const QVariantMap& session);
+
+private:
+  SessionMetrics();
+  void writeToFile(const QByteArray& line);
+  void sendBatch();
+
+  QVariantList m_pending;
+  QTimer m_batchTimer;
+  // a batch is out, the next one waits for it
+  bool m_sending;
+};
+
+#endif // SESSIONMETRICS_H
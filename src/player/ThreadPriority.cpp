@@ -0,0 +1,151 @@
+#include "ThreadPriority.h"
+
+#include <QStringList>
+
+#include "QsLog.h"
+
+#ifdef Q_OS_WIN32
+#include <avrt.h>
+#elif defined(Q_OS_LINUX)
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_MAC)
+#include <pthread.h>
+#include <pthread/qos.h>
+#endif
+
+#ifdef Q_OS_LINUX
+// Low end of the real-time range, enough to preempt all normal threads
+// without competing with the kernel's or the audio server's threads.
+#define RENDER_RR_PRIORITY 2
+// fallback if we may not use real-time scheduling
+#define RENDER_NICE -10
+
+static pid_t currentTid()
+{
+  return (pid_t)syscall(SYS_gettid);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ThreadPriority::ThreadPriority()
+  : m_raised(false)
+#ifdef Q_OS_WIN32
+  , m_avrtHandle(nullptr)
+#elif defined(Q_OS_LINUX)
+  , m_oldPolicy(SCHED_OTHER), m_oldParam(), m_oldNice(0), m_niced(false), m_pinned(false)
+#elif defined(Q_OS_MAC)
+  , m_oldQos(QOS_CLASS_DEFAULT)
+#endif
+{
+#ifdef Q_OS_LINUX
+  CPU_ZERO(&m_oldCpus);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QList<int> ThreadPriority::ParseCpuList(const QString& list)
+{
+  QList<int> cpus;
+  for (const QString& part : list.split(',', QString::SkipEmptyParts))
+  {
+    QStringList range = part.trimmed().split('-');
+    bool okFirst = false, okLast = false;
+    int first = range.value(0).toInt(&okFirst);
+    int last = range.size() > 1 ? range.value(1).toInt(&okLast) : first;
+    if (range.size() == 1)
+      okLast = okFirst;
+    if (!okFirst || !okLast || first < 0 || last < first)
+    {
+      QLOG_WARN() << "Ignoring invalid CPU list:" << list;
+      return QList<int>();
+    }
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus << cpu;
+  }
+  return cpus;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThreadPriority::raise()
+{
+  if (m_raised)
+    return;
+  m_raised = true;
+
+#ifdef Q_OS_WIN32
+  DWORD task = 0;
+  m_avrtHandle = AvSetMmThreadCharacteristicsW(L"Low Latency", &task);
+#elif defined(Q_OS_LINUX)
+  pthread_getschedparam(pthread_self(), &m_oldPolicy, &m_oldParam);
+
+  sched_param param = {};
+  param.sched_priority = RENDER_RR_PRIORITY;
+  int err = pthread_setschedparam(pthread_self(), SCHED_RR, &param);
+  if (err)
+  {
+    // On Linux the nice value is per thread, when given the thread id.
+    errno = 0;
+    m_oldNice = getpriority(PRIO_PROCESS, currentTid());
+    m_niced = setpriority(PRIO_PROCESS, currentTid(), RENDER_NICE) == 0;
+    QLOG_DEBUG() << "No real-time priority for the render thread (" << strerror(err) << "),"
+                 << (m_niced ? "lowered its nice value instead" : "keeping normal priority");
+  }
+
+  if (!m_cpus.isEmpty())
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : m_cpus)
+    {
+      if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &cpus);
+    }
+    m_pinned = pthread_getaffinity_np(pthread_self(), sizeof(m_oldCpus), &m_oldCpus) == 0 &&
+               pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+    if (!m_pinned)
+      QLOG_WARN() << "Could not pin the render thread to CPUs" << m_cpus;
+  }
+#elif defined(Q_OS_MAC)
+  qos_class_t qos = QOS_CLASS_DEFAULT;
+  int relative = 0;
+  if (pthread_get_qos_class_np(pthread_self(), &qos, &relative) == 0)
+    m_oldQos = qos;
+  pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThreadPriority::restore()
+{
+  if (!m_raised)
+    return;
+  m_raised = false;
+
+#ifdef Q_OS_WIN32
+  if (m_avrtHandle)
+  {
+    AvRevertMmThreadCharacteristics(m_avrtHandle);
+    m_avrtHandle = nullptr;
+  }
+#elif defined(Q_OS_LINUX)
+  pthread_setschedparam(pthread_self(), m_oldPolicy, &m_oldParam);
+
+  if (m_niced)
+  {
+    setpriority(PRIO_PROCESS, currentTid(), m_oldNice);
+    m_niced = false;
+  }
+
+  if (m_pinned)
+  {
+    pthread_setaffinity_np(pthread_self(), sizeof(m_oldCpus), &m_oldCpus);
+    m_pinned = false;
+  }
+#elif defined(Q_OS_MAC)
+  pthread_set_qos_class_self_np((qos_class_t)m_oldQos, 0);
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef THREADPRIORITY_H
+#define THREADPRIORITY_H
+
+#include <QList>
+
+#ifdef Q_OS_WIN32
+#include <windows.h>
+#elif defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Favors the calling thread over the rest of the process while video plays,
+// so web UI work doesn't delay presenting frames:
+//  - Windows: MMCSS "Low Latency" task
+//  - Linux: SCHED_RR (needs CAP_SYS_NICE, as on OpenELEC), otherwise a lower nice value
+//  - macOS: the user-interactive QoS class
+// Both functions must be called from the thread in question.
+class ThreadPriority
+{
+public:
+  ThreadPriority();
+
+  // CPUs the thread may run on while raised, empty for no restriction. Only
+  // supported on Linux, where it's useful to keep the renderer on the big
+  // cores of a big.LITTLE SoC.
+  void setCpus(const QList<int>& cpus) { m_cpus = cpus; }
+
+  void raise();
+  void restore();
+
+  // Parses lists like "4-7" or "0,2,4".
+  static QList<int> ParseCpuList(const QString& list);
+
+private:
+  bool m_raised;
+  QList<int> m_cpus;
+#ifdef Q_OS_WIN32
+  HANDLE m_avrtHandle;
+#elif defined(Q_OS_LINUX)
+  int m_oldPolicy;
+  sched_param m_oldParam;
+  int m_oldNice;
+  bool m_niced;
+  cpu_set_t m_oldCpus;
+  bool m_pinned;
+#elif defined(Q_OS_MAC)
+  int m_oldQos;
+#endif
+};
+
+#endif // THREADPRIORITY_H
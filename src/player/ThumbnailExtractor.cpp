@@ -0,0 +1,275 @@
+#include "ThumbnailExtractor.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include <mpv/client.h>
+
+#include "UtilityMpv.h"
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Waits until the frame at the position mpv was sent to is out (it's paused, so that's
+// when playback "restarts").
+static bool waitForFrame(mpv_handle* mpv, qint64 positionMs)
+{
+  QElapsedTimer timer;
+  timer.start();
+  while (1)
+  {
+    qint64 remaining = THUMBNAIL_TIMEOUT_MSEC - timer.elapsed();
+    if (remaining <= 0)
+    {
+      QLOG_DEBUG() << "Thumbnail at" << positionMs << "timed out";
+      return false;
+    }
+    mpv_event* event = mpv_wait_event(mpv, remaining / 1000.0);
+    if (event->event_id == MPV_EVENT_SHUTDOWN || event->event_id == MPV_EVENT_END_FILE)
+      return false;
+    if (event->event_id == MPV_EVENT_PLAYBACK_RESTART)
+      return true;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Decodes the keyframe before the position and returns it scaled to width, or a null image.
+// The file is only opened if *loaded is false, later positions are seeks in it. *loaded is
+// cleared if mpv ended up somewhere unknown, so the next one opens the file again.
+static QImage grabFrame(UtilityMpv::Session& session, const QString& source, const QString& userAgent,
+                        qint64 positionMs, int width, bool* loaded)
+{
+  mpv_handle* mpv = session.handle();
+  if (!mpv)
+    return QImage();
+
+  if (*loaded)
+  {
+    QVariantList seek{"seek", QString::number(positionMs / 1000.0), "absolute+keyframes"};
+    if (mpv::qt::is_error(mpv::qt::command(mpv, seek)))
+      *loaded = false;
+  }
+
+  if (!*loaded)
+  {
+    session.setProperty("start", QString::number(positionMs / 1000.0));
+    session.setProperty("pause", true);
+    session.setProperty("aid", "no");
+    session.setProperty("sid", "no");
+    // the keyframe is close enough for a preview, and it's the only frame to decode
+    session.setProperty("hr-seek", "no");
+    session.setProperty("vd-lavc-threads", 1);
+    session.setProperty("vd-lavc-skiploopfilter", "all");
+    session.setProperty("cache", "no");
+    session.setProperty("demuxer-max-bytes", THUMBNAIL_DEMUXER_MAX_BYTES);
+    if (!userAgent.isEmpty())
+      session.setProperty("user-agent", userAgent);
+
+    mpv::qt::command(mpv, QVariantList{"loadfile", source});
+    *loaded = true;
+  }
+
+  if (!waitForFrame(mpv, positionMs))
+  {
+    *loaded = false;
+    return QImage();
+  }
+
+  // The helpers drop byte arrays when converting nodes, so this uses the node as it is.
+  mpv::qt::node_builder args(QVariantList{"screenshot-raw", "video"});
+  mpv_node result;
+  if (mpv_command_node(mpv, args.node(), &result) < 0)
+    return QImage();
+
+  int w = 0, h = 0, stride = 0;
+  QByteArray format;
+  const mpv_byte_array* data = nullptr;
+  if (result.format == MPV_FORMAT_NODE_MAP)
+  {
+    mpv_node_list* list = result.u.list;
+    for (int n = 0; n < list->num; n++)
+    {
+      const char* key = list->keys[n];
+      const mpv_node& value = list->values[n];
+      if (!strcmp(key, "w") && value.format == MPV_FORMAT_INT64)
+        w = (int)value.u.int64;
+      else if (!strcmp(key, "h") && value.format == MPV_FORMAT_INT64)
+        h = (int)value.u.int64;
+      else if (!strcmp(key, "stride") && value.format == MPV_FORMAT_INT64)
+        stride = (int)value.u.int64;
+      else if (!strcmp(key, "format") && value.format == MPV_FORMAT_STRING)
+        format = value.u.string;
+      else if (!strcmp(key, "data") && value.format == MPV_FORMAT_BYTE_ARRAY)
+        data = value.u.ba;
+    }
+  }
+
+  QImage image;
+  // bgr0 is what screenshot-raw returns by default, the same bytes as RGB32 on little endian
+  if (format == "bgr0" && data && w > 0 && h > 0 && stride >= w * 4 && data->size >= (size_t)stride * h)
+  {
+    // scaled right away, so the full frame is freed before it's encoded
+    QImage frame((const uchar*)data->data, w, h, stride, QImage::Format_RGB32);
+    image = frame.scaledToWidth(qMin(width, w), Qt::SmoothTransformation);
+  }
+  mpv_free_node_contents(&result);
+
+  return image;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class ThumbnailJob : public QRunnable
+{
+public:
+  ThumbnailJob(ThumbnailExtractor* target, const QString& source, const QString& userAgent, qint64 positionMs, int width)
+    : m_target(target), m_source(source), m_userAgent(userAgent), m_positionMs(positionMs), m_width(width) {}
+
+  void run() override
+  {
+    // While scrubbing the requests come in bursts, they are all served from the file that
+    // is open already instead of opening it for each one.
+    UtilityMpv::Get().run([&](UtilityMpv::Session& session)
+    {
+      bool loaded = false;
+      do
+      {
+        QImage image = grabFrame(session, m_source, m_userAgent, m_positionMs, m_width, &loaded);
+
+        QByteArray jpeg;
+        if (!image.isNull())
+        {
+          QBuffer buffer(&jpeg);
+          buffer.open(QIODevice::WriteOnly);
+          image.save(&buffer, "JPEG", THUMBNAIL_JPEG_QUALITY);
+        }
+
+        QMetaObject::invokeMethod(m_target, "extracted", Qt::QueuedConnection, Q_ARG(QString, m_source),
+                                  Q_ARG(qint64, m_positionMs), Q_ARG(int, m_width), Q_ARG(QByteArray, jpeg));
+      }
+      while (m_target->takeNext(m_source, &m_positionMs, &m_width));
+    }, QThread::IdlePriority);
+
+    // a request for another file might have come in while this one was finishing
+    QMetaObject::invokeMethod(m_target, "startNext", Qt::QueuedConnection);
+  }
+
+private:
+  ThumbnailExtractor* m_target;
+  QString m_source;
+  QString m_userAgent;
+  qint64 m_positionMs;
+  int m_width;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ThumbnailExtractor::ThumbnailExtractor(QObject* parent) : QObject(parent), m_busy(false)
+{
+  m_cache.setMaxCost(THUMBNAIL_CACHE_BYTES);
+  m_pool.setMaxThreadCount(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ThumbnailExtractor::cacheKey(qint64 positionMs, int width)
+{
+  return QString::number(positionMs) + "@" + QString::number(width);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailExtractor::request(const QString& source, const QString& userAgent, qint64 positionMs, int width)
+{
+  if (width <= 0)
+    width = THUMBNAIL_DEFAULT_WIDTH;
+  width = qMin(width, THUMBNAIL_MAX_WIDTH);
+
+  if (source != m_source)
+  {
+    clear();
+    QMutexLocker lock(&m_lock);
+    m_source = source;
+  }
+  m_userAgent = userAgent;
+
+  QByteArray* cached = m_cache.object(cacheKey(positionMs, width));
+  if (cached)
+  {
+    emit ready(positionMs, width, *cached);
+    return;
+  }
+
+  QList<Request> dropped;
+  {
+    QMutexLocker lock(&m_lock);
+    for (int i = 0; i < m_pending.size(); i++)
+    {
+      if (m_pending[i].positionMs == positionMs && m_pending[i].width == width)
+      {
+        // asked again, so it's the one that matters now
+        m_pending.move(i, m_pending.size() - 1);
+        return;
+      }
+    }
+
+    m_pending.append(Request{positionMs, width});
+    while (m_pending.size() > THUMBNAIL_MAX_PENDING)
+      dropped.append(m_pending.takeFirst());
+  }
+
+  for (const Request& request : dropped)
+    emit ready(request.positionMs, request.width, QByteArray());
+
+  startNext();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailExtractor::clear()
+{
+  QMutexLocker lock(&m_lock);
+  m_source.clear();
+  m_pending.clear();
+  m_cache.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailExtractor::startNext()
+{
+  QMutexLocker lock(&m_lock);
+  if (m_busy || m_pending.isEmpty() || m_source.isEmpty())
+    return;
+
+  Request next = m_pending.takeLast();
+  m_busy = true;
+  m_pool.start(new ThumbnailJob(this, m_source, m_userAgent, next.positionMs, next.width));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ThumbnailExtractor::takeNext(const QString& source, qint64* positionMs, int* width)
+{
+  QMutexLocker lock(&m_lock);
+  if (source != m_source || m_pending.isEmpty())
+  {
+    m_busy = false;
+    return false;
+  }
+
+  Request next = m_pending.takeLast();
+  *positionMs = next.positionMs;
+  *width = next.width;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ThumbnailExtractor::extracted(const QString& source, qint64 positionMs, int width, const QByteArray& jpeg)
+{
+  // for a file that isn't playing anymore
+  if (source == m_source)
+  {
+    if (!jpeg.isEmpty())
+      m_cache.insert(cacheKey(positionMs, width), new QByteArray(jpeg), jpeg.size());
+    else
+      QLOG_DEBUG() << "No thumbnail at" << positionMs;
+    emit ready(positionMs, width, jpeg);
+  }
+}
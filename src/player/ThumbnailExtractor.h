@@ -0,0 +1,78 @@
+#ifndef THUMBNAILEXTRACTOR_H
+#define THUMBNAILEXTRACTOR_H
+
+#include <QObject>
+#include <QCache>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+
+// encoded thumbnails kept for the current file, by size of the JPEG data
+#define THUMBNAIL_CACHE_BYTES (4 * 1024 * 1024)
+// requests that wait for the extractor, the oldest ones are dropped first
+#define THUMBNAIL_MAX_PENDING 16
+// widths are clamped to this, and requests without one get the default
+#define THUMBNAIL_MAX_WIDTH 640
+#define THUMBNAIL_DEFAULT_WIDTH 320
+#define THUMBNAIL_JPEG_QUALITY 75
+// how long opening the file and decoding the keyframe may take
+#define THUMBNAIL_TIMEOUT_MSEC 10000
+// what the utility instance may buffer, it only needs the packets up to the keyframe
+#define THUMBNAIL_DEMUXER_MAX_BYTES "4MiB"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Seek bar previews and chapter images for files the server has no index for. Frames are
+// decoded on a utility mpv instance (see UtilityMpv), which opens the URL that is playing
+// again and seeks to the keyframe before each position, with a single decoder thread and
+// a small demuxer cache. The file stays open while requests keep coming. The frame is
+// scaled down as soon as it's there and encoded, one request at a time, on the utility
+// thread at idle priority, so playback never competes with it.
+//
+// Requests are answered with ready() unless clear() drops them, empty data means there is
+// no image for the position. The newest request is served first, since while scrubbing
+// that is the one on screen.
+//
+class ThumbnailExtractor : public QObject
+{
+  Q_OBJECT
+public:
+  explicit ThumbnailExtractor(QObject* parent);
+
+  // source is the URL mpv plays, userAgent what it sends. Asking for another source
+  // drops everything that was cached or queued for the previous one.
+  void request(const QString& source, const QString& userAgent, qint64 positionMs, int width);
+  // Drops the cache and the queue, a running extraction is discarded when it's done.
+  void clear();
+
+  // For the extraction job, from its thread: the newest request for source if there
+  // is one. Otherwise the job is done.
+  bool takeNext(const QString& source, qint64* positionMs, int* width);
+
+Q_SIGNALS:
+  void ready(qint64 positionMs, int width, const QByteArray& jpeg);
+
+private Q_SLOTS:
+  void extracted(const QString& source, qint64 positionMs, int width, const QByteArray& jpeg);
+  void startNext();
+
+private:
+  struct Request
+  {
+    qint64 positionMs;
+    int width;
+  };
+
+  static QString cacheKey(qint64 positionMs, int width);
+
+  // m_source, m_pending and m_busy are shared with the job
+  QMutex m_lock;
+  QString m_source;
+  QString m_userAgent;
+  QList<Request> m_pending;
+  bool m_busy;
+  QCache<QString, QByteArray> m_cache;
+  // last, so it waits for a running job before the rest goes away
+  QThreadPool m_pool;
+};
+
+#endif // THUMBNAILEXTRACTOR_H
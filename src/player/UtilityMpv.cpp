@@ -0,0 +1,130 @@
+#include "UtilityMpv.h"
+
+#include <QRunnable>
+#include <QSemaphore>
+#include <QElapsedTimer>
+
+#include <mpv/client.h>
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static mpv::qt::Handle createInstance()
+{
+  auto mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
+  if (!mpv)
+    return mpv::qt::Handle();
+
+  mpv::qt::set_property(mpv, "vo", "null");
+  mpv::qt::set_property(mpv, "ao", "null");
+  // stay around after a file ended, for the next job
+  mpv::qt::set_property(mpv, "idle", "yes");
+  mpv::qt::set_property(mpv, "ytdl", false);
+  mpv::qt::set_property(mpv, "load-scripts", false);
+
+  if (mpv_initialize(mpv) < 0)
+  {
+    QLOG_WARN() << "Failed to initialize the utility mpv instance";
+    return mpv::qt::Handle();
+  }
+
+  return mpv;
+}
+
+// Pool threads keep their instance until they exit, which they do after idling for a while.
+static thread_local mpv::qt::Handle t_instance;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class UtilityMpvJob : public QRunnable
+{
+public:
+  UtilityMpvJob(const UtilityMpv::Job& job, QThread::Priority priority, QSemaphore* done)
+    : m_job(job), m_priority(priority), m_done(done) {}
+
+  void run() override
+  {
+    if (m_priority != QThread::InheritPriority)
+      QThread::currentThread()->setPriority(m_priority);
+
+    if (!t_instance)
+      t_instance = createInstance();
+
+    UtilityMpv::Session session(t_instance);
+    m_job(session);
+    if (!session.finish())
+    {
+      QLOG_WARN() << "Utility mpv instance did not stop, replacing it";
+      t_instance = mpv::qt::Handle();
+    }
+
+    // the next job might be a probe that got no priority of its own
+    if (m_priority != QThread::InheritPriority)
+      QThread::currentThread()->setPriority(QThread::NormalPriority);
+
+    m_done->release();
+  }
+
+private:
+  UtilityMpv::Job m_job;
+  QThread::Priority m_priority;
+  QSemaphore* m_done;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UtilityMpv::Session::setProperty(const QString& name, const QVariant& value)
+{
+  if (!m_mpv)
+    return;
+
+  if (!m_changed.contains(name))
+  {
+    QVariant previous = mpv::qt::get_property(m_mpv, name);
+    if (!mpv::qt::is_error(previous))
+      m_changed.insert(name, previous);
+  }
+
+  mpv::qt::set_property(m_mpv, name, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool UtilityMpv::Session::finish()
+{
+  if (!m_mpv)
+    return true;
+
+  mpv::qt::command(m_mpv, QVariantList{"stop"});
+
+  QElapsedTimer timer;
+  timer.start();
+  while (!mpv::qt::get_property(m_mpv, "idle-active").toBool())
+  {
+    if (timer.elapsed() > UTILITY_MPV_STOP_MSEC)
+      return false;
+    mpv_wait_event(m_mpv, 0.05);
+  }
+
+  // whatever is still queued belongs to this job
+  while (mpv_wait_event(m_mpv, 0)->event_id != MPV_EVENT_NONE)
+    ;
+
+  for (auto it = m_changed.constBegin(); it != m_changed.constEnd(); ++it)
+    mpv::qt::set_property(m_mpv, it.key(), it.value());
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+UtilityMpv::UtilityMpv()
+{
+  m_pool.setMaxThreadCount(UTILITY_MPV_MAX_INSTANCES);
+  m_pool.setExpiryTimeout(UTILITY_MPV_IDLE_MSEC);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UtilityMpv::run(const QList<Job>& jobs, QThread::Priority priority)
+{
+  QSemaphore done;
+  for (const Job& job : jobs)
+    m_pool.start(new UtilityMpvJob(job, priority, &done));
+  done.acquire(jobs.size());
+}
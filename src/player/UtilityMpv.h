@@ -0,0 +1,72 @@
+#ifndef UTILITYMPV_H
+#define UTILITYMPV_H
+
+#include <QThread>
+#include <QThreadPool>
+#include <QVariant>
+#include <QHash>
+#include <QList>
+
+#include <functional>
+
+#include "QtHelper.h"
+#include "utils/Utils.h"
+
+// jobs running at the same time, every one of them has an mpv instance of its own
+#define UTILITY_MPV_MAX_INSTANCES 2
+// an instance is destroyed after its thread got no job for this long
+#define UTILITY_MPV_IDLE_MSEC (60 * 1000)
+// how long a finished job may take to stop playback, otherwise the instance is replaced
+#define UTILITY_MPV_STOP_MSEC 2000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Headless mpv instances (vo=null, ao=null) for short jobs that only need libmpv, like the
+// decoder probes. Creating and initializing an instance costs more than most of these jobs,
+// so each pool thread keeps one and runs the queued jobs on it, one at a time.
+//
+// Jobs get the instance through a Session, which puts the properties the job changed back
+// and stops playback when the job is done, so the next job starts out the same.
+//
+// Not for anything that needs a window or must run before Qt is set up, like the hwdec
+// interop probe, or before the environment is final, like the FFmpeg version query.
+//
+class UtilityMpv
+{
+  DEFINE_SINGLETON(UtilityMpv);
+
+public:
+  class Session
+  {
+  public:
+    explicit Session(const mpv::qt::Handle& mpv) : m_mpv(mpv) {}
+
+    // null if no instance could be created
+    mpv_handle* handle() const { return m_mpv; }
+    void setProperty(const QString& name, const QVariant& value);
+
+  private:
+    friend class UtilityMpvJob;
+    // returns false if the instance didn't get back to idle and shouldn't be used again
+    bool finish();
+
+    mpv::qt::Handle m_mpv;
+    QHash<QString, QVariant> m_changed;
+  };
+
+  typedef std::function<void(Session& session)> Job;
+
+  // Both block until the jobs are done. The pool thread runs them at priority, and goes
+  // back to normal after. (mpv's own threads keep the priority they were started with.)
+  void run(const Job& job, QThread::Priority priority = QThread::InheritPriority)
+  {
+    run(QList<Job>() << job, priority);
+  }
+  void run(const QList<Job>& jobs, QThread::Priority priority = QThread::InheritPriority);
+
+private:
+  UtilityMpv();
+
+  QThreadPool m_pool;
+};
+
+#endif // UTILITYMPV_H
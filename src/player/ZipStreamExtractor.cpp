@@ -0,0 +1,397 @@
+#ifdef HAVE_MINIZIP
+
+#include "ZipStreamExtractor.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include "QsLog.h"
+
+#define ZIP_LOCAL_HEADER_SIG      0x04034b50
+#define ZIP_DATA_DESCRIPTOR_SIG   0x08074b50
+#define ZIP_CENTRAL_DIRECTORY_SIG 0x02014b50
+#define ZIP_END_OF_DIRECTORY_SIG  0x06054b50
+
+#define ZIP_LOCAL_HEADER_SIZE     30
+#define ZIP_CENTRAL_HEADER_SIZE   46
+
+#define ZIP_FLAG_ENCRYPTED        0x1
+#define ZIP_FLAG_DATA_DESCRIPTOR  0x8
+
+#define ZIP_METHOD_STORED         0
+#define ZIP_METHOD_DEFLATED       8
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static quint16 le16(const QByteArray& buf, int pos)
+{
+  return qFromLittleEndian<quint16>((const uchar *)buf.constData() + pos);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static quint32 le32(const QByteArray& buf, int pos)
+{
+  return qFromLittleEndian<quint32>((const uchar *)buf.constData() + pos);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ZipStreamExtractor::ZipStreamExtractor(const QString& dest)
+  : m_dest(dest), m_state(State::LocalHeader), m_position(0), m_failed(false),
+    m_entryFlags(0), m_entryMethod(0), m_entryCrc(0), m_entryRemaining(0), m_runningCrc(0),
+    m_entryFile(nullptr), m_zstream(), m_zstreamActive(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ZipStreamExtractor::~ZipStreamExtractor()
+{
+  closeEntry();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ZipStreamExtractor::reset()
+{
+  closeEntry();
+  m_state = State::LocalHeader;
+  m_buffer.clear();
+  m_position = 0;
+  m_failed = false;
+  m_attributes.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ZipStreamExtractor::closeEntry()
+{
+  if (m_zstreamActive)
+    inflateEnd(&m_zstream);
+  m_zstreamActive = false;
+
+  // Deleting an uncommitted QSaveFile discards it.
+  delete m_entryFile;
+  m_entryFile = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ZipStreamExtractor::fail(const QString& message)
+{
+  if (!m_failed)
+    QLOG_WARN() << "Streaming zip extraction stopped:" << message;
+  m_failed = true;
+  closeEntry();
+  m_buffer.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ZipStreamExtractor::feed(const QByteArray& data, qint64 offset)
+{
+  if (offset == 0)
+    reset();
+
+  if (m_failed)
+    return;
+
+  if (offset != m_position)
+  {
+    fail("non-contiguous data");
+    return;
+  }
+
+  m_position += data.size();
+  m_buffer.append(data);
+  process();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ZipStreamExtractor::process()
+{
+  bool progress = true;
+  while (progress && !m_failed)
+  {
+    switch (m_state)
+    {
+      case State::LocalHeader:
+        progress = startEntry();
+        break;
+      case State::EntryData:
+        progress = processEntryData();
+        break;
+      case State::DataDescriptor:
+      {
+        progress = false;
+        if (m_buffer.size() < 4)
+          break;
+        // The signature is optional.
+        int start = le32(m_buffer, 0) == ZIP_DATA_DESCRIPTOR_SIG ? 4 : 0;
+        if (m_buffer.size() < start + 12)
+          break;
+        quint32 crc = le32(m_buffer, start);
+        m_buffer.remove(0, start + 12);
+        progress = finishEntry(crc);
+        break;
+      }
+      case State::CentralDirectory:
+        progress = processCentralDirectory();
+        break;
+      case State::Done:
+        m_buffer.clear();
+        progress = false;
+        break;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZipStreamExtractor::startEntry()
+{
+  if (m_buffer.size() < 4)
+    return false;
+
+  quint32 sig = le32(m_buffer, 0);
+  if (sig == ZIP_CENTRAL_DIRECTORY_SIG)
+  {
+    m_state = State::CentralDirectory;
+    return true;
+  }
+  if (sig != ZIP_LOCAL_HEADER_SIG)
+  {
+    fail("unexpected signature");
+    return false;
+  }
+
+  if (m_buffer.size() < ZIP_LOCAL_HEADER_SIZE)
+    return false;
+
+  quint16 nameLength = le16(m_buffer, 26);
+  quint16 extraLength = le16(m_buffer, 28);
+  int headerSize = ZIP_LOCAL_HEADER_SIZE + nameLength + extraLength;
+  if (m_buffer.size() < headerSize)
+    return false;
+
+  m_entryFlags = le16(m_buffer, 6);
+  m_entryMethod = le16(m_buffer, 8);
+  m_entryCrc = le32(m_buffer, 14);
+  quint32 compressedSize = le32(m_buffer, 18);
+  m_entryName = QString::fromUtf8(m_buffer.constData() + ZIP_LOCAL_HEADER_SIZE, nameLength);
+  m_buffer.remove(0, headerSize);
+
+  if (m_entryFlags & ZIP_FLAG_ENCRYPTED)
+  {
+    fail("encrypted entry");
+    return false;
+  }
+  if (m_entryMethod != ZIP_METHOD_STORED && m_entryMethod != ZIP_METHOD_DEFLATED)
+  {
+    fail("unsupported compression method");
+    return false;
+  }
+  if (compressedSize == 0xFFFFFFFF)
+  {
+    fail("zip64 entry");
+    return false;
+  }
+  bool sizeKnown = !(m_entryFlags & ZIP_FLAG_DATA_DESCRIPTOR);
+  if (!sizeKnown && m_entryMethod == ZIP_METHOD_STORED)
+  {
+    fail("stored entry of unknown size");
+    return false;
+  }
+  if (m_entryName.isEmpty() || m_entryName.startsWith("/") || m_entryName.split("/").contains(".."))
+  {
+    fail("invalid entry name " + m_entryName);
+    return false;
+  }
+
+  QString path = m_dest + "/" + m_entryName;
+  QString dir = m_entryName.endsWith("/") ? path : QFileInfo(path).path();
+  if (!QDir(dir).mkpath("."))
+  {
+    fail("could not create zip sub directory");
+    return false;
+  }
+
+  if (!m_entryName.endsWith("/"))
+  {
+    m_entryFile = new QSaveFile(path);
+    if (!m_entryFile->open(QIODevice::WriteOnly))
+    {
+      fail("could not open output file " + m_entryName);
+      return false;
+    }
+  }
+
+  if (m_entryMethod == ZIP_METHOD_DEFLATED)
+  {
+    m_zstream = z_stream();
+    // Negative window bits: raw deflate data without zlib header.
+    if (inflateInit2(&m_zstream, -MAX_WBITS) != Z_OK)
+    {
+      fail("inflateInit2() failed");
+      return false;
+    }
+    m_zstreamActive = true;
+  }
+
+  m_entryRemaining = sizeKnown ? compressedSize : -1;
+  m_runningCrc = crc32(0, Z_NULL, 0);
+  m_state = State::EntryData;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZipStreamExtractor::processEntryData()
+{
+  int available = m_buffer.size();
+  if (m_entryRemaining >= 0)
+    available = (int)qMin((qint64)available, m_entryRemaining);
+
+  if (m_entryMethod == ZIP_METHOD_STORED)
+  {
+    if (available > 0)
+    {
+      m_runningCrc = crc32(m_runningCrc, (const Bytef *)m_buffer.constData(), available);
+      if (m_entryFile && m_entryFile->write(m_buffer.constData(), available) != available)
+      {
+        fail("error writing output file " + m_entryName);
+        return false;
+      }
+      m_buffer.remove(0, available);
+      m_entryRemaining -= available;
+    }
+    if (m_entryRemaining > 0)
+      return false;
+    return finishEntry(m_entryCrc);
+  }
+
+  if (available == 0 && m_entryRemaining != 0)
+    return false;
+
+  m_zstream.next_in = (Bytef *)m_buffer.constData();
+  m_zstream.avail_in = available;
+
+  int ret = Z_OK;
+  while (ret == Z_OK && (m_zstream.avail_in > 0 || m_zstream.avail_out == 0))
+  {
+    char out[65536];
+    m_zstream.next_out = (Bytef *)out;
+    m_zstream.avail_out = sizeof(out);
+
+    ret = inflate(&m_zstream, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+    {
+      fail("error decompressing zip entry " + m_entryName);
+      return false;
+    }
+
+    int produced = (int)(sizeof(out) - m_zstream.avail_out);
+    m_runningCrc = crc32(m_runningCrc, (const Bytef *)out, produced);
+    if (m_entryFile && m_entryFile->write(out, produced) != produced)
+    {
+      fail("error writing output file " + m_entryName);
+      return false;
+    }
+
+    if (ret == Z_BUF_ERROR)
+      break;
+  }
+
+  int consumed = available - (int)m_zstream.avail_in;
+  m_buffer.remove(0, consumed);
+  if (m_entryRemaining >= 0)
+    m_entryRemaining -= consumed;
+
+  if (ret != Z_STREAM_END)
+  {
+    if (m_entryRemaining == 0)
+      fail("truncated deflate data in " + m_entryName);
+    return false;
+  }
+
+  if (m_entryFlags & ZIP_FLAG_DATA_DESCRIPTOR)
+  {
+    m_state = State::DataDescriptor;
+    return true;
+  }
+
+  return finishEntry(m_entryCrc);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZipStreamExtractor::finishEntry(quint32 crc)
+{
+  if (crc != m_runningCrc)
+  {
+    fail("CRC mismatch in " + m_entryName);
+    return false;
+  }
+
+  if (m_entryFile && !m_entryFile->commit())
+  {
+    fail("error closing output file " + m_entryName);
+    return false;
+  }
+
+  closeEntry();
+  m_state = State::LocalHeader;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZipStreamExtractor::processCentralDirectory()
+{
+  if (m_buffer.size() < 4)
+    return false;
+
+  if (le32(m_buffer, 0) != ZIP_CENTRAL_DIRECTORY_SIG)
+  {
+    // End of central directory record (or zip64 variants of it); nothing of
+    // interest follows.
+    m_state = State::Done;
+    return true;
+  }
+
+  if (m_buffer.size() < ZIP_CENTRAL_HEADER_SIZE)
+    return false;
+
+  quint16 nameLength = le16(m_buffer, 28);
+  quint16 extraLength = le16(m_buffer, 30);
+  quint16 commentLength = le16(m_buffer, 32);
+  int size = ZIP_CENTRAL_HEADER_SIZE + nameLength + extraLength + commentLength;
+  if (m_buffer.size() < size)
+    return false;
+
+  quint32 attributes = le32(m_buffer, 38);
+  QString name = QString::fromUtf8(m_buffer.constData() + ZIP_CENTRAL_HEADER_SIZE, nameLength);
+  m_attributes.append(qMakePair(name, attributes));
+
+  m_buffer.remove(0, size);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ZipStreamExtractor::finish()
+{
+  if (!m_failed && m_state != State::Done)
+    fail("archive is truncated");
+
+  if (m_failed)
+    return false;
+
+#ifndef _WIN32
+  // Set the executable bit, same as extractZip().
+  for (auto entry : m_attributes)
+  {
+    if (entry.first.endsWith("/") || !(entry.second & 0x400000))
+      continue;
+
+    if (!QFile::setPermissions(m_dest + "/" + entry.first, QFileDevice::Permissions(0x5145)))
+    {
+      fail("could not set output executable bit on extracted file");
+      return false;
+    }
+  }
+#endif
+
+  return true;
+}
+
+#endif // HAVE_MINIZIP
@@ -0,0 +1,78 @@
+#ifndef ZIPSTREAMEXTRACTOR_H
+#define ZIPSTREAMEXTRACTOR_H
+
+#ifdef HAVE_MINIZIP
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QSaveFile>
+#include <QString>
+
+#include <zlib.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Extracts a .zip archive while it's being downloaded, by walking the local
+// file headers in order instead of seeking to the central directory. Only the
+// subset of the format used by our archives is supported (stored or deflated
+// entries, no encryption, no zip64). If anything unsupported shows up, the
+// extractor marks itself as failed and the caller should fall back to
+// extracting the complete file with minizip.
+class ZipStreamExtractor
+{
+public:
+  explicit ZipStreamExtractor(const QString& dest);
+  ~ZipStreamExtractor();
+
+  // Feed the next chunk of the archive. offset is the position of the chunk
+  // within the archive; feeding offset 0 again restarts extraction.
+  void feed(const QByteArray& data, qint64 offset);
+
+  // Call after the last chunk. Returns whether all entries were extracted.
+  bool finish();
+
+  bool failed() const { return m_failed; }
+
+private:
+  enum class State
+  {
+    LocalHeader,
+    EntryData,
+    DataDescriptor,
+    CentralDirectory,
+    Done,
+  };
+
+  void reset();
+  void process();
+  bool startEntry();
+  bool processEntryData();
+  bool finishEntry(quint32 crc);
+  bool processCentralDirectory();
+  void closeEntry();
+  void fail(const QString& message);
+
+  QString m_dest;
+  State m_state;
+  QByteArray m_buffer;
+  qint64 m_position;
+  bool m_failed;
+
+  // current entry
+  QString m_entryName;
+  quint16 m_entryFlags;
+  quint16 m_entryMethod;
+  quint32 m_entryCrc;
+  qint64 m_entryRemaining; // compressed bytes left, -1 if unknown
+  quint32 m_runningCrc;
+  QSaveFile* m_entryFile;
+  z_stream m_zstream;
+  bool m_zstreamActive;
+
+  // (path, external attributes) from the central directory
+  QList<QPair<QString, quint32>> m_attributes;
+};
+
+#endif // HAVE_MINIZIP
+
+#endif // ZIPSTREAMEXTRACTOR_H
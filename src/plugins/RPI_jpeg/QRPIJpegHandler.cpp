@@ -10,6 +10,170 @@
 
 QT_BEGIN_NAMESPACE
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool JpegSizeParser::feed(const BYTE* data, int size)
+{
+  for (int i = 0; i < size && m_state != Done && m_state != Failed; i++)
+  {
+    BYTE c = data[i];
+
+    switch (m_state)
+    {
+      case StartOfImage:
+        if (c != (m_position ? 0xD8 : 0xFF))
+          m_state = Failed;
+        else if (++m_position == 2)
+          m_state = MarkerStart;
+        break;
+
+      case MarkerStart:
+        m_state = c == 0xFF ? MarkerCode : Failed;
+        break;
+
+      case MarkerCode:
+        if (c == 0xFF)
+        {
+          // fill byte
+        }
+        else if (c == 0x01 || (c >= 0xD0 && c <= 0xD7))
+        {
+          // markers without a segment
+          m_state = MarkerStart;
+        }
+        else if (c == 0xD9 || c == 0xDA)
+        {
+          // end of image or start of scan, there should have been a frame header before
+          m_state = Failed;
+        }
+        else
+        {
+          // SOF0 - SOF15, except for DHT, JPG and DAC
+          m_frameHeader = c >= 0xC0 && c <= 0xCF && c != 0xC4 && c != 0xC8 && c != 0xCC;
+          m_position = 0;
+          m_state = SegmentLength;
+        }
+        break;
+
+      case SegmentLength:
+        m_buffer[m_position++] = c;
+        if (m_position == 2)
+        {
+          m_remaining = ((m_buffer[0] << 8) | m_buffer[1]) - 2;
+          m_position = 0;
+          if (m_remaining < (m_frameHeader ? 5 : 0))
+            m_state = Failed;
+          else if (m_frameHeader)
+            m_state = FrameHeader;
+          else
+            m_state = m_remaining ? SkipSegment : MarkerStart;
+        }
+        break;
+
+      case SkipSegment:
+      {
+        // APP segments can be big (EXIF thumbnails), skip them in one go
+        int skip = qMin(m_remaining, size - i);
+        m_remaining -= skip;
+        i += skip - 1;
+        if (!m_remaining)
+          m_state = MarkerStart;
+        break;
+      }
+
+      case FrameHeader:
+        m_buffer[m_position++] = c;
+        if (m_position == 5)
+        {
+          // precision, height, width
+          m_size = QSize((m_buffer[3] << 8) | m_buffer[4], (m_buffer[1] << 8) | m_buffer[2]);
+          m_state = Done;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  return m_state != Failed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// State of one QRPIJpegHandler::read(), passed to the decoder callbacks.
+struct JpegDecodeJob
+{
+  QIODevice* device;
+  BRCMJPEG_REQUEST_T* request;
+  JpegSizeParser parser;
+  qint64 inputSize;
+  // only set if the decoder may scale
+  QSize scaledSize;
+  QImage image;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int readJpegInput(void* opaque, unsigned char* buffer, unsigned int size)
+{
+  JpegDecodeJob* job = (JpegDecodeJob*)opaque;
+
+  qint64 got = job->device->read((char*)buffer, size);
+  while (got == 0 && !job->device->atEnd() && job->device->waitForReadyRead(JPEG_READ_TIMEOUT_MSEC))
+    got = job->device->read((char*)buffer, size);
+
+  if (got < 0)
+    return -1;
+
+  job->inputSize += got;
+  if (job->inputSize > MAX_ENCODED)
+  {
+    qWarning() << "QRPIJpegHandler : image is larger than" << MAX_ENCODED << "bytes";
+    return -1;
+  }
+
+  if (!job->parser.hasSize() && !job->parser.failed())
+  {
+    job->parser.feed(buffer, (int)got);
+
+    if (job->parser.hasSize())
+    {
+      QSize size = job->parser.size();
+      if (size.width() > MAX_WIDTH || size.height() > MAX_HEIGHT)
+      {
+        qWarning() << "QRPIJpegHandler : image is too big" << size;
+        return -1;
+      }
+
+      // The decoder hasn't seen the header yet, so it's not too late to ask for a smaller
+      // picture. Only downscaling is left to the hardware.
+      if (job->scaledSize.isValid() && !job->scaledSize.isEmpty() &&
+          job->scaledSize.width() < size.width() && job->scaledSize.height() < size.height())
+      {
+        job->request->scaled_width = job->scaledSize.width();
+        job->request->scaled_height = job->scaledSize.height();
+      }
+    }
+  }
+
+  return (int)got;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int allocateJpegOutput(void* opaque, BRCMJPEG_REQUEST_T* request)
+{
+  JpegDecodeJob* job = (JpegDecodeJob*)opaque;
+
+  // decode straight into the image
+  job->image = QImage(request->width, request->height, QImage::Format_RGBA8888_Premultiplied);
+  if (job->image.isNull())
+    return -1;
+
+  request->output = job->image.bits();
+  request->output_alloc_size = job->image.byteCount();
+  request->buffer_width = job->image.bytesPerLine() / 4;
+  request->buffer_height = job->image.height();
+  return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QRPIJpegHandler::QRPIJpegHandler() : m_quality(100), m_decoder(NULL)
 {
@@ -17,10 +181,7 @@ QRPIJpegHandler::QRPIJpegHandler() : m_quality(100), m_decoder(NULL)
 
   // initialize decoder parameters
   memset(&m_dec_request, 0, sizeof(m_dec_request));
-  m_dec_request.input = encodedInBuf;
-  m_dec_request.output = decodedBuf;
   m_dec_request.output_handle = 0;
-  m_dec_request.output_alloc_size = MAX_DECODED;
   m_dec_request.pixel_format = PIXEL_FORMAT_RGBA;
 
   BRCMJPEG_STATUS_T status = brcmjpeg_create(BRCMJPEG_TYPE_DECODER, &m_decoder);
@@ -68,30 +229,57 @@ bool QRPIJpegHandler::read(QImage* image)
 {
   if (device())
   {
+    // don't even start on files the decoder won't take
+    if (!device()->isSequential() && device()->size() - device()->pos() > MAX_ENCODED)
+    {
+      qWarning() << "QRPIJpegHandler : image is larger than" << MAX_ENCODED << "bytes";
+      return false;
+    }
 
+    JpegDecodeJob job;
+    job.device = device();
+    job.request = &m_dec_request;
+    job.inputSize = 0;
+    // with a clip rect the full picture is needed first
+    if (m_clipRect.isNull())
+      job.scaledSize = m_scaledSize;
+
+    // the data is streamed in, and the output allocated once the decoder knows the size
+    m_dec_request.input = NULL;
+    m_dec_request.input_size = 0;
+    m_dec_request.output = NULL;
+    m_dec_request.output_alloc_size = 0;
     m_dec_request.buffer_width = 0;
     m_dec_request.buffer_height = 0;
-    m_dec_request.input_size = device()->read((char*)encodedInBuf, sizeof(encodedInBuf));
+    m_dec_request.scaled_width = 0;
+    m_dec_request.scaled_height = 0;
+    m_dec_request.input_read = readJpegInput;
+    m_dec_request.output_ready = allocateJpegOutput;
+    m_dec_request.opaque = &job;
 
     QElapsedTimer timer;
     timer.start();
 
     BRCMJPEG_STATUS_T status = brcmjpeg_process(m_decoder, &m_dec_request);
 
-    if (status == BRCMJPEG_SUCCESS)
+    m_dec_request.output = NULL;
+    m_dec_request.opaque = NULL;
+
+    if (status == BRCMJPEG_SUCCESS && !job.image.isNull())
     {
+      QImage decodedImage = job.image;
 
-      for (int i = 0; i < m_dec_request.height; i++)
-      {
-        memcpy(image->scanLine(i), decodedBuf + m_dec_request.buffer_width * i * 4,
-               m_dec_request.buffer_width * 4);
-      }
+      // whatever the hardware couldn't do for us
+      if (!m_clipRect.isNull())
+        decodedImage = decodedImage.copy(m_clipRect);
+      if (m_scaledSize.isValid() && !m_scaledSize.isEmpty() && decodedImage.size() != m_scaledSize)
+        decodedImage = decodedImage.scaled(m_scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 
-      //*image = decodedImage;
+      *image = decodedImage;
       qDebug() << QDateTime::currentDateTime().toMSecsSinceEpoch()
                << "QRPIJpegHandler : decoded a"
                << m_dec_request.width << "x" << m_dec_request.height
-               << "image in" << timer.elapsed() << "ms";
+               << "image from" << job.inputSize << "bytes in" << timer.elapsed() << "ms";
 
       return true;
     }
@@ -120,53 +308,31 @@ bool QRPIJpegHandler::write(const QImage& image)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool QRPIJpegHandler::supportsOption(ImageOption option) const
 {
-  return option == Quality || option == Size || option == ImageFormat;
+  return option == Quality || option == Size || option == ImageFormat ||
+         option == ScaledSize || option == ClipRect;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool QRPIJpegHandler::readJpegSize(QIODevice* device, QSize& size) const
 {
-  if (canRead(device))
+  if (!canRead(device))
   {
-    JFIFHEAD header;
-    int bytesRead = device->peek((char*)&header, sizeof(header));
-    if (bytesRead >= (sizeof(header) - JFIF_DATA_SIZE))
-    {
-      BYTE* dataptr = header.data;
-
-      while (dataptr < ((BYTE*)&header + bytesRead))
-      {
-        if (dataptr[0] != 0xFF)
-        {
-          qWarning() << "readJpegSize : got wrong marker " << dataptr[0];
-          return false;
-        }
+    qWarning() << "readJpegSize : device " << device << "can't be read!" ;
+    return false;
+  }
 
-        // we look for size block marker
-        if (dataptr[1] == 0xC0 && dataptr[2] == 0x0)
-        {
-          size.setWidth(dataptr[8] + dataptr[7] * 256);
-          size.setHeight(dataptr[6] + dataptr[5] * 256);
-          return true;
-        }
+  JpegSizeParser parser;
+  QByteArray header = device->peek(JPEG_HEADER_PEEK);
+  parser.feed((const BYTE*)header.constData(), header.size());
 
-        dataptr += dataptr[3] + (dataptr[2] * 256) + 2;
-      }
-    }
-    else
-    {
-       qWarning() << "readJpegSize : could not read " << sizeof(header) << "bytes, read " << bytesRead;
-       return false;
-    }
-  }
-  else
+  if (!parser.hasSize())
   {
-    qWarning() << "readJpegSize : device " << device << "can't be read!" ;
+    qWarning() << "readJpegSize : could not find the proper size marker";
     return false;
   }
 
-  qWarning() << "readJpegSize : could not find the proper size marker";
-  return false;
+  size = parser.size();
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -187,6 +353,16 @@ QVariant QRPIJpegHandler::option(ImageOption option) const
       return QImage::Format_RGBA8888_Premultiplied;
     }
 
+    case ScaledSize:
+    {
+      return m_scaledSize;
+    }
+
+    case ClipRect:
+    {
+      return m_clipRect;
+    }
+
     default:
     {
       qWarning() << "QRPIJpegHandler : requesting unsupported option" << option;
@@ -205,6 +381,14 @@ void QRPIJpegHandler::setOption(ImageOption option, const QVariant& value)
       m_quality = value.toInt();
       break;
 
+    case ScaledSize:
+      m_scaledSize = value.toSize();
+      break;
+
+    case ClipRect:
+      m_clipRect = value.toRect();
+      break;
+
     default:
       qWarning() << "QRPIJpegHandler : setOption unsupported option" << option << "to" << value;
       break;
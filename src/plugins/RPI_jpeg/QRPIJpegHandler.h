@@ -8,38 +8,62 @@
 
 QT_BEGIN_NAMESPACE
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
-// JPEG header struct
-#define JFIF_DATA_SIZE 4096 // additionnal data size for header parsing
-
 typedef unsigned char BYTE;
 
-typedef struct _JFIFHeader
-{
-  BYTE SOI[2];          /* 00h  Start of Image Marker     */
-  BYTE APP0[2];         /* 02h  Application Use Marker    */
-  BYTE Length[2];       /* 04h  Length of APP0 Field      */
-  BYTE Identifier[5];   /* 06h  "JFIF" (zero terminated) Id String */
-  BYTE Version[2];      /* 07h  JFIF Format Revision      */
-  BYTE Units;           /* 09h  Units used for Resolution */
-  BYTE Xdensity[2];     /* 0Ah  Horizontal Resolution     */
-  BYTE Ydensity[2];     /* 0Ch  Vertical Resolution       */
-  BYTE XThumbnail;      /* 0Eh  Horizontal Pixel Count    */
-  BYTE YThumbnail;      /* 0Fh  Vertical Pixel Count      */
-  BYTE data[JFIF_DATA_SIZE];
-} JFIFHEAD;
-
-// Hardware decoder buffers
+// Hardware decoder limits
 #define MAX_WIDTH   5000
 #define MAX_HEIGHT  5000
 #define MAX_ENCODED (15*1024*1024)
-#define MAX_DECODED (MAX_WIDTH*MAX_HEIGHT*2)
 
-static BYTE encodedInBuf[MAX_ENCODED];
-static BYTE decodedBuf[MAX_DECODED];
+// how much of the file option(Size) looks at without reading it
+#define JPEG_HEADER_PEEK (256*1024)
+
+// how long to wait for more data from a sequential device
+#define JPEG_READ_TIMEOUT_MSEC 5000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Finds the picture size in the markers of a JPEG stream. The data can be fed in arbitrary
+// chunks, each byte is only looked at once.
+class JpegSizeParser
+{
+public:
+  JpegSizeParser() : m_state(StartOfImage), m_position(0), m_remaining(0), m_frameHeader(false) {}
+
+  // Returns false if parsing can't continue (not a JPEG, or no size before the image data).
+  bool feed(const BYTE *data, int size);
+
+  bool hasSize() const { return m_state == Done; }
+  bool failed() const { return m_state == Failed; }
+  QSize size() const { return m_size; }
+
+private:
+  enum State
+  {
+    StartOfImage,
+    MarkerStart,
+    MarkerCode,
+    SegmentLength,
+    SkipSegment,
+    FrameHeader,
+    Done,
+    Failed
+  };
+
+  State m_state;
+  int m_position;
+  int m_remaining;
+  bool m_frameHeader;
+  BYTE m_buffer[5];
+  QSize m_size;
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // RPI JPEG decoding handling class
+//
+// The encoded data is streamed into the decoder's own input buffers, and the picture
+// is decoded into a QImage allocated once its size is known. Nothing is shared between
+// handlers, so QtQuick's loader threads can use them at the same time (the hardware
+// decoder takes one request after the other).
 class QRPIJpegHandler : public QImageIOHandler
 {
 public:
@@ -61,6 +85,8 @@ public:
 private:
     bool readJpegSize(QIODevice *device, QSize &size) const;
     int m_quality;
+    QSize m_scaledSize;
+    QRect m_clipRect;
     BRCMJPEG_REQUEST_T m_dec_request;
     BRCMJPEG_T *m_decoder;
 };
@@ -283,7 +283,8 @@ static BRCMJPEG_STATUS_T brcmjpeg_init_decoder(BRCMJPEG_T *ctx)
 
    ctx->mmal->input[0]->buffer_size = ctx->mmal->input[0]->buffer_size_min;
    ctx->mmal->input[0]->buffer_num = 3;
-   status = mmal_wrapper_port_enable(ctx->mmal->input[0], 0);
+   /* The input is copied or streamed into buffers owned by the port */
+   status = mmal_wrapper_port_enable(ctx->mmal->input[0], MMAL_WRAPPER_FLAG_PAYLOAD_ALLOCATE);
    CHECK_MMAL_STATUS(status, INIT, "failed to enable input port");
 
    LOG_DEBUG("decoder initialised (input chunk size %i)",
@@ -538,7 +539,7 @@ static BRCMJPEG_STATUS_T brcmjpeg_decode(BRCMJPEG_T *ctx,
    BRCMJPEG_STATUS_T err;
    MMAL_STATUS_T status;
    MMAL_BUFFER_HEADER_T *in, *out;
-   MMAL_BOOL_T eos = MMAL_FALSE;
+   MMAL_BOOL_T eos = MMAL_FALSE, in_eos = MMAL_FALSE;
    const uint8_t *inBuf = jd->input;
    unsigned int slices = 0, inBufSize = jd->input_size;
    MMAL_PORT_T *port_in = ctx->mmal->input[0];
@@ -553,19 +554,34 @@ static BRCMJPEG_STATUS_T brcmjpeg_decode(BRCMJPEG_T *ctx,
    while (!eos)
    {
       /* Send as many chunks of data to decode as we can */
-      while (inBufSize)
+      while (!in_eos)
       {
          status = mmal_wrapper_buffer_get_empty(port_in, &in, 0);
          if (status == MMAL_EAGAIN)
             break;
          CHECK_MMAL_STATUS(status, EXECUTE, "failed to get empty buffer (%i)", status);
 
-         in->data = (uint8_t *)inBuf;
-         in->length = MMAL_MIN(port_in->buffer_size, inBufSize);
-         in->alloc_size = in->length;
-         inBufSize -= in->length;
-         inBuf += in->length;
-         in->flags = inBufSize ? 0 : MMAL_BUFFER_HEADER_FLAG_EOS;
+         if (jd->input_read)
+         {
+            int got = jd->input_read(jd->opaque, in->data, in->alloc_size);
+            if (got < 0)
+            {
+               mmal_buffer_header_release(in);
+               status = MMAL_EINVAL;
+            }
+            CHECK_MMAL_STATUS(status, INPUT_BUFFER, "input aborted");
+            in->length = got;
+            in_eos = !got;
+         }
+         else
+         {
+            in->length = MMAL_MIN(in->alloc_size, inBufSize);
+            memcpy(in->data, inBuf, in->length);
+            inBufSize -= in->length;
+            inBuf += in->length;
+            in_eos = !inBufSize;
+         }
+         in->flags = in_eos ? MMAL_BUFFER_HEADER_FLAG_EOS : 0;
          LOG_DEBUG("send decode in (%i bytes)", in->length);
          status = mmal_port_send_buffer(port_in, in);
          CHECK_MMAL_STATUS(status, EXECUTE, "failed to send input buffer");
@@ -617,6 +633,33 @@ static BRCMJPEG_STATUS_T brcmjpeg_decode(BRCMJPEG_T *ctx,
             }
          }
 
+         /* Let the video_convert stage scale the picture if we've been asked to */
+         if (jd->scaled_width && jd->scaled_height && !jd->output_handle &&
+             ctx->slice_height == port_out->format->es->video.height)
+         {
+            MMAL_VIDEO_FORMAT_T original = port_out->format->es->video;
+
+            port_out->format->es->video.width = VCOS_ALIGN_UP(jd->scaled_width, 32);
+            port_out->format->es->video.height = VCOS_ALIGN_UP(jd->scaled_height, 16);
+            port_out->format->es->video.crop.x = 0;
+            port_out->format->es->video.crop.y = 0;
+            port_out->format->es->video.crop.width = jd->scaled_width;
+            port_out->format->es->video.crop.height = jd->scaled_height;
+
+            status = mmal_port_format_commit(port_out);
+            if (status == MMAL_SUCCESS)
+            {
+               ctx->slice_height = port_out->format->es->video.height;
+               LOG_DEBUG("scaling to %ux%u", jd->scaled_width, jd->scaled_height);
+            }
+            else
+            {
+               LOG_DEBUG("scaling to %ux%u not supported (%i)", jd->scaled_width,
+                  jd->scaled_height, status);
+               port_out->format->es->video = original;
+            }
+         }
+
          LOG_DEBUG("using slice size %u", ctx->slice_height);
          status = mmal_port_format_commit(port_out);
          CHECK_MMAL_STATUS(status, EXECUTE, "invalid format change event");
@@ -653,6 +696,15 @@ static BRCMJPEG_STATUS_T brcmjpeg_decode(BRCMJPEG_T *ctx,
       jd->height = port_out->format->es->video.crop.height;
       if (!jd->height)
          jd->height = port_out->format->es->video.height;
+      if (!slices && jd->output_ready && !jd->output_handle)
+      {
+         if (jd->output_ready(jd->opaque, jd))
+         {
+            mmal_buffer_header_release(out);
+            status = MMAL_EINVAL;
+         }
+         CHECK_MMAL_STATUS(status, OUTPUT_BUFFER, "output rejected");
+      }
       if (jd->output_handle)
          jd->buffer_height = port_out->format->es->video.height;
       if (!jd->buffer_height)
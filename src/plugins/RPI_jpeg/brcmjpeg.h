@@ -70,7 +70,7 @@ typedef enum
 } BRCMJPEG_PIXEL_FORMAT_T;
 
 /** Definition of a codec request  */
-typedef struct
+typedef struct BRCMJPEG_REQUEST_T
 {
    /** Pointer to the buffer containing the input data
     * A client should set input OR input_handle, but not both. */
@@ -108,6 +108,28 @@ typedef struct
 
    /** Encode quality - 0 to 100 */
    unsigned int quality;
+
+   /** Size the decoded picture should be scaled to (input parameter for decode).
+     * 0 decodes at the size of the jpeg. The picture is scaled by the video
+     * convert stage of the decoder pipeline; if that fails the full size is
+     * decoded, so check width and height afterwards. */
+   unsigned int scaled_width;
+   unsigned int scaled_height;
+
+   /** Optional input callback (decode only). If set, input and input_size are
+     * ignored and the data is pulled in chunks straight into the decoder's
+     * input buffers. It returns the number of bytes written to buffer, 0 at the
+     * end of the data or a negative value to abort the decode.
+     * scaled_width and scaled_height are only looked at once the decoder has
+     * parsed the header, so this callback may still fill them in. */
+   int (*input_read)(void *opaque, unsigned char *buffer, unsigned int size);
+   /** Optional output callback (decode only). Called when width and height of
+     * the decoded picture are known, before anything is written to output. It
+     * can set output, output_alloc_size, buffer_width and buffer_height, or
+     * return non-zero to abort the decode. */
+   int (*output_ready)(void *opaque, struct BRCMJPEG_REQUEST_T *request);
+   /** Passed to the callbacks */
+   void *opaque;
 } BRCMJPEG_REQUEST_T;
 
 /** Type of the codec instance */
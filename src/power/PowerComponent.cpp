@@ -63,9 +63,9 @@ void PowerComponent::setScreensaverEnabled(bool enabled)
 /////////////////////////////////////////////////////////////////////////////////////////
 void PowerComponent::componentPostInitialize()
 {
-  InputComponent::Get().registerHostCommand("poweroff", this, "PowerOff");
-  InputComponent::Get().registerHostCommand("reboot", this, "Reboot");
-  InputComponent::Get().registerHostCommand("suspend", this, "Suspend");
+  InputComponent::Get().registerHostCommand("poweroff", this, &PowerComponent::PowerOff);
+  InputComponent::Get().registerHostCommand("reboot", this, &PowerComponent::Reboot);
+  InputComponent::Get().registerHostCommand("suspend", this, &PowerComponent::Suspend);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -24,6 +24,7 @@ public:
     { }
 
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings" }; }
   bool componentExport() override { return true; }
   const char* componentName() override { return "power"; }
   void componentPostInitialize() override;
@@ -1,6 +1,9 @@
+#include <QThread>
 #include <QtDBus/QDBusConnection>
-#include <QtDBus/QDBusInterface>
-#include <QtDBus/QDBusReply>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
+#include <QtDBus/QDBusServiceWatcher>
 
 #include "PowerComponentDBus.h"
 
@@ -13,147 +16,201 @@
 #define DBUS_SCREENSAVER_INTERFACE "org.freedesktop.ScreenSaver"
 
 /////////////////////////////////////////////////////////////////////////////////////////
-bool PowerComponentDBus::callPowerMethod(QString method)
+PowerComponentDBus::PowerComponentDBus() : PowerComponent(0), m_capabilities(0), m_loginWatcher(nullptr),
+  m_inhibitPending(false), m_inhibitWanted(false)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool PowerComponentDBus::componentInitialize()
 {
   if (QDBusConnection::systemBus().isConnected())
   {
-    QDBusInterface iface(DBUS_SERVICE_NAME, DBUS_SERVICE_PATH, DBUS_INTERFACE,
-                         QDBusConnection::systemBus());
+    // a restarted logind might answer differently
+    m_loginWatcher = new QDBusServiceWatcher(DBUS_SERVICE_NAME, QDBusConnection::systemBus(),
+                                             QDBusServiceWatcher::WatchForRegistration, this);
+    connect(m_loginWatcher, &QDBusServiceWatcher::serviceRegistered, this, [=]() { refreshCapabilities(); });
 
-    if (iface.isValid())
-    {
-      QDBusReply<bool> reply = iface.call(method, true);
-
-      if (reply.isValid())
-      {
-        return true;
-      }
-      else
-      {
-        QLOG_ERROR() << "callPowerMethod : Error while calling" << method << ":"
-                     << reply.error().message();
-        return false;
-      }
-    }
-    else
-    {
-      QLOG_ERROR() << "callPowerMethod : failed to retrieve interface.";
-    }
+    refreshCapabilities();
   }
   else
   {
-    QLOG_ERROR() << "callPowerMethod : could not find system bus";
+    QLOG_ERROR() << "PowerComponentDBus : could not find system bus";
   }
 
-  return false;
+  return PowerComponent::componentInitialize();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-bool PowerComponentDBus::isPowerMethodAvailable(QString method)
+QDBusPendingCall PowerComponentDBus::asyncCall(const QDBusConnection& bus, const QString& service,
+                                               const QString& path, const QString& interface,
+                                               const QString& method, const QVariantList& arguments)
 {
-  if (QDBusConnection::systemBus().isConnected())
+  QDBusMessage message = QDBusMessage::createMethodCall(service, path, interface, method);
+  message.setArguments(arguments);
+  return bus.asyncCall(message);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+int PowerComponentDBus::getPowerCapabilities()
+{
+  // answered right away, the web client asks for these when it opens the power menu
+  if (QThread::currentThread() == thread())
+    refreshStaleCapabilities();
+  else
+    QMetaObject::invokeMethod(this, "refreshStaleCapabilities", Qt::QueuedConnection);
+
+  return m_capabilities.load();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PowerComponentDBus::refreshStaleCapabilities()
+{
+  if (!m_capabilitiesAge.isValid() || m_capabilitiesAge.elapsed() > DBUS_CAPABILITIES_MAX_AGE_MSEC)
+    refreshCapabilities();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PowerComponentDBus::refreshCapabilities()
+{
+  if (!QDBusConnection::systemBus().isConnected())
+    return;
+
+  m_capabilitiesAge.start();
+  refreshCapability("CanPowerOff", CAP_POWER_OFF);
+  refreshCapability("CanReboot", CAP_REBOOT);
+  refreshCapability("CanSuspend", CAP_SUSPEND);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void PowerComponentDBus::refreshCapability(const QString& method, int capability)
+{
+  QDBusPendingCall call = asyncCall(QDBusConnection::systemBus(), DBUS_SERVICE_NAME, DBUS_SERVICE_PATH,
+                                    DBUS_INTERFACE, method);
+
+  auto watcher = new QDBusPendingCallWatcher(call, this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [=](QDBusPendingCallWatcher* finished)
   {
-    QDBusInterface iface(DBUS_SERVICE_NAME, DBUS_SERVICE_PATH, DBUS_INTERFACE,
-                         QDBusConnection::systemBus());
+    QDBusPendingReply<QString> reply = *finished;
+    finished->deleteLater();
 
-    if (iface.isValid())
+    if (reply.isError())
     {
-      QDBusReply<QString> reply = iface.call(method);
-
-      if (reply.isValid())
-      {
-        return (reply.value() == "yes");
-      }
-      else
-      {
-        QLOG_ERROR() << "isPowerMethodAvailable : Error while calling" << method << ":"
-                     << reply.error().message();
-        return false;
-      }
+      QLOG_ERROR() << "refreshCapability : Error while calling" << method << ":" << reply.error().message();
+      m_capabilities.fetchAndAndOrdered(~capability);
+      return;
     }
+
+    if (reply.value() == "yes")
+      m_capabilities.fetchAndOrOrdered(capability);
     else
-    {
-      QLOG_ERROR() << "isPowerMethodAvailable : failed to retrieve interface.";
-    }
+      m_capabilities.fetchAndAndOrdered(~capability);
+  });
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool PowerComponentDBus::callPowerMethod(const QString& method)
+{
+  if (!QDBusConnection::systemBus().isConnected())
+  {
+    QLOG_ERROR() << "callPowerMethod : could not find system bus";
+    return false;
   }
-  else
+
+  if (QThread::currentThread() != thread())
   {
-    QLOG_ERROR() << "isPowerMethodAvailable : could not find system bus";
+    QMetaObject::invokeMethod(this, "callPowerMethod", Qt::QueuedConnection, Q_ARG(QString, method));
+    return true;
   }
 
-  return false;
+  // the argument is "interactive", polkit may ask the user
+  QDBusPendingCall call = asyncCall(QDBusConnection::systemBus(), DBUS_SERVICE_NAME, DBUS_SERVICE_PATH,
+                                    DBUS_INTERFACE, method, QVariantList{ true });
+
+  auto watcher = new QDBusPendingCallWatcher(call, this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [=](QDBusPendingCallWatcher* finished)
+  {
+    QDBusPendingReply<> reply = *finished;
+    finished->deleteLater();
+
+    if (reply.isError())
+      QLOG_ERROR() << "callPowerMethod : Error while calling" << method << ":" << reply.error().message();
+  });
+
+  return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
 void PowerComponentDBus::doDisableScreensaver()
 {
-  if (screensaver_inhibit_cookie)
+  m_inhibitWanted = true;
+
+  if (screensaver_inhibit_cookie || m_inhibitPending)
   {
     QLOG_INFO() << "doDisableScreensaver : already disabled.";
     return;
   }
-  if (QDBusConnection::systemBus().isConnected())
+  if (!QDBusConnection::sessionBus().isConnected())
   {
-    QDBusInterface iface(DBUS_SCREENSAVER_SERVICE_NAME, DBUS_SCREENSAVER_SERVICE_PATH,
-                         DBUS_SCREENSAVER_INTERFACE, QDBusConnection::sessionBus());
-    if (iface.isValid())
-    {
-      QDBusReply<unsigned int> reply = iface.call("Inhibit", "plexmediaplayer", "playing");
-
-      if (reply.isValid())
-      {
-        screensaver_inhibit_cookie = reply.value();
-      }
-      else
-      {
-        QLOG_ERROR() << "doDisableScreensaver : Error while calling UnInhibit:"
-                     << reply.error().message();
-      }
-    }
-    else
-    {
-      QLOG_ERROR() << "doDisableScreensaver : failed to retrieve interface.";
-    }
+    QLOG_ERROR() << "doDisableScreensaver : could not find session bus";
+    return;
   }
-  else
+
+  QDBusPendingCall call = asyncCall(QDBusConnection::sessionBus(), DBUS_SCREENSAVER_SERVICE_NAME,
+                                    DBUS_SCREENSAVER_SERVICE_PATH, DBUS_SCREENSAVER_INTERFACE, "Inhibit",
+                                    QVariantList{ QString("plexmediaplayer"), QString("playing") });
+  m_inhibitPending = true;
+
+  auto watcher = new QDBusPendingCallWatcher(call, this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [=](QDBusPendingCallWatcher* finished)
   {
-    QLOG_ERROR() << "doDisableScreensaver : could not find system bus";
-  }
+    QDBusPendingReply<unsigned int> reply = *finished;
+    finished->deleteLater();
+    m_inhibitPending = false;
+
+    if (reply.isError())
+    {
+      QLOG_ERROR() << "doDisableScreensaver : Error while calling Inhibit:" << reply.error().message();
+      return;
+    }
+
+    screensaver_inhibit_cookie = reply.value();
+
+    // playback ended while we waited for the cookie
+    if (!m_inhibitWanted)
+      doEnableScreensaver();
+  });
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PowerComponentDBus::doEnableScreensaver()
 {
+  m_inhibitWanted = false;
+
+  // with Inhibit still pending, its reply takes care of this
   if (!screensaver_inhibit_cookie)
   {
     QLOG_INFO() << "doEnableScreensaver : already enabled.";
     return;
   }
-  if (QDBusConnection::systemBus().isConnected())
+  if (!QDBusConnection::sessionBus().isConnected())
   {
-    QDBusInterface iface(DBUS_SCREENSAVER_SERVICE_NAME, DBUS_SCREENSAVER_SERVICE_PATH,
-                         DBUS_SCREENSAVER_INTERFACE, QDBusConnection::sessionBus());
-    if (iface.isValid())
-    {
-      QDBusReply<void> reply = iface.call("UnInhibit", screensaver_inhibit_cookie);
-
-      if (reply.isValid())
-      {
-        screensaver_inhibit_cookie = 0;
-      }
-      else
-      {
-        QLOG_ERROR() << "doEnableScreensaver : Error while calling UnInhibit:"
-                     << reply.error().message();
-      } 
-    }
-    else
-    {
-      QLOG_ERROR() << "doEnableScreensaver : failed to retrieve interface.";
-    }
+    QLOG_ERROR() << "doEnableScreensaver : could not find session bus";
+    return;
   }
-  else
+
+  QDBusPendingCall call = asyncCall(QDBusConnection::sessionBus(), DBUS_SCREENSAVER_SERVICE_NAME,
+                                    DBUS_SCREENSAVER_SERVICE_PATH, DBUS_SCREENSAVER_INTERFACE, "UnInhibit",
+                                    QVariantList{ screensaver_inhibit_cookie });
+  screensaver_inhibit_cookie = 0;
+
+  auto watcher = new QDBusPendingCallWatcher(call, this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [=](QDBusPendingCallWatcher* finished)
   {
-    QLOG_ERROR() << "doEnableScreensaver : could not find system bus";
-  }
-}
+    QDBusPendingReply<> reply = *finished;
+    finished->deleteLater();
 
+    if (reply.isError())
+      QLOG_ERROR() << "doEnableScreensaver : Error while calling UnInhibit:" << reply.error().message();
+  });
+}
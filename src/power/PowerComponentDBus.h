@@ -1,38 +1,68 @@
 #ifndef POWERCOMPONENTDBUS_H
 #define POWERCOMPONENTDBUS_H
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusPendingCall>
+
 #include "PowerComponent.h"
 
+class QDBusServiceWatcher;
+
+// how long the Can* answers of logind are used before asking again, they depend on polkit
+#define DBUS_CAPABILITIES_MAX_AGE_MSEC (60 * 1000)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Power management through logind and the screensaver through org.freedesktop.ScreenSaver.
+// All calls are asynchronous messages, there are no QDBusInterface objects, which would
+// introspect the service (blocking) when they're created. The capabilities are answered
+// from a cache, which is refreshed in the background when it's older than
+// DBUS_CAPABILITIES_MAX_AGE_MSEC and when logind (re)appears on the bus.
+//
+// CEC asks for the capabilities and suspends from its own thread. The calls and their
+// watchers belong to the main thread, so they are posted there, and only the cached
+// capabilities are read elsewhere.
+//
 class PowerComponentDBus : public PowerComponent
 {
+  Q_OBJECT
   public:
-    PowerComponentDBus() : PowerComponent(0) {};
+    PowerComponentDBus();
     ~PowerComponentDBus() {};
 
+    bool componentInitialize() override;
+
   public Q_SLOTS:
 
-  virtual int getPowerCapabilities() override
-  {
-    int flags = 0;
-    if (isPowerMethodAvailable("CanPowerOff"))
-      flags |= CAP_POWER_OFF;
-    if (isPowerMethodAvailable("CanReboot"))
-      flags |= CAP_REBOOT;
-    if (isPowerMethodAvailable("CanSuspend"))
-      flags |= CAP_SUSPEND;
-    return flags;
-  }
+    virtual int getPowerCapabilities() override;
 
+    // These return once the call was sent, errors are only logged.
     virtual bool PowerOff() { return callPowerMethod("PowerOff"); }
     virtual bool Reboot() { return callPowerMethod("Reboot"); }
     virtual bool Suspend() { return callPowerMethod("Suspend"); }
 
+  private Q_SLOTS:
+    bool callPowerMethod(const QString& method);
+    void refreshStaleCapabilities();
+
   private:
-    bool callPowerMethod(QString method);
-    bool isPowerMethodAvailable(QString method);
+    QDBusPendingCall asyncCall(const QDBusConnection& bus, const QString& service, const QString& path,
+                               const QString& interface, const QString& method,
+                               const QVariantList& arguments = QVariantList());
+    void refreshCapabilities();
+    void refreshCapability(const QString& method, int capability);
+
+    QAtomicInt m_capabilities;
+    QElapsedTimer m_capabilitiesAge;
+    QDBusServiceWatcher* m_loginWatcher;
 
     unsigned int screensaver_inhibit_cookie = 0;
-  
+    // Inhibit was sent, but didn't answer yet
+    bool m_inhibitPending;
+    // what doDisableScreensaver()/doEnableScreensaver() asked for last
+    bool m_inhibitWanted;
+
   protected:
     virtual void doDisableScreensaver();
     virtual void doEnableScreensaver();
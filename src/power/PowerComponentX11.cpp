@@ -3,12 +3,43 @@
 #include "PowerComponentX11.h"
 #include "QsLog.h"
 
+#if defined(HAVE_XSS) && defined(USE_X11EXTRAS)
+#include <QX11Info>
+#include <X11/extensions/scrnsaver.h>
+#define USE_XSS 1
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 PowerComponentX11::PowerComponentX11() : PowerComponent(0)
 {
   m_timer = new QTimer(this);
   connect(m_timer, &QTimer::timeout, this, &PowerComponentX11::onTimer);
   m_timer->setInterval(15 * 1000);
+  // the screensaver times out after minutes, a second either way doesn't matter
+  m_timer->setTimerType(Qt::VeryCoarseTimer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool PowerComponentX11::suspendScreensaver(bool suspend)
+{
+#ifdef USE_XSS
+  if (!QX11Info::isPlatformX11())
+    return false;
+
+  Display* display = QX11Info::display();
+  int eventBase, errorBase, major, minor;
+  if (!display || !XScreenSaverQueryExtension(display, &eventBase, &errorBase) ||
+      !XScreenSaverQueryVersion(display, &major, &minor) || major < 1 || (major == 1 && minor < 1))
+    return false;
+
+  // This also keeps DPMS from blanking the screen, until we unsuspend again.
+  XScreenSaverSuspend(display, suspend ? True : False);
+  XFlush(display);
+  return true;
+#else
+  Q_UNUSED(suspend);
+  return false;
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -45,11 +76,23 @@ void PowerComponentX11::onProcessError(QProcess::ProcessError error)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PowerComponentX11::doDisableScreensaver()
 {
+  // Suspending through the X server also holds off DPMS. Desktop lockers (GNOME,
+  // light-locker, KDE) keep their own idle time and don't look at it, so they are
+  // still reset through xdg-screensaver, which knows how to reach each of them.
+  if (!m_suspended)
+    m_suspended = suspendScreensaver(true);
+
   m_timer->start();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void PowerComponentX11::doEnableScreensaver()
 {
+  if (m_suspended)
+  {
+    suspendScreensaver(false);
+    m_suspended = false;
+  }
+
   m_timer->stop();
 }
@@ -23,7 +23,12 @@ private slots:
   void onProcessError(QProcess::ProcessError error);
 
 private:
+  // Returns false if the X server can't do it, then only xdg-screensaver is left.
+  bool suspendScreensaver(bool suspend);
+
   bool m_broken = false;
+  // suspended through the X screensaver extension
+  bool m_suspended = false;
   QTimer* m_timer = 0;
   QProcess* m_process = 0;
 };
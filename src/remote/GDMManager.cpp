@@ -7,6 +7,8 @@
 #include "QsLog.h"
 #include "RemoteComponent.h"
 
+#define GDM_MULTICAST_ADDRESS "239.0.0.250"
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 GDMManager::GDMManager(QObject *parent) : QObject(parent), m_port(-1)
 {
@@ -29,12 +31,24 @@ void GDMManager::startListener()
 {
   m_socket.bind(QHostAddress::AnyIPv4, 32412, QUdpSocket::ReuseAddressHint | QUdpSocket::ShareAddress);
 
-  QHostAddress multicast("239.0.0.250");
-  m_socket.joinMulticastGroup(multicast);
+  m_socket.joinMulticastGroup(QHostAddress(GDM_MULTICAST_ADDRESS));
 
   connect(&m_socket, &QUdpSocket::readyRead, this, &GDMManager::readData);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GDMManager::rejoinMulticast()
+{
+  if (m_socket.state() != QAbstractSocket::BoundState)
+    return;
+
+  // leaving fails if the interface we joined on is gone, which is fine
+  QHostAddress multicast(GDM_MULTICAST_ADDRESS);
+  m_socket.leaveMulticastGroup(multicast);
+  if (!m_socket.joinMulticastGroup(multicast))
+    QLOG_WARN() << "Failed to rejoin the GDM multicast group:" << m_socket.errorString();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void GDMManager::readData()
 {
@@ -54,14 +68,18 @@ void GDMManager::readData()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void GDMManager::parseData(const QByteArray& data, const QHostAddress& sender, quint16 port)
 {
-  if (data.startsWith("M-SEARCH *"))
+  if (data.startsWith("M-SEARCH *") && m_throttle.allow(sender, port, data))
     m_socket.writeDatagram(getPacket(), sender, port);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-QByteArray GDMManager::getPacket()
+const QByteArray& GDMManager::getPacket()
 {
-  QByteArray packetData;
+  // discovery requests often come in bursts, so the reply is only built once
+  if (!m_packet.isEmpty())
+    return m_packet;
+
+  QByteArray& packetData = m_packet;
 
   // Header
   packetData.append("HTTP/1.0 200 OK\r\n");
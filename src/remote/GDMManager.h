@@ -7,6 +7,8 @@
 #include <qhostaddress.h>
 #include <qglobal.h>
 
+#include "utils/DiscoveryThrottle.h"
+
 class GDMManager : public QObject
 {
   Q_OBJECT
@@ -16,15 +18,23 @@ public:
   void startAnnouncing();
   void stopAnnouncing();
 
+  // Drop the cached reply packet, it's rebuilt on the next search.
+  void invalidatePacket() { m_packet.clear(); }
+
+  // The group membership is per interface, so it has to be renewed when the network changes.
+  void rejoinMulticast();
+
 private:
   void startListener();
   void parseData(const QByteArray& data, const QHostAddress& sender, quint16 port);
   void readData();
 
-  QByteArray getPacket();
+  const QByteArray& getPacket();
 
   QUdpSocket m_socket;
   qint32 m_port;
+  QByteArray m_packet;
+  DiscoveryThrottle m_throttle;
 };
 
 #endif // GDMANNOUNCER_H
@@ -6,11 +6,18 @@
 
 #include <QXmlStreamWriter>
 #include <QUrlQuery>
+#include <QTextStream>
+#include <QRunnable>
 
 #include "QsLog.h"
 #include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
+#include "settings/SettingsKey.h"
 #include "utils/Utils.h"
+#include "utils/NetworkState.h"
+#include "utils/Trace.h"
 #include "Version.h"
+#include "utils/AllocationTracker.h"
 
 static QMap<QString, QString> g_resourceKeyMap = {
   { "Name", "title" },
@@ -29,11 +36,38 @@ static QMap<QString, QString> g_headerKeyMap = {
   { "Version", "X-Plex-Version" }
 };
 
+// each of these replaces what the one before it did, so only the newest has to get to web
+static const QSet<QString> g_coalescedCommands = {
+  "/player/playback/setParameters",
+  "/player/playback/seekTo"
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////
-RemoteComponent::RemoteComponent(QObject* parent) : ComponentBase(parent), m_commandId(0)
+RemoteComponent::RemoteComponent(QObject* parent) : ComponentBase(parent), m_commandId(0), m_pendingCommandID(0),
+  m_timelineBusy(false), m_processingCommandID(0), m_sentCommandID(0),
+  m_subscribers(std::make_shared<const SubscriberMap>()),
+  m_expiryWheel(SUBSCRIBER_WHEEL_SLOTS), m_wheelPosition(0)
 {
   m_gdmManager = new GDMManager(this);
-  m_networkAccessManager = new QNetworkAccessManager(this);
+  m_commandClock.start();
+
+  // one timeline at a time, they have to be compared to the one before
+  m_timelinePool.setMaxThreadCount(1);
+
+  // Set up here and not in componentInitialize(): the component is deferred, but exported
+  // right away, and the calls that start these can come before it's initialized.
+  //
+  // check for timed out subscribers, only while there are some. The wheel is a tick
+  // off anyway, so the wakeups can be merged with others in the same second.
+  m_subscriberTimer.setInterval(SUBSCRIBER_WHEEL_TICK_MSEC);
+  m_subscriberTimer.setTimerType(Qt::VeryCoarseTimer);
+  connect(&m_subscriberTimer, &QTimer::timeout, this, &RemoteComponent::checkSubscribers);
+
+  connect(&m_timelineTimer, &QTimer::timeout, this, &RemoteComponent::flushTimeline);
+
+  // commands web doesn't answer are timed out, this only runs while there are some
+  m_commandTimer.setInterval(1000);
+  connect(&m_commandTimer, &QTimer::timeout, this, &RemoteComponent::checkCommands);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -41,13 +75,17 @@ bool RemoteComponent::componentInitialize()
 {
   m_gdmManager->startAnnouncing();
 
-  // check for timed out subscribers
-  m_subscriberTimer.setInterval(5000);
-  connect(&m_subscriberTimer, &QTimer::timeout, this, &RemoteComponent::checkSubscribers);
-  m_subscriberTimer.start();
+  // the cached headers depend on these
+  for (const QString& section : { SETTINGS_SECTION_MAIN, SETTINGS_SECTION_WEBCLIENT, SETTINGS_SECTION_SYSTEM })
+  {
+    SettingsSection* settings = SettingsComponent::Get().getSection(section);
+    if (settings)
+      connect(settings, &SettingsSection::valuesUpdated, this, &RemoteComponent::invalidateHeaders);
+  }
 
-  // connect the network access stuff
-  connect(m_networkAccessManager, &QNetworkAccessManager::finished, this, &RemoteComponent::timelineFinished);
+  // and the host name might change with the network
+  connect(&NetworkState::Get(), &NetworkState::addressesChanged, this, &RemoteComponent::invalidateHeaders);
+  connect(&NetworkState::Get(), &NetworkState::addressesChanged, m_gdmManager, &GDMManager::rejoinMulticast);
 
   return true;
 }
@@ -70,6 +108,50 @@ QVariantMap RemoteComponent::HeaderInformation()
   return headerInfo;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+const QList<QPair<QByteArray, QByteArray>>& RemoteComponent::timelineHeaders()
+{
+  if (m_timelineHeaders.isEmpty())
+  {
+    QVariantMap headers = HeaderInformation();
+    for (const QString& key : headers.keys())
+      m_timelineHeaders.append(qMakePair(key.toUtf8(), headers[key].toString().toUtf8()));
+  }
+
+  return m_timelineHeaders;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+const QByteArray& RemoteComponent::resourceResponse()
+{
+  if (m_resourceResponse.isEmpty())
+  {
+    QVariantMap headers = ResourceInformation();
+
+    QXmlStreamWriter output(&m_resourceResponse);
+    output.setAutoFormatting(true);
+    output.writeStartDocument();
+    output.writeStartElement("MediaContainer");
+    output.writeStartElement("Player");
+
+    for(const QString& key : headers.keys())
+      output.writeAttribute(key, headers[key].toString());
+
+    output.writeEndElement();
+    output.writeEndDocument();
+  }
+
+  return m_resourceResponse;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void RemoteComponent::invalidateHeaders()
+{
+  m_timelineHeaders.clear();
+  m_resourceResponse.clear();
+  m_gdmManager->invalidatePacket();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 QVariantMap RemoteComponent::ResourceInformation()
 {
@@ -146,23 +228,8 @@ void RemoteComponent::handleResource(QHttpRequest* request, QHttpResponse* respo
 {
   if (request->method() == qhttp::EHTTP_GET)
   {
-    QVariantMap headers = ResourceInformation();
-
-    QByteArray outputData;
-    QXmlStreamWriter output(&outputData);
-    output.setAutoFormatting(true);
-    output.writeStartDocument();
-    output.writeStartElement("MediaContainer");
-    output.writeStartElement("Player");
-
-    for(const QString& key : headers.keys())
-      output.writeAttribute(key, headers[key].toString());
-
-    output.writeEndElement();
-    output.writeEndDocument();
-
     response->setStatusCode(qhttp::ESTATUS_OK);
-    response->write(outputData);
+    response->write(resourceResponse());
     response->end();
   }
   else
@@ -222,27 +289,27 @@ QVariantMap RemoteComponent::HeaderToMap(const qhttp::THeaderHash& hash, const Q
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteComponent::handleCommand(QHttpRequest* request, QHttpResponse* response)
+void RemoteComponent::handleCommand(QHttpRequest* httpRequest, QHttpResponse* response)
 {
-
-  QVariantMap queryMap = QueryToMap(request->url());
-  QVariantMap headerMap = HeaderToMap(request->headers());
-  QString identifier = headerMap["x-plex-client-identifier"].toString();
+  ALLOCATION_TAG(Remote);
+  // only what is forwarded to web is converted into maps
+  RemoteRequest request(httpRequest);
+  QString identifier = request.header("x-plex-client-identifier");
 
   response->addHeader("Access-Control-Allow-Origin", "*");
   response->addHeader("X-Plex-Client-Identifier",  SettingsComponent::Get().value(SETTINGS_SECTION_WEBCLIENT, "clientID").toByteArray());
 
   // handle CORS requests here
-  if ((request->method() == qhttp::EHTTP_OPTIONS) && headerMap.contains("access-control-request-method"))
+  if ((httpRequest->method() == qhttp::EHTTP_OPTIONS) && request.hasHeader("access-control-request-method"))
   {    
     response->addHeader("Content-Type", "text/plain");
     response->addHeader("Access-Control-Allow-Methods", "POST, GET, OPTIONS, DELETE, PUT, HEAD");
     response->addHeader("Access-Control-Max-Age", "1209600");
     response->addHeader("Connection", "close");
 
-    if (headerMap.contains("access-control-request-headers"))
+    if (request.hasHeader("access-control-request-headers"))
     {
-      response->addHeader("Access-Control-Allow-Headers", headerMap.value("access-control-request-headers").toByteArray());
+      response->addHeader("Access-Control-Allow-Headers", request.header("access-control-request-headers"));
     }
 
     response->setStatusCode(qhttp::ESTATUS_OK);
@@ -253,43 +320,45 @@ void RemoteComponent::handleCommand(QHttpRequest* request, QHttpResponse* respon
   // we want to handle the subscription events in the host
   // since we are going to handle the updating later.
   //
-  if (request->url().path() == "/player/timeline/subscribe")
+  QString path = request.path();
+  if (path == "/player/timeline/subscribe")
   {
     handleSubscription(request, response, false);
     return;
   }
-  else if (request->url().path() == "/player/timeline/unsubscribe")
+  else if (path == "/player/timeline/unsubscribe")
   {
-    subscriberRemove(request->headers()["x-plex-client-identifier"]);
+    subscriberRemove(identifier);
     response->setStatusCode(qhttp::ESTATUS_OK);
     response->end();
     return;
   }
-  else if ((request->url().path() == "/player/timeline/poll"))
+  else if (path == "/player/timeline/poll")
   {
-    QMutexLocker lk(&m_subscriberLock);
-    if (!m_subscriberMap.contains(identifier))
-    {
-      lk.unlock();
+    if (!subscribers()->contains(identifier))
       handleSubscription(request, response, true);
-      lk.relock();
-    }
 
-    if (!m_subscriberMap.contains(identifier))
+    RemotePollSubscriber *subscriber = dynamic_cast<RemotePollSubscriber *>(subscribers()->value(identifier));
+    if (!subscriber)
       return;
 
-    RemotePollSubscriber *subscriber = dynamic_cast<RemotePollSubscriber *>(m_subscriberMap[identifier]);
-    if (subscriber)
     {
-      subscriber->reSubscribe();
-      subscriber->setHTTPResponse(response);
+      // it might have been removed since we took the snapshot
+      QMutexLocker lk(&m_subscriberLock);
+      if (subscribers()->value(identifier) != subscriber)
+        return;
+      touchSubscriber(subscriber);
+    }
 
-      // if we don't have to wait, just ship the update right away
-      // otherwise, this will wait until next update
-      if (! (queryMap.contains("wait") && (queryMap["wait"].toList()[0].toInt() == 1)))
-      {
-        subscriber->sendUpdate();
-      }
+    // the response is written without the lock, subscribers are only ever
+    // deleted later from the event loop so the pointer stays valid
+    subscriber->setHTTPResponse(response);
+
+    // if we don't have to wait, just ship the update right away
+    // otherwise, this will wait until next update
+    if (request.queryInt("wait") != 1)
+    {
+      subscriber->sendUpdate();
     }
 
     return;
@@ -297,7 +366,7 @@ void RemoteComponent::handleCommand(QHttpRequest* request, QHttpResponse* respon
 
 
   // handle commandID
-  if (!headerMap.contains("x-plex-client-identifier") || !queryMap.contains("commandID"))
+  if (!request.hasHeader("x-plex-client-identifier") || !request.hasQuery("commandID"))
   {
     QLOG_WARN() << "Can't find a X-Plex-Client-Identifier header";
     response->setStatusCode(qhttp::ESTATUS_NOT_ACCEPTABLE);
@@ -305,62 +374,146 @@ void RemoteComponent::handleCommand(QHttpRequest* request, QHttpResponse* respon
     return;
   }
 
-  quint64 commandId = 0;
+  RemoteSubscriber* subscriber = subscribers()->value(identifier);
+  if (!subscriber)
   {
-    QMutexLocker lk(&m_responseLock);
-    commandId = ++m_commandId;
-    m_responseMap[commandId] = response;
-
-    connect(response, &QHttpResponse::done, this, &RemoteComponent::responseDone);
+    QLOG_WARN() << "Failed to lock up subscriber" << identifier;
+    response->setStatusCode(qhttp::ESTATUS_NOT_ACCEPTABLE);
+    response->end();
+    return;
   }
 
+  // commands of the same kind from the same controller, with the same arguments
+  QString key;
+  if (g_coalescedCommands.contains(path))
+    key = identifier + ":" + path + "?" + request.queryKeys().join(',');
+
+  quint64 commandId = 0;
+  QVariantMap arg;
+  QHttpResponse* superseded = nullptr;
+  bool send = true;
   {
-    QMutexLocker lk(&m_subscriberLock);
-    if (!m_subscriberMap.contains(identifier))
+    QMutexLocker lk(&m_responseLock);
+    if (m_responseMap.size() >= REMOTE_MAX_PENDING_COMMANDS)
     {
-      QLOG_WARN() << "Failed to lock up subscriber" << identifier;
-      response->setStatusCode(qhttp::ESTATUS_NOT_ACCEPTABLE);
+      lk.unlock();
+      QLOG_WARN() << "Too many commands waiting for web, rejecting" << path;
+      response->setStatusCode(qhttp::ESTATUS_SERVICE_UNAVAILABLE);
       response->end();
       return;
     }
 
-    RemoteSubscriber* subscriber = m_subscriberMap[identifier];
-    subscriber->setCommandId(m_commandId, queryMap["commandID"].toList()[0].toInt());
+    commandId = ++m_commandId;
+    arg = {
+      { "method", httpRequest->methodString() },
+      { "headers", request.headerMap() },
+      { "path", path },
+      { "query", request.queryMap() },
+      { "commandID", commandId }
+    };
+
+    if (!key.isEmpty() && m_sentCommands.contains(key))
+    {
+      // web is still busy with the last one, this one replaces whatever waited behind it
+      quint64 queued = m_queuedCommands.value(key);
+      if (queued)
+        superseded = m_responseMap.take(queued).response;
+      if (superseded)
+        QLOG_DEBUG() << "Dropping command" << queued << "for a newer one";
+      m_queuedCommands[key] = commandId;
+      send = false;
+    }
+    else if (!key.isEmpty())
+    {
+      m_sentCommands[key] = commandId;
+    }
+
+    m_responseMap[commandId] = { response, key, m_commandClock.elapsed(), send ? QVariantMap() : arg };
   }
 
-  QVariantMap arg = {
-    { "method", request->methodString() },
-    { "headers", headerMap },
-    { "path", request->url().path() },
-    { "query", queryMap },
-    { "commandID", m_commandId}
-  };
+  // the response goes away without done when the controller hangs up
+  connect(response, &QHttpResponse::done, this, [=]() { finishCommand(commandId); });
+  connect(response, &QObject::destroyed, this, [=]() { finishCommand(commandId); });
 
-  emit commandReceived(arg);
+  if (!m_commandTimer.isActive())
+    m_commandTimer.start();
+
+  subscriber->setCommandId(commandId, request.queryInt("commandID"));
+
+  if (superseded)
+  {
+    superseded->setStatusCode(qhttp::ESTATUS_OK);
+    superseded->end();
+  }
+
+  if (send)
+    emit commandReceived(arg);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteComponent::responseDone()
+void RemoteComponent::finishCommand(quint64 commandId)
 {
-  QHttpResponse* response = dynamic_cast<QHttpResponse*>(sender());
-  if (response)
+  QVariantMap next;
   {
     QMutexLocker lk(&m_responseLock);
+    auto it = m_responseMap.find(commandId);
+    if (it == m_responseMap.end())
+      return;
+
+    QString key = it->key;
+    m_responseMap.erase(it);
 
-    bool found = false;
-    quint64 foundId = 0;
-    for(auto responseId : m_responseMap.keys())
+    if (!key.isEmpty() && m_sentCommands.value(key) == commandId)
     {
-      if (m_responseMap[responseId] == response)
+      m_sentCommands.remove(key);
+
+      // web is free for the newest one that came in meanwhile
+      quint64 queued = m_queuedCommands.take(key);
+      auto queuedIt = m_responseMap.find(queued);
+      if (queuedIt != m_responseMap.end())
       {
-        foundId = responseId;
-        found = true;
-        break;
+        m_sentCommands[key] = queued;
+        next.swap(queuedIt->arg);
       }
     }
+    else if (!key.isEmpty() && m_queuedCommands.value(key) == commandId)
+    {
+      m_queuedCommands.remove(key);
+    }
+  }
+
+  if (!next.isEmpty())
+    emit commandReceived(next);
+}
 
-    if (found)
-      m_responseMap.remove(foundId);
+/////////////////////////////////////////////////////////////////////////////////////////
+void RemoteComponent::checkCommands()
+{
+  QList<QHttpResponse*> expired;
+  {
+    QMutexLocker lk(&m_responseLock);
+    if (m_responseMap.isEmpty())
+    {
+      m_commandTimer.stop();
+      return;
+    }
+
+    // the map is ordered by command id, which is the order they came in
+    qint64 now = m_commandClock.elapsed();
+    for (auto it = m_responseMap.constBegin(); it != m_responseMap.constEnd(); ++it)
+    {
+      if (now - it->started < REMOTE_COMMAND_TIMEOUT_MSEC)
+        break;
+      expired << it->response;
+    }
+  }
+
+  // ending them removes them from the map
+  for (QHttpResponse* response : expired)
+  {
+    QLOG_WARN() << "Web didn't answer a command in time";
+    response->setStatusCode(qhttp::ESTATUS_GATEWAY_TIMEOUT);
+    response->end();
   }
 }
 
@@ -385,7 +538,7 @@ void RemoteComponent::commandResponse(const QVariantMap& responseArguments)
     return;
   }
 
-  QHttpResponse* response = m_responseMap[commandId];
+  QHttpResponse* response = m_responseMap[commandId].response;
 
   // no need to hold the lock when we have changed m_responseMap
   lk.unlock();
@@ -409,13 +562,11 @@ void RemoteComponent::commandResponse(const QVariantMap& responseArguments)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteComponent::handleSubscription(QHttpRequest* request, QHttpResponse* response, bool poll)
+void RemoteComponent::handleSubscription(const RemoteRequest& request, QHttpResponse* response, bool poll)
 {
-  QVariantMap headers = HeaderToMap(request->headers(), &request->url());
-
   // check for required headers
-  if (!headers.contains("x-plex-client-identifier") ||
-      (!headers.contains("x-plex-device-name")))
+  if (!request.hasPlexValue("x-plex-client-identifier") ||
+      (!request.hasPlexValue("x-plex-device-name")))
   {
     QLOG_ERROR() << "Missing X-Plex headers in /timeline/subscribe request";
     response->setStatusCode(qhttp::ESTATUS_BAD_REQUEST);
@@ -424,9 +575,7 @@ void RemoteComponent::handleSubscription(QHttpRequest* request, QHttpResponse* r
   }
 
   // check for required arguments
-  QVariantMap query = QueryToMap(request->url());
-
-  if (!query.contains("commandID") || ((!query.contains("port")) && !poll))
+  if (!request.hasQuery("commandID") || ((!request.hasQuery("port")) && !poll))
   {
     QLOG_ERROR() << "Missing arguments to /timeline/subscribe request";
     response->setStatusCode(qhttp::ESTATUS_BAD_REQUEST);
@@ -434,49 +583,59 @@ void RemoteComponent::handleSubscription(QHttpRequest* request, QHttpResponse* r
     return;
   }
 
-  QString clientIdentifier(request->headers()["x-plex-client-identifier"]);
+  QString clientIdentifier(request.header("x-plex-client-identifier"));
+  QString deviceName(request.header("x-plex-device-name"));
 
   QMutexLocker lk(&m_subscriberLock);
-  RemoteSubscriber* subscriber = nullptr;
+  SubscriberMap subscriberMap(*subscribers());
+  RemoteSubscriber* subscriber = subscriberMap.value(clientIdentifier);
 
-  if (m_subscriberMap.contains(clientIdentifier))
+  if (subscriber)
   {
     QLOG_DEBUG() << "Refreshed subscriber:" << clientIdentifier;
-    subscriber = m_subscriberMap[clientIdentifier];
-    subscriber->reSubscribe();
+    touchSubscriber(subscriber);
   }
   else
   {
     if (poll)
     {
-      QLOG_DEBUG() << "New poll subscriber:" << clientIdentifier << request->headers()["x-plex-device-name"];
-      subscriber = new RemotePollSubscriber(clientIdentifier, request->headers()["x-plex-device-name"], response, this);
+      QLOG_DEBUG() << "New poll subscriber:" << clientIdentifier << deviceName;
+      subscriber = new RemotePollSubscriber(clientIdentifier, deviceName, response, this);
     }
     else
     {
       QUrl address;
-      QString protocol = query.contains("protocol") ? query["protocol"].toList()[0].toString() : "http";
-      int port = query.contains("port") ? query["port"].toList()[0].toInt() : 32400;
+      QString protocol = request.query("protocol", "http");
+      int port = request.queryInt("port", 32400);
 
       address.setScheme(protocol);
-      address.setHost(request->remoteAddress());
+      address.setHost(request.request()->remoteAddress());
       address.setPort(port);
 
-      QLOG_DEBUG() << "New subscriber:" << clientIdentifier << request->headers()["x-plex-device-name"] << address.toString();
-      subscriber = new RemoteSubscriber(clientIdentifier, request->headers()["x-plex-device-name"], address, this);
+      QLOG_DEBUG() << "New subscriber:" << clientIdentifier << deviceName << address.toString();
+      subscriber = new RemoteSubscriber(clientIdentifier, deviceName, address, this);
     }
 
-    m_subscriberMap[clientIdentifier] = subscriber;
+    subscriberMap[clientIdentifier] = subscriber;
+    publishSubscribers(subscriberMap);
+    touchSubscriber(subscriber);
 
     // if it's our first controller, we notify web for subscription
-    if (m_subscriberMap.size() == 1)
+    if (subscriberMap.size() == 1)
     {
       QLOG_DEBUG() << "First subscriber added, subscribing to web";
       subscribeToWeb(true);
     }
   }
 
-  subscriber->setCommandId(m_commandId, query["commandID"].toList()[0].toInt());
+  subscriber->setCommandId(m_commandId, request.queryInt("commandID"));
+
+  // timelines are only pushed when they change, so give subscribers the
+  // current one instead of making them wait for the next change
+  if (!m_sentTemplate.isNull())
+    subscriber->queueTimeline(m_sentCommandID, m_sentTemplate);
+
+  lk.unlock();
 
   if (!poll)
   {
@@ -500,87 +659,248 @@ void RemoteComponent::subscribeToWeb(bool subscribe)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteComponent::checkSubscribers()
+void RemoteComponent::publishSubscribers(const SubscriberMap& subscribers)
 {
-  QMutexLocker lk(&m_subscriberLock);
-  QList<RemoteSubscriber*> subsToRemove;
-  for(RemoteSubscriber* subscriber : m_subscriberMap.values())
+  std::atomic_store(&m_subscribers, std::make_shared<const SubscriberMap>(subscribers));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString RemoteComponent::diagnosticsInformation()
+{
+  QString text;
+  QTextStream info(&text);
+
+  SubscriberSnapshot snapshot = subscribers();
+  info << "Remote" << endl;
+  info << "  Subscribers: " << snapshot->size() << endl;
+  for (RemoteSubscriber* subscriber : *snapshot)
   {
-    // was it more than 10 seconds since this client checked in last?
-    if (subscriber->lastSubscribe() > 90 * 1000)
-    {
-      QLOG_DEBUG() << "more than 10 seconds since we heard from:" << subscriber->deviceName() << "- unsubscribing..";
-      subsToRemove << subscriber;
-    }
+    info << "    " << subscriber->deviceName()
+         << (dynamic_cast<RemotePollSubscriber*>(subscriber) ? " (poll)" : " (http)")
+         << ", subscribed " << subscriber->lastSubscribe() / 1000 << "s ago" << endl;
   }
 
-  lk.unlock();
+  {
+    QMutexLocker lock(&m_responseLock);
+    info << "  Pending commands: " << m_responseMap.size() << endl;
+  }
+  info << endl;
 
-  for(RemoteSubscriber* sub : subsToRemove)
-    subscriberRemove(sub->clientIdentifier());
+  info << flush;
+  return text;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-QNetworkAccessManager* RemoteComponent::getNetworkAccessManager()
+void RemoteComponent::touchSubscriber(RemoteSubscriber* subscriber)
 {
-  // we might want to set common options here.
-  return m_networkAccessManager;
-}
+  subscriber->reSubscribe();
+
+  auto it = m_expirySlot.find(subscriber);
+  if (it != m_expirySlot.end())
+    m_expiryWheel[it.value()].remove(subscriber);
 
+  // the slot we are at right now was just checked, so the one before it is
+  // the last one to come around
+  int slot = (m_wheelPosition + SUBSCRIBER_WHEEL_SLOTS - 1) % SUBSCRIBER_WHEEL_SLOTS;
+  m_expiryWheel[slot].insert(subscriber);
+  m_expirySlot[subscriber] = slot;
+
+  if (!m_subscriberTimer.isActive())
+    m_subscriberTimer.start();
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteComponent::timelineFinished(QNetworkReply* reply)
+void RemoteComponent::checkSubscribers()
 {
-  QString identifier = reply->request().attribute(QNetworkRequest::User).toString();
+  QMutexLocker lk(&m_subscriberLock);
 
-  // ignore requests with no identifier
-  if (identifier.isEmpty())
-    return;
+  m_wheelPosition = (m_wheelPosition + 1) % SUBSCRIBER_WHEEL_SLOTS;
+  QSet<RemoteSubscriber*> expiring;
+  expiring.swap(m_expiryWheel[m_wheelPosition]);
 
-  QMutexLocker lk(&m_subscriberLock);
-  if (!m_subscriberMap.contains(identifier))
+  QStringList subsToRemove;
+  for(RemoteSubscriber* subscriber : expiring)
   {
-    QLOG_WARN() << "Got a networkreply with a identifier we don't know about:" << identifier;
-    return;
+    // the wheel is only accurate to a tick, keep it around until it really expired
+    if (subscriber->lastSubscribe() > SUBSCRIBER_EXPIRY_MSEC)
+    {
+      QLOG_DEBUG() << "more than" << SUBSCRIBER_EXPIRY_MSEC / 1000 << "seconds since we heard from:" << subscriber->deviceName() << "- unsubscribing..";
+      subsToRemove << subscriber->clientIdentifier();
+    }
+    else
+    {
+      int slot = (m_wheelPosition + 1) % SUBSCRIBER_WHEEL_SLOTS;
+      m_expiryWheel[slot].insert(subscriber);
+      m_expirySlot[subscriber] = slot;
+    }
   }
 
-  RemoteSubscriber* sub = m_subscriberMap[identifier];
-  lk.unlock();
+  // all of them go in one swap of the snapshot, and web hears about it once at most
+  if (!subsToRemove.isEmpty())
+    removeSubscribers(subsToRemove);
 
-  sub->timelineFinished(reply);
+  // the next subscriber starts it again
+  if (m_expirySlot.isEmpty())
+    m_subscriberTimer.stop();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void RemoteComponent::subscriberRemove(const QString& identifier)
 {
   QMutexLocker lk(&m_subscriberLock);
-  if (!m_subscriberMap.contains(identifier))
+  removeSubscribers({ identifier });
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void RemoteComponent::removeSubscribers(const QStringList& identifiers)
+{
+  SubscriberMap subscriberMap(*subscribers());
+  bool hadSubscribers = !subscriberMap.isEmpty();
+  int removed = 0;
+
+  for (const QString& identifier : identifiers)
   {
-    QLOG_ERROR() << "Can't remove client:" << identifier << "since we don't know about it.";
-    return;
+    RemoteSubscriber* subscriber = subscriberMap.take(identifier);
+    if (!subscriber)
+    {
+      QLOG_ERROR() << "Can't remove client:" << identifier << "since we don't know about it.";
+      continue;
+    }
+
+    int slot = m_expirySlot.take(subscriber);
+    m_expiryWheel[slot].remove(subscriber);
+
+    subscriber->deleteLater();
+    removed++;
+    QLOG_DEBUG() << "Removed subscriber:" << identifier;
   }
 
-  RemoteSubscriber* subscriber = m_subscriberMap[identifier];
-  m_subscriberMap.remove(identifier);
-  subscriber->deleteLater();
+  if (!removed)
+    return;
+
+  publishSubscribers(subscriberMap);
 
-  // if it's our first controller, we notify web for subscription
-  if (m_subscriberMap.size() == 0)
+  // if it was our last controller, we notify web that nobody is listening
+  if (hadSubscribers && subscriberMap.isEmpty())
   {
     QLOG_DEBUG() << "Last subscriber removed, unsubscribing from web";
     subscribeToWeb(false);
   }
-  QLOG_DEBUG() << "Removed subscriber:" << identifier;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void RemoteComponent::timelineUpdate(quint64 commandID, const QString& timeline)
 {
-  QMutexLocker lk(&m_subscriberLock);
+  TRACE_SCOPE("remote", "timelineUpdate");
+  m_pendingCommandID = commandID;
+  m_pendingTimeline = timeline.toUtf8();
+
+  // the newest timeline supersedes anything still waiting, so just wait for the timer
+  if (m_timelineTimer.isActive())
+    return;
+
+  flushTimeline();
+
+  static SettingsKey<int> timelineUpdateRate(SETTINGS_SECTION_MAIN, "timelineUpdateRate");
+  int rate = timelineUpdateRate.value();
+  if (rate > 0)
+    m_timelineTimer.start(1000 / rate);
+}
 
-  for(RemoteSubscriber* subscriber : m_subscriberMap.values())
+/////////////////////////////////////////////////////////////////////////////////////////
+class TimelineProcessor : public QRunnable
+{
+public:
+  TimelineProcessor(RemoteComponent* component, const QByteArray& data, bool onlySignificant, qint64 sentElapsed)
+    : m_component(component), m_data(data), m_onlySignificant(onlySignificant), m_sentElapsed(sentElapsed) {}
+
+  void run() override
   {
-    subscriber->queueTimeline(commandID, timeline.toUtf8());
-    subscriber->sendUpdate();
+    // Parse and serialize once for everyone, every subscriber only inserts
+    // its own commandID. Web can send a lot of these while a controller is
+    // connected, so it's kept away from the GUI thread.
+    RemoteTimeline& timeline = m_component->m_timeline;
+    if (!timeline.parse(m_data))
+    {
+      QLOG_WARN() << "Failed to parse timeline data from player";
+      done(false);
+      return;
+    }
+
+    if (m_onlySignificant && !timeline.isSignificantChange(m_component->m_sentTimeline, m_sentElapsed))
+    {
+      done(false);
+      return;
+    }
+
+    m_component->m_sentTimeline = timeline;
+    done(true, timeline.serialize());
   }
+
+private:
+  void done(bool send, const TimelineTemplate& timeline = TimelineTemplate())
+  {
+    QMetaObject::invokeMethod(m_component, "timelineProcessed", Qt::QueuedConnection, Q_ARG(bool, send),
+                              Q_ARG(QByteArray, timeline.prefix), Q_ARG(QByteArray, timeline.suffix));
+  }
+
+  RemoteComponent* m_component;
+  QByteArray m_data;
+  bool m_onlySignificant;
+  qint64 m_sentElapsed;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void RemoteComponent::flushTimeline()
+{
+  if (m_pendingTimeline.isEmpty())
+  {
+    m_timelineTimer.stop();
+    return;
+  }
+
+  // the one that is still being worked on is sent first, this one waits for it
+  if (m_timelineBusy)
+    return;
+
+  // Only push right away if something else than the playback time changed,
+  // controllers can extrapolate that on their own for a while.
+  static SettingsKey<int> timelineHeartbeat(SETTINGS_SECTION_MAIN, "timelineHeartbeat");
+  int heartbeat = timelineHeartbeat.value();
+  qint64 sentElapsed = m_sentTime.isValid() ? m_sentTime.elapsed() : 0;
+  bool onlySignificant = heartbeat > 0 && m_sentTime.isValid() && sentElapsed < heartbeat &&
+                         m_pendingCommandID == m_sentCommandID;
+
+  m_timelineBusy = true;
+  m_processingCommandID = m_pendingCommandID;
+  m_timelinePool.start(new TimelineProcessor(this, m_pendingTimeline, onlySignificant, sentElapsed));
+  m_pendingTimeline.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void RemoteComponent::timelineProcessed(bool send, const QByteArray& prefix, const QByteArray& suffix)
+{
+  TRACE_SCOPE("remote", "timelineProcessed");
+  m_timelineBusy = false;
+
+  if (send)
+  {
+    m_sentTemplate.prefix = prefix;
+    m_sentTemplate.suffix = suffix;
+    m_sentCommandID = m_processingCommandID;
+    m_sentTime.start();
+
+    // Posting stays here, NetworkService is only used from the main thread. Fan out
+    // to the current snapshot, (un)subscribes only affect the next one.
+    SubscriberSnapshot snapshot = subscribers();
+    for(RemoteSubscriber* subscriber : *snapshot)
+    {
+      subscriber->queueTimeline(m_sentCommandID, m_sentTemplate);
+      subscriber->sendUpdate();
+    }
+  }
+
+  // a newer one came in meanwhile and no timer is left to pick it up
+  if (!m_pendingTimeline.isEmpty() && !m_timelineTimer.isActive())
+    flushTimeline();
 }
@@ -8,6 +8,13 @@
 #include <QJsonObject>
 #include <QMutex>
 #include <QTimer>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include <memory>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 
@@ -17,6 +24,18 @@
 #include "qhttpserverresponse.hpp"
 #include "qhttpserver.hpp"
 #include "RemoteSubscriber.h"
+#include "RemoteRequest.h"
+
+// subscribers that didn't check in for this long are removed
+#define SUBSCRIBER_EXPIRY_MSEC (90 * 1000)
+// granularity of the expiry wheel
+#define SUBSCRIBER_WHEEL_TICK_MSEC 5000
+#define SUBSCRIBER_WHEEL_SLOTS (SUBSCRIBER_EXPIRY_MSEC / SUBSCRIBER_WHEEL_TICK_MSEC + 1)
+
+// commands waiting for web beyond this are turned away
+#define REMOTE_MAX_PENDING_COMMANDS 64
+// and the controller isn't kept waiting for web longer than this
+#define REMOTE_COMMAND_TIMEOUT_MSEC (10 * 1000)
 
 class RemoteComponent : public ComponentBase
 {
@@ -24,9 +43,10 @@ class RemoteComponent : public ComponentBase
   DEFINE_SINGLETON(RemoteComponent);
 
 public:
-  QNetworkAccessManager* getNetworkAccessManager();
-
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings", "system" }; }
+  // GDM announcing can wait until the UI is up
+  bool componentDeferred() override { return true; }
   const char* componentName() override { return "remote"; }
   bool componentExport() override { return true; }
 
@@ -34,6 +54,13 @@ public:
   static QVariantMap GDMInformation();
   static QVariantMap HeaderInformation();
 
+  // HeaderInformation() converted to raw headers. This is cached, since it's
+  // needed for every timeline that is sent.
+  const QList<QPair<QByteArray, QByteArray>>& timelineHeaders();
+
+  // The /resources reply, serialized once and cached like the headers.
+  const QByteArray& resourceResponse();
+
   void handleResource(QHttpRequest* request, QHttpResponse* response);
   void handleCommand(QHttpRequest* request, QHttpResponse* response);
 
@@ -44,6 +71,9 @@ public:
   Q_INVOKABLE QVariantMap resourceInfo() { return ResourceInformation(); }
   Q_INVOKABLE void timelineUpdate(quint64 commandID, const QString& timeline);
 
+  // Subscribers and commands waiting for web, for diagnostics dumps.
+  QString diagnosticsInformation();
+
   void subscriberRemove(const QString& identifier);
 
 Q_SIGNALS:
@@ -51,24 +81,88 @@ Q_SIGNALS:
 
 private Q_SLOTS:
   void checkSubscribers();
-  void timelineFinished(QNetworkReply* reply);
-  void responseDone();
+  void checkCommands();
+  void flushTimeline();
+  void timelineProcessed(bool send, const QByteArray& prefix, const QByteArray& suffix);
+  void invalidateHeaders();
 
 private:
+  friend class TimelineProcessor;
+
   explicit RemoteComponent(QObject* parent = nullptr);
-  void handleSubscription(QHttpRequest * request, QHttpResponse * response, bool poll=false);
+  void handleSubscription(const RemoteRequest& request, QHttpResponse * response, bool poll=false);
   void subscribeToWeb(bool subscribe);
+  // (Re)start the expiry of a subscriber, m_subscriberLock must be held
+  void touchSubscriber(RemoteSubscriber* subscriber);
+  // Remove all of them with a single new snapshot, m_subscriberLock must be held
+  void removeSubscribers(const QStringList& identifiers);
+  // Forget a command that was answered or hung up on, and send web the one queued behind it
+  void finishCommand(quint64 commandId);
+
+  typedef QMap<QString, RemoteSubscriber*> SubscriberMap;
+  typedef std::shared_ptr<const SubscriberMap> SubscriberSnapshot;
+
+  // Readers never lock, they just hold on to the snapshot that was current
+  // when they started. Writers copy it under m_subscriberLock and swap in
+  // the new one.
+  SubscriberSnapshot subscribers() const { return std::atomic_load(&m_subscribers); }
+  void publishSubscribers(const SubscriberMap& subscribers);
 
   GDMManager* m_gdmManager;
 
+  struct PendingCommand
+  {
+    QHttpResponse* response = nullptr;
+    // set for commands that are coalesced
+    QString key;
+    qint64 started = 0;
+    // only kept while the command waits to be sent to web
+    QVariantMap arg;
+  };
+
   quint64 m_commandId;
-  QMap<quint64, QHttpResponse*> m_responseMap;
+  QMap<quint64, PendingCommand> m_responseMap;
   QMutex m_responseLock;
 
+  // Of each kind of coalesced command, web only works on one at a time and the
+  // newest one waits for it. Anything in between is answered right away.
+  QHash<QString, quint64> m_sentCommands;
+  QHash<QString, quint64> m_queuedCommands;
+  QTimer m_commandTimer;
+  QElapsedTimer m_commandClock;
+
+  // only taken by writers of m_subscribers and for the expiry wheel
   QMutex m_subscriberLock;
-  QMap<QString, RemoteSubscriber*> m_subscriberMap;
+  SubscriberSnapshot m_subscribers;
   QTimer m_subscriberTimer;
-  QNetworkAccessManager* m_networkAccessManager;
+
+  // Timer wheel of subscriber expiries. Each slot holds the subscribers that
+  // expire in that tick, so checking only ever looks at a single slot.
+  QVector<QSet<RemoteSubscriber*>> m_expiryWheel;
+  QHash<RemoteSubscriber*, int> m_expirySlot;
+  int m_wheelPosition;
+
+  // timelines from web are merged and sent at most "timelineUpdateRate" times a second
+  QTimer m_timelineTimer;
+  quint64 m_pendingCommandID;
+  QByteArray m_pendingTimeline;
+  // only touched by the timeline worker, and only while m_timelineBusy is set
+  RemoteTimeline m_timeline;
+  bool m_timelineBusy;
+  quint64 m_processingCommandID;
+
+  // what subscribers got last, used to only push timelines that changed. The worker
+  // keeps m_sentTimeline, the rest is on the main thread.
+  RemoteTimeline m_sentTimeline;
+  TimelineTemplate m_sentTemplate;
+  quint64 m_sentCommandID;
+  QElapsedTimer m_sentTime;
+  QList<QPair<QByteArray, QByteArray>> m_timelineHeaders;
+  QByteArray m_resourceResponse;
+
+  // parses and serializes the timelines, declared last so it's finished with the
+  // members above before they are destroyed
+  QThreadPool m_timelinePool;
 };
 
 
@@ -0,0 +1,101 @@
+#include "RemoteRequest.h"
+
+#include <QUrlQuery>
+
+#include "RemoteComponent.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const RemoteRequest::QueryItems& RemoteRequest::queryItems() const
+{
+  if (!m_queryParsed)
+  {
+    for (const auto& item : QUrlQuery(m_request->url()).queryItems())
+      m_queryItems.append(qMakePair(item.first, QUrl::fromPercentEncoding(item.second.toLatin1())));
+    m_queryParsed = true;
+  }
+
+  return m_queryItems;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool RemoteRequest::hasQuery(const QString& key) const
+{
+  for (const auto& item : queryItems())
+  {
+    if (item.first == key)
+      return true;
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString RemoteRequest::query(const QString& key, const QString& defaultValue) const
+{
+  for (const auto& item : queryItems())
+  {
+    if (item.first == key)
+      return item.second;
+  }
+  return defaultValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int RemoteRequest::queryInt(const QString& key, int defaultValue) const
+{
+  bool ok;
+  int value = query(key).toInt(&ok);
+  return ok ? value : defaultValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList RemoteRequest::queryKeys() const
+{
+  // sorted and without duplicates, like the keys of queryMap()
+  QStringList keys;
+  for (const auto& item : queryItems())
+    keys << item.first;
+  keys.sort();
+  keys.removeDuplicates();
+  return keys;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool RemoteRequest::hasPlexValue(const QByteArray& key) const
+{
+  if (hasHeader(key))
+    return true;
+
+  // query parameter names are matched regardless of case
+  for (const auto& item : queryItems())
+  {
+    if (item.first.compare(QLatin1String(key), Qt::CaseInsensitive) == 0)
+      return true;
+  }
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString RemoteRequest::plexValue(const QByteArray& key) const
+{
+  if (hasHeader(key))
+    return header(key);
+
+  for (const auto& item : queryItems())
+  {
+    if (item.first.compare(QLatin1String(key), Qt::CaseInsensitive) == 0)
+      return item.second;
+  }
+  return QString();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap RemoteRequest::headerMap() const
+{
+  return RemoteComponent::HeaderToMap(m_request->headers());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap RemoteRequest::queryMap() const
+{
+  return RemoteComponent::QueryToMap(m_request->url());
+}
@@ -0,0 +1,54 @@
+#ifndef REMOTEREQUEST_H
+#define REMOTEREQUEST_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#include "qhttpserverrequest.hpp"
+
+using namespace qhttp::server;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A view of the headers and query of a remote control request. The handlers only look at
+// a few of them, so nothing is converted until it is asked for, and the query is decoded once
+// the first time it's needed. headerMap() and queryMap() build the full QVariantMaps for what
+// is forwarded to web.
+//
+class RemoteRequest
+{
+public:
+  explicit RemoteRequest(QHttpRequest* request) : m_request(request), m_queryParsed(false) {}
+
+  QHttpRequest* request() const { return m_request; }
+  QString path() const { return m_request->url().path(); }
+
+  // qhttp stores the header names in lower case, so the key has to be lower case too
+  bool hasHeader(const QByteArray& key) const { return m_request->headers().contains(key); }
+  QByteArray header(const QByteArray& key) const { return m_request->headers().value(key); }
+
+  // X-Plex- headers can also be sent as query parameters, the header wins
+  bool hasPlexValue(const QByteArray& key) const;
+  QString plexValue(const QByteArray& key) const;
+
+  bool hasQuery(const QString& key) const;
+  // the first value of the parameter
+  QString query(const QString& key, const QString& defaultValue = QString()) const;
+  int queryInt(const QString& key, int defaultValue = 0) const;
+  QStringList queryKeys() const;
+
+  QVariantMap headerMap() const;
+  QVariantMap queryMap() const;
+
+private:
+  typedef QList<QPair<QString, QString>> QueryItems;
+  const QueryItems& queryItems() const;
+
+  QHttpRequest* m_request;
+  mutable bool m_queryParsed;
+  mutable QueryItems m_queryItems;
+};
+
+#endif // REMOTEREQUEST_H
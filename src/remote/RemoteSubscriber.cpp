@@ -2,34 +2,32 @@
 // Created by Tobias Hieta on 31/03/15.
 //
 
-#include <QNetworkAccessManager>
 #include <QsLog.h>
 #include <QtCore/qxmlstream.h>
-#include <QDomDocument>
 #include <QMutex>
+#include <QTimer>
 
 #include "RemoteSubscriber.h"
 #include "RemoteComponent.h"
 #include "settings/SettingsComponent.h"
+#include "utils/NetworkService.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////
 RemoteSubscriber::RemoteSubscriber(const QString& clientIdentifier, const QString& deviceName, const QUrl& address, QObject* parent)
-  : QObject(parent), m_address(address), m_clientIdentifier(clientIdentifier), m_deviceName(deviceName)
+  : QObject(parent), m_address(address), m_updatePending(false), m_errors(0), m_backoffMsec(0),
+    m_clientIdentifier(clientIdentifier), m_deviceName(deviceName)
 {
   m_subscribeTime.start();
 
   if (!address.isEmpty())
   {
-    RemoteComponent* remote = dynamic_cast<RemoteComponent*>(parent);
-    Q_ASSERT(remote);
-
-    m_netAccess = remote->getNetworkAccessManager();
+    QNetworkAccessManager* netAccess = NetworkService::Get().manager();
 
     // make first access faster by connecting directly to the host now.
     if (address.scheme() == "https")
-      m_netAccess->connectToHostEncrypted(address.host(), address.port());
+      netAccess->connectToHostEncrypted(address.host(), address.port());
     else
-      m_netAccess->connectToHost(address.host(), address.port());
+      netAccess->connectToHost(address.host(), address.port());
   }
 }
 
@@ -54,52 +52,77 @@ QString RemoteSubscriber::clientIdentifier()
 /////////////////////////////////////////////////////////////////////////////////////////
 void RemoteSubscriber::sendUpdate()
 {
+  // still backing off after errors, the next update after that will catch up
+  if (m_backoffMsec && m_backoffTimer.elapsed() < m_backoffMsec)
+    return;
+
+  if (m_reply)
+  {
+    m_updatePending = true;
+    return;
+  }
+
   QUrl url(m_address);
   url.setPath("/:/timeline");
 
   QNetworkRequest request(url);
   request.setHeader(QNetworkRequest::ContentTypeHeader, "application/xml");
-  request.setAttribute(QNetworkRequest::User, m_clientIdentifier);
+  // QNetworkAccessManager pools connections per host, ask the controller to
+  // keep it open so that the next update doesn't need a new connection.
+  request.setRawHeader("Connection", "keep-alive");
 
-  QVariantMap headers = RemoteComponent::HeaderInformation();
-  for(const QString& key : headers.keys())
-  {
-    request.setRawHeader(key.toUtf8(), headers[key].toString().toUtf8());
-  }
+  for (const auto& header : RemoteComponent::Get().timelineHeaders())
+    request.setRawHeader(header.first, header.second);
+
+  QNetworkReply* reply = NetworkService::Get().post(request, getTimeline(), NetworkService::RemoteRequest);
+  m_reply = reply;
 
-  m_netAccess->post(request, getTimeline());
+  // the reply outlives us if we are removed while it runs, then nobody needs to hear about it
+  connect(reply, &QNetworkReply::finished, this, [this, reply]() { timelineFinished(reply); });
+  connect(reply, &QNetworkReply::finished, reply, &QObject::deleteLater);
+
+  // don't let a controller that went away hold on to the connection
+  QTimer::singleShot(SUBSCRIBER_TIMEOUT_MSEC, m_reply.data(), &QNetworkReply::abort);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void RemoteSubscriber::timelineFinished(QNetworkReply* reply)
 {
+  if (reply == m_reply)
+    m_reply = nullptr;
+
   if (reply->error() != QNetworkReply::NoError)
   {
     QLOG_ERROR() << "got error code when sending timeline:" << reply->errorString();
-#if 0
-    if (++m_errors > 10)
+
+    if (++m_errors >= SUBSCRIBER_MAX_ERRORS)
     {
-      QLOG_ERROR() << "More than 10 errors received. Dropping this subscriber";
-      RemoteComponent::Get()->subscriberRemove(clientIdentifier());
+      QLOG_ERROR() << m_errors << "errors in a row, dropping subscriber" << m_deviceName;
+      RemoteComponent::Get().subscriberRemove(clientIdentifier());
+      return;
     }
-#endif
+
+    m_backoffMsec = qMin(SUBSCRIBER_BACKOFF_MSEC << (m_errors - 1), SUBSCRIBER_BACKOFF_MAX_MSEC);
+    m_backoffTimer.start();
+    m_updatePending = false;
+    return;
+  }
+
+  m_errors = 0;
+  m_backoffMsec = 0;
+
+  if (m_updatePending)
+  {
+    m_updatePending = false;
+    sendUpdate();
   }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void RemoteSubscriber::queueTimeline(quint64 playerCommandID, const QByteArray& timelineData)
+void RemoteSubscriber::queueTimeline(quint64 playerCommandID, const TimelineTemplate& timeline)
 {
   QMutexLocker lk(&m_timelineLock);
-
-  QDomDocument doc;
-  if (doc.setContent(timelineData) && !doc.firstChildElement("MediaContainer").isNull())
-  {
-    QDomElement node = doc.firstChildElement("MediaContainer");
-    node.setAttribute("commandID", commandId(playerCommandID));
-    m_timeline = doc;
-  }
-  else
-    QLOG_WARN() << "Failed to parse timeline data from player";
+  m_timeline = timeline.build(commandId(playerCommandID));
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -107,7 +130,7 @@ QByteArray RemoteSubscriber::getTimeline()
 {
   QMutexLocker lk(&m_timelineLock);
 
-  if (m_timeline.isNull())
+  if (m_timeline.isEmpty())
   {
     QByteArray xmlData;
     QXmlStreamWriter writer(&xmlData);
@@ -139,7 +162,7 @@ QByteArray RemoteSubscriber::getTimeline()
   }
   else
   {
-    return m_timeline.toByteArray(2);
+    return m_timeline;
   }
 }
 
@@ -9,11 +9,21 @@
 #include <QPointer>
 #include <QUrl>
 #include <QDateTime>
-#include <QDomDocument>
+#include <QElapsedTimer>
 #include <QNetworkReply>
 #include <QQueue>
 
 #include "qhttpserverresponse.hpp"
+#include "RemoteTimeline.h"
+
+// a timeline POST that takes longer than this is aborted
+#define SUBSCRIBER_TIMEOUT_MSEC 5000
+// after a failed POST the subscriber is left alone for this long, doubled
+// with every further failure up to the maximum
+#define SUBSCRIBER_BACKOFF_MSEC 1000
+#define SUBSCRIBER_BACKOFF_MAX_MSEC 30000
+// consecutive failures after which the subscriber is dropped
+#define SUBSCRIBER_MAX_ERRORS 6
 
 /////////////////////////////////////////////////////////////////////////////////////////
 class RemoteSubscriber : public QObject
@@ -27,7 +37,7 @@ public:
   QString clientIdentifier();
   virtual void sendUpdate();
   void timelineFinished(QNetworkReply* reply);
-  void queueTimeline(quint64 playerCommandID, const QByteArray& timelineData);
+  void queueTimeline(quint64 playerCommandID, const TimelineTemplate& timeline);
   QByteArray getTimeline();
   void setCommandId(quint64 playerCommandId, quint64 controllerCommandId);
 
@@ -54,20 +64,25 @@ private:
   QHash<quint64, quint64> m_commandIdMap;
   QQueue<quint64> m_commandIdQueue;
 
-  QNetworkAccessManager* m_netAccess;
   QUrl m_address;
   QTime m_subscribeTime;
 
+  // Only one POST is in flight per subscriber. If the timeline changes in
+  // the meantime, the newest one is sent when the current POST is done.
+  QPointer<QNetworkReply> m_reply;
+  bool m_updatePending;
+
+  // circuit breaker for subscribers that stopped responding
+  quint16 m_errors;
+  int m_backoffMsec;
+  QElapsedTimer m_backoffTimer;
+
   QMutex m_timelineLock;
-  QDomDocument m_timeline;
+  QByteArray m_timeline;
 
 protected:
   QString m_clientIdentifier;
   QString m_deviceName;
-
-#if 0
-  quint16 m_errors;
- #endif
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////
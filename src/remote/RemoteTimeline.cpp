@@ -0,0 +1,162 @@
+#include "RemoteTimeline.h"
+
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include "QsLog.h"
+
+// big enough for the usual three timelines, the buffer is reused afterwards
+#define TIMELINE_BUFFER_SIZE 4096
+
+// msec a timeline may be off from where we expect it before it counts as a seek
+#define TIMELINE_SEEK_THRESHOLD 2000
+
+static const QByteArray g_commandIdMarker("@@commandID@@");
+
+/////////////////////////////////////////////////////////////////////////////////////////
+RemoteTimeline::RemoteTimeline()
+{
+  // reserving also keeps resize(0) from freeing the buffer
+  m_buffer.reserve(TIMELINE_BUFFER_SIZE);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool RemoteTimeline::parse(const QByteArray& xml)
+{
+  m_containerAttributes.clear();
+  m_timelines.resize(0);
+  m_template = TimelineTemplate();
+
+  QXmlStreamReader reader(xml);
+
+  if (!reader.readNextStartElement() || reader.name() != QLatin1String("MediaContainer"))
+    return false;
+
+  for (const QXmlStreamAttribute& attr : reader.attributes())
+  {
+    // set for each subscriber on its own
+    if (attr.name() != QLatin1String("commandID"))
+      m_containerAttributes.append(attr);
+  }
+
+  while (reader.readNextStartElement())
+  {
+    if (reader.name() != QLatin1String("Timeline"))
+    {
+      QLOG_DEBUG() << "Ignoring unknown element in timeline:" << reader.name();
+      reader.skipCurrentElement();
+      continue;
+    }
+
+    MediaTimeline timeline;
+    for (const QXmlStreamAttribute& attr : reader.attributes())
+    {
+      QStringRef name = attr.name();
+      if (name == QLatin1String("type"))
+        timeline.type = attr.value().toString();
+      else if (name == QLatin1String("state"))
+        timeline.state = attr.value().toString();
+      else if (name == QLatin1String("time"))
+        timeline.time = attr.value().toString();
+      else if (name == QLatin1String("duration"))
+        timeline.duration = attr.value().toString();
+      else if (name == QLatin1String("key"))
+        timeline.key = attr.value().toString();
+      else
+        timeline.attributes.append(attr);
+    }
+    m_timelines.append(timeline);
+
+    // Timeline elements don't have children
+    reader.skipCurrentElement();
+  }
+
+  if (reader.hasError())
+  {
+    QLOG_WARN() << "Failed to parse timeline:" << reader.errorString();
+    m_containerAttributes.clear();
+    m_timelines.resize(0);
+    return false;
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool RemoteTimeline::isSignificantChange(const RemoteTimeline& previous, qint64 elapsedMs) const
+{
+  if (m_containerAttributes != previous.m_containerAttributes ||
+      m_timelines.size() != previous.m_timelines.size())
+    return true;
+
+  for (int i = 0; i < m_timelines.size(); i++)
+  {
+    const MediaTimeline& current = m_timelines.at(i);
+    const MediaTimeline& last = previous.m_timelines.at(i);
+
+    if (current.type != last.type || current.state != last.state || current.key != last.key ||
+        current.duration != last.duration || current.attributes != last.attributes)
+      return true;
+
+    if (current.time != last.time)
+    {
+      qint64 expected = last.time.toLongLong();
+      if (current.state == QLatin1String("playing"))
+        expected += elapsedMs;
+
+      if (qAbs(current.time.toLongLong() - expected) > TIMELINE_SEEK_THRESHOLD)
+        return true;
+    }
+  }
+
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static inline void writeOptionalAttribute(QXmlStreamWriter& writer, const QString& name, const QString& value)
+{
+  if (!value.isNull())
+    writer.writeAttribute(name, value);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+const TimelineTemplate& RemoteTimeline::serialize()
+{
+  m_buffer.resize(0);
+
+  QXmlStreamWriter writer(&m_buffer);
+  writer.setAutoFormatting(true);
+  writer.setAutoFormattingIndent(2);
+
+  writer.writeStartDocument();
+  writer.writeStartElement("MediaContainer");
+  writer.writeAttributes(m_containerAttributes);
+  writer.writeAttribute("commandID", QString::fromLatin1(g_commandIdMarker));
+
+  for (const MediaTimeline& timeline : m_timelines)
+  {
+    writer.writeEmptyElement("Timeline");
+    writeOptionalAttribute(writer, "type", timeline.type);
+    writeOptionalAttribute(writer, "state", timeline.state);
+    writeOptionalAttribute(writer, "time", timeline.time);
+    writeOptionalAttribute(writer, "duration", timeline.duration);
+    writeOptionalAttribute(writer, "key", timeline.key);
+    writer.writeAttributes(timeline.attributes);
+  }
+
+  writer.writeEndElement();
+  writer.writeEndDocument();
+
+  int pos = m_buffer.indexOf(g_commandIdMarker);
+  if (pos >= 0)
+  {
+    m_template.prefix = m_buffer.left(pos);
+    m_template.suffix = m_buffer.mid(pos + g_commandIdMarker.size());
+  }
+  else
+  {
+    m_template = TimelineTemplate();
+  }
+
+  return m_template;
+}
@@ -0,0 +1,71 @@
+#ifndef KONVERGO_REMOTETIMELINE_H
+#define KONVERGO_REMOTETIMELINE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QXmlStreamAttributes>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// A timeline as it is sent to the subscribers, serialized once. The only
+// thing that differs between subscribers is the commandID attribute, which is
+// inserted between prefix and suffix.
+struct TimelineTemplate
+{
+  QByteArray prefix;
+  QByteArray suffix;
+
+  bool isNull() const { return prefix.isEmpty(); }
+  QByteArray build(quint64 commandID) const { return prefix + QByteArray::number(commandID) + suffix; }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Flat model of the timeline XML that web sends us:
+//
+//   <MediaContainer location="..." ...>
+//     <Timeline type="video" state="playing" time="..." duration="..." key="..." .../>
+//     ...
+//   </MediaContainer>
+//
+// The commonly used attributes are kept as separate fields, everything else
+// is passed through untouched in its original order.
+class RemoteTimeline
+{
+public:
+  struct MediaTimeline
+  {
+    QString type;
+    QString state;
+    QString time;
+    QString duration;
+    QString key;
+    QXmlStreamAttributes attributes;
+  };
+
+  RemoteTimeline();
+
+  // Returns false if the data is not a timeline. The previous contents are
+  // lost in either case.
+  bool parse(const QByteArray& xml);
+  bool isNull() const { return m_timelines.isEmpty() && m_containerAttributes.isEmpty(); }
+
+  const QVector<MediaTimeline>& timelines() const { return m_timelines; }
+
+  // Returns true if this differs from previous in more than the progress of
+  // playback that is expected after elapsedMs. A jump in time, e.g. because
+  // of a seek, counts as a change.
+  bool isSignificantChange(const RemoteTimeline& previous, qint64 elapsedMs) const;
+
+  // Serialize with a placeholder for the commandID. The returned template is
+  // valid until the next call to parse() or serialize().
+  const TimelineTemplate& serialize();
+
+private:
+  QXmlStreamAttributes m_containerAttributes;
+  QVector<MediaTimeline> m_timelines;
+
+  QByteArray m_buffer;
+  TimelineTemplate m_template;
+};
+
+#endif //KONVERGO_REMOTETIMELINE_H
@@ -0,0 +1,170 @@
+#include "TimelineBenchmark.h"
+
+#include <QXmlStreamWriter>
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "QsLog.h"
+#include "RemoteComponent.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach.h>
+#else
+#include <time.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////
+TimelineBenchmark::TimelineBenchmark(int rate, QObject* parent) : QObject(parent),
+  m_rate(qMax(rate, 1)), m_intervalUsec(1000000 / m_rate), m_nextUpdateUsec(0), m_mediaTime(0),
+  m_commandID(0), m_updates(0), m_callCpuUsec(0), m_threadCpuStart(0), m_reportStart(0)
+{
+  // the coarse default would hide the latency this is about
+  m_updateTimer.setTimerType(Qt::PreciseTimer);
+  m_updateTimer.setInterval(qMax(1, (int)(m_intervalUsec / 1000)));
+  connect(&m_updateTimer, &QTimer::timeout, this, &TimelineBenchmark::update);
+
+  m_reportTimer.setInterval(TIMELINE_BENCHMARK_REPORT_MSEC);
+  connect(&m_reportTimer, &QTimer::timeout, this, &TimelineBenchmark::report);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void TimelineBenchmark::start()
+{
+  printf("Driving timelines at %d updates/s, run timeline-load against this player\n", m_rate);
+  QLOG_INFO() << "Timeline benchmark started at" << m_rate << "updates/s";
+
+  m_clock.start();
+  m_nextUpdateUsec = m_intervalUsec;
+  m_threadCpuStart = threadCpuUsec();
+  m_updateTimer.start();
+  m_reportTimer.start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+qint64 TimelineBenchmark::threadCpuUsec()
+{
+#if defined(Q_OS_WIN)
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0;
+
+  // 100ns units
+  quint64 k = ((quint64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+  quint64 u = ((quint64)user.dwHighDateTime << 32) | user.dwLowDateTime;
+  return (qint64)((k + u) / 10);
+#elif defined(Q_OS_MAC)
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  mach_port_t thread = mach_thread_self();
+  kern_return_t result = thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  if (result != KERN_SUCCESS)
+    return 0;
+
+  return (qint64)info.user_time.seconds * 1000000 + info.user_time.microseconds +
+         (qint64)info.system_time.seconds * 1000000 + info.system_time.microseconds;
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    return 0;
+  return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Roughly what web sends while a video plays, music and photo idle.
+//
+QByteArray TimelineBenchmark::buildTimeline()
+{
+  QByteArray xml;
+  QXmlStreamWriter writer(&xml);
+
+  writer.writeStartElement("MediaContainer");
+  writer.writeAttribute("location", "fullScreenVideo");
+  writer.writeAttribute("commandID", QString::number(m_commandID));
+
+  writer.writeStartElement("Timeline");
+  writer.writeAttribute("type", "video");
+  writer.writeAttribute("state", "playing");
+  writer.writeAttribute("time", QString::number(m_mediaTime));
+  writer.writeAttribute("duration", "7200000");
+  writer.writeAttribute("key", "/library/metadata/1");
+  writer.writeAttribute("ratingKey", "1");
+  writer.writeAttribute("containerKey", "/playQueues/1");
+  writer.writeAttribute("playQueueID", "1");
+  writer.writeAttribute("playQueueItemID", "1");
+  writer.writeAttribute("machineIdentifier", "0000000000000000000000000000000000000000");
+  writer.writeAttribute("protocol", "http");
+  writer.writeAttribute("address", "127.0.0.1");
+  writer.writeAttribute("port", "32400");
+  writer.writeAttribute("volume", "100");
+  writer.writeAttribute("shuffle", "0");
+  writer.writeAttribute("repeat", "0");
+  writer.writeAttribute("controllable", "playPause,stop,stepBack,stepForward,seekTo,volume,audioStream,subtitleStream");
+  writer.writeEndElement();
+
+  for (const char* type : { "music", "photo" })
+  {
+    writer.writeStartElement("Timeline");
+    writer.writeAttribute("type", type);
+    writer.writeAttribute("state", "stopped");
+    writer.writeEndElement();
+  }
+
+  writer.writeEndElement();
+  return xml;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void TimelineBenchmark::update()
+{
+  qint64 now = m_clock.nsecsElapsed() / 1000;
+  m_latencyUsec.append(qMax(0LL, now - m_nextUpdateUsec));
+
+  // don't let one long stall count against every following update
+  m_nextUpdateUsec = qMax(m_nextUpdateUsec + m_intervalUsec, now);
+
+  m_mediaTime = (m_mediaTime + TIMELINE_BENCHMARK_SEEK_MSEC) % 7200000;
+  QByteArray timeline = buildTimeline();
+
+  qint64 cpu = threadCpuUsec();
+  RemoteComponent::Get().timelineUpdate(m_commandID, QString::fromUtf8(timeline));
+  m_callCpuUsec += threadCpuUsec() - cpu;
+  m_updates++;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void TimelineBenchmark::report()
+{
+  if (!m_updates)
+    return;
+
+  qint64 now = m_clock.elapsed();
+  qint64 threadCpu = threadCpuUsec();
+  qint64 wall = qMax(1LL, now - m_reportStart);
+
+  std::sort(m_latencyUsec.begin(), m_latencyUsec.end());
+  auto percentile = [&](int p) { return m_latencyUsec.at((m_latencyUsec.size() - 1) * p / 100) / 1000.0; };
+
+  // The call itself only queues the POSTs and poll replies, the writes happen later on
+  // the same thread, so the whole thread per update is the more honest number.
+  double callUsec = (double)m_callCpuUsec / m_updates;
+  double threadUsec = (double)(threadCpu - m_threadCpuStart) / m_updates;
+  double threadPercent = (threadCpu - m_threadCpuStart) / 10.0 / wall;
+
+  printf("%lld updates, cpu/update %.0f us in call %.0f us thread, gui thread %.1f%%, "
+         "latency p50 %.2f ms p99 %.2f ms max %.2f ms\n",
+         (long long)m_updates, callUsec, threadUsec, threadPercent, percentile(50), percentile(99), percentile(100));
+  fflush(stdout);
+  QLOG_INFO() << "Timeline benchmark:" << m_updates << "updates," << callUsec << "us/update in call,"
+              << threadUsec << "us/update thread, latency p99" << percentile(99) << "ms";
+
+  m_updates = 0;
+  m_callCpuUsec = 0;
+  m_threadCpuStart = threadCpu;
+  m_reportStart = now;
+  m_latencyUsec.clear();
+}
@@ -0,0 +1,52 @@
+#ifndef KONVERGO_TIMELINEBENCHMARK_H
+#define KONVERGO_TIMELINEBENCHMARK_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QVector>
+
+// how often the numbers are printed
+#define TIMELINE_BENCHMARK_REPORT_MSEC 10000
+// each update jumps this far, so none of them is held back as mere playback progress
+#define TIMELINE_BENCHMARK_SEEK_MSEC 10000
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Driver half of the timeline load test, started with --benchmark-timeline <rate> in
+// ENABLE_BENCHMARKS builds. Feeds synthetic timelines to RemoteComponent::timelineUpdate
+// at rate updates per second and prints the GUI thread CPU time per update and how late
+// its timer fires, which is the latency everything else on that thread sees. The
+// subscribers come from the timeline-load tool, which also counts the bytes sent.
+//
+class TimelineBenchmark : public QObject
+{
+  Q_OBJECT
+public:
+  explicit TimelineBenchmark(int rate, QObject* parent = nullptr);
+
+  void start();
+
+private:
+  void update();
+  void report();
+  QByteArray buildTimeline();
+  static qint64 threadCpuUsec();
+
+  int m_rate;
+  qint64 m_intervalUsec;
+  QTimer m_updateTimer;
+  QTimer m_reportTimer;
+  QElapsedTimer m_clock;
+  qint64 m_nextUpdateUsec;
+  qint64 m_mediaTime;
+  quint64 m_commandID;
+
+  // since the last report
+  qint64 m_updates;
+  qint64 m_callCpuUsec;
+  qint64 m_threadCpuStart;
+  qint64 m_reportStart;
+  QVector<qint64> m_latencyUsec;
+};
+
+#endif //KONVERGO_TIMELINEBENCHMARK_H
@@ -1,28 +1,208 @@
 #include "HTTPServer.h"
 
 #include <QFile>
+#include <QFileInfo>
+#include <QLocale>
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTcpSocket>
 
 #include "QsLog.h"
 #include "utils/Utils.h"
+#include "utils/Trace.h"
+#include "utils/Systemd.h"
+#include "ComponentManager.h"
 #include "settings/SettingsComponent.h"
 #include "remote/RemoteComponent.h"
 #include "Paths.h"
+#include "Version.h"
+
+#include "qhttpserverconnection.hpp"
+#include "utils/AllocationTracker.h"
 
 #define WEB_CLIENT_PATH "/web/tv"
 
+// files up to this size are kept in memory
+#define FILE_CACHE_MAX_FILE (256 * 1024)
+#define FILE_CACHE_SIZE (16 * 1024 * 1024)
+// larger files are written in chunks of this size when the socket drained
+#define FILE_STREAM_CHUNK (64 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes a file into a response chunk by chunk, only queueing the next one
+// when the socket has written the previous. Lives as long as the response.
+class FileStreamer : public QObject
+{
+public:
+  FileStreamer(const QString& path, QHttpResponse* response)
+    : QObject(response), m_file(path), m_response(response), m_map(nullptr), m_offset(0)
+  {
+  }
+
+  bool start()
+  {
+    if (!m_file.open(QFile::ReadOnly))
+      return false;
+
+    // resources and regular files can usually be mapped, otherwise just read
+    m_map = m_file.map(0, m_file.size());
+
+    connect(m_response, &QHttpResponse::allBytesWritten, this, &FileStreamer::writeChunk);
+    writeChunk();
+    return true;
+  }
+
+private:
+  void writeChunk()
+  {
+    qint64 size = m_file.size();
+    qint64 length = qMin<qint64>(FILE_STREAM_CHUNK, size - m_offset);
+
+    if (length > 0)
+    {
+      if (m_map)
+        m_response->write(QByteArray::fromRawData((const char*)m_map + m_offset, (int)length));
+      else
+        m_response->write(m_file.read(length));
+      m_offset += length;
+    }
+
+    if (m_offset >= size || (!m_map && m_file.atEnd()))
+    {
+      disconnect(m_response, &QHttpResponse::allBytesWritten, this, &FileStreamer::writeChunk);
+      m_response->end();
+      deleteLater();
+    }
+  }
+
+  QFile m_file;
+  QHttpResponse* m_response;
+  uchar* m_map;
+  qint64 m_offset;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QByteArray httpDate(const QDateTime& time)
+{
+  return QLocale::c().toString(time.toUTC(), "ddd, dd MMM yyyy hh:mm:ss").append(" GMT").toLatin1();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
-HttpServer::HttpServer(QObject* parent) : QObject(parent)
+HttpServer::HttpServer(QObject* parent) : QObject(parent), m_fileCache(FILE_CACHE_SIZE)
 {
   m_server = new QHttpServer(this);
   m_baseUrl = ":/konvergo";
   m_port = (quint16)SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "webserverport").toUInt();
+
+  m_routeNodes.append(RouteNode{-1, QHash<QString, int>()});
+  addRoute(WEB_CLIENT_PATH, &HttpServer::handleWebClientRequest);
+  // the remote component is one of the deferred ones
+  addRoute("/resources", &HttpServer::handleResource, true, "remote");
+  addRoute("/player", &HttpServer::handleRemoteController, true, "remote");
+  addRoute("/files", &HttpServer::handleFilesRequest);
+  addRoute("/sounds", &HttpServer::handleSoundsRequest);
+  addRoute("/metrics", &HttpServer::handleMetricsRequest, false);
+  addRoute("/", &HttpServer::handleRootRequest, false);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HttpServer::addRoute(const QString& path, RequestHandler handler, bool prefix, const QString& component)
+{
+  int node = 0;
+  for (const QString& segment : path.split('/', QString::SkipEmptyParts))
+  {
+    int child = m_routeNodes[node].children.value(segment, -1);
+    if (child == -1)
+    {
+      child = m_routeNodes.size();
+      m_routeNodes.append(RouteNode{-1, QHash<QString, int>()});
+      m_routeNodes[node].children.insert(segment, child);
+    }
+    node = child;
+  }
+
+  Route route = { path, handler, prefix, component, 0, 0, {} };
+  m_routeNodes[node].route = m_routes.size();
+  m_routes.append(route);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+int HttpServer::findRoute(const QString& path) const
+{
+  const QStringList segments = path.split('/', QString::SkipEmptyParts);
+
+  // the deepest prefix route on the way wins, exact routes only match at the end
+  int node = 0;
+  int found = -1;
+  int depth = 0;
+
+  for (;;)
+  {
+    int route = m_routeNodes[node].route;
+    if (route != -1 && (m_routes[route].prefix || depth == segments.size()))
+      found = route;
+
+    if (depth == segments.size())
+      break;
+
+    node = m_routeNodes[node].children.value(segments[depth++], -1);
+    if (node == -1)
+      break;
+  }
+
+  return found;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HttpServer::trackRequest(int route, QHttpRequest* request, QHttpResponse* response)
+{
+  m_routes[route].requests++;
+
+  QString client = request->headers().value("x-plex-device-name");
+  if (client.isEmpty())
+    client = request->remoteAddress();
+  if (m_clientRequests.contains(client) || m_clientRequests.size() < HTTP_MAX_TRACKED_CLIENTS)
+    m_clientRequests[client]++;
+
+  // everything written to the socket while this response is alive belongs to it
+  QTcpSocket* socket = response->connection() ? response->connection()->tcpSocket() : nullptr;
+  if (socket)
+    connect(socket, &QTcpSocket::bytesWritten, response, [=](qint64 bytes) { m_routes[route].bytes += bytes; });
+
+  QElapsedTimer timer;
+  timer.start();
+
+  connect(response, &QHttpResponse::done, this, [=]()
+  {
+    static const qint64 bounds[] = HTTP_LATENCY_BUCKETS;
+
+    qint64 elapsed = timer.elapsed();
+    int bucket = 0;
+    while (bucket < HTTP_LATENCY_BUCKET_COUNT - 1 && elapsed > bounds[bucket])
+      bucket++;
+
+    m_routes[route].latency[bucket]++;
+  });
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 bool HttpServer::start()
 {
   connect(m_server, &QHttpServer::newRequest, this, &HttpServer::handleRequest);
+
+  // With socket activation systemd already listens on the port, and queues the connections
+  // of remote controllers while we start up.
+  int socket = Systemd::TakeListenSocket();
+  if (socket >= 0)
+  {
+    if (m_server->listenDescriptor(socket))
+    {
+      QLOG_DEBUG() << "Listening to the socket passed in by systemd";
+      return true;
+    }
+    QLOG_WARN() << "Can't use the socket passed in by systemd, listening to port" << m_port;
+  }
+
   if (!m_server->listen(QHostAddress::AnyIPv4, m_port))
   {
     QLOG_WARN() << "Failed to listen to remote control web server. Remote controlling from apps disabled.";
@@ -55,6 +235,9 @@ void HttpServer::writeError(QHttpResponse* response, qhttp::TStatusCode errorCod
     case qhttp::ESTATUS_NOT_IMPLEMENTED:
       error = "This request is not yet implemented";
       break;
+    case qhttp::ESTATUS_SERVICE_UNAVAILABLE:
+      error = "Still starting up, try again in a moment";
+      break;
     default:
       error = "Generic error, something went wrong<tm>";
       break;
@@ -65,35 +248,145 @@ void HttpServer::writeError(QHttpResponse* response, qhttp::TStatusCode errorCod
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-bool HttpServer::writeFile(const QString& file, QHttpResponse* response)
+const HttpServer::CachedFile* HttpServer::cachedFile(const QString& file)
 {
-  QLOG_DEBUG() << "Going to request file:" << qPrintable(file);
-  if (QFile::exists(file))
+  // resources can't change, files on disk are checked again
+  bool isResource = file.startsWith(":");
+  CachedFile* entry = m_fileCache.object(file);
+  if (entry && isResource)
+    return entry->exists ? entry : nullptr;
+
+  QFileInfo info(file);
+  if (!info.exists() || info.isDir())
+  {
+    if (isResource)
+      m_fileCache.insert(file, new CachedFile{false, 0, QDateTime(), QByteArray(), QByteArray(), QByteArray(), QByteArray(), AssetView()}, 1);
+    else
+      m_fileCache.remove(file);
+    return nullptr;
+  }
+
+  if (entry && entry->exists && entry->size == info.size() && entry->modified == info.lastModified())
+    return entry;
+
+  entry = new CachedFile;
+  entry->exists = true;
+  entry->size = info.size();
+  entry->modified = info.lastModified();
+  entry->mime = m_mime.mimeTypeForFile(info).name().toUtf8();
+
+  // resources have no useful time stamp, so the version takes its place
+  entry->etag = "\"" + QByteArray::number(entry->size, 16) + "-" +
+                QByteArray::number(entry->modified.toMSecsSinceEpoch(), 16) + "-" +
+                QByteArray::number(qHash(Version::GetVersionString()), 16) + "\"";
+  if (entry->modified.isValid())
+    entry->lastModified = httpDate(entry->modified);
+
+  if (entry->size <= FILE_CACHE_MAX_FILE && isResource)
+  {
+    // points into the binary, nothing is copied
+    entry->asset = AssetView::open(file);
+    entry->data = entry->asset.bytes();
+  }
+  else if (entry->size <= FILE_CACHE_MAX_FILE)
   {
     QFile fp(file);
     if (fp.open(QFile::ReadOnly))
-    {
-      auto mime = m_mime.mimeTypeForFile(fp);
+      entry->data = fp.readAll();
+  }
 
-      response->setStatusCode(qhttp::ESTATUS_OK);
-      response->addHeader("Content-Type", mime.name().toUtf8());
-      response->addHeader("Content-Length", QByteArray::number(fp.size()));
-      response->write(fp.readAll());
+  // the metadata is cheap, so every entry costs at least a little
+  int cost = entry->data.size() + 1;
+  if (!m_fileCache.insert(file, entry, cost))
+  {
+    QLOG_WARN() << "Failed to cache file" << file;
+    return nullptr;
+  }
 
-      fp.close();
-      return true;
-    }
-    else
+  return m_fileCache.object(file);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool HttpServer::writeFile(const QString& file, QHttpRequest* request, QHttpResponse* response)
+{
+  QLOG_DEBUG() << "Going to request file:" << qPrintable(file);
+
+  const CachedFile* entry = cachedFile(file);
+  if (!entry)
+  {
+    writeError(response, qhttp::ESTATUS_NOT_FOUND);
+    response->end();
+    return false;
+  }
+
+  // Serve a variant compressed at build time if the client takes it. The
+  // lookup may evict the original entry, so only its type is kept.
+  QByteArray mime = entry->mime;
+  QString servedFile = file;
+  QByteArray accepted = request->headers().value("accept-encoding");
+
+  for (const auto& encoding : { qMakePair(QByteArray("br"), QString(".br")), qMakePair(QByteArray("gzip"), QString(".gz")) })
+  {
+    if (!accepted.contains(encoding.first))
+      continue;
+
+    const CachedFile* variant = cachedFile(file + encoding.second);
+    if (variant)
     {
-      writeError(response, qhttp::ESTATUS_FORBIDDEN);
-      return false;
+      entry = variant;
+      servedFile = file + encoding.second;
+      response->addHeader("Content-Encoding", encoding.first);
+      break;
     }
   }
-  else
+
+  // the original might have been evicted while looking for variants
+  if (servedFile == file)
+    entry = cachedFile(file);
+
+  if (!entry)
   {
     writeError(response, qhttp::ESTATUS_NOT_FOUND);
+    response->end();
     return false;
   }
+
+  response->addHeader("Vary", "Accept-Encoding");
+  response->addHeader("ETag", entry->etag);
+  if (!entry->lastModified.isEmpty())
+    response->addHeader("Last-Modified", entry->lastModified);
+
+  // the client already has it
+  const qhttp::THeaderHash& headers = request->headers();
+  if (headers.value("if-none-match") == entry->etag ||
+      (!headers.contains("if-none-match") && !entry->lastModified.isEmpty() &&
+       headers.value("if-modified-since") == entry->lastModified))
+  {
+    response->setStatusCode(qhttp::ESTATUS_NOT_MODIFIED);
+    response->end();
+    return true;
+  }
+
+  response->setStatusCode(qhttp::ESTATUS_OK);
+  response->addHeader("Content-Type", mime);
+  response->addHeader("Content-Length", QByteArray::number(entry->size));
+
+  if (entry->size <= FILE_CACHE_MAX_FILE && entry->data.size() == entry->size)
+  {
+    response->end(entry->data);
+    return true;
+  }
+
+  FileStreamer* streamer = new FileStreamer(servedFile, response);
+  if (!streamer->start())
+  {
+    delete streamer;
+    writeError(response, qhttp::ESTATUS_FORBIDDEN);
+    response->end();
+    return false;
+  }
+
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -108,7 +401,7 @@ void HttpServer::handleWebClientRequest(QHttpRequest* request, QHttpResponse* re
       relativeUrl.replace(WEB_CLIENT_PATH, "");
       QString rUrl = m_baseUrl + relativeUrl;
 
-      writeFile(rUrl, response);
+      writeFile(rUrl, request, response);
       break;
     }
 
@@ -116,10 +409,9 @@ void HttpServer::handleWebClientRequest(QHttpRequest* request, QHttpResponse* re
     {
       writeError(response, qhttp::ESTATUS_METHOD_NOT_ALLOWED);
       QLOG_WARN() << "Method" << qPrintable(request->methodString()) << "is not supported";
+      response->end();
     }
   }
-
-  response->end();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -138,11 +430,14 @@ void HttpServer::handleRemoteController(QHttpRequest* request, QHttpResponse* re
 void HttpServer::handleFilesRequest(QHttpRequest* request, QHttpResponse* response)
 {
   if (request->url().path() == "/files/qwebchannel.js")
-    writeFile(":/qtwebchannel/qwebchannel.js", response);
+  {
+    writeFile(":/qtwebchannel/qwebchannel.js", request, response);
+  }
   else
+  {
     writeError(response, qhttp::ESTATUS_NOT_FOUND);
-
-  response->end();
+    response->end();
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -152,47 +447,86 @@ void HttpServer::handleSoundsRequest(QHttpRequest* request, QHttpResponse* respo
   auto soundPath = Paths::soundsPath(sound);
 
   if (soundPath.isEmpty())
+  {
     writeError(response, qhttp::ESTATUS_NOT_FOUND);
+    response->end();
+  }
   else
-    writeFile(Paths::soundsPath(sound), response);
+  {
+    writeFile(soundPath, request, response);
+  }
+}
 
-  response->end();
+/////////////////////////////////////////////////////////////////////////////////////////
+void HttpServer::handleRootRequest(QHttpRequest* request, QHttpResponse* response)
+{
+  Q_UNUSED(request);
+
+  response->setStatusCode(qhttp::ESTATUS_OK);
+  response->end("You should not be here :-)");
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void HttpServer::handleRequest(QHttpRequest* request, QHttpResponse* response)
+void HttpServer::handleMetricsRequest(QHttpRequest* request, QHttpResponse* response)
 {
-  QLOG_DEBUG() << "Incoming request to:" << request->url().toString() << "from" << request->remoteAddress();
+  Q_UNUSED(request);
 
-  QString path = request->url().path();
-  if (path.startsWith(WEB_CLIENT_PATH))
-  {
-    handleWebClientRequest(request, response);
-  }
-  else if (path.startsWith("/resources"))
-  {
-    handleResource(request, response);
-  }
-  else if (path.startsWith("/player"))
-  {
-    handleRemoteController(request, response);
-  }
-  else if (path.startsWith("/files"))
+  static const qint64 bounds[] = HTTP_LATENCY_BUCKETS;
+
+  QByteArray output;
+  for (const Route& route : m_routes)
   {
-    handleFilesRequest(request, response);
+    QByteArray label = "{route=\"" + route.path.toUtf8() + "\"";
+
+    output += "http_requests_total" + label + "} " + QByteArray::number(route.requests) + "\n";
+    output += "http_response_bytes_total" + label + "} " + QByteArray::number(route.bytes) + "\n";
+
+    quint64 count = 0;
+    for (int i = 0; i < HTTP_LATENCY_BUCKET_COUNT; i++)
+    {
+      count += route.latency[i];
+      QByteArray bound = i < HTTP_LATENCY_BUCKET_COUNT - 1 ? QByteArray::number(bounds[i]) : QByteArray("+Inf");
+      output += "http_request_duration_ms_bucket" + label + ",le=\"" + bound + "\"} " + QByteArray::number(count) + "\n";
+    }
   }
-  else if (path.startsWith("/sounds"))
+
+  for (auto it = m_clientRequests.constBegin(); it != m_clientRequests.constEnd(); ++it)
   {
-    handleSoundsRequest(request, response);
+    QByteArray client = it.key().toUtf8().replace('"', '\'').replace('\n', ' ');
+    output += "http_client_requests_total{client=\"" + client + "\"} " + QByteArray::number(it.value()) + "\n";
   }
-  else if (path == "/")
+
+  response->setStatusCode(qhttp::ESTATUS_OK);
+  response->addHeader("Content-Type", "text/plain; version=0.0.4");
+  response->end(output);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HttpServer::handleRequest(QHttpRequest* request, QHttpResponse* response)
+{
+  ALLOCATION_TAG(HttpServer);
+  TRACE_SCOPE("http", "handleRequest");
+  QLOG_DEBUG() << "Incoming request to:" << request->url().toString() << "from" << request->remoteAddress();
+
+  int route = findRoute(request->url().path());
+  if (route == -1)
   {
-    response->setStatusCode(qhttp::ESTATUS_OK);
-    response->end("You should not be here :-)");
+    writeError(response, qhttp::ESTATUS_NOT_FOUND);
+    response->end();
+    return;
   }
-  else
+
+  trackRequest(route, request, response);
+
+  const QString& component = m_routes[route].component;
+  if (!component.isEmpty() && !ComponentManager::Get().isInitialized(component))
   {
-    writeError(response, qhttp::ESTATUS_NOT_FOUND);
+    QLOG_DEBUG() << "Component" << component << "isn't initialized yet, asking to retry";
+    response->addHeader("Retry-After", QByteArray::number(HTTP_RETRY_AFTER_SECONDS));
+    writeError(response, qhttp::ESTATUS_SERVICE_UNAVAILABLE);
     response->end();
+    return;
   }
+
+  (this->*m_routes[route].handler)(request, response);
 }
@@ -4,13 +4,27 @@
 #include <QObject>
 #include <QString>
 #include <QMimeDatabase>
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
 
 #include "qhttpserverrequest.hpp"
 #include "qhttpserver.hpp"
 #include "qhttpserverresponse.hpp"
 
+#include "utils/AssetView.h"
+
 using namespace qhttp::server;
 
+// upper bounds (in ms) of the request latency histogram, the last bucket takes the rest
+#define HTTP_LATENCY_BUCKETS { 1, 5, 20, 100, 500 }
+#define HTTP_LATENCY_BUCKET_COUNT 6
+// how many distinct clients are counted before we stop adding new ones
+#define HTTP_MAX_TRACKED_CLIENTS 64
+// Retry-After of the 503 for routes whose component isn't initialized yet
+#define HTTP_RETRY_AFTER_SECONDS 2
+
 class HttpServer : public QObject
 {
 Q_OBJECT
@@ -27,13 +41,71 @@ private slots:
   void writeError(QHttpResponse* response, qhttp::TStatusCode errorCode);
 
 private:
-  bool writeFile(const QString& file, QHttpResponse* response);
+  // Writes the file and ends the response, possibly asynchronously
+  bool writeFile(const QString& file, QHttpRequest* request, QHttpResponse* response);
   void handleSoundsRequest(QHttpRequest* request, QHttpResponse* response);
+  void handleRootRequest(QHttpRequest* request, QHttpResponse* response);
+  void handleMetricsRequest(QHttpRequest* request, QHttpResponse* response);
+
+  typedef void (HttpServer::*RequestHandler)(QHttpRequest*, QHttpResponse*);
+
+  struct Route
+  {
+    QString path;
+    RequestHandler handler;
+    // false if only the path itself matches and not everything below it
+    bool prefix;
+    // component the handler needs, requests get a 503 until it is initialized
+    QString component;
+
+    quint64 requests;
+    quint64 bytes;
+    quint64 latency[HTTP_LATENCY_BUCKET_COUNT];
+  };
+
+  // Routes are found in a trie of path segments, so dispatching is one
+  // hash lookup per segment no matter how many routes there are.
+  struct RouteNode
+  {
+    int route;
+    QHash<QString, int> children;
+  };
+
+  void addRoute(const QString& path, RequestHandler handler, bool prefix = true,
+                const QString& component = QString());
+  int findRoute(const QString& path) const;
+  void trackRequest(int route, QHttpRequest* request, QHttpResponse* response);
 
   QHttpServer* m_server;
   QString m_baseUrl;
   quint16 m_port;
   QMimeDatabase m_mime;
+
+  QVector<Route> m_routes;
+  QVector<RouteNode> m_routeNodes;
+  QHash<QString, quint64> m_clientRequests;
+
+  struct CachedFile
+  {
+    // resources are looked up a lot for precompressed variants that don't
+    // exist, so misses are cached as well
+    bool exists;
+    qint64 size;
+    QDateTime modified;
+    QByteArray mime;
+    QByteArray etag;
+    QByteArray lastModified;
+    // only set for small files, the others are streamed from disk
+    QByteArray data;
+    // what data of a resource points into
+    AssetView asset;
+  };
+
+  // Looks up (or stats and caches) a file, returns nullptr if it doesn't exist.
+  const CachedFile* cachedFile(const QString& file);
+
+  // cost is the size of the cached data, so this limits the memory used
+  QCache<QString, CachedFile> m_fileCache;
 };
 
 #endif // HTTPSERVER_H
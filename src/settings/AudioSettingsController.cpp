@@ -31,6 +31,8 @@ void AudioSettingsController::valuesUpdated(const QVariantMap& values)
   QString type = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "devicetype").toString();
 
   audioSection->setValueHidden("channels", false);
+  // only HDMI sinks tell us what they decode
+  audioSection->setValueHidden("passthrough.detect", type != AUDIO_DEVICE_TYPE_HDMI);
 
   if (type == AUDIO_DEVICE_TYPE_BASIC)
   {
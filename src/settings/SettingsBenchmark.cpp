@@ -0,0 +1,215 @@
+#include "SettingsBenchmark.h"
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Paths.h"
+#include "QsLog.h"
+#include "SettingsComponent.h"
+#include "SettingsSection.h"
+#include "utils/AllocationCounter.h"
+#include "utils/BenchmarkReport.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::prepare()
+{
+  QStandardPaths::setTestModeEnabled(true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int SettingsBenchmark::run()
+{
+  SettingsBenchmark benchmark;
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  for (SettingsSection* section : settings.m_sections.values())
+  {
+    if (section->isStorage())
+      continue;
+
+    for (const QString& key : section->allValues().keys())
+      benchmark.m_keys.append(qMakePair(section->sectionName(), key));
+  }
+
+  if (benchmark.m_keys.isEmpty())
+  {
+    fprintf(stderr, "No settings loaded\n");
+    return EXIT_FAILURE;
+  }
+
+  benchmark.populateStorage();
+  printf("%d sections, %d described keys, %d storage sections of %d keys\n", settings.m_sections.size(),
+         benchmark.m_keys.size(), SETTINGS_BENCHMARK_STORAGE_SECTIONS, SETTINGS_BENCHMARK_STORAGE_KEYS);
+
+  benchmark.benchmarkValue();
+  benchmark.benchmarkSetValue();
+  benchmark.benchmarkSetValues();
+  benchmark.benchmarkAllValues();
+  benchmark.benchmarkSave();
+
+  settings.flush();
+  return EXIT_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString SettingsBenchmark::storageSection(int index)
+{
+  return QString("benchmark-storage-%1").arg(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The web client keeps serialized JSON in its storage, so the values are strings of that.
+//
+QString SettingsBenchmark::storageValue(int key, int generation)
+{
+  QString value = QString("{\"id\":%1,\"generation\":%2,\"data\":\"").arg(key).arg(generation);
+  value += QString(SETTINGS_BENCHMARK_STORAGE_VALUE_BYTES - value.size() - 2, QChar('a' + key % 26));
+  return value + "\"}";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::populateStorage()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  for (int i = 0; i < SETTINGS_BENCHMARK_STORAGE_SECTIONS; i++)
+  {
+    QVariantMap values;
+    for (int key = 0; key < SETTINGS_BENCHMARK_STORAGE_KEYS; key++)
+      values.insert(QString("key%1").arg(key), storageValue(key, 0));
+
+    settings.setValues({{"key", storageSection(i)}, {"value", values}});
+  }
+
+  settings.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::benchmarkValue()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  qint64 calls = 0;
+  AllocationCounter counter;
+  QElapsedTimer timer;
+  timer.start();
+  for (int round = 0; round < SETTINGS_BENCHMARK_ROUNDS; round++)
+  {
+    for (const auto& key : m_keys)
+      settings.value(key.first, key.second);
+    calls += m_keys.size();
+  }
+  qint64 nsecs = timer.nsecsElapsed();
+  reportBenchmark("value", calls, nsecs, counter.stop());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::benchmarkSetValue()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  // the web client's own keys, changing how the rest of the player behaves would skew it
+  AllocationCounter counter;
+  QElapsedTimer timer;
+  timer.start();
+  for (int i = 0; i < SETTINGS_BENCHMARK_WRITE_ROUNDS; i++)
+    settings.setValue(SETTINGS_SECTION_WEBCLIENT, QString("benchmark%1").arg(i % 16), storageValue(i % 16, i));
+  qint64 nsecs = timer.nsecsElapsed();
+  reportBenchmark("setValue", SETTINGS_BENCHMARK_WRITE_ROUNDS, nsecs, counter.stop());
+
+  settings.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::benchmarkSetValues()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  // what the web client sends: the whole section, with one of the values changed
+  QList<QVariantMap> sections;
+  for (int i = 0; i < SETTINGS_BENCHMARK_STORAGE_SECTIONS; i++)
+    sections.append(settings.allValues(storageSection(i)).toMap());
+
+  AllocationCounter counter;
+  QElapsedTimer timer;
+  timer.start();
+  for (int i = 0; i < SETTINGS_BENCHMARK_WRITE_ROUNDS; i++)
+  {
+    int index = i % SETTINGS_BENCHMARK_STORAGE_SECTIONS;
+    int key = i % SETTINGS_BENCHMARK_STORAGE_KEYS;
+    sections[index].insert(QString("key%1").arg(key), storageValue(key, i));
+    settings.setValues({{"key", storageSection(index)}, {"value", sections[index]}});
+  }
+  qint64 nsecs = timer.nsecsElapsed();
+  reportBenchmark("setValues (storage section)", SETTINGS_BENCHMARK_WRITE_ROUNDS, nsecs, counter.stop());
+
+  settings.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::benchmarkAllValues()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  AllocationCounter counter;
+  QElapsedTimer timer;
+  timer.start();
+  for (int round = 0; round < SETTINGS_BENCHMARK_SAVE_ROUNDS; round++)
+    settings.allValues();
+  qint64 nsecs = timer.nsecsElapsed();
+  reportBenchmark("allValues (all sections)", SETTINGS_BENCHMARK_SAVE_ROUNDS, nsecs, counter.stop());
+
+  AllocationCounter sectionCounter;
+  timer.restart();
+  for (int round = 0; round < SETTINGS_BENCHMARK_ROUNDS; round++)
+    settings.allValues(storageSection(round % SETTINGS_BENCHMARK_STORAGE_SECTIONS));
+  nsecs = timer.nsecsElapsed();
+  reportBenchmark("allValues (storage section)", SETTINGS_BENCHMARK_ROUNDS, nsecs, sectionCounter.stop());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsBenchmark::benchmarkSave()
+{
+  SettingsComponent& settings = SettingsComponent::Get();
+
+  struct Save
+  {
+    const char* name;
+    const char* written;
+    void (SettingsComponent::*save)();
+    const char* file;
+  };
+
+  const Save saves[] = {
+    { "saveSettings (call)", "saveSettings (on disk)", &SettingsComponent::saveSettings, "plexmediaplayer.conf" },
+    { "saveStorage (call)", "saveStorage (on disk)", &SettingsComponent::saveStorage, "storage.json" },
+  };
+
+  for (const Save& save : saves)
+  {
+    qint64 callNsecs = 0, allocations = 0;
+    QElapsedTimer total;
+    total.start();
+    for (int round = 0; round < SETTINGS_BENCHMARK_SAVE_ROUNDS; round++)
+    {
+      // the allocations are this thread's, the writer thread isn't counted
+      AllocationCounter counter;
+      QElapsedTimer timer;
+      timer.start();
+      (settings.*save.save)();
+      callNsecs += timer.nsecsElapsed();
+      allocations += counter.stop();
+
+      settings.m_writerPool.waitForDone();
+    }
+    qint64 totalNsecs = total.nsecsElapsed();
+
+    reportBenchmark(save.name, SETTINGS_BENCHMARK_SAVE_ROUNDS, callNsecs, allocations < 0 ? -1 : allocations);
+    reportBenchmark(save.written, SETTINGS_BENCHMARK_SAVE_ROUNDS, totalNsecs, -1);
+    printf("%-32s %9lld bytes\n", save.file, (long long)QFileInfo(Paths::dataDir(save.file)).size());
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef SETTINGSBENCHMARK_H
+#define SETTINGSBENCHMARK_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+// each read phase goes through all the keys this many times
+#define SETTINGS_BENCHMARK_ROUNDS 200
+// changes and saves are a lot slower, fewer of them do
+#define SETTINGS_BENCHMARK_WRITE_ROUNDS 2000
+#define SETTINGS_BENCHMARK_SAVE_ROUNDS 50
+// storage the web client could plausibly have built up
+#define SETTINGS_BENCHMARK_STORAGE_SECTIONS 8
+#define SETTINGS_BENCHMARK_STORAGE_KEYS 64
+#define SETTINGS_BENCHMARK_STORAGE_VALUE_BYTES 512
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Times SettingsComponent::value, setValue, setValues, allValues, saveSettings and
+// saveStorage against the real settings description, with storage sections filled
+// the way the web client fills them, and prints ns and allocations per call. The
+// saves are timed both for the call, which serializes on the GUI thread, and until
+// the writer thread has the file on disk. Only built with ENABLE_BENCHMARKS and run
+// with --benchmark-settings, on Qt's test mode profile so the user's settings are
+// left alone.
+//
+class SettingsBenchmark
+{
+public:
+  // before anything touches the settings
+  static void prepare();
+
+  // after the components are initialized, returns the exit code for the process.
+  static int run();
+
+private:
+  SettingsBenchmark() {}
+
+  void populateStorage();
+  void benchmarkValue();
+  void benchmarkSetValue();
+  void benchmarkSetValues();
+  void benchmarkAllValues();
+  void benchmarkSave();
+
+  static QString storageSection(int index);
+  static QString storageValue(int key, int generation);
+
+  QList<QPair<QString, QString>> m_keys;
+};
+
+#endif // SETTINGSBENCHMARK_H
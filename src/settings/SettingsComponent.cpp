@@ -1,33 +1,66 @@
 #include "SettingsComponent.h"
 #include "SettingsSection.h"
+#include "SettingsDescription.h"
+#include "SettingsDescriptionTables.h"
 #include "Paths.h"
 #include "utils/Utils.h"
+#include "utils/Trace.h"
 #include "QsLog.h"
 #include "AudioSettingsController.h"
 #include "Names.h"
 
-#include <QSaveFile>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QList>
 #include <QSettings>
+#include <QRunnable>
+#include <QFile>
+#include <QFileInfo>
+#include <QCoreApplication>
 #include "input/InputComponent.h"
 #include "system/SystemComponent.h"
 #include "Version.h"
+#include "utils/AllocationTracker.h"
+
+#include <string.h>
 
 #define OLDEST_PREVIOUS_VERSION_KEY "oldestPreviousVersion"
+// first bytes of a parsed settings snapshot, bump when the layout changes
+#define SETTINGS_SNAPSHOT_MAGIC 0x504d5332
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-SettingsComponent::SettingsComponent(QObject *parent) : ComponentBase(parent), m_settingsVersion(-1)
+SettingsComponent::SettingsComponent(QObject *parent) : ComponentBase(parent), m_settingsVersion(-1),
+  m_settingsDirty(false), m_storageDirty(false), m_updateDepth(0),
+  m_snapshot(std::make_shared<const SettingsSnapshot>()), m_snapshotDirty(false)
 {
+  m_updateTimer.setSingleShot(true);
+  m_updateTimer.setInterval(SETTINGS_UPDATE_TIMEOUT_MSEC);
+  connect(&m_updateTimer, &QTimer::timeout, this, [=]()
+  {
+    QLOG_WARN() << "Settings update wasn't ended, sending the notifications now";
+    m_updateDepth = 1;
+    endUpdate();
+  });
+
+  m_descriptionTimer.setSingleShot(true);
+  m_descriptionTimer.setInterval(SETTINGS_DESCRIPTION_DELAY_MSEC);
+  connect(&m_descriptionTimer, &QTimer::timeout, this, &SettingsComponent::flushDescriptions);
+
+  m_saveTimer.setSingleShot(true);
+  m_saveTimer.setInterval(SETTINGS_SAVE_DELAY_MSEC);
+  connect(&m_saveTimer, &QTimer::timeout, this, &SettingsComponent::savePending);
+
+  m_writerPool.setMaxThreadCount(1);
+  // don't let the thread go away between writes, they come in bursts
+  m_writerPool.setExpiryTimeout(-1);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void SettingsComponent::componentPostInitialize()
 {
-  InputComponent::Get().registerHostCommand("cycle_setting", this, "cycleSettingCommand");
-  InputComponent::Get().registerHostCommand("set_setting", this, "setSettingCommand");
+  InputComponent::Get().registerHostCommand("cycle_setting", this, &SettingsComponent::cycleSettingCommand);
+  InputComponent::Get().registerHostCommand("set_setting", this, &SettingsComponent::setSettingCommand);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -136,8 +169,8 @@ void SettingsComponent::updatePossibleValues(const QString &sectionID, const QSt
     QLOG_ERROR() << "Section" << sectionID << "is unknown";
     return;
   }
-  section->updatePossibleValues(key, possibleValues);
-  QLOG_DEBUG() << "Updated possible values for:" << key << "to" << possibleValues;
+  if (section->updatePossibleValues(key, possibleValues))
+    QLOG_DEBUG() << "Updated possible values for:" << key << "to" << possibleValues;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -162,17 +195,85 @@ QVariant SettingsComponent::allValues(const QString& section)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static void writeFile(const QString& filename, const QByteArray& data)
+// JSON files we read at startup are kept as compact JSON without comments in the
+// cache dir, so they don't have to be filtered and parsed as text with comments on
+// every launch. (Binary JSON would be quicker still, but it's deprecated and Qt 5.7
+// has no CBOR.) A snapshot is only used if it was made by this version from a source
+// with the same size and modification time.
+struct SnapshotHeader
+{
+  quint32 magic;
+  quint32 version;
+  qint64 size;
+  qint64 modified;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString snapshotPath(const QString& filename)
+{
+  return Paths::cacheDir("settings-" + QFileInfo(filename).fileName() + ".snapshot");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QJsonDocument openJsonSnapshot(const QString& filename, QJsonParseError* err)
 {
-  QSaveFile file(filename);
-  file.open(QIODevice::WriteOnly | QIODevice::Text);
-  file.write(data);
-  if (!file.commit())
+  QFileInfo info(filename);
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SETTINGS_SNAPSHOT_MAGIC;
+  header.version = qHash(Version::GetVersionString());
+  header.size = info.size();
+  header.modified = info.lastModified().toMSecsSinceEpoch();
+
+  QFile snapshot(snapshotPath(filename));
+  if (snapshot.open(QFile::ReadOnly) && snapshot.size() > (qint64)sizeof(header))
+  {
+    const uchar* data = snapshot.map(0, snapshot.size());
+    if (data && memcmp(data, &header, sizeof(header)) == 0)
+    {
+      QByteArray json = QByteArray::fromRawData((const char*)data + sizeof(header), (int)(snapshot.size() - sizeof(header)));
+      QJsonDocument doc = QJsonDocument::fromJson(json);
+      if (!doc.isNull())
+        return doc;
+    }
+
+    QLOG_DEBUG() << "Settings snapshot of" << filename << "is stale";
+  }
+  snapshot.close();
+
+  QJsonDocument doc = Utils::OpenJsonDocument(filename, err);
+  if (!doc.isNull())
   {
-    QLOG_ERROR() << "Could not write" << filename;
+    QByteArray data((const char*)&header, sizeof(header));
+    data.append(doc.toJson(QJsonDocument::Compact));
+    if (!Utils::safelyWriteFile(snapshotPath(filename), data))
+      QLOG_DEBUG() << "Could not write settings snapshot of" << filename;
   }
+
+  return doc;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class SettingsWriter : public QRunnable
+{
+public:
+  SettingsWriter(const QString& filename, const QByteArray& data) : m_filename(filename), m_data(data) {}
+
+  void run() override
+  {
+    if (!Utils::safelyWriteFile(m_filename, m_data))
+      QLOG_ERROR() << "Could not write" << m_filename;
+
+    // the time stamp might not be fine grained enough to catch this
+    QFile::remove(snapshotPath(m_filename));
+  }
+
+private:
+  QString m_filename;
+  QByteArray m_data;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static QJsonObject loadJson(const QString& filename)
 {
@@ -182,7 +283,7 @@ static QJsonObject loadJson(const QString& filename)
     return QJsonObject();
 
   QJsonParseError err;
-  QJsonDocument json = Utils::OpenJsonDocument(filename, &err);
+  QJsonDocument json = openJsonSnapshot(filename, &err);
   if (json.isNull())
   {
     QLOG_ERROR() << "Could not open" << filename << "due to" << err.errorString();
@@ -191,10 +292,10 @@ static QJsonObject loadJson(const QString& filename)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static void writeJson(const QString& filename, const QJsonObject& data, bool pretty = true)
+static void writeJson(QThreadPool& pool, const QString& filename, const QJsonObject& data, bool pretty = true)
 {
   QJsonDocument json(data);
-  writeFile(filename, json.toJson(pretty ? QJsonDocument::Indented : QJsonDocument::Compact));
+  pool.start(new SettingsWriter(filename, json.toJson(pretty ? QJsonDocument::Indented : QJsonDocument::Compact)));
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -209,6 +310,7 @@ void SettingsComponent::load()
 {
   loadConf(Paths::dataDir("plexmediaplayer.conf"), false);
   loadConf(Paths::dataDir("storage.json"), true);
+  publishSnapshot();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -275,6 +377,8 @@ void SettingsComponent::loadConf(const QString& path, bool storage)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SettingsComponent::saveSettings()
 {
+  TRACE_SCOPE("settings", "saveSettings");
+
   if (m_oldestPreviousVersion.isEmpty())
   {
     QLOG_ERROR() << "Not writing settings: uninitialized.\n";
@@ -292,7 +396,8 @@ void SettingsComponent::saveSettings()
   QJsonObject json;
   json.insert("sections", QJsonValue::fromVariant(sections));
   json.insert("version", m_settingsVersion);
-  writeJson(Paths::dataDir("plexmediaplayer.conf"), json);
+  m_settingsDirty = false;
+  writeJson(m_writerPool, Paths::dataDir("plexmediaplayer.conf"), json);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -309,16 +414,130 @@ void SettingsComponent::saveStorage()
   QJsonObject storagejson;
   storagejson.insert("sections", QJsonValue::fromVariant(storage));
   storagejson.insert("version", m_settingsVersion);
-  writeJson(Paths::dataDir("storage.json"), storagejson, false);
+  m_storageDirty = false;
+  writeJson(m_writerPool, Paths::dataDir("storage.json"), storagejson, false);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SettingsComponent::saveSection(SettingsSection* section)
 {
   if (section && section->isStorage())
-    saveStorage();
+  {
+    m_storageDirty = true;
+  }
   else
+  {
+    m_settingsDirty = true;
+
+    if (isUpdating())
+      m_snapshotDirty = true;
+    else
+      publishSnapshot();
+  }
+
+  // don't restart it, so a steady stream of changes still gets written
+  if (!m_saveTimer.isActive())
+    m_saveTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::savePending()
+{
+  if (m_settingsDirty)
     saveSettings();
+  if (m_storageDirty)
+    saveStorage();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::beginUpdate()
+{
+  if (m_updateDepth++ == 0)
+    m_updateTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::endUpdate()
+{
+  if (m_updateDepth == 0)
+  {
+    QLOG_WARN() << "endUpdate() without beginUpdate()";
+    return;
+  }
+
+  if (--m_updateDepth > 0)
+    return;
+
+  m_updateTimer.stop();
+
+  // before the notifications, a listener might hand the change to a thread
+  if (m_snapshotDirty)
+  {
+    m_snapshotDirty = false;
+    publishSnapshot();
+  }
+
+  // listeners might change settings again, those are notified right away
+  QList<SettingsSection*> sections;
+  sections.swap(m_deferredSections);
+  for (SettingsSection* section : sections)
+    section->flushNotifications();
+
+  flushDescriptions();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::publishSnapshot()
+{
+  // allValues() hands out the sections' own cached maps, the unchanged ones are shared
+  QHash<QString, QVariantMap> sections;
+  for (SettingsSection* section : m_sections)
+  {
+    if (!section->isStorage())
+      sections.insert(section->sectionName(), section->allValues());
+  }
+
+  std::atomic_store(&m_snapshot, std::make_shared<const SettingsSnapshot>(sections));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::deferNotifications(SettingsSection* section)
+{
+  if (!m_deferredSections.contains(section))
+    m_deferredSections.append(section);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::queueDescriptionUpdate(SettingsSection* section)
+{
+  if (!m_descriptionSections.contains(section))
+    m_descriptionSections.append(section);
+
+  // an update sends them when it ends
+  if (!isUpdating())
+    m_descriptionTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::flushDescriptions()
+{
+  if (isUpdating())
+    return;
+
+  m_descriptionTimer.stop();
+
+  QList<SettingsSection*> sections;
+  sections.swap(m_descriptionSections);
+  for (SettingsSection* section : sections)
+    emit groupUpdate(section->sectionName(), section->descriptions());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsComponent::flush()
+{
+  m_saveTimer.stop();
+  savePending();
+  m_writerPool.waitForDone();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -336,6 +555,7 @@ QVariant SettingsComponent::value(const QString& sectionID, const QString &key)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SettingsComponent::setValue(const QString& sectionID, const QString &key, const QVariant &value)
 {
+  ALLOCATION_TAG(Settings);
   SettingsSection* section = getSection(sectionID);
   if (!section)
   {
@@ -424,6 +644,8 @@ void SettingsComponent::resetToDefault(const QString &sectionID)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SettingsComponent::resetToDefaultAll()
 {
+  SettingsUpdate update;
+
   for(SettingsSection *section : m_sections)
   {
     section->resetValues();
@@ -458,123 +680,84 @@ QVariantList SettingsComponent::settingDescriptions()
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-bool SettingsComponent::loadDescription()
+static QVariant descriptionVariant(const SettingsDescriptionVariant& value)
 {
-  QJsonParseError err;
-  auto doc = Utils::OpenJsonDocument(":/settings/settings_description.json", &err);
-  if (doc.isNull())
+  switch (value.type)
   {
-    QLOG_ERROR() << "Failed to read settings description:" << err.errorString();
-    throw FatalException("Failed to read settings description!");
+    case SD_TYPE_BOOL:
+      return QVariant(value.number != 0);
+    case SD_TYPE_NUMBER:
+      // what QJsonValue::toVariant() returned for these
+      return QVariant(value.number);
+    case SD_TYPE_STRING:
+      return QVariant(QString::fromUtf8(value.string));
+    case SD_TYPE_JSON:
+      return QJsonDocument::fromJson(value.string).toVariant();
+    default:
+      return QVariant();
   }
+}
 
-  if (!doc.isArray())
-  {
-    QLOG_ERROR() << "The object needs to be an array";
-    return false;
-  }
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool forCurrentPlatform(quint8 platforms)
+{
+  return (platforms & Utils::CurrentPlatform()) == Utils::CurrentPlatform();
+}
 
+/////////////////////////////////////////////////////////////////////////////////////////
+bool SettingsComponent::loadDescription()
+{
+  m_settingsVersion = SETTINGS_DESCRIPTION_VERSION;
   m_sectionIndex = 0;
 
-  for(const QJsonValue& val : doc.array())
+  for (const SettingsDescriptionSection& section : g_settingsSections)
   {
-    if (!val.isObject())
-    {
-      QLOG_ERROR() << "Hoped to find sections in the root array, but they where not JSON objects";
-      return false;
-    }
-
-    QJsonObject section = val.toObject();
-    if (!section.contains("section"))
-    {
-      QLOG_ERROR() << "A section needs to contain the section keyword.";
-      return false;
-    }
-
-    if (section["section"] == "__meta__")
-      m_settingsVersion = section.value("version").toInt();
-    else
-      parseSection(section);
+    // the placeholder of an empty description
+    if (section.name)
+      createSection(section);
   }
 
   return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void SettingsComponent::parseSection(const QJsonObject& sectionObject)
+void SettingsComponent::createSection(const SettingsDescriptionSection& description)
 {
-  QString sectionName = sectionObject.value("section").toString();
-  if (!sectionObject.contains("values") || !sectionObject.value("values").isArray())
-  {
-    QLOG_ERROR() << "section object:" << sectionName << "did not contain a values array";
-    return;
-  }
-
-  int platformMask = platformMaskFromObject(sectionObject);
+  QString sectionName = QString::fromUtf8(description.name);
 
-  auto  section = new SettingsSection(sectionName, (quint8)platformMask, m_sectionIndex ++, this);
-  section->setHidden(sectionObject.value("hidden").toBool(false));
-  section->setStorage(sectionObject.value("storage").toBool(false));
+  auto  section = new SettingsSection(sectionName, description.platforms, m_sectionIndex ++, this);
+  section->setHidden(description.hidden);
+  section->setStorage(description.storage);
 
-  auto values = sectionObject.value("values").toArray();
-  int order = 0;
-  for(auto val : values)
+  for (int i = 0; i < description.valueCount; i++)
   {
-    if (!val.isObject())
-      continue;
-
-    QJsonObject valobj = val.toObject();
-    if (!valobj.contains("value") || !valobj.contains("default") || valobj.value("value").isNull())
-      continue;
+    const SettingsDescriptionValue& valueDescription = g_settingsValues[description.firstValue + i];
 
-    QJsonValue defaults = valobj.value("default");
-    QVariant defaultval = defaults.toVariant();
-    if (defaults.isArray())
+    // Whichever default matches the current platform first is used.
+    QVariant defaultval;
+    for (int d = 0; d < valueDescription.defaultCount; d++)
     {
-      defaultval = QVariant();
-      // Whichever default matches the current platform first is used.
-      for(const auto& v : defaults.toArray())
+      const SettingsDescriptionDefault& entry = g_settingsDefaults[valueDescription.firstDefault + d];
+      if (forCurrentPlatform(entry.platforms))
       {
-        auto vobj = v.toObject();
-        int defPlatformMask = platformMaskFromObject(vobj);
-        if ((defPlatformMask & Utils::CurrentPlatform()) == Utils::CurrentPlatform())
-        {
-          defaultval = vobj.value("value").toVariant();
-          break;
-        }
+        defaultval = descriptionVariant(entry.value);
+        break;
       }
     }
 
-    int vPlatformMask = platformMaskFromObject(valobj);
-    SettingsValue* setting = new SettingsValue(valobj.value("value").toString(), defaultval, (quint8)vPlatformMask, this);
+    SettingsValue* setting = new SettingsValue(QString::fromUtf8(valueDescription.key), defaultval, valueDescription.platforms, this);
     setting->setHasDescription(true);
-    setting->setHidden(valobj.value("hidden").toBool(false));
-    setting->setIndexOrder(order ++);
+    setting->setHidden(valueDescription.hidden);
+    setting->setIndexOrder(i);
 
-    if (valobj.contains("input_type"))
-      setting->setInputType(valobj.value("input_type").toString());
+    if (valueDescription.inputType)
+      setting->setInputType(QString::fromUtf8(valueDescription.inputType));
 
-    if (valobj.contains("possible_values") && valobj.value("possible_values").isArray())
+    for (int o = 0; o < valueDescription.optionCount; o++)
     {
-      auto list = valobj.value("possible_values").toArray();
-      for(const auto& v : list)
-      {
-        int platform = PLATFORM_ANY;
-
-        auto vl = v.toArray();
-        if (vl.size() < 2)
-          continue;
-
-        if (vl.size() == 3 && vl.at(2).isObject())
-        {
-          // platform options
-          QJsonObject options = vl.at(2).toObject();
-          platform = platformMaskFromObject(options);
-        }
-
-        if ((platform & Utils::CurrentPlatform()) == Utils::CurrentPlatform())
-          setting->addPossibleValue(vl.at(1).toString(), vl.at(0).toVariant());
-      }
+      const SettingsDescriptionOption& option = g_settingsOptions[valueDescription.firstOption + o];
+      if (forCurrentPlatform(option.platforms))
+        setting->addPossibleValue(QString::fromUtf8(option.title), descriptionVariant(option.value));
     }
 
     section->registerSetting(setting);
@@ -583,84 +766,15 @@ void SettingsComponent::parseSection(const QJsonObject& sectionObject)
   m_sections.insert(sectionName, section);
 }
 
-/////////////////////////////////////////////////////////////////////////////////////////
-int SettingsComponent::platformMaskFromObject(const QJsonObject& object)
-{
-  int platformMask = PLATFORM_ANY;
-
-  // only include the listed platforms
-  if (object.contains("platforms"))
-  {
-    // start by resetting it to no platforms
-    platformMask = PLATFORM_UNKNOWN;
-
-    QJsonValue platforms = object.value("platforms");
-
-    // platforms can be both array or a single string
-    if (platforms.isArray())
-    {
-      for(const QJsonValue& pl : platforms.toArray())
-      {
-        if (!pl.isString())
-          continue;
-
-        platformMask |= platformFromString(pl.toString());
-      }
-    }
-    else
-    {
-      platformMask = platformFromString(platforms.toString());
-    }
-  }
-  else if (object.contains("platforms_excluded"))
-  {
-    QJsonValue val = object.value("platforms_excluded");
-    if (val.isArray())
-    {
-      for(const QJsonValue& pl : val.toArray())
-      {
-        if (!pl.isString())
-          continue;
-
-        platformMask &= ~platformFromString(pl.toString());
-      }
-    }
-    else
-    {
-      platformMask &= ~platformFromString(val.toString());
-    }
-  }
-
-  return platformMask;
-}
-
-/////////////////////////////////////////////////////////////////////////////////////////
-Platform SettingsComponent::platformFromString(const QString& platformString)
-{
-  if (platformString == "osx")
-    return PLATFORM_OSX;
-  else if (platformString == "windows")
-    return PLATFORM_WINDOWS;
-  else if (platformString == "linux")
-    return PLATFORM_LINUX;
-  else if (platformString == "oe")
-    return PLATFORM_OE;
-  else if (platformString == "oe_rpi")
-    return PLATFORM_OE_RPI;
-  else if (platformString == "oe_x86")
-    return PLATFORM_OE_X86;
-  else if (platformString == "any")
-    return PLATFORM_ANY;
-
-  return PLATFORM_UNKNOWN;
-}
-
 /////////////////////////////////////////////////////////////////////////////////////////
 bool SettingsComponent::componentInitialize()
 {
   if (!loadDescription())
     return false;
 
+  // pending changes must hit the disk before we go away
+  connect(qApp, &QCoreApplication::aboutToQuit, this, &SettingsComponent::flush);
+
   // Must be called before we possibly write the config file.
   setupVersion();
 
@@ -782,6 +896,8 @@ void SettingsComponent::setCommandLineValues(const QStringList& values)
 {
   QLOG_DEBUG() << values;
 
+  SettingsUpdate update;
+
   QString mode = ""; // unset, different from "auto"
 
   for (const QString& value : values)
@@ -2,6 +2,9 @@
 #define SETTINGSCOMPONENT_H
 
 #include <QObject>
+#include <QTimer>
+#include <QThreadPool>
+#include <memory>
 #include "utils/Utils.h"
 #include "ComponentManager.h"
 #include "SettingsValue.h"
@@ -17,13 +20,46 @@
 #define SETTINGS_SECTION_OVERRIDES "overrides"
 #define SETTINGS_SECTION_CEC "cec"
 #define SETTINGS_SECTION_APPLEREMOTE "appleremote"
+#define SETTINGS_SECTION_LIRC "lirc"
 
 #define AUDIO_DEVICE_TYPE_BASIC "basic"
 #define AUDIO_DEVICE_TYPE_SPDIF "spdif"
 #define AUDIO_DEVICE_TYPE_HDMI "hdmi"
 
+// changes are collected for this long before the files are written
+#define SETTINGS_SAVE_DELAY_MSEC 1000
+// an update that wasn't ended after this long is ended for the caller
+#define SETTINGS_UPDATE_TIMEOUT_MSEC 5000
+// Possible values change in bursts (startup, hotplug), a section's description is sent once
+// nothing changed for this long. Every change ends up being sent.
+#define SETTINGS_DESCRIPTION_DELAY_MSEC 100
+
 
 class SettingsSection;
+struct SettingsDescriptionSection;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The values of the settings sections (without the web client's storage) as of one committed
+// change. Never modified once published, so any thread can read it without locking.
+class SettingsSnapshot
+{
+public:
+  SettingsSnapshot() {}
+  explicit SettingsSnapshot(const QHash<QString, QVariantMap>& sections) : m_sections(sections) {}
+
+  QVariant value(const QString& sectionID, const QString& key) const
+  {
+    auto it = m_sections.constFind(sectionID);
+    return (it != m_sections.constEnd()) ? it.value().value(key) : QVariant();
+  }
+
+  QVariantMap allValues(const QString& sectionID) const { return m_sections.value(sectionID); }
+
+private:
+  QHash<QString, QVariantMap> m_sections;
+};
+
+typedef std::shared_ptr<const SettingsSnapshot> SettingsSnapshotPtr;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class SettingsComponent : public ComponentBase
@@ -50,6 +86,11 @@ public:
   Q_INVOKABLE void setValues(const QVariantMap& options);
   Q_INVOKABLE QVariant value(const QString& sectionID, const QString& key);
   Q_INVOKABLE QVariant allValues(const QString& section = "");
+
+  // For threads other than the main one, which must not use value(). A new snapshot is
+  // published after every change, or at endUpdate() for the changes made since beginUpdate().
+  // Keep the returned one around for reads that have to be consistent with each other.
+  SettingsSnapshotPtr snapshot() const { return std::atomic_load(&m_snapshot); }
   // Note: the naming "remove" is a lie - it will remove the affected keys only if they are not
   //       declared in settings_descriptions.json. Also, sections are never removed, even if they
   //       remain empty.
@@ -59,14 +100,28 @@ public:
   Q_INVOKABLE QVariantList settingDescriptions();
   Q_INVOKABLE QString getWebClientUrl(bool desktop);
 
+  // Between beginUpdate() and endUpdate() change notifications are merged,
+  // every section then announces all of its changes at once. Can be nested.
+  Q_INVOKABLE void beginUpdate();
+  Q_INVOKABLE void endUpdate();
+  bool isUpdating() const { return m_updateDepth > 0; }
+  // Called by sections that have notifications waiting for endUpdate().
+  void deferNotifications(SettingsSection* section);
+  // Called by sections whose description changed, groupUpdate() follows once the burst is
+  // over, or with endUpdate().
+  void queueDescriptionUpdate(SettingsSection* section);
+
   // host commands
   Q_SLOT Q_INVOKABLE void cycleSettingCommand(const QString& args);
   Q_SLOT Q_INVOKABLE void setSettingCommand(const QString& args);
 
   void updatePossibleValues(const QString& sectionID, const QString& key, const QVariantList& possibleValues);
 
+  // Serialize the settings and write them on the writer thread.
   void saveSettings();
   void saveStorage();
+  // Write everything that is still pending and wait until it's on disk.
+  Q_SLOT void flush();
   void load();
 
   // Fired when a section's description is updated.
@@ -96,13 +151,18 @@ public:
   }
 
 private:
+  friend class SettingsBenchmark;
+
   explicit SettingsComponent(QObject *parent = nullptr);
+  // Create the sections and values of the compiled settings description.
   bool loadDescription();
-  void parseSection(const QJsonObject& sectionObject);
-  int platformMaskFromObject(const QJsonObject& object);
-  Platform platformFromString(const QString& platformString);
+  void createSection(const SettingsDescriptionSection& description);
+  // Mark the file the section lives in as dirty, it's written a bit later.
   void saveSection(SettingsSection* section);
+  void savePending();
   void setupVersion();
+  // Copy the values into a new snapshot and swap it in for snapshot().
+  void publishSnapshot();
 
   QMap<QString, SettingsSection*> m_sections;
 
@@ -111,7 +171,33 @@ private:
 
   QString m_oldestPreviousVersion;
 
+  bool m_settingsDirty;
+  bool m_storageDirty;
+  QTimer m_saveTimer;
+
+  int m_updateDepth;
+  QList<SettingsSection*> m_deferredSections;
+  QTimer m_updateTimer;
+  QList<SettingsSection*> m_descriptionSections;
+  QTimer m_descriptionTimer;
+  void flushDescriptions();
+
+  SettingsSnapshotPtr m_snapshot;
+  // a section changed during an update
+  bool m_snapshotDirty;
+  // a single thread, so writes of the same file can't overtake each other
+  QThreadPool m_writerPool;
+
   void loadConf(const QString& path, bool storage);
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Scoped SettingsComponent::beginUpdate()/endUpdate()
+class SettingsUpdate
+{
+public:
+  SettingsUpdate() { SettingsComponent::Get().beginUpdate(); }
+  ~SettingsUpdate() { SettingsComponent::Get().endUpdate(); }
+};
+
 #endif // SETTINGSCOMPONENT_H
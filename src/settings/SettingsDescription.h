@@ -0,0 +1,71 @@
+#ifndef SETTINGSDESCRIPTION_H
+#define SETTINGSDESCRIPTION_H
+
+#include <QtGlobal>
+#include "utils/Utils.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// settings_description.json, compiled into tables by scripts/build-settings-description.py at
+// build time (SettingsDescriptionTables.h in the build directory). SettingsComponent creates the
+// sections and values from these, the description isn't parsed at startup.
+//
+// The platforms fields are masks of the PLATFORM_* flags an entry applies to.
+//
+enum SettingsDescriptionType
+{
+  SD_TYPE_NULL,
+  SD_TYPE_BOOL,
+  SD_TYPE_NUMBER,
+  SD_TYPE_STRING,
+  // arrays and objects, as JSON text
+  SD_TYPE_JSON
+};
+
+struct SettingsDescriptionVariant
+{
+  quint8 type;
+  // also the bool, as 0 or 1
+  double number;
+  const char* string;
+};
+
+struct SettingsDescriptionDefault
+{
+  SettingsDescriptionVariant value;
+  quint8 platforms;
+};
+
+struct SettingsDescriptionOption
+{
+  SettingsDescriptionVariant value;
+  const char* title;
+  quint8 platforms;
+};
+
+struct SettingsDescriptionValue
+{
+  const char* key;
+  quint8 platforms;
+  bool hidden;
+  // nullptr if there is none
+  const char* inputType;
+  // in g_settingsDefaults, the first one for the current platform is used
+  int firstDefault;
+  int defaultCount;
+  // in g_settingsOptions
+  int firstOption;
+  int optionCount;
+};
+
+struct SettingsDescriptionSection
+{
+  const char* name;
+  quint8 platforms;
+  bool hidden;
+  bool storage;
+  // in g_settingsValues
+  int firstValue;
+  int valueCount;
+};
+
+#endif // SETTINGSDESCRIPTION_H
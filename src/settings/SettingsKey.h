@@ -0,0 +1,77 @@
+#ifndef SETTINGSKEY_H
+#define SETTINGSKEY_H
+
+#include "SettingsComponent.h"
+#include "SettingsSection.h"
+#include "SettingsValue.h"
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A handle to a single described setting. The section and key are looked up
+// once, on first use, and the value is only converted to T again after it
+// changed, so reading it is a pointer and a generation compare.
+//
+// Handles are meant to be kept around (e.g. file static) and used from the
+// main thread, like the settings themselves.
+//
+template <typename T>
+class SettingsKey
+{
+public:
+  SettingsKey(const char* sectionID, const char* key)
+    : m_sectionID(sectionID), m_key(key), m_value(nullptr), m_resolved(false), m_generation(0), m_cached()
+  {}
+
+  const T& value()
+  {
+    if (!m_resolved)
+      resolve();
+
+    if (m_value && m_value->generation() != m_generation)
+    {
+      m_generation = m_value->generation();
+      m_cached = m_value->value().template value<T>();
+    }
+
+    return m_cached;
+  }
+
+  operator const T&() { return value(); }
+
+  // Call f(const QVariant&) whenever only this setting changes.
+  template <typename F>
+  QMetaObject::Connection onChanged(QObject* context, F f)
+  {
+    if (!m_resolved)
+      resolve();
+
+    if (!m_value)
+      return QMetaObject::Connection();
+
+    return QObject::connect(m_value, &SettingsValue::valueChanged, context, f);
+  }
+
+private:
+  void resolve()
+  {
+    m_resolved = true;
+
+    SettingsSection* section = SettingsComponent::Get().getSection(m_sectionID);
+    if (section)
+      m_value = section->describedValue(m_key);
+
+    if (!m_value)
+      QLOG_ERROR() << "Setting" << m_sectionID << m_key << "has no description, can't use it through a SettingsKey";
+    else
+      m_generation = m_value->generation() - 1;
+  }
+
+  const char* m_sectionID;
+  const char* m_key;
+  SettingsValue* m_value;
+  bool m_resolved;
+  quint32 m_generation;
+  T m_cached;
+};
+
+#endif // SETTINGSKEY_H
@@ -3,9 +3,9 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 SettingsSection::SettingsSection(const QString& sectionID, quint8 platforms, int _orderIndex, QObject* parent)
-  : QObject(parent), m_sectionID(sectionID), m_orderIndex(_orderIndex), m_platform(platforms), m_hidden(false), m_storage(false)
+  : QObject(parent), m_version(1), m_snapshotVersion(0), m_sectionID(sectionID), m_orderIndex(_orderIndex),
+    m_platform(platforms), m_hidden(false), m_storage(false)
 {
-  m_values.clear();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -19,6 +19,55 @@ void SettingsSection::registerSetting(SettingsValue* value)
 
   value->setParent(this);
   m_values[value->key()] = value;
+
+  // a value stored before the description was known
+  auto it = m_storedIndex.constFind(value->key());
+  if (it != m_storedIndex.constEnd())
+  {
+    value->setValue(m_storedValues[it.value()]);
+    m_storedValues[it.value()] = QVariant();
+    m_freeSlots.append(it.value());
+    m_storedIndex.remove(value->key());
+  }
+
+  m_version++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SettingsSection::setValueNoNotify(const QString& key, const QVariant& value)
+{
+  SettingsValue* described = m_values.value(key);
+  if (described)
+  {
+    if (described->value() == value)
+      return false;
+    described->setValue(value);
+  }
+  else
+  {
+    auto it = m_storedIndex.constFind(key);
+    if (it != m_storedIndex.constEnd())
+    {
+      QVariant& stored = m_storedValues[it.value()];
+      if (stored == value)
+        return false;
+      stored = value;
+    }
+    else if (!m_freeSlots.isEmpty())
+    {
+      int slot = m_freeSlots.takeLast();
+      m_storedValues[slot] = value;
+      m_storedIndex.insert(key, slot);
+    }
+    else
+    {
+      m_storedIndex.insert(key, m_storedValues.size());
+      m_storedValues.append(value);
+    }
+  }
+
+  m_version++;
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -28,39 +77,79 @@ void SettingsSection::setValues(const QVariant& values)
   QVariantMap updatedValues;
 
   // values not included in the map are "removed"
-  for(const QString& key : m_values.keys())
+  for (const QString& key : m_values.keys())
+  {
+    if (!map.contains(key))
+      resetValueNoNotify(key, updatedValues);
+  }
+  for (const QString& key : m_storedIndex.keys())
   {
     if (!map.contains(key))
       resetValueNoNotify(key, updatedValues);
   }
 
-  for(const QString& key : map.keys())
+  for (auto it = map.constBegin(); it != map.constEnd(); ++it)
   {
-    if (key.isEmpty())
-      continue;
+    if (!it.key().isEmpty() && setValueNoNotify(it.key(), it.value()))
+      updatedValues.insert(it.key(), it.value());
+  }
 
-    bool haveKey = m_values.contains(key);
-    if (haveKey && m_values[key]->value() == map[key])
-      continue;
+  if (updatedValues.size() > 0)
+    notifyValues(updatedValues, true);
+}
 
-    if (haveKey)
-    {
-      m_values[key]->setValue(map[key]);
-    }
-    else
-    {
-      m_values[key] = new SettingsValue(key, QVariant(), PLATFORM_ANY, this);
-      m_values[key]->setValue(map[key]);
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsSection::notifyValues(const QVariantMap& updatedValues, bool webClient)
+{
+  if (!SettingsComponent::Get().isUpdating())
+  {
+    emitNotifications(updatedValues, webClient ? updatedValues : QVariantMap());
+    return;
+  }
 
-    updatedValues.insert(key, map[key]);
+  for (auto it = updatedValues.constBegin(); it != updatedValues.constEnd(); ++it)
+  {
+    m_pendingValues.insert(it.key(), it.value());
+    if (webClient)
+      m_pendingWebClientValues.insert(it.key(), it.value());
   }
 
-  if (updatedValues.size() > 0)
+  SettingsComponent::Get().deferNotifications(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsSection::flushNotifications()
+{
+  QVariantMap values, webClientValues;
+  values.swap(m_pendingValues);
+  webClientValues.swap(m_pendingWebClientValues);
+
+  emitNotifications(values, webClientValues);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SettingsSection::emitNotifications(const QVariantMap& updatedValues, const QVariantMap& webClientValues)
+{
+  if (!updatedValues.isEmpty())
   {
     emit valuesUpdated(updatedValues);
-    emit SettingsComponent::Get().sectionValueUpdate(m_sectionID, updatedValues);
+
+    for (auto it = updatedValues.constBegin(); it != updatedValues.constEnd(); ++it)
+    {
+      SettingsValue* value = m_values.value(it.key());
+      if (value)
+        emit value->valueChanged(it.value());
+    }
   }
+
+  if (!webClientValues.isEmpty())
+    emit SettingsComponent::Get().sectionValueUpdate(m_sectionID, webClientValues);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SettingsValue* SettingsSection::describedValue(const QString& key) const
+{
+  return m_values.value(key);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -69,6 +158,10 @@ QVariant SettingsSection::defaultValue(const QString& key)
   if (m_values.contains(key))
     return m_values[key]->defaultValue();
 
+  // stored values have no default
+  if (m_storedIndex.contains(key))
+    return QVariant();
+
   QLOG_WARN() << "Looking for defaultValue:" << key << "in section:" << m_sectionID << "but it can't be found";
   return QVariant();
 }
@@ -76,19 +169,29 @@ QVariant SettingsSection::defaultValue(const QString& key)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QVariant SettingsSection::value(const QString& key)
 {
-  if (m_values.contains(key))
-    return m_values[key]->value();
+  SettingsValue* described = m_values.value(key);
+  if (described)
+    return described->value();
+
+  auto it = m_storedIndex.constFind(key);
+  if (it != m_storedIndex.constEnd())
+    return m_storedValues[it.value()];
 
   QLOG_WARN() << "Looking for value:" << key << "in section:" << m_sectionID << "but it can't be found";
   return QVariant();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void SettingsSection::updatePossibleValues(const QString &key, const QVariantList &possibleValues)
+bool SettingsSection::updatePossibleValues(const QString &key, const QVariantList &possibleValues)
 {
-  if (m_values.contains(key))
-    m_values[key]->setPossibleValues(possibleValues);
-  emit SettingsComponent::Get().groupUpdate(m_sectionID, descriptions());
+  SettingsValue* value = m_values.value(key);
+  if (!value || value->possibleValues() == possibleValues)
+    return false;
+
+  // the web client rebuilds the page for each description, so changes are sent together
+  value->setPossibleValues(possibleValues);
+  SettingsComponent::Get().queueDescriptionUpdate(this);
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -105,37 +208,41 @@ bool SettingsSection::setValue(const QString& key, const QVariant& value)
   if (key == "index")
     return false;
 
-  QVariantMap values;
-  // populate with default values (setValues() resets missing values)
-  for(const QString& entry : m_values.keys())
-    values[entry] = m_values[entry]->value();
-
-  values[key] = value;
+  if (key.isEmpty())
+    return false;
 
-  setValues(values);
+  // the same as setValues() with all current values and this one changed, without building them
+  if (setValueNoNotify(key, value))
+  {
+    QVariantMap updatedValues;
+    updatedValues.insert(key, value);
+    notifyValues(updatedValues, true);
+  }
   return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SettingsSection::resetValueNoNotify(const QString& key, QVariantMap& updatedValues)
 {
-  if (!m_values.contains(key))
-    return;
-
-  SettingsValue* val = m_values[key];
-
-  if (val->hasDescription())
+  SettingsValue* val = m_values.value(key);
+  if (val)
   {
     if (val->value() == val->defaultValue())
       return;
     val->setValue(val->defaultValue());
     updatedValues[key] = val->value();
+    m_version++;
+    return;
   }
-  else
-  {
-    m_values[key]->deleteLater();
-    m_values.remove(key);
-  }
+
+  auto it = m_storedIndex.constFind(key);
+  if (it == m_storedIndex.constEnd())
+    return;
+
+  m_storedValues[it.value()] = QVariant();
+  m_freeSlots.append(it.value());
+  m_storedIndex.remove(key);
+  m_version++;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -146,7 +253,7 @@ void SettingsSection::resetValue(const QString &key)
   resetValueNoNotify(key, updatedValues);
 
   if (updatedValues.size() > 0)
-    emit valuesUpdated(updatedValues);
+    notifyValues(updatedValues, false);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -156,20 +263,31 @@ void SettingsSection::resetValues()
 
   for (auto key : m_values.keys())
     resetValueNoNotify(key, updatedValues);
+  for (auto key : m_storedIndex.keys())
+    resetValueNoNotify(key, updatedValues);
 
   if (updatedValues.size() > 0)
-    emit valuesUpdated(updatedValues);
+    notifyValues(updatedValues, false);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const QVariantMap SettingsSection::allValues() const
 {
-  QVariantMap values;
+  // handing out the snapshot is a reference count, the web client asks for all values a lot
+  if (m_snapshotVersion != m_version)
+  {
+    QVariantMap values;
 
-  for(SettingsValue* val : m_values.values())
-    values[val->key()] = val->value();
+    for (SettingsValue* val : m_values)
+      values.insert(val->key(), val->value());
+    for (auto it = m_storedIndex.constBegin(); it != m_storedIndex.constEnd(); ++it)
+      values.insert(it.key(), m_storedValues[it.value()]);
+
+    m_snapshot = values;
+    m_snapshotVersion = m_version;
+  }
 
-  return values;
+  return m_snapshot;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
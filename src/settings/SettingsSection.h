@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QMap>
+#include <QVector>
 #include <QVariant>
 #include "SettingsValue.h"
 #include "SettingsComponent.h"
@@ -15,7 +16,8 @@ public:
   explicit SettingsSection(const QString& sectionID, quint8 platforms = PLATFORM_ANY,
                            int _orderIndex = -1, QObject* parent = nullptr);
 
-  void updatePossibleValues(const QString& key, const QVariantList& possibleValues);
+  // false if they are what the setting has already, then nobody is told
+  bool updatePossibleValues(const QString& key, const QVariantList& possibleValues);
   QVariantList possibleValues(const QString& key);
 
   void setValues(const QVariant& values);
@@ -26,13 +28,21 @@ public:
   bool isHidden() const;
 
   QVariant value(const QString& key);
+  // The value object of a setting from settings_description.json. Those are
+  // never deleted, so the pointer can be kept around. nullptr for others.
+  SettingsValue* describedValue(const QString& key) const;
   QVariant defaultValue(const QString& key);
   QString sectionName() const { return m_sectionID; }
 
+  // Served from a snapshot that is only rebuilt after a value changed.
   const QVariantMap allValues() const;
   const QVariantMap descriptions() const;
 
-  bool isValueHidden(const QString& key) const { return m_values[key]->isHidden(); }
+  bool isValueHidden(const QString& key) const
+  {
+    SettingsValue* value = m_values.value(key);
+    return value ? value->isHidden() : true;
+  }
   int orderIndex() const { return m_orderIndex; }
 
   void setHidden(bool hidden=true)
@@ -54,16 +64,41 @@ public:
 
   Q_SIGNAL void valuesUpdated(const QVariantMap& values);
 
+  // Send what was collected during SettingsComponent::beginUpdate()
+  void flushNotifications();
+
 protected:
+  // true if the value changed
+  bool setValueNoNotify(const QString& key, const QVariant& value);
   // if the value is _not_ removed, _and_ changes, it's added to updatedValues
   void resetValueNoNotify(const QString& key, QVariantMap& updatedValues);
+  // webClient: also announce the values through SettingsComponent::sectionValueUpdate
+  void notifyValues(const QVariantMap& updatedValues, bool webClient);
+  void emitNotifications(const QVariantMap& updatedValues, const QVariantMap& webClientValues);
 
+  // settings from settings_description.json
   QHash<QString, SettingsValue*> m_values;
+
+  // Everything else, mostly what the web client stores. There can be hundreds of these, so
+  // they don't get a SettingsValue each: the values sit in one table, m_storedIndex has their
+  // slots and m_freeSlots the ones of removed values.
+  QHash<QString, int> m_storedIndex;
+  QVector<QVariant> m_storedValues;
+  QVector<int> m_freeSlots;
+
+  // bumped whenever a value changes, allValues() is rebuilt when it doesn't match
+  quint32 m_version;
+  mutable quint32 m_snapshotVersion;
+  mutable QVariantMap m_snapshot;
+
   QString m_sectionID;
   int m_orderIndex;
   quint8 m_platform;
   bool m_hidden;
   bool m_storage;
+
+  QVariantMap m_pendingValues;
+  QVariantMap m_pendingWebClientValues;
 };
 
 #endif // SETTINGSSECTION_H
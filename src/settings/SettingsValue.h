@@ -19,6 +19,7 @@ public:
     , m_hidden(true)
     , m_indexOrder(0)
     , m_hasDescription(false)
+    , m_generation(0)
   {}
 
   explicit SettingsValue(const QString& _key, QVariant _defaultValue=QVariant(), quint8 platforms = PLATFORM_ANY, QObject* parent = nullptr)
@@ -30,6 +31,7 @@ public:
     , m_hidden(true)
     , m_indexOrder(0)
     , m_hasDescription(false)
+    , m_generation(0)
   {}
 
   const QString& key() const { return m_key; }
@@ -44,6 +46,7 @@ public:
   void setValue(const QVariant& value)
   {
     m_value = value;
+    m_generation++;
   }
 
   const QVariant& defaultValue() const
@@ -54,8 +57,13 @@ public:
   void setDefaultValue(const QVariant& defaultValue)
   {
     m_defaultValue = defaultValue;
+    m_generation++;
   }
 
+  // Changes whenever value() might have, so SettingsKey can tell when its
+  // converted copy is stale.
+  quint32 generation() const { return m_generation; }
+
   const QVariantList& possibleValues() const
   {
     return m_possibleValues;
@@ -128,6 +136,9 @@ public:
 
   bool hasDescription() { return m_hasDescription; }
 
+  // Emitted by the section after the value changed.
+  Q_SIGNAL void valueChanged(const QVariant& value);
+
 private:
   QString m_key;
   QVariant m_value;
@@ -139,6 +150,7 @@ private:
 
   int m_indexOrder;
   bool m_hasDescription;
+  quint32 m_generation;
 };
 
 #endif //KONVERGO_SETTINGS_VALUE_H
@@ -0,0 +1,192 @@
+#include "HelperStatus.h"
+#include "Paths.h"
+#include "QsLog.h"
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+
+#include <cstring>
+
+#define HELPER_STATUS_MAGIC 0x504d5053
+// bump when the layout below changes
+#define HELPER_STATUS_VERSION 1
+#define HELPER_STATUS_ERROR_SIZE 256
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct HelperStatusBlock
+{
+  quint32 magic;
+  quint32 version;
+
+  // monotonic msec, 0 if that side isn't running
+  QAtomicInteger<qint64> mainHeartbeat;
+  QAtomicInteger<qint64> mainBusyUntil;
+  QAtomicInteger<qint64> helperHeartbeat;
+
+  QAtomicInteger<int> crashQueueDepth;
+
+  // only accessed with the shared memory locked
+  char lastError[HELPER_STATUS_ERROR_SIZE];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static qint64 now()
+{
+  QElapsedTimer timer;
+  timer.start();
+  return timer.msecsSinceReference();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HelperStatus& HelperStatus::Get()
+{
+  static HelperStatus status;
+  return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Named like the helper socket, so every user gets their own.
+HelperStatus::HelperStatus() : m_memory(Paths::socketName("pmpHelperStatus")), m_block(nullptr), m_attachFailed(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HelperStatus::~HelperStatus()
+{
+  m_memory.detach();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool HelperStatus::attach()
+{
+  if (m_block)
+    return true;
+  if (m_attachFailed)
+    return false;
+
+  // whoever comes first creates it, zeroed, the other one attaches
+  bool created = m_memory.create(sizeof(HelperStatusBlock));
+  if (!created && (m_memory.error() != QSharedMemory::AlreadyExists || !m_memory.attach()))
+  {
+    QLOG_WARN() << "Failed to set up the helper status:" << m_memory.errorString();
+    m_attachFailed = true;
+    return false;
+  }
+
+  if (m_memory.size() < (int)sizeof(HelperStatusBlock))
+  {
+    QLOG_WARN() << "Helper status is from an incompatible version, ignoring it";
+    m_memory.detach();
+    m_attachFailed = true;
+    return false;
+  }
+
+  auto block = (HelperStatusBlock*)m_memory.data();
+
+  m_memory.lock();
+  if (created || block->magic != HELPER_STATUS_MAGIC || block->version != HELPER_STATUS_VERSION)
+  {
+    std::memset((void*)block, 0, sizeof(HelperStatusBlock));
+    block->magic = HELPER_STATUS_MAGIC;
+    block->version = HELPER_STATUS_VERSION;
+  }
+  m_memory.unlock();
+
+  m_block = block;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::mainHeartbeat()
+{
+  if (attach())
+    m_block->mainHeartbeat.storeRelease(now());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::setMainBusy(int msec)
+{
+  if (attach())
+    m_block->mainBusyUntil.storeRelease(now() + msec);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::mainExited()
+{
+  if (attach())
+    m_block->mainHeartbeat.storeRelease(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::helperHeartbeat()
+{
+  if (attach())
+    m_block->helperHeartbeat.storeRelease(now());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::setCrashQueueDepth(int depth)
+{
+  if (attach())
+    m_block->crashQueueDepth.storeRelease(depth);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HelperStatus::setLastError(const QString& error)
+{
+  if (!attach())
+    return;
+
+  QByteArray utf8 = error.toUtf8().left(HELPER_STATUS_ERROR_SIZE - 1);
+
+  m_memory.lock();
+  std::memcpy(m_block->lastError, utf8.constData(), utf8.size());
+  m_block->lastError[utf8.size()] = '\0';
+  m_memory.unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HelperStatus::MainState HelperStatus::mainState()
+{
+  if (!attach())
+    return MainGone;
+
+  qint64 heartbeat = m_block->mainHeartbeat.loadAcquire();
+  if (heartbeat == 0)
+    return MainGone;
+
+  qint64 time = now();
+  if (time - heartbeat < HELPER_STATUS_STALE_MSEC)
+    return MainAlive;
+
+  return time < m_block->mainBusyUntil.loadAcquire() ? MainBusy : MainHung;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool HelperStatus::helperAlive()
+{
+  if (!attach())
+    return false;
+
+  qint64 heartbeat = m_block->helperHeartbeat.loadAcquire();
+  return heartbeat != 0 && now() - heartbeat < HELPER_STATUS_STALE_MSEC;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int HelperStatus::crashQueueDepth()
+{
+  return attach() ? m_block->crashQueueDepth.loadAcquire() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString HelperStatus::lastError()
+{
+  if (!attach())
+    return QString();
+
+  m_memory.lock();
+  QString error = QString::fromUtf8(m_block->lastError, (int)strnlen(m_block->lastError, HELPER_STATUS_ERROR_SIZE));
+  m_memory.unlock();
+
+  return error;
+}
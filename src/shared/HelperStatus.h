@@ -0,0 +1,61 @@
+#ifndef KONVERGO_HELPERSTATUS_H
+#define KONVERGO_HELPERSTATUS_H
+
+#include <QSharedMemory>
+#include <QString>
+
+// each side beats this often, rarely enough not to keep an idle box awake
+#define HELPER_STATUS_HEARTBEAT_MSEC 5000
+// and is considered stuck if it didn't for this long
+#define HELPER_STATUS_STALE_MSEC (3 * HELPER_STATUS_HEARTBEAT_MSEC)
+
+struct HelperStatusBlock;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Status shared between the main application and the helper in a small block of
+// shared memory, so either side can see how the other one is doing without
+// asking over the socket. Timestamps are from the monotonic clock, which is the
+// same for both processes. Every field has a single writer.
+//
+class HelperStatus
+{
+public:
+  enum MainState
+  {
+    MainGone,
+    MainAlive,
+    MainBusy,
+    MainHung
+  };
+
+  static HelperStatus& Get();
+
+  // Written by the main application. The heartbeat comes from the main thread,
+  // so it stops when the event loop is blocked. Before doing something known
+  // to block, setMainBusy() tells the helper not to worry for that long.
+  void mainHeartbeat();
+  void setMainBusy(int msec);
+  void mainExited();
+
+  // Written by the helper
+  void helperHeartbeat();
+  void setCrashQueueDepth(int depth);
+  void setLastError(const QString& error);
+
+  MainState mainState();
+  bool helperAlive();
+  int crashQueueDepth();
+  QString lastError();
+
+private:
+  HelperStatus();
+  ~HelperStatus();
+  bool attach();
+
+  QSharedMemory m_memory;
+  HelperStatusBlock* m_block;
+  // don't retry, and warn, on every heartbeat
+  bool m_attachFailed;
+};
+
+#endif //KONVERGO_HELPERSTATUS_H
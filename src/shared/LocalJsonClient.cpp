@@ -7,10 +7,21 @@
 #include "LocalJsonServer.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////
-LocalJsonClient::LocalJsonClient(const QString serverPath, QObject* parent) : QLocalSocket(parent)
+LocalJsonClient::LocalJsonClient(const QString serverPath, QObject* parent, bool framed) : QLocalSocket(parent)
 {
   m_serverPath = Paths::socketName(serverPath);
   connect(this, &QLocalSocket::readyRead, this, &LocalJsonClient::readyRead);
+
+  if (framed)
+    connect(this, &QLocalSocket::connected, this, &LocalJsonClient::requestFraming);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void LocalJsonClient::requestFraming()
+{
+  // a reconnect starts over with JSON
+  LocalJsonServer::setFramed(this, false);
+  LocalJsonServer::sendMessage({{ "command", LOCAL_FRAMING_COMMAND }, { "framing", LOCAL_FRAMING_DATASTREAM }}, this);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -30,5 +41,14 @@ void LocalJsonClient::readyRead()
 {
   QVariantList list = LocalJsonServer::readFromSocket(this);
   for(const QVariant& msg : list)
-    emit messageReceived(msg.toMap());
+  {
+    QVariantMap map = msg.toMap();
+    if (map.size() == 1 && map.value("framing").toString() == LOCAL_FRAMING_DATASTREAM)
+    {
+      LocalJsonServer::setFramed(this, true);
+      continue;
+    }
+
+    emit messageReceived(map);
+  }
 }
@@ -11,7 +11,9 @@ class LocalJsonClient : public QLocalSocket
 {
   Q_OBJECT
 public:
-  explicit LocalJsonClient(const QString serverPath, QObject* parent = nullptr);
+  // With framed set, binary frames are requested from the server as soon as
+  // we are connected. Until it agrees, messages are still sent as JSON.
+  explicit LocalJsonClient(const QString serverPath, QObject* parent = nullptr, bool framed = true);
   void connectToServer();
   bool sendMessage(const QVariantMap& message);
 
@@ -20,6 +22,7 @@ Q_SIGNALS:
 
 private:
   Q_SLOT void readyRead();
+  Q_SLOT void requestFraming();
   QString m_serverPath;
 };
 
@@ -6,6 +6,9 @@
 #include "Paths.h"
 #include "QsLog.h"
 
+#include <QDataStream>
+#include <QtEndian>
+
 /////////////////////////////////////////////////////////////////////////////////////////
 LocalJsonServer::LocalJsonServer(const QString& serverName, QObject* parent) : QObject(parent)
 {
@@ -46,22 +49,105 @@ void LocalJsonServer::serverClientConnected()
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Per socket outgoing queue, owned by the socket.
+class LocalSocketWriter : public QObject
+{
+public:
+  explicit LocalSocketWriter(QLocalSocket* socket) : QObject(socket), m_socket(socket), m_dropped(0)
+  {
+    connect(socket, &QLocalSocket::bytesWritten, this, &LocalSocketWriter::flush);
+  }
+
+  static LocalSocketWriter* forSocket(QLocalSocket* socket)
+  {
+    LocalSocketWriter* writer = socket->findChild<LocalSocketWriter*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!writer)
+      writer = new LocalSocketWriter(socket);
+    return writer;
+  }
+
+  bool queue(const QByteArray& data)
+  {
+    if (m_pending.isEmpty() && m_socket->bytesToWrite() < LOCAL_SOCKET_WRITE_CHUNK)
+      return (m_socket->write(data) == data.size());
+
+    if (m_socket->bytesToWrite() + m_pending.size() + data.size() > LOCAL_SOCKET_HIGH_WATER)
+    {
+      if (++m_dropped >= LOCAL_SOCKET_MAX_DROPS)
+      {
+        QLOG_WARN() << "Peer on" << m_socket->serverName() << "isn't reading, disconnecting it";
+        m_pending.clear();
+        m_socket->abort();
+      }
+      else if (m_dropped == 1)
+      {
+        QLOG_WARN() << "Peer on" << m_socket->serverName() << "is falling behind, dropping messages";
+      }
+      return false;
+    }
+
+    m_pending.append(data);
+    return true;
+  }
+
+private:
+  void flush()
+  {
+    if (m_socket->bytesToWrite() >= LOCAL_SOCKET_WRITE_CHUNK)
+      return;
+
+    if (!m_pending.isEmpty())
+    {
+      m_socket->write(m_pending);
+      m_pending.clear();
+    }
+    else if (m_socket->bytesToWrite() == 0)
+    {
+      // caught up again
+      m_dropped = 0;
+    }
+  }
+
+  QLocalSocket* m_socket;
+  QByteArray m_pending;
+  int m_dropped;
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////
-bool LocalJsonServer::sendMessage(const QVariantMap& message, QLocalSocket* socket)
+QByteArray LocalJsonServer::encodeMessage(const QVariantMap& message, bool framed)
 {
+  if (framed)
+  {
+    QByteArray data(LOCAL_FRAME_HEADER_SIZE, LOCAL_FRAME_MARKER);
+    QDataStream stream(&data, QIODevice::WriteOnly | QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << QVariant(message);
+
+    qToBigEndian<quint32>(data.size() - LOCAL_FRAME_HEADER_SIZE, (uchar*)data.data() + 1);
+    return data;
+  }
+
   QJsonObject obj = QJsonObject::fromVariantMap(message);
 
   if (obj.isEmpty())
-    return false;
+    return QByteArray();
 
   QJsonDocument doc(obj);
   QByteArray data = doc.toJson(QJsonDocument::Compact);
   data.append("\r\n");
 
-  if (!data.isEmpty())
-    return (socket->write(data) == data.size());
+  return data;
+}
 
-  return false;
+/////////////////////////////////////////////////////////////////////////////////////////
+bool LocalJsonServer::sendMessage(const QVariantMap& message, QLocalSocket* socket)
+{
+  QByteArray data = encodeMessage(message, isFramed(socket));
+  if (data.isEmpty())
+    return false;
+
+  return LocalSocketWriter::forSocket(socket)->queue(data);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -73,7 +159,21 @@ void LocalJsonServer::clientReadyRead()
 
   QVariantList messages = readFromSocket(socket);
   for(const QVariant& msg : messages)
-    emit messageReceived(msg.toMap());
+  {
+    QVariantMap map = msg.toMap();
+    if (map.value("command").toString() == LOCAL_FRAMING_COMMAND)
+    {
+      if (map.value("framing").toString() == LOCAL_FRAMING_DATASTREAM && !isFramed(socket))
+      {
+        // the acknowledgement is the last thing we send as JSON
+        sendMessage({{ "framing", LOCAL_FRAMING_DATASTREAM }}, socket);
+        setFramed(socket, true);
+      }
+      continue;
+    }
+
+    emit messageReceived(map);
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -81,8 +181,51 @@ QVariantList LocalJsonServer::readFromSocket(QLocalSocket* socket)
 {
   QVariantList lst;
 
-  while (socket->canReadLine())
+  for (;;)
   {
+    char marker;
+    if (socket->peek(&marker, 1) != 1)
+      break;
+
+    if (marker == LOCAL_FRAME_MARKER)
+    {
+      uchar header[LOCAL_FRAME_HEADER_SIZE];
+      if (socket->peek((char*)header, LOCAL_FRAME_HEADER_SIZE) != LOCAL_FRAME_HEADER_SIZE)
+        break;
+
+      quint32 length = qFromBigEndian<quint32>(header + 1);
+      if (length > LOCAL_FRAME_MAX_SIZE)
+      {
+        QLOG_WARN() << "Frame from client is too large:" << length << "- disconnecting";
+        socket->abort();
+        break;
+      }
+
+      if (socket->bytesAvailable() < LOCAL_FRAME_HEADER_SIZE + length)
+        break;
+
+      socket->skip(LOCAL_FRAME_HEADER_SIZE);
+      QByteArray frame = socket->read(length);
+
+      QDataStream stream(frame);
+      stream.setVersion(QDataStream::Qt_5_0);
+
+      QVariant message;
+      stream >> message;
+
+      if (stream.status() != QDataStream::Ok)
+      {
+        QLOG_WARN() << "Failed to decode frame from client";
+        continue;
+      }
+
+      lst << message;
+      continue;
+    }
+
+    if (!socket->canReadLine())
+      break;
+
     QByteArray data = socket->readLine();
     if (!data.isNull())
     {
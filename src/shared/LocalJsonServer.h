@@ -10,6 +10,26 @@
 #include <QJsonObject>
 #include <QJsonDocument>
 
+// Messages are newline terminated JSON by default. A client can ask for
+// binary frames by sending {"command": "setFraming", "framing": "datastream"},
+// which the server acknowledges with {"framing": "datastream"} before it
+// switches. Frames are LOCAL_FRAME_MARKER, a big endian quint32 length and a
+// QDataStream serialized QVariant. Peers that don't know about this just
+// never ask or never acknowledge and keep talking JSON.
+#define LOCAL_FRAMING_COMMAND "setFraming"
+#define LOCAL_FRAMING_DATASTREAM "datastream"
+#define LOCAL_FRAME_MARKER '\0'
+#define LOCAL_FRAME_HEADER_SIZE 5
+// don't let a broken peer make us buffer forever
+#define LOCAL_FRAME_MAX_SIZE (16 * 1024 * 1024)
+
+// Outgoing messages are written right away while the socket keeps up, and
+// merged into one write while it doesn't. Past the high water mark new
+// messages are dropped, and a peer that keeps us dropping is disconnected.
+#define LOCAL_SOCKET_WRITE_CHUNK (64 * 1024)
+#define LOCAL_SOCKET_HIGH_WATER (1024 * 1024)
+#define LOCAL_SOCKET_MAX_DROPS 100
+
 class LocalJsonServer : public QObject
 {
   Q_OBJECT
@@ -17,8 +37,13 @@ public:
   explicit LocalJsonServer(const QString& serverName, QObject* parent = nullptr);
 
   bool listen();
+  // Returns false if the message couldn't be encoded or was dropped.
   static bool sendMessage(const QVariantMap& message, QLocalSocket* socket);
   static QVariantList readFromSocket(QLocalSocket* socket);
+
+  // Once set, sendMessage() writes binary frames to this socket.
+  static void setFramed(QLocalSocket* socket, bool framed) { socket->setProperty("localJsonFramed", framed); }
+  static bool isFramed(QLocalSocket* socket) { return socket->property("localJsonFramed").toBool(); }
   QString errorString() const { return m_server->errorString(); }
 
 Q_SIGNALS:
@@ -30,6 +55,8 @@ private Q_SLOTS:
   void clientReadyRead();
 
 private:
+  static QByteArray encodeMessage(const QVariantMap& message, bool framed);
+
   QString m_serverName;
   QLocalServer* m_server;
   QList<QLocalSocket*> m_clientSockets;
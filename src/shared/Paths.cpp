@@ -5,7 +5,11 @@
 #include "settings/SettingsSection.h"
 #include "Paths.h"
 
+#include <functional>
+
 #include <QDir>
+#include <QHash>
+#include <QMutex>
 #include <QStandardPaths>
 #include <QGuiApplication>
 #include <QsLog.h>
@@ -28,6 +32,48 @@ static QDir writableLocation(QStandardPaths::StandardLocation loc)
   return d;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// The base directories don't change while we run, and neither does what is installed
+// next to the binary. Both are looked up once, since every lookup costs a couple of
+// stat() calls, which are slow on the flash storage of embedded boxes. These are
+// used from worker threads too.
+struct PathCache
+{
+  QMutex lock;
+  QString dataDir, cacheDir, logDir;
+  // file -> where resourceDir() found it
+  QHash<QString, QString> resources;
+};
+
+static PathCache g_pathCache;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Paths::invalidateCache()
+{
+  QMutexLocker lock(&g_pathCache.lock);
+  g_pathCache.dataDir.clear();
+  g_pathCache.cacheDir.clear();
+  g_pathCache.logDir.clear();
+  g_pathCache.resources.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QString cachedDir(QString& cached, const std::function<QString()>& resolve)
+{
+  QMutexLocker lock(&g_pathCache.lock);
+  if (cached.isEmpty())
+    cached = resolve();
+  return cached;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QString filePath(const QString& dir, const QString& file)
+{
+  if (file.isEmpty())
+    return dir;
+  return QDir(dir).filePath(file);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Try a couple of different strategies to find the file we are looking for.
 // 1) By looking next to the application binary
@@ -35,7 +81,7 @@ static QDir writableLocation(QStandardPaths::StandardLocation loc)
 // 3) By looking in PREFIX/share/plexmediaplayer
 // 4) By looking in PREFIX/plexmediaplayer
 //
-QString Paths::resourceDir(const QString& file)
+static QString findResource(const QString& file)
 {
   auto appResourceDir = QGuiApplication::applicationDirPath() + "/";
   auto prefixDir = QString(PREFIX);
@@ -56,42 +102,63 @@ QString Paths::resourceDir(const QString& file)
   return appResourceDir + file;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+QString Paths::resourceDir(const QString& file)
+{
+  {
+    QMutexLocker lock(&g_pathCache.lock);
+    auto it = g_pathCache.resources.constFind(file);
+    if (it != g_pathCache.resources.constEnd())
+      return it.value();
+  }
+
+  QString path = findResource(file);
+
+  QMutexLocker lock(&g_pathCache.lock);
+  g_pathCache.resources.insert(file, path);
+  return path;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 QString Paths::dataDir(const QString& file)
 {
-  QDir d = writableLocation(QStandardPaths::GenericDataLocation);
-  if (file.isEmpty())
-    return d.absolutePath();
-  return d.filePath(file);
+  return filePath(cachedDir(g_pathCache.dataDir, []()
+  {
+    return writableLocation(QStandardPaths::GenericDataLocation).absolutePath();
+  }), file);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 QString Paths::cacheDir(const QString& file)
 {
-  QDir d = writableLocation(QStandardPaths::GenericCacheLocation);
-  if (file.isEmpty())
-    return d.absolutePath();
-  return d.filePath(file);
+  return filePath(cachedDir(g_pathCache.cacheDir, []()
+  {
+    return writableLocation(QStandardPaths::GenericCacheLocation).absolutePath();
+  }), file);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 QString Paths::logDir(const QString& file)
 {
+  QString dir = cachedDir(g_pathCache.logDir, []()
+  {
 #ifdef Q_OS_MAC
-  QDir ldir = QDir(QStandardPaths::locate(QStandardPaths::HomeLocation, "", QStandardPaths::LocateDirectory));
-  ldir.mkpath(ldir.absolutePath() + "/Library/Logs/" + Names::MainName());
-  ldir.cd("Library/Logs/" + Names::MainName());
-  return ldir.filePath(file);
+    QDir ldir = QDir(QStandardPaths::locate(QStandardPaths::HomeLocation, "", QStandardPaths::LocateDirectory));
+    ldir.mkpath(ldir.absolutePath() + "/Library/Logs/" + Names::MainName());
+    ldir.cd("Library/Logs/" + Names::MainName());
 #else
-  QDir ldir = writableLocation(QStandardPaths::GenericDataLocation);
-  ldir.mkpath(ldir.absolutePath() + "/logs");
-  ldir.cd("logs");
-  return ldir.filePath(file);
+    QDir ldir = writableLocation(QStandardPaths::GenericDataLocation);
+    ldir.mkpath(ldir.absolutePath() + "/logs");
+    ldir.cd("logs");
 #endif
+    return ldir.absolutePath();
+  });
+
+  return filePath(dir, file);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-QString Paths::socketName(const QString& serverName)
+static QString userName()
 {
   QString userName = qgetenv("USER");
 
@@ -100,10 +167,26 @@ QString Paths::socketName(const QString& serverName)
   if(userName.isEmpty())
     userName = "unknown";
 
+  return userName;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString Paths::socketName(const QString& serverName)
+{
+#ifdef Q_OS_UNIX
+  return QString("/tmp/pmp_%1_%2.sock").arg(serverName).arg(userName());
+#else
+  return QString("pmp_%1_%2.sock").arg(serverName).arg(userName());
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QString Paths::lockFileName(const QString& serverName)
+{
 #ifdef Q_OS_UNIX
-  return QString("/tmp/pmp_%1_%2.sock").arg(serverName).arg(userName);
+  return QString("/tmp/pmp_%1_%2.lock").arg(serverName).arg(userName());
 #else
-  return QString("pmp_%1_%2.sock").arg(serverName).arg(userName);
+  return QDir::temp().filePath(QString("pmp_%1_%2.lock").arg(serverName).arg(userName()));
 #endif
 }
 
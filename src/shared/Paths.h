@@ -16,8 +16,13 @@ namespace Paths
   QString cacheDir(const QString& file = QString());
   QString logDir(const QString& file = QString());
   QString socketName(const QString& serverName);
+  QString lockFileName(const QString& serverName);
   QString soundsPath(const QString& sound);
   QString webClientPath(const QString& mode = "tv");
+
+  // The directories above are resolved once, and files found by resourceDir()
+  // are remembered. Call this if any of them might have moved.
+  void invalidateCache();
 };
 
 #endif //KONVERGO_PATHS_H
@@ -6,6 +6,7 @@
 #define KONVERGO_UNIQUEAPPLICATION_H
 
 #include <QObject>
+#include <QLockFile>
 #include "Paths.h"
 #include "LocalJsonServer.h"
 #include "LocalJsonClient.h"
@@ -17,7 +18,8 @@ class UniqueApplication : public QObject
 {
   Q_OBJECT
 public:
-  explicit UniqueApplication(QObject* parent = nullptr, const QString& socketname = SOCKET_NAME) : QObject(parent)
+  explicit UniqueApplication(QObject* parent = nullptr, const QString& socketname = SOCKET_NAME) : QObject(parent),
+    m_server(nullptr), m_lock(nullptr)
   {
     m_socketName = socketname;
   }
@@ -37,37 +39,57 @@ public:
       throw FatalException("Failed to listen to uniqueApp socket: " + m_server->errorString());
   }
 
+  // The lock decides, it doesn't wait for anything: a lock left behind by a crashed
+  // instance is taken over, since its process is gone. The socket is only used to
+  // bring the running instance to the front.
   bool ensureUnique()
   {
+    m_lock = new QLockFile(Paths::lockFileName(m_socketName));
+    // a running instance holds it for as long as it likes
+    m_lock->setStaleLockTime(0);
+
+    if (m_lock->tryLock(0))
+    {
+      listen();
+      return true;
+    }
+
+    if (m_lock->error() != QLockFile::LockFailedError)
+    {
+      // can't tell, so don't stand in the way of starting
+      qWarning("Can't create the lock file %s, assuming we are unique", qPrintable(Paths::lockFileName(m_socketName)));
+      listen();
+      return true;
+    }
+
     auto socket = new LocalJsonClient(m_socketName, this);
     socket->connectToServer();
 
-    // we will just assume that the app isn't running if we get a error here
-    if (!socket->waitForConnected(1000))
+    // it's still starting up if it isn't listening yet, then it's in front anyway
+    if (socket->waitForConnected(1000))
     {
-      if (socket->error() != QLocalSocket::SocketTimeoutError)
-      {
-        // since we are unique we will start to listen and claim this socket.
-        listen();
-        return true;
-      }
+      QVariantMap m;
+      m.insert("command", "appStart");
+      socket->sendMessage(m);
+      socket->waitForBytesWritten(2000);
     }
 
-    QVariantMap m;
-    m.insert("command", "appStart");
-    socket->sendMessage(m);
-    socket->waitForBytesWritten(2000);
-
     socket->close();
     socket->deleteLater();
 
     return false;
   }
 
+  ~UniqueApplication() override
+  {
+    delete m_lock;
+  }
+
   Q_SIGNAL void otherApplicationStarted();
 
 private:
   LocalJsonServer* m_server;
+  QLockFile* m_lock;
   QString m_socketName;
 };
 
@@ -0,0 +1,215 @@
+#include "DeltaPatch.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSaveFile>
+
+#include <string.h>
+
+#ifdef HAVE_MINIZIP
+#include <zlib.h>
+#endif
+
+#include "QsLog.h"
+
+#define DELTA_MAGIC "PMPDELTA"
+#define DELTA_HEADER_SIZE 32
+#define DELTA_CHUNK_SIZE (256 * 1024)
+
+#ifdef HAVE_MINIZIP
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static qint64 offtin(const uchar* buf)
+{
+  qint64 y = buf[7] & 0x7f;
+  for (int i = 6; i >= 0; i--)
+    y = y * 256 + buf[i];
+
+  return (buf[7] & 0x80) ? -y : y;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One of the three blocks, inflated straight from the mapped patch.
+class PatchBlock
+{
+public:
+  PatchBlock(const uchar* data, qint64 size) : m_stream(), m_ok(false)
+  {
+    m_stream.next_in = (Bytef*)data;
+    m_stream.avail_in = (uInt)size;
+    m_ok = (inflateInit(&m_stream) == Z_OK);
+  }
+
+  ~PatchBlock()
+  {
+    if (m_ok)
+      inflateEnd(&m_stream);
+  }
+
+  bool read(char* out, qint64 size)
+  {
+    m_stream.next_out = (Bytef*)out;
+    m_stream.avail_out = (uInt)size;
+
+    while (m_ok && m_stream.avail_out > 0)
+    {
+      int result = inflate(&m_stream, Z_NO_FLUSH);
+      if (result == Z_STREAM_END)
+        break;
+      if (result != Z_OK)
+        m_ok = false;
+    }
+
+    return m_ok && m_stream.avail_out == 0;
+  }
+
+private:
+  z_stream m_stream;
+  bool m_ok;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString hashMapped(const uchar* data, qint64 size)
+{
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  for (qint64 pos = 0; pos < size; pos += DELTA_CHUNK_SIZE)
+    hash.addData((const char*)data + pos, (int)qMin((qint64)DELTA_CHUNK_SIZE, size - pos));
+  return hash.result().toHex();
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DeltaPatch::Apply(const QString& basePath, const QString& baseHash, const QString& patchPath,
+                       const QString& targetPath, const QString& targetHash, QString* error)
+{
+#ifdef HAVE_MINIZIP
+  QFile base(basePath);
+  QFile patch(patchPath);
+  if (!base.open(QIODevice::ReadOnly) || !patch.open(QIODevice::ReadOnly))
+  {
+    *error = "can't open the base package or the patch";
+    return false;
+  }
+
+  qint64 baseSize = base.size();
+  qint64 patchSize = patch.size();
+  const uchar* old = baseSize > 0 ? base.map(0, baseSize) : nullptr;
+  const uchar* header = patchSize >= DELTA_HEADER_SIZE ? patch.map(0, patchSize) : nullptr;
+  if (!old || !header)
+  {
+    *error = "can't map the base package or the patch";
+    return false;
+  }
+
+  if (hashMapped(old, baseSize) != baseHash)
+  {
+    *error = "the base package isn't the one the patch was made for";
+    return false;
+  }
+
+  qint64 ctrlSize = offtin(header + 8);
+  qint64 diffSize = offtin(header + 16);
+  qint64 newSize = offtin(header + 24);
+  if (memcmp(header, DELTA_MAGIC, 8) != 0 || ctrlSize < 0 || diffSize < 0 || newSize < 0 ||
+      DELTA_HEADER_SIZE + ctrlSize + diffSize > patchSize)
+  {
+    *error = "not a patch";
+    return false;
+  }
+
+  const uchar* blocks = header + DELTA_HEADER_SIZE;
+  PatchBlock ctrl(blocks, ctrlSize);
+  PatchBlock diff(blocks + ctrlSize, diffSize);
+  PatchBlock extra(blocks + ctrlSize + diffSize, patchSize - DELTA_HEADER_SIZE - ctrlSize - diffSize);
+
+  QSaveFile target(targetPath);
+  if (!target.open(QIODevice::WriteOnly))
+  {
+    *error = "can't write " + targetPath;
+    return false;
+  }
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  QByteArray buffer(DELTA_CHUNK_SIZE, 0);
+  qint64 oldPos = 0, newPos = 0;
+
+  while (newPos < newSize)
+  {
+    uchar control[24];
+    if (!ctrl.read((char*)control, sizeof(control)))
+    {
+      *error = "truncated control block";
+      return false;
+    }
+
+    // x bytes of diff added to the old data, y bytes extra, then seek the old data by z
+    qint64 x = offtin(control), y = offtin(control + 8), z = offtin(control + 16);
+    if (x < 0 || y < 0 || newPos + x + y > newSize)
+    {
+      *error = "corrupt control block";
+      return false;
+    }
+
+    for (qint64 left = x; left > 0;)
+    {
+      int count = (int)qMin(left, (qint64)DELTA_CHUNK_SIZE);
+      if (!diff.read(buffer.data(), count))
+      {
+        *error = "truncated diff block";
+        return false;
+      }
+
+      for (int i = 0; i < count; i++)
+      {
+        qint64 pos = oldPos + i;
+        if (pos >= 0 && pos < baseSize)
+          buffer[i] = (char)(buffer[i] + old[pos]);
+      }
+
+      hash.addData(buffer.constData(), count);
+      target.write(buffer.constData(), count);
+      oldPos += count;
+      left -= count;
+    }
+    newPos += x;
+
+    for (qint64 left = y; left > 0;)
+    {
+      int count = (int)qMin(left, (qint64)DELTA_CHUNK_SIZE);
+      if (!extra.read(buffer.data(), count))
+      {
+        *error = "truncated extra block";
+        return false;
+      }
+
+      hash.addData(buffer.constData(), count);
+      target.write(buffer.constData(), count);
+      left -= count;
+    }
+    newPos += y;
+    oldPos += z;
+  }
+
+  if (QString(hash.result().toHex()) != targetHash)
+  {
+    *error = "the rebuilt package has the wrong hash";
+    return false;
+  }
+
+  if (!target.commit())
+  {
+    *error = "can't write " + targetPath + ": " + target.errorString();
+    return false;
+  }
+
+  QLOG_DEBUG() << "Rebuilt" << targetPath << "from a" << patchSize << "byte patch";
+  return true;
+#else
+  Q_UNUSED(basePath);
+  Q_UNUSED(baseHash);
+  Q_UNUSED(patchPath);
+  Q_UNUSED(targetPath);
+  Q_UNUSED(targetHash);
+  *error = "built without zlib";
+  return false;
+#endif
+}
@@ -0,0 +1,28 @@
+#ifndef DELTAPATCH_H
+#define DELTAPATCH_H
+
+#include <QString>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Rebuilds an update package from the package of the installed version and a binary
+// patch, so only the patch has to be downloaded. The patch is bsdiff 4 with the bzip2
+// streams swapped for zlib ones, since that's what we link anyway:
+//
+//   "PMPDELTA"   8 bytes
+//   ctrl size    8 bytes, compressed size of the control block
+//   diff size    8 bytes, compressed size of the diff block
+//   new size     8 bytes, size of the rebuilt file
+//   control, diff and extra block, each a zlib stream
+//
+// The numbers are bsdiff's sign and magnitude little endian. Only available with zlib
+// (HAVE_MINIZIP), without it Apply() always fails and the full package is used.
+//
+namespace DeltaPatch
+{
+  // Writes targetPath, which is only put in place if the SHA1 of the base and of the
+  // result match. Blocks for a while, so not on the GUI thread.
+  bool Apply(const QString& basePath, const QString& baseHash, const QString& patchPath,
+             const QString& targetPath, const QString& targetHash, QString* error);
+}
+
+#endif // DELTAPATCH_H
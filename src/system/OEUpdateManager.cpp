@@ -1,15 +1,27 @@
 #include <QProcess>
 #include <QDir>
+#include <QFile>
+#include <string.h>
 #include "QsLog.h"
 #include "OEUpdateManager.h"
 #include "SystemComponent.h"
 
+#define TAR_BLOCK_SIZE 512
+// longer than any path in an update, anything bigger is not a name
+#define TAR_MAX_LONG_NAME 4096
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QString OEUpdateManager::HaveUpdate()
 {
   return "";
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void OEUpdateManager::CleanupUpdates()
+{
+  CleanupTrash();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool OEUpdateManager::applyUpdate(const QString& version)
 {
@@ -25,25 +37,20 @@ void OEUpdateManager::doUpdate(const QString& version)
 
   QStringList updateFiles = packageDir.entryList(QStringList( "*.tar"), QDir::Files, QDir::Time);
 
-  // make sure we remove all the eventually remaining downloads
+  // make sure we remove all the eventually remaining downloads, without waiting for it
   QDir rootDir(GetPath("", "", false));
-
   foreach(auto updateDir, rootDir.entryList(QStringList("*"), QDir::Dirs | QDir::NoDotAndDotDot))
   {
-      QDir checkDir(rootDir.absolutePath() + updateDir);
-      if (checkDir != QDir(GetPath("", version, false)))
-      {
-          if (!checkDir.removeRecursively()) {
-              QLOG_ERROR() << "Failed to remove directory" << checkDir.path();
-          }
-      }
+    QString checkPath = rootDir.absoluteFilePath(updateDir);
+    if (QDir(checkPath) != QDir(GetPath("", version, false)))
+      RemoveDirAsync(checkPath);
   }
 
   if (updateFiles.size())
   {
-    // copy the update files to /storage/.update
+    // move the update file to /storage/.update, a rename as both are on /storage
     QString destUpdatePath = "/storage/.update/" + updateFiles.at(0);
-    if (packageDir.rename(packagePath + updateFiles.at(0), destUpdatePath))
+    if (StageFile(packagePath + updateFiles.at(0), destUpdatePath))
     {
       if (isMiniUpdateArchive(destUpdatePath))
       {
@@ -53,34 +60,86 @@ void OEUpdateManager::doUpdate(const QString& version)
       }
       else
       {
-        // remove the update package
-        QDir updateDir(GetPath("", version, false));
-        if (!updateDir.removeRecursively()) {
-            QLOG_ERROR() << "Failed to remove directory" << updateDir.path();
-        }
+        // remove the update package, what's left after the reboot is swept by CleanupUpdates()
+        RemoveDirAsync(GetPath("", version, false));
 
         // now reboot to do the update
         QLOG_DEBUG() << "Rebooting to apply system update " << destUpdatePath;
         QProcess::startDetached("reboot");
       }
     }
+    else
+    {
+      QLOG_ERROR() << "Failed to move the update to" << destUpdatePath;
+    }
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool OEUpdateManager::isMiniUpdateArchive(QString archivePath)
+static qint64 tarNumber(const char* field, int size)
 {
-  QProcess process;
+  // octal, NUL or space terminated
+  qint64 value = 0;
+  for (int i = 0; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+    value = value * 8 + (field[i] - '0');
+  return value;
+}
 
-  process.start("/bin/tar", QStringList() << "-tf" << archivePath);
-  if (process.waitForFinished(1000) && (process.exitCode() == 0))
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Walks the tar headers and seeks over the file data, so only a block per entry is read
+// from storage no matter how big the system image in there is.
+//
+bool OEUpdateManager::isMiniUpdateArchive(QString archivePath)
+{
+  QFile archive(archivePath);
+  if (!archive.open(QIODevice::ReadOnly))
   {
-    QByteArray output = process.readAllStandardOutput();
-    return output.contains(QByteArray("bin/") + Names::MainName().toUtf8());
+    QLOG_ERROR() << "Unable to open update archive" << archivePath << ":" << archive.errorString();
+    return false;
   }
-  else
+
+  QByteArray binary = QByteArray("bin/") + Names::MainName().toUtf8();
+  QByteArray longName;
+  char header[TAR_BLOCK_SIZE];
+
+  while (archive.read(header, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE)
   {
-    QLOG_ERROR() << "Unable to list update archive files : " << QString(process.readAllStandardError());
+    // the archive ends with empty blocks
+    if (header[0] == '\0')
+      break;
+
+    qint64 size = tarNumber(header + 124, 12);
+    char type = header[156];
+
+    QByteArray name;
+    if (!longName.isEmpty())
+    {
+      name = longName;
+      longName.clear();
+    }
+    else
+    {
+      name = QByteArray(header, (int)qstrnlen(header, 100));
+      // ustar keeps the directory part of long paths in a prefix
+      if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0')
+        name = QByteArray(header + 345, (int)qstrnlen(header + 345, 155)) + "/" + name;
+    }
+
+    qint64 padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+    // GNU long names are the data of an entry of their own, in front of the real one
+    if (type == 'L' && size < TAR_MAX_LONG_NAME)
+    {
+      QByteArray data = archive.read(padded);
+      longName = QByteArray(data.constData(), (int)qstrnlen(data.constData(), (int)qMin(size, (qint64)data.size())));
+      continue;
+    }
+
+    if (name.contains(binary))
+      return true;
+
+    if (!archive.seek(archive.pos() + padded))
+      break;
   }
 
   return false;
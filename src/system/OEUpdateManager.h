@@ -10,6 +10,8 @@ public:
   ~OEUpdateManager() override {};
 
   QString HaveUpdate() override;
+  // doUpdate() removes the old downloads itself, this only sweeps what it left behind
+  void CleanupUpdates() override;
   bool applyUpdate(const QString &version) override;
   void doUpdate(const QString& version) override;
 
@@ -1,10 +1,15 @@
 #include <QSysInfo>
 #include <QProcess>
 #include <QMap>
-#include <QtNetwork/qnetworkinterface.h>
 #include <QGuiApplication>
 #include <QDesktopServices>
 #include <QDir>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QDateTime>
+#ifdef Q_OS_WIN
+#include <QLocalSocket>
+#endif
 
 #include "input/InputComponent.h"
 #include "SystemComponent.h"
@@ -16,6 +21,17 @@
 #include "Paths.h"
 #include "Names.h"
 #include "utils/Utils.h"
+#include "utils/NetworkState.h"
+#include "utils/BandwidthEstimator.h"
+#include "utils/MemoryPressure.h"
+#include "player/CodecsComponent.h"
+#include "player/PlayerComponent.h"
+#include "display/DisplayComponent.h"
+#include "remote/RemoteComponent.h"
+#include "utils/ProcessSampler.h"
+#include "utils/AllocationTracker.h"
+#include "utils/Trace.h"
+#include "utils/LogArchive.h"
 
 #define MOUSE_TIMEOUT 5 * 1000
 
@@ -41,7 +57,7 @@ QMap<SystemComponent::PlatformArch, QString> g_platformArchNames = {
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-SystemComponent::SystemComponent(QObject* parent) : ComponentBase(parent), m_platformType(platformTypeUnknown), m_platformArch(platformArchUnknown), m_doLogMessages(false), m_cursorVisible(true), m_scale(1)
+SystemComponent::SystemComponent(QObject* parent) : ComponentBase(parent), m_platformType(platformTypeUnknown), m_platformArch(platformArchUnknown), m_doLogMessages(false), m_cursorVisible(true), m_webDesktopMode(false), m_scale(1), m_capabilitiesGeneration(-1)
 {
   m_mouseOutTimer = new QTimer(this);
   m_mouseOutTimer->setSingleShot(true);
@@ -69,8 +85,20 @@ SystemComponent::SystemComponent(QObject* parent) : ComponentBase(parent), m_pla
 
   connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_AUDIO), &SettingsSection::valuesUpdated, [=]()
   {
+    m_capabilitiesGeneration = -1;
+    emit capabilitiesChanged(getCapabilitiesString());
+  });
+
+  connect(&BandwidthEstimator::Get(), &BandwidthEstimator::maxBitrateChanged, this, [=]()
+  {
+    m_capabilitiesGeneration = -1;
     emit capabilitiesChanged(getCapabilitiesString());
   });
+
+  connect(&MemoryPressure::Get(), &MemoryPressure::levelChanged, this, [=](MemoryPressure::Level level)
+  {
+    emit memoryPressureChanged(level);
+  });
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -82,6 +110,32 @@ bool SystemComponent::componentInitialize()
   // Hide mouse pointer on any keyboard input
   connect(&InputComponent::Get(), &InputComponent::receivedInput, [=]() { setCursorVisibility(false); });
 
+  m_webDesktopMode = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "webMode").toString() == "desktop";
+  connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_MAIN), &SettingsSection::valuesUpdated,
+          [=](const QVariantMap& values)
+  {
+    if (values.contains("webMode"))
+      m_webDesktopMode = values["webMode"].toString() == "desktop";
+  });
+
+#ifdef Q_OS_WIN
+  // There are no signals to send us on Windows, connecting to this pipe is the SIGUSR2
+  // equivalent. Only the same user gets to do that.
+  m_diagnosticsServer = new QLocalServer(this);
+  m_diagnosticsServer->setSocketOptions(QLocalServer::UserAccessOption);
+  connect(m_diagnosticsServer, &QLocalServer::newConnection, [=]()
+  {
+    while (QLocalSocket* socket = m_diagnosticsServer->nextPendingConnection())
+    {
+      socket->disconnectFromServer();
+      socket->deleteLater();
+      dumpDiagnostics();
+    }
+  });
+  if (!m_diagnosticsServer->listen(Paths::socketName("pmpDiagnostics")))
+    QLOG_WARN() << "Failed to listen for diagnostics requests:" << m_diagnosticsServer->errorString();
+#endif
+
   return true;
 }
 
@@ -94,9 +148,9 @@ void SystemComponent::crashApp()
 /////////////////////////////////////////////////////////////////////////////////////////
 void SystemComponent::componentPostInitialize()
 {
-  InputComponent::Get().registerHostCommand("crash!", this, "crashApp");
-  InputComponent::Get().registerHostCommand("script", this, "runUserScript");
-  InputComponent::Get().registerHostCommand("message", this, "hostMessage");
+  InputComponent::Get().registerHostCommand("crash!", this, &SystemComponent::crashApp);
+  InputComponent::Get().registerHostCommand("script", this, &SystemComponent::runUserScript);
+  InputComponent::Get().registerHostCommand("message", this, &SystemComponent::hostMessage);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -182,7 +236,7 @@ void SystemComponent::info(QString text)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SystemComponent::setCursorVisibility(bool visible)
 {
-  if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "webMode") == "desktop")
+  if (m_webDesktopMode)
     visible = true;
 
   if (visible == m_cursorVisible)
@@ -248,6 +302,55 @@ QString SystemComponent::debugInformation()
   return debugInfo;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+void SystemComponent::dumpDiagnostics()
+{
+  QString diagnostics = debugInformation();
+  diagnostics += DisplayComponent::Get().debugInformation();
+  diagnostics += PlayerComponent::Get().diagnosticsInformation();
+  diagnostics += RemoteComponent::Get().diagnosticsInformation();
+  diagnostics += InputComponent::Get().latencyInformation();
+  diagnostics += ProcessSampler::Get().debugInformation();
+  diagnostics += AllocationTracker::summary();
+
+  QLOG_INFO() << "Diagnostics:";
+  for (const QString& line : diagnostics.split('\n'))
+    QLOG_INFO() << "  " << qPrintable(line);
+
+  ProcessSampler::Get().dumpToLog();
+  Trace::Snapshot();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+class LogExporter : public QRunnable
+{
+public:
+  explicit LogExporter(const QString& path) : m_path(path) {}
+
+  void run() override
+  {
+    bool success = LogArchive::ExportBundle(m_path);
+    if (success)
+      QLOG_INFO() << "Exported logs to" << m_path;
+    else
+      QLOG_WARN() << "Failed to export logs to" << m_path;
+
+    QMetaObject::invokeMethod(&SystemComponent::Get(), "logsExported", Qt::QueuedConnection,
+                              Q_ARG(QString, success ? m_path : QString()));
+  }
+
+private:
+  QString m_path;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void SystemComponent::exportLogs()
+{
+  QString name = QString("%1-logs-%2.zip").arg(Names::MainName())
+                                          .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+  QThreadPool::globalInstance()->start(new LogExporter(Paths::logDir(name)));
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 int SystemComponent::networkPort() const
 {
@@ -258,16 +361,9 @@ int SystemComponent::networkPort() const
 QStringList SystemComponent::networkAddresses() const
 {
   QStringList list;
-  for(const QHostAddress& address : QNetworkInterface::allAddresses())
-  {
-    if (! address.isLoopback() && (address.protocol() == QAbstractSocket::IPv4Protocol ||
-                                   address.protocol() == QAbstractSocket::IPv6Protocol))
-    {
-      auto s = address.toString();
-      if (!s.startsWith("fe80::"))
-        list << s;
-    }
-  }
+  // loopback and link-local addresses are already left out
+  for(const QHostAddress& address : NetworkState::Get().addresses())
+    list << address.toString();
 
   return list;
 }
@@ -335,15 +431,129 @@ void SystemComponent::hello(const QString& version)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-#define BASESTR "protocols=shoutcast,http-video;videoDecoders=h264{profile:high&resolution:2160&level:52};audioDecoders=mp3,aac,dts{bitrate:800000&channels:%1},ac3{bitrate:800000&channels:%2}"
+#ifdef TARGET_RPI
+#define CAPS_MAX_RESOLUTION "1080"
+#else
+#define CAPS_MAX_RESOLUTION "2160"
+#endif
+// what 10 bit formats are left with in software, once hardware decoding failed their probe
+#define CAPS_SOFTWARE_RESOLUTION 1080
+
+struct CapabilityCodec
+{
+  const char* name;   // FFmpeg name, as in the codec list
+  const char* params; // attributes appended in braces, may be empty
+  bool baseline;      // advertised before the codecs were probed
+  // %r is replaced by the resolution hardware decoding was probed with (see
+  // Codecs::hardwareDecodeMaxResolution()), CAPS_MAX_RESOLUTION until it was
+  bool probedResolution;
+};
+
+// The formats the server knows, in the order they're advertised. A format is
+// only listed if a decoder for it was probed (or can be downloaded on demand).
+// %1 and %2 are the DTS and AC3 channel counts.
+static const CapabilityCodec g_capsVideoCodecs[] =
+{
+  { "h264", "profile:high&resolution:" CAPS_MAX_RESOLUTION "&level:52", true, false },
+  { "hevc", "profile:main10&resolution:%r&level:153", false, true },
+  { "vp9", "profile:2&resolution:%r", false, true },
+  { "vp8", "", false, false },
+  { "mpeg4", "", false, false },
+  { "msmpeg4v3", "", false, false },
+  { "mpeg2video", "", false, false },
+  { "vc1", "", false, false },
+  { "wmv3", "", false, false },
+};
+
+static const CapabilityCodec g_capsAudioCodecs[] =
+{
+  { "mp3", "", true, false },
+  { "aac", "", true, false },
+  { "flac", "", false, false },
+  { "alac", "", false, false },
+  { "vorbis", "", false, false },
+  { "opus", "", false, false },
+  { "dts", "bitrate:800000&channels:%1", true, false },
+  { "ac3", "bitrate:800000&channels:%2", true, false },
+  { "eac3", "", false, false },
+  { "truehd", "", false, false },
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QString capabilityResolution(const QString& format)
+{
+  bool probed = false;
+  QSize max = Codecs::hardwareDecodeMaxResolution(format, &probed);
+  if (!probed)
+    return CAPS_MAX_RESOLUTION;
+
+  // Software decoding of main10 and profile 2 doesn't keep up with 4K on most machines.
+  int height = max.isEmpty() ? CAPS_SOFTWARE_RESOLUTION : qMax(max.height(), CAPS_SOFTWARE_RESOLUTION);
+  return QString::number(qMin(height, QString(CAPS_MAX_RESOLUTION).toInt()));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QString capabilityDecoders(const CapabilityCodec* codecs, size_t count)
+{
+  // Codecs aren't probed until the player is initialized.
+  bool probed = !Codecs::getCachedCodecList().isEmpty();
+
+  QStringList decoders;
+  for (size_t i = 0; i < count; i++)
+  {
+    bool available = !probed && codecs[i].baseline;
+    for (const CodecDriver& driver : Codecs::findCodecsByFormat(Codecs::getCachedCodecList(), CodecType::Decoder, codecs[i].name))
+    {
+      // Missing external codecs are fetched before playback starts.
+      if (driver.present || driver.external)
+      {
+        available = true;
+        break;
+      }
+    }
+    if (!available)
+      continue;
+
+    // (The names are the same ones the server uses here, "dts" included.)
+    QString decoder = codecs[i].name;
+    if (codecs[i].params[0])
+    {
+      QString params = codecs[i].params;
+      if (codecs[i].probedResolution)
+        params.replace("%r", capabilityResolution(codecs[i].name));
+      decoder += "{" + params + "}";
+    }
+    decoders << decoder;
+  }
+  return decoders.join(",");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void SystemComponent::codecsProbed()
+{
+  m_capabilitiesGeneration = -1;
+  emit capabilitiesChanged(getCapabilitiesString());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap SystemComponent::networkThroughput(const QString& url)
+{
+  return BandwidthEstimator::Get().summary(url.isEmpty() ? QString() : BandwidthEstimator::serverKey(QUrl(url)));
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
 QString SystemComponent::getCapabilitiesString()
 {
-  auto capstring = QString(BASESTR);
+  int generation = Codecs::cachedCodecListGeneration();
+  if (generation == m_capabilitiesGeneration)
+    return m_capabilities;
+
   auto channels = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "channels").toString();
-  auto dtsenabled = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.dts").toBool();
-  auto ac3enabled = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.ac3").toBool();
+  auto detected = PlayerComponent::DetectedPassthroughCodecs();
+  auto dtsenabled = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.dts").toBool() ||
+                    detected.contains("dts") || detected.contains("dts-hd");
+  auto ac3enabled = SettingsComponent::Get().value(SETTINGS_SECTION_AUDIO, "passthrough.ac3").toBool() ||
+                    detected.contains("ac3");
 
   // Assume that auto means that we want to select multi-channel tracks by default.
   // So really only disable it when 2.0 is selected.
@@ -358,5 +568,20 @@ QString SystemComponent::getCapabilitiesString()
   else if (ac3enabled)
     ac3channels = 8;
 
-  return capstring.arg(dtschannels).arg(ac3channels);
+  QString audioDecoders = capabilityDecoders(g_capsAudioCodecs, sizeof(g_capsAudioCodecs) / sizeof(g_capsAudioCodecs[0]));
+  // Only the placeholders of the listed codecs are present, so replace them by hand.
+  audioDecoders.replace("%1", QString::number(dtschannels)).replace("%2", QString::number(ac3channels));
+
+  m_capabilities = "protocols=shoutcast,http-video;videoDecoders=" +
+                   capabilityDecoders(g_capsVideoCodecs, sizeof(g_capsVideoCodecs) / sizeof(g_capsVideoCodecs[0])) +
+                   ";audioDecoders=" + audioDecoders;
+
+  int maxBitrate = BandwidthEstimator::Get().maxBitrate();
+  if (maxBitrate > 0)
+    m_capabilities += ";maxBitrate=" + QString::number(maxBitrate);
+  // Not probed yet, so build it again next time.
+  m_capabilitiesGeneration = Codecs::getCachedCodecList().isEmpty() ? -1 : generation;
+
+  QLOG_DEBUG() << "Capabilities:" << m_capabilities;
+  return m_capabilities;
 }
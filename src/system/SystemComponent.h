@@ -3,6 +3,9 @@
 
 #include "ComponentManager.h"
 #include <QTimer>
+#ifdef Q_OS_WIN
+#include <QLocalServer>
+#endif
 #include "utils/Utils.h"
 #include "Paths.h"
 #include "Names.h"
@@ -24,6 +27,7 @@ public:
   bool componentExport() override { return true; }
   const char* componentName() override { return "system"; }
   bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "settings", "input" }; }
   void componentPostInitialize() override;
 
   Q_INVOKABLE QVariantMap systemInformation() const;
@@ -38,6 +42,15 @@ public:
 
   Q_INVOKABLE QString debugInformation();
 
+  // Logs everything the debug overlay shows plus the remote state and the process
+  // samples, and writes a trace snapshot if tracing. Triggered by SIGUSR2 or, on
+  // Windows, by connecting to the pmpDiagnostics named pipe.
+  void dumpDiagnostics();
+
+  // Zips the logs and session records for support, on a worker thread. logsExported()
+  // has the path of the bundle once it's written.
+  Q_INVOKABLE void exportLogs();
+
   Q_INVOKABLE QStringList networkAddresses() const;
   Q_INVOKABLE int networkPort() const;
 
@@ -50,8 +63,17 @@ public:
   // called by the web-client when everything is properly inited
   Q_INVOKABLE void hello(const QString& version);
 
+  // What we can direct play, built from the probed decoders. Cached until the
+  // codec list, the audio settings or the bitrate hint change. maxBitrate (kbps) is
+  // what the server that was played from last can likely stream, if that's known.
   Q_INVOKABLE QString getCapabilitiesString();
+
+  // Estimated throughput to the server of url, see BandwidthEstimator::summary(). An empty
+  // url is the server that was played from last.
+  Q_INVOKABLE QVariantMap networkThroughput(const QString& url);
   Q_SIGNAL void capabilitiesChanged(const QString& capabilities);
+  // The background decoder probe found the resolution limits, queued from its thread.
+  Q_SLOT void codecsProbed();
   Q_SIGNAL void userInfoChanged();
 
   // possible os types type enum
@@ -93,6 +115,11 @@ signals:
   void hostMessage(const QString& message);
   void settingsMessage(const QString& setting, const QString& value);
   void scaleChanged(qreal scale);
+  // The system is short on memory (level 1 is low, 2 critical) or fine again (0). The web
+  // client should drop what it can rebuild, like cached images and views off screen.
+  void memoryPressureChanged(int level);
+  // empty if the bundle couldn't be written
+  void logsExported(const QString& path);
 
 private:
   explicit SystemComponent(QObject* parent = nullptr);
@@ -103,13 +130,21 @@ private:
   bool platformIsLinux() const { return m_platformType == platformTypeLinux; }
 
   QTimer* m_mouseOutTimer;
+#ifdef Q_OS_WIN
+  QLocalServer* m_diagnosticsServer;
+#endif
   PlatformType m_platformType;
   PlatformArch m_platformArch;
   bool m_doLogMessages;
   QString m_authenticationToken;
   QString m_webClientVersion;
   bool m_cursorVisible;
+  // main.webMode is "desktop", cached since the cursor is updated on every mouse move
+  bool m_webDesktopMode;
   qreal m_scale;
+  QString m_capabilities;
+  // Codecs::cachedCodecListGeneration() m_capabilities was built from
+  int m_capabilitiesGeneration;
 
 };
 
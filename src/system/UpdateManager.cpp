@@ -4,10 +4,15 @@
 #include <QStandardPaths>
 #include <QCoreApplication>
 #include <QProcess>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QRunnable>
 #include "UpdateManager.h"
 #include "utils/Utils.h"
 #include "utils/HelperLauncher.h"
 #include "system/SystemComponent.h"
+#include "core/Version.h"
 
 #ifdef KONVERGO_OPENELEC
 #include "OEUpdateManager.h"
@@ -15,8 +20,15 @@
 
 #ifdef Q_OS_WIN
 #include "UpdateManagerWin32.h"
+#else
+#include <unistd.h>
 #endif
 
+// directories touched more recently than this are left alone by CleanupUpdates()
+#define UPDATE_CLEANUP_MIN_AGE_SECS (60 * 60)
+// directories given to RemoveDirAsync() are renamed to this, plus a unique suffix
+#define UPDATE_TRASH_PREFIX "_trash-"
+
 UpdateManager* g_updateManager;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,33 +51,71 @@ UpdateManager* UpdateManager::Get()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QString UpdateManager::HaveUpdate()
 {
-  QDir updateDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/updates/");
-  if (!updateDir.exists())
+  QFile marker(MarkerPath());
+  if (!marker.open(QIODevice::ReadOnly))
   {
-    QLOG_DEBUG() << "No Update directory found, exiting";
+    QLOG_DEBUG() << "No pending update";
     return "";
   }
-  QStringList nonAppliedUpdates;
+
+  QString version = QString::fromUtf8(marker.readAll()).trimmed();
+  marker.close();
+
+  // check if this version has been applied
+  if (!version.isEmpty() && QFile::exists(GetPath("_readyToApply", version, false)))
+  {
+    QLOG_DEBUG() << version << "is not applied";
+    return version;
+  }
+
+  QLOG_DEBUG() << "Removing stale update marker for:" << version;
+  QFile::remove(MarkerPath());
+  return "";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdateManager::CleanupUpdates()
+{
+  QDir updateDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/updates/");
+  if (!updateDir.exists())
+    return;
+
+  CleanupTrash();
+
+  bool marked = QFile::exists(MarkerPath());
+  bool newest = true;
 
   // sort update directories, sort by the newest directory first, that way
-  // we apply the latest update downloaded.
+  // we mark the latest update downloaded.
   //
-  for(const QString& dir : updateDir.entryList(QDir::NoDotAndDotDot | QDir::Dirs, QDir::Time))
+  for (const QFileInfo& info : updateDir.entryInfoList(QDir::NoDotAndDotDot | QDir::Dirs, QDir::Time))
   {
-    // check if this version has been applied
-    QString readyFile(GetPath("_readyToApply", dir, false));
-    QString packagesDir(GetPath("packages", dir, false));
+    QString dir = info.fileName();
 
-    QLOG_DEBUG() << "Checking for:" << readyFile;
+    // this runs while the updater might already download into a new directory
+    if (info.lastModified().secsTo(QDateTime::currentDateTime()) < UPDATE_CLEANUP_MIN_AGE_SECS)
+      continue;
+
+    // what is installed now is the base the next binary delta applies to
+    if (dir == Version::GetVersionString())
+      continue;
 
     QDir packageDir(GetPath("packages", dir, false));
 
-    if (QFile::exists(readyFile))
+    // the newest unfinished download is resumed by the updater
+    bool resumable = newest && !packageDir.entryList(QStringList("*.part"), QDir::Files).isEmpty();
+    newest = false;
+
+    if (QFile::exists(GetPath("_readyToApply", dir, false)))
     {
-      QLOG_DEBUG() << dir << "is not applied";
-      return dir;
+      if (!marked)
+      {
+        QLOG_DEBUG() << dir << "is not applied, marking it for the next start";
+        MarkPending(dir);
+        marked = true;
+      }
     }
-    else if (packageDir.exists())
+    else if (packageDir.exists() && !resumable)
     {
       QLOG_DEBUG() << "Removing old update packages in dir:" << dir;
       if (!packageDir.removeRecursively())
@@ -74,9 +124,132 @@ QString UpdateManager::HaveUpdate()
       }
     }
   }
+}
 
-  QLOG_DEBUG() << "No valid/applicable update found.";
-  return "";
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdateManager::CleanupTrash()
+{
+  // left over when we quit before RemoveDirAsync() was done
+  QDir updateDir(GetPath("", "", false));
+  for (const QString& trash : updateDir.entryList(QStringList(UPDATE_TRASH_PREFIX "*"), QDir::NoDotAndDotDot | QDir::Dirs))
+  {
+    if (!QDir(updateDir.absoluteFilePath(trash)).removeRecursively())
+      QLOG_WARN() << "Failed to remove old update dir:" << trash;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class DirRemoval : public QRunnable
+{
+public:
+  explicit DirRemoval(const QString& path) : m_path(path) {}
+
+  void run() override
+  {
+    if (!QDir(m_path).removeRecursively())
+      QLOG_WARN() << "Failed to remove directory:" << m_path;
+  }
+
+private:
+  QString m_path;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdateManager::RemoveDirAsync(const QString& path)
+{
+  QDir dir(path);
+  if (!dir.exists())
+    return;
+
+  // the rename is instant, so the next download can't find any of the old files in there
+  QString trash = GetPath(UPDATE_TRASH_PREFIX + QString::number(QDateTime::currentMSecsSinceEpoch()) + "-" + dir.dirName(), "", false);
+  if (dir.dirName().startsWith(UPDATE_TRASH_PREFIX))
+  {
+    trash = dir.absolutePath();
+  }
+  else if (!QDir().rename(dir.absolutePath(), trash))
+  {
+    QLOG_DEBUG() << "Can't move" << path << "out of the way, removing it in place";
+    trash = dir.absolutePath();
+  }
+
+  QThreadPool::globalInstance()->start(new DirRemoval(trash));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copies through a temporary name so dest is never seen half written.
+//
+static bool copyFile(const QString& source, const QString& dest)
+{
+  QString temp = dest + ".part";
+  QFile::remove(temp);
+
+  if (!QFile::copy(source, temp))
+    return false;
+
+  QFile::remove(dest);
+  if (!QFile::rename(temp, dest))
+  {
+    QFile::remove(temp);
+    return false;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool UpdateManager::StageFile(const QString& source, const QString& dest)
+{
+  QFile::remove(dest);
+  if (QFile::rename(source, dest))
+    return true;
+
+  // different filesystems
+  QLOG_DEBUG() << "Can't rename" << source << "to" << dest << ", copying it";
+  if (!copyFile(source, dest))
+    return false;
+
+  QFile::remove(source);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool UpdateManager::LinkFile(const QString& source, const QString& dest)
+{
+  QFile::remove(dest);
+
+#ifndef Q_OS_WIN
+  if (::link(QFile::encodeName(source).constData(), QFile::encodeName(dest).constData()) == 0)
+    return true;
+
+  QLOG_DEBUG() << "Can't link" << source << "to" << dest << ", copying it";
+#endif
+
+  // Windows won't let the installer replace an exe that runs under another name of the same file
+  return copyFile(source, dest);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class UpdateCleanup : public QRunnable
+{
+public:
+  void run() override { UpdateManager::Get()->CleanupUpdates(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdateManager::CleanupUpdatesAsync()
+{
+  // create the manager here, not on the worker thread
+  Get();
+  QThreadPool::globalInstance()->start(new UpdateCleanup);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdateManager::MarkPending(const QString& version)
+{
+  QSaveFile marker(MarkerPath());
+  if (!marker.open(QIODevice::WriteOnly) || marker.write(version.toUtf8()) < 0 || !marker.commit())
+    QLOG_WARN() << "Failed to write update marker:" << MarkerPath();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -110,16 +283,8 @@ bool UpdateManager::applyUpdate(const QString& version)
   // copy the updater to a temporary directory so that we don't overwrite it.
   QString updaterPath = QDir::temp().absoluteFilePath(updaterName);
 
-  // we need to remove it first, since QFile::copy() will fail otherwise.
-  if (QFile::exists(updaterPath))
-  {
-    if (!QFile::remove(updaterPath))
-    {
-      QLOG_DEBUG() << "Failed to remove updater from " << updaterPath;
-    }
-  }
-
-  if (!QFile::copy(updaterFile.fileName(), updaterPath))
+  // a hardlink is enough, the installer replaces files instead of writing into them
+  if (!LinkFile(updaterFile.fileName(), updaterPath))
   {
     QLOG_ERROR() << "Failed to copy the updater to:" << updaterPath;
     return false;
@@ -166,6 +331,12 @@ QString UpdateManager::GetPath(const QString& file, const QString& version, bool
   return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/updates/" + version + "/" + filePath;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString UpdateManager::MarkerPath()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/updates/_pending";
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void UpdateManager::doUpdate(const QString& version)
 {
@@ -191,6 +362,9 @@ bool UpdateManager::CheckForUpdates()
   {
     QLOG_DEBUG() << "We want to apply update:" << updateVersion;
 
+    // if applying fails and the update is still ready, CleanupUpdates() marks it again
+    QFile::remove(MarkerPath());
+
     // if this call succeeds we need to shut down and let
     // the updater do it's work. Otherwise we'll just
     // start the application as normal and pretend that
@@ -14,11 +14,29 @@ public:
 
   static UpdateManager* Get();
 
+  // Only looks at the marker file written by MarkPending(), so it's cheap enough for startup.
   virtual QString HaveUpdate();
+  // Sweeps the update directory: removes packages of old updates and marks a ready update
+  // that has no marker (downloaded by an older version). Slow, don't use it at startup.
+  virtual void CleanupUpdates();
+  // Run CleanupUpdates() on a worker thread.
+  static void CleanupUpdatesAsync();
+  static void MarkPending(const QString& version);
+  // Moves the directory out of the way and deletes it on a worker thread.
+  static void RemoveDirAsync(const QString& path);
+  // Moves source to dest, a rename on the same filesystem and a copy otherwise.
+  static bool StageFile(const QString& source, const QString& dest);
+  // Makes dest a hardlink to source where that's possible, a copy otherwise.
+  static bool LinkFile(const QString& source, const QString& dest);
   virtual bool applyUpdate(const QString &version);
   virtual void doUpdate(const QString& version);
 
   static QString GetPath(const QString &file, const QString& version, bool package);
+  static QString MarkerPath();
+
+protected:
+  // Deletes what RemoveDirAsync() didn't get to before we quit.
+  static void CleanupTrash();
 };
 
 #endif // UPDATEMANAGER_H
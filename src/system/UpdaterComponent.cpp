@@ -16,21 +16,27 @@
 #include <utils/HelperLauncher.h>
 #include <QUrlQuery>
 #include <QDomDocument>
+#include <QRunnable>
+#include <QThreadPool>
 #include "qhttpclient.hpp"
 #include "qhttpclientresponse.hpp"
 
 #include "settings/SettingsComponent.h"
 #include "UpdateManager.h"
+#include "DeltaPatch.h"
 #include "SystemComponent.h"
+#include "player/PlayerComponent.h"
 
 using namespace qhttp::client;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 UpdaterComponent::UpdaterComponent(QObject* parent) :
   ComponentBase(parent),
-  m_netManager(this),
   m_checkReply(nullptr),
-  m_enabled(true)
+  m_enabled(true),
+  m_throttled(false),
+  m_patching(false),
+  m_patched(false)
 {
   m_file = nullptr;
   m_manifest = nullptr;
@@ -39,23 +45,44 @@ UpdaterComponent::UpdaterComponent(QObject* parent) :
   m_enabled = false;
 #endif
 
-  connect(&m_netManager, &QNetworkAccessManager::finished, this, &UpdaterComponent::dlComplete);
-
   connect(&SystemComponent::Get(), &SystemComponent::userInfoChanged, [this](){
     if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "automaticUpdates").toBool())
       QTimer::singleShot(10 * 1000, this, &UpdaterComponent::checkForUpdate);
   });
 
+  // Instead of looking every few minutes if a check is due, the timer is set for when the
+  // next one is. Checks that happen in between move it.
   auto updateTimer = new QTimer(this);
-  connect(updateTimer, &QTimer::timeout, [&]{
-    auto diff = m_lastUpdateCheck.secsTo(QTime::currentTime());
-    QLOG_DEBUG() << "It has gone" << diff << "seconds since last update check.";
-    if (diff >= (3 * 60 * 60))
+  updateTimer->setSingleShot(true);
+  updateTimer->setTimerType(Qt::VeryCoarseTimer);
+  connect(updateTimer, &QTimer::timeout, [=]{
+    // like before, the timer doesn't do the first check
+    qint64 elapsed = m_lastUpdateCheck.isValid() ? m_lastUpdateCheck.elapsed() : 0;
+    QLOG_DEBUG() << "It has gone" << elapsed / 1000 << "seconds since last update check.";
+    if (elapsed >= UPDATE_CHECK_INTERVAL_MSEC)
+    {
       checkForUpdate();
+      elapsed = 0;
+    }
+    updateTimer->start((int)(UPDATE_CHECK_INTERVAL_MSEC - elapsed));
   });
 
   if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "automaticUpdates").toBool())
-    updateTimer->start(5 * 60 * 1000);
+    updateTimer->start(UPDATE_CHECK_INTERVAL_MSEC);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool UpdaterComponent::componentInitialize()
+{
+  // this component is deferred, so the sweep of old updates doesn't delay the startup
+  UpdateManager::CleanupUpdatesAsync();
+
+  connect(&PlayerComponent::Get(), &PlayerComponent::videoPlaybackActive, this, [this](bool active)
+  {
+    m_throttled = active;
+    updateRateLimit();
+  });
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -84,9 +111,7 @@ void UpdaterComponent::checkForUpdate()
   if (!m_checkReply)
   {
     QLOG_DEBUG() << "Checking for updates at:" << baseUrl.toString();
-    QNetworkRequest req(baseUrl);
-    req.setPriority(QNetworkRequest::HighPriority);
-    m_checkReply = m_netManager.get(req);
+    m_checkReply = startRequest(QNetworkRequest(baseUrl), NetworkService::MetadataRequest);
     connect(m_checkReply, &QNetworkReply::readyRead, [this]()
     {
       m_checkData.append(m_checkReply->read(m_checkReply->bytesAvailable()));
@@ -102,7 +127,7 @@ void UpdaterComponent::checkForUpdate()
     });
   }
 
-  m_lastUpdateCheck = QTime::currentTime();
+  m_lastUpdateCheck.start();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -120,11 +145,10 @@ void UpdaterComponent::dlComplete(QNetworkReply* reply)
           redirectURL.toString().startsWith("https://downloads.plex.tv") ||
           redirectURL.toString().startsWith("https://plex.tv"))
       {
-        QNetworkReply* redirReply = m_netManager.get(QNetworkRequest(redirectURL));
         if (m_manifest->m_reply == reply)
-          m_manifest->setReply(redirReply);
+          m_manifest->setReply(startRequest(m_manifest->request(redirectURL), NetworkService::DownloadRequest));
         else if (m_file->m_reply == reply)
-          m_file->setReply(redirReply);
+          m_file->setReply(startRequest(m_file->request(redirectURL), NetworkService::DownloadRequest));
 
         QLOG_DEBUG() << "Redirecting to:" << redirectURL.toString();
 
@@ -132,6 +156,11 @@ void UpdaterComponent::dlComplete(QNetworkReply* reply)
       }
     }
   }
+  else if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 416)
+  {
+    // a resume past the end, Update::finished() checks the file it has
+    QLOG_DEBUG() << "Nothing left to download for:" << reply->url();
+  }
   else
   {
     QLOG_ERROR() << "Error downloading:" << reply->url() << "-" << reply->errorString();
@@ -147,24 +176,67 @@ void UpdaterComponent::dlComplete(QNetworkReply* reply)
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QNetworkReply* UpdaterComponent::startRequest(const QNetworkRequest& request, NetworkService::RequestKind kind)
+{
+  QNetworkReply* reply = NetworkService::Get().get(request, kind);
+  connect(reply, &QNetworkReply::finished, this, [this, reply]() { dlComplete(reply); });
+  return reply;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void UpdaterComponent::downloadFile(Update* update)
 {
-  QNetworkRequest request(update->m_url);
-  request.setPriority(QNetworkRequest::LowPriority);
-  request.setAttribute(QNetworkRequest::BackgroundRequestAttribute, true);
-  if (update->setReply(m_netManager.get(request)))
+  if (update->setReply(startRequest(update->request(update->m_url), NetworkService::DownloadRequest)))
+  {
     QLOG_INFO() << "Downloading update:" << update->m_url << "to:" << update->m_localPath;
+    updateRateLimit();
+  }
   else QLOG_ERROR() << "Failed to start download:" << update->m_url;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdaterComponent::updateRateLimit()
+{
+  // don't compete with the video stream for bandwidth
+  qint64 limit = 0;
+  if (m_throttled)
+    limit = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "updateBandwidthLimit").toInt() * 1024;
+
+  if (m_manifest)
+    m_manifest->setRateLimit(limit);
+  if (m_file)
+    m_file->setRateLimit(limit);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool UpdaterComponent::fileComplete(Update* update)
 {
-  Q_UNUSED(update);
+  // the partial file was dropped, this one starts at zero and can't end up here again
+  if (update && update->takeRestart())
+  {
+    downloadFile(update);
+    return false;
+  }
+
+  // a patch that can't be downloaded won't get better by trying again
+  if (update && update == m_file && isBinaryDelta() && !m_patched && !m_patching && !m_file->isReady())
+  {
+    // queued, this comes from m_file
+    QMetaObject::invokeMethod(this, "fallBackToPackage", Qt::QueuedConnection,
+                              Q_ARG(QString, QString("the patch download failed")));
+    return false;
+  }
+
   if (m_file->isReady() && (m_manifest->isReady() || !m_hasManifest))
   {
+    if (isBinaryDelta() && !m_patched)
+    {
+      applyPatch();
+      return false;
+    }
+
     QLOG_DEBUG() << "Both files downloaded";
     // create a file that shows that we are ready
     // to apply this update
@@ -175,6 +247,7 @@ bool UpdaterComponent::fileComplete(Update* update)
       readyFile.write("FOO");
       readyFile.close();
     }
+    UpdateManager::MarkPending(m_version);
 
     emit downloadComplete(m_version);
 
@@ -220,9 +293,20 @@ void UpdaterComponent::startUpdateDownload(const QVariantHash& updateInfo)
   // determine if we have a manifest (some distros don't like OE)
   m_hasManifest = ((!m_manifest->m_url.isEmpty()) && (!m_manifest->m_hash.isEmpty()));
 
-  m_file = new Update(updateInfo["fileURL"].toString(),
-                      UpdateManager::GetPath(updateInfo["fileName"].toString(), m_version, true),
-                      updateInfo["fileHash"].toString(), this);
+  m_patched = false;
+  if (isBinaryDelta())
+  {
+    // the patch goes next to the manifest, the packages dir is handed to the updater
+    m_file = new Update(updateInfo["fileURL"].toString(),
+                        UpdateManager::GetPath(updateInfo["fileName"].toString() + ".patch", m_version, false),
+                        updateInfo["fileHash"].toString(), this);
+  }
+  else
+  {
+    m_file = new Update(updateInfo["fileURL"].toString(),
+                        UpdateManager::GetPath(updateInfo["fileName"].toString(), m_version, true),
+                        updateInfo["fileHash"].toString(), this);
+  }
 
   if (m_hasManifest)
   {
@@ -232,7 +316,7 @@ void UpdaterComponent::startUpdateDownload(const QVariantHash& updateInfo)
   connect(m_file, &Update::fileDone, this, &UpdaterComponent::fileComplete);
 
   // create directories we need
-  QDir dr(QFileInfo(m_file->m_localPath).dir());
+  QDir dr(QFileInfo(UpdateManager::GetPath(updateInfo["fileName"].toString(), m_version, true)).dir());
   if (!dr.exists())
   {
     if (!dr.mkpath("."))
@@ -257,17 +341,137 @@ void UpdaterComponent::startUpdateDownload(const QVariantHash& updateInfo)
 
   if (!m_file->isReady())
   {
-    downloadFile(m_file);
+    // A package rebuilt by an earlier run is checked on the worker, it's too big to hash
+    // here. The patch is only downloaded if that one is no good.
+    if (isBinaryDelta() && QFile::exists(UpdateManager::GetPath(updateInfo["fileName"].toString(), m_version, true)))
+      applyPatch();
+    else
+      downloadFile(m_file);
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool UpdaterComponent::isDownloading()
 {
-  return (m_manifest && m_manifest->m_reply && m_manifest->m_reply->isRunning()) ||
+  return m_patching ||
+         (m_manifest && m_manifest->m_reply && m_manifest->m_reply->isRunning()) ||
          (m_file && m_file->m_reply && m_file->m_reply->isRunning());
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool UpdaterComponent::isBinaryDelta() const
+{
+  return m_updateInfo.value("binaryDelta").toString() == "true";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class PatchApplier : public QRunnable
+{
+public:
+  PatchApplier(const QVariantHash& info, const QString& version, const QString& patchPath)
+    : m_info(info), m_version(version), m_patchPath(patchPath) {}
+
+  void run() override
+  {
+    QString error;
+    QString targetPath = UpdateManager::GetPath(m_info["fileName"].toString(), m_version, true);
+    bool ok = false;
+
+    if (QFile::exists(targetPath) && Update::hashFile(targetPath) == m_info["targetFileHash"].toString())
+    {
+      // rebuilt by an earlier run
+      ok = true;
+    }
+    else if (!QFile::exists(m_patchPath))
+    {
+      // left over from an earlier run that didn't get to the end, the patch has to come first
+      QFile::remove(targetPath);
+    }
+    else
+    {
+      ok = DeltaPatch::Apply(UpdateManager::GetPath(m_info["baseFileName"].toString(), m_info["baseVersion"].toString(), true),
+                             m_info["baseFileHash"].toString(), m_patchPath, targetPath,
+                             m_info["targetFileHash"].toString(), &error);
+    }
+
+    QMetaObject::invokeMethod(&UpdaterComponent::Get(), "patchDone", Qt::QueuedConnection,
+                              Q_ARG(bool, ok), Q_ARG(QString, error));
+  }
+
+private:
+  QVariantHash m_info;
+  QString m_version;
+  QString m_patchPath;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdaterComponent::applyPatch()
+{
+  if (m_patching)
+    return;
+
+  QLOG_INFO() << "Rebuilding the update package from" << m_file->m_localPath;
+  m_patching = true;
+  QThreadPool::globalInstance()->start(new PatchApplier(m_updateInfo, m_version, m_file->m_localPath));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdaterComponent::patchDone(bool ok, const QString& error)
+{
+  m_patching = false;
+  if (!m_file)
+    return;
+
+  // only the stale package of an earlier run was found, there was no patch to apply yet
+  if (!ok && error.isEmpty())
+  {
+    downloadFile(m_file);
+    return;
+  }
+
+  // it's either in the package now, or it's no use
+  QFile::remove(m_file->m_localPath);
+
+  if (ok)
+  {
+    delete m_file;
+    m_file = new Update("", UpdateManager::GetPath(m_updateInfo["fileName"].toString(), m_version, true),
+                        m_updateInfo["targetFileHash"].toString(), this);
+    m_file->markVerified();
+    m_patched = true;
+
+    // if the manifest is still downloading, that finishes it
+    fileComplete(nullptr);
+    return;
+  }
+
+  fallBackToPackage(error);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void UpdaterComponent::fallBackToPackage(const QString& reason)
+{
+  if (!m_file || !isBinaryDelta() || m_patched)
+    return;
+
+  QVariantHash fallback = m_updateInfo["fallback"].toHash();
+  QLOG_WARN() << "Failed to apply the update patch (" << reason << "), downloading the whole package";
+
+  delete m_file;
+  delete m_manifest;
+  m_file = nullptr;
+  m_manifest = nullptr;
+  m_updateInfo.clear();
+
+  if (fallback.isEmpty())
+  {
+    emit downloadError("Failed to apply the update patch");
+    return;
+  }
+
+  startUpdateDownload(fallback);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void UpdaterComponent::doUpdate()
 {
@@ -335,7 +539,16 @@ QVariantHash UpdaterComponent::parseUpdateData(const QByteArray& data)
 
           package["fileName"] = packageElement.attribute("fileName");
 
-          if (package["delta"].toString() == "true")
+          // a patch against the package of an older version, see DeltaPatch
+          package["binaryDelta"] = packageElement.attribute("binaryDelta");
+          package["baseVersion"] = packageElement.attribute("baseVersion");
+          package["baseFileName"] = packageElement.attribute("baseFileName");
+          package["baseFileHash"] = packageElement.attribute("baseFileHash");
+          package["targetFileHash"] = packageElement.attribute("targetFileHash");
+
+          if (package["binaryDelta"].toString() == "true")
+            rel["binary_package"] = package;
+          else if (package["delta"].toString() == "true")
             rel["delta_package"] = package;
           else
             rel["full_package"] = package;
@@ -364,11 +577,33 @@ QVariantHash UpdaterComponent::parseUpdateData(const QByteArray& data)
   else
     updateInfo = release["full_package"].toHash();
 
-  updateInfo["version"] = release["version"];
-  updateInfo["fixed"] = release["fixed"];
-  updateInfo["new"] = release["new"];
-  updateInfo["fileURL"] = getFinalUrl(updateInfo["file"].toString());
-  updateInfo["manifestURL"] = getFinalUrl(updateInfo["manifest"].toString());
+  auto finish = [&](QVariantHash& info)
+  {
+    info["version"] = release["version"];
+    info["fixed"] = release["fixed"];
+    info["new"] = release["new"];
+    info["fileURL"] = getFinalUrl(info["file"].toString());
+    info["manifestURL"] = getFinalUrl(info["manifest"].toString());
+  };
+  finish(updateInfo);
+
+  // the patch is a lot smaller, but only works if we still have what it applies to
+  if (release.contains("binary_package"))
+  {
+    QVariantHash binary = release["binary_package"].toHash();
+    QString base = UpdateManager::GetPath(binary["baseFileName"].toString(), binary["baseVersion"].toString(), true);
+
+    if (!binary["baseFileName"].toString().isEmpty() && QFile::exists(base))
+    {
+      finish(binary);
+      binary["fallback"] = updateInfo;
+      updateInfo = binary;
+    }
+    else
+    {
+      QLOG_DEBUG() << "No base package for the binary delta, using the whole package";
+    }
+  }
 
   QLOG_DEBUG() << updateInfo;
 
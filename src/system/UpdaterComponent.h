@@ -7,27 +7,63 @@
 #include <QCryptographicHash>
 #include <QFile>
 #include <QThread>
-#include <QTime>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFileInfo>
 #include <time.h>
 
 #include "ComponentManager.h"
 #include "QsLog.h"
+#include "utils/NetworkService.h"
 
 #include <time.h>
 
+// how often the budget of a rate limited download is refilled
+#define UPDATE_THROTTLE_TICK_MSEC 250
+// automatic updates are checked for this often
+#define UPDATE_CHECK_INTERVAL_MSEC (3 * 60 * 60 * 1000)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+// A single file of an update. It is downloaded to <localPath>.part, which survives restarts and
+// is resumed with a Range request. The hash is computed while the data arrives, and the file
+// only gets its final name once the hash matched.
 class Update : public QObject
 {
   Q_OBJECT
 public:
   explicit Update(const QString& url = "", const QString& localPath = "",
-         const QString& hash = "", QObject* parent = nullptr) : QObject(parent)
+         const QString& hash = "", QObject* parent = nullptr) : QObject(parent),
+    m_hasher(QCryptographicHash::Sha1)
   {
     m_url = url;
     m_localPath = localPath;
     m_hash = hash;
     m_reply = nullptr;
-    m_openFile = new QFile(m_localPath);
+    m_openFile = new QFile(m_localPath + ".part", this);
+    m_verified = false;
+    m_resumeOffset = 0;
+    m_rateLimit = 0;
+    m_budget = 0;
+    m_replyChecked = false;
+    m_restart = false;
+
+    m_throttleTimer.setInterval(UPDATE_THROTTLE_TICK_MSEC);
+    connect(&m_throttleTimer, &QTimer::timeout, this, &Update::refillBudget);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  // The request for url, asking for the rest of a previous partial download if there is one.
+  QNetworkRequest request(const QUrl& url)
+  {
+    QNetworkRequest request(url);
+    request.setPriority(QNetworkRequest::LowPriority);
+    request.setAttribute(QNetworkRequest::BackgroundRequestAttribute, true);
+
+    m_resumeOffset = QFileInfo(m_openFile->fileName()).size();
+    if (m_resumeOffset > 0)
+      request.setRawHeader("Range", "bytes=" + QByteArray::number(m_resumeOffset) + "-");
+
+    return request;
   }
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -43,11 +79,13 @@ public:
 
     m_reply = reply;
     m_timeStarted = time(nullptr);
+    m_replyChecked = false;
+    applyRateLimit();
 
     connect(m_reply, &QNetworkReply::readyRead, this, &Update::write);
     connect(m_reply, &QNetworkReply::finished, this, &Update::finished);
 
-    if (m_openFile->open(QFile::WriteOnly))
+    if (m_openFile->open(QFile::ReadWrite))
       return true;
 
     m_reply->deleteLater();
@@ -56,21 +94,100 @@ public:
     return false;
   }
 
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  // Limit the download to bytesPerSecond, 0 removes the limit.
+  void setRateLimit(qint64 bytesPerSecond)
+  {
+    m_rateLimit = bytesPerSecond;
+    applyRateLimit();
+
+    // pick up whatever piled up while we were limited
+    if (!m_rateLimit && m_reply)
+      write();
+  }
+
   ///////////////////////////////////////////////////////////////////////////////////////////////////
   void write()
   {
-    m_openFile->write(m_reply->read(m_reply->bytesAvailable()));
+    writeAvailable(m_rateLimit > 0);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  void writeAvailable(bool limited)
+  {
+    if (!m_reply || !startWriting())
+      return;
+
+    qint64 available = m_reply->bytesAvailable();
+    if (limited)
+      available = qMin(available, m_budget);
+
+    if (available <= 0)
+      return;
+
+    QByteArray data = m_reply->read(available);
+    m_hasher.addData(data);
+    m_openFile->write(data);
+    m_budget -= data.size();
     QThread::yieldCurrentThread();
   }
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////
   void finished()
   {
+    // the rate limit doesn't matter anymore, the data is already here
+    writeAvailable(false);
+
+    m_throttleTimer.stop();
     m_openFile->close();
+
+    // a redirect (or error page) never passes startWriting()
+    bool success = m_reply->error() == QNetworkReply::NoError && m_replyChecked;
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
     m_reply->deleteLater();
     m_reply = nullptr;
 
-    QLOG_DEBUG() << "Update downloaded, took:" << time(nullptr) - m_timeStarted << "seconds";
+    if (status == 416 && m_resumeOffset > 0)
+    {
+      // The range starts at the end, an earlier run got the whole file but didn't check it.
+      if (hashFile(m_openFile->fileName()) == m_hash)
+      {
+        QLOG_DEBUG() << "Update was downloaded completely already";
+        QFile::remove(m_localPath);
+        m_verified = m_openFile->rename(m_localPath);
+        if (!m_verified)
+          QLOG_ERROR() << "Failed to move the download to:" << m_localPath;
+      }
+      else
+      {
+        QLOG_ERROR() << "Partial download of" << m_localPath << "doesn't match, starting over";
+        m_openFile->remove();
+        m_restart = true;
+      }
+    }
+    else if (success)
+    {
+      QLOG_DEBUG() << "Update downloaded, took:" << time(nullptr) - m_timeStarted << "seconds";
+
+      if (QString(m_hasher.result().toHex()) == m_hash)
+      {
+        QFile::remove(m_localPath);
+        m_verified = m_openFile->rename(m_localPath);
+        if (!m_verified)
+          QLOG_ERROR() << "Failed to move the download to:" << m_localPath;
+      }
+      else
+      {
+        // it's not going to get better by appending more data to it
+        QLOG_ERROR() << "Hash mismatch for:" << m_localPath;
+        m_openFile->remove();
+      }
+    }
+    else if (!m_restart)
+    {
+      QLOG_DEBUG() << "Update download interrupted, keeping" << m_openFile->size() << "bytes to resume";
+    }
 
     emit fileDone(this);
   }
@@ -82,21 +199,35 @@ public:
         (m_openFile && m_openFile->isOpen()))
       return false;
 
+    if (m_verified)
+      return true;
+
+    // downloaded by a previous run
     QFile file(m_localPath);
     if (file.exists())
     {
-      QString fileHash = hashFile();
+      QString fileHash = hashFile(m_localPath);
       if (!fileHash.isEmpty() && fileHash == m_hash)
+      {
+        m_verified = true;
         return true;
+      }
     }
 
     return false;
   }
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////
-  QString hashFile()
+  // The file was checked elsewhere already, so isReady() doesn't hash it again.
+  void markVerified()
   {
-    QFile file(m_localPath);
+    m_verified = true;
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  static QString hashFile(const QString& path)
+  {
+    QFile file(path);
     QCryptographicHash hash(QCryptographicHash::Sha1);
 
     if (file.open(QFile::ReadOnly))
@@ -111,6 +242,16 @@ public:
     return "";
   }
 
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  // True once after the partial file turned out to be unusable and was dropped, the download
+  // should then be started again from zero.
+  bool takeRestart()
+  {
+    bool restart = m_restart;
+    m_restart = false;
+    return restart;
+  }
+
   /////////////////////////////////////////////////////////////////////////////////////////
   void abort()
   {
@@ -129,6 +270,115 @@ public:
 
 signals:
   void fileDone(Update* update);
+
+private:
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  // Decide what to do with the partial file once we know what the server sent.
+  bool startWriting()
+  {
+    if (m_replyChecked)
+      return true;
+
+    if (m_restart)
+    {
+      m_reply->read(m_reply->bytesAvailable());
+      return false;
+    }
+
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status < 200 || status >= 300)
+    {
+      // the body of a redirect or an error page, not our data
+      m_reply->read(m_reply->bytesAvailable());
+      return false;
+    }
+
+    m_hasher.reset();
+
+    if (status == 206 && m_resumeOffset > 0 && contentRangeStart() != m_resumeOffset)
+    {
+      // not the rest of what we have, the file may have changed on the server as well
+      // The rest of the body is dropped like an error page, finished() starts over.
+      QLOG_ERROR() << "Server resumed" << m_localPath << "at the wrong offset, starting over";
+      m_reply->read(m_reply->bytesAvailable());
+      m_openFile->resize(0);
+      m_restart = true;
+      return false;
+    }
+
+    if (status == 206 && m_resumeOffset > 0)
+    {
+      // the stored part has to go into the hash as well
+      m_openFile->seek(0);
+      while (m_openFile->pos() < m_resumeOffset)
+      {
+        QByteArray data = m_openFile->read(qMin((qint64)65536, m_resumeOffset - m_openFile->pos()));
+        if (data.isEmpty())
+          break;
+        m_hasher.addData(data);
+      }
+
+      QLOG_DEBUG() << "Resuming download of" << m_localPath << "at" << m_openFile->pos();
+    }
+    else
+    {
+      // the server ignored the range, start from zero
+      m_openFile->resize(0);
+    }
+
+    m_openFile->seek(m_openFile->size());
+    m_replyChecked = true;
+    return true;
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  // Where the data of a 206 starts, "Content-Range: bytes <start>-<end>/<size>". -1 if missing.
+  qint64 contentRangeStart()
+  {
+    QByteArray range = m_reply->rawHeader("Content-Range").trimmed();
+    if (!range.startsWith("bytes "))
+      return -1;
+
+    bool ok = false;
+    qint64 start = range.mid(6, range.indexOf('-') - 6).trimmed().toLongLong(&ok);
+    return ok ? start : -1;
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  void applyRateLimit()
+  {
+    if (!m_reply)
+      return;
+
+    if (m_rateLimit)
+    {
+      // makes Qt stop reading from the socket while we hold back
+      m_budget = m_rateLimit * UPDATE_THROTTLE_TICK_MSEC / 1000;
+      m_reply->setReadBufferSize(qMax(m_budget, (qint64)16384));
+      m_throttleTimer.start();
+    }
+    else
+    {
+      m_reply->setReadBufferSize(0);
+      m_throttleTimer.stop();
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////
+  void refillBudget()
+  {
+    m_budget = m_rateLimit * UPDATE_THROTTLE_TICK_MSEC / 1000;
+    write();
+  }
+
+  QCryptographicHash m_hasher;
+  bool m_verified;
+  bool m_replyChecked;
+  bool m_restart;
+  qint64 m_resumeOffset;
+  qint64 m_rateLimit;
+  qint64 m_budget;
+  QTimer m_throttleTimer;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -140,7 +390,9 @@ class UpdaterComponent : public ComponentBase
 public:
   bool componentExport() override { return true; }
   const char* componentName() override { return "updater"; }
-  bool componentInitialize() override { return true; }
+  bool componentInitialize() override;
+  QStringList componentDependencies() override { return { "system", "player" }; }
+  bool componentDeferred() override { return true; }
 
   Q_INVOKABLE void disable() { m_enabled = false; }
 
@@ -162,12 +414,21 @@ signals:
 private slots:
   void dlComplete(QNetworkReply *reply);
   bool fileComplete(Update *update);
+  // from the worker thread that rebuilt the package
+  void patchDone(bool ok, const QString& error);
+  // the patch didn't work out, the release's full (or delta) package is downloaded instead
+  void fallBackToPackage(const QString& reason);
 
 private:
   explicit UpdaterComponent(QObject *parent = nullptr);
 
   bool isDownloading();
+  bool isBinaryDelta() const;
+  void applyPatch();
   void downloadFile(Update *update);
+  // replies go to dlComplete() when they are done
+  QNetworkReply* startRequest(const QNetworkRequest& request, NetworkService::RequestKind kind);
+  void updateRateLimit();
 
   QString m_version;
 
@@ -175,7 +436,6 @@ private:
   Update* m_file;
   bool m_hasManifest;
 
-  QNetworkAccessManager m_netManager;
   QNetworkReply* m_checkReply;
   QByteArray m_checkData;
 
@@ -183,8 +443,12 @@ private:
   QString getFinalUrl(const QString& path);
 
   QVariantHash m_updateInfo;
-  QTime m_lastUpdateCheck;
+  QElapsedTimer m_lastUpdateCheck;
   bool m_enabled;
+  bool m_throttled;
+  // a binary delta is downloaded as a patch, then rebuilt into the package
+  bool m_patching;
+  bool m_patched;
 };
 
 #endif // UPDATERCOMPONENT_H
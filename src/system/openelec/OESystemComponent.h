@@ -16,6 +16,7 @@ public:
   virtual bool componentExport() { return true; }
   virtual const char* componentName() { return "oesystem"; }
   virtual bool componentInitialize();
+  virtual QStringList componentDependencies() { return { "settings", "system" }; }
 
   void updateSectionSettings(const QVariantMap& values);
   bool setHostName(QString name);
@@ -0,0 +1,50 @@
+#ifndef BENCHMARKALLOCATIONS_H
+#define BENCHMARKALLOCATIONS_H
+
+#include <QtGlobal>
+
+#include "utils/AllocationCounter.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sums up what AllocationCounter counted over the iterations of a QBENCHMARK, so only the
+// code under test is counted and not the benchmark loop itself:
+//
+//   BenchmarkAllocations allocations;
+//   QBENCHMARK
+//   {
+//     AllocationCounter counter;
+//     ...
+//     allocations.add(counter.stop());
+//   }
+//   allocations.report("handleMpvEvents");
+//
+class BenchmarkAllocations
+{
+public:
+  void add(qint64 allocations, qint64 calls = 1)
+  {
+    if (allocations < 0)
+      m_unknown = true;
+    else
+      m_allocations += allocations;
+    m_calls += calls;
+  }
+
+  // Logs the allocations per call, next to the timings QTest prints.
+  void report(const char* name) const
+  {
+    if (!m_calls)
+      return;
+    if (m_unknown)
+      qInfo("%s: allocations can't be counted here", name);
+    else
+      qInfo("%s: %.2f allocations per call", name, (double)m_allocations / m_calls);
+  }
+
+private:
+  qint64 m_allocations = 0;
+  qint64 m_calls = 0;
+  bool m_unknown = false;
+};
+
+#endif // BENCHMARKALLOCATIONS_H
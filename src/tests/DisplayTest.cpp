@@ -0,0 +1,183 @@
+#include "DisplayTest.h"
+
+#include <QSize>
+#include <QtTest>
+
+#include "display/dummy/DisplayManagerDummy.h"
+#include "BenchmarkAllocations.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Every mode a 4K TV with HDMI 2.0 typically lists, on each display. Mode 0 is
+// 1080p60, which DisplayManagerDummy reports as the current one.
+//
+class SyntheticDisplayManager : public DisplayManagerDummy
+{
+public:
+  explicit SyntheticDisplayManager(QObject* parent) : DisplayManagerDummy(parent) {}
+
+  bool initialize() override
+  {
+    static const QSize resolutions[] = {
+      {1920, 1080}, {640, 480}, {720, 480}, {720, 576}, {1280, 720},
+      {1680, 1050}, {2560, 1440}, {3840, 2160}, {4096, 2160}
+    };
+    static const float rates[] = {
+      60, 23.976f, 24, 25, 29.97f, 30, 47.952f, 48, 50, 59.94f, 72, 100, 119.88f, 120
+    };
+
+    m_displays.clear();
+    for (int i = 0; i < DISPLAY_TEST_DISPLAYS; i++)
+    {
+      DMDisplayPtr display = DMDisplayPtr(new DMDisplay());
+      display->m_id = i;
+      display->m_name = QString("Synthetic display %1").arg(i);
+      display->m_privId = i;
+
+      for (const QSize& resolution : resolutions)
+      {
+        for (float rate : rates)
+        {
+          for (int bitsPerPixel : {24, 30})
+          {
+            // only the SD and 1080 modes also come interlaced, at the broadcast rates
+            bool broadcast = rate == 50 || rate == 59.94f || rate == 60;
+            bool interlacable = resolution.height() == 1080 || resolution.width() == 720;
+            for (bool interlaced : {false, true})
+            {
+              if (interlaced && (!broadcast || !interlacable))
+                continue;
+
+              DMVideoModePtr mode = DMVideoModePtr(new DMVideoMode());
+              mode->m_id = display->m_videoModes.size();
+              mode->m_width = resolution.width();
+              mode->m_height = resolution.height();
+              mode->m_bitsPerPixel = bitsPerPixel;
+              mode->m_refreshRate = rate;
+              mode->m_interlaced = interlaced;
+              if (bitsPerPixel == 30 && resolution.height() == 2160 && !interlaced)
+                mode->m_hdrFormats = DM_HDR_HDR10 | DM_HDR_HLG;
+              mode->m_privId = mode->m_id;
+              display->m_videoModes[mode->m_id] = mode;
+            }
+          }
+        }
+      }
+
+      m_displays[display->m_id] = display;
+    }
+
+    return DisplayManager::initialize();
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayTest::initTestCase()
+{
+  for (float rate : {23.976f, 24.0f, 25.0f, 29.97f, 30.0f, 50.0f, 59.94f, 60.0f})
+  {
+    m_media.append(DMMatchMediaInfo(rate, false));
+    m_media.append(DMMatchMediaInfo(rate, false, DM_HDR_HDR10));
+  }
+
+  m_manager.reset(new SyntheticDisplayManager(nullptr));
+  QVERIFY(m_manager->initialize());
+  QVERIFY(m_manager->isValidDisplayMode(m_manager->getMainDisplay(), 0));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayTest::cleanupTestCase()
+{
+  m_manager.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Each of the usual frame rates has a mode at the current resolution that plays it without
+// dropped or repeated frames, which beats whatever HDR modes there are at other resolutions.
+//
+void DisplayTest::matches()
+{
+  for (const DMDisplayPtr& display : m_manager->m_displays)
+  {
+    for (DMMatchMediaInfo& media : m_media)
+    {
+      int id = m_manager->findBestMatch(display->m_id, media);
+      QVERIFY(id >= 0);
+
+      DMVideoModePtr mode = display->m_videoModes[id];
+      QString name = mode->getPrettyName();
+      QVERIFY2(mode->m_width == 1920 && mode->m_height == 1080 && mode->m_bitsPerPixel == 24, qPrintable(name));
+      QVERIFY2(!mode->m_interlaced, qPrintable(name));
+      QVERIFY2(DisplayManager::FrameErrorsPerHour(mode->m_refreshRate, media.m_refreshRate) < 1, qPrintable(name));
+
+      // memoized, the same again
+      QCOMPARE(m_manager->findBestMatch(display->m_id, media), id);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayTest::frameErrorsPerHour()
+{
+  static const double refreshRates[] = { 23.976, 24, 25, 29.97, 30, 47.952, 48, 50, 59.94, 60, 72, 100, 119.88, 120 };
+
+  int cadence = 0;
+  QCOMPARE(DisplayManager::FrameErrorsPerHour(48, 24, &cadence), 0.0);
+  QCOMPARE(cadence, 2);
+  // a repeated frame every 42 seconds
+  QVERIFY(qAbs(DisplayManager::FrameErrorsPerHour(24, 23.976, &cadence) - 86.4) < 0.01);
+  QCOMPARE(cadence, 1);
+
+  double sum = 0;
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    for (const DMMatchMediaInfo& media : m_media)
+    {
+      for (double refreshRate : refreshRates)
+        sum += DisplayManager::FrameErrorsPerHour(refreshRate, media.m_refreshRate, &cadence);
+    }
+    allocations.add(counter.stop(), m_media.size() * (sizeof(refreshRates) / sizeof(refreshRates[0])));
+  }
+  allocations.report("FrameErrorsPerHour");
+
+  // so the loop isn't optimized away
+  QVERIFY(sum > 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayTest::findBestMatchCold()
+{
+  QList<int> displays = m_manager->m_displays.keys();
+
+  // 13 mHz apart, so each one gets its own memoized result
+  int i = 0;
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    DMMatchMediaInfo media(10.0f + i * 0.013f, false, (i % 4) ? DM_HDR_NONE : DM_HDR_HDR10);
+    AllocationCounter counter;
+    m_manager->findBestMatch(displays[i % displays.size()], media);
+    allocations.add(counter.stop());
+    i++;
+  }
+  allocations.report("findBestMatch (cold)");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DisplayTest::findBestMatchMemoized()
+{
+  int display = m_manager->getMainDisplay();
+  for (DMMatchMediaInfo& media : m_media)
+    m_manager->findBestMatch(display, media);
+
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    for (DMMatchMediaInfo& media : m_media)
+      m_manager->findBestMatch(display, media);
+    allocations.add(counter.stop(), m_media.size());
+  }
+  allocations.report("findBestMatch (memoized)");
+}
@@ -0,0 +1,37 @@
+#ifndef DISPLAYTEST_H
+#define DISPLAYTEST_H
+
+#include <QList>
+#include <QObject>
+#include <QScopedPointer>
+
+#include "display/DisplayManager.h"
+
+// displays of the synthetic display manager, each with the full mode set
+#define DISPLAY_TEST_DISPLAYS 2
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// DisplayManager::findBestMatch and FrameErrorsPerHour against a display manager based on
+// DisplayManagerDummy that reports every resolution, rate, bit depth and HDR combination a
+// large TV lists in its EDID. Matching is timed both for frame rates that were never asked
+// for, which scores all of the modes, and for the ones that are memoized.
+//
+class DisplayTest : public QObject
+{
+  Q_OBJECT
+
+private Q_SLOTS:
+  void initTestCase();
+  void cleanupTestCase();
+
+  void matches();
+  void frameErrorsPerHour();
+  void findBestMatchCold();
+  void findBestMatchMemoized();
+
+private:
+  QScopedPointer<DisplayManager> m_manager;
+  QList<DMMatchMediaInfo> m_media;
+};
+
+#endif // DISPLAYTEST_H
@@ -0,0 +1,248 @@
+#include "InputTest.h"
+
+#include <QDirIterator>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QtTest>
+
+#include "input/InputComponent.h"
+#include "input/InputMapping.h"
+#include "utils/CachedRegexMatcher.h"
+#include "utils/Utils.h"
+#include "BenchmarkAllocations.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The source name an input device would report for the idmatcher of a mapping,
+// "Keyboard.*" -> "Keyboard". Empty if the guess doesn't match.
+//
+QString InputTest::sourceFor(const QString& idmatcher)
+{
+  QString source = idmatcher.section('|', 0, 0);
+  source.remove(".*").remove('*').remove('^').remove('$');
+
+  if (source.isEmpty() || !QRegularExpression(idmatcher).match(source).hasMatch())
+    return QString();
+  return source;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool InputTest::isHostAction(const QVariant& action)
+{
+  if (action.type() == QVariant::String)
+    return action.toString().startsWith("host:");
+
+  if (action.type() == QVariant::List)
+  {
+    for (const QVariant& entry : action.toList())
+    {
+      if (isHostAction(entry))
+        return true;
+    }
+  }
+  else if (action.type() == QVariant::Map)
+  {
+    for (const QVariant& entry : action.toMap())
+    {
+      if (isHostAction(entry))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputTest::initTestCase()
+{
+  QDirIterator it(":/inputmaps");
+  while (it.hasNext())
+  {
+    QString path = it.next();
+    if (!path.endsWith(".json"))
+      continue;
+
+    QJsonParseError err;
+    QJsonDocument doc = Utils::OpenJsonDocument(path, &err);
+    QVERIFY2(doc.isObject(), qPrintable(path));
+
+    QVariantMap map = doc.object().toVariantMap();
+    QString source = sourceFor(map.value("idmatcher").toString());
+    if (source.isEmpty())
+    {
+      qInfo("No source name for %s, skipped", qPrintable(path));
+      continue;
+    }
+
+    Mapping mapping;
+    QList<Event> events;
+
+    // patterns without regex features are keycodes a device really sends
+    QVariantMap inputMap = map.value("mapping").toMap();
+    for (auto pattern = inputMap.constBegin(); pattern != inputMap.constEnd(); ++pattern)
+    {
+      mapping.patterns.append(qMakePair("^" + pattern.key() + "$", pattern.value()));
+      if (QRegularExpression::escape(pattern.key()) == pattern.key())
+        events.append({source, pattern.key(), true});
+    }
+
+    // and misses, which have to go through every pattern
+    events.append({source, "BenchmarkUnmapped", false});
+    events.append({source, "Shift+BenchmarkUnmapped", false});
+
+    m_mappings.append(mapping);
+    m_events.append(events);
+  }
+
+  QVERIFY(!m_mappings.isEmpty());
+
+  InputMapping mapping;
+  QVERIFY(mapping.loadMappings());
+  QCOMPARE(mapping.mapToAction("Keyboard", "Left"), QVariantList{"left"});
+  QCOMPARE(mapping.mapToAction("Keyboard", "Shift+Left"), QVariantList{"left"});
+  QVERIFY(mapping.mapToAction("Keyboard", "BenchmarkUnmapped").isEmpty());
+
+  // the component's own mapping, without the inputs componentInitialize() would open
+  QVERIFY(InputComponent::Get().m_mappings->loadMappings());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The first lookup of each keycode, which runs the regular expressions. Building the
+// matchers is included, that's what comes before the first lookup after a mapping is loaded.
+//
+void InputTest::matchUncached()
+{
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    for (int i = 0; i < m_mappings.size(); i++)
+    {
+      CachedRegexMatcher matcher;
+      for (const auto& pattern : m_mappings[i].patterns)
+        matcher.addMatcher(pattern.first, pattern.second);
+
+      AllocationCounter counter;
+      for (const Event& event : m_events[i])
+        matcher.match(event.keycode);
+      allocations.add(counter.stop(), m_events[i].size());
+    }
+  }
+  allocations.report("match (uncached)");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Repeated lookups, which is what a held down key looks like.
+//
+void InputTest::matchCached()
+{
+  QList<CachedRegexMatcher*> matchers;
+  for (int i = 0; i < m_mappings.size(); i++)
+  {
+    auto matcher = new CachedRegexMatcher;
+    for (const auto& pattern : m_mappings[i].patterns)
+      matcher->addMatcher(pattern.first, pattern.second);
+    for (const Event& event : m_events[i])
+      QVERIFY2(matcher->match(event.keycode).isEmpty() != event.mapped, qPrintable(event.keycode));
+    matchers.append(matcher);
+  }
+
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    for (int i = 0; i < matchers.size(); i++)
+    {
+      AllocationCounter counter;
+      for (const Event& event : m_events[i])
+        matchers[i]->match(event.keycode);
+      allocations.add(counter.stop(), m_events[i].size());
+    }
+  }
+  allocations.report("match (cached)");
+
+  qDeleteAll(matchers);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading and compiling the bundled and user mappings, on startup and when they're edited.
+//
+void InputTest::loadMappings()
+{
+  InputMapping mapping;
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    mapping.loadMappings();
+    allocations.add(counter.stop());
+  }
+  allocations.report("loadMappings");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The real thing, including user mappings and the source matching.
+//
+void InputTest::mapToAction()
+{
+  InputMapping mapping;
+  QVERIFY(mapping.loadMappings());
+
+  int events = 0;
+  for (const QList<Event>& list : m_events)
+  {
+    for (const Event& event : list)
+    {
+      if (!event.mapped)
+        QVERIFY2(mapping.mapToAction(event.source, event.keycode).isEmpty(), qPrintable(event.keycode));
+    }
+    events += list.size();
+  }
+
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    for (const QList<Event>& list : m_events)
+    {
+      for (const Event& event : list)
+        mapping.mapToAction(event.source, event.keycode);
+    }
+    allocations.add(counter.stop(), events);
+  }
+  allocations.report("mapToAction");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void InputTest::remapInput()
+{
+  InputComponent& input = InputComponent::Get();
+
+  // host commands would toggle fullscreen, quit and so on
+  QList<Event> events;
+  for (const QList<Event>& list : m_events)
+  {
+    for (const Event& event : list)
+    {
+      bool host = false;
+      for (const QVariant& action : input.m_mappings->mapToAction(event.source, event.keycode))
+        host = host || isHostAction(action);
+      if (!host)
+        events.append(event);
+    }
+  }
+  QVERIFY(!events.isEmpty());
+
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    for (const Event& event : events)
+    {
+      input.remapInput(event.source, event.keycode, InputBase::KeyDown, 0);
+      input.remapInput(event.source, event.keycode, InputBase::KeyUp, 0);
+    }
+    allocations.add(counter.stop(), events.size());
+  }
+  allocations.report("remapInput (down+up)");
+
+  input.cancelAutoRepeat();
+}
@@ -0,0 +1,50 @@
+#ifndef INPUTTEST_H
+#define INPUTTEST_H
+
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+#include <QVariant>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The input mapping engine: CachedRegexMatcher::match, InputMapping::mapToAction and
+// InputComponent::remapInput, fed with events made up from the bundled mapping files
+// (resources/inputmaps), so every mapping and a few misses are covered.
+//
+class InputTest : public QObject
+{
+  Q_OBJECT
+
+private Q_SLOTS:
+  void initTestCase();
+
+  void matchUncached();
+  void matchCached();
+  void loadMappings();
+  void mapToAction();
+  void remapInput();
+
+private:
+  struct Event
+  {
+    QString source;
+    QString keycode;
+    // misses don't map to anything
+    bool mapped;
+  };
+
+  struct Mapping
+  {
+    QList<QPair<QString, QVariant>> patterns;
+  };
+
+  static QString sourceFor(const QString& idmatcher);
+  static bool isHostAction(const QVariant& action);
+
+  QList<Mapping> m_mappings;
+  // events for m_mappings, same index
+  QList<QList<Event>> m_events;
+};
+
+#endif // INPUTTEST_H
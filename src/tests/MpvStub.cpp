@@ -0,0 +1,809 @@
+#include "MpvStub.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVariant>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpv/client.h>
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 101)
+#include <mpv/render_gl.h>
+#include <mpv/stream_cb.h>
+#define HAVE_MPV_RENDER_API 1
+#else
+#include <mpv/opengl_cb.h>
+#endif
+
+#include "QtHelper.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A libmpv that doesn't play anything, so the player and codec code runs on machines
+// without libmpv, a display or an audio device. Properties are kept as they're set and
+// read back, observed ones report their changes, and the commands succeed without
+// doing anything, except for "loadfile", which fails the file right away (so codec
+// probes end), and "quit". Decoders and encoders are listed for the usual formats.
+// Render contexts can't be created. Everything the client gets to free comes from
+// malloc, like mpv's.
+//
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct StubEvent
+{
+  mpv_event_id id;
+  int error;
+  uint64_t userdata;
+  // property changes
+  QByteArray name;
+  mpv_format format;
+  // the property value, or the result of a command
+  QVariant value;
+  // MPV_EVENT_END_FILE
+  int reason;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct StubObservation
+{
+  uint64_t userdata;
+  QByteArray name;
+  mpv_format format;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct mpv_handle
+{
+  QMutex lock;
+  QWaitCondition queued;
+  void (*wakeup)(void*) = nullptr;
+  void* wakeupData = nullptr;
+
+  QVariantMap properties;
+  QList<StubObservation> observations;
+
+  // Played back from next on, and reset once drained so the storage is reused.
+  QVector<StubEvent> events;
+  int next = 0;
+
+  // what the last mpv_wait_event() returned points into
+  StubEvent current;
+  mpv_event event;
+  mpv_event_property property;
+  mpv_event_end_file endFile;
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 102)
+  mpv_event_command command;
+#endif
+  mpv_node node;
+  union
+  {
+    int flag;
+    int64_t int64;
+    double double_;
+    char* string;
+  } value;
+  bool valueIsString = false;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QVariantMap codecEntry(const char* codec)
+{
+  return QVariantMap{{"family", "lavc"}, {"codec", codec}, {"driver", codec}, {"description", codec}};
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QVariantMap defaultProperties()
+{
+  QVariantList decoders;
+  for (const char* codec : {"h264", "hevc", "mpeg2video", "vc1", "aac", "ac3", "eac3", "truehd", "dca",
+                            "mp2", "flac"})
+    decoders.append(codecEntry(codec));
+
+  return QVariantMap{
+    {"mpv-version", "mpv stub"},
+    {"ffmpeg-version", "stub"},
+    {"idle-active", true},
+    {"decoder-list", decoders},
+    {"encoder-list", QVariantList{codecEntry("ac3")}},
+    {"audio-device-list", QVariantList{QVariantMap{{"name", "auto"}, {"description", "Autoselect device"}}}},
+  };
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static char* copyString(const QByteArray& str)
+{
+  char* result = (char*)malloc(str.size() + 1);
+  memcpy(result, str.constData(), str.size() + 1);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void variantToNode(const QVariant& value, mpv_node* node)
+{
+  switch ((int)value.type())
+  {
+    case QMetaType::UnknownType:
+      node->format = MPV_FORMAT_NONE;
+      break;
+    case QMetaType::Bool:
+      node->format = MPV_FORMAT_FLAG;
+      node->u.flag = value.toBool();
+      break;
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+      node->format = MPV_FORMAT_INT64;
+      node->u.int64 = value.toLongLong();
+      break;
+    case QMetaType::Float:
+    case QMetaType::Double:
+      node->format = MPV_FORMAT_DOUBLE;
+      node->u.double_ = value.toDouble();
+      break;
+    case QMetaType::QVariantList:
+    case QMetaType::QStringList:
+    {
+      QVariantList list = value.toList();
+      node->format = MPV_FORMAT_NODE_ARRAY;
+      node->u.list = (mpv_node_list*)calloc(1, sizeof(mpv_node_list));
+      node->u.list->num = list.size();
+      node->u.list->values = (mpv_node*)calloc(list.size() + 1, sizeof(mpv_node));
+      for (int i = 0; i < list.size(); i++)
+        variantToNode(list[i], &node->u.list->values[i]);
+      break;
+    }
+    case QMetaType::QVariantMap:
+    {
+      QVariantMap map = value.toMap();
+      node->format = MPV_FORMAT_NODE_MAP;
+      node->u.list = (mpv_node_list*)calloc(1, sizeof(mpv_node_list));
+      node->u.list->num = map.size();
+      node->u.list->values = (mpv_node*)calloc(map.size() + 1, sizeof(mpv_node));
+      node->u.list->keys = (char**)calloc(map.size() + 1, sizeof(char*));
+      int i = 0;
+      for (auto it = map.constBegin(); it != map.constEnd(); ++it, i++)
+      {
+        node->u.list->keys[i] = copyString(it.key().toUtf8());
+        variantToNode(it.value(), &node->u.list->values[i]);
+      }
+      break;
+    }
+    default:
+      node->format = MPV_FORMAT_STRING;
+      node->u.string = copyString(value.toString().toUtf8());
+      break;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QVariant dataToVariant(mpv_format format, void* data)
+{
+  switch (format)
+  {
+    case MPV_FORMAT_STRING:
+    case MPV_FORMAT_OSD_STRING:
+      return QString::fromUtf8(*(char**)data);
+    case MPV_FORMAT_FLAG:
+      return (bool)*(int*)data;
+    case MPV_FORMAT_INT64:
+      return (qlonglong)*(int64_t*)data;
+    case MPV_FORMAT_DOUBLE:
+      return *(double*)data;
+    case MPV_FORMAT_NODE:
+      return mpv::qt::node_to_variant((mpv_node*)data);
+    default:
+      return QVariant();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int variantToData(const QVariant& value, mpv_format format, void* data)
+{
+  switch (format)
+  {
+    case MPV_FORMAT_STRING:
+    case MPV_FORMAT_OSD_STRING:
+      *(char**)data = copyString(value.toString().toUtf8());
+      return 0;
+    case MPV_FORMAT_FLAG:
+      *(int*)data = value.toBool();
+      return 0;
+    case MPV_FORMAT_INT64:
+      *(int64_t*)data = value.toLongLong();
+      return 0;
+    case MPV_FORMAT_DOUBLE:
+      *(double*)data = value.toDouble();
+      return 0;
+    case MPV_FORMAT_NODE:
+      variantToNode(value, (mpv_node*)data);
+      return 0;
+    default:
+      return MPV_ERROR_PROPERTY_FORMAT;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The caller holds the lock.
+static void queue(mpv_handle* ctx, mpv_event_id id, int error = 0, uint64_t userdata = 0)
+{
+  StubEvent event = {};
+  event.id = id;
+  event.error = error;
+  event.userdata = userdata;
+  ctx->events.append(event);
+  ctx->queued.wakeAll();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The caller holds the lock.
+static int queueChanges(mpv_handle* ctx, const char* name, const QVariant& value)
+{
+  int count = 0;
+  for (const StubObservation& observation : ctx->observations)
+  {
+    if (observation.name != name)
+      continue;
+
+    StubEvent event = {};
+    event.id = MPV_EVENT_PROPERTY_CHANGE;
+    event.userdata = observation.userdata;
+    event.name = observation.name;
+    event.format = observation.format;
+    event.value = value;
+    ctx->events.append(event);
+    count++;
+  }
+  if (count)
+    ctx->queued.wakeAll();
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Without the lock, like mpv, because the callback might want to call back into us.
+static void wakeup(mpv_handle* ctx)
+{
+  void (*callback)(void*) = nullptr;
+  void* data = nullptr;
+  {
+    QMutexLocker locker(&ctx->lock);
+    callback = ctx->wakeup;
+    data = ctx->wakeupData;
+  }
+  if (callback)
+    callback(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The caller holds the lock.
+static void releaseCurrent(mpv_handle* ctx)
+{
+  mpv_free_node_contents(&ctx->node);
+  if (ctx->valueIsString)
+    free(ctx->value.string);
+  ctx->valueIsString = false;
+  ctx->current = StubEvent();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The caller holds the lock. Returns whether the property changed.
+static bool setProperty(mpv_handle* ctx, const char* name, const QVariant& value)
+{
+  QVariant& stored = ctx->properties[QString::fromUtf8(name)];
+  if (stored == value && stored.type() == value.type())
+    return false;
+
+  stored = value;
+  return queueChanges(ctx, name, value) > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The caller holds the lock. Returns whether events were queued.
+static bool runCommand(mpv_handle* ctx, const QVariant& command, QVariant* result, int* error)
+{
+  QVariantList args = command.toList();
+  QString name = command.type() == QVariant::Map ? command.toMap()["name"].toString() : args.value(0).toString();
+
+  *result = QVariant();
+  *error = 0;
+
+  if (name.isEmpty())
+  {
+    *error = MPV_ERROR_INVALID_PARAMETER;
+    return false;
+  }
+
+  if (name == "loadfile")
+  {
+    queue(ctx, MPV_EVENT_START_FILE);
+    queue(ctx, MPV_EVENT_END_FILE);
+    ctx->events.last().reason = MPV_END_FILE_REASON_ERROR;
+    ctx->events.last().error = MPV_ERROR_LOADING_FAILED;
+    return true;
+  }
+
+  if (name == "quit")
+  {
+    queue(ctx, MPV_EVENT_SHUTDOWN);
+    return true;
+  }
+
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int MpvStub::queuePropertyChange(mpv_handle* mpv, const char* name, const QVariant& value)
+{
+  QMutexLocker locker(&mpv->lock);
+  return queueChanges(mpv, name, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MpvStub::queueEvent(mpv_handle* mpv, mpv_event_id id)
+{
+  QMutexLocker locker(&mpv->lock);
+  queue(mpv, id);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long mpv_client_api_version(void)
+{
+  return MPV_CLIENT_API_VERSION;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const char* mpv_error_string(int error)
+{
+  switch (error)
+  {
+    case MPV_ERROR_SUCCESS: return "success";
+    case MPV_ERROR_INVALID_PARAMETER: return "invalid parameter";
+    case MPV_ERROR_PROPERTY_FORMAT: return "unsupported format for accessing property";
+    case MPV_ERROR_PROPERTY_UNAVAILABLE: return "property unavailable";
+    case MPV_ERROR_LOADING_FAILED: return "loading failed";
+    default: return "unknown error";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const char* mpv_event_name(mpv_event_id event)
+{
+  switch (event)
+  {
+    case MPV_EVENT_NONE: return "none";
+    case MPV_EVENT_SHUTDOWN: return "shutdown";
+    case MPV_EVENT_LOG_MESSAGE: return "log-message";
+    case MPV_EVENT_SET_PROPERTY_REPLY: return "set-property-reply";
+    case MPV_EVENT_COMMAND_REPLY: return "command-reply";
+    case MPV_EVENT_START_FILE: return "start-file";
+    case MPV_EVENT_END_FILE: return "end-file";
+    case MPV_EVENT_SEEK: return "seek";
+    case MPV_EVENT_PLAYBACK_RESTART: return "playback-restart";
+    case MPV_EVENT_PROPERTY_CHANGE: return "property-change";
+    default: return "unknown";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_free(void* data)
+{
+  free(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_free_node_contents(mpv_node* node)
+{
+  switch (node->format)
+  {
+    case MPV_FORMAT_STRING:
+      free(node->u.string);
+      break;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP:
+    {
+      mpv_node_list* list = node->u.list;
+      for (int i = 0; i < list->num; i++)
+      {
+        if (list->keys)
+          free(list->keys[i]);
+        mpv_free_node_contents(&list->values[i]);
+      }
+      free(list->keys);
+      free(list->values);
+      free(list);
+      break;
+    }
+    default:;
+  }
+  node->format = MPV_FORMAT_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpv_handle* mpv_create(void)
+{
+  mpv_handle* ctx = new mpv_handle();
+  ctx->properties = defaultProperties();
+  ctx->node.format = MPV_FORMAT_NONE;
+  return ctx;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_initialize(mpv_handle* ctx)
+{
+  Q_UNUSED(ctx);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_terminate_destroy(mpv_handle* ctx)
+{
+  if (!ctx)
+    return;
+
+  {
+    QMutexLocker locker(&ctx->lock);
+    releaseCurrent(ctx);
+  }
+  delete ctx;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_request_log_messages(mpv_handle* ctx, const char* min_level)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(min_level);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_set_wakeup_callback(mpv_handle* ctx, void (*cb)(void* d), void* d)
+{
+  QMutexLocker locker(&ctx->lock);
+  ctx->wakeup = cb;
+  ctx->wakeupData = d;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_set_property(mpv_handle* ctx, const char* name, mpv_format format, void* data)
+{
+  QVariant value = dataToVariant(format, data);
+  if (!value.isValid())
+    return MPV_ERROR_PROPERTY_FORMAT;
+
+  bool changed;
+  {
+    QMutexLocker locker(&ctx->lock);
+    changed = setProperty(ctx, name, value);
+  }
+  if (changed)
+    wakeup(ctx);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_set_option(mpv_handle* ctx, const char* name, mpv_format format, void* data)
+{
+  return mpv_set_property(ctx, name, format, data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_set_property_async(mpv_handle* ctx, uint64_t reply_userdata, const char* name, mpv_format format,
+                           void* data)
+{
+  QVariant value = dataToVariant(format, data);
+
+  {
+    QMutexLocker locker(&ctx->lock);
+    if (value.isValid())
+      setProperty(ctx, name, value);
+    queue(ctx, MPV_EVENT_SET_PROPERTY_REPLY, value.isValid() ? 0 : MPV_ERROR_PROPERTY_FORMAT, reply_userdata);
+  }
+  wakeup(ctx);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_get_property(mpv_handle* ctx, const char* name, mpv_format format, void* data)
+{
+  QMutexLocker locker(&ctx->lock);
+  auto it = ctx->properties.constFind(QString::fromUtf8(name));
+  if (it == ctx->properties.constEnd())
+    return MPV_ERROR_PROPERTY_UNAVAILABLE;
+  return variantToData(it.value(), format, data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+char* mpv_get_property_osd_string(mpv_handle* ctx, const char* name)
+{
+  char* result = nullptr;
+  if (mpv_get_property(ctx, name, MPV_FORMAT_OSD_STRING, &result) < 0)
+    return nullptr;
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_observe_property(mpv_handle* mpv, uint64_t reply_userdata, const char* name, mpv_format format)
+{
+  {
+    QMutexLocker locker(&mpv->lock);
+
+    StubObservation observation = { reply_userdata, name, format };
+    mpv->observations.append(observation);
+
+    // mpv reports the current value (or that there's none) right away
+    StubEvent event = {};
+    event.id = MPV_EVENT_PROPERTY_CHANGE;
+    event.userdata = reply_userdata;
+    event.name = observation.name;
+    event.format = format;
+    event.value = mpv->properties.value(QString::fromUtf8(name));
+    mpv->events.append(event);
+    mpv->queued.wakeAll();
+  }
+  wakeup(mpv);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_unobserve_property(mpv_handle* mpv, uint64_t registered_reply_userdata)
+{
+  QMutexLocker locker(&mpv->lock);
+  int count = 0;
+  for (int i = mpv->observations.size() - 1; i >= 0; i--)
+  {
+    if (mpv->observations[i].userdata == registered_reply_userdata)
+    {
+      mpv->observations.removeAt(i);
+      count++;
+    }
+  }
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_command_node(mpv_handle* ctx, mpv_node* args, mpv_node* result)
+{
+  QVariant command = mpv::qt::node_to_variant(args);
+  QVariant value;
+  int error;
+  bool queued;
+  {
+    QMutexLocker locker(&ctx->lock);
+    queued = runCommand(ctx, command, &value, &error);
+  }
+  if (queued)
+    wakeup(ctx);
+
+  if (result)
+  {
+    result->format = MPV_FORMAT_NONE;
+    if (error >= 0)
+      variantToNode(value, result);
+  }
+  return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_command_node_async(mpv_handle* ctx, uint64_t reply_userdata, mpv_node* args)
+{
+  QVariant command = mpv::qt::node_to_variant(args);
+  {
+    QMutexLocker locker(&ctx->lock);
+    QVariant value;
+    int error;
+    runCommand(ctx, command, &value, &error);
+    queue(ctx, MPV_EVENT_COMMAND_REPLY, error, reply_userdata);
+    ctx->events.last().value = value;
+  }
+  wakeup(ctx);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_command_string(mpv_handle* ctx, const char* args)
+{
+  QVariantList command;
+  for (const QString& arg : QString::fromUtf8(args).split(' ', QString::SkipEmptyParts))
+    command.append(arg);
+
+  mpv::qt::node_builder node(command);
+  return mpv_command_node(ctx, node.node(), nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpv_event* mpv_wait_event(mpv_handle* ctx, double timeout)
+{
+  QMutexLocker locker(&ctx->lock);
+  releaseCurrent(ctx);
+
+  if (ctx->next >= ctx->events.size() && timeout != 0)
+  {
+    if (timeout < 0)
+    {
+      while (ctx->next >= ctx->events.size())
+        ctx->queued.wait(&ctx->lock);
+    }
+    else
+    {
+      ctx->queued.wait(&ctx->lock, (unsigned long)(timeout * 1000));
+    }
+  }
+
+  memset(&ctx->event, 0, sizeof(ctx->event));
+  if (ctx->next >= ctx->events.size())
+  {
+    // resize() keeps the capacity, so the next batch doesn't allocate
+    ctx->events.resize(0);
+    ctx->next = 0;
+    ctx->event.event_id = MPV_EVENT_NONE;
+    return &ctx->event;
+  }
+
+  ctx->current = ctx->events[ctx->next++];
+  const StubEvent& current = ctx->current;
+  ctx->event.event_id = current.id;
+  ctx->event.error = current.error;
+  ctx->event.reply_userdata = current.userdata;
+
+  switch (current.id)
+  {
+    case MPV_EVENT_PROPERTY_CHANGE:
+    {
+      memset(&ctx->property, 0, sizeof(ctx->property));
+      ctx->property.name = current.name.constData();
+      ctx->property.format = MPV_FORMAT_NONE;
+      if (current.value.isValid())
+      {
+        void* data = current.format == MPV_FORMAT_NODE ? (void*)&ctx->node : (void*)&ctx->value;
+        if (variantToData(current.value, current.format, data) >= 0)
+        {
+          ctx->property.format = current.format;
+          ctx->property.data = data;
+          ctx->valueIsString = current.format == MPV_FORMAT_STRING || current.format == MPV_FORMAT_OSD_STRING;
+        }
+      }
+      ctx->event.data = &ctx->property;
+      break;
+    }
+    case MPV_EVENT_END_FILE:
+    {
+      memset(&ctx->endFile, 0, sizeof(ctx->endFile));
+      ctx->endFile.reason = (decltype(ctx->endFile.reason))current.reason;
+      ctx->endFile.error = current.error;
+      ctx->event.error = 0;
+      ctx->event.data = &ctx->endFile;
+      break;
+    }
+#if MPV_CLIENT_API_VERSION >= MPV_MAKE_VERSION(1, 102)
+    case MPV_EVENT_COMMAND_REPLY:
+    {
+      memset(&ctx->command, 0, sizeof(ctx->command));
+      ctx->command.result.format = MPV_FORMAT_NONE;
+      if (current.error >= 0)
+      {
+        variantToNode(current.value, &ctx->node);
+        ctx->command.result = ctx->node;
+      }
+      ctx->event.data = &ctx->command;
+      break;
+    }
+#endif
+    default:;
+  }
+
+  return &ctx->event;
+}
+
+#ifdef HAVE_MPV_RENDER_API
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_stream_cb_add_ro(mpv_handle* ctx, const char* protocol, void* user_data, mpv_stream_cb_open_ro_fn open_fn)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(protocol);
+  Q_UNUSED(user_data);
+  Q_UNUSED(open_fn);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_render_context_create(mpv_render_context** res, mpv_handle* mpv, mpv_render_param* params)
+{
+  Q_UNUSED(mpv);
+  Q_UNUSED(params);
+  *res = nullptr;
+  return MPV_ERROR_UNSUPPORTED;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_render_context_set_update_callback(mpv_render_context* ctx, mpv_render_update_fn callback,
+                                            void* callback_ctx)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(callback);
+  Q_UNUSED(callback_ctx);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_render_context_render(mpv_render_context* ctx, mpv_render_param* params)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(params);
+  return MPV_ERROR_UNSUPPORTED;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t mpv_render_context_update(mpv_render_context* ctx)
+{
+  Q_UNUSED(ctx);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_render_context_report_swap(mpv_render_context* ctx)
+{
+  Q_UNUSED(ctx);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_render_context_free(mpv_render_context* ctx)
+{
+  Q_UNUSED(ctx);
+}
+#else
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void* mpv_get_sub_api(mpv_handle* ctx, mpv_sub_api sub_api)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(sub_api);
+  return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpv_opengl_cb_set_update_callback(mpv_opengl_cb_context* ctx, mpv_opengl_cb_update_fn callback,
+                                       void* callback_ctx)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(callback);
+  Q_UNUSED(callback_ctx);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_opengl_cb_init_gl(mpv_opengl_cb_context* ctx, const char* exts,
+                          mpv_opengl_cb_get_proc_address_fn get_proc_address, void* get_proc_address_ctx)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(exts);
+  Q_UNUSED(get_proc_address);
+  Q_UNUSED(get_proc_address_ctx);
+  return MPV_ERROR_INVALID_PARAMETER;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_opengl_cb_draw(mpv_opengl_cb_context* ctx, int fbo, int w, int h)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(fbo);
+  Q_UNUSED(w);
+  Q_UNUSED(h);
+  return MPV_ERROR_INVALID_PARAMETER;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_opengl_cb_report_flip(mpv_opengl_cb_context* ctx, int64_t time)
+{
+  Q_UNUSED(ctx);
+  Q_UNUSED(time);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int mpv_opengl_cb_uninit_gl(mpv_opengl_cb_context* ctx)
+{
+  Q_UNUSED(ctx);
+  return 0;
+}
+#endif
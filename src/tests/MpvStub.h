@@ -0,0 +1,22 @@
+#ifndef MPVSTUB_H
+#define MPVSTUB_H
+
+#include <QVariant>
+
+#include <mpv/client.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The test side of the mpv client the test target links instead of libmpv, see MpvStub.cpp.
+//
+namespace MpvStub
+{
+// Queue a change of the properties observed under this name, the way mpv reports them
+// while playing. Unlike the changes mpv_set_property() causes, the client isn't woken up,
+// the test drains the queue itself. Returns the number of events that were queued.
+int queuePropertyChange(mpv_handle* mpv, const char* name, const QVariant& value);
+
+// Queue an event without data, e.g. MPV_EVENT_SEEK, also without waking the client up.
+void queueEvent(mpv_handle* mpv, mpv_event_id id);
+}
+
+#endif // MPVSTUB_H
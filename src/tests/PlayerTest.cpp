@@ -0,0 +1,176 @@
+#include "PlayerTest.h"
+
+#include <QtTest>
+
+#include "player/PlayerComponent.h"
+#include "utils/Utils.h"
+#include "BenchmarkAllocations.h"
+#include "MpvStub.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerTest::initTestCase()
+{
+  // what main() does before the components are initialized
+  Codecs::preinitCodecs();
+
+  try
+  {
+    QVERIFY(PlayerComponent::Get().componentInitialize());
+  }
+  catch (FatalException& e)
+  {
+    QFAIL(qPrintable(e.message()));
+  }
+
+  // the initial values of the observed properties
+  QCoreApplication::processEvents();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerTest::cleanupTestCase()
+{
+  Codecs::Uninit();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StreamInfo PlayerTest::videoStream(const QString& codec, const QString& profile, int width, int height)
+{
+  StreamInfo stream = {};
+  stream.isVideo = true;
+  stream.codec = codec;
+  stream.profile = profile;
+  stream.videoResolution = QSize(width, height);
+  return stream;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StreamInfo PlayerTest::audioStream(const QString& codec, int channels)
+{
+  StreamInfo stream = {};
+  stream.isAudio = true;
+  stream.codec = codec;
+  stream.audioChannels = channels;
+  stream.audioSampleRate = 48000;
+  return stream;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The properties mpv keeps reporting during playback, in 100ms steps, the others only
+// change when a file starts or the user does something.
+//
+void PlayerTest::handleMpvEvents()
+{
+  PlayerComponent& player = PlayerComponent::Get();
+  mpv_handle* mpv = player.m_mpv;
+
+  for (const char* name : {"playback-time", "demuxer-cache-duration", "cache-speed", "cache-buffering-state", "avsync"})
+    QVERIFY2(player.m_propertyIds.contains(name), name);
+
+  // as if a file was playing, so the handlers do everything they do then
+  player.resetRebufferPrediction();
+  player.m_quality.start();
+  player.m_inPlayback = true;
+  player.m_playbackActive = true;
+  player.m_paused = false;
+  player.m_bufferingPercentage = 100;
+
+  int batch = 0;
+  double position = 0;
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    position = batch * 0.1;
+    double moving = position + (batch % 50) * 0.01;
+
+    AllocationCounter counter;
+    MpvStub::queuePropertyChange(mpv, "playback-time", position);
+    MpvStub::queuePropertyChange(mpv, "demuxer-cache-duration", moving);
+    MpvStub::queuePropertyChange(mpv, "cache-speed", moving);
+    MpvStub::queuePropertyChange(mpv, "cache-buffering-state", 100);
+    MpvStub::queuePropertyChange(mpv, "avsync", (batch % 50) * 0.001);
+    player.handleMpvEvents();
+    allocations.add(counter.stop());
+    batch++;
+  }
+  allocations.report("handleMpvEvents");
+
+  QCOMPARE(player.m_pendingPosition, position);
+  QCOMPARE(player.m_bufferingPercentage, 100);
+
+  player.m_snapshotTimer.stop();
+  player.m_quality.stop();
+  player.m_inPlayback = false;
+  player.m_playbackActive = false;
+  player.updatePlaybackState();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs before every file, asking mpv for the decoders it has.
+//
+void PlayerTest::updateCachedCodecList()
+{
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    Codecs::updateCachedCodecList();
+    allocations.add(counter.stop());
+  }
+  allocations.report("updateCachedCodecList");
+
+  for (const char* format : {"h264", "hevc", "aac", "flac"})
+  {
+    bool present = false;
+    for (const CodecDriver& codec : Codecs::findCodecsByFormat(Codecs::getCachedCodecList(), CodecType::Decoder, format))
+      present |= codec.present;
+    QVERIFY2(present, format);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PlayerTest::determineRequiredCodecs()
+{
+  // what a server typically has: a few video formats, each with a couple of audio tracks
+  QList<PlaybackInfo> files;
+  QList<QStringList> drivers;
+  PlaybackInfo info = {};
+  info.streams = { videoStream("h264", "high", 1920, 1080), audioStream("aac", 2), audioStream("ac3", 6) };
+  files.append(info);
+  drivers.append({ "h264", "aac", "ac3" });
+  info.streams = { videoStream("hevc", "main 10", 3840, 2160), audioStream("eac3", 6), audioStream("truehd", 8) };
+  files.append(info);
+  drivers.append({ "hevc", "eac3", "truehd" });
+  info.streams = { videoStream("mpeg2video", "main", 720, 576), audioStream("mp2", 2) };
+  files.append(info);
+  drivers.append({ "mpeg2video", "mp2" });
+  info.streams = { videoStream("vc1", "advanced", 1920, 1080), audioStream("dca", 6), audioStream("aac", 2) };
+  files.append(info);
+  drivers.append({ "vc1", "dca", "aac" });
+  info.streams = { audioStream("flac", 2) };
+  files.append(info);
+  drivers.append({ "flac" });
+  // the same with the AC3 encoder, for receivers that only take AC3
+  info.streams = files[0].streams;
+  info.enableAC3Transcoding = true;
+  files.append(info);
+  drivers.append({ "h264", "aac", "ac3", "ac3" });
+
+  // the decoders the stub lists are all installed, so they win over anything downloadable
+  for (int i = 0; i < files.size(); i++)
+  {
+    QStringList selected;
+    for (const CodecDriver& codec : Codecs::determineRequiredCodecs(files[i]))
+      selected.append(codec.driver);
+    QCOMPARE(selected, drivers[i]);
+  }
+
+  BenchmarkAllocations allocations;
+  QBENCHMARK
+  {
+    AllocationCounter counter;
+    for (const PlaybackInfo& file : files)
+      Codecs::determineRequiredCodecs(file);
+    allocations.add(counter.stop(), files.size());
+  }
+  allocations.report("determineRequiredCodecs");
+}
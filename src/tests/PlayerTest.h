@@ -0,0 +1,32 @@
+#ifndef PLAYERTEST_H
+#define PLAYERTEST_H
+
+#include <QList>
+#include <QObject>
+
+#include "player/CodecsComponent.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The main thread side of PlayerComponent, on top of the mpv stub: the property changes
+// mpv reports several times a second while playing go through handleMpvEvents() with the
+// state a playing file has, and codecs are selected for made up files covering the usual
+// video and audio formats against the decoders the stub lists.
+//
+class PlayerTest : public QObject
+{
+  Q_OBJECT
+
+private Q_SLOTS:
+  void initTestCase();
+  void cleanupTestCase();
+
+  void handleMpvEvents();
+  void updateCachedCodecList();
+  void determineRequiredCodecs();
+
+private:
+  static StreamInfo videoStream(const QString& codec, const QString& profile, int width, int height);
+  static StreamInfo audioStream(const QString& codec, int channels);
+};
+
+#endif // PLAYERTEST_H
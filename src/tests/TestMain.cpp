@@ -0,0 +1,65 @@
+#include <QApplication>
+#include <QStandardPaths>
+#include <QtTest>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "shared/Names.h"
+#include "Paths.h"
+#include "settings/SettingsComponent.h"
+#include "DisplayTest.h"
+#include "InputTest.h"
+#include "PlayerTest.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs the test class named by the first argument, or all of them, and passes the other
+// arguments on to QTest, e.g. "PlayerTest -iterations 1000". ctest runs each class on its
+// own with QT_QPA_PLATFORM=offscreen. The player is linked against the mpv stub, so
+// neither libmpv nor a display is needed.
+//
+int main(int argc, char** argv)
+{
+  // keeps the user's own settings, codec state and caches out of it
+  QStandardPaths::setTestModeEnabled(true);
+  Paths::invalidateCache();
+
+  QCoreApplication::setApplicationName(Names::MainName());
+  QCoreApplication::setOrganizationDomain("plex.tv");
+  QApplication app(argc, argv);
+
+  QStringList args = app.arguments();
+  QString only;
+  if (args.size() > 1 && !args[1].startsWith('-'))
+    only = args.takeAt(1);
+
+  // every test class reads settings
+  if (!SettingsComponent::Get().componentInitialize())
+  {
+    fprintf(stderr, "Failed to initialize the settings\n");
+    return EXIT_FAILURE;
+  }
+
+  PlayerTest player;
+  DisplayTest display;
+  InputTest input;
+  QList<QObject*> tests = { &player, &display, &input };
+
+  int failed = 0;
+  bool found = false;
+  for (QObject* test : tests)
+  {
+    if (!only.isEmpty() && only != test->metaObject()->className())
+      continue;
+    found = true;
+    failed += QTest::qExec(test, args);
+  }
+
+  if (!found)
+  {
+    fprintf(stderr, "There is no test class %s\n", qPrintable(only));
+    return EXIT_FAILURE;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
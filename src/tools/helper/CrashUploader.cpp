@@ -12,15 +12,187 @@
 #include <QEventLoop>
 #include <QFileInfo>
 #include <QSysInfo>
+#include <QtEndian>
+#include <QRegExp>
+#include <QVector>
 
 #include "Paths.h"
 #include "Version.h"
 #include "utils/Utils.h"
 #include "QsLog.h"
 #include "HelperSettings.h"
+#include "HelperStatus.h"
+#include "breakpad/BreakPad.h"
 
 #define UPLOAD_URL "https://crashreport.plexapp.com"
 
+// raw bytes encoded at a time, a multiple of 3 so the chunks don't need padding
+#define BASE64_CHUNK_BYTES (3 * 4096)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads a file as base64, a chunk at a time, so neither the dump nor its encoded copy has
+// to be in memory for the upload. Seekable, since the multipart body may be read again if
+// the request is resent.
+class Base64FileDevice : public QIODevice
+{
+public:
+  explicit Base64FileDevice(const QString& path) : m_file(path), m_pos(0), m_chunk(-1) {}
+
+  bool open(OpenMode mode) override
+  {
+    if (mode != QIODevice::ReadOnly || !m_file.open(QIODevice::ReadOnly))
+      return false;
+    m_pos = 0;
+    m_chunk = -1;
+    return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+  }
+
+  void close() override
+  {
+    m_file.close();
+    QIODevice::close();
+  }
+
+  qint64 size() const override { return (m_file.size() + 2) / 3 * 4; }
+
+  bool seek(qint64 pos) override
+  {
+    if (pos < 0 || pos > size() || !QIODevice::seek(pos))
+      return false;
+    m_pos = pos;
+    return true;
+  }
+
+protected:
+  qint64 readData(char* data, qint64 maxlen) override
+  {
+    qint64 done = 0;
+    while (done < maxlen && m_pos < size())
+    {
+      qint64 chunk = m_pos / (BASE64_CHUNK_BYTES / 3 * 4);
+      if (chunk != m_chunk)
+      {
+        if (!m_file.seek(chunk * BASE64_CHUNK_BYTES))
+          return done ? done : -1;
+        m_encoded = m_file.read(BASE64_CHUNK_BYTES).toBase64();
+        m_chunk = chunk;
+        if (m_encoded.isEmpty())
+          return done ? done : -1;
+      }
+
+      qint64 offset = m_pos - chunk * (BASE64_CHUNK_BYTES / 3 * 4);
+      qint64 count = qMin(maxlen - done, m_encoded.size() - offset);
+      if (count <= 0)
+        break;
+      memcpy(data + done, m_encoded.constData() + offset, count);
+      done += count;
+      m_pos += count;
+    }
+    return done;
+  }
+
+  qint64 writeData(const char*, qint64) override { return -1; }
+
+private:
+  QFile m_file;
+  qint64 m_pos;
+  qint64 m_chunk;
+  QByteArray m_encoded;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool readAt(QFile& file, qint64 offset, void* data, qint64 size)
+{
+  return file.seek(offset) && file.read((char*)data, size) == size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// "<exception code>@<module>+<offset>" from the exception and module list streams of a
+// minidump, empty if it has no exception or it can't be read. The offset instead of the
+// address, so the same crash matches no matter where the module was loaded.
+static QString minidumpSignature(const QString& path)
+{
+  // see MINIDUMP_HEADER, MINIDUMP_DIRECTORY, MINIDUMP_EXCEPTION_STREAM and MINIDUMP_MODULE
+  static const quint32 headerSignature = 0x504d444d; // "MDMP"
+  static const quint32 moduleListStream = 4;
+  static const quint32 exceptionStream = 6;
+  static const qint64 moduleSize = 108;
+
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return QString();
+
+  quint32 header[4];
+  if (!readAt(file, 0, header, sizeof(header)) || qFromLittleEndian(header[0]) != headerSignature)
+    return QString();
+
+  quint32 streamCount = qFromLittleEndian(header[2]);
+  quint32 directory = qFromLittleEndian(header[3]);
+  qint64 exceptionRva = -1, moduleListRva = -1;
+  for (quint32 i = 0; i < streamCount && i < 256; i++)
+  {
+    quint32 entry[3];
+    if (!readAt(file, directory + i * sizeof(entry), entry, sizeof(entry)))
+      return QString();
+    if (qFromLittleEndian(entry[0]) == exceptionStream)
+      exceptionRva = qFromLittleEndian(entry[2]);
+    else if (qFromLittleEndian(entry[0]) == moduleListStream)
+      moduleListRva = qFromLittleEndian(entry[2]);
+  }
+  if (exceptionRva < 0)
+    return QString();
+
+  // thread id and alignment, then the exception record: code, flags, record and address
+  quint32 code;
+  quint64 address;
+  if (!readAt(file, exceptionRva + 8, &code, sizeof(code)) ||
+      !readAt(file, exceptionRva + 24, &address, sizeof(address)))
+    return QString();
+  code = qFromLittleEndian(code);
+  address = qFromLittleEndian(address);
+
+  QString module = "?";
+  quint64 offset = address;
+  quint32 moduleCount = 0;
+  if (moduleListRva >= 0 && readAt(file, moduleListRva, &moduleCount, sizeof(moduleCount)))
+  {
+    moduleCount = qFromLittleEndian(moduleCount);
+    for (quint32 i = 0; i < moduleCount && i < 4096; i++)
+    {
+      // base, size, checksum, timestamp and the RVA of the name
+      quint64 base;
+      quint32 sizeAndName[4];
+      qint64 entry = moduleListRva + 4 + i * moduleSize;
+      if (!readAt(file, entry, &base, sizeof(base)) || !readAt(file, entry + 8, sizeAndName, sizeof(sizeAndName)))
+        break;
+      base = qFromLittleEndian(base);
+      quint32 size = qFromLittleEndian(sizeAndName[0]);
+      if (address < base || address >= base + size)
+        continue;
+
+      // MINIDUMP_STRING, the length in bytes and then UTF-16
+      quint32 nameRva = qFromLittleEndian(sizeAndName[3]);
+      quint32 nameLength;
+      if (readAt(file, nameRva, &nameLength, sizeof(nameLength)))
+      {
+        nameLength = qMin(qFromLittleEndian(nameLength), (quint32)1024) & ~1u;
+        QByteArray name(nameLength, 0);
+        if (readAt(file, nameRva + 4, name.data(), nameLength))
+        {
+          QVector<ushort> utf16(nameLength / 2);
+          for (int n = 0; n < utf16.size(); n++)
+            utf16[n] = qFromLittleEndian<quint16>((const uchar*)name.constData() + n * 2);
+          module = QString::fromUtf16(utf16.constData(), utf16.size()).section(QRegExp("[/\\\\]"), -1);
+        }
+      }
+      offset = address - base;
+      break;
+    }
+  }
+
+  return QString("%1@%2+%3").arg(code, 8, 16, QChar('0')).arg(module).arg(offset, 0, 16);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Delete crash dumps that are not from the current version. They are most likely useless.
 void CrashUploader::deleteOldCrashDumps()
@@ -39,6 +211,16 @@ void CrashUploader::deleteOldCrashDumps()
     }
   }
 
+  // and the signatures reported for them
+  HelperSettings settings;
+  settings.beginGroup(SIGNATURES_GROUP);
+  for (const QString& version : settings.childKeys())
+  {
+    if (version != Version::GetCanonicalVersionString())
+      settings.remove(version);
+  }
+  settings.endGroup();
+
   // clean out any things that are in progress.
   QDir progressDir(m_processing);
   progressDir.removeRecursively();
@@ -69,11 +251,39 @@ void CrashUploader::uploadCrashDump(const QString& version, const QString& path)
 
   QLOG_DEBUG() << "Crashdump:" << inProgressPath;
 
-  if (!file.open(QIODevice::ReadOnly))
+  // The same crash from the same version only needs to be reported once; after a bad
+  // release every client would otherwise send the same dump over and over.
+  // The crash handler leaves a fingerprint next to the dump if it could, otherwise we
+  // get one from the dump itself.
+  // It stays in the incoming directory until the dump is done with, so a failed upload
+  // still has it next time.
+  QString signature;
+  QString fingerprintPath = QFileInfo(path).path() + "/" + uuid + BREAKPAD_FINGERPRINT_EXT;
+  QFile fingerprint(fingerprintPath);
+  if (fingerprint.open(QIODevice::ReadOnly))
+    signature = QString::fromUtf8(fingerprint.readAll()).section(' ', 0, 0);
+  if (signature.isEmpty())
+    signature = minidumpSignature(inProgressPath);
+  QString signaturesKey = QString(SIGNATURES_GROUP) + "/" + version;
+  if (!signature.isEmpty() && HelperSettings().value(signaturesKey).toStringList().contains(signature))
+  {
+    QLOG_INFO() << "Not uploading crashdump" << uuid << "- already reported a crash with signature" << signature;
+    watchCrashDir(false);
+    QDir().mkpath(m_old + "/" + version);
+    QFile::rename(inProgressPath, m_old + "/" + version + "/" + QFileInfo(inProgressPath).fileName());
+    QFile::remove(fingerprintPath);
+    watchCrashDir(true);
+    return;
+  }
+
+  auto dumpDevice = new Base64FileDevice(inProgressPath);
+  if (!dumpDevice->open(QIODevice::ReadOnly))
   {
     QLOG_ERROR() << "Could not open crashdump file. will try again later.";
+    HelperStatus::Get().setLastError("Could not open crashdump " + inProgressPath);
+    delete dumpDevice;
     moveFileBackToIncoming(version, inProgressPath);
-    m_scanTimer->start(5000);
+    retryLater();
     return;
   }
 
@@ -94,11 +304,13 @@ void CrashUploader::uploadCrashDump(const QString& version, const QString& path)
   QHttpPart dataPart;
   dataPart.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/octet-stream"));
   dataPart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"dumpfileb64\""));
-  dataPart.setBody(file.readAll().toBase64());
+  dataPart.setBodyDevice(dumpDevice);
+  dumpDevice->setParent(multiPart);
   multiPart->append(dataPart);
 
   QNetworkReply* reply = m_manager->post(req, multiPart);
   multiPart->setParent(reply);
+  m_inFlight++;
 
   connect(reply, &QNetworkReply::sslErrors, [=](const QList<QSslError> & errors)
   {
@@ -108,6 +320,8 @@ void CrashUploader::uploadCrashDump(const QString& version, const QString& path)
   connect(reply, static_cast<void (QNetworkReply::*)()>(&QNetworkReply::finished), [=]()
   {
     QVariant statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    m_inFlight--;
+    reply->deleteLater();
 
     // The only situation in which we retry a failed crash dump upload is when
     // we get a 503 http status code (we got throttled because we are sending
@@ -118,27 +332,70 @@ void CrashUploader::uploadCrashDump(const QString& version, const QString& path)
     if (!statusCode.isValid() || statusCode.toInt() == 503)
     {
       QLOG_WARN() << "Failed to submit report with uuid:" << uuid << "will try again later";
+      HelperStatus::Get().setLastError(QString("Crash upload failed: %1").arg(statusCode.isValid() ? QString("HTTP 503") : reply->errorString()));
       moveFileBackToIncoming(version, inProgressPath);
-      m_scanTimer->start(5000);
+      retryLater();
       return;
     }
 
+    m_retryDelay = CRASH_UPLOAD_RETRY_MSEC;
+
+    // the server took it or doesn't want it, either way it's not uploaded again
     watchCrashDir(false);
     QDir().mkpath(m_old + "/" + version);
     QFile::rename(inProgressPath, m_old + "/" + version + "/" + QFileInfo(inProgressPath).fileName());
+    QFile::remove(fingerprintPath);
     watchCrashDir(true);
 
     if (statusCode.toInt() == 200)
     {
       QLOG_INFO() << "Submitted crash report with uuid:" << uuid;
+
+      if (!signature.isEmpty())
+      {
+        HelperSettings settings;
+        QStringList signatures = settings.value(signaturesKey).toStringList();
+        signatures << signature;
+        settings.setValue(signaturesKey, signatures);
+      }
     }
     else
     {
       QLOG_INFO() << "Server didn't want our crash report with uuid:" << uuid << "giving HTTP status" << statusCode.toInt() << "- saving it in old for now";
     }
+
+    startUploads();
   });
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CrashUploader::startUploads()
+{
+  // A pending retry means the server or the network isn't taking dumps right now.
+  while (m_inFlight < CRASH_UPLOAD_CONCURRENCY && !m_queue.isEmpty() && !m_scanTimer->isActive())
+  {
+    auto next = m_queue.takeFirst();
+    m_queuedPaths.remove(next.second);
+    if (QFile::exists(next.second))
+      uploadCrashDump(next.first, next.second);
+  }
+
+  HelperStatus::Get().setCrashQueueDepth(m_queue.size() + m_inFlight);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void CrashUploader::retryLater()
+{
+  // Everything still queued is in the incoming directory and found again by the next scan.
+  m_queue.clear();
+  m_queuedPaths.clear();
+  HelperStatus::Get().setCrashQueueDepth(m_inFlight);
+
+  QLOG_DEBUG() << "Retrying crashdump uploads in" << m_retryDelay / 1000 << "seconds";
+  m_scanTimer->start(m_retryDelay);
+  m_retryDelay = qMin(m_retryDelay * 2, CRASH_UPLOAD_RETRY_MAX_MSEC);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void CrashUploader::moveFileBackToIncoming(const QString& version, const QString& filename)
 {
@@ -176,14 +433,23 @@ void CrashUploader::uploadAndDeleteCrashDumps()
       {
         QLOG_DEBUG() << "We have uploaded more than 20 crash reports, removing:" << entry;
         QFile::remove(versionDir.filePath(entry));
+        QFile::remove(versionDir.filePath(QFileInfo(entry).completeBaseName() + BREAKPAD_FINGERPRINT_EXT));
+        continue;
       }
 
-      uploadCrashDump(version, versionDir.filePath(entry));
+      QString path = versionDir.filePath(entry);
+      if (!m_queuedPaths.contains(path))
+      {
+        m_queue.append(qMakePair(version, path));
+        m_queuedPaths.insert(path);
+      }
       numUploads ++;
     }
   }
 
   watchCrashDir(true);
+
+  startUploads();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -196,7 +462,8 @@ void CrashUploader::watchCrashDir(bool watch)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-CrashUploader::CrashUploader(QObject* parent) : QObject(parent)
+CrashUploader::CrashUploader(QObject* parent) : QObject(parent), m_inFlight(0),
+  m_retryDelay(CRASH_UPLOAD_RETRY_MSEC)
 {
   m_manager = new QNetworkAccessManager(this);
   m_watcher = new QFileSystemWatcher(this);
@@ -207,6 +474,10 @@ CrashUploader::CrashUploader(QObject* parent) : QObject(parent)
 
   connect(m_watcher, &QFileSystemWatcher::directoryChanged, [=](const QString& dir)
   {
+    // don't cut a retry backoff short
+    if (m_scanTimer->isActive() && m_scanTimer->interval() > 2000)
+      return;
+
     // wait 2 seconds before starting process dumps.
     m_scanTimer->start(2000);
   });
@@ -11,8 +11,18 @@
 #include <qnetworkreply.h>
 #include <qfilesystemwatcher.h>
 #include <qtimer.h>
+#include <QPair>
+#include <QSet>
 #include "Version.h"
 
+// uploads running at the same time
+#define CRASH_UPLOAD_CONCURRENCY 2
+// first retry after a failed upload, doubled for every failure in a row
+#define CRASH_UPLOAD_RETRY_MSEC 5000
+#define CRASH_UPLOAD_RETRY_MAX_MSEC (30 * 60 * 1000)
+// helper.conf group with the signatures of the reported crashes, one list per version
+#define SIGNATURES_GROUP "crashSignatures"
+
 class CrashUploader : public QObject
 {
   Q_OBJECT
@@ -22,6 +32,8 @@ public:
 
 private:
   Q_SLOT void uploadCrashDump(const QString& version, const QString& path);
+  void startUploads();
+  void retryLater();
 
   QString incomingCurrentVersion() { return m_incoming + "/" + Version::GetCanonicalVersionString(); }
   void deleteOldCrashDumps();
@@ -36,6 +48,12 @@ private:
   QString m_old, m_incoming, m_processing;
   QTimer* m_scanTimer;
   QMutex m_scanLock;
+
+  // version and path of the dumps waiting for an upload slot
+  QList<QPair<QString, QString>> m_queue;
+  QSet<QString> m_queuedPaths;
+  int m_inFlight;
+  int m_retryDelay;
 };
 
 #endif //KONVERGO_CRASHUPLOADER_H
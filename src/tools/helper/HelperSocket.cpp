@@ -11,11 +11,22 @@
 #include <QCoreApplication>
 
 /////////////////////////////////////////////////////////////////////////////////////////
-HelperSocket::HelperSocket(QObject* parent)
+HelperSocket::HelperSocket(QObject* parent) : m_clients(0), m_mainState(HelperStatus::MainGone)
 {
   m_server = new LocalJsonServer("pmpHelper", this);
   m_quitTimer = new QTimer(this);
 
+  m_heartbeatTimer = new QTimer(this);
+  m_heartbeatTimer->setTimerType(Qt::CoarseTimer);
+  connect(m_heartbeatTimer, &QTimer::timeout, this, &HelperSocket::heartbeat);
+  HelperStatus::Get().helperHeartbeat();
+  m_heartbeatTimer->start(HELPER_STATUS_HEARTBEAT_MSEC);
+
+  m_queueTimer = new QTimer(this);
+  m_queueTimer->setSingleShot(true);
+  m_queueTimer->setInterval(0);
+  connect(m_queueTimer, &QTimer::timeout, this, &HelperSocket::runQueued);
+
   connect(m_quitTimer, &QTimer::timeout, []()
   {
     QLOG_DEBUG() << "Quit timer ran out, quitting...";
@@ -40,8 +51,12 @@ void HelperSocket::clientConnected(QLocalSocket* socket)
 
   // if we are going to quit, restart the timer.
   m_quitTimer->stop();
+  m_clients++;
 
   connect(socket, &QLocalSocket::disconnected, [=](){
+    m_clients--;
+    m_mainState = HelperStatus::MainGone;
+
     // give us 5 minute to upload a crash log if we got one. then quit
     QLOG_DEBUG() << "PMP application quit, let's wait 3 minutes and then exit";
     m_quitTimer->start(3 * 60 * 1000);
@@ -52,22 +67,118 @@ void HelperSocket::clientConnected(QLocalSocket* socket)
 void HelperSocket::message(const QVariant& message)
 {
   QVariantMap map = message.toMap();
-  if (map.contains("command"))
+  if (map.value("command").toString() != HELPER_COMMAND_BATCH)
+  {
+    command(map);
+    return;
+  }
+
+  for (const QVariant& entry : map.value("commands").toList())
+    command(entry.toMap());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperSocket::command(const QVariantMap& command)
+{
+  if (!command.contains("command"))
+    return;
+
+  if (command.value("command").toString() == "quit")
+  {
+    execute(command);
+    return;
+  }
+
+  // a newer info replaces one that is still waiting
+  if (command.value("command").toString() == "info")
   {
-    if (map.value("command").toString() == "quit")
+    for (QVariant& queued : m_queued)
     {
-      QLOG_DEBUG() << "Asked to quit.";
-      qApp->quit();
+      if (queued.toMap().value("command").toString() == "info")
+      {
+        queued = command;
+        return;
+      }
     }
-    else if (map.value("command").toString() == "info")
-    {
-      QLOG_DEBUG() << "Updating clientID.";
-      QVariantMap arg = map.value("argument").toMap();
-      if (arg.contains("clientId"))
-        HelperSettings().setValue("clientId", arg.value("clientId").toString());
+  }
 
-      if (arg.contains("userId"))
-        HelperSettings().setValue("userId", arg.value("userId").toString());
-    }
+  m_queued << command;
+  m_queueTimer->start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperSocket::runQueued()
+{
+  if (m_queued.isEmpty())
+    return;
+
+  execute(m_queued.takeFirst().toMap());
+
+  if (!m_queued.isEmpty())
+    m_queueTimer->start();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperSocket::execute(const QVariantMap& command)
+{
+  QString name = command.value("command").toString();
+  if (name == "quit")
+  {
+    QLOG_DEBUG() << "Asked to quit.";
+    qApp->quit();
+  }
+  else if (name == "hello")
+  {
+    QVariantMap arg = command.value("argument").toMap();
+    QLOG_DEBUG() << "PMP application" << arg.value("version").toString() << "connected, pid" << arg.value("pid").toLongLong();
+  }
+  else if (name == "info")
+  {
+    QLOG_DEBUG() << "Updating clientID.";
+    QVariantMap arg = command.value("argument").toMap();
+    if (arg.contains("clientId"))
+      HelperSettings().setValue("clientId", arg.value("clientId").toString());
+
+    if (arg.contains("userId"))
+      HelperSettings().setValue("userId", arg.value("userId").toString());
+  }
+  else
+  {
+    QLOG_WARN() << "Unknown helper command:" << name;
   }
-}
\ No newline at end of file
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperSocket::heartbeat()
+{
+  HelperStatus& status = HelperStatus::Get();
+  status.helperHeartbeat();
+
+  if (m_clients == 0)
+    return;
+
+  // The socket tells us when the main application is gone, the heartbeat
+  // whether it still gets to run its event loop.
+  HelperStatus::MainState state = status.mainState();
+  if (state == m_mainState)
+    return;
+
+  switch (state)
+  {
+    case HelperStatus::MainAlive:
+      if (m_mainState == HelperStatus::MainBusy || m_mainState == HelperStatus::MainHung)
+        QLOG_INFO() << "PMP application is responding again";
+      break;
+    case HelperStatus::MainBusy:
+      QLOG_INFO() << "PMP application is busy";
+      break;
+    case HelperStatus::MainHung:
+      QLOG_WARN() << "PMP application didn't respond for" << HELPER_STATUS_STALE_MSEC / 1000 << "seconds, it seems to hang";
+      status.setLastError("Main application hangs");
+      break;
+    case HelperStatus::MainGone:
+      break;
+  }
+
+  m_mainState = state;
+}
@@ -7,9 +7,20 @@
 
 #include "Paths.h"
 #include "LocalJsonServer.h"
+#include "HelperStatus.h"
 
 #include <QTimer>
+#include <QVariantList>
 
+// Several commands in one message: {"command": "batch", "commands": [{"command": ...}, ...]}
+#define HELPER_COMMAND_BATCH "batch"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The helper side of the socket to the main application. Commands come in one per message or
+// batched. "quit" is handled as soon as it arrives, everything else (settings writes, crash
+// upload bookkeeping) is queued and run one command per event loop iteration, so it can't
+// hold up the heartbeat the main application watches.
+//
 class HelperSocket : public QObject
 {
   Q_OBJECT
@@ -19,8 +30,23 @@ public:
 private:
   Q_SLOT void clientConnected(QLocalSocket* socket);
   Q_SLOT void message(const QVariant& message);
+  Q_SLOT void heartbeat();
+  Q_SLOT void runQueued();
+
+  void command(const QVariantMap& command);
+  void execute(const QVariantMap& command);
+
   LocalJsonServer* m_server;
   QTimer* m_quitTimer;
+  QTimer* m_heartbeatTimer;
+
+  // the commands that aren't urgent, in order
+  QVariantList m_queued;
+  QTimer* m_queueTimer;
+
+  // only watched while the main application is connected
+  int m_clients;
+  HelperStatus::MainState m_mainState;
 };
 
 #endif //KONVERGO_HELPERSOCKET_H
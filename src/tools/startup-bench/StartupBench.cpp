@@ -0,0 +1,161 @@
+//
+// Runs the player with --benchmark-startup over and over, cold (profile and caches
+// wiped) and warm, and prints percentiles of the time spent in each startup phase.
+// The numbers come from the player's StartupTrace. Build with ENABLE_BENCHMARKS and
+// run the benchmark_startup target, or point --player at a binary yourself.
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QVector>
+
+#include <algorithm>
+#include <stdio.h>
+
+// a start that takes longer than this is broken, not slow
+#define BENCH_START_TIMEOUT_MSEC 120000
+
+typedef QMap<QString, QVector<double>> PhaseSamples;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static bool runPlayer(const QString& player, const QString& mode, QJsonObject& result)
+{
+  QProcess process;
+  process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+  process.start(player, { "--benchmark-startup", mode, "--no-updates" });
+
+  if (!process.waitForFinished(BENCH_START_TIMEOUT_MSEC))
+  {
+    fprintf(stderr, "The player didn't finish starting: %s\n", qPrintable(process.errorString()));
+    process.kill();
+    process.waitForFinished();
+    return false;
+  }
+
+  if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+  {
+    fprintf(stderr, "The player exited with %d\n", process.exitCode());
+    return false;
+  }
+
+  // the summary is the last line, anything before it is the player talking
+  QList<QByteArray> lines = process.readAllStandardOutput().trimmed().split('\n');
+  QJsonDocument document = QJsonDocument::fromJson(lines.last());
+  if (!document.isObject())
+  {
+    // another instance running makes the player quit right away, without one
+    fprintf(stderr, "No startup summary from the player, is another one running?\n");
+    return false;
+  }
+
+  result = document.object();
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static double percentile(QVector<double> values, int p)
+{
+  std::sort(values.begin(), values.end());
+  return values.at((values.size() - 1) * p / 100);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QJsonObject measure(const QString& player, const QString& mode, int runs)
+{
+  // the first warm start just fills the profile and caches
+  if (mode == "warm")
+  {
+    QJsonObject ignored;
+    if (!runPlayer(player, mode, ignored))
+      return QJsonObject();
+  }
+
+  PhaseSamples samples;
+  for (int i = 0; i < runs; i++)
+  {
+    QJsonObject result;
+    if (!runPlayer(player, mode, result))
+      return QJsonObject();
+
+    samples["total"].append(result.value("totalMsec").toDouble());
+
+    QJsonObject phases = result.value("phases").toObject();
+    for (auto it = phases.constBegin(); it != phases.constEnd(); ++it)
+      samples[it.key()].append(it.value().toDouble());
+
+    fprintf(stderr, "%s %d/%d: %.0f ms\n", qPrintable(mode), i + 1, runs, result.value("totalMsec").toDouble());
+  }
+
+  printf("\n%s start, %d runs                          p50 ms    p90 ms    max ms\n", qPrintable(mode), runs);
+
+  QJsonObject summary;
+  for (auto it = samples.constBegin(); it != samples.constEnd(); ++it)
+  {
+    double p50 = percentile(it.value(), 50);
+    double p90 = percentile(it.value(), 90);
+    double max = percentile(it.value(), 100);
+    printf("  %-40s %9.1f %9.1f %9.1f\n", qPrintable(it.key().left(40)), p50, p90, max);
+
+    QJsonObject phase;
+    phase.insert("p50", p50);
+    phase.insert("p90", p90);
+    phase.insert("max", max);
+    phase.insert("runs", it.value().size());
+    summary.insert(it.key(), phase);
+  }
+
+  fflush(stdout);
+  return summary;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measures cold and warm starts of the player");
+  parser.addHelpOption();
+  parser.addOptions({{"player", "The player binary, built with ENABLE_BENCHMARKS", "path"},
+                     {"runs", "Starts measured per mode", "count", "10"},
+                     {"mode", "cold, warm or both", "mode", "both"},
+                     {"output", "Also write the percentiles there as JSON", "file"}});
+  parser.process(app);
+
+  if (!parser.isSet("player"))
+  {
+    fprintf(stderr, "--player is required\n");
+    return EXIT_FAILURE;
+  }
+
+  QString mode = parser.value("mode");
+  QStringList modes = (mode == "both") ? QStringList{ "cold", "warm" } : QStringList{ mode };
+  int runs = qMax(1, parser.value("runs").toInt());
+
+  QJsonObject output;
+  for (const QString& m : modes)
+  {
+    QJsonObject summary = measure(parser.value("player"), m, runs);
+    if (summary.isEmpty())
+      return EXIT_FAILURE;
+    output.insert(m, summary);
+  }
+
+  if (parser.isSet("output"))
+  {
+    QFile file(parser.value("output"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(output).toJson()) < 0)
+    {
+      fprintf(stderr, "Can't write %s\n", qPrintable(parser.value("output")));
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
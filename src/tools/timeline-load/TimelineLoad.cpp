@@ -0,0 +1,280 @@
+//
+// Load generator for the remote timeline path: pretends to be a bunch of companion
+// controllers, some subscribed with a port the player pushes timelines to and
+// some long polling, and counts what the player sends them. Run it against a
+// player started with --benchmark-timeline, which drives the updates and reports
+// the CPU and latency side.
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QUuid>
+#include <QVector>
+
+#include <stdio.h>
+
+#include "qhttpserver.hpp"
+#include "qhttpserverrequest.hpp"
+#include "qhttpserverresponse.hpp"
+
+using namespace qhttp::server;
+
+// well below the 90 seconds after which the player drops a subscriber
+#define LOAD_RESUBSCRIBE_MSEC 30000
+#define LOAD_REPORT_MSEC 10000
+// a failed poll is retried after this long
+#define LOAD_POLL_RETRY_MSEC 1000
+
+/////////////////////////////////////////////////////////////////////////////////////////
+class TimelineLoad : public QObject
+{
+  Q_OBJECT
+public:
+  TimelineLoad(const QUrl& player, int subscribers, int pollers, quint16 port) : QObject(nullptr),
+    m_player(player), m_port(port)
+  {
+    for (int i = 0; i < subscribers; i++)
+      m_subscriberIds << QUuid::createUuid().toString().mid(1, 36);
+
+    for (int i = 0; i < pollers; i++)
+    {
+      Poller poller;
+      poller.identifier = QUuid::createUuid().toString().mid(1, 36);
+      // QNetworkAccessManager only keeps six connections per host, and each poll holds one
+      poller.network = new QNetworkAccessManager(this);
+      m_pollers << poller;
+    }
+
+    m_network = new QNetworkAccessManager(this);
+
+    m_resubscribeTimer.setInterval(LOAD_RESUBSCRIBE_MSEC);
+    connect(&m_resubscribeTimer, &QTimer::timeout, this, &TimelineLoad::subscribeAll);
+    m_reportTimer.setInterval(LOAD_REPORT_MSEC);
+    connect(&m_reportTimer, &QTimer::timeout, this, &TimelineLoad::report);
+  }
+
+  bool start()
+  {
+    if (!m_subscriberIds.isEmpty())
+    {
+      m_server = new QHttpServer(this);
+      connect(m_server, &QHttpServer::newRequest, this, &TimelineLoad::handleTimeline);
+      if (!m_server->listen(QHostAddress::Any, m_port))
+      {
+        fprintf(stderr, "Can't listen on port %d\n", m_port);
+        return false;
+      }
+    }
+
+    printf("%d push subscribers on port %d, %d pollers, player %s\n", m_subscriberIds.size(), m_port,
+           m_pollers.size(), qPrintable(m_player.toString()));
+
+    m_clock.start();
+    subscribeAll();
+    for (int i = 0; i < m_pollers.size(); i++)
+      poll(i);
+
+    m_resubscribeTimer.start();
+    m_reportTimer.start();
+    return true;
+  }
+
+  void stop()
+  {
+    m_resubscribeTimer.stop();
+    report();
+
+    for (const QString& identifier : m_subscriberIds)
+      m_network->get(playerRequest("/player/timeline/unsubscribe", identifier, QUrlQuery()));
+    for (const Poller& poller : m_pollers)
+      m_network->get(playerRequest("/player/timeline/unsubscribe", poller.identifier, QUrlQuery()));
+
+    // give the unsubscribes a moment to go out
+    QTimer::singleShot(1000, qApp, &QCoreApplication::quit);
+  }
+
+private:
+  struct Poller
+  {
+    QString identifier;
+    QNetworkAccessManager* network;
+    quint64 commandID = 0;
+  };
+
+  struct Counters
+  {
+    qint64 timelines = 0;
+    qint64 bytes = 0;
+    qint64 errors = 0;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  QNetworkRequest playerRequest(const QString& path, const QString& identifier, QUrlQuery query)
+  {
+    QUrl url(m_player);
+    url.setPath(path);
+    query.addQueryItem("commandID", QString::number(m_commandID++));
+    url.setQuery(query);
+
+    QNetworkRequest request(url);
+    request.setRawHeader("X-Plex-Client-Identifier", identifier.toUtf8());
+    request.setRawHeader("X-Plex-Device-Name", "timeline-load " + identifier.left(8).toUtf8());
+    request.setRawHeader("X-Plex-Product", "timeline-load");
+    return request;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  void subscribeAll()
+  {
+    QUrlQuery query;
+    query.addQueryItem("protocol", "http");
+    query.addQueryItem("port", QString::number(m_port));
+
+    for (const QString& identifier : m_subscriberIds)
+    {
+      QNetworkReply* reply = m_network->get(playerRequest("/player/timeline/subscribe", identifier, query));
+      connect(reply, &QNetworkReply::finished, this, [=]()
+      {
+        if (reply->error() != QNetworkReply::NoError)
+        {
+          m_push.errors++;
+          fprintf(stderr, "Subscribing failed: %s\n", qPrintable(reply->errorString()));
+        }
+        reply->deleteLater();
+      });
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  void poll(int index)
+  {
+    Poller& poller = m_pollers[index];
+
+    QUrlQuery query;
+    query.addQueryItem("wait", "1");
+
+    // the poll response carries the timeline, what the player sees as commandID
+    // is only used for matching up the replies
+    QNetworkReply* reply = poller.network->get(playerRequest("/player/timeline/poll", poller.identifier, query));
+    connect(reply, &QNetworkReply::finished, this, [=]()
+    {
+      reply->deleteLater();
+
+      if (reply->error() != QNetworkReply::NoError)
+      {
+        m_poll.errors++;
+        QTimer::singleShot(LOAD_POLL_RETRY_MSEC, this, [=]() { poll(index); });
+        return;
+      }
+
+      QByteArray data = reply->readAll();
+      m_poll.timelines++;
+      m_poll.bytes += data.size() + headerSize(reply->rawHeaderPairs());
+      poll(index);
+    });
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  static qint64 headerSize(const QList<QNetworkReply::RawHeaderPair>& headers)
+  {
+    // "name: value\r\n", the status line isn't available and left out
+    qint64 size = 0;
+    for (const auto& header : headers)
+      size += header.first.size() + header.second.size() + 4;
+    return size;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  void handleTimeline(QHttpRequest* request, QHttpResponse* response)
+  {
+    request->collectData();
+    request->onEnd([=]()
+    {
+      qint64 size = request->collectedData().size();
+      for (auto it = request->headers().constBegin(); it != request->headers().constEnd(); ++it)
+        size += it.key().size() + it.value().size() + 4;
+
+      m_push.timelines++;
+      m_push.bytes += size;
+
+      // controllers keep the connection, so the player shouldn't have to reconnect every time
+      response->addHeader("connection", "keep-alive");
+      response->addHeader("content-length", "0");
+      response->setStatusCode(qhttp::ESTATUS_OK);
+      response->end();
+    });
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  void reportLine(const char* name, int clients, Counters& counters, double seconds)
+  {
+    if (!clients)
+      return;
+
+    printf("%-5s %5d clients %8.1f timelines/s %10.0f bytes/s %8.0f bytes/timeline %6lld errors\n", name, clients,
+           counters.timelines / seconds, counters.bytes / seconds,
+           counters.timelines ? (double)counters.bytes / counters.timelines : 0.0, (long long)counters.errors);
+    counters = Counters();
+  }
+
+  /////////////////////////////////////////////////////////////////////////////////////////
+  void report()
+  {
+    qint64 now = m_clock.elapsed();
+    double seconds = qMax(1LL, now - m_lastReport) / 1000.0;
+    m_lastReport = now;
+
+    reportLine("push", m_subscriberIds.size(), m_push, seconds);
+    reportLine("poll", m_pollers.size(), m_poll, seconds);
+    fflush(stdout);
+  }
+
+  QUrl m_player;
+  quint16 m_port;
+  QHttpServer* m_server = nullptr;
+  QNetworkAccessManager* m_network;
+  QStringList m_subscriberIds;
+  QVector<Poller> m_pollers;
+  quint64 m_commandID = 0;
+
+  QTimer m_resubscribeTimer;
+  QTimer m_reportTimer;
+  QElapsedTimer m_clock;
+  qint64 m_lastReport = 0;
+  Counters m_push;
+  Counters m_poll;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Simulates companion controllers subscribing to the player's timeline");
+  parser.addHelpOption();
+  parser.addOptions({{"player", "Base URL of the player", "url", "http://127.0.0.1:32433"},
+                     {"subscribers", "Controllers the player pushes timelines to", "count", "10"},
+                     {"pollers", "Controllers long polling for timelines", "count", "0"},
+                     {"port", "Where the pushed timelines are received", "port", "32500"},
+                     {"duration", "Stop after this many seconds, 0 runs until killed", "seconds", "0"}});
+  parser.process(app);
+
+  TimelineLoad load(QUrl(parser.value("player")), parser.value("subscribers").toInt(),
+                    parser.value("pollers").toInt(), (quint16)parser.value("port").toUInt());
+  if (!load.start())
+    return EXIT_FAILURE;
+
+  int duration = parser.value("duration").toInt();
+  if (duration > 0)
+    QTimer::singleShot(duration * 1000, &load, &TimelineLoad::stop);
+
+  return app.exec();
+}
+
+#include "TimelineLoad.moc"
@@ -0,0 +1,222 @@
+#include "ArtworkImageProvider.h"
+#include "QsLog.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QImageReader>
+#include <QBuffer>
+#include <QThreadStorage>
+#include <QPointer>
+#include <QUrl>
+
+#include <climits>
+
+// default budget of the decoded artwork, in megabytes
+#define ARTWORK_CACHE_DEFAULT_MB 64
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ArtworkCache& ArtworkCache::Get()
+{
+  static ArtworkCache cache;
+  return cache;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ArtworkCache::ArtworkCache() : m_images(ARTWORK_CACHE_DEFAULT_MB * 1024 * 1024),
+  m_budget(ARTWORK_CACHE_DEFAULT_MB * 1024 * 1024), m_memoryShare(1)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ArtworkCache::find(const QString& key, QImage& image)
+{
+  QMutexLocker lock(&m_lock);
+
+  // QCache::object() also moves the entry to the front
+  QImage* cached = m_images.object(key);
+  if (!cached)
+    return false;
+
+  image = *cached;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::insert(const QString& key, const QImage& image)
+{
+  QMutexLocker lock(&m_lock);
+  m_images.insert(key, new QImage(image), image.byteCount());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::clear()
+{
+  QMutexLocker lock(&m_lock);
+  m_images.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::setBudget(int megabytes)
+{
+  setBudgetBytes((qint64)qMax(megabytes, 0) * 1024 * 1024);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::setBudgetBytes(qint64 bytes)
+{
+  QMutexLocker lock(&m_lock);
+  m_budget = qMax(bytes, (qint64)0);
+  applyBudget();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::setMemoryShare(double share)
+{
+  QMutexLocker lock(&m_lock);
+  m_memoryShare = share;
+  applyBudget();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ArtworkCache::applyBudget()
+{
+  m_images.setMaxCost((int)qMin((qint64)(m_budget * m_memoryShare), (qint64)INT_MAX));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The responses are created on Qt's image loader thread, each thread needs its own manager.
+static QNetworkAccessManager* networkManager()
+{
+  static QThreadStorage<QNetworkAccessManager*> managers;
+  if (!managers.hasLocalData())
+    managers.setLocalData(new QNetworkAccessManager);
+  return managers.localData();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Fit the picture into the requested size, keeping its aspect. A 0 dimension is unbounded,
+// like sourceSize of a QML Image.
+static QSize fitSize(const QSize& full, const QSize& requested)
+{
+  if (!full.isValid() || full.isEmpty() || (requested.width() <= 0 && requested.height() <= 0))
+    return QSize();
+
+  QSize bounds(requested.width() > 0 ? requested.width() : INT_MAX,
+               requested.height() > 0 ? requested.height() : INT_MAX);
+  if (full.width() <= bounds.width() && full.height() <= bounds.height())
+    return QSize();
+
+  return full.scaled(bounds, Qt::KeepAspectRatio);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class ArtworkResponse : public QQuickImageResponse
+{
+public:
+  ArtworkResponse(ArtworkCache* cache, const QUrl& url, const QSize& requestedSize, const QString& key)
+    : m_cache(cache), m_requestedSize(requestedSize), m_key(key)
+  {
+    if (m_cache->find(m_key, m_image))
+    {
+      // finished() must not be emitted before the loader had a chance to connect to it
+      QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+      return;
+    }
+
+    m_reply = networkManager()->get(QNetworkRequest(url));
+    connect(m_reply.data(), &QNetworkReply::finished, this, [=]() { decode(); });
+  }
+
+  ~ArtworkResponse() override
+  {
+    if (m_reply)
+      m_reply->deleteLater();
+  }
+
+  QQuickTextureFactory* textureFactory() const override
+  {
+    return QQuickTextureFactory::textureFactoryForImage(m_image);
+  }
+
+  QString errorString() const override { return m_error; }
+
+  void cancel() override
+  {
+    if (m_reply)
+      m_reply->abort();
+  }
+
+private:
+  void decode()
+  {
+    if (m_reply->error() != QNetworkReply::NoError)
+    {
+      m_error = m_reply->errorString();
+    }
+    else
+    {
+      // the reply is sequential, the reader needs to seek back after peeking at the size
+      if (ArtworkImageProvider::decode(m_reply->readAll(), m_requestedSize, m_image, m_error))
+        m_cache->insert(m_key, m_image);
+    }
+
+    if (!m_error.isEmpty())
+      QLOG_DEBUG() << "Failed to load artwork" << m_reply->url().toString() << ":" << m_error;
+
+    m_reply->deleteLater();
+    m_reply = nullptr;
+    emit finished();
+  }
+
+  ArtworkCache* m_cache;
+  QPointer<QNetworkReply> m_reply;
+  QSize m_requestedSize;
+  QString m_key;
+  QImage m_image;
+  QString m_error;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ArtworkImageProvider::ArtworkImageProvider(ArtworkCache* cache) : QQuickAsyncImageProvider(), m_cache(cache)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ArtworkImageProvider::imageSource(const QUrl& url, const QString& name)
+{
+  return "image://" + name + "/" + QString::fromLatin1(QUrl::toPercentEncoding(url.toString()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ArtworkImageProvider::cacheKey(const QUrl& url, const QSize& requestedSize)
+{
+  return QString("%1@%2x%3").arg(url.toString()).arg(requestedSize.width()).arg(requestedSize.height());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ArtworkImageProvider::decode(const QByteArray& data, const QSize& requestedSize, QImage& image, QString& error)
+{
+  QBuffer buffer;
+  buffer.setData(data);
+  buffer.open(QIODevice::ReadOnly);
+  QImageReader reader(&buffer);
+
+  // lets the decoder (hardware on the Pi) produce the small picture directly
+  QSize scaledSize = fitSize(reader.size(), requestedSize);
+  if (scaledSize.isValid())
+    reader.setScaledSize(scaledSize);
+
+  if (!reader.read(&image))
+  {
+    error = reader.errorString();
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QQuickImageResponse* ArtworkImageProvider::requestImageResponse(const QString& id, const QSize& requestedSize)
+{
+  QUrl url(QUrl::fromPercentEncoding(id.toUtf8()));
+  return new ArtworkResponse(m_cache, url, requestedSize, cacheKey(url, requestedSize));
+}
@@ -0,0 +1,60 @@
+#ifndef ARTWORKIMAGEPROVIDER_H
+#define ARTWORKIMAGEPROVIDER_H
+
+#include <QQuickImageProvider>
+#include <QCache>
+#include <QMutex>
+#include <QImage>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Decoded artwork, kept by least recently used and limited by the bytes of the decoded images.
+// Shared by all threads loading images. Get() is the one of image://artwork, others can have
+// their own (for a budget of their own).
+class ArtworkCache
+{
+public:
+  ArtworkCache();
+  static ArtworkCache& Get();
+
+  bool find(const QString& key, QImage& image);
+  void insert(const QString& key, const QImage& image);
+  void clear();
+  void setBudget(int megabytes);
+  void setBudgetBytes(qint64 bytes);
+  // Share of the budget that may be used while the system is short on memory, 1 normally.
+  // Shrinking drops the least recently used images right away.
+  void setMemoryShare(double share);
+
+private:
+  void applyBudget();
+
+  QMutex m_lock;
+  QCache<QString, QImage> m_images;
+  qint64 m_budget;
+  double m_memoryShare;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Serves image://artwork/<percent encoded url>. The image is downloaded and decoded (at the
+// requested size, which the RPI_jpeg plugin does in hardware) once, later requests for the same
+// url and size are answered from the cache, ArtworkCache::Get() unless it's given another one.
+class ArtworkImageProvider : public QQuickAsyncImageProvider
+{
+public:
+  explicit ArtworkImageProvider(ArtworkCache* cache = &ArtworkCache::Get());
+
+  QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
+
+  // What a QML Image loads url through from the provider registered as name, and where its
+  // cache keeps it. requestedSize is the sourceSize of the Image times the device pixel ratio.
+  static QString imageSource(const QUrl& url, const QString& name = "artwork");
+  static QString cacheKey(const QUrl& url, const QSize& requestedSize);
+
+  // Decodes at the requested size (see fitSize()). Can be called from any thread.
+  static bool decode(const QByteArray& data, const QSize& requestedSize, QImage& image, QString& error);
+
+private:
+  ArtworkCache* m_cache;
+};
+
+#endif // ARTWORKIMAGEPROVIDER_H
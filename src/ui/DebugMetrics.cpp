@@ -0,0 +1,98 @@
+#include "DebugMetrics.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/time.h>
+#endif
+
+#define METRICS_INTERVAL_MSEC 1000
+// samples kept per metric, i.e. two minutes of graph
+#define METRICS_HISTORY 120
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 processCpuTimeUsec()
+{
+#if defined(Q_OS_WIN)
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0;
+  auto toUsec = [](const FILETIME& ft) { return (((qint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime) / 10; };
+  return toUsec(kernel) + toUsec(user);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return (qint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DebugMetrics::DebugMetrics(QObject* parent) : QObject(parent), m_timer(this)
+{
+  m_timer.setInterval(METRICS_INTERVAL_MSEC);
+  connect(&m_timer, &QTimer::timeout, this, &DebugMetrics::sample);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DebugMetrics::addMetric(const QString& name, const Sampler& sampler)
+{
+  m_samplers[name] = sampler;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DebugMetrics::setActive(bool active)
+{
+  if (active == m_timer.isActive())
+    return;
+
+  if (active)
+  {
+    m_timer.start();
+    sample();
+  }
+  else
+  {
+    m_timer.stop();
+    m_history.clear();
+    m_values.clear();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantList DebugMetrics::history(const QString& name) const
+{
+  QVariantList list;
+  for (double value : m_history.value(name))
+    list << value;
+  return list;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DebugMetrics::sample()
+{
+  QVariantMap changed;
+
+  for (auto it = m_samplers.begin(); it != m_samplers.end(); ++it)
+  {
+    double value = it.value()();
+
+    QVector<double>& history = m_history[it.key()];
+    if (history.size() >= METRICS_HISTORY)
+      history.remove(0);
+    history.append(value);
+
+    QVariant& last = m_values[it.key()];
+    if (!last.isValid() || last.toDouble() != value)
+    {
+      last = value;
+      changed[it.key()] = value;
+    }
+  }
+
+  // The graphs scroll, so they're repainted on every sample anyway. The signal
+  // is still sent if nothing changed, but without arguments to convert.
+  emit metricsChanged(changed);
+}
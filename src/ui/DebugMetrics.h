@@ -0,0 +1,48 @@
+#ifndef DEBUGMETRICS_H
+#define DEBUGMETRICS_H
+
+#include <QObject>
+#include <QMap>
+#include <QTimer>
+#include <QVariant>
+#include <QVector>
+
+#include <functional>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Numbers for the debug overlay graphs. Each metric is a function that returns
+// the current value; they're sampled once per interval while the overlay is
+// visible, and only the values that changed are pushed to QML.
+class DebugMetrics : public QObject
+{
+  Q_OBJECT
+public:
+  typedef std::function<double()> Sampler;
+
+  explicit DebugMetrics(QObject* parent = nullptr);
+
+  void addMetric(const QString& name, const Sampler& sampler);
+  void setActive(bool active);
+
+  Q_INVOKABLE QStringList names() const { return m_samplers.keys(); }
+  // The last samples of a metric, oldest first.
+  Q_INVOKABLE QVariantList history(const QString& name) const;
+  Q_INVOKABLE QVariantMap values() const { return m_values; }
+
+Q_SIGNALS:
+  // Only contains the metrics whose value differs from the last sample.
+  void metricsChanged(const QVariantMap& changed);
+
+private:
+  void sample();
+
+  QTimer m_timer;
+  QMap<QString, Sampler> m_samplers;
+  QMap<QString, QVector<double>> m_history;
+  QVariantMap m_values;
+};
+
+// CPU time used by this process so far, in microseconds.
+qint64 processCpuTimeUsec();
+
+#endif // DEBUGMETRICS_H
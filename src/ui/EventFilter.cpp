@@ -5,9 +5,11 @@
 #include "EventFilter.h"
 #include "system/SystemComponent.h"
 #include "settings/SettingsComponent.h"
+#include "settings/SettingsSection.h"
 #include "input/InputKeyboard.h"
 #include "KonvergoWindow.h"
 
+#include <QHash>
 #include <QKeyEvent>
 #include <QObject>
 
@@ -22,43 +24,125 @@ static QStringList desktopWhiteListedKeys = { "Media Play",
 // These just happen to be mostly the same.
 static QStringList win32AppcommandBlackListedKeys = desktopWhiteListedKeys;
 
+struct KeyName
+{
+  QString name;
+  // the name isn't usable, see keyEventToKeyString()
+  bool mangle;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static QString keyEventToKeyString(QKeyEvent *kevent)
+// Names only depend on the key code (and the modifier combination), so each is
+// built with QKeySequence once and looked up afterwards. Only used from the GUI thread.
+static const KeyName& keyName(int key)
 {
-  // We ignore the KeypadModifier here since it's practically useless
-  QKeySequence modifiers(kevent->modifiers() &= ~Qt::KeypadModifier);
+  static QHash<int, KeyName> names;
+
+  auto it = names.find(key);
+  if (it != names.end())
+    return *it;
 
-  QKeySequence keySeq(kevent->key());
-  QString key = keySeq.toString();
+  KeyName entry;
+  entry.name = QKeySequence(key).toString();
 
   // Qt tends to make up something weird for keys which don't cleanly map to text.
   // See e.g. QKeySequencePrivate::keyName() in the Qt sources.
   // We can't really know for sure which names are "good" or "bad", so we simply
   // allow printable latin1 characters, and mangle everything else.
-  if ((key.size() > 0 && (key[0].unicode() < 32 || key[0].unicode() > 255)))
+  entry.mangle = entry.name.size() > 0 && (entry.name[0].unicode() < 32 || entry.name[0].unicode() > 255);
+  if (entry.mangle)
   {
-    if (kevent->nativeVirtualKey() != 0)
-    {
-      key = "0x" + QString::number(kevent->nativeVirtualKey(), 16) + "V";
-    }
-    else
+    QString properKey;
+    for (int n = 0; n < entry.name.size(); n++)
+      properKey += QString(n > 0 ? "+" : "") + "0x" + QString::number(entry.name[n].unicode(), 16) + "Q";
+    entry.name = properKey;
+  }
+
+  return *names.insert(key, entry);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static const QString& modifiersName(Qt::KeyboardModifiers modifiers)
+{
+  static QHash<int, QString> names;
+
+  auto it = names.find((int)modifiers);
+  if (it != names.end())
+    return *it;
+
+  return *names.insert((int)modifiers, QKeySequence((int)modifiers).toString());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The Qt::Key with the modifiers, which InputComponent looks the actions up by. 0 for keys
+// that have to be named by their native key code, those can't be told apart by it.
+static int keyCombination(QKeyEvent* kevent)
+{
+  if (keyName(kevent->key()).mangle && kevent->nativeVirtualKey() != 0)
+    return 0;
+
+  // key codes stay below the modifier bits
+  return kevent->key() | (int)(kevent->modifiers() & ~Qt::KeypadModifier);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString keyEventToKeyString(QKeyEvent *kevent)
+{
+  // We ignore the KeypadModifier here since it's practically useless
+  const QString& modifiers = modifiersName(kevent->modifiers() & ~Qt::KeypadModifier);
+
+  const KeyName& key = keyName(kevent->key());
+  if (key.mangle && kevent->nativeVirtualKey() != 0)
+    return modifiers + "0x" + QString::number(kevent->nativeVirtualKey(), 16) + "V";
+
+  return modifiers + key.name;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+EventFilter::EventFilter(QObject* parent)
+  : QObject(parent), m_currentKeyDown(false), m_webDesktopMode(false), m_disableMouse(false)
+{
+  KonvergoWindow* window = qobject_cast<KonvergoWindow*>(parent);
+  if (window)
+  {
+    m_webDesktopMode = window->property("webDesktopMode").toBool();
+    connect(window, &KonvergoWindow::webDesktopModeChanged, this, [=]()
     {
-      QString properKey;
-      for (int n = 0; n < key.size(); n++)
-        properKey += QString(n > 0 ? "+" : "") + "0x" + QString::number(key[n].unicode(), 16) + "Q";
-      key = properKey;
-    }
+      m_webDesktopMode = window->property("webDesktopMode").toBool();
+    });
   }
 
-  return modifiers.toString() + key;
+  m_disableMouse = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "disablemouse").toBool();
+  connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_MAIN), &SettingsSection::valuesUpdated,
+          this, &EventFilter::updateSettings);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void EventFilter::updateSettings(const QVariantMap& values)
+{
+  if (values.contains("disablemouse"))
+    m_disableMouse = values["disablemouse"].toBool();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool EventFilter::eventFilter(QObject* watched, QEvent* event)
 {
-  KonvergoWindow* window = qobject_cast<KonvergoWindow*>(parent());
+  QEvent::Type type = event->type();
+
+  // The most frequent event by far, keep it short.
+  if (type == QEvent::MouseMove)
+  {
+    if (m_webDesktopMode)
+      return QObject::eventFilter(watched, event);
+    if (m_disableMouse)
+      return true;
+    SystemComponent::Get().setCursorVisibility(true);
+    return QObject::eventFilter(watched, event);
+  }
 
-  if (window && window->property("webDesktopMode").toBool())
+  qint64 timestamp = InputBase::timestamp();
+
+  if (m_webDesktopMode)
   {
     // For desktop mode we don't want fullblown keyboard handling in
     // the host yet. We just want to handle some specific keyboard
@@ -80,7 +164,7 @@ bool EventFilter::eventFilter(QObject* watched, QEvent* event)
         QString seq = keyEventToKeyString(key);
         if (desktopWhiteListedKeys.contains(seq))
         {
-          InputKeyboard::Get().keyPress(seq, keystatus);
+          InputKeyboard::Get().keyPress(seq, keystatus, timestamp);
           return true;
         }
       }
@@ -91,9 +175,8 @@ bool EventFilter::eventFilter(QObject* watched, QEvent* event)
   SystemComponent& system = SystemComponent::Get();
 
   // ignore mouse events if mouse is disabled
-  if  (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "disablemouse").toBool() &&
-       ((event->type() == QEvent::MouseMove) ||
-        (event->type() == QEvent::MouseButtonPress) ||
+  if  (m_disableMouse &&
+       ((event->type() == QEvent::MouseButtonPress) ||
         (event->type() == QEvent::MouseButtonRelease) ||
         (event->type() == QEvent::MouseButtonDblClick)))
   {
@@ -147,14 +230,14 @@ bool EventFilter::eventFilter(QObject* watched, QEvent* event)
     system.setCursorVisibility(false);
     if (kevent->spontaneous() && !kevent->isAutoRepeat())
     {
-      InputKeyboard::Get().keyPress(keyName, keystatus);
+      int combination = keyCombination(kevent);
+      if (combination)
+        InputKeyboard::Get().keyPress(combination, keyName, keystatus, timestamp);
+      else
+        InputKeyboard::Get().keyPress(keyName, keystatus, timestamp);
       return true;
     }
   }
-  else if (event->type() == QEvent::MouseMove)
-  {
-    system.setCursorVisibility(true);
-  }
   else if (event->type() == QEvent::Wheel)
   {
     return true;
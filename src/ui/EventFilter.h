@@ -12,13 +12,20 @@ class EventFilter : public QObject
 {
   Q_OBJECT
 public:
-  explicit EventFilter(QObject* parent = nullptr) : QObject(parent), m_currentKeyDown(false) {}
+  // parent is the KonvergoWindow whose events are filtered.
+  explicit EventFilter(QObject* parent = nullptr);
 
 protected:
   bool eventFilter(QObject* watched, QEvent* event) override;
 
 private:
+  // Runs for every event (including each mouse move), so everything it
+  // depends on is kept here and updated by change signals.
+  void updateSettings(const QVariantMap& values);
+
   bool m_currentKeyDown;
+  bool m_webDesktopMode;
+  bool m_disableMouse;
 };
 
 #endif //PLEXMEDIAPLAYER_EVENTFILTER_H
@@ -18,12 +18,15 @@
 #include "display/DisplayComponent.h"
 #include "QsLog.h"
 #include "utils/Utils.h"
+#include "utils/ProcessSampler.h"
+#include "utils/AllocationTracker.h"
 #include "Globals.h"
 #include "EventFilter.h"
 
 #ifdef USE_X11EXTRAS
 #include <QX11Info>
 #include <X11/Xlib.h>
+#include <X11/Xatom.h>
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -38,12 +41,18 @@ public:
   ~ScopedDecrementer() { (*m_value)--; }
 };
 
+// screens are given this long to settle after they were added, before the window moves
+#define WINDOW_SCREEN_SETTLE_MSEC 200
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 KonvergoWindow::KonvergoWindow(QWindow* parent) :
   QQuickWindow(parent),
   m_debugLayer(false),
   m_ignoreFullscreenSettingsChange(0),
   m_showedUpdateDialog(false),
+  m_debugMetrics(nullptr),
+  m_lastCpuTime(0),
+  m_compositorBypass(-1),
   m_osxPresentationOptions(0)
 {
   // NSWindowCollectionBehaviorFullScreenPrimary is only set on OSX if Qt::WindowFullscreenButtonHint is set on the window.
@@ -51,18 +60,24 @@ KonvergoWindow::KonvergoWindow(QWindow* parent) :
 
   m_infoTimer = new QTimer(this);
   m_infoTimer->setInterval(1000);
+
+  // Everything that changes the window state within one event loop pass ends up in a single transition.
+  m_windowStateTimer = new QTimer(this);
+  m_windowStateTimer->setSingleShot(true);
+  connect(m_windowStateTimer, &QTimer::timeout, this, [=]() { applyWindowState(targetWindowState(), true); });
   m_webDesktopMode = (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "webMode").toString() == "desktop");
 
   installEventFilter(new EventFilter(this));
 
   connect(m_infoTimer, &QTimer::timeout, this, &KonvergoWindow::updateDebugInfo);
+  setupDebugMetrics();
 
-  InputComponent::Get().registerHostCommand("close", this, "close");
-  InputComponent::Get().registerHostCommand("toggleDebug", this, "toggleDebug");
-  InputComponent::Get().registerHostCommand("reload", this, "reloadWeb");
-  InputComponent::Get().registerHostCommand("fullscreen", this, "toggleFullscreen");
-  InputComponent::Get().registerHostCommand("minimize", this, "minimizeWindow");
-  InputComponent::Get().registerHostCommand("switchMode", this, "toggleWebMode");
+  InputComponent::Get().registerHostCommand("close", this, &KonvergoWindow::close);
+  InputComponent::Get().registerHostCommand("toggleDebug", this, &KonvergoWindow::toggleDebug);
+  InputComponent::Get().registerHostCommand("reload", this, &KonvergoWindow::reloadWeb);
+  InputComponent::Get().registerHostCommand("fullscreen", this, &KonvergoWindow::toggleFullscreen);
+  InputComponent::Get().registerHostCommand("minimize", this, &KonvergoWindow::minimizeWindow);
+  InputComponent::Get().registerHostCommand("switchMode", this, &KonvergoWindow::toggleWebMode);
 
 #ifdef TARGET_RPI
   // On RPI, we use dispmanx layering - the video is on a layer below Konvergo,
@@ -89,8 +104,6 @@ KonvergoWindow::KonvergoWindow(QWindow* parent) :
   }
 #endif
 
-  QRect loadedGeo = loadGeometry();
-
   connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_MAIN), &SettingsSection::valuesUpdated,
           this, &KonvergoWindow::updateMainSectionSettings);
 
@@ -126,11 +139,7 @@ KonvergoWindow::KonvergoWindow(QWindow* parent) :
   m_osxPresentationOptions = 0;
 #endif
 
-#ifdef KONVERGO_OPENELEC
-  setVisibility(QWindow::FullScreen);
-#else
-  updateWindowState(false);
-#endif
+  applyWindowState(targetWindowState(true), false);
 
   updateScreens();
 
@@ -236,45 +245,6 @@ void KonvergoWindow::saveGeometry()
   SettingsComponent::Get().setValue(SETTINGS_SECTION_STATE, "lastUsedScreen", curScreen ? curScreen->name() : "");
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
-QRect KonvergoWindow::loadGeometry()
-{
-  QRect rc = loadGeometryRect();
-  QScreen* myScreen = loadLastScreen();
-  if (!myScreen)
-    myScreen = screen();
-
-  QRect nsize = rc;
-
-  if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "fullscreen").toBool())
-  {
-    QLOG_DEBUG() << "Load FullScreen geo...";
-
-    if (myScreen)
-    {
-      // On OSX we need to set the geometry to the size we want when we
-      // return from fullscreen otherwise when we exit fullscreen it
-      // will stay small or big. On Windows we need to set it to max
-      // resolution for the screen (i.e. fullscreen) otherwise it will
-      // just scale the webcontent to the minimum size we have defined
-      //
-  #ifndef Q_OS_MAC
-      nsize = myScreen->geometry();
-  #endif
-      setGeometry(nsize);
-
-      setScreen(myScreen);
-    }
-  }
-  else
-  {
-    setGeometry(nsize);
-    saveGeometry();
-  }
-
-  return nsize;
-}
-
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 QRect KonvergoWindow::loadGeometryRect()
 {
@@ -385,10 +355,10 @@ void KonvergoWindow::updateMainSectionSettings(const QVariantMap& values)
   }
 
   if (values.contains("alwaysOnTop"))
-    updateWindowState();
+    m_windowStateTimer->start(0);
 
   if (values.contains("fullscreen") && !m_ignoreFullscreenSettingsChange)
-    updateWindowState();
+    m_windowStateTimer->start(0);
 
   if (values.contains("webMode"))
   {
@@ -427,65 +397,107 @@ void KonvergoWindow::updateMainSectionSettings(const QVariantMap& values)
   if (values.contains("startupurl"))
     emit webUrlChanged();
 
-  if (values.contains("forceFSScreen"))
-    updateForcedScreen();
+  if (values.contains("forceFSScreen") && !SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceFSScreen").toString().isEmpty())
+  {
+    // picking a screen for fullscreen means going fullscreen on it, the transition is still pending
+    setFullScreen(true);
+    m_windowStateTimer->start(0);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void KonvergoWindow::updateForcedScreen()
+KonvergoWindow::WindowState KonvergoWindow::targetWindowState(bool startup)
 {
-  QString screenName = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceFSScreen").toString();
+  WindowState state;
+  state.fullscreen = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "fullscreen").toBool() ||
+                     SystemComponent::Get().isOpenELEC() ||
+                     SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceAlwaysFS").toBool();
 
-  if (screenName.isEmpty())
-    return;
+  state.flags = flags();
 
-  for (QScreen* scr : QGuiApplication::screens())
+  if (state.fullscreen)
   {
-    if (scr->name() == screenName)
-    {
-      QLOG_DEBUG() << "Forcing screen to" << scr->name();
-      setScreen(scr);
-      setGeometry(scr->geometry());
-      setVisibility(QWindow::FullScreen);
-      InputComponent::Get().cancelAutoRepeat();
-      return;
-    }
+    // Qt fullscreens to the screen the window is on, so it has to be moved to
+    // the forced screen (or the one it was on last time) first.
+    state.screen = loadLastScreen();
+    if (!startup && SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceFSScreen").toString().isEmpty())
+      state.screen = findCurrentScreen();
+    if (!state.screen)
+      state.screen = screen();
+
+    // On OSX we need to set the geometry to the size we want when we
+    // return from fullscreen otherwise when we exit fullscreen it
+    // will stay small or big. On Windows we need to set it to max
+    // resolution for the screen (i.e. fullscreen) otherwise it will
+    // just scale the webcontent to the minimum size we have defined
+    //
+#ifdef Q_OS_MAC
+    state.geometry = loadGeometryRect();
+#else
+    state.geometry = state.screen ? state.screen->geometry() : geometry();
+#endif
   }
+  else
+  {
+    state.screen = screen();
+    state.geometry = loadGeometryRect();
+
+    Qt::WindowFlags forceOnTopFlags = Qt::WindowStaysOnTopHint;
+#ifdef Q_WS_X11
+    forceOnTopFlags = forceOnTopFlags | Qt::X11BypassWindowManagerHint;
+#endif
+
+    if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "alwaysOnTop").toBool())
+      state.flags |= forceOnTopFlags;
+    else
+      state.flags &= ~forceOnTopFlags;
+  }
+
+  return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void KonvergoWindow::updateWindowState(bool saveGeo)
+void KonvergoWindow::applyWindowState(const WindowState& state, bool saveGeo)
 {
-  if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "fullscreen").toBool() || SystemComponent::Get().isOpenELEC() || SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceAlwaysFS").toBool())
+  m_windowStateTimer->stop();
+
+  // Each step is skipped if there's nothing to change, every one of them that
+  // is done resizes the web view and the video.
+  if (state.fullscreen)
   {
     // if we were go from windowed to fullscreen
     // we want to store our current windowed position
     if (!isFullScreen() && saveGeo)
       saveGeometry();
 
-    setVisibility(QWindow::FullScreen);
-
-    // When fullscreening explicitly, we might have to move the window to a
-    // different screen, as Qt will fullscreen to the current screen.
-    QTimer::singleShot(200, [=]
+    // the geometry only matters before the window is shown, or to move it to another screen
+    if (state.screen && (state.screen != screen() || !isVisible()))
     {
-      updateForcedScreen();
-    });
+      QLOG_DEBUG() << "Moving the window to screen" << state.screen->name();
+      setScreen(state.screen);
+      setGeometry(state.geometry);
+    }
+
+    if (visibility() != QWindow::FullScreen)
+      setVisibility(QWindow::FullScreen);
   }
   else
   {
-    setVisibility(QWindow::Windowed);
-    loadGeometry();
+    if (flags() != state.flags)
+      setFlags(state.flags);
 
-    Qt::WindowFlags forceOnTopFlags = Qt::WindowStaysOnTopHint;
-#ifdef Q_WS_X11
-    forceOnTopFlags = forceOnTopFlags | Qt::X11BypassWindowManagerHint;
-#endif
+    // a fullscreen window ignores the geometry it's given
+    bool leavingFullscreen = visibility() == QWindow::FullScreen;
+    if (!leavingFullscreen && geometry() != state.geometry)
+      setGeometry(state.geometry);
 
-    if (SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "alwaysOnTop").toBool())
-      setFlags(flags() | forceOnTopFlags);
-    else
-      setFlags(flags() &~ forceOnTopFlags);
+    if (visibility() != QWindow::Windowed)
+      setVisibility(QWindow::Windowed);
+
+    if (leavingFullscreen && geometry() != state.geometry)
+      setGeometry(state.geometry);
+
+    saveGeometry();
   }
 
   InputComponent::Get().cancelAutoRepeat();
@@ -517,6 +529,8 @@ void KonvergoWindow::onVisibilityChanged(QWindow::Visibility visibility)
 {
   QLOG_DEBUG() << "QWindow visibility set to" << visibility;
 
+  updateCompositorBypass();
+
 #ifdef Q_OS_WIN32
   if (visibility == QWindow::Windowed)
   {
@@ -534,8 +548,8 @@ void KonvergoWindow::onVisibilityChanged(QWindow::Visibility visibility)
   if (visibility == QWindow::Windowed && SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceAlwaysFS").toBool())
   {
     QLOG_WARN() << "Forcing re-entering fullscreen because of forceAlwaysFS setting!";
-    updateForcedScreen(); // if a specific screen is forced, try to move the window there
-    setVisibility(QWindow::FullScreen);
+    // if a specific screen is forced, this moves the window there
+    applyWindowState(targetWindowState(), false);
     return;
   }
 
@@ -553,6 +567,34 @@ void KonvergoWindow::onVisibilityChanged(QWindow::Visibility visibility)
   InputComponent::Get().cancelAutoRepeat();
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+void KonvergoWindow::updateCompositorBypass()
+{
+  int bypass = isFullScreen() ? 1 : 0;
+  if (bypass == m_compositorBypass)
+    return;
+  m_compositorBypass = bypass;
+
+#ifdef USE_X11EXTRAS
+  // _NET_WM_BYPASS_COMPOSITOR: 0 is no preference, 1 asks the compositor to
+  // unredirect the window, so frames go to the screen without an extra copy.
+  // Compositors only do that for windows covering the screen.
+  if (QX11Info::isPlatformX11())
+  {
+    Display* dpy = QX11Info::display();
+    if (dpy)
+    {
+      long value = bypass;
+      XChangeProperty(dpy, winId(),
+                      XInternAtom(dpy, "_NET_WM_BYPASS_COMPOSITOR", false),
+                      XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&value, 1);
+      XFlush(dpy);
+      QLOG_DEBUG() << "Compositor bypass:" << (bypass ? "requested" : "no preference");
+    }
+  }
+#endif
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void KonvergoWindow::focusOutEvent(QFocusEvent * ev)
 {
@@ -576,40 +618,112 @@ void KonvergoWindow::RegisterClass()
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
+void KonvergoWindow::setupDebugMetrics()
+{
+  m_debugMetrics = new DebugMetrics(this);
+
+  // process CPU usage since the last sample, in percent of one core
+  m_debugMetrics->addMetric("cpu", [=]()
+  {
+    qint64 cpuTime = processCpuTimeUsec();
+    qint64 elapsed = m_cpuClock.isValid() ? m_cpuClock.nsecsElapsed() / 1000 : 0;
+    double usage = elapsed > 0 ? (cpuTime - m_lastCpuTime) * 100.0 / elapsed : 0;
+    m_lastCpuTime = cpuTime;
+    m_cpuClock.start();
+    return usage;
+  });
+
+  m_debugMetrics->addMetric("frameTime", [=]()
+  {
+    PlayerQuickItem* video = findChild<PlayerQuickItem*>("video");
+    return video ? video->meanDrawMsec() : 0.0;
+  });
+
+  // KB/s
+  m_debugMetrics->addMetric("network", []()
+  {
+    return PlayerComponent::Get().cacheSpeed() / 1024;
+  });
+
+  // seconds of demuxed media
+  m_debugMetrics->addMetric("cacheFill", []()
+  {
+    return PlayerComponent::Get().cacheDuration();
+  });
+
+  // resident size in MB
+  m_debugMetrics->addMetric("memory", []()
+  {
+    return ProcessSampler::currentResidentKB() / 1024.0;
+  });
+
+  connect(&DisplayComponent::Get(), &DisplayComponent::refreshRateChanged,
+          this, &KonvergoWindow::invalidateDebugInfo);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void KonvergoWindow::invalidateDebugInfo()
+{
+  m_displayDebugInfo.clear();
+  m_windowDebugInfo.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
 void KonvergoWindow::updateDebugInfo()
 {
+  // Only the parts that come from this process itself are rebuilt every time.
+  // Asking the display manager and windowing system is left for when they changed.
   if (m_systemDebugInfo.size() == 0)
     m_systemDebugInfo = SystemComponent::Get().debugInformation();
-  m_debugInfo = m_systemDebugInfo;
-  m_debugInfo += DisplayComponent::Get().debugInformation();
+  if (m_displayDebugInfo.size() == 0)
+    m_displayDebugInfo = DisplayComponent::Get().debugInformation();
+  QString debugInfo = m_systemDebugInfo;
+  debugInfo += m_displayDebugInfo;
+  debugInfo += InputComponent::Get().latencyInformation();
+  debugInfo += ProcessSampler::Get().debugInformation();
+  debugInfo += AllocationTracker::summary();
   PlayerQuickItem* video = findChild<PlayerQuickItem*>("video");
   if (video)
-    m_debugInfo += video->debugInfo();
-  QString infoString;
-  QDebug info(&infoString);
-  info << "Qt windowing info:\n";
-  info << "  FS: " << visibility() << "\n";
-  info << "  Geo: " << geometry() << "\n";
-  for (QScreen* scr : QGuiApplication::screens())
+    debugInfo += video->debugInfo();
+
+  if (m_windowDebugInfo.isEmpty())
   {
-    info << "  Screen" << scr->name() << scr->geometry() << "\n";
-  }
+    QString infoString;
+    QDebug info(&infoString);
+    info << "Qt windowing info:\n";
+    info << "  FS: " << visibility() << "\n";
+    info << "  Geo: " << geometry() << "\n";
+    for (QScreen* scr : QGuiApplication::screens())
+    {
+      info << "  Screen" << scr->name() << scr->geometry() << "\n";
+    }
 
 #ifdef Q_OS_WIN32
-  HMONITOR mon = MonitorFromWindow((HWND)winId(), MONITOR_DEFAULTTONEAREST);
-  MONITORINFO moninfo = {};
-  moninfo.cbSize = sizeof(moninfo);
-  RECT winrc;
-  if (GetMonitorInfo(mon, &moninfo) &&GetWindowRect((HWND)winId(), &winrc))
-  {
-    RECT rc = moninfo.rcMonitor;
-    info << "  Win32 window" << QString("%1/%2 %3x%4").arg(rc.left).arg(rc.top).arg(rc.right).arg(rc.bottom) << QString("%1/%2 %3x%4").arg(winrc.left).arg(winrc.top).arg(winrc.right).arg(winrc.bottom) << "\n";
-  }
+    HMONITOR mon = MonitorFromWindow((HWND)winId(), MONITOR_DEFAULTTONEAREST);
+    MONITORINFO moninfo = {};
+    moninfo.cbSize = sizeof(moninfo);
+    RECT winrc;
+    if (GetMonitorInfo(mon, &moninfo) &&GetWindowRect((HWND)winId(), &winrc))
+    {
+      RECT rc = moninfo.rcMonitor;
+      info << "  Win32 window" << QString("%1/%2 %3x%4").arg(rc.left).arg(rc.top).arg(rc.right).arg(rc.bottom) << QString("%1/%2 %3x%4").arg(winrc.left).arg(winrc.top).arg(winrc.right).arg(winrc.bottom) << "\n";
+    }
 #endif
 
-  info << "\n";
-  m_debugInfo += infoString;
-  m_videoInfo = PlayerComponent::Get().videoInformation();
+    info << "\n";
+    m_windowDebugInfo = infoString;
+  }
+  debugInfo += m_windowDebugInfo;
+
+  QString videoInfo = PlayerComponent::Get().videoInformation();
+  if (video && !videoInfo.isEmpty())
+    videoInfo += "\n" + video->frameTimingSummary();
+
+  if (debugInfo == m_debugInfo && videoInfo == m_videoInfo)
+    return;
+
+  m_debugInfo = debugInfo;
+  m_videoInfo = videoInfo;
   emit debugInfoChanged();
 }
 
@@ -619,11 +733,16 @@ void KonvergoWindow::toggleDebug()
   if (property("showDebugLayer").toBool())
   {
     m_infoTimer->stop();
+    m_debugMetrics->setActive(false);
+    PlayerComponent::Get().setDebugOverlayActive(false);
     setProperty("showDebugLayer", false);
   }
   else
   {
+    PlayerComponent::Get().setDebugOverlayActive(true);
+    invalidateDebugInfo();
     m_infoTimer->start();
+    m_debugMetrics->setActive(true);
     updateDebugInfo();
     setProperty("showDebugLayer", true);
   }
@@ -634,29 +753,7 @@ void KonvergoWindow::resizeEvent(QResizeEvent* event)
 {
   QLOG_DEBUG() << "resize event:" << event->size();
 
-  // This next block was added at some point to workaround a problem with
-  // resizing on windows. Unfortunately it broke the desktop client behavior
-  // and when retried on Windows 10 with Qt5.7 the original bug seems to be
-  // gone. I'll keep this code around until such a time that we dont get any
-  // complaints about it.
-  //
-  #if 0
-  // This next block should never really be needed in a prefect world...
-  // Unfortunatly this is an imperfect world and on windows sometimes what
-  // would happen on startup is that we got a resize event that would make
-  // the window much smaller than fullscreen.
-  //
-
-  if (isFullScreen())
-  {
-    QSize fsSize = screen()->size();
-    if (event->size().width() < fsSize.width() || event->size().height() < fsSize.height())
-    {
-      QLOG_DEBUG() << "Ignoring resize event when in fullscreen...";
-      return;
-    }
-  }
-  #endif
+  invalidateDebugInfo();
 
   QQuickWindow::resizeEvent(event);
 }
@@ -681,9 +778,21 @@ QScreen* KonvergoWindow::loadLastScreen()
   return nullptr;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+static QString g_webUrlOverride;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void KonvergoWindow::setWebUrlOverride(const QString& url)
+{
+  g_webUrlOverride = url;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 QString KonvergoWindow::webUrl()
 {
+  if (!g_webUrlOverride.isEmpty())
+    return g_webUrlOverride;
+
   return SettingsComponent::Get().getWebClientUrl(m_webDesktopMode);
 }
 
@@ -744,11 +853,10 @@ void KonvergoWindow::updateScreens()
 void KonvergoWindow::onScreenAdded(QScreen *screen)
 {
   updateScreens();
-  // The timer is out of fear for chaotic mid-change states.
-  QTimer::singleShot(200, [this]
-  {
-    updateForcedScreen();
-  });
+
+  // The forced screen might be back. The delay is out of fear for chaotic mid-change states.
+  if (isFullScreen() && !SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "forceFSScreen").toString().isEmpty())
+    m_windowStateTimer->start(WINDOW_SCREEN_SETTLE_MSEC);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -760,8 +868,23 @@ void KonvergoWindow::onScreenRemoved(QScreen *screen)
 /////////////////////////////////////////////////////////////////////////////////////////
 void KonvergoWindow::updateCurrentScreen()
 {
+  invalidateDebugInfo();
+
   QScreen* current = findCurrentScreen();
+
+  // Qt doesn't always notice the window moved to another screen. The render loop paces
+  // itself (and FrameTimings) by the refresh rate of screen(), which would then be the one
+  // of the previous screen. Screens of the same virtual desktop don't recreate the window.
+  if (current && screen() && current != screen() && screen()->virtualSiblings().contains(current))
+  {
+    QLOG_DEBUG() << "Window is on screen" << current->name() << "now," << current->refreshRate() << "Hz";
+    setScreen(current);
+  }
+
   QString currentName = current ? current->name() : "";
   if (currentName != m_currentScreenName)
+  {
     updateScreens();
+    DisplayComponent::Get().applicationScreenChanged();
+  }
 }
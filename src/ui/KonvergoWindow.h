@@ -3,8 +3,11 @@
 
 #include <QQuickWindow>
 #include <QEvent>
+#include <QElapsedTimer>
 #include <settings/SettingsComponent.h>
 
+#include "DebugMetrics.h"
+
 
 // This controls how big the web view will zoom using semantic zoom
 // over a specific number of pixels and we run out of space for on screen
@@ -29,6 +32,7 @@ class KonvergoWindow : public QQuickWindow
   Q_PROPERTY(bool showDebugLayer MEMBER m_debugLayer NOTIFY debugLayerChanged)
   Q_PROPERTY(QString debugInfo MEMBER m_debugInfo NOTIFY debugInfoChanged)
   Q_PROPERTY(QString videoInfo MEMBER m_videoInfo NOTIFY debugInfoChanged)
+  Q_PROPERTY(QObject* debugMetrics READ debugMetrics CONSTANT)
   Q_PROPERTY(QSize windowMinSize READ windowMinSize CONSTANT)
   Q_PROPERTY(bool alwaysOnTop READ isAlwaysOnTop WRITE setAlwaysOnTop)
   Q_PROPERTY(bool webDesktopMode MEMBER m_webDesktopMode NOTIFY webDesktopModeChanged)
@@ -87,8 +91,12 @@ public:
   }
 
   QSize windowMinSize() { return WINDOWW_MIN_SIZE; }
+  QObject* debugMetrics() { return m_debugMetrics; }
   QString webUrl();
 
+  // Load this instead of the web client, before the window is created.
+  static void setWebUrlOverride(const QString& url);
+
 Q_SIGNALS:
   void fullScreenSwitched();
   void enableVideoWindowSignal();
@@ -107,7 +115,6 @@ private slots:
   void enableVideoWindow();
   void onVisibilityChanged(QWindow::Visibility visibility);
   void updateMainSectionSettings(const QVariantMap& values);
-  void updateWindowState(bool saveGeo = true);
   void updateDebugInfo();
   void playerWindowVisible(bool visible);
   void showUpdateDialog();
@@ -116,22 +123,45 @@ private slots:
   void updateCurrentScreen();
 
 private:
+  // Where the settings want the window, and how.
+  struct WindowState
+  {
+    bool fullscreen = false;
+    QScreen* screen = nullptr;
+    QRect geometry;
+    Qt::WindowFlags flags;
+  };
+  WindowState targetWindowState(bool startup = false);
+  // Go there in one step, doing only what actually changes.
+  void applyWindowState(const WindowState& state, bool saveGeo);
+
   void saveGeometry();
-  QRect loadGeometry();
   QRect loadGeometryRect();
   bool fitsInScreens(const QRect& rc);
   QScreen* loadLastScreen();
   void updateScreens();
-  void updateForcedScreen();
   QScreen* findCurrentScreen();
+  void invalidateDebugInfo();
+  void setupDebugMetrics();
+  // Ask the compositor to leave the window alone while it's fullscreen.
+  void updateCompositorBypass();
 
   bool m_debugLayer;
   QTimer* m_infoTimer;
+  QTimer* m_windowStateTimer;
   QString m_debugInfo, m_systemDebugInfo, m_videoInfo;
+  // Display and windowing part of m_debugInfo, only rebuilt after they changed.
+  QString m_displayDebugInfo, m_windowDebugInfo;
+  DebugMetrics* m_debugMetrics;
+  qint64 m_lastCpuTime;
+  QElapsedTimer m_cpuClock;
   int m_ignoreFullscreenSettingsChange;
   bool m_webDesktopMode;
   bool m_showedUpdateDialog;
 
+  // what updateCompositorBypass() set last, -1 if nothing yet
+  int m_compositorBypass;
+
   unsigned long m_osxPresentationOptions;
   QString m_currentScreenName;
 
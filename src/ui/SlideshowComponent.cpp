@@ -0,0 +1,186 @@
+#include "SlideshowComponent.h"
+
+#include <QRunnable>
+#include <QThreadPool>
+#include <QUrl>
+
+#include "QsLog.h"
+#include "utils/NetworkService.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class PhotoDecodeJob : public QRunnable
+{
+public:
+  PhotoDecodeJob(ArtworkCache* cache, const QByteArray& data, const QSize& size, const QString& key)
+    : m_cache(cache), m_data(data), m_size(size), m_key(key) { }
+
+  void run() override
+  {
+    QImage image;
+    QString error;
+    if (ArtworkImageProvider::decode(m_data, m_size, image, error))
+      m_cache->insert(m_key, image);
+    else
+      QLOG_WARN() << "Failed to decode photo:" << error;
+
+    QMetaObject::invokeMethod(&SlideshowComponent::Get(), "photoDecoded", Qt::QueuedConnection,
+                              Q_ARG(QString, m_key));
+  }
+
+private:
+  ArtworkCache* m_cache;
+  QByteArray m_data;
+  QSize m_size;
+  QString m_key;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SlideshowComponent::SlideshowComponent() : ComponentBase(nullptr), m_index(0), m_interval(0),
+  m_timer(this), m_waiting(false)
+{
+  m_timer.setSingleShot(true);
+  connect(&m_timer, &QTimer::timeout, this, &SlideshowComponent::intervalElapsed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::start(const QStringList& urls, int index, int intervalMsec)
+{
+  stop();
+  if (urls.isEmpty())
+    return;
+
+  QLOG_DEBUG() << "Slideshow of" << urls.size() << "photos, every" << intervalMsec << "ms";
+
+  m_urls = urls;
+  m_interval = intervalMsec;
+  m_index = qBound(0, index, urls.size() - 1);
+  advance(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::stop()
+{
+  if (m_urls.isEmpty())
+    return;
+
+  m_urls.clear();
+  m_timer.stop();
+  m_waiting = false;
+
+  // aborting emits finished right away, which removes them
+  for (QNetworkReply* reply : m_downloads.values())
+    reply->abort();
+  // decode jobs that are still running only fill the cache
+  m_decoding.clear();
+  m_photos.clear();
+
+  emit stopped();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::setPhotoSize(int width, int height, qreal devicePixelRatio)
+{
+  // the Image asks its provider for sourceSize times the ratio, rounded like this
+  QSize size = QSize(width, height) * devicePixelRatio;
+  if (size == m_decodeSize)
+    return;
+
+  m_decodeSize = size;
+  m_photos.clear();
+  m_photos.setBudgetBytes((qint64)size.width() * size.height() * 4 * SLIDESHOW_CACHED_PHOTOS);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString SlideshowComponent::key(int index) const
+{
+  return ArtworkImageProvider::cacheKey(QUrl(m_urls.at(index)), m_decodeSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int SlideshowComponent::nextIndex(int step) const
+{
+  return ((m_index + step) % m_urls.size() + m_urls.size()) % m_urls.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SlideshowComponent::isDecoded(int index) const
+{
+  QImage image;
+  return m_photos.find(key(index), image);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::advance(int step)
+{
+  if (m_urls.isEmpty())
+    return;
+
+  m_waiting = false;
+  m_index = nextIndex(step);
+  emit showPhoto(ArtworkImageProvider::imageSource(QUrl(m_urls.at(m_index)), "slideshow"), m_index);
+
+  prefetch();
+
+  if (m_interval > 0)
+    m_timer.start(m_interval);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::intervalElapsed()
+{
+  // Keep the current photo up a bit longer instead of fading to one that isn't there yet.
+  // photoDecoded() moves on once it is.
+  QString nextKey = key(nextIndex(1));
+  if (!m_waiting && (m_downloads.contains(nextKey) || m_decoding.contains(nextKey)))
+  {
+    m_waiting = true;
+    m_timer.start(SLIDESHOW_MAX_WAIT_MSEC);
+    return;
+  }
+
+  advance(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::prefetch()
+{
+  for (int i = 1; i <= SLIDESHOW_DECODE_AHEAD && i < m_urls.size(); i++)
+  {
+    int index = nextIndex(i);
+    QString photoKey = key(index);
+    if (m_downloads.contains(photoKey) || m_decoding.contains(photoKey) || isDecoded(index))
+      continue;
+
+    QNetworkReply* reply = NetworkService::Get().get(QNetworkRequest(QUrl(m_urls.at(index))),
+                                                     NetworkService::DownloadRequest);
+    m_downloads.insert(photoKey, reply);
+    connect(reply, &QNetworkReply::finished, this, [=]() { downloaded(photoKey, reply); });
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::downloaded(const QString& key, QNetworkReply* reply)
+{
+  reply->deleteLater();
+  m_downloads.remove(key);
+
+  if (reply->error() != QNetworkReply::NoError)
+  {
+    if (reply->error() != QNetworkReply::OperationCanceledError)
+      QLOG_WARN() << "Failed to download photo:" << reply->errorString();
+    photoDecoded(key);
+    return;
+  }
+
+  m_decoding.insert(key);
+  QThreadPool::globalInstance()->start(new PhotoDecodeJob(&m_photos, reply->readAll(), m_decodeSize, key));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SlideshowComponent::photoDecoded(const QString& key)
+{
+  m_decoding.remove(key);
+
+  if (m_waiting && !m_urls.isEmpty() && key == this->key(nextIndex(1)))
+    advance(1);
+}
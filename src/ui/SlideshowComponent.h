@@ -0,0 +1,88 @@
+#ifndef SLIDESHOWCOMPONENT_H
+#define SLIDESHOWCOMPONENT_H
+
+#include <QHash>
+#include <QSet>
+#include <QSize>
+#include <QStringList>
+#include <QTimer>
+#include <QNetworkReply>
+
+#include "ComponentManager.h"
+#include "ArtworkImageProvider.h"
+
+// photos after the current one that are downloaded and decoded ahead
+#define SLIDESHOW_DECODE_AHEAD 3
+// how long the current photo stays up at most, if the next one isn't decoded yet
+#define SLIDESHOW_MAX_WAIT_MSEC 5000
+// decoded photos kept: the two of a crossfade and the ones decoded ahead
+#define SLIDESHOW_CACHED_PHOTOS (SLIDESHOW_DECODE_AHEAD + 2)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Photo slideshows, shown by the slideshow item of webview.qml instead of the web view. The
+// next SLIDESHOW_DECODE_AHEAD photos are downloaded and decoded at the size of the screen in
+// pixels on the thread pool (by the RPI_jpeg plugin on the Pi), so the Image that fades them in
+// finds them decoded. A 20MP JPEG takes longer to decode than the fade lasts.
+//
+// They are kept in a cache of their own, served as image://slideshow, with room for
+// SLIDESHOW_CACHED_PHOTOS of them at that size. Artwork the web client loads meanwhile
+// doesn't push them out, and the photos don't take the artwork's budget.
+//
+class SlideshowComponent : public ComponentBase
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(SlideshowComponent);
+
+public:
+  bool componentInitialize() override { return true; }
+  const char* componentName() override { return "slideshow"; }
+  bool componentExport() override { return true; }
+  bool componentDeferred() override { return true; }
+
+  // For the web client. intervalMsec 0 only changes photos on next() and previous().
+  Q_INVOKABLE void start(const QStringList& urls, int index, int intervalMsec);
+  Q_INVOKABLE void stop();
+  Q_INVOKABLE void next() { advance(1); }
+  Q_INVOKABLE void previous() { advance(-1); }
+
+  // For webview.qml: the sourceSize of the Images showing the photos and the device pixel
+  // ratio of the screen, the photos are decoded at their product.
+  Q_INVOKABLE void setPhotoSize(int width, int height, qreal devicePixelRatio);
+
+  // Where the photos are decoded to, for the image://slideshow provider.
+  ArtworkCache& photos() { return m_photos; }
+
+Q_SIGNALS:
+  // source for an Image with its sourceSize set to the screen size
+  void showPhoto(const QString& source, int index);
+  void stopped();
+
+private Q_SLOTS:
+  // from the decode jobs
+  void photoDecoded(const QString& key);
+
+private:
+  SlideshowComponent();
+
+  QString key(int index) const;
+  int nextIndex(int step) const;
+  bool isDecoded(int index) const;
+  void advance(int step);
+  void intervalElapsed();
+  void prefetch();
+  void downloaded(const QString& key, QNetworkReply* reply);
+
+  QStringList m_urls;
+  int m_index;
+  int m_interval;
+  QSize m_decodeSize;
+  ArtworkCache m_photos;
+  QTimer m_timer;
+  // the interval is over, but the next photo wasn't decoded yet
+  bool m_waiting;
+
+  QHash<QString, QNetworkReply*> m_downloads;
+  QSet<QString> m_decoding;
+};
+
+#endif // SLIDESHOWCOMPONENT_H
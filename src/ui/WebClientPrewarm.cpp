@@ -0,0 +1,78 @@
+#include "WebClientPrewarm.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QStringList>
+
+#include "QsLog.h"
+#include "Paths.h"
+#include "utils/StartupTrace.h"
+
+// don't spend more than this on warming up, the client is a lot smaller normally
+#define PREWARM_MAX_BYTES (64 * 1024 * 1024)
+#define PREWARM_CHUNK_SIZE (64 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class WebClientReader : public QRunnable
+{
+public:
+  explicit WebClientReader(const QStringList& dirs) : m_dirs(dirs) { }
+
+  void run() override
+  {
+    StartupTrace::Scope trace("web client prewarm");
+
+    qint64 total = 0;
+    int files = 0;
+    QByteArray buffer(PREWARM_CHUNK_SIZE, 0);
+
+    for (const QString& dir : m_dirs)
+    {
+      QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+      while (it.hasNext() && total < PREWARM_MAX_BYTES)
+      {
+        QFile file(it.next());
+        if (!file.open(QIODevice::ReadOnly))
+          continue;
+
+        // the data is thrown away, all we want is the kernel keeping it around
+        qint64 bytes;
+        while (total < PREWARM_MAX_BYTES && (bytes = file.read(buffer.data(), buffer.size())) > 0)
+          total += bytes;
+
+        files++;
+      }
+    }
+
+    QLOG_DEBUG() << "Prewarmed web client:" << files << "files," << total / 1024 << "kB";
+  }
+
+private:
+  QStringList m_dirs;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void WebClientPrewarm::Start()
+{
+  // the settings aren't loaded yet, so we don't know which client is going to be used
+  QStringList modes = { "tv" };
+#ifndef KONVERGO_OPENELEC
+  modes << "desktop";
+#endif
+
+  QStringList dirs;
+  for (const QString& mode : modes)
+  {
+    QFileInfo index(Paths::webClientPath(mode));
+    if (index.exists())
+      dirs << index.absolutePath();
+  }
+
+  if (dirs.isEmpty())
+    return;
+
+  QThreadPool::globalInstance()->start(new WebClientReader(dirs));
+}
@@ -0,0 +1,13 @@
+#ifndef WEBCLIENTPREWARM_H
+#define WEBCLIENTPREWARM_H
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads the bundled web client on a worker thread while the components initialize, so the
+// web engine finds it in the page cache instead of waiting for the (often slow) storage of
+// the TV boxes on a cold boot.
+namespace WebClientPrewarm
+{
+  void Start();
+}
+
+#endif // WEBCLIENTPREWARM_H
@@ -168,10 +168,12 @@ KonvergoWindow
       else if (loadRequest.status == WebEngineView.LoadSucceededStatus)
       {
         console.log("WebEngineLoadRequest success: " + loadRequest.url);
+        splash.reveal()
       }
       else if (loadRequest.status == WebEngineView.LoadFailedStatus)
       {
         console.log("WebEngineLoadRequest failure: " + loadRequest.url + " error code: " + loadRequest.errorCode);
+        splash.visible = false
         errorLabel.visible = true
         errorLabel.text = "Error loading client, this is bad and should not happen<br>" +
                           "You can try to <a href='reload'>reload</a> or head to our <a href='http://plex.tv/support'>support page</a><br><br>Actual Error: <pre>" +
@@ -207,6 +209,98 @@ KonvergoWindow
     }
   }
 
+  // Photos from components.slideshow, faded into each other. The component decodes the next
+  // ones ahead at the size the Images ask for, so they find them in its cache.
+  Rectangle
+  {
+    id: slideshow
+    z: 3
+    anchors.fill: parent
+    color: "black"
+    visible: false
+
+    property var front: photoA
+    property var back: photoB
+
+    // what the Images ask image://slideshow for, in pixels
+    property size photoSize: Qt.size(photoA.sourceSize.width * Screen.devicePixelRatio,
+                                     photoA.sourceSize.height * Screen.devicePixelRatio)
+    onPhotoSizeChanged: components.slideshow.setPhotoSize(photoA.sourceSize.width, photoA.sourceSize.height, Screen.devicePixelRatio)
+    Component.onCompleted: components.slideshow.setPhotoSize(photoA.sourceSize.width, photoA.sourceSize.height, Screen.devicePixelRatio)
+
+    function crossfade()
+    {
+      fadeIn.target = back
+      fadeOut.target = front
+      fade.restart()
+      var previous = front
+      front = back
+      back = previous
+    }
+
+    Image
+    {
+      id: photoA
+      anchors.fill: parent
+      sourceSize.width: slideshow.width
+      sourceSize.height: slideshow.height
+      fillMode: Image.PreserveAspectFit
+      asynchronous: true
+      // the component's cache has them already
+      cache: false
+      opacity: 0
+      onStatusChanged:
+      {
+        if (status == Image.Ready && slideshow.back === photoA)
+          slideshow.crossfade()
+      }
+    }
+
+    Image
+    {
+      id: photoB
+      anchors.fill: parent
+      sourceSize.width: slideshow.width
+      sourceSize.height: slideshow.height
+      fillMode: Image.PreserveAspectFit
+      asynchronous: true
+      // the component's cache has them already
+      cache: false
+      opacity: 0
+      onStatusChanged:
+      {
+        if (status == Image.Ready && slideshow.back === photoB)
+          slideshow.crossfade()
+      }
+    }
+
+    ParallelAnimation
+    {
+      id: fade
+      OpacityAnimator { id: fadeIn; from: 0; to: 1; duration: 500 }
+      OpacityAnimator { id: fadeOut; from: 1; to: 0; duration: 500 }
+    }
+
+    Connections
+    {
+      target: components.slideshow
+      onShowPhoto:
+      {
+        slideshow.visible = true
+        slideshow.back.source = source
+      }
+      onStopped:
+      {
+        slideshow.visible = false
+        fade.stop()
+        slideshow.front.source = ""
+        slideshow.back.source = ""
+        slideshow.front.opacity = 0
+        slideshow.back.opacity = 0
+      }
+    }
+  }
+
   Text
   {
     id: errorLabel
@@ -235,6 +329,49 @@ KonvergoWindow
   }
 
 
+  // Covers the web view until the client has loaded and had a moment to render, the
+  // load itself starts while the deferred components are still initializing.
+  Rectangle
+  {
+    id: splash
+    z: 4
+    anchors.fill: parent
+    color: "#111111"
+
+    function reveal()
+    {
+      revealTimer.start()
+    }
+
+    Image
+    {
+      anchors.centerIn: parent
+      width: Math.min(parent.width, parent.height) / 3
+      height: width
+      source: "qrc:/images/splash.png"
+      fillMode: Image.PreserveAspectFit
+      smooth: true
+      asynchronous: false
+    }
+
+    Timer
+    {
+      id: revealTimer
+      interval: 250
+      onTriggered: splashFade.start()
+    }
+
+    OpacityAnimator
+    {
+      id: splashFade
+      target: splash
+      from: 1
+      to: 0
+      duration: 300
+      onStopped: splash.visible = false
+    }
+  }
+
   Rectangle
   {
     id: debug
@@ -289,6 +426,82 @@ KonvergoWindow
 
       text: mainWindow.videoInfo
     }
+
+    Row
+    {
+      id: debugGraphs
+      anchors.left: parent.left
+      anchors.right: parent.right
+      anchors.bottom: parent.bottom
+      anchors.leftMargin: 64
+      anchors.rightMargin: 64
+      anchors.bottomMargin: 24
+      height: parent.height / 8
+      spacing: 16
+
+      // name, label, unit
+      property var metrics: [
+        [ "cpu", "CPU", "%" ],
+        [ "frameTime", "Frame draw", "ms" ],
+        [ "network", "Network", "KB/s" ],
+        [ "cacheFill", "Cache", "s" ],
+        [ "memory", "Memory", "MB" ]
+      ]
+
+      Repeater
+      {
+        model: debugGraphs.metrics
+
+        Canvas
+        {
+          id: graph
+          width: (debugGraphs.width - debugGraphs.spacing * (debugGraphs.metrics.length - 1)) / debugGraphs.metrics.length
+          height: debugGraphs.height
+
+          property string metric: modelData[0]
+
+          Connections
+          {
+            target: mainWindow.debugMetrics
+            onMetricsChanged: graph.requestPaint()
+          }
+
+          onPaint:
+          {
+            var ctx = getContext("2d");
+            ctx.clearRect(0, 0, width, height);
+
+            var values = mainWindow.debugMetrics.history(metric);
+            var max = 0;
+            for (var i = 0; i < values.length; i++)
+              max = Math.max(max, values[i]);
+            var scale = max > 0 ? (height - 16) / max : 0;
+            // 120 samples fill the width
+            var step = width / 120;
+
+            ctx.strokeStyle = "#cc7b19";
+            ctx.lineWidth = 2;
+            ctx.beginPath();
+            for (i = 0; i < values.length; i++)
+            {
+              var x = width - (values.length - i) * step;
+              var y = height - values[i] * scale;
+              if (i === 0)
+                ctx.moveTo(x, y);
+              else
+                ctx.lineTo(x, y);
+            }
+            ctx.stroke();
+
+            var last = values.length ? values[values.length - 1] : 0;
+            ctx.fillStyle = "white";
+            ctx.font = Math.round(debugLabel.font.pixelSize) + "px sans-serif";
+            ctx.fillText(modelData[1] + ": " + last.toFixed(1) + " " + modelData[2] +
+                         " (max " + max.toFixed(1) + ")", 0, 12);
+          }
+        }
+      }
+    }
   }
 
   property QtObject webChannel: web.webChannel
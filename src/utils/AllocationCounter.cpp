@@ -0,0 +1,72 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+
+#include "AllocationTracker.h"
+
+// With allocation tracking, that already is in front of malloc and counts per thread.
+#if defined(__GLIBC__) && !defined(ENABLE_ALLOCATION_TRACKING)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocations are counted by putting our own malloc in front of glibc's. Qt allocates
+// its containers with malloc directly, so replacing operator new wouldn't see most of
+// them. Only the benchmarking thread is counted. This build option is the only reason
+// this is acceptable.
+//
+#define HAVE_ALLOCATION_COUNT 1
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+}
+
+static thread_local bool g_countAllocations = false;
+static thread_local qint64 g_allocations = 0;
+
+extern "C" void* malloc(size_t size)
+{
+  if (g_countAllocations)
+    g_allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  if (g_countAllocations)
+    g_allocations++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+  if (g_countAllocations)
+    g_allocations++;
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AllocationCounter::AllocationCounter() : m_start(0)
+{
+#ifdef ENABLE_ALLOCATION_TRACKING
+  m_start = AllocationTracker::threadAllocations();
+#elif defined(HAVE_ALLOCATION_COUNT)
+  m_start = g_allocations;
+  g_countAllocations = true;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 AllocationCounter::stop()
+{
+#ifdef ENABLE_ALLOCATION_TRACKING
+  qint64 now = AllocationTracker::threadAllocations();
+  return now < 0 ? -1 : now - m_start;
+#elif defined(HAVE_ALLOCATION_COUNT)
+  g_countAllocations = false;
+  return g_allocations - m_start;
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Counts the malloc/calloc/realloc calls the current thread makes between construction
+// and stop(). Only built into ENABLE_BENCHMARKS builds and the tests, and only counts on
+// glibc, elsewhere stop() returns -1.
+//
+class AllocationCounter
+{
+public:
+  AllocationCounter();
+
+  // -1 if allocations can't be counted here
+  qint64 stop();
+
+private:
+  qint64 m_start;
+};
+
+#endif // ALLOCATIONCOUNTER_H
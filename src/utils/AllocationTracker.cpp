@@ -0,0 +1,225 @@
+#include "AllocationTracker.h"
+
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ENABLE_ALLOCATION_TRACKING) && defined(__GLIBC__)
+#define HAVE_ALLOCATION_TRACKING 1
+#endif
+
+#ifdef HAVE_ALLOCATION_TRACKING
+
+#include <dlfcn.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Like AllocationCounter, this puts our own malloc in front of glibc's. Each block gets a 16
+// byte header with its size and tag, so free() knows what to take off which tag. Blocks from
+// memalign() and friends (and any allocated before we were there) don't have it, the check
+// word tells them apart and they go to glibc untouched.
+//
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+#define ALLOCATION_HEADER_MAGIC 0x9e3779b97f4a7c15ULL
+
+struct AllocationHeader
+{
+  // the size in the upper bits, the tag in the lowest byte
+  quint64 sizeAndTag;
+  quint64 check;
+};
+
+static_assert(sizeof(AllocationHeader) == 16, "keeps malloc's alignment");
+
+static std::atomic<qint64> g_liveBytes[AllocationTracker::TagCount];
+static std::atomic<qint64> g_allocations[AllocationTracker::TagCount];
+
+static thread_local int g_tag = AllocationTracker::Untagged;
+static thread_local qint64 g_threadAllocations = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void* track(void* block, size_t size)
+{
+  if (!block)
+    return nullptr;
+
+  AllocationHeader* header = (AllocationHeader*)block;
+  header->sizeAndTag = ((quint64)size << 8) | (quint64)g_tag;
+  header->check = header->sizeAndTag ^ ALLOCATION_HEADER_MAGIC;
+
+  g_liveBytes[g_tag].fetch_add(size, std::memory_order_relaxed);
+  g_allocations[g_tag].fetch_add(1, std::memory_order_relaxed);
+  g_threadAllocations++;
+
+  return header + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// nullptr if ptr isn't one of ours
+static AllocationHeader* headerOf(void* ptr)
+{
+  AllocationHeader* header = (AllocationHeader*)ptr - 1;
+  if ((header->sizeAndTag ^ ALLOCATION_HEADER_MAGIC) != header->check)
+    return nullptr;
+  return header;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void untrack(AllocationHeader* header)
+{
+  int tag = header->sizeAndTag & 0xff;
+  g_liveBytes[tag].fetch_sub(header->sizeAndTag >> 8, std::memory_order_relaxed);
+  // so a stale pointer isn't taken for ours again
+  header->check = 0;
+}
+
+extern "C" void* malloc(size_t size)
+{
+  return track(__libc_malloc(size + sizeof(AllocationHeader)), size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  if (size && count > (SIZE_MAX - sizeof(AllocationHeader)) / size)
+    return nullptr;
+  return track(__libc_calloc(1, count * size + sizeof(AllocationHeader)), count * size);
+}
+
+extern "C" void free(void* ptr)
+{
+  if (!ptr)
+    return;
+
+  AllocationHeader* header = headerOf(ptr);
+  if (!header)
+  {
+    __libc_free(ptr);
+    return;
+  }
+
+  untrack(header);
+  __libc_free(header);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+  if (!ptr)
+    return malloc(size);
+
+  AllocationHeader* header = headerOf(ptr);
+  if (!header)
+    return __libc_realloc(ptr, size);
+
+  if (size == 0)
+  {
+    free(ptr);
+    return nullptr;
+  }
+
+  // taken off its old tag and put on the current one, whoever grows it owns it
+  AllocationHeader saved = *header;
+  untrack(header);
+  void* block = __libc_realloc(header, size + sizeof(AllocationHeader));
+  if (!block)
+  {
+    // the old block is still there, and still ours
+    *header = saved;
+    g_liveBytes[saved.sizeAndTag & 0xff].fetch_add(saved.sizeAndTag >> 8, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  return track(block, size);
+}
+
+extern "C" size_t malloc_usable_size(void* ptr)
+{
+  if (!ptr)
+    return 0;
+
+  // glibc's would read our header as its chunk header
+  AllocationHeader* header = headerOf(ptr);
+  if (header)
+    return header->sizeAndTag >> 8;
+
+  // not ours, so it came from glibc as it is and glibc's own knows its size
+  typedef size_t (*UsableSizeFunc)(void*);
+  static UsableSizeFunc libcUsableSize = (UsableSizeFunc)dlsym(RTLD_NEXT, "malloc_usable_size");
+  return libcUsableSize ? libcUsableSize(ptr) : 0;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AllocationTracker::Scope::Scope(Tag tag) : m_previous(Untagged)
+{
+#ifdef HAVE_ALLOCATION_TRACKING
+  m_previous = (Tag)g_tag;
+  g_tag = tag;
+#else
+  Q_UNUSED(tag);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AllocationTracker::Scope::~Scope()
+{
+#ifdef HAVE_ALLOCATION_TRACKING
+  g_tag = m_previous;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool AllocationTracker::isEnabled()
+{
+#ifdef HAVE_ALLOCATION_TRACKING
+  return true;
+#else
+  return false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 AllocationTracker::threadAllocations()
+{
+#ifdef HAVE_ALLOCATION_TRACKING
+  return g_threadAllocations;
+#else
+  return -1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString AllocationTracker::summary()
+{
+#ifdef HAVE_ALLOCATION_TRACKING
+  static const char* names[TagCount] = { "untagged", "player", "remote", "input", "settings", "http" };
+  static qint64 lastAllocations[TagCount] = {};
+  static QElapsedTimer clock;
+
+  double seconds = clock.isValid() ? clock.restart() / 1000.0 : 0;
+  if (!clock.isValid())
+    clock.start();
+
+  QString info = "Allocations\n";
+  for (int tag = 0; tag < TagCount; tag++)
+  {
+    qint64 allocations = g_allocations[tag].load(std::memory_order_relaxed);
+    qint64 rate = seconds > 0 ? (qint64)((allocations - lastAllocations[tag]) / seconds) : 0;
+    lastAllocations[tag] = allocations;
+
+    info += QString("  %1: %2KB live, %3/s\n").arg(names[tag])
+            .arg(g_liveBytes[tag].load(std::memory_order_relaxed) / 1024).arg(rate);
+  }
+  return info + "\n";
+#else
+  return QString();
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+
+#include <QString>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// In ENABLE_ALLOCATION_TRACKING builds on glibc, every malloc is tagged with the subsystem
+// the allocating thread is in (see ALLOCATION_TAG) and the live bytes and allocation rate
+// are kept per tag, for the debug overlay and the diagnostics dump. This is for measuring
+// allocation work and catching leaks and churn, it costs a header per allocation and an
+// atomic add per malloc and free. In other builds ALLOCATION_TAG() is nothing and summary()
+// is empty.
+//
+class AllocationTracker
+{
+public:
+  enum Tag
+  {
+    Untagged,
+    Player,
+    Remote,
+    Input,
+    Settings,
+    HttpServer,
+    TagCount
+  };
+
+  // Sets the tag of the current thread until it goes out of scope. Innermost wins.
+  class Scope
+  {
+  public:
+    explicit Scope(Tag tag);
+    ~Scope();
+
+  private:
+    Tag m_previous;
+  };
+
+  static bool isEnabled();
+  // Allocations of the calling thread so far, -1 if not tracking. For AllocationCounter.
+  static qint64 threadAllocations();
+
+  // Live bytes and allocations per second since the last call, by tag. Main thread only.
+  static QString summary();
+};
+
+#ifdef ENABLE_ALLOCATION_TRACKING
+#define ALLOCATION_TAG(tag) AllocationTracker::Scope allocationScope(AllocationTracker::tag)
+#else
+#define ALLOCATION_TAG(tag)
+#endif
+
+#endif // ALLOCATIONTRACKER_H
@@ -0,0 +1,87 @@
+#include "AssetView.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QResource>
+#include <QWeakPointer>
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Keeps whatever the data lives in: the mapped file, or an expanded resource.
+struct AssetView::Owner
+{
+  QFile file;
+  QByteArray expanded;
+};
+
+// expanded resources, by path, for as long as any view holds them
+static QMutex g_expandedLock;
+static QHash<QString, QWeakPointer<AssetView::Owner>> g_expanded;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AssetView AssetView::open(const QString& path)
+{
+  AssetView view;
+
+  if (path.startsWith(":/") || path.startsWith("qrc:/"))
+  {
+    QResource resource(path.startsWith("qrc:") ? path.mid(3) : path);
+    if (!resource.isValid() || !resource.data())
+      return view;
+
+    if (!resource.isCompressed())
+    {
+      view.m_data = (const char*)resource.data();
+      view.m_size = resource.size();
+      return view;
+    }
+
+    QMutexLocker lock(&g_expandedLock);
+    QSharedPointer<Owner> owner = g_expanded.value(resource.fileName()).toStrongRef();
+    if (!owner)
+    {
+      owner.reset(new Owner);
+      owner->expanded = qUncompress(resource.data(), (int)resource.size());
+      if (owner->expanded.isEmpty() && resource.size() > 0)
+      {
+        QLOG_WARN() << "Failed to expand resource" << path;
+        return view;
+      }
+      g_expanded.insert(resource.fileName(), owner);
+    }
+
+    view.m_owner = owner;
+    view.m_data = owner->expanded.constData();
+    view.m_size = owner->expanded.size();
+    return view;
+  }
+
+  QSharedPointer<Owner> owner(new Owner);
+  owner->file.setFileName(path);
+  if (!owner->file.open(QIODevice::ReadOnly))
+    return view;
+
+  // mapping nothing fails, an empty file is still a valid view
+  view.m_owner = owner;
+  qint64 size = owner->file.size();
+  if (size > 0)
+  {
+    const uchar* data = owner->file.map(0, size);
+    if (!data)
+    {
+      // not every file can be mapped, those are read instead
+      owner->expanded = owner->file.readAll();
+      owner->file.close();
+      view.m_data = owner->expanded.constData();
+      view.m_size = owner->expanded.size();
+      return view;
+    }
+
+    view.m_data = (const char*)data;
+    view.m_size = size;
+  }
+
+  return view;
+}
@@ -0,0 +1,39 @@
+#ifndef ASSETVIEW_H
+#define ASSETVIEW_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Read-only view of an embedded resource (":/...") or a file on disk, without copying it
+// into the heap. Uncompressed resources point straight into the binary, files are
+// memory-mapped. Compressed resources have to be expanded, that's done once and shared
+// by all views of the same resource for as long as one of them is around, which is why
+// the hot assets are stored uncompressed (see build-qt-resources.py). Copies of a view
+// share the data, and it can be used from any thread.
+//
+class AssetView
+{
+public:
+  AssetView() : m_data(nullptr), m_size(0) {}
+
+  // An invalid view if the resource or file doesn't exist or can't be read.
+  static AssetView open(const QString& path);
+
+  bool isValid() const { return !m_owner.isNull() || m_data; }
+  const char* data() const { return m_data; }
+  qint64 size() const { return m_size; }
+
+  // No copy either, so the QByteArray must not outlive the view.
+  QByteArray bytes() const { return QByteArray::fromRawData(m_data, (int)m_size); }
+
+private:
+  struct Owner;
+
+  QSharedPointer<Owner> m_owner;
+  const char* m_data;
+  qint64 m_size;
+};
+
+#endif // ASSETVIEW_H
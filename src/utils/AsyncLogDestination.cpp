@@ -0,0 +1,119 @@
+#include "AsyncLogDestination.h"
+
+#include <QMutexLocker>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+AsyncLogDestination::AsyncLogDestination(const QsLogging::DestinationPtr& destination)
+  : m_destination(destination), m_thread(this), m_writing(false), m_rotate(false), m_quit(false), m_dropped(0),
+    m_written(0), m_totalDropped(0)
+{
+  m_queue.reserve(ASYNC_LOG_QUEUE_SIZE);
+
+  m_thread.setObjectName("AsyncLog");
+  m_thread.start(QThread::LowPriority);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+AsyncLogDestination::~AsyncLogDestination()
+{
+  {
+    QMutexLocker lock(&m_lock);
+    m_quit = true;
+    m_wakeup.wakeOne();
+  }
+
+  // the writer thread drains the queue before it exits
+  m_thread.wait();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void AsyncLogDestination::write(const QString& message, QsLogging::Level level)
+{
+  QMutexLocker lock(&m_lock);
+
+  int limit = level >= QsLogging::WarnLevel ? ASYNC_LOG_QUEUE_SIZE * 2 : ASYNC_LOG_QUEUE_SIZE;
+  if (m_queue.size() >= limit)
+  {
+    m_dropped++;
+    m_totalDropped++;
+    return;
+  }
+
+  m_queue.append(Message{message, level});
+
+  if (m_queue.size() == 1)
+    m_wakeup.wakeOne();
+
+  // the process is about to go down, make sure this makes it to the disk
+  if (level >= QsLogging::FatalLevel)
+  {
+    while (!m_queue.isEmpty() || m_writing)
+      m_drained.wait(&m_lock);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void AsyncLogDestination::rotate()
+{
+  QMutexLocker lock(&m_lock);
+  m_rotate = true;
+  m_wakeup.wakeOne();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void AsyncLogDestination::run()
+{
+  QVector<Message> batch;
+  batch.reserve(ASYNC_LOG_QUEUE_SIZE);
+
+  QMutexLocker lock(&m_lock);
+
+  while (true)
+  {
+    while (m_queue.isEmpty() && !m_rotate && !m_quit)
+      m_wakeup.wait(&m_lock);
+
+    if (m_queue.isEmpty() && m_quit)
+      break;
+
+    batch.swap(m_queue);
+    bool rotate = m_rotate;
+    int dropped = m_dropped;
+    m_rotate = false;
+    m_dropped = 0;
+    m_writing = true;
+
+    lock.unlock();
+
+    if (rotate)
+      m_destination->rotate();
+
+    if (!batch.isEmpty())
+    {
+      // Join everything into one write. The file destination flushes after
+      // every write, so this turns many small writes into a single one.
+      QString text;
+      QsLogging::Level level = QsLogging::TraceLevel;
+      for (int i = 0; i < batch.size(); i++)
+      {
+        if (i > 0)
+          text += QLatin1Char('\n');
+        text += batch.at(i).text;
+        level = qMax(level, batch.at(i).level);
+      }
+
+      if (dropped)
+        text += QString("\n(%1 log messages dropped, log writer could not keep up)").arg(dropped);
+
+      m_destination->write(text, level);
+      m_written += batch.size();
+      batch.clear();
+    }
+
+    lock.relock();
+    m_writing = false;
+    m_drained.wakeAll();
+  }
+
+  m_drained.wakeAll();
+}
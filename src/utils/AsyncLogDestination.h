@@ -0,0 +1,70 @@
+#ifndef PLEXMEDIAPLAYER_ASYNCLOGDESTINATION_H
+#define PLEXMEDIAPLAYER_ASYNCLOGDESTINATION_H
+
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "QsLogDest.h"
+
+// Max. number of messages waiting for the writer thread. Below warning level
+// new messages are dropped once this is reached, warnings and errors are
+// allowed to use twice as much before they are dropped too.
+#define ASYNC_LOG_QUEUE_SIZE 4096
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Wraps another destination (normally the log file) and writes to it from a
+// background thread, so that a slow disk never blocks the thread that logs.
+// Messages are written in batches, log rotation happens on the writer thread.
+class AsyncLogDestination : public QsLogging::Destination
+{
+public:
+  explicit AsyncLogDestination(const QsLogging::DestinationPtr& destination);
+  ~AsyncLogDestination() override;
+
+  void write(const QString& message, QsLogging::Level level) override;
+  bool isValid() override { return m_destination && m_destination->isValid(); }
+  void rotate() override;
+
+  quint64 writtenCount() const { return m_written; }
+  quint64 droppedCount() const { return m_totalDropped; }
+
+private:
+  class WriterThread : public QThread
+  {
+  public:
+    explicit WriterThread(AsyncLogDestination* destination) : m_destination(destination) {}
+    void run() override { m_destination->run(); }
+
+  private:
+    AsyncLogDestination* m_destination;
+  };
+
+  void run();
+
+  struct Message
+  {
+    QString text;
+    QsLogging::Level level;
+  };
+
+  QsLogging::DestinationPtr m_destination;
+  WriterThread m_thread;
+
+  QMutex m_lock;
+  QWaitCondition m_wakeup;
+  QWaitCondition m_drained;
+  QVector<Message> m_queue;
+  bool m_writing;
+  bool m_rotate;
+  bool m_quit;
+  int m_dropped;
+
+  std::atomic<quint64> m_written;
+  std::atomic<quint64> m_totalDropped;
+};
+
+#endif //PLEXMEDIAPLAYER_ASYNCLOGDESTINATION_H
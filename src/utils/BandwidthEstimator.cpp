@@ -0,0 +1,169 @@
+#include "BandwidthEstimator.h"
+
+#include <memory>
+
+#include "QsLog.h"
+#include "utils/NetworkState.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BandwidthEstimator::BandwidthEstimator() : QObject(nullptr), m_lastMaxBitrate(0), m_expiryTimer(this)
+{
+  connect(&NetworkState::Get(), &NetworkState::addressesChanged, this, &BandwidthEstimator::clear);
+
+  m_expiryTimer.setSingleShot(true);
+  m_expiryTimer.setTimerType(Qt::CoarseTimer);
+  connect(&m_expiryTimer, &QTimer::timeout, this, &BandwidthEstimator::expire);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString BandwidthEstimator::serverKey(const QUrl& url)
+{
+  int port = url.port(url.scheme() == "https" ? 443 : 80);
+  return url.host().toLower() + ":" + QString::number(port);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::watch(QNetworkReply* reply)
+{
+  struct Timing
+  {
+    QElapsedTimer timer;
+    qint64 first = 0;
+    qint64 last = 0;
+  };
+  auto timing = std::make_shared<Timing>();
+
+  connect(reply, &QNetworkReply::downloadProgress, this, [=](qint64 received, qint64)
+  {
+    if (!timing->timer.isValid())
+    {
+      timing->timer.start();
+      timing->first = received;
+    }
+    timing->last = received;
+  });
+
+  connect(reply, &QNetworkReply::finished, this, [=]()
+  {
+    // aborted ones end early, but what arrived until then was real
+    if (timing->timer.isValid())
+      addSample(serverKey(reply->url()), timing->last - timing->first, timing->timer.elapsed());
+  });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::addSample(const QString& server, qint64 bytes, qint64 msecs)
+{
+  if (bytes < BANDWIDTH_MIN_SAMPLE_BYTES || msecs <= 0)
+    return;
+
+  add(server, bytes * 1000.0 / msecs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::addRate(const QString& server, double bytesPerSecond)
+{
+  if (bytesPerSecond <= 0)
+    return;
+
+  m_playbackServer = server;
+  add(server, bytesPerSecond);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::add(const QString& server, double bytesPerSecond)
+{
+  Estimate& estimate = m_estimates[server];
+  if (estimate.samples == 0 || estimate.age.elapsed() > BANDWIDTH_MAX_AGE_MSEC)
+  {
+    estimate.rate = bytesPerSecond;
+    estimate.samples = 0;
+  }
+  else
+  {
+    estimate.rate += (bytesPerSecond - estimate.rate) * BANDWIDTH_EWMA_WEIGHT;
+  }
+
+  estimate.samples++;
+  estimate.age.start();
+
+  QLOG_TRACE() << "Throughput to" << server << ":" << (qint64)bytesPerSecond << "B/s, estimate"
+               << (qint64)estimate.rate << "B/s";
+
+  // downloads from the playback server count for the hint as well
+  if (server == m_playbackServer)
+  {
+    m_expiryTimer.start(BANDWIDTH_MAX_AGE_MSEC);
+    updateMaxBitrate();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double BandwidthEstimator::estimate(const QString& server) const
+{
+  auto it = m_estimates.constFind(server);
+  if (it == m_estimates.constEnd() || it->age.elapsed() > BANDWIDTH_MAX_AGE_MSEC)
+    return 0;
+  return it->rate;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int BandwidthEstimator::maxBitrate(const QString& server) const
+{
+  double rate = estimate(server.isEmpty() ? m_playbackServer : server);
+  int kbps = (int)(rate * 8 / 1000 * BANDWIDTH_BITRATE_HEADROOM);
+  return kbps / BANDWIDTH_BITRATE_STEP_KBPS * BANDWIDTH_BITRATE_STEP_KBPS;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QVariantMap BandwidthEstimator::summary(const QString& server) const
+{
+  QString key = server.isEmpty() ? m_playbackServer : server;
+  double rate = estimate(key);
+
+  QVariantMap summary;
+  summary["bytesPerSecond"] = (qint64)rate;
+  summary["samples"] = rate > 0 ? m_estimates.value(key).samples : 0;
+  summary["maxBitrate"] = maxBitrate(key);
+  return summary;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::clear()
+{
+  if (m_estimates.isEmpty())
+    return;
+
+  QLOG_DEBUG() << "Network changed, forgetting throughput estimates";
+  m_estimates.clear();
+  m_expiryTimer.stop();
+  updateMaxBitrate();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::expire()
+{
+  // a coarse timer may run out a little early, the age check below would keep it then
+  m_estimates.remove(m_playbackServer);
+  for (auto it = m_estimates.begin(); it != m_estimates.end();)
+  {
+    if (it->age.elapsed() >= BANDWIDTH_MAX_AGE_MSEC)
+      it = m_estimates.erase(it);
+    else
+      ++it;
+  }
+
+  QLOG_DEBUG() << "Throughput estimate for" << m_playbackServer << "expired";
+  updateMaxBitrate();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BandwidthEstimator::updateMaxBitrate()
+{
+  int kbps = maxBitrate();
+  if (kbps != m_lastMaxBitrate)
+  {
+    m_lastMaxBitrate = kbps;
+    emit maxBitrateChanged(kbps);
+  }
+}
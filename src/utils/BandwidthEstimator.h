@@ -0,0 +1,88 @@
+#ifndef BANDWIDTHESTIMATOR_H
+#define BANDWIDTHESTIMATOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QNetworkReply>
+#include <QTimer>
+#include <QUrl>
+#include <QVariantMap>
+
+#include "utils/Utils.h"
+
+// weight of a new sample in the per server moving average
+#define BANDWIDTH_EWMA_WEIGHT 0.25
+// downloads smaller than this say more about latency than about throughput
+#define BANDWIDTH_MIN_SAMPLE_BYTES (256 * 1024)
+// estimates that weren't updated for this long are dropped
+#define BANDWIDTH_MAX_AGE_MSEC (30 * 60 * 1000)
+// share of the estimate a stream should use at most, the rest covers variance and seeking
+#define BANDWIDTH_BITRATE_HEADROOM 0.7
+// the bitrate hint is rounded down to this, so it doesn't change with every sample
+#define BANDWIDTH_BITRATE_STEP_KBPS 500
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the throughput to each server as an exponentially weighted moving average. The
+// samples are mpv's cache-speed while it is filling its cache, and the timings of the large
+// downloads of NetworkService (codecs, updates). Estimates are forgotten when the network
+// changes, or when they weren't updated for BANDWIDTH_MAX_AGE_MSEC.
+//
+// The web client can ask for it to pick a transcode bitrate before starting playback,
+// the capabilities string carries a hint for the server that was played from last.
+//
+// Main thread only.
+//
+class BandwidthEstimator : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(BandwidthEstimator);
+
+public:
+  // Server key of url, "host:port".
+  static QString serverKey(const QUrl& url);
+
+  // Times reply from its first byte to the end.
+  void watch(QNetworkReply* reply);
+
+  void addSample(const QString& server, qint64 bytes, qint64 msecs);
+  // A rate measured while reading as fast as possible, only playback has these.
+  void addRate(const QString& server, double bytesPerSecond);
+
+  // Bytes per second, 0 if unknown.
+  double estimate(const QString& server) const;
+
+  // The bitrate in kbps a stream from server should stay below, 0 if unknown. Without a
+  // server, for the server playback used last.
+  int maxBitrate(const QString& server = QString()) const;
+
+  // For the web client: "bytesPerSecond", "samples" and "maxBitrate" (kbps). Without a server,
+  // for the server playback used last.
+  QVariantMap summary(const QString& server) const;
+
+Q_SIGNALS:
+  // Only when maxBitrate() of the playback server changed, that includes its estimate expiring.
+  void maxBitrateChanged(int kbps);
+
+private:
+  BandwidthEstimator();
+  void add(const QString& server, double bytesPerSecond);
+  void clear();
+  void expire();
+  void updateMaxBitrate();
+
+  struct Estimate
+  {
+    double rate = 0;
+    int samples = 0;
+    QElapsedTimer age;
+  };
+  QHash<QString, Estimate> m_estimates;
+
+  QString m_playbackServer;
+  int m_lastMaxBitrate;
+  // runs out when the estimate of the playback server gets too old
+  QTimer m_expiryTimer;
+};
+
+#endif // BANDWIDTHESTIMATOR_H
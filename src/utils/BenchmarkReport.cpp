@@ -0,0 +1,23 @@
+#include "BenchmarkReport.h"
+
+#include <QString>
+
+#include <stdio.h>
+
+#include "QsLog.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void reportBenchmark(const char* name, qint64 calls, qint64 nsecs, qint64 allocations, const char* unit)
+{
+  if (!calls || !nsecs)
+    return;
+
+  double perCall = (double)nsecs / calls;
+  QString allocs = allocations < 0 ? "n/a" : QString::number((double)allocations / calls, 'f', 2);
+
+  // one line each, so runs are easy to diff against a baseline
+  printf("%-32s %9lld %ss %12.0f %ss/s %11.0f ns/%s %8s allocs/%s\n", name, (long long)calls, unit,
+         1e9 / perCall, unit, perCall, unit, qPrintable(allocs), unit);
+  QLOG_INFO() << "Benchmark" << name << ":" << calls << unit << "s," << perCall << "ns/" << unit << ","
+              << allocs << "allocs/" << unit;
+}
@@ -0,0 +1,13 @@
+#ifndef BENCHMARKREPORT_H
+#define BENCHMARKREPORT_H
+
+#include <QtGlobal>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Prints one result line of a --benchmark run and logs it. unit is what calls counts
+// ("call", "event"), allocations is what AllocationCounter::stop() returned, -1 if unknown.
+// Nothing is printed for a run that didn't do anything.
+//
+void reportBenchmark(const char* name, qint64 calls, qint64 nsecs, qint64 allocations, const char* unit = "call");
+
+#endif // BENCHMARKREPORT_H
@@ -5,75 +5,152 @@
 #include "CachedRegexMatcher.h"
 #include "QsLog.h"
 
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool CachedRegexMatcher::parseLiteral(const QString& pattern, QString& text, bool& exact)
+{
+  static const QString metaChars = "^$.|?*+()[]{}";
+
+  QString body = pattern;
+  exact = body.startsWith("^") && body.endsWith("$") && !body.endsWith("\\$") && body.size() >= 2;
+  if (exact)
+    body = body.mid(1, body.size() - 2);
+
+  text.clear();
+  for (int i = 0; i < body.size(); i++)
+  {
+    QChar c = body[i];
+    if (c == '\\')
+    {
+      // escaped punctuation is literal, anything else (\d, \w, ...) is a class
+      if (i + 1 >= body.size() || body[i + 1].isLetterOrNumber())
+        return false;
+      text += body[++i];
+    }
+    else if (metaChars.contains(c))
+    {
+      return false;
+    }
+    else
+    {
+      text += c;
+    }
+  }
+  return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 bool CachedRegexMatcher::addMatcher(const QString& pattern, const QVariant& result)
 {
-  QRegExp matcher(pattern);
-  if (!matcher.isValid())
+  Matcher matcher;
+  matcher.pattern = pattern;
+  matcher.result = result;
+  matcher.literal = parseLiteral(pattern, matcher.text, matcher.exact);
+
+  if (!matcher.literal)
   {
-    QLOG_WARN() << "Could not compile pattern:" << pattern;
-    return false;
+    matcher.regex = QRegularExpression(pattern, QRegularExpression::OptimizeOnFirstUsageOption);
+    if (!matcher.regex.isValid())
+    {
+      QLOG_WARN() << "Could not compile pattern:" << pattern << matcher.regex.errorString();
+      return false;
+    }
   }
 
   // Remove older mapping if it exists.
   if (!m_allowMultiplePatterns)
   {
-    auto newEnd = std::remove_if(m_matcherList.begin(),m_matcherList.end(), [pattern](auto mp)
+    auto newEnd = std::remove_if(m_matcherList.begin(), m_matcherList.end(), [pattern](const Matcher& mp)
     {
-      return mp.first.pattern() == pattern;
+      return mp.pattern == pattern;
     });
     m_matcherList.erase(newEnd, m_matcherList.end());
   }
 
-  m_matcherList.push_back(qMakePair(matcher, result));
+  m_matcherList.push_back(matcher);
+  rebuildIndex();
   return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-QVariantList CachedRegexMatcher::match(const QString& input)
+void CachedRegexMatcher::rebuildIndex()
 {
-  // first we check if this match has already happened before
-  if (m_matcherCache.contains(input))
-    return m_matcherCache.value(input);
+  m_exactIndex.clear();
+  m_scanList.clear();
+  m_matcherCache.clear();
 
-  QVariantList matches;
+  for (int i = 0; i < m_matcherList.size(); i++)
+  {
+    const Matcher& matcher = m_matcherList[i];
+    if (matcher.literal && matcher.exact)
+      m_exactIndex[matcher.text].append(i);
+    else
+      m_scanList.append(i);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariant CachedRegexMatcher::resultFor(const Matcher& matcher, const QRegularExpressionMatch* match) const
+{
+  if (!match || match->lastCapturedIndex() < 1 || matcher.result.type() != QVariant::String)
+    return matcher.result;
 
-  // otherwise try to iterate our list and find a match
-  for(const MatcherValuePair& matcher : m_matcherList)
+  QString value(matcher.result.toString());
+
+  for (int i = 0; i < match->lastCapturedIndex(); i ++)
   {
-    QRegExp re(matcher.first);
+    QString argFmt = QString("%%1").arg(i + 1);
+    if (value.contains(argFmt))
+      value = value.arg(match->captured(i + 1));
+  }
+  return QVariant(value);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QVariantList CachedRegexMatcher::match(const QString& input)
+{
+  // first we check if this input has been seen before, misses are cached too
+  QVariantList* cached = m_matcherCache.object(input);
+  if (cached)
+    return *cached;
+
+  // collect (index, result) so that the results keep the order the patterns
+  // were added in, no matter which path found them
+  QList<QPair<int, QVariant>> found;
 
-    if (re.indexIn(input) != -1)
+  for (int index : m_exactIndex.value(input))
+    found.append(qMakePair(index, m_matcherList[index].result));
+
+  for (int index : m_scanList)
+  {
+    const Matcher& matcher = m_matcherList[index];
+    if (matcher.literal)
     {
-      // found match
-      QVariant returnValue = matcher.second;
-
-      if (re.captureCount() > 0 && matcher.second.type() == QVariant::String)
-      {
-        QString value(matcher.second.toString());
-
-        for (int i = 0; i < re.captureCount(); i ++)
-        {
-          QString argFmt = QString("%%1").arg(i + 1);
-          if (value.contains(argFmt))
-            value = value.arg(re.cap(i + 1));
-        }
-        returnValue = QVariant(value);
-      }
-
-      matches << returnValue;
+      if (input.contains(matcher.text))
+        found.append(qMakePair(index, matcher.result));
+      continue;
     }
-  }
 
-  QLOG_DEBUG() << "No match for:" << input;
+    QRegularExpressionMatch match = matcher.regex.match(input);
+    if (match.hasMatch())
+      found.append(qMakePair(index, resultFor(matcher, &match)));
+  }
 
-  if (!matches.isEmpty())
+  std::stable_sort(found.begin(), found.end(), [](const QPair<int, QVariant>& a, const QPair<int, QVariant>& b)
   {
-    m_matcherCache.insert(input, matches);
-    return matches;
-  }
+    return a.first < b.first;
+  });
+
+  QVariantList matches;
+  for (auto& entry : found)
+    matches << entry.second;
+
+  if (matches.isEmpty())
+    QLOG_DEBUG() << "No match for:" << input;
 
-  return QVariantList();
+  m_matcherCache.insert(input, new QVariantList(matches));
+  return matches;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -81,4 +158,6 @@ void CachedRegexMatcher::clear()
 {
   m_matcherCache.clear();
   m_matcherList.clear();
+  m_exactIndex.clear();
+  m_scanList.clear();
 }
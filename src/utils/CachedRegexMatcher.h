@@ -5,28 +5,49 @@
 #ifndef KONVERGO_CACHEDREGEXMATCHER_H
 #define KONVERGO_CACHEDREGEXMATCHER_H
 
-#include <QRegExp>
+#include <QRegularExpression>
 #include <QVariant>
 #include <QString>
 #include <QHash>
+#include <QCache>
 
-typedef QPair<QRegExp, QVariant> MatcherValuePair;
-typedef QList<MatcherValuePair> MatcherValueList;
+// how many distinct inputs (matches and misses) are remembered
+#define REGEX_MATCHER_CACHE_SIZE 512
 
 class CachedRegexMatcher : public QObject
 {
 public:
   explicit CachedRegexMatcher(bool allowMultiplePatterns = true, QObject* parent = nullptr)
-    : QObject(parent), m_allowMultiplePatterns(allowMultiplePatterns) {}
+    : QObject(parent), m_allowMultiplePatterns(allowMultiplePatterns), m_matcherCache(REGEX_MATCHER_CACHE_SIZE) {}
 
   bool addMatcher(const QString& pattern, const QVariant& result);
   QVariantList match(const QString& input);
   void clear();
 
 private:
-  MatcherValueList m_matcherList;
-  QHash<QString, QVariantList> m_matcherCache;
+  struct Matcher
+  {
+    QString pattern;
+    QRegularExpression regex;
+    // Patterns without any regex features are compared as plain strings.
+    // "^foo$" is an exact match, anything else a substring match.
+    bool literal;
+    bool exact;
+    QString text;
+    QVariant result;
+  };
+
+  static bool parseLiteral(const QString& pattern, QString& text, bool& exact);
+  void rebuildIndex();
+  QVariant resultFor(const Matcher& matcher, const QRegularExpressionMatch* match) const;
+
+  QList<Matcher> m_matcherList;
+  // exact literal text -> indexes into m_matcherList
+  QHash<QString, QList<int>> m_exactIndex;
+  // everything that isn't an exact literal, in m_matcherList order
+  QList<int> m_scanList;
   bool m_allowMultiplePatterns;
+  QCache<QString, QVariantList> m_matcherCache;
 };
 
 #endif //KONVERGO_CACHEDREGEXMATCHER_H
@@ -0,0 +1,67 @@
+#include "DiscoveryThrottle.h"
+#include "QsLog.h"
+
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DiscoveryThrottle::allow(const QHostAddress& sender, quint16 port, const QByteArray& request)
+{
+  qint64 now = m_clock.elapsed();
+  uint requestHash = qHash(request);
+
+  auto it = m_senders.find(sender);
+  if (it == m_senders.end())
+  {
+    if (m_senders.size() >= DISCOVERY_MAX_SENDERS)
+      prune(now);
+
+    Sender entry = { DISCOVERY_BURST - 1, now, port, requestHash, now };
+    m_senders.insert(sender, entry);
+    return true;
+  }
+
+  Sender& entry = it.value();
+
+  if (entry.lastPort == port && entry.lastRequest == requestHash &&
+      now - entry.lastRequestTime < DISCOVERY_DEDUP_MSEC)
+  {
+    m_dropped++;
+    return false;
+  }
+
+  entry.tokens = std::min<double>(DISCOVERY_BURST, entry.tokens + (now - entry.lastRefill) * DISCOVERY_RATE_PER_SEC / 1000.0);
+  entry.lastRefill = now;
+
+  if (entry.tokens < 1)
+  {
+    if ((++m_dropped % 100) == 1)
+      QLOG_DEBUG() << "Throttling discovery requests from" << sender.toString() << "- dropped" << m_dropped << "so far";
+    return false;
+  }
+
+  entry.tokens -= 1;
+  entry.lastPort = port;
+  entry.lastRequest = requestHash;
+  entry.lastRequestTime = now;
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void DiscoveryThrottle::prune(qint64 now)
+{
+  // a sender whose bucket is full again is the same as one we never saw
+  qint64 refillTime = DISCOVERY_BURST * 1000 / DISCOVERY_RATE_PER_SEC;
+
+  for (auto it = m_senders.begin(); it != m_senders.end();)
+  {
+    if (now - it.value().lastRefill > refillTime)
+      it = m_senders.erase(it);
+    else
+      ++it;
+  }
+
+  // everyone is busy, start over rather than growing without bounds
+  if (m_senders.size() >= DISCOVERY_MAX_SENDERS)
+    m_senders.clear();
+}
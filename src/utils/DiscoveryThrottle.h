@@ -0,0 +1,46 @@
+#ifndef KONVERGO_DISCOVERYTHROTTLE_H
+#define KONVERGO_DISCOVERYTHROTTLE_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QElapsedTimer>
+
+// answers a sender can get in a row
+#define DISCOVERY_BURST 4
+// and how fast they come back
+#define DISCOVERY_RATE_PER_SEC 2
+// the same request from the same sender and port within this window is a retransmit
+#define DISCOVERY_DEDUP_MSEC 1000
+// forget about senders when we track more than this
+#define DISCOVERY_MAX_SENDERS 256
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Decides whether a multicast discovery request (GDM, SSDP) should be answered.
+// Every sender gets a small token bucket, and retransmits of the same request
+// are dropped, so busy networks don't keep us answering the same search.
+//
+class DiscoveryThrottle
+{
+public:
+  DiscoveryThrottle() { m_clock.start(); }
+
+  bool allow(const QHostAddress& sender, quint16 port, const QByteArray& request);
+
+private:
+  struct Sender
+  {
+    double tokens;
+    qint64 lastRefill;
+    quint16 lastPort;
+    uint lastRequest;
+    qint64 lastRequestTime;
+  };
+
+  void prune(qint64 now);
+
+  QHash<QHostAddress, Sender> m_senders;
+  QElapsedTimer m_clock;
+  quint64 m_dropped = 0;
+};
+
+#endif // KONVERGO_DISCOVERYTHROTTLE_H
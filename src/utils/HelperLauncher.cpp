@@ -8,11 +8,19 @@
 #include "settings/SettingsSection.h"
 #include "utils/Utils.h"
 #include "Names.h"
+#include "HelperStatus.h"
 
+#include <QCoreApplication>
 #include <QTimer>
 
+// first wait before connecting again, doubled on every failed attempt up to the maximum
+#define HELPER_CONNECT_RETRY_MSEC 1000
+#define HELPER_CONNECT_RETRY_MAX_MSEC 30000
+// attempts in a row before giving up on the helper until the next disconnect
+#define HELPER_CONNECT_MAX_RETRIES 10
+
 /////////////////////////////////////////////////////////////////////////////////////////
-HelperLauncher::HelperLauncher(QObject* parent) : QObject(parent)
+HelperLauncher::HelperLauncher(QObject* parent) : QObject(parent), m_connectRetries(0)
 {
   start();
 }
@@ -32,6 +40,16 @@ void HelperLauncher::start()
 
   m_helperProcess = new QProcess(this);
 
+  m_heartbeatTimer = new QTimer(this);
+  m_heartbeatTimer->setInterval(HELPER_STATUS_HEARTBEAT_MSEC);
+  m_heartbeatTimer->setTimerType(Qt::CoarseTimer);
+  connect(m_heartbeatTimer, &QTimer::timeout, []() { HelperStatus::Get().mainHeartbeat(); });
+  if (helperEnabled())
+  {
+    HelperStatus::Get().mainHeartbeat();
+    m_heartbeatTimer->start();
+  }
+
   connect(SettingsComponent::Get().getSection(SETTINGS_SECTION_WEBCLIENT), &SettingsSection::valuesUpdated, [=](const QVariantMap& values)
   {
     if (values.contains("clientID"))
@@ -99,42 +117,61 @@ void HelperLauncher::socketError(QLocalSocket::LocalSocketError error)
 {
   QLOG_DEBUG() << "Failed to connect to helper:" << m_jsonClient->errorString();
 
-  if (error == QLocalSocket::ConnectionRefusedError ||
-      error == QLocalSocket::ServerNotFoundError)
-    launch();
+  if (error != QLocalSocket::ConnectionRefusedError &&
+      error != QLocalSocket::ServerNotFoundError)
+    return;
+
+  // a helper that is still starting up or busy doesn't need another one next to it
+  if (HelperStatus::Get().helperAlive())
+  {
+    QLOG_DEBUG() << "Helper is alive, connecting again later";
+    retryConnect();
+    return;
+  }
+
+  launch();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void HelperLauncher::socketDisconnect()
 {
   QLOG_DEBUG() << "Disconnected from helper, trying to relaunch";
+  m_connectRetries = 0;
   connectToHelper();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-void HelperLauncher::updateClientId()
+QVariantMap HelperLauncher::infoCommand()
 {
-  if (!helperEnabled())
-    return;
+  // no info without a clientId
+  QString clientId = SettingsComponent::Get().value(SETTINGS_SECTION_WEBCLIENT, "clientID").toString();
+  if (clientId.isEmpty())
+    return QVariantMap();
 
-  // update clientId if we have it
-  if (!SettingsComponent::Get().value(SETTINGS_SECTION_WEBCLIENT, "clientID").toString().isEmpty())
-  {
-    QVariantMap msg;
-    msg.insert("command", "info");
+  QVariantMap msg;
+  msg.insert("command", "info");
+
+  QVariantMap arg;
+  arg.insert("clientId", clientId);
 
-    QVariantMap arg;
-    arg.insert("clientId", SettingsComponent::Get().value(SETTINGS_SECTION_WEBCLIENT, "clientID").toString());
+  QString userId = Utils::CurrentUserId();
+  if (!userId.isEmpty())
+    arg.insert("userId", userId);
 
-    QString userId = Utils::CurrentUserId();
-    if (!userId.isEmpty())
-      arg.insert("userId", userId);
+  msg.insert("argument", arg);
+  return msg;
+}
 
-    msg.insert("argument", arg);
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperLauncher::updateClientId()
+{
+  if (!helperEnabled())
+    return;
 
+  QVariantMap msg = infoCommand();
+  if (!msg.isEmpty())
     m_jsonClient->sendMessage(msg);
-  }
-};
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////
 bool HelperLauncher::helperEnabled()
@@ -146,7 +183,24 @@ bool HelperLauncher::helperEnabled()
 void HelperLauncher::didConnect()
 {
   QLOG_DEBUG() << "Connected to helper";
-  updateClientId();
+  m_connectRetries = 0;
+
+  HelperStatus& status = HelperStatus::Get();
+  if (status.crashQueueDepth() > 0 || !status.lastError().isEmpty())
+    QLOG_DEBUG() << "Helper has" << status.crashQueueDepth() << "crash dumps queued, last error:" << status.lastError();
+
+  // everything the helper needs to know about us, in one message
+  QVariantMap hello;
+  hello.insert("command", "hello");
+  hello.insert("argument", QVariantMap {{ "version", Version::GetVersionString() },
+                                        { "pid", QCoreApplication::applicationPid() }});
+
+  QVariantList commands { hello };
+  QVariantMap info = infoCommand();
+  if (!info.isEmpty())
+    commands << info;
+
+  m_jsonClient->sendMessage({{ "command", HELPER_COMMAND_BATCH }, { "commands", commands }});
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -167,7 +221,21 @@ void HelperLauncher::launch()
   }
 #endif
 
-  QTimer::singleShot(1000, this, &HelperLauncher::connectToHelper);
+  retryConnect();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void HelperLauncher::retryConnect()
+{
+  if (m_connectRetries >= HELPER_CONNECT_MAX_RETRIES)
+  {
+    QLOG_WARN() << "Could not connect to the helper after" << m_connectRetries << "attempts, giving up";
+    return;
+  }
+
+  int delay = qMin(HELPER_CONNECT_RETRY_MSEC << m_connectRetries, HELPER_CONNECT_RETRY_MAX_MSEC);
+  m_connectRetries++;
+  QTimer::singleShot(delay, this, &HelperLauncher::connectToHelper);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -195,5 +263,7 @@ void HelperLauncher::stop()
 {
   // this method needs to disconnect all signals from the helper as well, so it doesn't start up again.
   m_jsonClient->disconnect();
+  m_heartbeatTimer->stop();
+  HelperStatus::Get().mainExited();
   killHelper();
 }
@@ -9,6 +9,7 @@
 #include <QObject>
 #include <QProcess>
 #include <QJsonObject>
+#include <QTimer>
 
 #include "LocalJsonClient.h"
 #include "tools/helper/HelperSocket.h"
@@ -42,9 +43,17 @@ private:
 
   QProcess* m_helperProcess;
   LocalJsonClient* m_jsonClient;
+  // keeps the heartbeat in the HelperStatus going
+  QTimer* m_heartbeatTimer;
 
+  // the "info" command for the helper, empty while we don't have a clientId
+  QVariantMap infoCommand();
   void updateClientId();
   bool helperEnabled();
+  // connects again after a delay that grows with every attempt, until there were too many
+  void retryConnect();
+  // failed attempts since the last connect or disconnect
+  int m_connectRetries;
 
 #ifdef Q_OS_MAC
   HelperLaunchd* m_launchd;
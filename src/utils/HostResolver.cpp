@@ -0,0 +1,203 @@
+#include "HostResolver.h"
+
+#include "QsLog.h"
+#include "utils/NetworkState.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HostResolver::HostResolver() : QObject(nullptr)
+{
+  connect(&NetworkState::Get(), &NetworkState::addressesChanged, this, &HostResolver::clear);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostResolver::prepare(const QString& host, quint16 port)
+{
+  // nothing to resolve, and nothing to choose from
+  if (host.isEmpty() || !QHostAddress(host).isNull())
+    return;
+
+  QString entryKey = key(host, port);
+  {
+    QMutexLocker lock(&m_lock);
+    Entry& entry = m_entries[entryKey];
+    if (entry.racing)
+      return;
+
+    if (entry.age.isValid())
+    {
+      qint64 ttl = entry.address.isNull() ? HOST_RESOLVER_FAILED_TTL_MSEC : HOST_RESOLVER_TTL_MSEC;
+      if (entry.age.elapsed() < ttl)
+        return;
+    }
+
+    entry.racing = true;
+  }
+
+  auto race = new HostRace(host, port, this);
+  m_races.insert(entryKey, race);
+  race->start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QHostAddress HostResolver::fastestAddress(const QString& host, quint16 port)
+{
+  QMutexLocker lock(&m_lock);
+  auto it = m_entries.constFind(key(host, port));
+  if (it == m_entries.constEnd() || !it->age.isValid() || it->age.elapsed() >= HOST_RESOLVER_TTL_MSEC)
+    return QHostAddress();
+  return it->address;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostResolver::finishRace(const QString& host, quint16 port, const QHostAddress& address)
+{
+  QString entryKey = key(host, port);
+  m_races.remove(entryKey);
+
+  {
+    QMutexLocker lock(&m_lock);
+    Entry& entry = m_entries[entryKey];
+    entry.address = address;
+    entry.age.start();
+    entry.racing = false;
+  }
+
+  if (address.isNull())
+    QLOG_DEBUG() << "Could not connect to any address of" << host << "port" << port;
+  else
+    QLOG_DEBUG() << "Fastest address of" << host << "port" << port << "is" << address.toString();
+
+  emit raceFinished(host, port, address);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostResolver::clear()
+{
+  // the races that are running would report an address from before the change
+  for (HostRace* race : m_races)
+    delete race;
+  m_races.clear();
+
+  QMutexLocker lock(&m_lock);
+  m_entries.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HostRace::HostRace(const QString& host, quint16 port, QObject* parent) : QObject(parent),
+  m_host(host), m_port(port), m_lookupId(-1), m_staggerTimer(this), m_timeout(this), m_finished(false)
+{
+  m_staggerTimer.setSingleShot(true);
+  m_staggerTimer.setInterval(HOST_RESOLVER_STAGGER_MSEC);
+  connect(&m_staggerTimer, &QTimer::timeout, this, &HostRace::startNextAttempt);
+
+  m_timeout.setSingleShot(true);
+  m_timeout.setInterval(HOST_RESOLVER_RACE_TIMEOUT_MSEC);
+  connect(&m_timeout, &QTimer::timeout, [=]() { finish(QHostAddress()); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HostRace::~HostRace()
+{
+  if (m_lookupId >= 0)
+    QHostInfo::abortHostLookup(m_lookupId);
+  qDeleteAll(m_attempts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostRace::start()
+{
+  m_timeout.start();
+  m_lookupId = QHostInfo::lookupHost(m_host, this, SLOT(lookedUp(QHostInfo)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostRace::lookedUp(const QHostInfo& info)
+{
+  m_lookupId = -1;
+
+  // Alternate between the address families, starting with the one the resolver likes
+  // best, which is the one of the first address.
+  QList<QHostAddress> primary, secondary;
+  for (const QHostAddress& address : info.addresses())
+  {
+    // the scope doesn't survive being put into a URL
+    if (!address.scopeId().isEmpty())
+      continue;
+
+    if (primary.isEmpty() || address.protocol() == primary.first().protocol())
+      primary << address;
+    else
+      secondary << address;
+  }
+
+  while (!primary.isEmpty() || !secondary.isEmpty())
+  {
+    if (!primary.isEmpty())
+      m_candidates << primary.takeFirst();
+    if (!secondary.isEmpty())
+      m_candidates << secondary.takeFirst();
+  }
+
+  if (m_candidates.isEmpty())
+  {
+    finish(QHostAddress());
+    return;
+  }
+
+  startNextAttempt();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostRace::startNextAttempt()
+{
+  if (m_finished || m_candidates.isEmpty())
+    return;
+
+  QHostAddress address = m_candidates.takeFirst();
+  auto socket = new QTcpSocket(this);
+  m_attempts << socket;
+
+  connect(socket, &QTcpSocket::connected, [=]() { finish(address); });
+  connect(socket, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+          [=](QAbstractSocket::SocketError) { attemptFailed(socket); });
+
+  socket->connectToHost(address, m_port);
+  m_staggerTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostRace::attemptFailed(QTcpSocket* socket)
+{
+  if (m_finished)
+    return;
+
+  m_attempts.removeOne(socket);
+  socket->deleteLater();
+
+  if (!m_candidates.isEmpty())
+    startNextAttempt();
+  else if (m_attempts.isEmpty())
+    finish(QHostAddress());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void HostRace::finish(const QHostAddress& address)
+{
+  if (m_finished)
+    return;
+
+  m_finished = true;
+  m_staggerTimer.stop();
+  m_timeout.stop();
+
+  for (QTcpSocket* socket : m_attempts)
+  {
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+  }
+  m_attempts.clear();
+
+  HostResolver::Get().finishRace(m_host, m_port, address);
+  deleteLater();
+}
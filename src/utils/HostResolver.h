@@ -0,0 +1,103 @@
+#ifndef HOSTRESOLVER_H
+#define HOSTRESOLVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QHostAddress>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHostInfo>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "utils/Utils.h"
+
+// the next address is tried if the previous one didn't connect within this time (RFC 8305)
+#define HOST_RESOLVER_STAGGER_MSEC 250
+// a race where nothing connected within this time failed
+#define HOST_RESOLVER_RACE_TIMEOUT_MSEC 5000
+// how long a winner is used before racing again
+#define HOST_RESOLVER_TTL_MSEC (5 * 60 * 1000)
+// failures are forgotten sooner, the server might just have been restarting
+#define HOST_RESOLVER_FAILED_TTL_MSEC (30 * 1000)
+
+class HostRace;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Resolves server host names and races TCP connections to all of their addresses, happy
+// eyeballs style: the address families take turns and the next attempt starts when the
+// previous one failed or took longer than HOST_RESOLVER_STAGGER_MSEC. The address that
+// connected first is kept for HOST_RESOLVER_TTL_MSEC, so opening a stream doesn't have to
+// resolve the name and wait for an address that doesn't work first. Everything is forgotten
+// when the network changes.
+//
+class HostResolver : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(HostResolver);
+
+public:
+  // Starts a race in the background, unless one is running or a result is still fresh.
+  // Has to be called from the main thread.
+  void prepare(const QString& host, quint16 port);
+
+  // The address that connected first, or a null address if that is not known (yet).
+  // Can be called from any thread.
+  QHostAddress fastestAddress(const QString& host, quint16 port);
+
+Q_SIGNALS:
+  void raceFinished(const QString& host, quint16 port, const QHostAddress& address);
+
+private:
+  HostResolver();
+
+  struct Entry
+  {
+    QHostAddress address;
+    QElapsedTimer age;
+    bool racing = false;
+  };
+
+  static QString key(const QString& host, quint16 port) { return host.toLower() + ":" + QString::number(port); }
+  void finishRace(const QString& host, quint16 port, const QHostAddress& address);
+  void clear();
+
+  QMutex m_lock;
+  QHash<QString, Entry> m_entries;
+  // races still running, so a network change can stop them
+  QHash<QString, HostRace*> m_races;
+
+  friend class HostRace;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One lookup and connection race of HostResolver, on the main thread.
+class HostRace : public QObject
+{
+  Q_OBJECT
+
+public:
+  HostRace(const QString& host, quint16 port, QObject* parent);
+  ~HostRace() override;
+
+  void start();
+
+private Q_SLOTS:
+  void lookedUp(const QHostInfo& info);
+
+private:
+  void startNextAttempt();
+  void attemptFailed(QTcpSocket* socket);
+  void finish(const QHostAddress& address);
+
+  QString m_host;
+  quint16 m_port;
+  int m_lookupId;
+  QList<QHostAddress> m_candidates;
+  QList<QTcpSocket*> m_attempts;
+  QTimer m_staggerTimer;
+  QTimer m_timeout;
+  bool m_finished;
+};
+
+#endif // HOSTRESOLVER_H
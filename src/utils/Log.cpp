@@ -11,14 +11,20 @@
 #include "shared/Names.h"
 #include "shared/Paths.h"
 #include "settings/SettingsComponent.h"
+#include "settings/SettingsKey.h"
 #include "Version.h"
+#include "AsyncLogDestination.h"
+#include "LogArchive.h"
 
 using namespace QsLogging;
 
 /////////////////////////////////////////////////////////////////////////////////////////
 static void qtMessageOutput(QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
-    QByteArray localMsg = msg.toLocal8Bit();
+    // Qt's debug output is chatty, don't format anything that would be dropped anyway
+    if (type == QtDebugMsg && Logger::instance().loggingLevel() > DebugLevel)
+      return;
+
     QString prefix;
     if (context.line)
       prefix = QString("%1:%2:%3: ").arg(context.file).arg(context.line).arg(context.function);
@@ -44,28 +50,55 @@ static void qtMessageOutput(QtMsgType type, const QMessageLogContext& context, c
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-static void elidePattern(QString& msg, const QString& substring, int chars)
+// Number of characters after a token key that get replaced.
+#define CENSOR_CHARS 20
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static inline bool precededBy(const QString& msg, int pos, const QLatin1String& key)
 {
-  int start = 0;
-  while (true)
-  {
-    start = msg.indexOf(substring, start);
-    if (start < 0 || start + substring.length() + chars > msg.length())
-      break;
-    start += substring.length();
-    for (int n = 0; n < chars; n++)
-      msg[start + n] = QChar('x');
-  }
+  return pos >= key.size() && msg.midRef(pos - key.size(), key.size()) == key;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static inline void elideAt(QString& msg, int start)
+{
+  // like before, a token that is cut off by the end of the line is left alone
+  if (start + CENSOR_CHARS > msg.length())
+    return;
+
+  for (int n = 0; n < CENSOR_CHARS; n++)
+    msg[start + n] = QChar('x');
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void Log::CensorAuthTokens(QString& msg)
 {
-  elidePattern(msg, "X-Plex-Token=", 20);
-  elidePattern(msg, "X-Plex-Token%3D", 20);
-  elidePattern(msg, "auth_token=", 20);
-  elidePattern(msg, "authenticationToken=\"", 20);
-  elidePattern(msg, "token=", 20);
+  // Every key we censor ends in '=' (or its URL encoded form), so scan the
+  // line once for those and only then look at what precedes them. The keys are:
+  //   X-Plex-Token=, X-Plex-Token%3D, auth_token=, authenticationToken=" and token=
+  // where auth_token= is already covered by token=.
+  static const QLatin1String plexToken("X-Plex-Token");
+  static const QLatin1String token("token");
+  static const QLatin1String authenticationToken("authenticationToken");
+
+  const int length = msg.length();
+  for (int i = 0; i < length; i++)
+  {
+    QChar c = msg.at(i);
+
+    if (c == QLatin1Char('='))
+    {
+      if (precededBy(msg, i, plexToken) || precededBy(msg, i, token))
+        elideAt(msg, i + 1);
+      else if (precededBy(msg, i, authenticationToken) && i + 1 < length && msg.at(i + 1) == QLatin1Char('"'))
+        elideAt(msg, i + 2);
+    }
+    else if (c == QLatin1Char('%') && msg.midRef(i + 1, 2) == QLatin1String("3D"))
+    {
+      if (precededBy(msg, i, plexToken))
+        elideAt(msg, i + 3);
+    }
+  }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -85,7 +118,9 @@ static QsLogging::Level logLevelFromString(const QString& str)
 /////////////////////////////////////////////////////////////////////////////////////////
 void Log::UpdateLogLevel()
 {
-  QString level = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "logLevel").toString();
+  static SettingsKey<QString> logLevel(SETTINGS_SECTION_MAIN, "logLevel");
+
+  const QString& level = logLevel.value();
   if (level.size())
   {
     QLOG_INFO() << "Setting log level to:" << level;
@@ -99,14 +134,16 @@ void Log::Init()
   // Note where the logfile is going to be
   qDebug("Logging to %s", qPrintable(Paths::logDir(Names::MainName() + ".log")));
 
-  // init logging.
-  DestinationPtr dest = DestinationFactory::MakeFileDestination(
-    Paths::logDir(Names::MainName() + ".log"),
-    EnableLogRotationOnOpen,
-    MaxSizeBytes(1024 * 1024),
-    MaxOldLogCount(9));
+  // init logging. the file is written from a separate thread, so that a slow
+  // disk doesn't stall whoever is logging (render thread, libcec callbacks...)
+  // the segments it rotates away are compressed, see LogArchive
+  RotationStrategyPtr rotation(new LogArchive(LOG_SEGMENT_SIZE, LOG_ARCHIVE_BUDGET_BYTES, LOG_ARCHIVE_MAX_SEGMENTS));
+  FileDestination* file = new FileDestination(Paths::logDir(Names::MainName() + ".log"), rotation);
+  if (rotation->currentSizeInBytes() > 0)
+    file->rotate();
+  DestinationPtr dest(file);
 
-  Logger::instance().addDestination(dest);
+  Logger::instance().addDestination(DestinationPtr(new AsyncLogDestination(dest)));
   Logger::instance().setLoggingLevel(DebugLevel);
   Logger::instance().setProcessingCallback(Log::CensorAuthTokens);
 
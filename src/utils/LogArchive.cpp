@@ -0,0 +1,251 @@
+#include "LogArchive.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+
+#include <iostream>
+
+#ifdef HAVE_MINIZIP
+#include <zlib.h>
+#include <minizip/zip.h>
+#endif
+
+#include "shared/Names.h"
+#include "shared/Paths.h"
+
+// read and written in pieces this big
+#define LOG_ARCHIVE_CHUNK_SIZE (64 * 1024)
+
+// This runs below the logger, so problems go to stderr like they do in QsLog.
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool compressSegment(const QString& path)
+{
+#ifdef HAVE_MINIZIP
+  QFile source(path);
+  if (!source.open(QIODevice::ReadOnly))
+    return false;
+
+  // written next to it and renamed, so a cut off one is never taken for a segment
+  QString target = path + ".gz";
+  QString partial = target + ".part";
+  gzFile out = gzopen(QFile::encodeName(partial).constData(), "wb6");
+  if (!out)
+  {
+    std::cerr << "LogArchive: could not create " << qPrintable(partial) << std::endl;
+    return false;
+  }
+
+  bool success = true;
+  while (success && !source.atEnd())
+  {
+    QByteArray data = source.read(LOG_ARCHIVE_CHUNK_SIZE);
+    success = !data.isEmpty() && gzwrite(out, data.constData(), (unsigned)data.size()) == data.size();
+  }
+  success = gzclose(out) == Z_OK && success;
+  source.close();
+
+  QFile::remove(target);
+  if (!success || !QFile::rename(partial, target))
+  {
+    std::cerr << "LogArchive: could not compress " << qPrintable(path) << std::endl;
+    QFile::remove(partial);
+    return false;
+  }
+
+  QFile::remove(path);
+  return true;
+#else
+  Q_UNUSED(path);
+  return false;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class SegmentCompressor : public QRunnable
+{
+public:
+  explicit SegmentCompressor(const QString& path) : m_path(path) {}
+  void run() override { compressSegment(m_path); }
+
+private:
+  QString m_path;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+LogArchive::LogArchive(qint64 segmentSize, qint64 budgetBytes, int maxSegments)
+  : m_currentSize(0), m_segmentSize(segmentSize), m_budget(budgetBytes), m_maxSegments(maxSegments)
+{
+  m_compressor.setMaxThreadCount(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+LogArchive::~LogArchive()
+{
+  // a segment that is half done is left plain, the next start shifts it like any other
+  m_compressor.waitForDone();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void LogArchive::setInitialInfo(const QFile& file)
+{
+  m_fileName = file.fileName();
+  m_currentSize = file.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void LogArchive::includeMessageInCalculation(const QString& message)
+{
+  // Almost all of it is ASCII, so characters are close enough to bytes and this
+  // doesn't have to encode every message a second time.
+  m_currentSize += message.size() + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString LogArchive::segmentPath(const QString& logPath, int index)
+{
+  QString plain = QString("%1.%2").arg(logPath).arg(index);
+  if (QFile::exists(plain + ".gz"))
+    return plain + ".gz";
+  if (QFile::exists(plain))
+    return plain;
+  return QString();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void LogArchive::rotate()
+{
+  // the newest segment has to be finished before it can move
+  m_compressor.waitForDone();
+
+  // Newest first, keep what fits into the budget next to the segment this rotates away,
+  // and remove the rest.
+  QStringList kept;
+  qint64 total = m_currentSize;
+  for (int index = 1; ; index++)
+  {
+    QString segment = segmentPath(m_fileName, index);
+    if (segment.isEmpty())
+      break;
+
+    total += QFileInfo(segment).size();
+    if (kept.size() + 1 < m_maxSegments && total <= m_budget)
+    {
+      kept.append(segment);
+      continue;
+    }
+
+    if (!QFile::remove(segment))
+      std::cerr << "LogArchive: could not remove " << qPrintable(segment) << std::endl;
+  }
+
+  // shift up, oldest first so nothing is overwritten
+  for (int index = kept.size(); index >= 1; index--)
+  {
+    const QString& segment = kept[index - 1];
+    QString suffix = segment.endsWith(".gz") ? ".gz" : "";
+    QString newName = QString("%1.%2%3").arg(m_fileName).arg(index + 1).arg(suffix);
+    if (!QFile::rename(segment, newName))
+      std::cerr << "LogArchive: could not rename " << qPrintable(segment) << " to " << qPrintable(newName) << std::endl;
+  }
+
+  QString newest = m_fileName + ".1";
+  if (!QFile::rename(m_fileName, newest))
+  {
+    std::cerr << "LogArchive: could not rename log " << qPrintable(m_fileName) << std::endl;
+    return;
+  }
+
+  m_compressor.start(new SegmentCompressor(newest));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList LogArchive::Segments(const QString& logPath)
+{
+  QStringList segments;
+  if (QFile::exists(logPath))
+    segments.append(logPath);
+
+  for (int index = 1; ; index++)
+  {
+    QString segment = segmentPath(logPath, index);
+    if (segment.isEmpty())
+      break;
+    segments.append(segment);
+  }
+
+  return segments;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool LogArchive::ExportBundle(const QString& targetPath)
+{
+#ifdef HAVE_MINIZIP
+  QStringList files = Segments(Paths::logDir(Names::MainName() + ".log"));
+  files += Segments(Paths::logDir("pmphelper.log"));
+  for (const QString& name : { "sessions.jsonl", "mpv-failure.log", "startup-trace.json" })
+  {
+    if (QFile::exists(Paths::logDir(name)))
+      files.append(Paths::logDir(name));
+  }
+
+  QString partial = targetPath + ".part";
+  zipFile zip = zipOpen(QFile::encodeName(partial).constData(), APPEND_STATUS_CREATE);
+  if (!zip)
+  {
+    std::cerr << "LogArchive: could not create " << qPrintable(partial) << std::endl;
+    return false;
+  }
+
+  bool success = true;
+  for (const QString& path : files)
+  {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+      continue;
+
+    QFileInfo info(path);
+    QDateTime modified = info.lastModified();
+    zip_fileinfo zipInfo = {};
+    zipInfo.tmz_date.tm_sec = (uInt)modified.time().second();
+    zipInfo.tmz_date.tm_min = (uInt)modified.time().minute();
+    zipInfo.tmz_date.tm_hour = (uInt)modified.time().hour();
+    zipInfo.tmz_date.tm_mday = (uInt)modified.date().day();
+    zipInfo.tmz_date.tm_mon = (uInt)modified.date().month() - 1;
+    zipInfo.tmz_date.tm_year = (uInt)modified.date().year();
+
+    // deflating them again wouldn't gain anything
+    bool compressed = path.endsWith(".gz");
+    if (zipOpenNewFileInZip(zip, info.fileName().toUtf8().constData(), &zipInfo, nullptr, 0, nullptr, 0, nullptr,
+                            compressed ? 0 : Z_DEFLATED, compressed ? 0 : Z_DEFAULT_COMPRESSION) != ZIP_OK)
+    {
+      success = false;
+      break;
+    }
+
+    while (success && !file.atEnd())
+    {
+      QByteArray data = file.read(LOG_ARCHIVE_CHUNK_SIZE);
+      success = !data.isEmpty() && zipWriteInFileInZip(zip, data.constData(), (unsigned)data.size()) == ZIP_OK;
+    }
+    success = zipCloseFileInZip(zip) == ZIP_OK && success;
+    if (!success)
+      break;
+  }
+  success = zipClose(zip, nullptr) == ZIP_OK && success;
+
+  QFile::remove(targetPath);
+  if (!success || !QFile::rename(partial, targetPath))
+  {
+    std::cerr << "LogArchive: could not write " << qPrintable(targetPath) << std::endl;
+    QFile::remove(partial);
+    return false;
+  }
+  return true;
+#else
+  Q_UNUSED(targetPath);
+  return false;
+#endif
+}
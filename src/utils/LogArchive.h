@@ -0,0 +1,54 @@
+#ifndef PLEXMEDIAPLAYER_LOGARCHIVE_H
+#define PLEXMEDIAPLAYER_LOGARCHIVE_H
+
+#include <QStringList>
+#include <QThreadPool>
+
+#include "QsLogDestFile.h"
+
+// the log is rotated once it's this big
+#define LOG_SEGMENT_SIZE (1024 * 1024)
+// rotated segments are kept until they add up to this, as much as the nine plain
+// ones took before. Compressed, that's a lot more of them.
+#define LOG_ARCHIVE_BUDGET_BYTES (9 * 1024 * 1024)
+// and never more than this many
+#define LOG_ARCHIVE_MAX_SEGMENTS 99
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Rotation strategy for the log file that gzips the segments it rotates away, <log>.1.gz
+// being the newest. The compression runs on a thread of its own, so the log writer only
+// renames files. Segments are dropped, oldest first, once they go over the byte budget.
+// Plain segments (from older versions, builds without zlib, or a compression that was cut
+// short) are shifted and counted the same way.
+class LogArchive : public QsLogging::RotationStrategy
+{
+public:
+  LogArchive(qint64 segmentSize, qint64 budgetBytes, int maxSegments);
+  ~LogArchive() override;
+
+  void setInitialInfo(const QFile& file) override;
+  void includeMessageInCalculation(const QString& message) override;
+  bool shouldRotate() override { return m_currentSize > m_segmentSize; }
+  void rotate() override;
+  QIODevice::OpenMode recommendedOpenModeFlag() override { return QIODevice::Append; }
+  qint64 currentSizeInBytes() override { return m_currentSize; }
+
+  // The log and its rotated segments, newest first.
+  static QStringList Segments(const QString& logPath);
+
+  // Writes the logs, their segments and the session records to a zip for support. The
+  // segments go in as they are, the rest is deflated.
+  static bool ExportBundle(const QString& targetPath);
+
+private:
+  static QString segmentPath(const QString& logPath, int index);
+
+  QString m_fileName;
+  qint64 m_currentSize;
+  qint64 m_segmentSize;
+  qint64 m_budget;
+  int m_maxSegments;
+  QThreadPool m_compressor;
+};
+
+#endif //PLEXMEDIAPLAYER_LOGARCHIVE_H
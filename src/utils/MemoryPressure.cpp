@@ -0,0 +1,134 @@
+#include "MemoryPressure.h"
+
+#include <QFile>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "QsLog.h"
+#include "player/CachePolicy.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryPressure::MemoryPressure() : QObject(nullptr), m_timer(this), m_total(0), m_level(Normal)
+{
+  m_timer.setInterval(MEMORY_PRESSURE_CHECK_MSEC);
+  m_timer.setTimerType(Qt::CoarseTimer);
+  connect(&m_timer, &QTimer::timeout, this, &MemoryPressure::check);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MemoryPressure::start()
+{
+  m_total = CachePolicy::physicalMemory();
+  if (m_total <= 0 || availableMemory() < 0)
+  {
+    QLOG_INFO() << "Can't tell how much memory is available, not watching it";
+    return;
+  }
+
+  m_timer.start();
+  check();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+double MemoryPressure::share(Level level)
+{
+  switch (level)
+  {
+    case Low:
+      return MEMORY_PRESSURE_LOW_SHARE;
+    case Critical:
+      return MEMORY_PRESSURE_CRITICAL_SHARE;
+    default:
+      return 1;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 MemoryPressure::availableMemory()
+{
+#if defined(Q_OS_WIN)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status))
+    return (qint64)status.ullAvailPhys;
+  return -1;
+#elif defined(Q_OS_MAC)
+  vm_statistics64_data_t stats;
+  mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+  if (host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&stats, &count) != KERN_SUCCESS)
+    return -1;
+  // inactive pages are given up without swapping, like the page cache on Linux
+  return ((qint64)stats.free_count + stats.inactive_count) * vm_page_size;
+#else
+  QFile file("/proc/meminfo");
+  if (!file.open(QIODevice::ReadOnly))
+    return -1;
+
+  // Kernels before 3.14 don't have MemAvailable, free memory and the page cache come close.
+  qint64 available = -1, fallback = 0;
+  for (const QByteArray& line : file.readAll().split('\n'))
+  {
+    QList<QByteArray> fields = line.simplified().split(' ');
+    if (fields.size() < 2)
+      continue;
+
+    qint64 kb = fields.at(1).toLongLong();
+    if (fields.at(0) == "MemAvailable:")
+      available = kb * 1024;
+    else if (fields.at(0) == "MemFree:" || fields.at(0) == "Buffers:" || fields.at(0) == "Cached:")
+      fallback += kb * 1024;
+  }
+  return available >= 0 ? available : (fallback > 0 ? fallback : -1);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MemoryPressure::check()
+{
+  qint64 available = availableMemory();
+  if (available < 0)
+    return;
+
+  double percent = available * 100.0 / m_total;
+
+  // memory doesn't run out within a few seconds while there's this much
+  int interval = percent >= 2 * MEMORY_PRESSURE_LOW_PERCENT ? MEMORY_PRESSURE_RELAXED_CHECK_MSEC : MEMORY_PRESSURE_CHECK_MSEC;
+  if (m_timer.interval() != interval)
+    m_timer.setInterval(interval);
+
+  // going up right away, down only with some room to spare
+  Level level = m_level;
+  if (percent < MEMORY_PRESSURE_CRITICAL_PERCENT)
+    level = Critical;
+  else if (percent < MEMORY_PRESSURE_LOW_PERCENT)
+    level = (m_level == Critical && percent < MEMORY_PRESSURE_CRITICAL_PERCENT + MEMORY_PRESSURE_HYSTERESIS_PERCENT) ? Critical : Low;
+  else if (percent >= MEMORY_PRESSURE_LOW_PERCENT + MEMORY_PRESSURE_HYSTERESIS_PERCENT)
+    level = Normal;
+  else if (m_level == Critical)
+    level = Low;
+
+  if (level == m_level)
+    return;
+
+  if (level > m_level)
+    QLOG_WARN() << "Memory is" << (level == Critical ? "critical" : "low") << "-" << available / (1024 * 1024) << "MB available";
+  else
+    QLOG_INFO() << "Memory is" << (level == Normal ? "fine" : "low") << "again -" << available / (1024 * 1024) << "MB available";
+
+  m_level = level;
+  emit levelChanged(level);
+
+#if defined(__GLIBC__)
+  // what the others just freed would otherwise stay with the process
+  if (level != Normal)
+    malloc_trim(0);
+#endif
+}
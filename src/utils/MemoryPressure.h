@@ -0,0 +1,66 @@
+#ifndef MEMORYPRESSURE_H
+#define MEMORYPRESSURE_H
+
+#include <QObject>
+#include <QTimer>
+
+#include "utils/Utils.h"
+
+// how often the available memory is looked at, and how often while there's more than
+// twice the low share of it
+#define MEMORY_PRESSURE_CHECK_MSEC 2000
+#define MEMORY_PRESSURE_RELAXED_CHECK_MSEC 10000
+// share of the physical memory (in percent) still available below which memory is low, and
+// critical
+#define MEMORY_PRESSURE_LOW_PERCENT 15
+#define MEMORY_PRESSURE_CRITICAL_PERCENT 7
+// a level is only left again once this much more is available, so it doesn't flap
+#define MEMORY_PRESSURE_HYSTERESIS_PERCENT 3
+// what caches shrink to at each level, as a share of their usual size
+#define MEMORY_PRESSURE_LOW_SHARE 0.5
+#define MEMORY_PRESSURE_CRITICAL_SHARE 0.25
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Watches how much memory the system has left (MemAvailable on Linux) and tells whoever
+// connected to levelChanged() to shrink while it is low: the mpv cache, the decoded artwork
+// and the web client. The kernel OOM killer would otherwise end long sessions on 1GB boxes,
+// where QtWebEngine, the demuxer and the artwork all grow into the same RAM.
+//
+// Main thread only.
+//
+class MemoryPressure : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(MemoryPressure);
+
+public:
+  enum Level
+  {
+    Normal,
+    Low,
+    Critical
+  };
+  Q_ENUM(Level)
+
+  void start();
+  Level level() const { return m_level; }
+
+  // The share of their usual size caches should keep to at level.
+  static double share(Level level);
+
+  // Bytes the system can still hand out without swapping, -1 if we can't tell.
+  static qint64 availableMemory();
+
+Q_SIGNALS:
+  void levelChanged(MemoryPressure::Level level);
+
+private:
+  MemoryPressure();
+  void check();
+
+  QTimer m_timer;
+  qint64 m_total;
+  Level m_level;
+};
+
+#endif // MEMORYPRESSURE_H
@@ -0,0 +1,63 @@
+#include "NetworkService.h"
+
+#include <QNetworkDiskCache>
+
+#include "QsLog.h"
+#include "Paths.h"
+#include "BandwidthEstimator.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+NetworkService::NetworkService() : QObject(nullptr), m_manager(this)
+{
+  auto cache = new QNetworkDiskCache(&m_manager);
+  cache->setCacheDirectory(Paths::cacheDir("network"));
+  cache->setMaximumCacheSize(NETWORK_DISK_CACHE_SIZE);
+  m_manager.setCache(cache);
+
+  QLOG_DEBUG() << "Network cache in" << cache->cacheDirectory() << "using" << cache->cacheSize() << "bytes";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkService::prepareRequest(QNetworkRequest& request, RequestKind kind)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+  request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+
+  switch (kind)
+  {
+    case RemoteRequest:
+      request.setPriority(QNetworkRequest::HighPriority);
+      request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+      request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
+      break;
+    case MetadataRequest:
+      request.setPriority(QNetworkRequest::NormalPriority);
+      request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+      break;
+    case DownloadRequest:
+      // these are resumed with Range requests, a cached copy would only get in the way
+      request.setPriority(QNetworkRequest::LowPriority);
+      request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+      request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
+      break;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QNetworkReply* NetworkService::get(QNetworkRequest request, RequestKind kind)
+{
+  prepareRequest(request, kind);
+  QNetworkReply* reply = m_manager.get(request);
+  // the large ones are what the throughput can be measured with
+  if (kind == DownloadRequest)
+    BandwidthEstimator::Get().watch(reply);
+  return reply;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QNetworkReply* NetworkService::post(QNetworkRequest request, const QByteArray& data, RequestKind kind)
+{
+  prepareRequest(request, kind);
+  return m_manager.post(request, data);
+}
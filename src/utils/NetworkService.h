@@ -0,0 +1,56 @@
+#ifndef NETWORKSERVICE_H
+#define NETWORKSERVICE_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+
+#include "utils/Utils.h"
+
+// what the shared disk cache may grow to, it only holds small API replies
+#define NETWORK_DISK_CACHE_SIZE (16 * 1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The one QNetworkAccessManager of the main thread. Sharing it means sharing its connection
+// pool, so the remote, the updater and the codec downloads reuse each others connections (and
+// TLS sessions) to plex.tv instead of each doing their own handshakes. HTTP/2 is allowed where
+// Qt supports it, a server that speaks it gets all of these over a single connection.
+//
+// The manager queues requests per host by their priority, so a timeline a controller is
+// waiting for doesn't end up behind a codec download.
+//
+// QNetworkAccessManager belongs to the thread that created it, this one must only be used on
+// the main thread.
+//
+class NetworkService : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(NetworkService);
+
+public:
+  enum RequestKind
+  {
+    // someone is waiting for these, like the timelines remote controllers are sent
+    RemoteRequest,
+    // small API replies (update checks, codec information), cached as the server allows
+    MetadataRequest,
+    // large files (updates, codecs), never cached and only sent when nothing else waits
+    DownloadRequest
+  };
+
+  QNetworkAccessManager* manager() { return &m_manager; }
+
+  // Sets priority, HTTP/2 and caching for kind on request.
+  static void prepareRequest(QNetworkRequest& request, RequestKind kind);
+
+  QNetworkReply* get(QNetworkRequest request, RequestKind kind);
+  QNetworkReply* post(QNetworkRequest request, const QByteArray& data, RequestKind kind);
+
+private:
+  NetworkService();
+
+  QNetworkAccessManager m_manager;
+};
+
+#endif // NETWORKSERVICE_H
@@ -0,0 +1,342 @@
+#include "NetworkState.h"
+
+#include <QMutexLocker>
+
+#include "QsLog.h"
+
+#if defined(Q_OS_WIN)
+#include <QWinEventNotifier>
+#include <iphlpapi.h>
+#elif defined(Q_OS_MAC)
+#include <dispatch/dispatch.h>
+#elif defined(Q_OS_LINUX)
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+NetworkState::NetworkState() : QObject(nullptr), m_notifications(false), m_settleTimer(this)
+#if defined(Q_OS_WIN)
+  , m_changeHandle(nullptr), m_overlapped(), m_notifier(nullptr)
+#elif defined(Q_OS_MAC)
+  , m_store(nullptr)
+#elif defined(Q_OS_LINUX)
+  , m_socket(-1), m_notifier(nullptr)
+#endif
+{
+  m_settleTimer.setSingleShot(true);
+  m_settleTimer.setInterval(NETWORK_STATE_SETTLE_MSEC);
+  connect(&m_settleTimer, &QTimer::timeout, this, &NetworkState::refresh);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+NetworkState::~NetworkState()
+{
+  stopNotifications();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::start()
+{
+  m_notifications = startNotifications();
+  if (!m_notifications)
+    QLOG_INFO() << "No network change notifications, addresses are refreshed every"
+                << NETWORK_STATE_MAX_AGE_MSEC / 1000 << "seconds";
+
+  refresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::scheduleRefresh()
+{
+  m_settleTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::refresh()
+{
+  QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
+  QList<Entry> entries;
+
+  for (const QNetworkInterface& iface : interfaces)
+  {
+    if (!iface.isValid() || !(iface.flags() & QNetworkInterface::IsUp) ||
+        iface.flags() & QNetworkInterface::IsLoopBack)
+      continue;
+
+    for (const QNetworkAddressEntry& address : iface.addressEntries())
+    {
+      const QHostAddress& ip = address.ip();
+      if (ip.isLoopback() || ip.isMulticast())
+        continue;
+
+      if (ip.protocol() == QAbstractSocket::IPv4Protocol ||
+          (ip.protocol() == QAbstractSocket::IPv6Protocol && !ip.isInSubnet(QHostAddress("fe80::"), 10)))
+        entries.append({address, iface.name()});
+    }
+  }
+
+  bool changed;
+  {
+    QMutexLocker lock(&m_lock);
+    changed = m_age.isValid() && entries != m_entries;
+    m_interfaces = interfaces;
+    m_entries = entries;
+    m_age.start();
+  }
+
+  if (changed)
+  {
+    QLOG_DEBUG() << "Network addresses changed";
+    emit addressesChanged();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::refreshIfExpired()
+{
+  bool expired;
+  {
+    QMutexLocker lock(&m_lock);
+    expired = !m_age.isValid() || (!m_notifications && m_age.hasExpired(NETWORK_STATE_MAX_AGE_MSEC));
+  }
+
+  // Emitting from here would be on the caller's thread, that's fine with queued
+  // connections and receivers don't expect anything else.
+  if (expired)
+    refresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QList<QNetworkInterface> NetworkState::interfaces()
+{
+  refreshIfExpired();
+
+  QMutexLocker lock(&m_lock);
+  return m_interfaces;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QList<QHostAddress> NetworkState::addresses()
+{
+  refreshIfExpired();
+
+  QList<QHostAddress> list;
+  QMutexLocker lock(&m_lock);
+  for (const Entry& entry : m_entries)
+    list << entry.address.ip();
+  return list;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QHostAddress NetworkState::primaryIPv4Address()
+{
+  refreshIfExpired();
+
+  QMutexLocker lock(&m_lock);
+  for (const Entry& entry : m_entries)
+  {
+    if (entry.address.ip().protocol() == QAbstractSocket::IPv4Protocol)
+      return entry.address.ip();
+  }
+  return QHostAddress();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QHostAddress NetworkState::localAddressFor(const QHostAddress& remote)
+{
+  refreshIfExpired();
+
+  {
+    QMutexLocker lock(&m_lock);
+    for (const Entry& entry : m_entries)
+    {
+      const QNetworkAddressEntry& address = entry.address;
+      if (address.ip().protocol() == remote.protocol() && address.prefixLength() > 0 &&
+          remote.isInSubnet(address.ip(), address.prefixLength()))
+        return address.ip();
+    }
+  }
+
+  return primaryIPv4Address();
+}
+
+#if defined(Q_OS_WIN)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetworkState::startNotifications()
+{
+  m_overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!m_overlapped.hEvent)
+    return false;
+
+  // NotifyAddrChange only fires once, so it's armed again every time the event is set.
+  m_notifier = new QWinEventNotifier(m_overlapped.hEvent, this);
+  connect(m_notifier, &QWinEventNotifier::activated, this, [=]()
+  {
+    ResetEvent(m_overlapped.hEvent);
+    armNotification();
+    scheduleRefresh();
+  });
+
+  armNotification();
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::armNotification()
+{
+  DWORD result = NotifyAddrChange(&m_changeHandle, &m_overlapped);
+  if (result != ERROR_IO_PENDING)
+    QLOG_WARN() << "NotifyAddrChange failed:" << result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::stopNotifications()
+{
+  if (m_overlapped.hEvent)
+  {
+    CancelIPChangeNotify(&m_overlapped);
+    delete m_notifier;
+    m_notifier = nullptr;
+    CloseHandle(m_overlapped.hEvent);
+    m_overlapped.hEvent = nullptr;
+  }
+}
+
+#elif defined(Q_OS_MAC)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::onStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKeys, void* info)
+{
+  // Runs on the main dispatch queue, which is the main thread.
+  static_cast<NetworkState*>(info)->scheduleRefresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetworkState::startNotifications()
+{
+  SCDynamicStoreContext context = {0, this, nullptr, nullptr, nullptr};
+  m_store = SCDynamicStoreCreate(nullptr, CFSTR("PlexMediaPlayer"), onStoreChanged, &context);
+  if (!m_store)
+    return false;
+
+  // The per interface address keys, "State:/Network/Interface/en0/IPv4" and so on.
+  CFStringRef patterns[] = {
+    SCDynamicStoreKeyCreateNetworkInterfaceEntity(nullptr, kSCDynamicStoreDomainState, kSCCompAnyRegex, kSCEntNetIPv4),
+    SCDynamicStoreKeyCreateNetworkInterfaceEntity(nullptr, kSCDynamicStoreDomainState, kSCCompAnyRegex, kSCEntNetIPv6)
+  };
+  CFArrayRef patternList = CFArrayCreate(nullptr, (const void**)patterns, 2, &kCFTypeArrayCallBacks);
+
+  bool ok = SCDynamicStoreSetNotificationKeys(m_store, nullptr, patternList) &&
+            SCDynamicStoreSetDispatchQueue(m_store, dispatch_get_main_queue());
+
+  CFRelease(patternList);
+  CFRelease(patterns[0]);
+  CFRelease(patterns[1]);
+
+  if (!ok)
+  {
+    QLOG_WARN() << "Failed to register for network changes:" << SCErrorString(SCError());
+    CFRelease(m_store);
+    m_store = nullptr;
+  }
+
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::stopNotifications()
+{
+  if (m_store)
+  {
+    SCDynamicStoreSetDispatchQueue(m_store, nullptr);
+    CFRelease(m_store);
+    m_store = nullptr;
+  }
+}
+
+#elif defined(Q_OS_LINUX)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetworkState::startNotifications()
+{
+  m_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (m_socket < 0)
+  {
+    QLOG_WARN() << "Failed to open rtnetlink socket:" << strerror(errno);
+    return false;
+  }
+
+  struct sockaddr_nl address = {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+  if (bind(m_socket, (struct sockaddr*)&address, sizeof(address)) < 0)
+  {
+    QLOG_WARN() << "Failed to bind rtnetlink socket:" << strerror(errno);
+    close(m_socket);
+    m_socket = -1;
+    return false;
+  }
+
+  m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+  connect(m_notifier, &QSocketNotifier::activated, this, &NetworkState::readEvents);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::readEvents()
+{
+  // The messages only tell us that something changed, the addresses are read
+  // through QNetworkInterface like before.
+  char buffer[8192];
+  int size;
+  bool changed = false;
+
+  while ((size = (int)recv(m_socket, buffer, sizeof(buffer), 0)) > 0)
+  {
+    for (struct nlmsghdr* header = (struct nlmsghdr*)buffer; NLMSG_OK(header, size);
+         header = NLMSG_NEXT(header, size))
+    {
+      if (header->nlmsg_type == RTM_NEWADDR || header->nlmsg_type == RTM_DELADDR ||
+          header->nlmsg_type == RTM_NEWLINK || header->nlmsg_type == RTM_DELLINK)
+        changed = true;
+    }
+  }
+
+  if (changed)
+    scheduleRefresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::stopNotifications()
+{
+  delete m_notifier;
+  m_notifier = nullptr;
+  if (m_socket >= 0)
+  {
+    close(m_socket);
+    m_socket = -1;
+  }
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetworkState::startNotifications()
+{
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void NetworkState::stopNotifications()
+{
+}
+
+#endif
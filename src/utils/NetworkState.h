@@ -0,0 +1,106 @@
+#ifndef NETWORKSTATE_H
+#define NETWORKSTATE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QMutex>
+#include <QNetworkInterface>
+#include <QTimer>
+
+#include "utils/Utils.h"
+
+#if defined(Q_OS_WIN)
+#include <winsock2.h>
+#include <windows.h>
+class QWinEventNotifier;
+#elif defined(Q_OS_MAC)
+#include <SystemConfiguration/SystemConfiguration.h>
+#elif defined(Q_OS_LINUX)
+class QSocketNotifier;
+#endif
+
+// address changes come in bursts (DHCP, IPv6 autoconfiguration), wait for them to settle
+#define NETWORK_STATE_SETTLE_MSEC 500
+// without change notifications the cache is refreshed when it's older than this
+#define NETWORK_STATE_MAX_AGE_MSEC 30000
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Caches the network interfaces and their addresses, so the discovery replies and
+// the debug information don't walk every interface each time. The cache is refreshed
+// when the OS tells us about address changes: a rtnetlink socket on Linux, the
+// SystemConfiguration store on macOS and NotifyAddrChange on Windows. Elsewhere it
+// simply expires. The getters can be called from any thread.
+//
+class NetworkState : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(NetworkState);
+
+public:
+  ~NetworkState() override;
+
+  // Has to be called from the main thread.
+  void start();
+
+  QList<QNetworkInterface> interfaces();
+
+  // Addresses of the interfaces that are up, without loopback and link-local ones.
+  QList<QHostAddress> addresses();
+
+  QHostAddress primaryIPv4Address();
+
+  // The address of ours that is in the same subnet as remote, or the primary IPv4
+  // address if there's none. That's what we should tell remote to connect to.
+  QHostAddress localAddressFor(const QHostAddress& remote);
+
+Q_SIGNALS:
+  // The addresses changed, emitted from the main thread.
+  void addressesChanged();
+
+private:
+  NetworkState();
+
+  struct Entry
+  {
+    QNetworkAddressEntry address;
+    QString interface;
+
+    bool operator==(const Entry& other) const
+    {
+      return address == other.address && interface == other.interface;
+    }
+  };
+
+  void scheduleRefresh();
+  void refresh();
+  void refreshIfExpired();
+  bool startNotifications();
+  void stopNotifications();
+
+  QMutex m_lock;
+  QList<QNetworkInterface> m_interfaces;
+  QList<Entry> m_entries;
+  QElapsedTimer m_age;
+  bool m_notifications;
+  QTimer m_settleTimer;
+
+#if defined(Q_OS_WIN)
+  void armNotification();
+
+  HANDLE m_changeHandle;
+  OVERLAPPED m_overlapped;
+  QWinEventNotifier* m_notifier;
+#elif defined(Q_OS_MAC)
+  static void onStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKeys, void* info);
+
+  SCDynamicStoreRef m_store;
+#elif defined(Q_OS_LINUX)
+  void readEvents();
+
+  int m_socket;
+  QSocketNotifier* m_notifier;
+#endif
+};
+
+#endif // NETWORKSTATE_H
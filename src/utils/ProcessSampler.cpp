@@ -0,0 +1,342 @@
+#include "ProcessSampler.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+
+#include "QsLog.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#else
+#include <unistd.h>
+#include <malloc.h>
+#endif
+
+// thread groups shown in the overlay and log, the rest is summed up as "other"
+#define PROCESS_SAMPLE_TOP_THREADS 8
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProcessSampler::ProcessSampler() : QObject(nullptr), m_timer(this), m_lastSampleTime(0),
+  m_sampleCount(0), m_gpuKB(-1)
+{
+  m_timer.setInterval(PROCESS_SAMPLE_MSEC);
+  // the CPU numbers are per elapsed time, it doesn't matter when exactly a sample is taken
+  m_timer.setTimerType(Qt::VeryCoarseTimer);
+  connect(&m_timer, &QTimer::timeout, this, &ProcessSampler::sample);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProcessSampler::start()
+{
+  if (m_timer.isActive())
+    return;
+
+  m_clock.start();
+  m_timer.start();
+  // The first sample only provides the baseline for the CPU numbers.
+  sample();
+}
+
+#if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads /proc/<pid>/stat or /proc/<pid>/task/<tid>/stat. The name can contain
+// spaces and parentheses, so everything after the last ')' is split instead.
+static bool readProcStat(const QString& path, QString* name, QList<QByteArray>* fields)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QByteArray data = file.readAll();
+  int open = data.indexOf('(');
+  int close = data.lastIndexOf(')');
+  if (open < 0 || close < open)
+    return false;
+
+  *name = QString::fromUtf8(data.mid(open + 1, close - open - 1));
+  // fields[0] is the state, fields[1] the parent pid, fields[11]/[12] user and system time
+  *fields = data.mid(close + 2).split(' ');
+  return fields->size() > 12;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The children of pid from /proc/<pid>/task/<tid>/children (Linux 3.5, CONFIG_PROC_CHILDREN).
+// Without that file the helper processes just aren't sampled.
+static QList<qint64> childProcesses(qint64 pid)
+{
+  QList<qint64> children;
+  QString taskDir = QString("/proc/%1/task").arg(pid);
+  for (const QString& tid : QDir(taskDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    QFile file(taskDir + "/" + tid + "/children");
+    if (!file.open(QIODevice::ReadOnly))
+      continue;
+
+    for (const QByteArray& child : file.readAll().simplified().split(' '))
+    {
+      bool ok;
+      qint64 id = child.toLongLong(&ok);
+      if (ok)
+        children.append(id);
+    }
+  }
+  return children;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static qint64 readResidentKB(const QString& path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return 0;
+
+  QList<QByteArray> pages = file.readAll().split(' ');
+  if (pages.size() < 2)
+    return 0;
+
+  return pages[1].toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 ProcessSampler::currentResidentKB()
+{
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters = {};
+  if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.WorkingSetSize / 1024;
+#elif defined(Q_OS_MAC)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+    return 0;
+  return info.resident_size / 1024;
+#else
+  return readResidentKB("/proc/self/statm");
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProcessSampler::collectMemory(Sample& sample)
+{
+  sample.residentKB = currentResidentKB();
+  sample.heapKB = -1;
+  sample.childResidentKB = 0;
+
+#if defined(Q_OS_MAC)
+  malloc_statistics_t stats;
+  malloc_zone_statistics(nullptr, &stats);
+  sample.heapKB = stats.size_in_use / 1024;
+#elif defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2();
+#else
+  struct mallinfo info = mallinfo();
+#endif
+  sample.heapKB = ((qint64)info.uordblks + info.hblkhd) / 1024;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProcessSampler::collectThreads(QVector<ThreadTime>& threads)
+{
+#if defined(Q_OS_WIN)
+  // Listing the threads takes a snapshot of every thread on the system and they'd only be shown
+  // by id, so Windows gets the time of the whole process.
+  FILETIME creation, exit, kernel, user;
+  if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+  {
+    auto toUsec = [](const FILETIME& ft) { return (((qint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime) / 10; };
+    threads.append({ (qint64)GetCurrentProcessId(), "process", toUsec(kernel) + toUsec(user) });
+  }
+#elif defined(Q_OS_MAC)
+  thread_act_array_t list;
+  mach_msg_type_number_t listCount;
+  if (task_threads(mach_task_self(), &list, &listCount) != KERN_SUCCESS)
+    return;
+
+  for (mach_msg_type_number_t i = 0; i < listCount; i++)
+  {
+    thread_extended_info_data_t info;
+    mach_msg_type_number_t count = THREAD_EXTENDED_INFO_COUNT;
+    thread_identifier_info_data_t ident;
+    mach_msg_type_number_t identCount = THREAD_IDENTIFIER_INFO_COUNT;
+
+    if (thread_info(list[i], THREAD_EXTENDED_INFO, (thread_info_t)&info, &count) == KERN_SUCCESS &&
+        thread_info(list[i], THREAD_IDENTIFIER_INFO, (thread_info_t)&ident, &identCount) == KERN_SUCCESS)
+    {
+      QString name = QString::fromUtf8(info.pth_name);
+      if (name.isEmpty())
+        name = "unnamed";
+      threads.append({ (qint64)ident.thread_id, name,
+                       (qint64)((info.pth_user_time + info.pth_system_time) / 1000) });
+    }
+    mach_port_deallocate(mach_task_self(), list[i]);
+  }
+  vm_deallocate(mach_task_self(), (vm_address_t)list, listCount * sizeof(thread_act_t));
+#else
+  static const qint64 usecPerTick = 1000000 / sysconf(_SC_CLK_TCK);
+  qint64 pid = QCoreApplication::applicationPid();
+
+  QString name;
+  QList<QByteArray> fields;
+  for (const QString& tid : QDir("/proc/self/task").entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    if (!readProcStat("/proc/self/task/" + tid + "/stat", &name, &fields))
+      continue;
+
+    qint64 id = tid.toLongLong();
+    // The main thread carries the executable name, all Qt event handling happens on it.
+    if (id == pid)
+      name = "main";
+    threads.append({ id, name, (fields[11].toLongLong() + fields[12].toLongLong()) * usecPerTick });
+  }
+
+  // QtWebEngine starts its helper processes as children (and grandchildren). They are found
+  // through our own entries instead of going through every process in /proc.
+  QList<qint64> parents = { pid };
+  for (int depth = 0; depth < 4 && !parents.isEmpty(); depth++)
+  {
+    QList<qint64> children;
+    for (qint64 parent : parents)
+      children += childProcesses(parent);
+
+    for (qint64 child : children)
+    {
+      if (readProcStat(QString("/proc/%1/stat").arg(child), &name, &fields))
+        threads.append({ -child, "child " + name, (fields[11].toLongLong() + fields[12].toLongLong()) * usecPerTick });
+    }
+    parents = children;
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProcessSampler::sample()
+{
+  qint64 now = m_clock.elapsed();
+  qint64 elapsedUsec = (now - m_lastSampleTime) * 1000;
+  bool baseline = m_lastCpuUsec.isEmpty();
+
+  Sample current;
+  current.time = now;
+  current.gpuKB = m_gpuKB;
+  current.cpuPercent = 0;
+  collectMemory(current);
+
+  QVector<ThreadTime> threads;
+  collectThreads(threads);
+
+  QHash<qint64, qint64> cpuUsec;
+  QHash<QString, double> groups;
+  for (const ThreadTime& thread : threads)
+  {
+    cpuUsec[thread.id] = thread.cpuUsec;
+
+#if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
+    if (thread.id < 0)
+      current.childResidentKB += readResidentKB(QString("/proc/%1/statm").arg(-thread.id));
+#endif
+
+    if (baseline || elapsedUsec <= 0)
+      continue;
+
+    // Threads that are new since the last sample did all their work in between.
+    qint64 delta = thread.cpuUsec - m_lastCpuUsec.value(thread.id, 0);
+    if (delta <= 0)
+      continue;
+
+    double percent = delta * 100.0 / elapsedUsec;
+    groups[thread.name] += percent;
+    if (thread.id >= 0)
+      current.cpuPercent += percent;
+  }
+
+  m_lastCpuUsec = cpuUsec;
+  m_lastSampleTime = now;
+  if (baseline)
+    return;
+
+  for (auto it = groups.begin(); it != groups.end(); ++it)
+    current.threadCpuPercent.append(qMakePair(it.key(), it.value()));
+  std::sort(current.threadCpuPercent.begin(), current.threadCpuPercent.end(),
+            [](const QPair<QString, double>& a, const QPair<QString, double>& b) { return a.second > b.second; });
+
+  if (m_samples.size() >= PROCESS_SAMPLE_HISTORY)
+    m_samples.remove(0);
+  m_samples.append(current);
+
+  if (m_sampleCount++ % PROCESS_SAMPLE_COARSE_EVERY == 0)
+  {
+    if (m_coarseSamples.size() >= PROCESS_SAMPLE_COARSE_HISTORY)
+      m_coarseSamples.remove(0);
+    m_coarseSamples.append(current);
+
+    QLOG_INFO() << "Process:" << qPrintable(formatSample(current, false));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ProcessSampler::formatSample(const Sample& sample, bool threads)
+{
+  QString str = QString("at %1s rss %2MB").arg(sample.time / 1000).arg(sample.residentKB / 1024);
+  if (sample.heapKB >= 0)
+    str += QString(" heap %1MB").arg(sample.heapKB / 1024);
+  if (sample.childResidentKB > 0)
+    str += QString(" children %1MB").arg(sample.childResidentKB / 1024);
+  if (sample.gpuKB >= 0)
+    str += QString(" gpu %1MB").arg(sample.gpuKB / 1024);
+  str += QString(" cpu %1%").arg(sample.cpuPercent, 0, 'f', 1);
+
+  if (threads)
+  {
+    double other = 0;
+    for (int i = 0; i < sample.threadCpuPercent.size(); i++)
+    {
+      const auto& group = sample.threadCpuPercent[i];
+      if (i < PROCESS_SAMPLE_TOP_THREADS)
+        str += QString("\n    %1: %2%").arg(group.first).arg(group.second, 0, 'f', 1);
+      else
+        other += group.second;
+    }
+    if (other > 0)
+      str += QString("\n    other: %1%").arg(other, 0, 'f', 1);
+  }
+
+  return str;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QString ProcessSampler::debugInformation() const
+{
+  if (m_samples.isEmpty())
+    return QString();
+
+  const Sample& first = m_coarseSamples.isEmpty() ? m_samples.first() : m_coarseSamples.first();
+  const Sample& last = m_samples.last();
+
+  QString info = "Process\n  " + formatSample(last, true) + "\n";
+  info += QString("  RSS change since %1s: %2MB\n\n").arg(first.time / 1000)
+          .arg((last.residentKB - first.residentKB) / 1024);
+  return info;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ProcessSampler::dumpToLog() const
+{
+  QLOG_INFO() << "Process samples, coarse:";
+  for (const Sample& sample : m_coarseSamples)
+    QLOG_INFO() << "  " << qPrintable(formatSample(sample, false));
+
+  QLOG_INFO() << "Process samples, last hour:";
+  for (const Sample& sample : m_samples)
+    QLOG_INFO() << "  " << qPrintable(formatSample(sample, &sample == &m_samples.last()));
+}
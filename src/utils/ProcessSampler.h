@@ -0,0 +1,94 @@
+#ifndef PROCESSSAMPLER_H
+#define PROCESSSAMPLER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPair>
+#include <QTimer>
+#include <QVector>
+
+#include <atomic>
+
+#include "utils/Utils.h"
+
+// how often the process is sampled
+#define PROCESS_SAMPLE_MSEC 10000
+// samples kept at full resolution, one hour
+#define PROCESS_SAMPLE_HISTORY 360
+// every this many samples one is kept (and logged) for the long term view
+#define PROCESS_SAMPLE_COARSE_EVERY 60
+// coarse samples kept, one day
+#define PROCESS_SAMPLE_COARSE_HISTORY 144
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Periodically records memory and CPU usage of the whole process: resident size,
+// malloc heap, CPU per thread (grouped by thread name), the QtWebEngine helper
+// processes and GPU memory where the driver tells us. Recent samples are kept at
+// full resolution, older ones thinned out, so slow memory creep over a long
+// running session shows up in the log and the debug overlay.
+//
+// A sample only reads what belongs to our own process, the helpers are found through
+// its children instead of the process list. On Windows there's no per thread list without
+// a snapshot of the whole system, there the process is counted as one.
+//
+class ProcessSampler : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(ProcessSampler);
+
+public:
+  struct Sample
+  {
+    // msecs since the sampler was started
+    qint64 time;
+    qint64 residentKB;
+    // -1 if not available on this platform
+    qint64 heapKB;
+    qint64 childResidentKB;
+    qint64 gpuKB;
+    // whole process, in percent of one core
+    double cpuPercent;
+    // by thread or child process name, busiest first
+    QVector<QPair<QString, double>> threadCpuPercent;
+  };
+
+  void start();
+
+  // Can be called from any thread, e.g. the render thread which has the GL context.
+  void setGpuMemoryKB(qint64 kb) { m_gpuKB = kb; }
+
+  // Cheap enough to call every second.
+  static qint64 currentResidentKB();
+
+  const QVector<Sample>& samples() const { return m_samples; }
+  QString debugInformation() const;
+  void dumpToLog() const;
+
+private:
+  ProcessSampler();
+
+  struct ThreadTime
+  {
+    // thread id, or the negated pid for child processes
+    qint64 id;
+    QString name;
+    qint64 cpuUsec;
+  };
+
+  void sample();
+  static void collectThreads(QVector<ThreadTime>& threads);
+  static void collectMemory(Sample& sample);
+  static QString formatSample(const Sample& sample, bool threads);
+
+  QTimer m_timer;
+  QElapsedTimer m_clock;
+  qint64 m_lastSampleTime;
+  int m_sampleCount;
+  QHash<qint64, qint64> m_lastCpuUsec;
+  QVector<Sample> m_samples;
+  QVector<Sample> m_coarseSamples;
+  std::atomic<qint64> m_gpuKB;
+};
+
+#endif // PROCESSSAMPLER_H
@@ -0,0 +1,186 @@
+#include "StallWatchdog.h"
+
+#include <QDir>
+
+#include "QsLog.h"
+#include "Paths.h"
+#include "Version.h"
+#include "breakpad/BreakPad.h"
+#include "settings/SettingsComponent.h"
+#include "utils/Trace.h"
+#include "utils/Systemd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StallWatchdog::StallWatchdog() : QObject(nullptr), m_pingTimer(this), m_thread(this), m_lastPing(0),
+  m_activity(nullptr), m_threshold(0), m_pingInterval(STALL_WATCHDOG_PING_MSEC), m_systemdInterval(0),
+  m_lastSystemdPing(0), m_dumpCount(0), m_quit(false)
+{
+  m_thread.setObjectName("StallWatchdog");
+  // a few ms late don't matter, and coarse timers can be woken up for together with others
+  m_pingTimer.setTimerType(Qt::CoarseTimer);
+  connect(&m_pingTimer, &QTimer::timeout, this, &StallWatchdog::ping);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+StallWatchdog::~StallWatchdog()
+{
+  stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::start()
+{
+  if (m_pingTimer.isActive())
+    return;
+
+  // twice per interval, as sd_watchdog_enabled(3) suggests
+  m_systemdInterval = Systemd::WatchdogIntervalMsec() / 2;
+  m_threshold = SettingsComponent::Get().value(SETTINGS_SECTION_MAIN, "stallThreshold").toInt();
+  if (m_threshold <= 0 && m_systemdInterval <= 0)
+    return;
+
+  m_pingInterval = m_threshold > 0 ? qBound<qint64>(STALL_WATCHDOG_PING_MSEC, m_threshold / 4, STALL_WATCHDOG_MAX_PING_MSEC)
+                                   : STALL_WATCHDOG_MAX_PING_MSEC;
+  if (m_systemdInterval > 0)
+    m_pingInterval = qMin(m_pingInterval, qMax<qint64>(STALL_WATCHDOG_PING_MSEC, m_systemdInterval));
+
+  m_clock.start();
+  m_lastPing = 0;
+  m_lastSystemdPing = 0;
+  m_pingTimer.start(m_pingInterval);
+
+  if (m_systemdInterval > 0)
+    QLOG_DEBUG() << "Sending systemd watchdog pings every" << m_systemdInterval << "ms";
+
+  if (m_threshold <= 0)
+    return;
+
+  m_dumpPath = Paths::cacheDir("crashdumps/stalls/" + Version::GetCanonicalVersionString());
+  QDir().mkpath(m_dumpPath);
+  pruneDumps();
+
+  Trace::WatchActivity(&m_activity);
+
+  m_quit = false;
+  m_thread.start();
+
+  QLOG_DEBUG() << "Watching for GUI stalls longer than" << m_threshold << "ms";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::stop()
+{
+  m_pingTimer.stop();
+  if (!m_thread.isRunning())
+    return;
+
+  {
+    QMutexLocker lock(&m_lock);
+    m_quit = true;
+    m_wakeup.wakeAll();
+  }
+  m_thread.wait();
+
+  Trace::WatchActivity(nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::ping()
+{
+  qint64 now = m_clock.elapsed();
+  qint64 gap = now - m_lastPing.exchange(now);
+
+  if (m_systemdInterval > 0 && now - m_lastSystemdPing >= m_systemdInterval)
+  {
+    m_lastSystemdPing = now;
+    Systemd::Notify("WATCHDOG=1");
+  }
+
+  // the watchdog logged the start of it, this is where we learn how long it was
+  if (m_threshold > 0 && gap - m_pingInterval >= m_threshold)
+    QLOG_WARN() << "GUI thread was stalled for" << gap - m_pingInterval << "ms";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::watch()
+{
+  QMutexLocker lock(&m_lock);
+
+  bool stalled = false;
+  qint64 lastCheck = m_clock.elapsed();
+
+  while (!m_quit)
+  {
+    m_wakeup.wait(&m_lock, m_pingInterval);
+    if (m_quit)
+      break;
+
+    qint64 now = m_clock.elapsed();
+
+    // If this thread didn't get to run either, the whole process was stopped (system
+    // sleep, a debugger) and the GUI thread deserves another chance.
+    bool overslept = now - lastCheck >= m_threshold;
+    lastCheck = now;
+    if (overslept)
+    {
+      m_lastPing = now;
+      stalled = false;
+      continue;
+    }
+
+    qint64 since = now - m_lastPing;
+    if (since - m_pingInterval < m_threshold)
+    {
+      stalled = false;
+    }
+    else if (!stalled)
+    {
+      stalled = true;
+      lock.unlock();
+      reportStall(since - m_pingInterval);
+      lock.relock();
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::pruneDumps()
+{
+  // Dumps of other versions can't be symbolized against this one anymore.
+  QDir stalls(Paths::cacheDir("crashdumps/stalls"));
+  for (const QString& entry : stalls.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    QDir subdir = stalls;
+    if (entry != Version::GetCanonicalVersionString() && subdir.cd(entry))
+    {
+      QLOG_DEBUG() << "Removing stall dumps of" << entry;
+      subdir.removeRecursively();
+    }
+  }
+
+  // newest first
+  QDir dumps(m_dumpPath);
+  QFileInfoList files = dumps.entryInfoList(QStringList() << "*.dmp", QDir::Files, QDir::Time);
+  for (int i = STALL_WATCHDOG_KEPT_DUMPS - STALL_WATCHDOG_MAX_DUMPS; i < files.size(); i++)
+  {
+    // along with whatever was written next to the dump
+    for (const QString& file : dumps.entryList(QStringList() << files[i].completeBaseName() + ".*", QDir::Files))
+      dumps.remove(file);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void StallWatchdog::reportStall(qint64 msec)
+{
+  const char* activity = m_activity.load(std::memory_order_relaxed);
+
+  QString dump;
+  if (m_dumpCount < STALL_WATCHDOG_MAX_DUMPS)
+  {
+    m_dumpCount++;
+    dump = writeBreakPadSnapshot(m_dumpPath);
+  }
+
+  QLOG_WARN() << "GUI thread not responding for" << msec << "ms, in" << (activity ? activity : "unknown")
+              << "- dump:" << (dump.isEmpty() ? QString("none") : dump);
+}
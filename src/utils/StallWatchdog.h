@@ -0,0 +1,84 @@
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "utils/Utils.h"
+
+// how often the GUI thread reports in, and the watchdog checks on it: a quarter of the
+// stall threshold within these bounds, and often enough for systemd
+#define STALL_WATCHDOG_PING_MSEC 250
+#define STALL_WATCHDOG_MAX_PING_MSEC 1000
+// dumps written per run, a machine that is just slow shouldn't fill the disk
+#define STALL_WATCHDOG_MAX_DUMPS 3
+// dumps kept across runs, the oldest are removed at start so that a run's can be added
+#define STALL_WATCHDOG_KEPT_DUMPS 12
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Watches the GUI event loop from a thread of its own. When the GUI thread doesn't get back
+// to its event loop within main.stallThreshold msecs, a dump with the stacks of all threads
+// is written to crashdumps/stalls in the cache directory and the stall is logged together
+// with the trace scope the GUI thread was in. These dumps stay on the machine, they are not
+// uploaded like crash dumps are. Only the latest few of the current version are kept.
+//
+// When systemd watches the service (WatchdogSec), the GUI thread's pings are also what sends
+// it WATCHDOG=1, so a player whose event loop is hung is restarted. That works regardless of
+// main.stallThreshold.
+//
+class StallWatchdog : public QObject
+{
+  Q_OBJECT
+  DEFINE_SINGLETON(StallWatchdog);
+
+public:
+  ~StallWatchdog() override;
+
+  // Must be called on the GUI thread.
+  void start();
+  void stop();
+
+private:
+  StallWatchdog();
+
+  class WatchThread : public QThread
+  {
+  public:
+    explicit WatchThread(StallWatchdog* watchdog) : m_watchdog(watchdog) {}
+    void run() override { m_watchdog->watch(); }
+
+  private:
+    StallWatchdog* m_watchdog;
+  };
+
+  void ping();
+  void watch();
+  void reportStall(qint64 msec);
+  void pruneDumps();
+
+  QTimer m_pingTimer;
+  QElapsedTimer m_clock;
+  WatchThread m_thread;
+  std::atomic<qint64> m_lastPing;
+  std::atomic<const char*> m_activity;
+
+  qint64 m_threshold;
+  qint64 m_pingInterval;
+  // how often WATCHDOG=1 is sent, 0 if systemd doesn't want it
+  qint64 m_systemdInterval;
+  qint64 m_lastSystemdPing;
+  QString m_dumpPath;
+  int m_dumpCount;
+
+  QMutex m_lock;
+  QWaitCondition m_wakeup;
+  bool m_quit;
+};
+
+#endif // STALLWATCHDOG_H
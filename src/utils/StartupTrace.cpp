@@ -0,0 +1,153 @@
+#include "StartupTrace.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <QSaveFile>
+
+#include "QsLog.h"
+#include "shared/Paths.h"
+#include "Version.h"
+
+struct TraceEvent
+{
+  QString name;
+  const char* category;
+  char phase;
+  qint64 timestamp;
+  quintptr thread;
+};
+
+static QMutex g_traceLock;
+static QVector<TraceEvent> g_traceEvents;
+static bool g_traceFinished = false;
+static QJsonObject g_traceSummary;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static QElapsedTimer& traceClock()
+{
+  // started by the first event, which is at the top of main()
+  static QElapsedTimer clock;
+  if (!clock.isValid())
+    clock.start();
+  return clock;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static void addEvent(const QString& name, const char* category, char phase)
+{
+  QMutexLocker lock(&g_traceLock);
+  if (g_traceFinished)
+    return;
+
+  qint64 timestamp = traceClock().nsecsElapsed() / 1000;
+  g_traceEvents.append({ name, category, phase, timestamp, (quintptr)QThread::currentThreadId() });
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void StartupTrace::Begin(const QString& name, const char* category)
+{
+  addEvent(name, category, 'B');
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void StartupTrace::End(const QString& name, const char* category)
+{
+  addEvent(name, category, 'E');
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void StartupTrace::Finish()
+{
+  QVector<TraceEvent> events;
+  qint64 total;
+  {
+    QMutexLocker lock(&g_traceLock);
+    if (g_traceFinished)
+      return;
+
+    g_traceFinished = true;
+    events.swap(g_traceEvents);
+    total = traceClock().elapsed();
+  }
+
+  // the viewer wants small thread ids, number them by first appearance
+  QVector<quintptr> threads;
+  qint64 pid = QCoreApplication::applicationPid();
+
+  // open begins per thread and name, Begin/End pairs nest but don't cross threads
+  QHash<QPair<quintptr, QString>, QVector<qint64>> open;
+  QJsonObject phases;
+
+  QJsonArray traceEvents;
+  for (const TraceEvent& event : events)
+  {
+    QVector<qint64>& begins = open[qMakePair(event.thread, event.name)];
+    if (event.phase == 'B')
+    {
+      begins.append(event.timestamp);
+    }
+    else if (!begins.isEmpty())
+    {
+      double msec = (event.timestamp - begins.takeLast()) / 1000.0;
+      phases.insert(event.name, phases.value(event.name).toDouble() + msec);
+    }
+
+    int tid = threads.indexOf(event.thread);
+    if (tid < 0)
+    {
+      tid = threads.size();
+      threads.append(event.thread);
+    }
+
+    QJsonObject entry;
+    entry.insert("name", event.name);
+    entry.insert("cat", event.category);
+    entry.insert("ph", QString(QChar(event.phase)));
+    entry.insert("ts", (double)event.timestamp);
+    entry.insert("pid", (double)pid);
+    entry.insert("tid", tid);
+    traceEvents.append(entry);
+  }
+
+  QJsonObject metadata;
+  metadata.insert("version", Version::GetVersionString());
+  metadata.insert("totalMsec", (double)total);
+
+  {
+    QMutexLocker lock(&g_traceLock);
+    g_traceSummary.insert("totalMsec", (double)total);
+    g_traceSummary.insert("phases", phases);
+  }
+
+  QJsonObject trace;
+  trace.insert("traceEvents", traceEvents);
+  trace.insert("displayTimeUnit", QString("ms"));
+  trace.insert("otherData", metadata);
+
+  QString path = Paths::logDir("startup-trace.json");
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly) ||
+      file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) < 0 ||
+      !file.commit())
+  {
+    QLOG_WARN() << "Failed to write startup trace to" << path;
+    return;
+  }
+
+  QLOG_INFO() << "Startup took" << total << "ms, trace written to" << path;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+QJsonObject StartupTrace::Summary()
+{
+  QMutexLocker lock(&g_traceLock);
+  return g_traceSummary;
+}
@@ -0,0 +1,36 @@
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QString>
+#include <QJsonObject>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Records begin/end of the startup phases and writes them as Chrome trace-event JSON
+// (chrome://tracing, about:tracing or Perfetto can open it) to startup-trace.json in the
+// log directory. Only the first startup of the process is traced, anything recorded after
+// Finish() is dropped.
+namespace StartupTrace
+{
+  void Begin(const QString& name, const char* category = "startup");
+  void End(const QString& name, const char* category = "startup");
+  void Finish();
+
+  // After Finish(): {"totalMsec": n, "phases": {name: msec}}, with the time of phases
+  // that ran more than once added up.
+  QJsonObject Summary();
+
+  // Begin() on construction, End() when going out of scope.
+  class Scope
+  {
+  public:
+    explicit Scope(const QString& name, const char* category = "startup")
+      : m_name(name), m_category(category) { Begin(m_name, m_category); }
+    ~Scope() { End(m_name, m_category); }
+
+  private:
+    QString m_name;
+    const char* m_category;
+  };
+}
+
+#endif // STARTUPTRACE_H
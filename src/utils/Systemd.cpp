@@ -0,0 +1,114 @@
+#include "Systemd.h"
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "QsLog.h"
+
+// the first descriptor passed in by socket activation, see sd_listen_fds(3)
+#define SYSTEMD_LISTEN_FDS_START 3
+
+#ifdef Q_OS_LINUX
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// LISTEN_PID and WATCHDOG_PID name the process the variables are meant for, they are
+// inherited by children that aren't.
+static bool isForUs(const char* variable)
+{
+  QByteArray pid = qgetenv(variable);
+  return pid.isEmpty() || pid.toLongLong() == (qlonglong)getpid();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Systemd::Notify(const QByteArray& state)
+{
+  QByteArray path = qgetenv("NOTIFY_SOCKET");
+  if (path.isEmpty())
+    return false;
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= (int)sizeof(address.sun_path))
+    return false;
+  memcpy(address.sun_path, path.constData(), path.size());
+
+  // a leading @ is the abstract namespace
+  if (address.sun_path[0] == '@')
+    address.sun_path[0] = 0;
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  socklen_t length = offsetof(sockaddr_un, sun_path) + path.size();
+  ssize_t sent = sendto(fd, state.constData(), state.size(), MSG_NOSIGNAL, (sockaddr*)&address, length);
+  close(fd);
+
+  if (sent != state.size())
+  {
+    QLOG_WARN() << "Failed to notify systemd of" << state;
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 Systemd::WatchdogIntervalMsec()
+{
+  if (!isForUs("WATCHDOG_PID"))
+    return 0;
+
+  return qMax(qgetenv("WATCHDOG_USEC").toLongLong() / 1000, 0LL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Systemd::TakeListenSocket()
+{
+  int count = qgetenv("LISTEN_FDS").toInt();
+  if (count <= 0 || !isForUs("LISTEN_PID"))
+    return -1;
+
+  qunsetenv("LISTEN_FDS");
+  qunsetenv("LISTEN_PID");
+  qunsetenv("LISTEN_FDNAMES");
+
+  int fd = SYSTEMD_LISTEN_FDS_START;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (count > 1)
+    QLOG_WARN() << "systemd passed in" << count << "sockets, only the first one is used";
+
+  return fd;
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Systemd::Notify(const QByteArray& state)
+{
+  Q_UNUSED(state);
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 Systemd::WatchdogIntervalMsec()
+{
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int Systemd::TakeListenSocket()
+{
+  return -1;
+}
+
+#endif
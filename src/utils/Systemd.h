@@ -0,0 +1,25 @@
+#ifndef SYSTEMD_H
+#define SYSTEMD_H
+
+#include <QByteArray>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The parts of the systemd service protocol we use, without linking libsystemd: sd_notify()
+// state messages to $NOTIFY_SOCKET, the watchdog interval from $WATCHDOG_USEC and sockets
+// passed in by socket activation ($LISTEN_FDS). Without systemd (or not on Linux) these do
+// nothing and report that nothing was passed in.
+namespace Systemd
+{
+  // Sends state ("READY=1", "WATCHDOG=1", ...). Returns false if we weren't started by
+  // systemd with Type=notify or the message couldn't be sent.
+  bool Notify(const QByteArray& state);
+
+  // How often the service has to send WATCHDOG=1, 0 if WatchdogSec isn't set for it.
+  qint64 WatchdogIntervalMsec();
+
+  // Takes the first listening socket systemd passed in, -1 if there is none. There is only
+  // one to take, the environment is cleared so children don't see it.
+  int TakeListenSocket();
+}
+
+#endif // SYSTEMD_H
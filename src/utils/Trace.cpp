@@ -0,0 +1,237 @@
+#include "Trace.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <QSaveFile>
+
+#include "QsLog.h"
+#include "shared/Paths.h"
+#include "Version.h"
+
+struct TraceEvent
+{
+  const char* category;
+  const char* name;
+  qint64 begin;
+  qint64 duration;
+};
+
+// Only the owning thread writes events, it publishes them by bumping head. writeTrace() copies
+// the events behind head and then drops the ones the owner might have overwritten meanwhile.
+struct TraceBuffer
+{
+  QString threadName;
+  std::atomic<quint64> head;
+  TraceEvent events[TRACE_THREAD_EVENTS];
+};
+
+std::atomic<bool> Trace::g_enabled(false);
+thread_local std::atomic<const char*>* Trace::t_activity = nullptr;
+static qint64 g_traceStart = 0;
+
+// buffers are handed to the next new thread when theirs exits, so this doesn't grow
+// with short lived threads
+static QMutex g_bufferLock;
+static QVector<TraceBuffer*> g_buffers;
+static QVector<TraceBuffer*> g_freeBuffers;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+class TraceBufferHolder
+{
+public:
+  ~TraceBufferHolder()
+  {
+    if (m_buffer)
+    {
+      QMutexLocker lock(&g_bufferLock);
+      g_freeBuffers.append(m_buffer);
+    }
+  }
+
+  TraceBuffer* buffer()
+  {
+    if (!m_buffer)
+      m_buffer = acquire();
+    return m_buffer;
+  }
+
+private:
+  static TraceBuffer* acquire()
+  {
+    QString name = QThread::currentThread()->objectName();
+    if (QCoreApplication::instance() && QCoreApplication::instance()->thread() == QThread::currentThread())
+      name = "main";
+
+    QMutexLocker lock(&g_bufferLock);
+    TraceBuffer* buffer;
+    if (!g_freeBuffers.isEmpty())
+    {
+      buffer = g_freeBuffers.takeLast();
+    }
+    else
+    {
+      buffer = new TraceBuffer;
+      g_buffers.append(buffer);
+    }
+
+    buffer->threadName = name;
+    buffer->head.store(0, std::memory_order_release);
+    return buffer;
+  }
+
+  TraceBuffer* m_buffer = nullptr;
+};
+
+static thread_local TraceBufferHolder t_traceBuffer;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+qint64 Trace::Now()
+{
+  static QElapsedTimer clock;
+  static bool started = (clock.start(), true);
+  Q_UNUSED(started);
+  return clock.nsecsElapsed() / 1000;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::AddComplete(const char* category, const char* name, qint64 begin, qint64 end)
+{
+  TraceBuffer* buffer = t_traceBuffer.buffer();
+  quint64 head = buffer->head.load(std::memory_order_relaxed);
+  buffer->events[head % TRACE_THREAD_EVENTS] = { category, name, begin, end - begin };
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::WatchActivity(std::atomic<const char*>* activity)
+{
+  t_activity = activity;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::Start()
+{
+  if (Enabled())
+    return;
+
+  // events from an earlier recording are still in the buffers, they are left out by time
+  g_traceStart = Now();
+  g_enabled = true;
+  QLOG_INFO() << "Started tracing";
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+static void writeTrace()
+{
+  qint64 stop = Trace::Now();
+
+  qint64 pid = QCoreApplication::applicationPid();
+  QJsonArray traceEvents;
+  int tid = 0;
+
+  QMutexLocker lock(&g_bufferLock);
+  for (TraceBuffer* buffer : g_buffers)
+  {
+    quint64 head = buffer->head.load(std::memory_order_acquire);
+    quint64 first = head > TRACE_THREAD_EVENTS ? head - TRACE_THREAD_EVENTS : 0;
+
+    QVector<TraceEvent> events;
+    events.reserve(head - first);
+    for (quint64 i = first; i < head; i++)
+      events.append(buffer->events[i % TRACE_THREAD_EVENTS]);
+
+    // a scope that was open when recording stopped may have wrapped over the oldest ones
+    quint64 newHead = buffer->head.load(std::memory_order_acquire);
+    int overwritten = newHead > first + TRACE_THREAD_EVENTS ? newHead - first - TRACE_THREAD_EVENTS : 0;
+
+    int written = 0;
+    for (int i = overwritten; i < events.size(); i++)
+    {
+      const TraceEvent& event = events.at(i);
+      if (event.begin < g_traceStart || event.begin > stop)
+        continue;
+
+      QJsonObject entry;
+      entry.insert("name", event.name);
+      entry.insert("cat", event.category);
+      entry.insert("ph", QString("X"));
+      entry.insert("ts", (double)event.begin);
+      entry.insert("dur", (double)event.duration);
+      entry.insert("pid", (double)pid);
+      entry.insert("tid", tid);
+      traceEvents.append(entry);
+      written++;
+    }
+
+    if (written)
+    {
+      QJsonObject args;
+      args.insert("name", buffer->threadName.isEmpty() ? QString("thread %1").arg(tid) : buffer->threadName);
+
+      QJsonObject entry;
+      entry.insert("name", QString("thread_name"));
+      entry.insert("ph", QString("M"));
+      entry.insert("pid", (double)pid);
+      entry.insert("tid", tid);
+      entry.insert("args", args);
+      traceEvents.append(entry);
+    }
+
+    tid++;
+  }
+  lock.unlock();
+
+  QJsonObject metadata;
+  metadata.insert("version", Version::GetVersionString());
+  metadata.insert("durationMsec", (double)(stop - g_traceStart) / 1000);
+
+  QJsonObject trace;
+  trace.insert("traceEvents", traceEvents);
+  trace.insert("displayTimeUnit", QString("ms"));
+  trace.insert("otherData", metadata);
+
+  QString path = Paths::logDir("trace.json");
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly) ||
+      file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) < 0 ||
+      !file.commit())
+  {
+    QLOG_WARN() << "Failed to write trace to" << path;
+    return;
+  }
+
+  QLOG_INFO() << "Wrote" << traceEvents.size() << "trace events to" << path;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::Stop()
+{
+  if (!Enabled())
+    return;
+
+  g_enabled = false;
+  QLOG_INFO() << "Stopped tracing";
+  writeTrace();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::Snapshot()
+{
+  if (Enabled())
+    writeTrace();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+void Trace::Toggle()
+{
+  if (Enabled())
+    Stop();
+  else
+    Start();
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+// events kept per thread, when a buffer is full the oldest events are overwritten
+#define TRACE_THREAD_EVENTS 16384
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Records how long instrumented code takes on every thread and writes it as Chrome
+// trace-event JSON (chrome://tracing or Perfetto can open it). Recording is off unless
+// started with --trace or the "trace" host command, until then a scope costs two cheap
+// loads. Every thread writes into its own ring buffer without taking a lock, so only the
+// newest TRACE_THREAD_EVENTS events per thread end up in the trace.
+//
+// Names and categories are not copied and must outlive the trace, string literals are fine.
+namespace Trace
+{
+  extern std::atomic<bool> g_enabled;
+
+  inline bool Enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+  void Start();
+  // Stops recording and writes everything recorded to trace.json in the log directory.
+  void Stop();
+  // Writes the same file while recording goes on.
+  void Snapshot();
+  void Toggle();
+
+  // usec since the trace clock was started
+  qint64 Now();
+  void AddComplete(const char* category, const char* name, qint64 begin, qint64 end);
+
+  // Makes the scopes opened on the calling thread publish their name to activity, whether
+  // tracing or not, so that another thread can tell what this one is busy with.
+  void WatchActivity(std::atomic<const char*>* activity);
+  extern thread_local std::atomic<const char*>* t_activity;
+
+  class Scope
+  {
+  public:
+    Scope(const char* category, const char* name)
+      : m_category(category), m_name(name), m_begin(Enabled() ? Now() : -1), m_previous(nullptr)
+    {
+      if (t_activity)
+        m_previous = t_activity->exchange(name, std::memory_order_relaxed);
+    }
+    ~Scope()
+    {
+      if (m_begin >= 0)
+        AddComplete(m_category, m_name, m_begin, Now());
+      if (t_activity)
+        t_activity->store(m_previous, std::memory_order_relaxed);
+    }
+
+  private:
+    const char* m_category;
+    const char* m_name;
+    qint64 m_begin;
+    const char* m_previous;
+  };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(category, name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(category, name)
+
+#endif // TRACE_H
@@ -8,15 +8,17 @@
 #include <QHostInfo>
 #include <QJsonDocument>
 #include <QVariant>
-#include <qnetworkinterface.h>
 #include <QUuid>
 #include <QFile>
 #include <QSaveFile>
 
 #include <mutex>
+#include <string.h>
 
 #include "settings/SettingsComponent.h"
 #include "settings/SettingsSection.h"
+#include "utils/AssetView.h"
+#include "utils/NetworkState.h"
 
 #include "QsLog.h"
 
@@ -56,30 +58,39 @@ QString Utils::ComputerName()
 /////////////////////////////////////////////////////////////////////////////////////////
 QJsonDocument Utils::OpenJsonDocument(const QString& path, QJsonParseError* err)
 {
-  QFile fp(path);
+  // most of these are resources, parsed in place unless there are comments to drop
+  AssetView view = AssetView::open(path);
+  QByteArray source = view.bytes();
   QByteArray fdata;
-  QRegExp commentMatch("^\\s*//");
+  bool filtered = false;
 
-  if (fp.open(QFile::ReadOnly))
+  int start = 0;
+  while (start < source.size())
   {
-    while(true)
-    {
-      QByteArray row = fp.readLine();
-
-      if (row.isEmpty())
-        break;
+    int end = source.indexOf('\n', start);
+    end = (end < 0) ? source.size() : end + 1;
 
-      // filter all comments
-      if (commentMatch.indexIn(row) != -1)
-        continue;
+    int pos = start;
+    while (pos < end && source.at(pos) && strchr(" \t\r\v\f", source.at(pos)))
+      pos++;
 
-      fdata.append(row);
+    // filter all comments
+    bool comment = (pos + 1 < end && source.at(pos) == '/' && source.at(pos + 1) == '/');
+    if (comment && !filtered)
+    {
+      fdata.reserve(source.size());
+      fdata.append(source.constData(), start);
+      filtered = true;
+    }
+    else if (!comment && filtered)
+    {
+      fdata.append(source.constData() + start, end - start);
     }
 
-    fp.close();
+    start = end;
   }
 
-  return QJsonDocument::fromJson(fdata, err);
+  return QJsonDocument::fromJson(filtered ? fdata : source, err);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -126,20 +137,8 @@ QString Utils::CurrentUserId()
 /////////////////////////////////////////////////////////////////////////////////////////
 QString Utils::PrimaryIPv4Address()
 {
-  QList<QNetworkInterface> ifs = QNetworkInterface::allInterfaces();
-  for(const QNetworkInterface& iface : ifs)
-  {
-    if (iface.isValid() && iface.flags() & QNetworkInterface::IsUp)
-    {
-      QList<QHostAddress> addresses = iface.allAddresses();
-      for(const QHostAddress& addr : addresses)
-      {
-        if (!addr.isLoopback() && !addr.isMulticast() && addr.protocol() == QAbstractSocket::IPv4Protocol)
-          return addr.toString();
-      }
-    }
-  }
-  return "";
+  QHostAddress address = NetworkState::Get().primaryIPv4Address();
+  return address.isNull() ? "" : address.toString();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////